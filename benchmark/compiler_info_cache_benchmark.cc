@@ -0,0 +1,154 @@
+// Copyright 2020 The Goma Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+// Measures cold start of CompilerInfoCache after compiler_proxy exited
+// uncleanly, and shutdown of CompilerInfoCache, with and without journal.
+//
+// The first argument is 1 to use journal, and the second argument is the
+// number of compilers stored in the cache.
+// "reprobes" is the number of compilers lost after unclean exit, which
+// need to be probed again by running the compiler.
+
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <memory>
+#include <string>
+
+#include "absl/memory/memory.h"
+#include "absl/strings/str_cat.h"
+#include "absl/time/clock.h"
+#include "absl/time/time.h"
+#include "benchmark/benchmark.h"
+#include "compiler_info_cache.h"
+#include "compiler_info_state.h"
+#include "compiler_specific.h"
+#include "glog/logging.h"
+#include "unittest_util.h"
+
+MSVC_PUSH_DISABLE_WARNING_FOR_PROTO()
+#include "client/compiler_info_data.pb.h"
+MSVC_POP_WARNING()
+
+namespace devtools_goma {
+
+namespace {
+
+constexpr char kCacheFilename[] = "compiler_info_cache";
+constexpr int kMaxNumEntries = 10000;
+constexpr absl::Duration kCacheHoldingTime = absl::Hours(24 * 30);
+
+// Fake compilers do not exist, so accept any cached CompilerInfo.
+class AlwaysValidValidator : public CompilerInfoCache::CompilerInfoValidator {
+ public:
+  bool Validate(const CompilerInfo& compiler_info,
+                const std::string& local_compiler_path) override {
+    return true;
+  }
+};
+
+void InitCache(const std::string& cache_dir, bool use_journal) {
+  CompilerInfoCache::Init(cache_dir, kCacheFilename, kMaxNumEntries,
+                          kCacheHoldingTime, use_journal);
+  CompilerInfoCache::instance()->SetValidator(new AlwaysValidValidator);
+  CompilerInfoCache::LoadIfEnabled();
+}
+
+void StoreCompilers(int num_compilers) {
+  for (int i = 0; i < num_compilers; ++i) {
+    CompilerInfoCache::Key key;
+    key.base = "-O2 lang:c++ @";
+    key.cwd = "/b/build/agent/work";
+    key.local_compiler_path = absl::StrCat("/usr/bin/g++-", i);
+
+    auto data = absl::make_unique<CompilerInfoData>();
+    data->set_name("g++");
+    data->set_lang("c++");
+    data->set_version(absl::StrCat("g++ (GCC) ", i));
+    data->set_target("x86_64-linux-gnu");
+    data->set_hash(absl::StrCat("hash", i));
+    data->set_local_compiler_path(key.local_compiler_path);
+    data->set_real_compiler_path(key.local_compiler_path);
+    data->set_found(true);
+    data->set_last_used_at(absl::ToTimeT(absl::Now()));
+    data->mutable_cxx()->add_cxx_system_include_paths("/usr/include");
+    ScopedCompilerInfoState state(
+        CompilerInfoCache::instance()->Store(key, std::move(data)));
+  }
+}
+
+}  // namespace
+
+// compiler_proxy stores compilers and is killed without saving the cache
+// file. Only the journal (synced periodically) survives.
+void BM_CompilerInfoCacheColdStartAfterCrash(benchmark::State& state) {
+  const bool use_journal = state.range(0) != 0;
+  const int num_compilers = state.range(1);
+  int reprobes = 0;
+
+  for (auto _ : state) {
+    (void)_;
+    state.PauseTiming();
+    TmpdirUtil tmpdir("compiler_info_cache_benchmark");
+    pid_t pid = fork();
+    PCHECK(pid >= 0) << "fork";
+    if (pid == 0) {
+      InitCache(tmpdir.tmpdir(), use_journal);
+      StoreCompilers(num_compilers);
+      if (use_journal) {
+        // Done by periodic closure in compiler_proxy.
+        CompilerInfoCache::instance()->Flush();
+      }
+      _exit(0);
+    }
+    int status = 0;
+    PCHECK(waitpid(pid, &status, 0) == pid);
+    CHECK(WIFEXITED(status) && WEXITSTATUS(status) == 0) << status;
+    state.ResumeTiming();
+
+    InitCache(tmpdir.tmpdir(), use_journal);
+
+    state.PauseTiming();
+    reprobes += num_compilers - CompilerInfoCache::instance()->Count();
+    CompilerInfoCache::Quit();
+    state.ResumeTiming();
+  }
+
+  state.counters["reprobes"] =
+      benchmark::Counter(reprobes, benchmark::Counter::kAvgIterations);
+}
+BENCHMARK(BM_CompilerInfoCacheColdStartAfterCrash)
+    ->Args({0, 100})
+    ->Args({1, 100})
+    ->Args({0, 1000})
+    ->Args({1, 1000})
+    ->UseRealTime();
+
+// compiler_proxy stores compilers and exits cleanly.
+void BM_CompilerInfoCacheQuit(benchmark::State& state) {
+  const bool use_journal = state.range(0) != 0;
+  const int num_compilers = state.range(1);
+
+  for (auto _ : state) {
+    (void)_;
+    state.PauseTiming();
+    TmpdirUtil tmpdir("compiler_info_cache_benchmark");
+    InitCache(tmpdir.tmpdir(), use_journal);
+    StoreCompilers(num_compilers);
+    state.ResumeTiming();
+
+    CompilerInfoCache::Quit();
+  }
+}
+BENCHMARK(BM_CompilerInfoCacheQuit)
+    ->Args({0, 100})
+    ->Args({1, 100})
+    ->Args({0, 1000})
+    ->Args({1, 1000})
+    ->UseRealTime();
+
+}  // namespace devtools_goma
+
+BENCHMARK_MAIN();
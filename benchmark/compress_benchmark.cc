@@ -0,0 +1,254 @@
+// Copyright 2020 The Goma Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+// Compares compression ratio and CPU time of request encodings on ExecReq.
+//
+// Set GOMA_COMPRESS_BENCHMARK_EXEC_REQ_DIR to a directory of ExecReq
+// captured by compiler_proxy (exec_req.data in the dumped task directories,
+// copied with distinct names).  Synthetic ExecReqs are used if not set.
+//
+// Set GOMA_COMPRESS_BENCHMARK_ZSTD_DICTIONARY to a zstd dictionary to run
+// the zstd dictionary benchmark, e.g. trained by
+//   zstd --train <other exec_req.data files> -o dictionary
+// on requests other than the ones compressed here.
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "absl/memory/memory.h"
+#include "absl/strings/str_cat.h"
+#include "absl/strings/string_view.h"
+#include "benchmark/benchmark.h"
+#include "compress_util.h"
+#include "file_dir.h"
+#include "file_helper.h"
+#include "glog/logging.h"
+#include "google/protobuf/io/gzip_stream.h"
+#include "google/protobuf/io/zero_copy_stream_impl_lite.h"
+#include "lib/goma_data.pb.h"
+#include "path.h"
+
+namespace devtools_goma {
+
+namespace {
+
+constexpr char kExecReqDirEnv[] = "GOMA_COMPRESS_BENCHMARK_EXEC_REQ_DIR";
+constexpr char kZstdDictionaryEnv[] =
+    "GOMA_COMPRESS_BENCHMARK_ZSTD_DICTIONARY";
+
+ExecReq MakeSyntheticExecReq(int i) {
+  ExecReq req;
+  req.mutable_command_spec()->set_name("clang++");
+  req.mutable_command_spec()->set_version("4.2.1[clang version 12.0.0]");
+  req.mutable_command_spec()->set_target("x86_64-unknown-linux-gnu");
+  req.add_arg("clang++");
+  req.add_arg("-c");
+  req.add_arg(absl::StrCat("../../src/foo", i, ".cc"));
+  req.add_arg("-o");
+  req.add_arg(absl::StrCat("obj/src/foo", i, ".o"));
+  for (int j = 0; j < 200; ++j) {
+    req.add_arg(absl::StrCat("-I../../third_party/lib", (i + j) % 300));
+    ExecReq_Input* input = req.add_input();
+    input->set_filename(absl::StrCat("../../src/header", (i * j) % 500, ".h"));
+    input->set_hash_key(absl::StrCat("hash", i * 1000 + j));
+  }
+  req.set_cwd("/home/goma/src/out/Release");
+  return req;
+}
+
+// Returns serialized ExecReqs.
+std::vector<std::string> LoadExecReqs() {
+  std::vector<std::string> reqs;
+  const char* dir = getenv(kExecReqDirEnv);
+  if (dir != nullptr && *dir != '\0') {
+    std::vector<DirEntry> entries;
+    CHECK(ListDirectory(dir, &entries)) << dir;
+    for (const auto& entry : entries) {
+      if (entry.is_dir) {
+        continue;
+      }
+      const std::string filename = file::JoinPath(dir, entry.name);
+      std::string data;
+      ExecReq req;
+      if (!ReadFileToString(filename, &data) || !req.ParseFromString(data)) {
+        LOG(WARNING) << "not ExecReq:" << filename;
+        continue;
+      }
+      reqs.push_back(std::move(data));
+    }
+    LOG(INFO) << "loaded " << reqs.size() << " ExecReqs from " << dir;
+    return reqs;
+  }
+  for (int i = 0; i < 200; ++i) {
+    reqs.push_back(MakeSyntheticExecReq(i).SerializeAsString());
+  }
+  return reqs;
+}
+
+const std::vector<std::string>& ExecReqs() {
+  static const std::vector<std::string>* reqs =
+      new std::vector<std::string>(LoadExecReqs());
+  return *reqs;
+}
+
+// Writes |input| to |stream|, as SerializeToZeroCopyStream does.
+void WriteAll(absl::string_view input,
+              google::protobuf::io::ZeroCopyOutputStream* stream) {
+  while (!input.empty()) {
+    void* data;
+    int size;
+    CHECK(stream->Next(&data, &size));
+    const int n = std::min<size_t>(size, input.size());
+    memcpy(data, input.data(), n);
+    stream->BackUp(size - n);
+    input.remove_prefix(n);
+  }
+}
+
+std::string CompressGzip(
+    absl::string_view input,
+    google::protobuf::io::GzipOutputStream::Format format,
+    int level) {
+  std::string compressed;
+  google::protobuf::io::StringOutputStream output(&compressed);
+  google::protobuf::io::GzipOutputStream::Options options;
+  options.format = format;
+  options.compression_level = level;
+  google::protobuf::io::GzipOutputStream gzip_output(&output, options);
+  WriteAll(input, &gzip_output);
+  CHECK(gzip_output.Close()) << gzip_output.ZlibErrorMessage();
+  return compressed;
+}
+
+#ifdef ENABLE_ZSTD
+std::string CompressZstd(absl::string_view input,
+                         int level,
+                         const ZstdDictionary* dictionary) {
+  std::string compressed;
+  google::protobuf::io::StringOutputStream output(&compressed);
+  ZstdOutputStream::Options options;
+  options.compression_level = level;
+  options.dictionary = dictionary;
+  ZstdOutputStream zstd_output(&output, options);
+  WriteAll(input, &zstd_output);
+  CHECK(zstd_output.Close()) << zstd_output.ErrorMessage();
+  return compressed;
+}
+#endif
+
+#ifdef ENABLE_LZMA
+std::string CompressLzma(absl::string_view input) {
+  std::string compressed;
+  {
+    LZMAOutputStream lzma_output(
+        absl::make_unique<google::protobuf::io::StringOutputStream>(
+            &compressed));
+    WriteAll(input, &lzma_output);
+    CHECK(lzma_output.Close()) << lzma_output.ErrorCode();
+  }
+  return compressed;
+}
+#endif
+
+// Runs |compress| on |reqs| and reports the compression ratio.
+template <typename Compress>
+void RunCompress(benchmark::State& state,
+                 const std::vector<std::string>& reqs,
+                 Compress compress) {
+  if (reqs.empty()) {
+    state.SkipWithError("no ExecReq");
+    return;
+  }
+  int64_t raw_size = 0;
+  int64_t compressed_size = 0;
+  for (const auto& req : reqs) {
+    raw_size += req.size();
+    compressed_size += compress(req).size();
+  }
+
+  for (auto _ : state) {
+    (void)_;
+    for (const auto& req : reqs) {
+      benchmark::DoNotOptimize(compress(req));
+    }
+  }
+
+  state.SetBytesProcessed(state.iterations() * raw_size);
+  state.counters["ratio"] =
+      static_cast<double>(raw_size) / std::max<int64_t>(compressed_size, 1);
+  state.counters["avg_compressed_size"] =
+      static_cast<double>(compressed_size) / reqs.size();
+}
+
+}  // anonymous namespace
+
+void BM_Deflate(benchmark::State& state) {
+  const int level = state.range(0);
+  RunCompress(state, ExecReqs(), [level](absl::string_view req) {
+    return CompressGzip(req, google::protobuf::io::GzipOutputStream::ZLIB,
+                        level);
+  });
+}
+BENCHMARK(BM_Deflate)->Arg(1)->Arg(3)->Arg(6)->Arg(9);
+
+void BM_Gzip(benchmark::State& state) {
+  const int level = state.range(0);
+  RunCompress(state, ExecReqs(), [level](absl::string_view req) {
+    return CompressGzip(req, google::protobuf::io::GzipOutputStream::GZIP,
+                        level);
+  });
+}
+BENCHMARK(BM_Gzip)->Arg(1)->Arg(3)->Arg(6)->Arg(9);
+
+#ifdef ENABLE_LZMA
+void BM_Lzma2(benchmark::State& state) {
+  RunCompress(state, ExecReqs(), CompressLzma);
+}
+BENCHMARK(BM_Lzma2);
+#endif
+
+#ifdef ENABLE_ZSTD
+void BM_Zstd(benchmark::State& state) {
+  const int level = state.range(0);
+  RunCompress(state, ExecReqs(), [level](absl::string_view req) {
+    return CompressZstd(req, level, nullptr);
+  });
+}
+BENCHMARK(BM_Zstd)->Arg(1)->Arg(3)->Arg(6)->Arg(9);
+
+void BM_ZstdWithDictionary(benchmark::State& state) {
+  const int level = state.range(0);
+  const char* dict_path = getenv(kZstdDictionaryEnv);
+  if (dict_path == nullptr) {
+    state.SkipWithError("GOMA_COMPRESS_BENCHMARK_ZSTD_DICTIONARY is not set");
+    return;
+  }
+  std::string dict;
+  if (!ReadFileToString(dict_path, &dict)) {
+    state.SkipWithError("failed to read dictionary");
+    return;
+  }
+  std::unique_ptr<ZstdDictionary> dictionary =
+      ZstdDictionary::Create(dict, level);
+  if (dictionary == nullptr) {
+    state.SkipWithError("failed to load dictionary");
+    return;
+  }
+
+  RunCompress(state, ExecReqs(), [level, &dictionary](absl::string_view req) {
+    return CompressZstd(req, level, dictionary.get());
+  });
+  state.counters["dictionary_size"] = dict.size();
+}
+BENCHMARK(BM_ZstdWithDictionary)->Arg(1)->Arg(3)->Arg(6)->Arg(9);
+#endif
+
+}  // namespace devtools_goma
+
+BENCHMARK_MAIN();
@@ -2,10 +2,15 @@
 // Use of this source code is governed by a BSD-style license that can be
 // found in the LICENSE file.
 
+#include <memory>
 #include <string>
+#include <vector>
 
 #include "benchmark/benchmark.h"
+#include "content.h"
+#include "cxx/include_processor/cpp_directive_parser.h"
 #include "cxx/include_processor/cpp_parser.h"
+#include "cxx/include_processor/directive_filter.h"
 #include "glog/logging.h"
 
 namespace devtools_goma {
@@ -60,6 +65,112 @@ void BM_ReadFunctionMacro(benchmark::State& state) {
 
 BENCHMARK(BM_ReadFunctionMacro)->RangeMultiplier(2)->Range(1, 32);
 
+// Headers that are large and mostly made of non-directive lines.
+// Missing ones are skipped, and the benchmark is skipped if none is found
+// (e.g. on Windows).
+const char* const kSystemHeaders[] = {
+    "/usr/include/stdlib.h",
+    "/usr/include/stdio.h",
+    "/usr/include/unistd.h",
+    "/usr/include/string.h",
+    "/usr/include/signal.h",
+    "/usr/include/x86_64-linux-gnu/sys/socket.h",
+    "/usr/include/linux/input-event-codes.h",
+    "/usr/include/openssl/ssl.h",
+    "/usr/include/c++/10/bits/stl_algo.h",
+    "/usr/include/c++/12/bits/stl_algo.h",
+};
+
+std::vector<std::unique_ptr<Content>> ReadSystemHeaders() {
+  std::vector<std::unique_ptr<Content>> contents;
+  for (const char* path : kSystemHeaders) {
+    std::unique_ptr<Content> content = Content::CreateFromFile(path);
+    if (content) {
+      contents.push_back(std::move(content));
+    }
+  }
+  return contents;
+}
+
+// Makes a header that has |num_lines| lines of code and comments per
+// directive.
+std::unique_ptr<Content> MakeSyntheticHeader(int num_lines) {
+  std::string header;
+  for (int i = 0; i < 256; ++i) {
+    header += "/*\n * Copyright notice and documentation comment.\n */\n";
+    header += "#ifndef FOO_" + std::to_string(i) + "\n";
+    for (int j = 0; j < num_lines; ++j) {
+      header += "  int long_function_name_" + std::to_string(j) +
+                "(const char* arg, size_t size);  // comment\n";
+    }
+    header += "#endif  // FOO_" + std::to_string(i) + "\n";
+  }
+  return Content::CreateFromString(header);
+}
+
+void BM_DirectiveFilterSystemHeaders(benchmark::State& state) {
+  std::vector<std::unique_ptr<Content>> contents = ReadSystemHeaders();
+  if (contents.empty()) {
+    state.SkipWithError("no system headers found");
+    return;
+  }
+
+  int64_t bytes = 0;
+  for (auto _ : state) {
+    (void)_;
+    for (const auto& content : contents) {
+      std::unique_ptr<Content> filtered =
+          DirectiveFilter::MakeFilteredContent(*content);
+      benchmark::DoNotOptimize(filtered);
+      bytes += content->size();
+    }
+  }
+
+  state.SetBytesProcessed(bytes);
+}
+
+BENCHMARK(BM_DirectiveFilterSystemHeaders);
+
+void BM_DirectiveFilterSynthetic(benchmark::State& state) {
+  std::unique_ptr<Content> content = MakeSyntheticHeader(state.range(0));
+
+  for (auto _ : state) {
+    (void)_;
+    std::unique_ptr<Content> filtered =
+        DirectiveFilter::MakeFilteredContent(*content);
+    benchmark::DoNotOptimize(filtered);
+  }
+
+  state.SetBytesProcessed(state.iterations() * content->size());
+}
+
+BENCHMARK(BM_DirectiveFilterSynthetic)->RangeMultiplier(4)->Range(1, 64);
+
+// CppDirectiveParser scans for directives with CppTokenizer::SkipUntilDirective.
+void BM_CppDirectiveParserSystemHeaders(benchmark::State& state) {
+  std::vector<std::unique_ptr<Content>> contents = ReadSystemHeaders();
+  if (contents.empty()) {
+    state.SkipWithError("no system headers found");
+    return;
+  }
+
+  int64_t bytes = 0;
+  for (auto _ : state) {
+    (void)_;
+    for (const auto& content : contents) {
+      CppDirectiveParser parser;
+      CppDirectiveList directives;
+      CHECK(parser.Parse(*content, "a.h", &directives));
+      benchmark::DoNotOptimize(directives);
+      bytes += content->size();
+    }
+  }
+
+  state.SetBytesProcessed(bytes);
+}
+
+BENCHMARK(BM_CppDirectiveParserSystemHeaders);
+
 }  // namespace devtools_goma
 
 BENCHMARK_MAIN();
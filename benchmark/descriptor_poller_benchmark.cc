@@ -0,0 +1,139 @@
+// Copyright 2020 The Goma Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+// Measures CPU time of DescriptorPoller driving many sockets in a
+// WorkerThread, in the request/response pattern used by HttpClient
+// (wait readable, then wait writable once to send a reply).
+//
+// To see the number of syscalls, run with
+//   strace -f -c -e trace=epoll_ctl,epoll_wait ./descriptor_poller_benchmark
+
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <memory>
+#include <vector>
+
+#include "benchmark/benchmark.h"
+#include "callback.h"
+#include "glog/logging.h"
+#include "scoped_fd.h"
+#include "socket_descriptor.h"
+#include "worker_thread.h"
+#include "worker_thread_manager.h"
+
+namespace devtools_goma {
+
+namespace {
+
+void RaiseFileDescriptorLimit() {
+  struct rlimit lim;
+  PCHECK(getrlimit(RLIMIT_NOFILE, &lim) == 0);
+  if (lim.rlim_cur < lim.rlim_max) {
+    lim.rlim_cur = lim.rlim_max;
+    PLOG_IF(WARNING, setrlimit(RLIMIT_NOFILE, &lim) != 0)
+        << "setrlimit(RLIMIT_NOFILE)";
+  }
+}
+
+// Echoes a byte written to each socket pair on a worker thread.
+class EchoServer {
+ public:
+  EchoServer(WorkerThreadManager* wm, int num_sockets)
+      : wm_(wm), num_sockets_(num_sockets) {}
+
+  void Start() {
+    for (int i = 0; i < num_sockets_; ++i) {
+      int fds[2];
+      PCHECK(socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == 0);
+      server_fds_.push_back(fds[0]);
+      client_fds_.emplace_back(fds[1]);
+    }
+    WorkerThreadRunner runner(wm_, FROM_HERE,
+                              NewCallback(this, &EchoServer::Register));
+  }
+
+  void Stop() {
+    WorkerThreadRunner runner(wm_, FROM_HERE,
+                              NewCallback(this, &EchoServer::Unregister));
+  }
+
+  // Sends a byte to every socket and receives replies.
+  void RoundTrip() {
+    char c = 'x';
+    for (const auto& fd : client_fds_) {
+      CHECK_EQ(1, fd.Write(&c, 1));
+    }
+    for (const auto& fd : client_fds_) {
+      CHECK_EQ(1, fd.Read(&c, 1));
+    }
+  }
+
+ private:
+  void Register() {
+    for (int i = 0; i < num_sockets_; ++i) {
+      SocketDescriptor* d = wm_->RegisterSocketDescriptor(
+          ScopedSocket(server_fds_[i]), WorkerThread::PRIORITY_MED);
+      d->NotifyWhenReadable(
+          NewPermanentCallback(this, &EchoServer::DoRead, d));
+      descriptors_.push_back(d);
+    }
+  }
+
+  void Unregister() {
+    for (auto* d : descriptors_) {
+      d->ClearReadable();
+      d->ClearWritable();
+      ScopedSocket fd(wm_->DeleteSocketDescriptor(d));
+    }
+    descriptors_.clear();
+  }
+
+  void DoRead(SocketDescriptor* d) {
+    char c;
+    if (d->Read(&c, 1) != 1) {
+      return;
+    }
+    d->NotifyWhenWritable(
+        NewPermanentCallback(this, &EchoServer::DoWrite, d));
+  }
+
+  void DoWrite(SocketDescriptor* d) {
+    char c = 'y';
+    CHECK_EQ(1, d->Write(&c, 1));
+    d->ClearWritable();
+  }
+
+  WorkerThreadManager* wm_;
+  const int num_sockets_;
+  std::vector<int> server_fds_;
+  std::vector<ScopedSocket> client_fds_;
+  std::vector<SocketDescriptor*> descriptors_;
+};
+
+}  // namespace
+
+void BM_DescriptorPollerEcho(benchmark::State& state) {
+  RaiseFileDescriptorLimit();
+  WorkerThreadManager wm;
+  wm.Start(1);
+  EchoServer server(&wm, state.range(0));
+  server.Start();
+
+  for (auto _ : state) {
+    (void)_;
+    server.RoundTrip();
+  }
+
+  server.Stop();
+  wm.Finish();
+  state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+
+BENCHMARK(BM_DescriptorPollerEcho)->Arg(16)->Arg(256)->Arg(2048)->UseRealTime();
+
+}  // namespace devtools_goma
+
+BENCHMARK_MAIN();
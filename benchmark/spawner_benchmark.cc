@@ -0,0 +1,56 @@
+// Copyright 2020 The Goma Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+// Measures latency to spawn and wait for /bin/true with SpawnerPosix,
+// via a monitor process (fork) and directly (vfork).
+// The argument is size of memory touched by the caller in MB, to see cost
+// of copying page tables in fork.
+
+#include <string.h>
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "benchmark/benchmark.h"
+#include "glog/logging.h"
+#include "spawner_posix.h"
+
+namespace devtools_goma {
+
+namespace {
+
+void SpawnTrue(benchmark::State& state, bool direct_spawn) {
+  const size_t size = static_cast<size_t>(state.range(0)) << 20;
+  std::unique_ptr<char[]> memory(new char[size + 1]);
+  memset(memory.get(), 1, size + 1);
+
+  const std::vector<std::string> args{"/bin/true"};
+  const std::vector<std::string> envs;
+  for (auto _ : state) {
+    (void)_;
+    SpawnerPosix spawner;
+    spawner.SetDirectSpawn(direct_spawn);
+    CHECK_NE(Spawner::kInvalidPid, spawner.Run(args[0], args, envs, "."));
+    spawner.Wait(Spawner::WAIT_INFINITE);
+    CHECK_EQ(0, spawner.ChildStatus());
+  }
+  benchmark::DoNotOptimize(memory.get());
+}
+
+}  // namespace
+
+void BM_SpawnMonitor(benchmark::State& state) {
+  SpawnTrue(state, false);
+}
+BENCHMARK(BM_SpawnMonitor)->Arg(0)->Arg(256)->Arg(1024)->UseRealTime();
+
+void BM_SpawnDirect(benchmark::State& state) {
+  SpawnTrue(state, true);
+}
+BENCHMARK(BM_SpawnDirect)->Arg(0)->Arg(256)->Arg(1024)->UseRealTime();
+
+}  // namespace devtools_goma
+
+BENCHMARK_MAIN();
@@ -0,0 +1,144 @@
+// Copyright 2020 The Goma Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "adaptive_batch_policy.h"
+
+#include <algorithm>
+#include <sstream>
+
+#include "glog/logging.h"
+
+namespace devtools_goma {
+
+namespace {
+
+// Weight of a new sample in the smoothed RTT and delay, as TCP's SRTT.
+constexpr double kDelayGain = 1.0 / 8;
+// The min delay slowly follows the smoothed delay, so that it recovers
+// from a permanent change of the network path.
+constexpr double kMinDelayRecoveryGain = 1.0 / 64;
+// Weight of a new sample in the regression of RTT on request size.
+constexpr double kRegressionGain = 1.0 / 16;
+// Coefficient of variation of request sizes needed for the regression.
+constexpr double kMinSizeVariation = 0.1;
+
+}  // anonymous namespace
+
+AdaptiveBatchPolicy::AdaptiveBatchPolicy(const Options& options)
+    : options_(options),
+      max_req_in_call_(options.max_req_in_call),
+      req_size_threshold_(options.max_req_size_threshold),
+      flush_interval_(options.max_flush_interval) {
+  CHECK_GT(options_.min_req_in_call, 0U);
+  CHECK_LE(options_.min_req_in_call, options_.max_req_in_call);
+  CHECK_LE(options_.min_req_size_threshold, options_.max_req_size_threshold);
+  CHECK_LE(options_.min_flush_interval, options_.max_flush_interval);
+}
+
+void AdaptiveBatchPolicy::OnCallDone(size_t num_req,
+                                     size_t req_size,
+                                     absl::Duration rtt,
+                                     bool ok) {
+  if (ok) {
+    UpdateThroughput(req_size, rtt);
+  }
+  absl::Duration delay = rtt;
+  if (throughput_ > 0) {
+    delay -= absl::Seconds(req_size / throughput_);
+  }
+  delay = std::max(delay, absl::ZeroDuration());
+
+  if (num_samples_++ == 0) {
+    smoothed_rtt_ = rtt;
+    smoothed_delay_ = delay;
+    min_delay_ = delay;
+  } else {
+    smoothed_rtt_ += (rtt - smoothed_rtt_) * kDelayGain;
+    smoothed_delay_ += (delay - smoothed_delay_) * kDelayGain;
+    min_delay_ = std::min(
+        delay,
+        min_delay_ + (smoothed_delay_ - min_delay_) * kMinDelayRecoveryGain);
+  }
+
+  const absl::Duration congestion_delay =
+      std::max(min_delay_ * options_.congestion_delay_ratio,
+               min_delay_ + options_.min_congestion_delay);
+  if (!ok || smoothed_delay_ > congestion_delay) {
+    ++num_congested_;
+    max_req_in_call_ = std::min(max_req_in_call_ * 2,
+                                options_.max_req_in_call);
+    flush_interval_ = std::min(flush_interval_ * 2,
+                               options_.max_flush_interval);
+  } else {
+    ++num_uncongested_;
+    if (max_req_in_call_ > options_.min_req_in_call) {
+      --max_req_in_call_;
+    }
+    flush_interval_ = std::max(flush_interval_ - options_.min_flush_interval,
+                               options_.min_flush_interval);
+  }
+  UpdateReqSizeThreshold();
+  VLOG(2) << "num_req=" << num_req << " " << DebugString();
+}
+
+void AdaptiveBatchPolicy::UpdateThroughput(size_t req_size,
+                                           absl::Duration rtt) {
+  // Exponentially weighted linear regression of RTT on request size.
+  const double x = req_size;
+  const double y = absl::ToDoubleSeconds(rtt);
+  if (num_throughput_samples_++ == 0) {
+    mean_size_ = x;
+    mean_rtt_secs_ = y;
+    return;
+  }
+  const double dx = x - mean_size_;
+  const double dy = y - mean_rtt_secs_;
+  mean_size_ += kRegressionGain * dx;
+  mean_rtt_secs_ += kRegressionGain * dy;
+  var_size_ = (1 - kRegressionGain) * (var_size_ + kRegressionGain * dx * dx);
+  cov_size_rtt_ =
+      (1 - kRegressionGain) * (cov_size_rtt_ + kRegressionGain * dx * dy);
+
+  // Needs enough variation of request sizes to tell transfer time from
+  // delay.  Otherwise, keeps the last estimate.
+  if (var_size_ <= kMinSizeVariation * kMinSizeVariation * mean_size_ *
+                       mean_size_ ||
+      cov_size_rtt_ <= 0) {
+    return;
+  }
+  if (throughput_ == 0) {
+    // Delays so far included transfer time, so start over.
+    num_samples_ = 0;
+  }
+  throughput_ = var_size_ / cov_size_rtt_;
+}
+
+void AdaptiveBatchPolicy::UpdateReqSizeThreshold() {
+  if (throughput_ <= 0) {
+    return;
+  }
+  const double bdp = throughput_ * absl::ToDoubleSeconds(smoothed_rtt_);
+  if (bdp >= options_.max_req_size_threshold) {
+    req_size_threshold_ = options_.max_req_size_threshold;
+    return;
+  }
+  req_size_threshold_ =
+      std::max(static_cast<size_t>(bdp), options_.min_req_size_threshold);
+}
+
+std::string AdaptiveBatchPolicy::DebugString() const {
+  std::ostringstream ss;
+  ss << "max_req_in_call=" << max_req_in_call_
+     << " req_size_threshold=" << req_size_threshold_
+     << " flush_interval=" << flush_interval_
+     << " smoothed_rtt=" << smoothed_rtt_
+     << " smoothed_delay=" << smoothed_delay_
+     << " min_delay=" << min_delay_
+     << " throughput=" << static_cast<int64_t>(throughput_) << "B/s"
+     << " congested=" << num_congested_
+     << " uncongested=" << num_uncongested_;
+  return ss.str();
+}
+
+}  // namespace devtools_goma
@@ -0,0 +1,102 @@
+// Copyright 2020 The Goma Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#ifndef DEVTOOLS_GOMA_CLIENT_ADAPTIVE_BATCH_POLICY_H_
+#define DEVTOOLS_GOMA_CLIENT_ADAPTIVE_BATCH_POLICY_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <string>
+
+#include "absl/time/time.h"
+#include "basictypes.h"
+
+namespace devtools_goma {
+
+// AdaptiveBatchPolicy decides how many requests are packed in one call
+// and how long a request may wait for others to be packed with, from
+// latency and throughput of completed calls.
+//
+// The delay of a call is its RTT minus the time to transfer its request.
+// The throughput is estimated by linear regression of RTT on request size,
+// so a larger batch alone doesn't look like a slow backend.
+// If the smoothed delay grows beyond |congestion_delay_ratio| times the
+// minimum delay, or a call fails, the backend is considered congested and
+// the batch size and the flush interval are doubled, so that it gets fewer
+// and larger calls.  Otherwise they are decreased additively, so that
+// requests don't wait needlessly for an idle backend (like AIMD, applied
+// to the request rate).
+// The request size threshold follows the bandwidth-delay product (bytes
+// sent in a smoothed RTT), since waiting for more bytes than that doesn't
+// improve the throughput.
+//
+// This class is thread-compatible.
+class AdaptiveBatchPolicy {
+ public:
+  struct Options {
+    size_t min_req_in_call = 1;
+    size_t max_req_in_call = 1;
+    size_t min_req_size_threshold = 64 * 1024;
+    size_t max_req_size_threshold = 64 * 1024;
+    absl::Duration min_flush_interval = absl::Milliseconds(5);
+    absl::Duration max_flush_interval = absl::Milliseconds(100);
+    double congestion_delay_ratio = 2.0;
+    // Delay below this is considered as noise.
+    absl::Duration min_congestion_delay = absl::Milliseconds(5);
+  };
+
+  // Starts with the max batch size and the max flush interval, i.e.
+  // the same as the static configuration.
+  explicit AdaptiveBatchPolicy(const Options& options);
+
+  size_t max_req_in_call() const { return max_req_in_call_; }
+  size_t req_size_threshold() const { return req_size_threshold_; }
+  absl::Duration flush_interval() const { return flush_interval_; }
+
+  // Records a call of |num_req| requests of |req_size| bytes in total,
+  // which took |rtt|.  |ok| is false if the call failed.
+  void OnCallDone(size_t num_req, size_t req_size, absl::Duration rtt,
+                  bool ok);
+
+  absl::Duration smoothed_rtt() const { return smoothed_rtt_; }
+  absl::Duration smoothed_delay() const { return smoothed_delay_; }
+  absl::Duration min_delay() const { return min_delay_; }
+  // Estimated throughput in bytes per second, or 0 if unknown yet.
+  double throughput() const { return throughput_; }
+  int64_t num_congested() const { return num_congested_; }
+  int64_t num_uncongested() const { return num_uncongested_; }
+
+  std::string DebugString() const;
+
+ private:
+  void UpdateThroughput(size_t req_size, absl::Duration rtt);
+  void UpdateReqSizeThreshold();
+
+  const Options options_;
+
+  size_t max_req_in_call_;
+  size_t req_size_threshold_;
+  absl::Duration flush_interval_;
+
+  int64_t num_samples_ = 0;
+  absl::Duration smoothed_rtt_;
+  absl::Duration smoothed_delay_;
+  absl::Duration min_delay_;
+  int64_t num_throughput_samples_ = 0;
+  double mean_size_ = 0;
+  double mean_rtt_secs_ = 0;
+  double var_size_ = 0;
+  double cov_size_rtt_ = 0;
+  double throughput_ = 0;
+
+  int64_t num_congested_ = 0;
+  int64_t num_uncongested_ = 0;
+
+  DISALLOW_COPY_AND_ASSIGN(AdaptiveBatchPolicy);
+};
+
+}  // namespace devtools_goma
+
+#endif  // DEVTOOLS_GOMA_CLIENT_ADAPTIVE_BATCH_POLICY_H_
@@ -0,0 +1,135 @@
+// Copyright 2020 The Goma Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "adaptive_batch_policy.h"
+
+#include "gtest/gtest.h"
+
+namespace devtools_goma {
+
+namespace {
+
+// Fake backend, which responds in |delay| plus the time to transfer
+// the request at |bandwidth| bytes per second.
+struct FakeBackend {
+  absl::Duration Rtt(size_t req_size) const {
+    return delay + absl::Seconds(req_size / bandwidth);
+  }
+
+  absl::Duration delay;
+  double bandwidth;
+};
+
+AdaptiveBatchPolicy::Options TestOptions() {
+  AdaptiveBatchPolicy::Options options;
+  options.min_req_in_call = 1;
+  options.max_req_in_call = 128;
+  options.min_req_size_threshold = 64 * 1024;
+  options.max_req_size_threshold = 12 * 1024 * 1024;
+  options.min_flush_interval = absl::Milliseconds(5);
+  options.max_flush_interval = absl::Milliseconds(100);
+  return options;
+}
+
+// Sends full batches of |req_size| requests to |backend| |num_calls| times.
+void RunCalls(const FakeBackend& backend, size_t req_size, int num_calls,
+              AdaptiveBatchPolicy* policy) {
+  for (int i = 0; i < num_calls; ++i) {
+    const size_t num_req = policy->max_req_in_call();
+    const size_t size = num_req * req_size;
+    policy->OnCallDone(num_req, size, backend.Rtt(size), true);
+  }
+}
+
+}  // anonymous namespace
+
+TEST(AdaptiveBatchPolicyTest, InitialIsStaticConfiguration) {
+  AdaptiveBatchPolicy policy(TestOptions());
+  EXPECT_EQ(128U, policy.max_req_in_call());
+  EXPECT_EQ(12U * 1024 * 1024, policy.req_size_threshold());
+  EXPECT_EQ(absl::Milliseconds(100), policy.flush_interval());
+}
+
+TEST(AdaptiveBatchPolicyTest, IdleBackendFlushesSooner) {
+  AdaptiveBatchPolicy policy(TestOptions());
+  const FakeBackend backend{absl::Milliseconds(10), 10e6};
+  RunCalls(backend, 1024, 200, &policy);
+
+  EXPECT_EQ(1U, policy.max_req_in_call());
+  EXPECT_EQ(absl::Milliseconds(5), policy.flush_interval());
+  EXPECT_EQ(0, policy.num_congested());
+}
+
+TEST(AdaptiveBatchPolicyTest, SlowBackendGetsLargerBatches) {
+  AdaptiveBatchPolicy policy(TestOptions());
+  const FakeBackend idle_backend{absl::Milliseconds(10), 10e6};
+  RunCalls(idle_backend, 1024, 200, &policy);
+  ASSERT_EQ(1U, policy.max_req_in_call());
+
+  // The backend becomes slow, e.g. overloaded.
+  const FakeBackend slow_backend{absl::Milliseconds(200), 10e6};
+  RunCalls(slow_backend, 1024, 10, &policy);
+
+  EXPECT_EQ(128U, policy.max_req_in_call());
+  EXPECT_EQ(absl::Milliseconds(100), policy.flush_interval());
+  EXPECT_GT(policy.num_congested(), 0);
+}
+
+TEST(AdaptiveBatchPolicyTest, RecoversFromPermanentLatencyChange) {
+  AdaptiveBatchPolicy policy(TestOptions());
+  const FakeBackend backend{absl::Milliseconds(10), 10e6};
+  RunCalls(backend, 1024, 200, &policy);
+
+  // e.g. network path has changed.  It looks congested for a while, but
+  // the new latency becomes the baseline.
+  const FakeBackend far_backend{absl::Milliseconds(50), 10e6};
+  RunCalls(far_backend, 1024, 1000, &policy);
+
+  EXPECT_EQ(1U, policy.max_req_in_call());
+  EXPECT_EQ(absl::Milliseconds(5), policy.flush_interval());
+}
+
+TEST(AdaptiveBatchPolicyTest, LargeRequestIsNotCongestion) {
+  AdaptiveBatchPolicy policy(TestOptions());
+  // Transfer time dominates RTT.
+  const FakeBackend backend{absl::Milliseconds(2), 10e6};
+  for (int i = 0; i < 100; ++i) {
+    const size_t size = (i % 2 == 0 ? 1 : 2) * 1000 * 1000;
+    policy.OnCallDone(1, size, backend.Rtt(size), true);
+  }
+  EXPECT_EQ(0, policy.num_congested());
+  EXPECT_EQ(absl::Milliseconds(5), policy.flush_interval());
+}
+
+TEST(AdaptiveBatchPolicyTest, ErrorIsCongestion) {
+  AdaptiveBatchPolicy policy(TestOptions());
+  const FakeBackend backend{absl::Milliseconds(10), 10e6};
+  RunCalls(backend, 1024, 200, &policy);
+  ASSERT_EQ(1U, policy.max_req_in_call());
+
+  policy.OnCallDone(1, 1024, backend.Rtt(1024), false);
+  EXPECT_EQ(2U, policy.max_req_in_call());
+  EXPECT_EQ(absl::Milliseconds(10), policy.flush_interval());
+  EXPECT_EQ(1, policy.num_congested());
+}
+
+TEST(AdaptiveBatchPolicyTest, ReqSizeThresholdFollowsBandwidthDelayProduct) {
+  AdaptiveBatchPolicy policy(TestOptions());
+  const FakeBackend backend{absl::Milliseconds(100), 10e6};
+  for (int i = 0; i < 100; ++i) {
+    const size_t size = (i % 2 == 0 ? 500 : 1500) * 1000;
+    policy.OnCallDone(1, size, backend.Rtt(size), true);
+  }
+  EXPECT_NEAR(10e6, policy.throughput(), 1e5);
+  // 10MB/s * 200ms.
+  EXPECT_NEAR(2e6, policy.req_size_threshold(), 2e5);
+
+  // Tiny requests on a tiny RTT.
+  AdaptiveBatchPolicy tiny_policy(TestOptions());
+  const FakeBackend fast_backend{absl::Milliseconds(1), 10e6};
+  RunCalls(fast_backend, 100, 100, &tiny_policy);
+  EXPECT_EQ(64U * 1024, tiny_policy.req_size_threshold());
+}
+
+}  // namespace devtools_goma
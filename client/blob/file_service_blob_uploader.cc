@@ -36,6 +36,20 @@ bool FileServiceBlobUploader::Upload() {
   return false;
 }
 
+bool FileServiceBlobUploader::ForceUpload() {
+  file_service_->set_skip_stored_chunks(false);
+  bool success = Upload();
+  file_service_->set_skip_stored_chunks(true);
+  return success;
+}
+
+bool FileServiceBlobUploader::IsStoredInServer() {
+  if (hash_key_.empty()) {
+    return false;
+  }
+  return file_service_->HasFileBlob(hash_key_);
+}
+
 bool FileServiceBlobUploader::Embed() {
   if (!hash_key_.empty()) {
     // already loaded into blob_.
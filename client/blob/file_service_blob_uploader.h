@@ -24,11 +24,19 @@ class FileServiceBlobUploader : public BlobClient::Uploader {
 
   bool Upload() override;
 
+  bool ForceUpload() override;
+
+  bool IsStoredInServer() override;
+
   bool Embed() override;
 
   const HttpClient::Status& http_status() const override {
     return file_service_->http_rpc_status();
   }
+  FileServiceClient::CreateFileBlobStats create_file_blob_stats()
+      const override {
+    return file_service_->create_file_blob_stats();
+  }
 
   bool GetInput(ExecReq_Input* input) const override;
 
@@ -29,15 +29,18 @@
 #include "compile_stats.h"
 #include "compile_task.h"
 #include "compiler_flags.h"
+#include "compiler_info_probe_stats.h"
 #include "compiler_proxy_histogram.h"
 #include "compiler_proxy_info.h"
 #include "cxx/include_processor/cpp_include_processor.h"
 #include "cxx/include_processor/include_cache.h"
+#include "cxx/include_processor/include_resolution_cache.h"
 #include "deps_cache.h"
 #include "file_hash_cache.h"
 #include "file_helper.h"
 #include "file_path_util.h"
 #include "file_stat.h"
+#include "file_watcher.h"
 #include "glog/logging.h"
 #include "goma_blob.h"
 #include "goma_file_http.h"
@@ -55,6 +58,8 @@
 #include "path.h"
 #include "path_resolver.h"
 #include "rpc_controller.h"
+#include "stored_file_chunk_cache.h"
+#include "task/input_file_task.h"
 #include "util.h"
 #include "watchdog.h"
 #include "worker_thread.h"
@@ -161,6 +166,18 @@ CompileService::~CompileService() {
   ClearTasksUnlocked();
 }
 
+void CompileService::SetFileHashCacheFile(
+    const std::string& cache_filename,
+    absl::optional<absl::Duration> alive_duration) {
+  if (cache_filename.empty()) {
+    LOG(INFO) << "FileHashCache is not persisted.";
+    file_hash_cache_file_.reset();
+    return;
+  }
+  file_hash_cache_file_ = absl::make_unique<CacheFile>(cache_filename);
+  file_hash_cache_->Load(*file_hash_cache_file_, alive_duration);
+}
+
 void CompileService::SetActiveTaskThrottle(int max_active_tasks) {
   AUTOLOCK(lock, &mu_);
   max_active_tasks_ = max_active_tasks;
@@ -202,6 +219,11 @@ void CompileService::SetSubProcessOptionSetter(
   subprocess_option_setter_ = std::move(option_setter);
 }
 
+void CompileService::SetLocalRacePolicy(
+    std::unique_ptr<LocalRacePolicy> policy) {
+  local_race_policy_ = std::move(policy);
+}
+
 void CompileService::SetHttpClient(std::unique_ptr<HttpClient> http_client) {
   http_client_ = std::move(http_client);
 }
@@ -220,6 +242,11 @@ void CompileService::SetMultiFileStore(
   multi_file_store_ = std::move(multi_file_store);
 }
 
+void CompileService::SetMultiFileLookup(
+    std::unique_ptr<MultiFileLookup> multi_file_lookup) {
+  multi_file_lookup_ = std::move(multi_file_lookup);
+}
+
 void CompileService::SetFileServiceHttpClient(
     std::unique_ptr<FileServiceHttpClient> file_service) {
   blob_client_ = absl::make_unique<FileBlobClient>(std::move(file_service));
@@ -339,6 +366,9 @@ void CompileService::ExecDone(WorkerThread::ThreadId thread_id,
 void CompileService::CompileTaskDone(CompileTask* task) {
   task->SetFrozenTimestamp(absl::Now());
   histogram_->UpdateCompileStat(task->stats());
+  if (local_race_policy_ != nullptr) {
+    RecordLocalRace(*task);
+  }
   rbe_stats_mgr_.Accumulate(task);
   if (log_service_client_.get())
     log_service_client_->SaveExecLog(task->stats().exec_log);
@@ -517,9 +547,14 @@ void CompileService::Wait() {
     log_service_client_->Wait();
   log_service_client_.reset();
   histogram_.reset();
+  if (file_hash_cache_file_) {
+    file_hash_cache_->Save(*file_hash_cache_file_);
+  }
   file_hash_cache_.reset();
   if (multi_file_store_.get())
     multi_file_store_->Wait();
+  if (multi_file_lookup_.get())
+    multi_file_lookup_->Wait();
   blob_client_.reset();
   exec_service_client_.reset();
 
@@ -745,6 +780,20 @@ void CompileService::DumpStats(std::ostringstream* ss) {
         << " miss=" << gstats.request_stats().compiler_info().miss()
         << " fail=" << gstats.request_stats().compiler_info().fail()
         << std::endl;
+  if (gstats.request_stats().compiler_info().probes_size() > 0) {
+    const CompilerInfoStats& compiler_info =
+        gstats.request_stats().compiler_info();
+    (*ss) << " compiler_info_probe:"
+          << " batches=" << compiler_info.probe_batches()
+          << " batch_saved=" << compiler_info.probe_batch_saved_ms() << "ms";
+    for (const auto& probe : compiler_info.probes()) {
+      (*ss) << " [" << probe.name() << "]"
+            << " count=" << probe.count()
+            << " total=" << probe.total_ms() << "ms"
+            << " max=" << probe.max_ms() << "ms";
+    }
+    (*ss) << std::endl;
+  }
   (*ss) << " goma:"
         << " finished=" << gstats.request_stats().goma().finished()
         << " cache_hit=" << gstats.request_stats().goma().cache_hit()
@@ -770,6 +819,17 @@ void CompileService::DumpStats(std::ostringstream* ss) {
         << " killed=" << gstats.request_stats().local().killed()
         << " finished=" << gstats.request_stats().local().finished()
         << std::endl;
+  if (gstats.request_stats().local().has_race_started()) {
+    const LocalCompileStats& local = gstats.request_stats().local();
+    (*ss) << " local_race:"
+          << " started=" << local.race_started()
+          << " delayed=" << local.race_delayed()
+          << " local_won=" << local.race_local_won()
+          << " remote_won=" << local.race_remote_won()
+          << " wasted_local=" << local.race_wasted_local_time_ms() << "ms"
+          << " saved_wall=" << local.race_saved_wall_time_ms() << "ms"
+          << std::endl;
+  }
   (*ss) << localrun_ss.str();
   (*ss) << mismatches_ss.str();
   (*ss) << error_ss.str();
@@ -805,8 +865,60 @@ void CompileService::DumpStats(std::ostringstream* ss) {
           << " hit=" << ic_stats.hit()
           << " missed=" << ic_stats.missed()
           << " updated=" << ic_stats.updated()
-          << " evicted=" << ic_stats.evicted() << std::endl;
+          << " evicted=" << ic_stats.evicted()
+          << " contended=" << ic_stats.contended()
+          << " shards=" << ic_stats.shard_stats_size() << std::endl;
+  }
+  if (gstats.has_include_resolution_cache_stats()) {
+    const IncludeResolutionCacheStats& irc_stats =
+        gstats.include_resolution_cache_stats();
+    (*ss) << "include_resolution_cache:"
+          << " entries=" << irc_stats.total_entries()
+          << " hit=" << irc_stats.hit()
+          << " missed=" << irc_stats.missed()
+          << " invalidated=" << irc_stats.invalidated() << std::endl;
+  }
+  if (FileWatcher::IsEnabled()) {
+    const FileWatcher* watcher = FileWatcher::instance();
+    (*ss) << "file_watcher:"
+          << " watches=" << watcher->num_watches()
+          << " events=" << watcher->num_events()
+          << " overflows=" << watcher->num_overflows()
+          << " watch_failures=" << watcher->num_watch_failures() << std::endl;
+  }
+  if (StoredFileChunkCache::IsEnabled()) {
+    StoredFileChunkCache* chunk_cache = StoredFileChunkCache::instance();
+    const int64_t hit = chunk_cache->hit();
+    const int64_t missed = chunk_cache->missed();
+    const int64_t total = hit + missed;
+    (*ss) << "stored_file_chunk_cache:"
+          << " entries=" << chunk_cache->size()
+          << " hit=" << hit
+          << " missed=" << missed
+          << " dedup_ratio=" << (total > 0 ? 100 * hit / total : 0) << "%"
+          << std::endl;
+  }
+  if (multi_file_store_ != nullptr) {
+    const std::string policy = multi_file_store_->BatchPolicyDebugString();
+    if (!policy.empty()) {
+      (*ss) << "multi_file_store: " << policy << std::endl;
+    }
+  }
+  if (multi_file_lookup_ != nullptr) {
+    const std::string policy = multi_file_lookup_->BatchPolicyDebugString();
+    if (!policy.empty()) {
+      (*ss) << "multi_file_lookup: " << policy << std::endl;
+    }
   }
+  (*ss) << "input_file_upload_skipped:"
+        << " joined=" << gstats.file_stats().upload_joined()
+        << " joined_bytes=" << gstats.file_stats().upload_joined_bytes()
+        << " found_stored=" << gstats.file_stats().upload_found_stored()
+        << " found_stored_bytes="
+        << gstats.file_stats().upload_found_stored_bytes()
+        << " lookup=" << gstats.file_stats().lookup_before_store()
+        << " lookup_rpc=" << gstats.file_stats().lookup_before_store_rpc()
+        << std::endl;
   if (gstats.has_depscache_stats()) {
     const DepsCacheStats& dc_stats = gstats.depscache_stats();
     (*ss) << "depscache:"
@@ -865,6 +977,22 @@ void CompileService::DumpStats(std::ostringstream* ss) {
         << " timeout=" << gstats.http_rpc_stats().timeout()
         << " error=" << gstats.http_rpc_stats().error()
         << std::endl;
+  if (gstats.http_rpc_stats().exec_hedged() > 0) {
+    const HttpRPCStats& http_rpc_stats = gstats.http_rpc_stats();
+    const int64_t query = http_rpc_stats.exec_query();
+    const int64_t hedged = http_rpc_stats.exec_hedged();
+    const int64_t won = http_rpc_stats.exec_hedge_won();
+    (*ss) << "exec_hedge:"
+          << " query=" << query
+          << " hedged=" << hedged
+          << " hedge_rate=" << (query > 0 ? 100 * hedged / query : 0) << "%"
+          << " won=" << won
+          << " win_rate=" << 100 * won / hedged << "%"
+          << " budget_exhausted="
+          << http_rpc_stats.exec_hedge_budget_exhausted()
+          << " delay=" << http_rpc_stats.exec_hedge_delay_ms() << "ms"
+          << std::endl;
+  }
 
   if (gstats.has_subprocess_stats()) {
     (*ss) << "burst_mode:"
@@ -873,6 +1001,18 @@ void CompileService::DumpStats(std::ostringstream* ss) {
           << " by_compiler_disabled="
           << gstats.subprocess_stats().count_burst_by_compiler_disabled()
           << std::endl;
+    if (gstats.subprocess_stats().has_heavy_weight_mem_kb()) {
+      (*ss) << "local_scheduler:"
+            << " deferred_by_memory="
+            << gstats.subprocess_stats().count_deferred_by_memory()
+            << " deferred_by_cpu="
+            << gstats.subprocess_stats().count_deferred_by_cpu()
+            << " heavy_weight_mem="
+            << gstats.subprocess_stats().heavy_weight_mem_kb() << "KB"
+            << " light_weight_mem="
+            << gstats.subprocess_stats().light_weight_mem_kb() << "KB"
+            << std::endl;
+    }
   }
 }
 
@@ -1388,6 +1528,43 @@ void CompileService::RecordOutputRename(bool rename) {
   }
 }
 
+void CompileService::RecordLocalRace(const CompileTask& task) {
+  const std::string& key = task.race_key();
+  if (key.empty()) {
+    return;
+  }
+  // The side that lost a race is recorded with its elapsed time as a lower
+  // bound, or only the winners would be learned.
+  const CompileStats& stats = task.stats();
+  if (task.state() == CompileTask::FINISHED) {
+    // The same as remote time in GetEstimatedSubprocessDelayTime.
+    local_race_policy_->RecordRemote(
+        key, stats.include_fileload_time + stats.total_rpc_call_time +
+                 stats.file_response_time);
+  } else if (task.abort() &&
+             task.remote_lower_bound() > absl::ZeroDuration()) {
+    local_race_policy_->RecordRemoteLowerBound(key,
+                                               task.remote_lower_bound());
+  }
+  if (task.local_run() && stats.local_run_time > absl::ZeroDuration()) {
+    if (task.local_killed()) {
+      local_race_policy_->RecordLocalLowerBound(key, stats.local_run_time);
+    } else {
+      local_race_policy_->RecordLocal(key, stats.local_run_time);
+    }
+  }
+  if (!task.local_raced()) {
+    return;
+  }
+  if (task.state() == CompileTask::LOCAL_FINISHED || task.abort()) {
+    local_race_policy_->RecordRace(key, true, stats.handler_time,
+                                   stats.local_run_time);
+  } else if (task.local_killed()) {
+    local_race_policy_->RecordRace(key, false, stats.handler_time,
+                                   stats.local_run_time);
+  }
+}
+
 absl::Duration CompileService::GetEstimatedSubprocessDelayTime() {
   static int count = 0;
   static absl::Duration delay = absl::ZeroDuration();
@@ -1569,6 +1746,8 @@ void CompileService::DumpCommonStatsUnlocked(GomaStats* stats) {
         CompilerInfoCache::instance()->Count());
     request->mutable_compiler_info()->set_loaded_size_bytes(
         CompilerInfoCache::instance()->LoadedSize());
+    CompilerInfoProbeStats::instance()->DumpStatsToProto(
+        request->mutable_compiler_info());
     request->mutable_goma()->set_finished(num_exec_goma_finished_);
     request->mutable_goma()->set_cache_hit(num_exec_goma_cache_hit_);
     request->mutable_goma()->set_local_cache_hit(
@@ -1579,6 +1758,9 @@ void CompileService::DumpCommonStatsUnlocked(GomaStats* stats) {
     request->mutable_local()->set_run(num_exec_local_run_);
     request->mutable_local()->set_killed(num_exec_local_killed_);
     request->mutable_local()->set_finished(num_exec_local_finished_);
+    if (local_race_policy_ != nullptr) {
+      local_race_policy_->DumpStatsToProto(request->mutable_local());
+    }
     // TODO: local run reason.  list up enum and show with it.
     //                    might need to avoid string field for privacy reason.
     // TODO: error reason. make it enum & show.
@@ -1602,6 +1784,15 @@ void CompileService::DumpCommonStatsUnlocked(GomaStats* stats) {
     files->set_uploaded(num_file_uploaded_);
     files->set_missed(num_file_missed_);
     files->set_dropped(num_file_dropped_);
+    files->set_upload_joined(InputFileTask::num_uploads_joined());
+    files->set_upload_joined_bytes(InputFileTask::upload_bytes_joined());
+    files->set_upload_found_stored(InputFileTask::num_uploads_found_stored());
+    files->set_upload_found_stored_bytes(
+        InputFileTask::upload_bytes_found_stored());
+    if (multi_file_lookup_ != nullptr) {
+      files->set_lookup_before_store(multi_file_lookup_->num_requests());
+      files->set_lookup_before_store_rpc(multi_file_lookup_->num_http_calls());
+    }
     OutputStats* outputs = stats->mutable_output_stats();
     outputs->set_files(num_file_output_);
     outputs->set_rename(num_file_rename_output_);
@@ -1628,6 +1819,10 @@ void CompileService::DumpCommonStatsUnlocked(GomaStats* stats) {
       IncludeCache::instance()->DumpStatsToProto(
           stats->mutable_includecache_stats());
     }
+    if (IncludeResolutionCache::IsEnabled()) {
+      IncludeResolutionCache::instance()->DumpStatsToProto(
+          stats->mutable_include_resolution_cache_stats());
+    }
     if (DepsCache::IsEnabled()) {
       DepsCache::instance()->DumpStatsToProto(stats->mutable_depscache_stats());
     }
@@ -1636,6 +1831,11 @@ void CompileService::DumpCommonStatsUnlocked(GomaStats* stats) {
           stats->mutable_local_output_cache_stats());
     }
     http_rpc_->DumpStatsToProto(stats->mutable_http_rpc_stats());
+    if (exec_service_client_ != nullptr &&
+        exec_service_client_->hedge_policy() != nullptr) {
+      exec_service_client_->hedge_policy()->DumpStatsToProto(
+          stats->mutable_http_rpc_stats());
+    }
     subprocess_option_setter_->DumpStatsToProto(
         stats->mutable_subprocess_stats());
 
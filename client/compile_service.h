@@ -26,6 +26,7 @@
 #include "compiler_type_specific.h"
 #include "compiler_type_specific_collection.h"
 #include "get_compiler_info_param.h"
+#include "local_race_policy.h"
 #include "lockhelper.h"
 #include "rbe/stats_manager.h"
 #include "subprocess_option_setter.h"
@@ -50,6 +51,7 @@ class GomaStats;
 class HttpClient;
 class HttpRPC;
 class LogServiceClient;
+class MultiFileLookup;
 class MultiFileStore;
 class RpcController;
 
@@ -118,6 +120,12 @@ class CompileService {
   void SetSubProcessOptionSetter(
       std::unique_ptr<SubProcessOptionSetter> option_setter);
 
+  void SetLocalRacePolicy(std::unique_ptr<LocalRacePolicy> policy);
+  // Returns nullptr if local race is not decided by history.
+  LocalRacePolicy* local_race_policy() const {
+    return local_race_policy_.get();
+  }
+
   void SetHttpClient(std::unique_ptr<HttpClient> http_client);
   HttpClient* http_client() const { return http_client_.get(); }
 
@@ -135,11 +143,21 @@ class CompileService {
     return multi_file_store_.get();
   }
 
+  void SetMultiFileLookup(std::unique_ptr<MultiFileLookup> multi_file_lookup);
+  MultiFileLookup* multi_file_lookup() const {
+    return multi_file_lookup_.get();
+  }
+
   void SetFileServiceHttpClient(
       std::unique_ptr<FileServiceHttpClient> file_service);
   BlobClient* blob_client() const;
 
   FileHashCache* file_hash_cache() const { return file_hash_cache_.get(); }
+  // Loads FileHashCache from |cache_filename|, and saves it to the file
+  // in Wait(). Snapshot older than |alive_duration| is ignored.
+  // If |cache_filename| is empty, FileHashCache is not persisted.
+  void SetFileHashCacheFile(const std::string& cache_filename,
+                            absl::optional<absl::Duration> alive_duration);
   CompilerProxyHistogram* histogram() const { return histogram_.get(); }
 
   void StartIncludeProcessorWorkers(int num_threads);
@@ -381,6 +399,7 @@ class CompileService {
   void RecordOutputRename(bool rename);
 
   // Returns duration to delay subprocess setup.
+  // Used if local_race_policy() doesn't know the command yet.
   absl::Duration GetEstimatedSubprocessDelayTime();
 
   void DumpErrorStatus(std::ostringstream* ss);
@@ -414,6 +433,9 @@ class CompileService {
 
   void ClearTasksUnlocked();
 
+  // Records durations and the race result of |task| to local_race_policy_.
+  void RecordLocalRace(const CompileTask& task);
+
   const CompileTask* FindTaskByIdUnlocked(int task_id, bool include_active);
 
   void DumpCommonStatsUnlocked(GomaStats* stats)
@@ -462,11 +484,13 @@ class CompileService {
   std::string compiler_proxy_id_prefix_;
 
   std::unique_ptr<SubProcessOptionSetter> subprocess_option_setter_;
+  std::unique_ptr<LocalRacePolicy> local_race_policy_;
   std::unique_ptr<HttpClient> http_client_;
   std::unique_ptr<HttpRPC> http_rpc_;
 
   std::unique_ptr<ExecServiceClient> exec_service_client_;
   std::unique_ptr<MultiFileStore> multi_file_store_;
+  std::unique_ptr<MultiFileLookup> multi_file_lookup_;
   std::unique_ptr<BlobClient> blob_client_;
 
   std::unique_ptr<CompilerTypeSpecificCollection>
@@ -480,6 +504,7 @@ class CompileService {
       compiler_info_waiters_ ABSL_GUARDED_BY(compiler_info_mu_);
 
   std::unique_ptr<FileHashCache> file_hash_cache_;
+  std::unique_ptr<CacheFile> file_hash_cache_file_;
 
   int include_processor_pool_;
 
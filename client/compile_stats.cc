@@ -310,6 +310,12 @@ void CompileStats::DumpToJson(Json::Value* json,
                                  this->include_fileload_pending_time, json);
     StoreDurationToJsonIfNotZero("include_fileload_run_time",
                                  this->include_fileload_run_time, json);
+    StoreDurationToJsonIfNotZero("input_file_read_time",
+                                 this->input_file_read_time, json);
+    StoreDurationToJsonIfNotZero("input_file_hash_time",
+                                 this->input_file_hash_time, json);
+    StoreDurationToJsonIfNotZero("input_file_store_time",
+                                 this->input_file_store_time, json);
     StoreDurationToJsonIfNotZero("rpc_call_time", this->total_rpc_call_time,
                                  json);
     StoreDurationToJsonIfNotZero("file_response_time",
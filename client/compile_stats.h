@@ -94,6 +94,10 @@ class CompileStats {
   absl::Duration include_fileload_time;
   absl::Duration include_fileload_pending_time;
   absl::Duration include_fileload_run_time;
+  // Time to create blobs of input files, summed over input files.
+  absl::Duration input_file_read_time;
+  absl::Duration input_file_hash_time;
+  absl::Duration input_file_store_time;
 
   // in CALL_EXEC.  repeated by retry.
   absl::Duration total_rpc_call_time;
@@ -536,6 +536,9 @@ TEST(CompileStatsTest, DumpToJsonDetailedDurations) {
   stats.include_fileload_time = absl::Milliseconds(200);
   stats.include_fileload_pending_time = absl::Milliseconds(300);
   stats.include_fileload_run_time = absl::Milliseconds(400);
+  stats.input_file_read_time = absl::Milliseconds(410);
+  stats.input_file_hash_time = absl::Milliseconds(420);
+  stats.input_file_store_time = absl::Milliseconds(430);
   stats.total_rpc_call_time = absl::Milliseconds(500);
   stats.file_response_time = absl::Milliseconds(600);
 
@@ -558,7 +561,7 @@ TEST(CompileStatsTest, DumpToJsonDetailedDurations) {
   stats.DumpToJson(&json, CompileStats::DumpDetailLevel::kDetailed);
 
   // "major_factor" is an extra field that is not explicitly set.
-  EXPECT_EQ(20, json.getMemberNames().size()) << json.toStyledString();
+  EXPECT_EQ(23, json.getMemberNames().size()) << json.toStyledString();
   EXPECT_TRUE(json.isMember("major_factor"));
 
   // Extract string value for each key and store it in |json_string_values|.
@@ -570,6 +573,9 @@ TEST(CompileStatsTest, DumpToJsonDetailedDurations) {
     "include_fileload_time",
     "include_fileload_pending_time",
     "include_fileload_run_time",
+    "input_file_read_time",
+    "input_file_hash_time",
+    "input_file_store_time",
     "rpc_call_time",
     "file_response_time",
     "exec_throttle_time",
@@ -599,6 +605,9 @@ TEST(CompileStatsTest, DumpToJsonDetailedDurations) {
   EXPECT_EQ("200 ms", json_string_values["include_fileload_time"]);
   EXPECT_EQ("300 ms", json_string_values["include_fileload_pending_time"]);
   EXPECT_EQ("400 ms", json_string_values["include_fileload_run_time"]);
+  EXPECT_EQ("410 ms", json_string_values["input_file_read_time"]);
+  EXPECT_EQ("420 ms", json_string_values["input_file_hash_time"]);
+  EXPECT_EQ("430 ms", json_string_values["input_file_store_time"]);
   EXPECT_EQ("500 ms", json_string_values["rpc_call_time"]);
   EXPECT_EQ("600 ms", json_string_values["file_response_time"]);
   EXPECT_EQ("700 ms", json_string_values["exec_throttle_time"]);
@@ -30,6 +30,7 @@
 #include "absl/strings/str_join.h"
 #include "absl/strings/str_split.h"
 #include "absl/time/clock.h"
+#include "absl/types/optional.h"
 #include "autolock_timer.h"
 #include "callback.h"
 #include "clang_tidy_flags.h"
@@ -501,6 +502,11 @@ void CompileTask::Start() {
   verify_output_ = ShouldVerifyOutput();
   should_fallback_ = ShouldFallback();
   subproc_weight_ = GetTaskWeight();
+  // Heavy tasks never race locally, so their durations are not learned,
+  // and must not skew the durations of the other tasks of the compiler.
+  if (subproc_weight_ != SubProcessReq::HEAVY_WEIGHT) {
+    race_key_ = local_compiler_path_;
+  }
   int ramp_up = service_->http_client()->ramp_up();
 
   if (verify_output_) {
@@ -546,9 +552,27 @@ void CompileTask::Start() {
     if (service_->local_run_for_failed_input()) {
       is_failed_input = service_->ContainFailedInput(flags_->input_filenames());
     }
+    absl::optional<absl::Duration> race_delay;
+    if (service_->local_race_policy() != nullptr && !is_failed_input &&
+        service_->http_client()->IsHealthyRecently()) {
+      race_delay = service_->local_race_policy()->LocalRunDelay(
+          race_key_, num_pending_subprocs);
+      prefer_local_run_ =
+          service_->local_race_policy()->PreferLocal(race_key_);
+    }
     const absl::Duration subproc_delay =
-        service_->GetEstimatedSubprocessDelayTime();
-    if (num_pending_subprocs == 0) {
+        race_delay.has_value() ? *race_delay
+                               : service_->GetEstimatedSubprocessDelayTime();
+    if (race_delay.has_value()) {
+      if (*race_delay <= absl::ZeroDuration()) {
+        stats_->exec_log.set_local_run_reason("local faster than goma");
+        SetupSubProcess();
+      } else {
+        stats_->exec_log.set_local_run_reason(
+            "should not run until goma gets slow");
+        DelaySetupSubProcess(subproc_delay);
+      }
+    } else if (num_pending_subprocs == 0) {
       stats_->exec_log.set_local_run_reason("local idle");
       SetupSubProcess();
     } else if (is_failed_input) {
@@ -564,19 +588,7 @@ void CompileTask::Start() {
     } else {
       stats_->exec_log.set_local_run_reason(
           "should not run while delaying subproc");
-      stats_->exec_log.set_local_delay_time(
-          absl::ToInt64Milliseconds(subproc_delay));
-      stats_->local_delay_time = subproc_delay;
-      VLOG(1) << trace_id_ << " subproc_delay=" << subproc_delay;
-      DCHECK(delayed_setup_subproc_ == nullptr) << trace_id_ << " subproc";
-      delayed_setup_subproc_ =
-          service_->wm()->RunDelayedClosureInThread(
-              FROM_HERE,
-              thread_id_,
-              subproc_delay,
-              NewCallback(
-                  this,
-                  &CompileTask::SetupSubProcess));
+      DelaySetupSubProcess(subproc_delay);
     }
   } else {
     stats_->exec_log.set_local_run_reason(
@@ -1070,7 +1082,7 @@ void CompileTask::ProcessCallExec() {
   ModifyRequestCWDAndPWD();
 
   service_->exec_service_client()->ExecAsync(
-      req_.get(), exec_resp_.get(), http_rpc_status_.get(),
+      req_, exec_resp_.get(), http_rpc_status_.get(),
       NewCallback(this, &CompileTask::ProcessCallExecDone));
 
   last_req_timestamp_ = absl::Now();
@@ -1087,6 +1099,10 @@ void CompileTask::ProcessCallExecDone() {
   VLOG(1) << trace_id_ << " call exec done";
   CHECK(BelongsToCurrentThread());
   CHECK_EQ(CALL_EXEC, state_);
+  if (req_.use_count() > 1) {
+    // A hedged request is still using |req_|, so copy it to modify.
+    req_ = std::make_shared<ExecReq>(*req_);
+  }
   exit_status_ = exec_resp_->result().exit_status();
   resp_->Swap(exec_resp_.get());
   exec_resp_.reset();
@@ -1435,7 +1451,7 @@ void CompileTask::ProcessFileResponse() {
     std::unique_ptr<OutputFileTask> output_file_task(new OutputFileTask(
         service_->wm(),
         service_->blob_client()->NewDownloader(requester_info_, trace_id_),
-        this, i, resp_->result().output(i), output_info));
+        this, i, resp_->mutable_result()->mutable_output(i), output_info));
 
     OutputFileTask* output_file_task_pointer = output_file_task.get();
     closures.push_back(
@@ -2638,6 +2654,9 @@ bool CompileTask::ShouldStopGoma() const {
     }
     if (service_->local_run_preference() >= state_)
       return true;
+    // Local run of this command usually finishes earlier than goma.
+    if (prefer_local_run_)
+      return true;
   }
   if (stats_->exec_log.exec_request_retry() > 1) {
     int num_pending = SubProcessTask::NumPending();
@@ -3531,6 +3550,11 @@ void CompileTask::InputFileTaskFinished(InputFileTask* input_file_task) {
       input_file_task->http_status();
   stats_->input_file_rpc_size += http_status.req_size;
   stats_->input_file_rpc_raw_size += http_status.raw_req_size;
+  const FileServiceClient::CreateFileBlobStats blob_stats =
+      input_file_task->create_file_blob_stats();
+  stats_->input_file_read_time += blob_stats.read_time;
+  stats_->input_file_hash_time += blob_stats.hash_time;
+  stats_->input_file_store_time += blob_stats.store_time;
   input_file_task->Done(this);
 }
 
@@ -4293,6 +4317,21 @@ void CompileTask::RunSubProcess(const std::string& reason) {
           << subproc_->req().DebugString();
 }
 
+void CompileTask::DelaySetupSubProcess(absl::Duration delay) {
+  stats_->exec_log.set_local_delay_time(absl::ToInt64Milliseconds(delay));
+  stats_->local_delay_time = delay;
+  VLOG(1) << trace_id_ << " subproc_delay=" << delay;
+  DCHECK(delayed_setup_subproc_ == nullptr) << trace_id_ << " subproc";
+  delayed_setup_subproc_ =
+      service_->wm()->RunDelayedClosureInThread(
+          FROM_HERE,
+          thread_id_,
+          delay,
+          NewCallback(
+              this,
+              &CompileTask::SetupSubProcess));
+}
+
 void CompileTask::KillSubProcess() {
   // TODO: support the case subprocess is killed by FAIL_FAST.
   VLOG(1) << trace_id_ << " KillSubProcess";
@@ -4506,6 +4545,11 @@ void CompileTask::FinishSubProcess() {
   // otherwise, local finishes earlier than remote, or setup.
   if (!local_run_goma_failure) {
     abort_ = true;
+    if (state_ >= FILE_REQ) {
+      // Remote time is measured after include processing.
+      remote_lower_bound_ =
+          include_timer_.GetDuration() - stats_->include_preprocess_time;
+    }
     VLOG(2) << trace_id_ << " idle fallback:" << resp_->DebugString();
     resp_->clear_error_message();
     ReplyResponse("local finish, abort goma");
@@ -107,6 +107,14 @@ class CompileTask {
   bool abort() const { return abort_; }
   bool local_run() const { return local_run_; }
   bool local_killed() const { return local_killed_; }
+  // Returns true if local run raced against remote compile.
+  bool local_raced() const { return local_run_ && !should_fallback_; }
+  // Key of the command to learn remote and local durations, or empty if
+  // they are not learned.
+  const std::string& race_key() const { return race_key_; }
+  // Remote time elapsed when the local run finished first and aborted the
+  // remote compile.  Zero if it was aborted before include processing.
+  absl::Duration remote_lower_bound() const { return remote_lower_bound_; }
   bool fail_fallback() const { return fail_fallback_; }
   bool cache_hit() const;
   bool local_cache_hit() const;
@@ -335,6 +343,8 @@ class CompileTask {
   // ----------------------------------------------------------------
   // Sets subprocess for local run.  The subprocess becomes ready to run.
   void SetupSubProcess();
+  // Sets subprocess for local run after |delay|.
+  void DelaySetupSubProcess(absl::Duration delay);
 
   // Runs subprocess in high priority with reason.
   void RunSubProcess(const std::string& reason);
@@ -382,10 +392,15 @@ class CompileTask {
   bool abort_ = false;  // local proc finished first.
   bool finished_ = false;  // remote call finished (no active remote calls).
 
-  std::unique_ptr<ExecReq> req_;
+  // Shared with ExecServiceClient while calling exec.
+  std::shared_ptr<ExecReq> req_;
   CommandSpec command_spec_;
   ScopedCompilerInfoState compiler_info_state_;
   std::string local_compiler_path_;
+  std::string race_key_;
+  // True if LocalRacePolicy expects local run finishes earlier than goma.
+  bool prefer_local_run_ = false;
+  absl::Duration remote_lower_bound_;
   RequesterInfo requester_info_;
   RequesterEnv requester_env_;
 
@@ -126,7 +126,7 @@ class FakeExecServiceClient : public ExecServiceClient {
         http_return_code_(http_return_code) {}
   ~FakeExecServiceClient() override = default;
 
-  void ExecAsync(const ExecReq* req, ExecResp* resp,
+  void ExecAsync(std::shared_ptr<const ExecReq> req, ExecResp* resp,
                  HttpClient::Status* status,
                  OneshotClosure* callback) override {
     status->http_return_code = http_return_code_;
@@ -3,6 +3,8 @@
 // found in the LICENSE file.
 #include "compiler_info_cache.h"
 
+#include <algorithm>
+#include <map>
 #include <memory>
 
 #include "absl/algorithm/container.h"
@@ -27,6 +29,9 @@ namespace devtools_goma {
 
 constexpr absl::Duration kNegativeCacheDuration = absl::Minutes(10);
 constexpr absl::Duration kUpdateLastUsedAtDuration = absl::Minutes(10);
+// Journal is not compacted until it gets larger than this size, even if
+// the cache file is smaller.
+constexpr size_t kJournalCompactionMinBytes = 4 * 1024 * 1024;
 
 CompilerInfoCache* CompilerInfoCache::instance_;
 
@@ -49,15 +54,17 @@ std::string CompilerInfoCache::Key::abs_local_compiler_path() const {
 void CompilerInfoCache::Init(const std::string& cache_dir,
                              const std::string& cache_filename,
                              int num_entries,
-                             absl::Duration cache_holding_time) {
+                             absl::Duration cache_holding_time,
+                             bool use_journal) {
   CHECK(instance_ == nullptr);
   if (cache_filename == "") {
-    instance_ = new CompilerInfoCache("", num_entries, cache_holding_time);
+    instance_ = new CompilerInfoCache("", num_entries, cache_holding_time,
+                                      false);
     return;
   }
   instance_ = new CompilerInfoCache(
       file::JoinPathRespectAbsolute(cache_dir, cache_filename), num_entries,
-      cache_holding_time);
+      cache_holding_time, use_journal);
 }
 
 /* static */
@@ -69,6 +76,13 @@ void CompilerInfoCache::LoadIfEnabled() {
   }
 }
 
+/* static */
+void CompilerInfoCache::FlushIfEnabled() {
+  if (instance()->cache_file_.Enabled()) {
+    instance()->Flush();
+  }
+}
+
 void CompilerInfoCache::Quit() {
   delete instance_;
   instance_ = nullptr;
@@ -76,13 +90,20 @@ void CompilerInfoCache::Quit() {
 
 CompilerInfoCache::CompilerInfoCache(const std::string& cache_filename,
                                      int num_entries,
-                                     absl::Duration cache_holding_time)
+                                     absl::Duration cache_holding_time,
+                                     bool use_journal)
     : cache_file_(cache_filename),
       max_num_entries_(num_entries),
-      cache_holding_time_(cache_holding_time) {}
+      cache_holding_time_(cache_holding_time),
+      journal_(use_journal && !cache_filename.empty()
+                   ? absl::make_unique<CompilerInfoJournal>(cache_filename +
+                                                            ".journal")
+                   : nullptr) {}
 
 CompilerInfoCache::~CompilerInfoCache() {
-  if (cache_file_.Enabled()) {
+  if (journal_ != nullptr && journal_->started()) {
+    Flush();
+  } else if (cache_file_.Enabled()) {
     Save();
   }
   Clear();
@@ -122,19 +143,27 @@ CompilerInfoCache::Key CompilerInfoCache::CreateKey(
 CompilerInfoState* CompilerInfoCache::Lookup(const Key& key) {
   AUTO_SHARED_LOCK(lock, &mu_);
   CompilerInfoState* state = nullptr;
+  std::string compiler_info_key;
   if (file::IsAbsolutePath(key.local_compiler_path)) {
-    state = LookupUnlocked(key.ToString(!Key::kCwdRelative),
-                           key.local_compiler_path);
+    compiler_info_key = key.ToString(!Key::kCwdRelative);
+    state = LookupUnlocked(compiler_info_key, key.local_compiler_path);
   }
   if (state == nullptr) {
-    state = LookupUnlocked(key.ToString(Key::kCwdRelative),
-                           key.abs_local_compiler_path());
+    compiler_info_key = key.ToString(Key::kCwdRelative);
+    state = LookupUnlocked(compiler_info_key, key.abs_local_compiler_path());
   }
 
   // Update last used timestamp of |state| having old timestamp.
   if (state != nullptr &&
       absl::Now() - state->info().last_used_at() > kUpdateLastUsedAtDuration) {
     state->UpdateLastUsedAt();
+    if (journal_ != nullptr) {
+      CompilerInfoJournalEntry entry;
+      entry.set_type(CompilerInfoJournalEntry::USED);
+      entry.add_keys(compiler_info_key);
+      entry.set_last_used_at(absl::ToTimeT(state->info().last_used_at()));
+      journal_->Append(entry);
+    }
   }
 
   return state;
@@ -270,6 +299,7 @@ CompilerInfoState* CompilerInfoCache::Store(
       break;
     }
   }
+  AppendStoreJournalUnlocked(compiler_info_key, *state.get());
   // CompilerInfoState is referenced in cache, so it won't be destroyed
   // when state is destroyed.
   return state.get();
@@ -280,10 +310,13 @@ bool CompilerInfoCache::Disable(CompilerInfoState* compiler_info_state,
   AUTO_EXCLUSIVE_LOCK(lock, &mu_);
 
   LOG(INFO) << "Disable state=" << compiler_info_state;
+  // States disabled by this call, whose keys need to be journaled.
+  absl::flat_hash_set<const CompilerInfoState*> newly_disabled;
   bool disabled = false;
   if (!compiler_info_state->disabled()) {
     compiler_info_state->SetDisabled(true, disabled_reason);
     LOG(INFO) << "Disabled state=" << compiler_info_state;
+    newly_disabled.insert(compiler_info_state);
     disabled = true;
   }
 
@@ -297,13 +330,47 @@ bool CompilerInfoCache::Disable(CompilerInfoState* compiler_info_state,
       if (!cis->disabled()) {
         cis->SetDisabled(true, disabled_reason);
         LOG(INFO) << "Disabled state=" << cis;
+        newly_disabled.insert(cis);
       }
     }
   }
 
+  if (journal_ != nullptr && !newly_disabled.empty()) {
+    CompilerInfoJournalEntry entry;
+    entry.set_type(CompilerInfoJournalEntry::DISABLE);
+    for (const auto& info : compiler_info_) {
+      if (newly_disabled.contains(info.second)) {
+        entry.add_keys(info.first);
+      }
+    }
+    if (entry.keys_size() > 0) {
+      journal_->Append(entry);
+    }
+  }
+
   return disabled;
 }
 
+void CompilerInfoCache::AppendStoreJournalUnlocked(
+    const std::string& compiler_info_key,
+    const CompilerInfoState& state) {
+  if (journal_ == nullptr) {
+    return;
+  }
+  CompilerInfoJournalEntry entry;
+  entry.add_keys(compiler_info_key);
+  const CompilerInfoData& data = state.info().data();
+  // Disabled or negative entry is not saved in cache file, so it should
+  // also remove the older entry for the key in the journal.
+  if (state.disabled() || !data.found() || data.error_message() != "") {
+    entry.set_type(CompilerInfoJournalEntry::DISABLE);
+  } else {
+    entry.set_type(CompilerInfoJournalEntry::STORE);
+    *entry.mutable_data() = data;
+  }
+  journal_->Append(entry);
+}
+
 void CompilerInfoCache::Dump(std::ostringstream* ss) {
   AUTO_SHARED_LOCK(lock, &mu_);
   (*ss) << "compiler info:" << compiler_info_.size()
@@ -445,36 +512,122 @@ std::string CompilerInfoCache::HashKey(const CompilerInfoData& data) {
   return hash;
 }
 
-bool CompilerInfoCache::Load() {
-  AUTO_EXCLUSIVE_LOCK(lock, &mu_);
-
-  LOG(INFO) << "loading from " << cache_file_.filename();
+/* static */
+void CompilerInfoCache::ApplyJournal(
+    const std::vector<CompilerInfoJournalEntry>& entries,
+    CompilerInfoDataTable* table) {
+  // key: compiler_info_key.
+  std::map<std::string, std::shared_ptr<CompilerInfoData>> data_by_key;
+  for (const auto& it : table->compiler_info_data()) {
+    auto data = std::make_shared<CompilerInfoData>(it.data());
+    for (const auto& key : it.keys()) {
+      data_by_key[key] = data;
+    }
+  }
 
-  CompilerInfoDataTable table;
-  if (!cache_file_.Load(&table)) {
-    LOG(ERROR) << "failed to load cache file " << cache_file_.filename();
-    loaded_timestamp_ = absl::Now();
-    return false;
+  for (const auto& entry : entries) {
+    switch (entry.type()) {
+      case CompilerInfoJournalEntry::STORE: {
+        auto data = std::make_shared<CompilerInfoData>(entry.data());
+        for (const auto& key : entry.keys()) {
+          data_by_key[key] = data;
+        }
+        break;
+      }
+      case CompilerInfoJournalEntry::DISABLE:
+        for (const auto& key : entry.keys()) {
+          data_by_key.erase(key);
+        }
+        break;
+      case CompilerInfoJournalEntry::USED:
+        for (const auto& key : entry.keys()) {
+          auto found = data_by_key.find(key);
+          if (found == data_by_key.end()) {
+            continue;
+          }
+          CompilerInfoData* data = found->second.get();
+          data->set_last_used_at(
+              std::max(data->last_used_at(), entry.last_used_at()));
+        }
+        break;
+      default:
+        LOG(WARNING) << "unexpected journal entry type=" << entry.type();
+        break;
+    }
   }
 
-  UnmarshalUnlocked(table);
-  if (table.built_revision() != kBuiltRevisionString) {
-    LOG(WARNING) << "loaded from " << cache_file_.filename()
-                 << " mismatch built_revision: got=" << table.built_revision()
-                 << " want=" << kBuiltRevisionString;
-    ClearUnlocked();
-    loaded_timestamp_ = absl::Now();
-    return false;
+  table->clear_compiler_info_data();
+  absl::flat_hash_map<std::string, CompilerInfoDataTable::Entry*> by_hash;
+  for (const auto& it : data_by_key) {
+    const CompilerInfoData& data = *it.second;
+    auto p = by_hash.emplace(HashKey(data), nullptr);
+    if (p.second) {
+      p.first->second = table->add_compiler_info_data();
+      *p.first->second->mutable_data() = data;
+    }
+    p.first->second->add_keys(it.first);
   }
+  table->set_built_revision(kBuiltRevisionString);
+}
 
-  loaded_size_ = table.ByteSize();
+bool CompilerInfoCache::Load() {
+  bool loaded = false;
+  bool journal_loaded = false;
+  std::vector<CompilerInfoJournalEntry> journal_entries;
+  size_t snapshot_size = 0;
+  {
+    AUTO_EXCLUSIVE_LOCK(lock, &mu_);
+
+    LOG(INFO) << "loading from " << cache_file_.filename();
+
+    CompilerInfoDataTable table;
+    if (!cache_file_.Load(&table)) {
+      LOG(ERROR) << "failed to load cache file " << cache_file_.filename();
+      table.Clear();
+    } else if (table.built_revision() != kBuiltRevisionString) {
+      LOG(WARNING) << "loaded from " << cache_file_.filename()
+                   << " mismatch built_revision: got="
+                   << table.built_revision()
+                   << " want=" << kBuiltRevisionString;
+      table.Clear();
+    } else {
+      loaded = true;
+      snapshot_size = table.ByteSize();
+    }
 
-  LOG(INFO) << "loaded from " << cache_file_.filename()
-            << " loaded size " << loaded_size_;
+    // Entries in the journal were stored after the cache file was saved,
+    // e.g. compiler_proxy was killed before it saves the cache file.
+    if (journal_ != nullptr && journal_->Read(&journal_entries)) {
+      journal_loaded = true;
+      ApplyJournal(journal_entries, &table);
+    }
 
-  UpdateOlderCompilerInfoUnlocked();
-  loaded_timestamp_ = absl::Now();
-  return true;
+    if (loaded || journal_loaded) {
+      UnmarshalUnlocked(table);
+      loaded_size_ = table.ByteSize();
+
+      LOG(INFO) << "loaded from " << cache_file_.filename()
+                << " loaded size " << loaded_size_
+                << " journal entries " << journal_entries.size();
+
+      UpdateOlderCompilerInfoUnlocked();
+    }
+    loaded_timestamp_ = absl::Now();
+  }
+
+  if (journal_ != nullptr) {
+    AUTOLOCK(lock, &save_mu_);
+    snapshot_size_ = snapshot_size;
+    if (!journal_entries.empty()) {
+      // Compacts the replayed journal into the cache file, and starts
+      // new journal.
+      SaveUnlocked();
+    } else {
+      // Keeps entries stored before Load in the new journal.
+      journal_->Rotate(0);
+    }
+  }
+  return loaded || journal_loaded;
 }
 
 void CompilerInfoCache::UpdateOlderCompilerInfo() {
@@ -570,6 +723,11 @@ bool CompilerInfoCache::UnmarshalUnlocked(const CompilerInfoDataTable& table) {
 }
 
 bool CompilerInfoCache::Save() {
+  AUTOLOCK(lock, &save_mu_);
+  return SaveUnlocked();
+}
+
+bool CompilerInfoCache::SaveUnlocked() {
   if (!cache_file_.Enabled()) {
     return true;
   }
@@ -577,18 +735,49 @@ bool CompilerInfoCache::Save() {
   LOG(INFO) << "saving to " << cache_file_.filename();
 
   CompilerInfoDataTable table;
-  if (!Marshal(&table)) {
-    return false;
+  // Journal records appended before |journal_mark| are in |table|.
+  size_t journal_mark = 0;
+  {
+    AUTO_SHARED_LOCK(lock, &mu_);
+    if (!MarshalUnlocked(&table)) {
+      return false;
+    }
+    if (journal_ != nullptr) {
+      journal_mark = journal_->size();
+    }
   }
 
   if (!cache_file_.Save(table)) {
     LOG(ERROR) << "failed to save cache file " << cache_file_.filename();
     return false;
   }
-  LOG(INFO) << "saved to " << cache_file_.filename();
+  snapshot_size_ = table.ByteSize();
+  LOG(INFO) << "saved to " << cache_file_.filename()
+            << " size=" << snapshot_size_;
+  if (journal_ != nullptr) {
+    return journal_->Rotate(journal_mark);
+  }
   return true;
 }
 
+bool CompilerInfoCache::Flush() {
+  if (journal_ == nullptr) {
+    return Save();
+  }
+  AUTOLOCK(lock, &save_mu_);
+  if (!journal_->started()) {
+    // Load has not finished yet. Records are kept in memory.
+    return true;
+  }
+  if (journal_->size() > std::max(kJournalCompactionMinBytes, snapshot_size_)) {
+    LOG(INFO) << "compacting journal " << journal_->filename()
+              << " size=" << journal_->size()
+              << " snapshot_size=" << snapshot_size_;
+    return SaveUnlocked();
+  }
+  return journal_->Sync();
+}
+
 bool CompilerInfoCache::Marshal(CompilerInfoDataTable* table) {
   AUTO_SHARED_LOCK(lock, &mu_);
   return MarshalUnlocked(table);
@@ -19,6 +19,7 @@
 #include "basictypes.h"
 #include "cache_file.h"
 #include "compiler_info.h"
+#include "compiler_info_journal.h"
 #include "gtest/gtest_prod.h"
 #include "json/json.h"
 #include "lockhelper.h"
@@ -29,6 +30,7 @@ class CompilerFlags;
 class CompilerInfo;
 class CompilerInfoState;
 class CompilerInfoDataTable;
+class CompilerInfoJournalEntry;
 
 // CompilerInfoCache caches CompilerInfo.
 // Information about a particular compiler found in 'path', with
@@ -60,15 +62,22 @@ class CompilerInfoCache {
 
   // Initializes the CompilerInfoCache.
   // Call LoadIfEnabled to load cache file.
+  // If |use_journal| is true and cache_filename is not empty, updates of
+  // the cache are also appended to the journal file next to the cache file,
+  // so that they survive unclean exit of compiler_proxy.
   static void Init(const std::string& cache_dir,
                    const std::string& cache_filename,
                    int num_entries,
-                   absl::Duration cache_holding_time);
+                   absl::Duration cache_holding_time,
+                   bool use_journal = false);
   // Load cached data from
   // JoinPathRespectAbsolute(cache_dir, cache_filename),
   // when cache_filename is not empty.
   // Do nothing if cache_filename is empty.
   static void LoadIfEnabled();
+  // Calls Flush if the cache file is enabled.
+  // This is expected to be called periodically.
+  static void FlushIfEnabled();
   static CompilerInfoCache* instance() { return instance_; }
 
   // Saves CompilerInfoCache into cache file.
@@ -121,16 +130,30 @@ class CompilerInfoCache {
     return validator_.get();
   }
 
-  bool Save() ABSL_LOCKS_EXCLUDED(mu_);
+  // Saves the whole cache into cache file, and starts new journal file.
+  bool Save() ABSL_LOCKS_EXCLUDED(save_mu_, mu_);
+
+  // Makes updates of the cache durable.
+  // If journal is used, this fsyncs the journal file, or compacts the
+  // journal into cache file by Save when the journal gets larger than
+  // the cache file. Otherwise, this is the same as Save.
+  bool Flush() ABSL_LOCKS_EXCLUDED(save_mu_, mu_);
 
  private:
   FRIEND_TEST(CompilerInfoCacheTest, LimitTableEntriesTest);
+  FRIEND_TEST(CompilerInfoCacheTest, ApplyJournal);
   CompilerInfoCache(const std::string& cache_filename,
                     int num_entries,
-                    absl::Duration cache_holding_time);
+                    absl::Duration cache_holding_time,
+                    bool use_journal);
 
   static std::string HashKey(const CompilerInfoData& data);
-  bool Load() ABSL_LOCKS_EXCLUDED(mu_);
+  // Applies journal |entries| to |table| loaded from cache file.
+  static void ApplyJournal(const std::vector<CompilerInfoJournalEntry>& entries,
+                           CompilerInfoDataTable* table);
+  bool Load() ABSL_LOCKS_EXCLUDED(save_mu_, mu_);
+  bool SaveUnlocked() ABSL_EXCLUSIVE_LOCKS_REQUIRED(save_mu_)
+      ABSL_LOCKS_EXCLUDED(mu_);
   bool Unmarshal(const CompilerInfoDataTable& table) ABSL_LOCKS_EXCLUDED(mu_);
   bool UnmarshalUnlocked(const CompilerInfoDataTable& table)
       ABSL_EXCLUSIVE_LOCKS_REQUIRED(mu_);
@@ -141,6 +164,11 @@ class CompilerInfoCache {
   void Clear() ABSL_LOCKS_EXCLUDED(mu_);
   void ClearUnlocked() ABSL_EXCLUSIVE_LOCKS_REQUIRED(mu_);
 
+  // Appends a journal entry to store |state| for |compiler_info_key|.
+  void AppendStoreJournalUnlocked(const std::string& compiler_info_key,
+                                  const CompilerInfoState& state)
+      ABSL_EXCLUSIVE_LOCKS_REQUIRED(mu_);
+
   CompilerInfoState* LookupUnlocked(const std::string& compiler_info_key,
                                     const std::string& abs_local_compiler_path)
       ABSL_SHARED_LOCKS_REQUIRED(mu_);
@@ -172,6 +200,13 @@ class CompilerInfoCache {
   const CacheFile cache_file_;
   const int max_num_entries_;
   const absl::Duration cache_holding_time_;
+  // nullptr if journal is not used.
+  const std::unique_ptr<CompilerInfoJournal> journal_;
+
+  // Serializes Save and Flush. Acquired before mu_.
+  Lock save_mu_;
+  // Serialized size of the cache file last loaded or saved.
+  size_t snapshot_size_ ABSL_GUARDED_BY(save_mu_) = 0;
 
   std::unique_ptr<CompilerInfoValidator> validator_ ABSL_GUARDED_BY(mu_) =
       absl::make_unique<CompilerInfoCache::CompilerInfoValidator>();
@@ -18,8 +18,10 @@
 #include "absl/time/time.h"
 #include "compiler_flags.h"
 #include "compiler_flags_parser.h"
+#include "compiler_info_journal.h"
 #include "compiler_info_state.h"
 #include "cxx/gcc_compiler_info_builder.h"
+#include "file_helper.h"
 #include "path.h"
 #include "proto_util.h"
 #include "subprocess.h"
@@ -84,7 +86,8 @@ class HashCheckingCompilerInfoValidator
 class CompilerInfoCacheTest : public testing::Test {
  public:
   CompilerInfoCacheTest()
-      : cache_(new CompilerInfoCache("", kMaxNumEntries, kCacheHoldingTime)),
+      : cache_(new CompilerInfoCache("", kMaxNumEntries, kCacheHoldingTime,
+                                     false)),
         validator_(new TestCompilerInfoValidator) {
     cache_->SetValidator(validator_);
   }
@@ -106,6 +109,17 @@ class CompilerInfoCacheTest : public testing::Test {
     cache_->UpdateOlderCompilerInfo();
   }
 
+  static std::unique_ptr<CompilerInfoCache> NewCacheWithJournal(
+      const std::string& cache_filename) {
+    std::unique_ptr<CompilerInfoCache> cache(new CompilerInfoCache(
+        cache_filename, kMaxNumEntries, kCacheHoldingTime, true));
+    cache->SetValidator(new TestCompilerInfoValidator);
+    return cache;
+  }
+  static bool Load(CompilerInfoCache* cache) {
+    return cache->Load();
+  }
+
   void SetFailedAt(CompilerInfoState* state, absl::Time failed_at) {
     // TODO: in prod code, CompilerInfo would never be updated like this.
     // error message has been changed only if new CompilerInfo data is stored.
@@ -811,6 +825,146 @@ TEST_F(CompilerInfoCacheTest, LimitTableEntriesTest) {
   EXPECT_EQ("key2", table.compiler_info_data(1).keys(0));
 }
 
+TEST_F(CompilerInfoCacheTest, ApplyJournal) {
+  CompilerInfoDataTable table;
+  CompilerInfoDataTable::Entry* entry = table.add_compiler_info_data();
+  entry->add_keys("gcc key1");
+  entry->add_keys("gcc key2");
+  entry->mutable_data()->set_name("gcc");
+  entry->mutable_data()->set_last_used_at(100);
+  entry = table.add_compiler_info_data();
+  entry->add_keys("clang key");
+  entry->mutable_data()->set_name("clang");
+  entry->mutable_data()->set_last_used_at(100);
+
+  std::vector<CompilerInfoJournalEntry> journal(4);
+  journal[0].set_type(CompilerInfoJournalEntry::STORE);
+  journal[0].add_keys("g++ key");
+  journal[0].mutable_data()->set_name("g++");
+  journal[0].mutable_data()->set_last_used_at(200);
+  journal[1].set_type(CompilerInfoJournalEntry::DISABLE);
+  journal[1].add_keys("clang key");
+  journal[2].set_type(CompilerInfoJournalEntry::USED);
+  journal[2].add_keys("gcc key1");
+  journal[2].set_last_used_at(300);
+  // Older timestamp should not overwrite newer one.
+  journal[3].set_type(CompilerInfoJournalEntry::USED);
+  journal[3].add_keys("g++ key");
+  journal[3].set_last_used_at(150);
+
+  CompilerInfoCache::ApplyJournal(journal, &table);
+
+  ASSERT_EQ(2, table.compiler_info_data_size());
+  absl::flat_hash_map<std::string, const CompilerInfoDataTable::Entry*>
+      by_name;
+  for (const auto& e : table.compiler_info_data()) {
+    by_name[e.data().name()] = &e;
+  }
+  ASSERT_EQ(1U, by_name.count("gcc"));
+  EXPECT_EQ(2, by_name["gcc"]->keys_size());
+  EXPECT_EQ(300, by_name["gcc"]->data().last_used_at());
+  ASSERT_EQ(1U, by_name.count("g++"));
+  ASSERT_EQ(1, by_name["g++"]->keys_size());
+  EXPECT_EQ("g++ key", by_name["g++"]->keys(0));
+  EXPECT_EQ(200, by_name["g++"]->data().last_used_at());
+  EXPECT_EQ(0U, by_name.count("clang"));
+}
+
+TEST_F(CompilerInfoCacheTest, JournalRecovery) {
+  TmpdirUtil tmpdir_util("compiler_info_cache_unittest");
+  const std::string cache_filename =
+      tmpdir_util.FullPath("compiler_info_cache");
+  const std::string recovered_filename =
+      tmpdir_util.FullPath("recovered_compiler_info_cache");
+
+  std::vector<CompilerInfoCache::Key> keys(3);
+  std::unique_ptr<CompilerInfoCache> cache =
+      NewCacheWithJournal(cache_filename);
+  EXPECT_FALSE(Load(cache.get()));
+  const char* const kNames[] = {"gcc", "g++", "clang"};
+  for (size_t i = 0; i < keys.size(); ++i) {
+    keys[i].base = std::string(kNames[i]) + " @";
+    keys[i].cwd = "/b/build/agent/work";
+    keys[i].local_compiler_path = std::string("/usr/bin/") + kNames[i];
+    auto cid = absl::make_unique<CompilerInfoData>();
+    cid->set_name(kNames[i]);
+    cid->set_hash(kNames[i]);
+    cid->set_found(true);
+    cid->set_last_used_at(absl::ToTimeT(absl::Now()));
+    cid->mutable_cxx();
+    ScopedCompilerInfoState cis(cache->Store(keys[i], std::move(cid)));
+    if (i == 2) {
+      cache->Disable(cis.get(), "disabled for test");
+    }
+  }
+  EXPECT_TRUE(cache->Flush());
+
+  // Simulate unclean exit: cache file is not saved, but journal is.
+  std::string journal_content;
+  ASSERT_TRUE(ReadFileToString(cache_filename + ".journal", &journal_content));
+  ASSERT_TRUE(
+      WriteStringToFile(journal_content, recovered_filename + ".journal"));
+
+  std::unique_ptr<CompilerInfoCache> recovered =
+      NewCacheWithJournal(recovered_filename);
+  EXPECT_TRUE(Load(recovered.get()));
+  EXPECT_EQ(2, recovered->Count());
+  EXPECT_NE(nullptr, recovered->Lookup(keys[0]));
+  EXPECT_NE(nullptr, recovered->Lookup(keys[1]));
+  EXPECT_EQ(nullptr, recovered->Lookup(keys[2]));
+
+  // Replayed journal is compacted into cache file.
+  std::vector<CompilerInfoJournalEntry> entries;
+  EXPECT_TRUE(CompilerInfoJournal(recovered_filename + ".journal")
+                  .Read(&entries));
+  EXPECT_TRUE(entries.empty());
+  recovered.reset();
+  recovered = NewCacheWithJournal(recovered_filename);
+  EXPECT_TRUE(Load(recovered.get()));
+  EXPECT_EQ(2, recovered->Count());
+}
+
+TEST_F(CompilerInfoCacheTest, JournalNewlyDisabledKeys) {
+  TmpdirUtil tmpdir_util("compiler_info_cache_unittest");
+  const std::string cache_filename =
+      tmpdir_util.FullPath("compiler_info_cache");
+
+  std::vector<CompilerInfoCache::Key> keys(2);
+  std::unique_ptr<CompilerInfoCache> cache =
+      NewCacheWithJournal(cache_filename);
+  std::vector<ScopedCompilerInfoState> states;
+  EXPECT_FALSE(Load(cache.get()));
+  const char* const kNames[] = {"gcc", "clang"};
+  for (size_t i = 0; i < keys.size(); ++i) {
+    keys[i].base = std::string(kNames[i]) + " @";
+    keys[i].cwd = "/b/build/agent/work";
+    keys[i].local_compiler_path = std::string("/usr/bin/") + kNames[i];
+    auto cid = absl::make_unique<CompilerInfoData>();
+    cid->set_name(kNames[i]);
+    cid->set_hash(kNames[i]);
+    cid->set_found(true);
+    cid->mutable_cxx();
+    states.emplace_back(cache->Store(keys[i], std::move(cid)));
+  }
+  EXPECT_TRUE(cache->Disable(states[0].get(), "disabled for test"));
+  // Already disabled key is not journaled again.
+  EXPECT_FALSE(cache->Disable(states[0].get(), "disabled for test"));
+  EXPECT_TRUE(cache->Disable(states[1].get(), "disabled for test"));
+
+  std::vector<CompilerInfoJournalEntry> entries;
+  ASSERT_TRUE(
+      CompilerInfoJournal(cache_filename + ".journal").Read(&entries));
+  ASSERT_EQ(4U, entries.size());
+  EXPECT_EQ(CompilerInfoJournalEntry::STORE, entries[0].type());
+  EXPECT_EQ(CompilerInfoJournalEntry::STORE, entries[1].type());
+  EXPECT_EQ(CompilerInfoJournalEntry::DISABLE, entries[2].type());
+  ASSERT_EQ(1, entries[2].keys_size());
+  EXPECT_EQ(entries[0].keys(0), entries[2].keys(0));
+  EXPECT_EQ(CompilerInfoJournalEntry::DISABLE, entries[3].type());
+  ASSERT_EQ(1, entries[3].keys_size());
+  EXPECT_EQ(entries[1].keys(0), entries[3].keys(0));
+}
+
 #ifdef __linux__
 TEST_F(CompilerInfoCacheTest, RelativePathCompiler) {
   InstallReadCommandOutputFunc(ReadCommandOutputByPopen);
@@ -820,7 +974,7 @@ TEST_F(CompilerInfoCacheTest, RelativePathCompiler) {
   static const char kCompilerInfoCache[] = "compiler_info_cache";
 
   CompilerInfoCache::Init(tmpdir_util.tmpdir(), kCompilerInfoCache,
-                          kMaxNumEntries, absl::Hours(1));
+                          kMaxNumEntries, absl::Hours(1), true);
   CompilerInfoCache::LoadIfEnabled();
   const std::vector<std::string> empty_env;
   CompilerInfoCache::Key key1, key2, key3;
@@ -881,7 +1035,7 @@ TEST_F(CompilerInfoCacheTest, RelativePathCompiler) {
   ASSERT_TRUE(Chdir("/"));
 
   CompilerInfoCache::Init(tmpdir_util.tmpdir(), kCompilerInfoCache,
-                          kMaxNumEntries, absl::Hours(1));
+                          kMaxNumEntries, absl::Hours(1), true);
   CompilerInfoCache::LoadIfEnabled();
 
   EXPECT_NE(nullptr, CompilerInfoCache::instance()->Lookup(key1));
@@ -0,0 +1,244 @@
+// Copyright 2020 The Goma Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "compiler_info_journal.h"
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include <utility>
+
+#include "absl/strings/string_view.h"
+#include "autolock_timer.h"
+#include "compiler_proxy_info.h"
+#include "compiler_specific.h"
+#include "file_helper.h"
+#include "glog/logging.h"
+#include "path.h"
+
+MSVC_PUSH_DISABLE_WARNING_FOR_PROTO()
+#include "client/compiler_info_data.pb.h"
+MSVC_POP_WARNING()
+
+namespace devtools_goma {
+
+namespace {
+
+// Record format:
+//   uint32 size of payload (little endian)
+//   uint32 checksum of payload (little endian)
+//   payload: serialized CompilerInfoJournalEntry
+constexpr size_t kRecordHeaderSize = 8;
+
+// FNV-1a hash, to detect a torn or corrupted record.
+uint32_t Checksum(absl::string_view payload) {
+  uint32_t hash = 2166136261u;
+  for (unsigned char c : payload) {
+    hash ^= c;
+    hash *= 16777619u;
+  }
+  return hash;
+}
+
+void PutUint32(uint32_t value, std::string* out) {
+  for (int i = 0; i < 4; ++i) {
+    out->push_back(static_cast<char>((value >> (8 * i)) & 0xff));
+  }
+}
+
+uint32_t GetUint32(absl::string_view buf) {
+  uint32_t value = 0;
+  for (int i = 0; i < 4; ++i) {
+    value |= static_cast<uint32_t>(static_cast<unsigned char>(buf[i]))
+             << (8 * i);
+  }
+  return value;
+}
+
+std::string MakeRecord(const CompilerInfoJournalEntry& entry) {
+  std::string payload;
+  entry.SerializeToString(&payload);
+  std::string record;
+  record.reserve(kRecordHeaderSize + payload.size());
+  PutUint32(payload.size(), &record);
+  PutUint32(Checksum(payload), &record);
+  record += payload;
+  return record;
+}
+
+std::string MakeHeaderRecord() {
+  CompilerInfoJournalEntry header;
+  header.set_type(CompilerInfoJournalEntry::HEADER);
+  header.set_built_revision(kBuiltRevisionString);
+  return MakeRecord(header);
+}
+
+}  // anonymous namespace
+
+CompilerInfoJournal::CompilerInfoJournal(std::string filename)
+    : filename_(std::move(filename)) {}
+
+CompilerInfoJournal::~CompilerInfoJournal() {
+  Sync();
+}
+
+bool CompilerInfoJournal::Read(
+    std::vector<CompilerInfoJournalEntry>* entries) const {
+  entries->clear();
+  std::string content;
+  if (!ReadFileToString(filename_, &content)) {
+    LOG(INFO) << filename_ << " does not exist.";
+    return false;
+  }
+
+  absl::string_view buf(content);
+  bool header_seen = false;
+  while (!buf.empty()) {
+    if (buf.size() < kRecordHeaderSize) {
+      LOG(WARNING) << "torn record header in " << filename_
+                   << " remaining=" << buf.size();
+      break;
+    }
+    const uint32_t size = GetUint32(buf);
+    const uint32_t checksum = GetUint32(buf.substr(4));
+    buf.remove_prefix(kRecordHeaderSize);
+    if (buf.size() < size) {
+      LOG(WARNING) << "torn record in " << filename_ << " size=" << size
+                   << " remaining=" << buf.size();
+      break;
+    }
+    const absl::string_view payload = buf.substr(0, size);
+    buf.remove_prefix(size);
+    CompilerInfoJournalEntry entry;
+    if (Checksum(payload) != checksum ||
+        !entry.ParseFromArray(payload.data(), payload.size())) {
+      LOG(WARNING) << "broken record in " << filename_ << " size=" << size;
+      break;
+    }
+    if (!header_seen) {
+      if (entry.type() != CompilerInfoJournalEntry::HEADER ||
+          entry.built_revision() != kBuiltRevisionString) {
+        LOG(WARNING) << filename_
+                     << " mismatch built_revision: got="
+                     << entry.built_revision()
+                     << " want=" << kBuiltRevisionString;
+        return false;
+      }
+      header_seen = true;
+      continue;
+    }
+    entries->push_back(std::move(entry));
+  }
+  if (!header_seen) {
+    LOG(WARNING) << "no header in " << filename_;
+    return false;
+  }
+  LOG(INFO) << "read " << entries->size() << " entries from " << filename_;
+  return true;
+}
+
+void CompilerInfoJournal::Append(const CompilerInfoJournalEntry& entry) {
+  const std::string record = MakeRecord(entry);
+  AUTOLOCK(lock, &mu_);
+  records_ += record;
+  if (!fd_.valid()) {
+    return;
+  }
+  ssize_t written = fd_.Write(record.data(), record.size());
+  if (written != static_cast<ssize_t>(record.size())) {
+    // Records appended after a partially written record could not be read,
+    // so stop writing the journal until next Rotate.
+    PLOG(ERROR) << "failed to append to " << filename_
+                << " size=" << record.size() << " written=" << written;
+    fd_.Close();
+    return;
+  }
+  unsynced_ = true;
+}
+
+bool CompilerInfoJournal::Rotate(size_t mark) {
+  AUTOLOCK(lock, &mu_);
+  DCHECK_LE(mark, records_.size());
+  records_.erase(0, mark);
+  started_ = true;
+
+  // Writes new journal in temporary file and renames it to the journal
+  // file, so that the journal file is not lost nor torn by unclean exit
+  // while rotating.  If it failed, records are still appended to the old
+  // journal file, which has all records in the new journal.
+  const std::string content = MakeHeaderRecord() + records_;
+  const std::string tmp_filename = filename_ + ".tmp";
+  {
+    ScopedFd fd(ScopedFd::Create(tmp_filename, 0644));
+    if (!fd.valid()) {
+      PLOG(ERROR) << "failed to create " << tmp_filename;
+      return false;
+    }
+    ssize_t written = fd.Write(content.data(), content.size());
+    if (written != static_cast<ssize_t>(content.size()) || !fd.Sync()) {
+      PLOG(ERROR) << "failed to write " << tmp_filename
+                  << " size=" << content.size() << " written=" << written;
+      fd.Close();
+      remove(tmp_filename.c_str());
+      return false;
+    }
+  }
+#ifdef _WIN32
+  // rename on Windows fails if the destination exists.
+  fd_.Close();
+  remove(filename_.c_str());
+#endif
+  if (rename(tmp_filename.c_str(), filename_.c_str()) != 0) {
+    PLOG(ERROR) << "failed to rename " << tmp_filename << " to " << filename_;
+    remove(tmp_filename.c_str());
+    return false;
+  }
+#ifndef _WIN32
+  // fsync the directory too, or the rename may be lost by crash, and the
+  // old journal would be replayed on the new cache file.
+  {
+    const std::string dir(file::Dirname(filename_));
+    ScopedFd dir_fd(ScopedFd::OpenForRead(dir.empty() ? "." : dir));
+    if (!dir_fd.valid() || !dir_fd.Sync()) {
+      PLOG(WARNING) << "failed to sync directory of " << filename_;
+    }
+  }
+#endif
+  unsynced_ = false;
+  fd_.reset(ScopedFd::OpenForRewrite(filename_));
+  if (!fd_.valid() ||
+      fd_.Seek(content.size(), ScopedFd::SeekAbsolute) !=
+          static_cast<off_t>(content.size())) {
+    PLOG(ERROR) << "failed to open " << filename_;
+    fd_.Close();
+    return false;
+  }
+  LOG(INFO) << "started journal " << filename_ << " size=" << content.size();
+  return true;
+}
+
+bool CompilerInfoJournal::Sync() {
+  AUTOLOCK(lock, &mu_);
+  if (!fd_.valid() || !unsynced_) {
+    return true;
+  }
+  if (!fd_.Sync()) {
+    PLOG(ERROR) << "failed to sync " << filename_;
+    return false;
+  }
+  unsynced_ = false;
+  return true;
+}
+
+size_t CompilerInfoJournal::size() const {
+  AUTOLOCK(lock, &mu_);
+  return records_.size();
+}
+
+bool CompilerInfoJournal::started() const {
+  AUTOLOCK(lock, &mu_);
+  return started_;
+}
+
+}  // namespace devtools_goma
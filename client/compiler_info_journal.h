@@ -0,0 +1,79 @@
+// Copyright 2020 The Goma Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#ifndef DEVTOOLS_GOMA_CLIENT_COMPILER_INFO_JOURNAL_H_
+#define DEVTOOLS_GOMA_CLIENT_COMPILER_INFO_JOURNAL_H_
+
+#include <string>
+#include <vector>
+
+#include "absl/base/thread_annotations.h"
+#include "basictypes.h"
+#include "lockhelper.h"
+#include "scoped_fd.h"
+
+namespace devtools_goma {
+
+class CompilerInfoJournalEntry;
+
+// CompilerInfoJournal is an append-only journal of updates of
+// CompilerInfoCache, written next to the cache file.
+//
+// Each record is a serialized CompilerInfoJournalEntry prefixed with its
+// size and checksum, so a record torn by unclean exit is detected and
+// ignored in Read.
+// Appended records are written to the file immediately, but fsync is
+// deferred to Sync, which is expected to be called periodically.
+// Records are also kept in memory until Rotate, which replaces the journal
+// file with a new one when the records have been saved in the cache file.
+//
+// This class is thread-safe.
+class CompilerInfoJournal {
+ public:
+  explicit CompilerInfoJournal(std::string filename);
+  ~CompilerInfoJournal();
+
+  // Reads entries in the journal file into |entries|.
+  // Returns false if the journal file does not exist, or it was written by
+  // different built revision.
+  // Entries after a broken record are ignored.
+  bool Read(std::vector<CompilerInfoJournalEntry>* entries) const
+      ABSL_LOCKS_EXCLUDED(mu_);
+
+  // Appends |entry| to the journal.
+  // Before the first Rotate, |entry| is kept only in memory.
+  void Append(const CompilerInfoJournalEntry& entry) ABSL_LOCKS_EXCLUDED(mu_);
+
+  // Starts a new journal file having records appended after |mark|, which
+  // is size() when the cache file was marshaled.
+  bool Rotate(size_t mark) ABSL_LOCKS_EXCLUDED(mu_);
+
+  // Flushes the journal file to the storage device if there are records
+  // appended after the last Sync.
+  bool Sync() ABSL_LOCKS_EXCLUDED(mu_);
+
+  // Returns bytes of records appended since the last Rotate.
+  size_t size() const ABSL_LOCKS_EXCLUDED(mu_);
+
+  // Returns true if the journal file was started by Rotate.
+  bool started() const ABSL_LOCKS_EXCLUDED(mu_);
+
+  const std::string& filename() const { return filename_; }
+
+ private:
+  const std::string filename_;
+
+  mutable Lock mu_;
+  ScopedFd fd_ ABSL_GUARDED_BY(mu_);
+  bool started_ ABSL_GUARDED_BY(mu_) = false;
+  bool unsynced_ ABSL_GUARDED_BY(mu_) = false;
+  // Records appended since the last Rotate.
+  std::string records_ ABSL_GUARDED_BY(mu_);
+
+  DISALLOW_COPY_AND_ASSIGN(CompilerInfoJournal);
+};
+
+}  // namespace devtools_goma
+
+#endif  // DEVTOOLS_GOMA_CLIENT_COMPILER_INFO_JOURNAL_H_
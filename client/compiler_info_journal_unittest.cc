@@ -0,0 +1,162 @@
+// Copyright 2020 The Goma Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "compiler_info_journal.h"
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "absl/memory/memory.h"
+#include "compiler_specific.h"
+#include "file_helper.h"
+#include "gtest/gtest.h"
+#include "unittest_util.h"
+
+MSVC_PUSH_DISABLE_WARNING_FOR_PROTO()
+#include "client/compiler_info_data.pb.h"
+MSVC_POP_WARNING()
+
+namespace devtools_goma {
+
+namespace {
+
+CompilerInfoJournalEntry StoreEntry(const std::string& key,
+                                    const std::string& name) {
+  CompilerInfoJournalEntry entry;
+  entry.set_type(CompilerInfoJournalEntry::STORE);
+  entry.add_keys(key);
+  entry.mutable_data()->set_name(name);
+  return entry;
+}
+
+}  // anonymous namespace
+
+class CompilerInfoJournalTest : public testing::Test {
+ protected:
+  void SetUp() override {
+    tmpdir_util_ = absl::make_unique<TmpdirUtil>("compiler_info_journal");
+    filename_ = tmpdir_util_->FullPath("compiler_info_cache.journal");
+  }
+
+  std::unique_ptr<TmpdirUtil> tmpdir_util_;
+  std::string filename_;
+};
+
+TEST_F(CompilerInfoJournalTest, NoFile) {
+  CompilerInfoJournal journal(filename_);
+  std::vector<CompilerInfoJournalEntry> entries;
+  EXPECT_FALSE(journal.Read(&entries));
+  EXPECT_TRUE(entries.empty());
+}
+
+TEST_F(CompilerInfoJournalTest, AppendAndRead) {
+  {
+    CompilerInfoJournal journal(filename_);
+    // Before Rotate, entries are kept only in memory.
+    journal.Append(StoreEntry("key0", "gcc"));
+    EXPECT_FALSE(journal.started());
+    EXPECT_TRUE(journal.Rotate(0));
+    EXPECT_TRUE(journal.started());
+    journal.Append(StoreEntry("key1", "clang"));
+    EXPECT_TRUE(journal.Sync());
+  }
+
+  CompilerInfoJournal journal(filename_);
+  std::vector<CompilerInfoJournalEntry> entries;
+  ASSERT_TRUE(journal.Read(&entries));
+  ASSERT_EQ(2U, entries.size());
+  EXPECT_EQ("key0", entries[0].keys(0));
+  EXPECT_EQ("gcc", entries[0].data().name());
+  EXPECT_EQ("key1", entries[1].keys(0));
+  EXPECT_EQ("clang", entries[1].data().name());
+}
+
+TEST_F(CompilerInfoJournalTest, TornRecord) {
+  {
+    CompilerInfoJournal journal(filename_);
+    EXPECT_TRUE(journal.Rotate(0));
+    journal.Append(StoreEntry("key0", "gcc"));
+    journal.Append(StoreEntry("key1", "clang"));
+  }
+  std::string content;
+  ASSERT_TRUE(ReadFileToString(filename_, &content));
+
+  // Simulate unclean exit while writing the last record.
+  ASSERT_TRUE(WriteStringToFile(content.substr(0, content.size() - 3),
+                                filename_));
+  CompilerInfoJournal journal(filename_);
+  std::vector<CompilerInfoJournalEntry> entries;
+  ASSERT_TRUE(journal.Read(&entries));
+  ASSERT_EQ(1U, entries.size());
+  EXPECT_EQ("key0", entries[0].keys(0));
+
+  // Broken record is ignored.
+  content[content.size() - 1] ^= 0xff;
+  ASSERT_TRUE(WriteStringToFile(content, filename_));
+  ASSERT_TRUE(journal.Read(&entries));
+  ASSERT_EQ(1U, entries.size());
+  EXPECT_EQ("key0", entries[0].keys(0));
+}
+
+TEST_F(CompilerInfoJournalTest, BrokenHeader) {
+  {
+    CompilerInfoJournal journal(filename_);
+    EXPECT_TRUE(journal.Rotate(0));
+    journal.Append(StoreEntry("key0", "gcc"));
+  }
+  std::string content;
+  ASSERT_TRUE(ReadFileToString(filename_, &content));
+  // Break the payload of the header, which has built_revision.
+  content[8] ^= 0xff;
+  ASSERT_TRUE(WriteStringToFile(content, filename_));
+
+  CompilerInfoJournal journal(filename_);
+  std::vector<CompilerInfoJournalEntry> entries;
+  EXPECT_FALSE(journal.Read(&entries));
+  EXPECT_TRUE(entries.empty());
+}
+
+TEST_F(CompilerInfoJournalTest, RotateKeepsRecordsAfterMark) {
+  CompilerInfoJournal journal(filename_);
+  EXPECT_TRUE(journal.Rotate(0));
+  EXPECT_EQ(0U, journal.size());
+  journal.Append(StoreEntry("key0", "gcc"));
+  // Records before |mark| were saved in cache file.
+  const size_t mark = journal.size();
+  journal.Append(StoreEntry("key1", "clang"));
+  EXPECT_TRUE(journal.Rotate(mark));
+
+  std::vector<CompilerInfoJournalEntry> entries;
+  ASSERT_TRUE(journal.Read(&entries));
+  ASSERT_EQ(1U, entries.size());
+  EXPECT_EQ("key1", entries[0].keys(0));
+
+  // Records are appended to the new journal file.
+  journal.Append(StoreEntry("key2", "clang"));
+  ASSERT_TRUE(journal.Read(&entries));
+  ASSERT_EQ(2U, entries.size());
+  EXPECT_EQ("key1", entries[0].keys(0));
+  EXPECT_EQ("key2", entries[1].keys(0));
+}
+
+TEST_F(CompilerInfoJournalTest, RotateReplacesJournalFile) {
+  // Old journal file left by unclean exit.
+  ASSERT_TRUE(WriteStringToFile("torn", filename_));
+
+  CompilerInfoJournal journal(filename_);
+  journal.Append(StoreEntry("key0", "gcc"));
+  EXPECT_TRUE(journal.Rotate(0));
+  std::string content;
+  EXPECT_FALSE(ReadFileToString(filename_ + ".tmp", &content));
+
+  journal.Append(StoreEntry("key1", "clang"));
+  std::vector<CompilerInfoJournalEntry> entries;
+  ASSERT_TRUE(journal.Read(&entries));
+  ASSERT_EQ(2U, entries.size());
+  EXPECT_EQ("key0", entries[0].keys(0));
+  EXPECT_EQ("key1", entries[1].keys(0));
+}
+
+}  // namespace devtools_goma
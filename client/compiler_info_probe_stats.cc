@@ -0,0 +1,114 @@
+// Copyright 2020 The Goma Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "compiler_info_probe_stats.h"
+
+#include <sstream>
+#include <utility>
+
+#include "absl/time/clock.h"
+#include "autolock_timer.h"
+#include "compiler_specific.h"
+
+MSVC_PUSH_DISABLE_WARNING_FOR_PROTO()
+#include "lib/goma_stats.pb.h"
+MSVC_POP_WARNING()
+
+namespace devtools_goma {
+
+/* static */
+CompilerInfoProbeStats* CompilerInfoProbeStats::instance() {
+  static CompilerInfoProbeStats* stats = new CompilerInfoProbeStats;
+  return stats;
+}
+
+void CompilerInfoProbeStats::Record(const std::string& name,
+                                    absl::Duration duration) {
+  AUTOLOCK(lock, &mu_);
+  RecordUnlocked(name, duration);
+}
+
+void CompilerInfoProbeStats::RecordBatch(
+    const std::vector<CommandOutputRequest>& requests,
+    absl::Duration wall_time) {
+  AUTOLOCK(lock, &mu_);
+  absl::Duration sum;
+  for (const auto& request : requests) {
+    RecordUnlocked(request.name, request.run_time);
+    sum += request.run_time;
+  }
+  if (requests.size() > 1) {
+    ++num_batches_;
+    if (sum > wall_time) {
+      batch_saved_time_ += sum - wall_time;
+    }
+  }
+}
+
+void CompilerInfoProbeStats::DumpStatsToProto(CompilerInfoStats* stats) const {
+  AUTOLOCK(lock, &mu_);
+  for (const auto& it : latencies_) {
+    CompilerInfoProbeLatency* probe = stats->add_probes();
+    probe->set_name(it.first);
+    probe->set_count(it.second.count);
+    probe->set_total_ms(absl::ToInt64Milliseconds(it.second.total));
+    probe->set_max_ms(absl::ToInt64Milliseconds(it.second.max));
+  }
+  stats->set_probe_batches(num_batches_);
+  stats->set_probe_batch_saved_ms(
+      absl::ToInt64Milliseconds(batch_saved_time_));
+}
+
+std::string CompilerInfoProbeStats::DebugString() const {
+  AUTOLOCK(lock, &mu_);
+  std::ostringstream ss;
+  ss << "batches=" << num_batches_
+     << " batch_saved=" << batch_saved_time_;
+  for (const auto& it : latencies_) {
+    ss << " [" << it.first << "]"
+       << " count=" << it.second.count
+       << " total=" << it.second.total
+       << " max=" << it.second.max;
+  }
+  return ss.str();
+}
+
+void CompilerInfoProbeStats::RecordUnlocked(const std::string& name,
+                                            absl::Duration duration) {
+  Latency* latency = &latencies_[name];
+  ++latency->count;
+  latency->total += duration;
+  if (duration > latency->max) {
+    latency->max = duration;
+  }
+}
+
+void ReadProbeCommandOutputs(std::vector<CommandOutputRequest>* requests) {
+  const absl::Time start = absl::Now();
+  ReadCommandOutputs(requests);
+  CompilerInfoProbeStats::instance()->RecordBatch(*requests,
+                                                  absl::Now() - start);
+}
+
+std::string ReadProbeCommandOutput(const std::string& name,
+                                   const std::string& prog,
+                                   const std::vector<std::string>& argv,
+                                   const std::vector<std::string>& env,
+                                   const std::string& cwd,
+                                   CommandOutputOption option,
+                                   int32_t* status) {
+  std::vector<CommandOutputRequest> requests(1);
+  CommandOutputRequest* request = &requests[0];
+  request->name = name;
+  request->prog = prog;
+  request->argv = argv;
+  request->env = env;
+  request->cwd = cwd;
+  request->option = option;
+  ReadProbeCommandOutputs(&requests);
+  *status = request->status;
+  return std::move(request->output);
+}
+
+}  // namespace devtools_goma
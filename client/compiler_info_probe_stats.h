@@ -0,0 +1,78 @@
+// Copyright 2020 The Goma Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#ifndef DEVTOOLS_GOMA_CLIENT_COMPILER_INFO_PROBE_STATS_H_
+#define DEVTOOLS_GOMA_CLIENT_COMPILER_INFO_PROBE_STATS_H_
+
+#include <stdint.h>
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include "absl/base/thread_annotations.h"
+#include "absl/time/time.h"
+#include "basictypes.h"
+#include "lockhelper.h"
+#include "util.h"
+
+namespace devtools_goma {
+
+class CompilerInfoStats;
+
+// CompilerInfoProbeStats aggregates latency of commands run to get compiler
+// info (e.g. "clang -xc++ -v -E", "clang -E -dM"), per kind of probe.
+//
+// This class is thread-safe.
+class CompilerInfoProbeStats {
+ public:
+  CompilerInfoProbeStats() = default;
+
+  static CompilerInfoProbeStats* instance();
+
+  // Records a probe |name| that took |duration|.
+  void Record(const std::string& name, absl::Duration duration)
+      ABSL_LOCKS_EXCLUDED(mu_);
+  // Records probes in |requests|, which ran concurrently in |wall_time|.
+  void RecordBatch(const std::vector<CommandOutputRequest>& requests,
+                   absl::Duration wall_time) ABSL_LOCKS_EXCLUDED(mu_);
+
+  void DumpStatsToProto(CompilerInfoStats* stats) const
+      ABSL_LOCKS_EXCLUDED(mu_);
+  std::string DebugString() const ABSL_LOCKS_EXCLUDED(mu_);
+
+ private:
+  struct Latency {
+    int64_t count = 0;
+    absl::Duration total;
+    absl::Duration max;
+  };
+
+  void RecordUnlocked(const std::string& name, absl::Duration duration)
+      ABSL_EXCLUSIVE_LOCKS_REQUIRED(mu_);
+
+  mutable Lock mu_;
+  std::map<std::string, Latency> latencies_ ABSL_GUARDED_BY(mu_);
+  int64_t num_batches_ ABSL_GUARDED_BY(mu_) = 0;
+  absl::Duration batch_saved_time_ ABSL_GUARDED_BY(mu_);
+
+  DISALLOW_COPY_AND_ASSIGN(CompilerInfoProbeStats);
+};
+
+// Runs |requests| with ReadCommandOutputs as probes to get compiler info,
+// and records their latency.
+void ReadProbeCommandOutputs(std::vector<CommandOutputRequest>* requests);
+
+// Same as ReadCommandOutput, but records latency as probe |name|.
+std::string ReadProbeCommandOutput(const std::string& name,
+                                   const std::string& prog,
+                                   const std::vector<std::string>& argv,
+                                   const std::vector<std::string>& env,
+                                   const std::string& cwd,
+                                   CommandOutputOption option,
+                                   int32_t* status);
+
+}  // namespace devtools_goma
+
+#endif  // DEVTOOLS_GOMA_CLIENT_COMPILER_INFO_PROBE_STATS_H_
@@ -0,0 +1,74 @@
+// Copyright 2020 The Goma Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "compiler_info_probe_stats.h"
+
+#include "compiler_specific.h"
+#include "gtest/gtest.h"
+
+MSVC_PUSH_DISABLE_WARNING_FOR_PROTO()
+#include "lib/goma_stats.pb.h"
+MSVC_POP_WARNING()
+
+namespace devtools_goma {
+
+namespace {
+
+CommandOutputRequest ProbeRequest(const std::string& name,
+                                  absl::Duration run_time) {
+  CommandOutputRequest request;
+  request.name = name;
+  request.run_time = run_time;
+  return request;
+}
+
+}  // anonymous namespace
+
+TEST(CompilerInfoProbeStatsTest, Record) {
+  CompilerInfoProbeStats stats;
+  stats.Record("predefined macros", absl::Milliseconds(30));
+  stats.Record("display programs", absl::Milliseconds(10));
+  stats.Record("display programs", absl::Milliseconds(20));
+
+  CompilerInfoStats proto;
+  stats.DumpStatsToProto(&proto);
+  ASSERT_EQ(2, proto.probes_size());
+  EXPECT_EQ("display programs", proto.probes(0).name());
+  EXPECT_EQ(2, proto.probes(0).count());
+  EXPECT_EQ(30, proto.probes(0).total_ms());
+  EXPECT_EQ(20, proto.probes(0).max_ms());
+  EXPECT_EQ("predefined macros", proto.probes(1).name());
+  EXPECT_EQ(1, proto.probes(1).count());
+  EXPECT_EQ(30, proto.probes(1).total_ms());
+  EXPECT_EQ(30, proto.probes(1).max_ms());
+  EXPECT_EQ(0, proto.probe_batches());
+  EXPECT_EQ(0, proto.probe_batch_saved_ms());
+}
+
+TEST(CompilerInfoProbeStatsTest, RecordBatch) {
+  CompilerInfoProbeStats stats;
+  std::vector<CommandOutputRequest> requests;
+  requests.push_back(ProbeRequest("display programs", absl::Milliseconds(40)));
+  requests.push_back(ProbeRequest("display programs", absl::Milliseconds(30)));
+  requests.push_back(ProbeRequest("predefined macros", absl::Milliseconds(20)));
+  stats.RecordBatch(requests, absl::Milliseconds(50));
+
+  // Single request is not counted as a batch.
+  requests.resize(1);
+  stats.RecordBatch(requests, absl::Milliseconds(40));
+
+  CompilerInfoStats proto;
+  stats.DumpStatsToProto(&proto);
+  ASSERT_EQ(2, proto.probes_size());
+  EXPECT_EQ("display programs", proto.probes(0).name());
+  EXPECT_EQ(3, proto.probes(0).count());
+  EXPECT_EQ(110, proto.probes(0).total_ms());
+  EXPECT_EQ(40, proto.probes(0).max_ms());
+  EXPECT_EQ("predefined macros", proto.probes(1).name());
+  EXPECT_EQ(1, proto.probes(1).count());
+  EXPECT_EQ(1, proto.probe_batches());
+  EXPECT_EQ(40, proto.probe_batch_saved_ms());
+}
+
+}  // namespace devtools_goma
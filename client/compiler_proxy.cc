@@ -37,11 +37,16 @@
 #include "breakpad.h"
 #include "clang_modules/modulemap/cache.h"
 #include "compiler_info_cache.h"
+#include "compiler_proxy_info.h"
 #include "compiler_proxy_http_handler.h"
 #include "counterz.h"
 #include "cxx/include_processor/include_cache.h"
 #include "cxx/include_processor/include_file_finder.h"
+#include "cxx/include_processor/include_prefetcher.h"
+#include "cxx/include_processor/include_resolution_cache.h"
 #include "deps_cache.h"
+#include "file_stat_cache.h"
+#include "file_watcher.h"
 #include "glog/logging.h"
 #include "goma_init.h"
 #include "ioutil.h"
@@ -52,6 +57,7 @@
 #include "platform_thread.h"
 #include "scoped_fd.h"
 #include "settings.h"
+#include "stored_file_chunk_cache.h"
 #include "subprocess.h"
 #include "subprocess_controller.h"
 #include "subprocess_controller_client.h"
@@ -174,7 +180,9 @@ void DepsCacheInit() {
               absl::Seconds(FLAGS_DEPS_CACHE_IDENTIFIER_ALIVE_DURATION)) :
           absl::nullopt,
       FLAGS_DEPS_CACHE_TABLE_THRESHOLD,
-      FLAGS_DEPS_CACHE_MAX_PROTO_SIZE_IN_MB);
+      FLAGS_DEPS_CACHE_MAX_PROTO_SIZE_IN_MB,
+      FLAGS_DEPS_CACHE_FLAT_FILE ? DepsCache::FileFormat::kFlat
+                                 : DepsCache::FileFormat::kProto);
 }
 
 }  // anonymous namespace
@@ -193,10 +201,6 @@ int main(int argc, char* argv[], const char* envp[]) {
   }
 #endif
 
-  if (FLAGS_ENABLE_GLOBAL_FILE_STAT_CACHE) {
-    devtools_goma::GlobalFileStatCache::Init();
-  }
-
   const std::string tmpdir = FLAGS_TMP_DIR;
 #ifndef _WIN32
   const std::string compiler_proxy_addr =
@@ -301,6 +305,9 @@ int main(int argc, char* argv[], const char* envp[]) {
   subproc_options.max_subprocs_low_priority = FLAGS_MAX_SUBPROCS_LOW;
   subproc_options.max_subprocs_heavy_weight = FLAGS_MAX_SUBPROCS_HEAVY;
   subproc_options.dont_kill_subprocess = FLAGS_DONT_KILL_SUBPROCESS;
+  subproc_options.resource_aware_scheduling =
+      FLAGS_RESOURCE_AWARE_SUBPROCS;
+  subproc_options.direct_spawn = FLAGS_DIRECT_SPAWN_SUBPROCS;
 
   devtools_goma::SubProcessController::Initialize(argv[0], subproc_options);
 
@@ -320,17 +327,37 @@ int main(int argc, char* argv[], const char* envp[]) {
   devtools_goma::WorkerThreadManager wm;
   wm.Start(FLAGS_COMPILER_PROXY_THREADS);
 
+  // FileWatcher thread should be started after daemonized.
+  devtools_goma::FileWatcher::Init(FLAGS_FILE_WATCHER_MAX_WATCHES);
+  if (FLAGS_ENABLE_GLOBAL_FILE_STAT_CACHE ||
+      devtools_goma::FileWatcher::IsEnabled()) {
+    devtools_goma::GlobalFileStatCache::Init();
+  }
+
   devtools_goma::SubProcessControllerClient::Initialize(&wm, tmpdir);
 
   devtools_goma::InstallReadCommandOutputFunc(
       &devtools_goma::SubProcessTask::ReadCommandOutput);
+  devtools_goma::InstallReadCommandOutputsFunc(
+      &devtools_goma::SubProcessTask::ReadCommandOutputs);
 
   devtools_goma::IncludeFileFinder::Init(FLAGS_ENABLE_GCH_HACK);
 
   devtools_goma::IncludeCache::Init(FLAGS_MAX_INCLUDE_CACHE_ENTRIES,
                                     !FLAGS_DEPS_CACHE_FILE.empty());
+  if (FLAGS_DIRECTIVE_SNAPSHOT && devtools_goma::IncludeCache::IsEnabled()) {
+    devtools_goma::IncludeCache::instance()->EnableDirectiveSnapshot(
+        devtools_goma::GetCacheDirectory(), kBuiltRevisionString);
+  }
+  if (devtools_goma::IncludeCache::IsEnabled()) {
+    devtools_goma::IncludePrefetcher::Init(&wm, FLAGS_INCLUDE_PREFETCH_THREADS);
+  }
   devtools_goma::modulemap::Cache::Init(FLAGS_MAX_MODULEMAP_CACHE_ENTRIES);
   devtools_goma::ListDirCache::Init(FLAGS_MAX_LIST_DIR_CACHE_ENTRY_NUM);
+  devtools_goma::IncludeResolutionCache::Init(
+      FLAGS_MAX_INCLUDE_RESOLUTION_CACHE_ENTRIES);
+  devtools_goma::StoredFileChunkCache::Init(
+      FLAGS_MAX_STORED_FILE_CHUNK_CACHE_ENTRIES);
 
   devtools_goma::DepsCacheInit();
   std::unique_ptr<devtools_goma::WorkerThreadRunner> load_deps_cache(
@@ -340,12 +367,23 @@ int main(int argc, char* argv[], const char* envp[]) {
   devtools_goma::CompilerInfoCache::Init(
       devtools_goma::GetCacheDirectory(), FLAGS_COMPILER_INFO_CACHE_FILE,
       FLAGS_COMPILER_INFO_CACHE_NUM_ENTRIES,
-      absl::Seconds(FLAGS_COMPILER_INFO_CACHE_HOLDING_TIME_SEC));
+      absl::Seconds(FLAGS_COMPILER_INFO_CACHE_HOLDING_TIME_SEC),
+      FLAGS_COMPILER_INFO_CACHE_JOURNAL);
   std::unique_ptr<devtools_goma::WorkerThreadRunner> load_compiler_info_cache(
       new devtools_goma::WorkerThreadRunner(
           &wm, FROM_HERE,
           devtools_goma::NewCallback(
               devtools_goma::CompilerInfoCache::LoadIfEnabled)));
+  devtools_goma::PeriodicClosureId flush_compiler_info_cache_id =
+      devtools_goma::kInvalidPeriodicClosureId;
+  if (FLAGS_COMPILER_INFO_CACHE_JOURNAL &&
+      FLAGS_COMPILER_INFO_CACHE_JOURNAL_SYNC_INTERVAL_SEC > 0) {
+    flush_compiler_info_cache_id = wm.RegisterPeriodicClosure(
+        FROM_HERE,
+        absl::Seconds(FLAGS_COMPILER_INFO_CACHE_JOURNAL_SYNC_INTERVAL_SEC),
+        devtools_goma::NewPermanentCallback(
+            devtools_goma::CompilerInfoCache::FlushIfEnabled));
+  }
 
   devtools_goma::TrustedIpsManager trustedipsmanager;
   devtools_goma::InitTrustedIps(&trustedipsmanager);
@@ -418,24 +456,33 @@ int main(int argc, char* argv[], const char* envp[]) {
 
   load_deps_cache.reset();
   load_compiler_info_cache.reset();
+  if (flush_compiler_info_cache_id !=
+      devtools_goma::kInvalidPeriodicClosureId) {
+    wm.UnregisterPeriodicClosure(flush_compiler_info_cache_id);
+  }
   // TODO: Remove this when b/118804052 is fixed.
-  devtools_goma::CompilerInfoCache::instance()->Save();
+  devtools_goma::CompilerInfoCache::instance()->Flush();
 
   server.Wait();
   handler->Wait();
   devtools_goma::CompilerInfoCache::Quit();
   devtools_goma::DepsCache::Quit();
+  devtools_goma::IncludePrefetcher::Quit();
   devtools_goma::IncludeCache::Quit();
   devtools_goma::modulemap::Cache::Quit();
+  devtools_goma::IncludeResolutionCache::Quit();
   devtools_goma::ListDirCache::Quit();
   devtools_goma::SubProcessControllerClient::Get()->Shutdown();
 
   handler.reset();
   wm.Finish();
+  devtools_goma::StoredFileChunkCache::Quit();
 
-  if (FLAGS_ENABLE_GLOBAL_FILE_STAT_CACHE) {
+  if (FLAGS_ENABLE_GLOBAL_FILE_STAT_CACHE ||
+      devtools_goma::FileWatcher::IsEnabled()) {
     devtools_goma::GlobalFileStatCache::Quit();
   }
+  devtools_goma::FileWatcher::Quit();
 
 #if HAVE_COUNTERZ
   if (FLAGS_ENABLE_COUNTERZ) {
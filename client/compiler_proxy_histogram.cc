@@ -279,6 +279,21 @@ double CompilerProxyHistogram::GetStatStandardDeviation(
   return h.standard_deviation();
 }
 
+int64_t CompilerProxyHistogram::GetStatPercentile(HistogramItems item,
+                                                  double percentile) const {
+  DCHECK_GE(item, 0);
+  DCHECK_LT(item, NumCols);
+  AUTOLOCK(lock, &mu_);
+  return histogram_[item].Percentile(percentile);
+}
+
+int64_t CompilerProxyHistogram::GetStatCount(HistogramItems item) const {
+  DCHECK_GE(item, 0);
+  DCHECK_LT(item, NumCols);
+  AUTOLOCK(lock, &mu_);
+  return histogram_[item].count();
+}
+
 void CompilerProxyHistogram::DumpString(std::ostringstream* ss) {
   AUTOLOCK(lock, &mu_);
   for (size_t i = 0; i < NumCols; ++i) {
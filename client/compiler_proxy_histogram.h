@@ -95,6 +95,8 @@ class CompilerProxyHistogram {
 
   int64_t GetStatMean(HistogramItems item) const;
   double GetStatStandardDeviation(HistogramItems item) const;
+  int64_t GetStatPercentile(HistogramItems item, double percentile) const;
+  int64_t GetStatCount(HistogramItems item) const;
   void DumpString(std::ostringstream* ss);
   void DumpToProto(GomaHistograms* hist);
 
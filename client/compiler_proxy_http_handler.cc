@@ -3,6 +3,7 @@
 // found in the LICENSE file.
 #include "compiler_proxy_http_handler.h"
 
+#include <algorithm>
 #include <sstream>
 
 #include "absl/container/flat_hash_set.h"
@@ -41,6 +42,7 @@
 #include "jquery.min.h"
 #include "legend_help.h"
 #include "linker/linker_input_processor/arfile_reader.h"
+#include "local_race_policy.h"
 #include "log_cleaner.h"
 #include "log_service_client.h"
 #include "multi_http_rpc.h"
@@ -239,8 +241,17 @@ CompilerProxyHttpHandler::CompilerProxyHttpHandler(std::string myname,
   service_.SetHttpRPC(
       absl::make_unique<HttpRPC>(service_.http_client(), http_rpc_options));
 
-  service_.SetExecServiceClient(
-      absl::make_unique<ExecServiceClient>(service_.http_rpc(), "/e"));
+  if (FLAGS_EXEC_HEDGE_BUDGET_PERCENT > 0) {
+    HedgePolicy::Options hedge_options;
+    hedge_options.percentile = FLAGS_EXEC_HEDGE_PERCENTILE;
+    hedge_options.min_delay = absl::Milliseconds(FLAGS_EXEC_HEDGE_MIN_DELAY_MS);
+    hedge_options.budget_ratio = FLAGS_EXEC_HEDGE_BUDGET_PERCENT / 100.0;
+    service_.SetExecServiceClient(absl::make_unique<HedgedExecServiceClient>(
+        service_.http_rpc(), "/e", wm, service_.histogram(), hedge_options));
+  } else {
+    service_.SetExecServiceClient(
+        absl::make_unique<ExecServiceClient>(service_.http_rpc(), "/e"));
+  }
 
   MultiHttpRPC::Options multi_store_options;
   multi_store_options.max_req_in_call = FLAGS_MULTI_STORE_IN_CALL;
@@ -248,10 +259,33 @@ CompilerProxyHttpHandler::CompilerProxyHttpHandler(std::string myname,
       FLAGS_MULTI_STORE_THRESHOLD_SIZE_IN_CALL;
   multi_store_options.check_interval =
       absl::Milliseconds(FLAGS_MULTI_STORE_PENDING_MS);
+  multi_store_options.adaptive = FLAGS_MULTI_RPC_ADAPTIVE_BATCHING;
+  multi_store_options.min_check_interval =
+      absl::Milliseconds(FLAGS_MULTI_RPC_MIN_PENDING_MS);
   service_.SetMultiFileStore(absl::make_unique<MultiFileStore>(
       service_.http_rpc(), "/s", multi_store_options, wm));
-  service_.SetFileServiceHttpClient(absl::make_unique<FileServiceHttpClient>(
-      service_.http_rpc(), "/s", "/l", service_.multi_file_store()));
+  if (FLAGS_LOOKUP_FILE_BEFORE_STORE) {
+    MultiHttpRPC::Options multi_lookup_options;
+    multi_lookup_options.max_req_in_call = FLAGS_MULTI_LOOKUP_IN_CALL;
+    multi_lookup_options.req_size_threshold_in_call =
+        FLAGS_MULTI_STORE_THRESHOLD_SIZE_IN_CALL;
+    multi_lookup_options.check_interval =
+        absl::Milliseconds(FLAGS_MULTI_LOOKUP_PENDING_MS);
+    multi_lookup_options.adaptive = FLAGS_MULTI_RPC_ADAPTIVE_BATCHING;
+    multi_lookup_options.min_check_interval =
+        absl::Milliseconds(FLAGS_MULTI_RPC_MIN_PENDING_MS);
+    service_.SetMultiFileLookup(absl::make_unique<MultiFileLookup>(
+        service_.http_rpc(), "/l", multi_lookup_options, wm));
+  }
+  std::unique_ptr<FileServiceHttpClient> file_service_http_client =
+      absl::make_unique<FileServiceHttpClient>(service_.http_rpc(), "/s", "/l",
+                                               service_.multi_file_store());
+  file_service_http_client->SetMultiFileLookup(service_.multi_file_lookup());
+  if (FLAGS_FILE_CHUNK_HASH_THREADS > 0) {
+    file_service_http_client->SetChunkHashPool(
+        wm, wm->StartPool(FLAGS_FILE_CHUNK_HASH_THREADS, "file_chunk_hash"));
+  }
+  service_.SetFileServiceHttpClient(std::move(file_service_http_client));
   if (FLAGS_PROVIDE_INFO)
     service_.SetLogServiceClient(absl::make_unique<LogServiceClient>(
         service_.http_rpc(), "/sl", FLAGS_NUM_LOG_IN_SAVE_LOG,
@@ -287,11 +321,26 @@ CompilerProxyHttpHandler::CompilerProxyHttpHandler(std::string myname,
   service_.SetLocalRunPreference(FLAGS_LOCAL_RUN_PREFERENCE);
   service_.SetLocalRunForFailedInput(FLAGS_LOCAL_RUN_FOR_FAILED_INPUT);
   service_.SetLocalRunDelay(absl::Milliseconds(FLAGS_LOCAL_RUN_DELAY_MSEC));
+  if (FLAGS_LOCAL_RACE_POLICY) {
+    LocalRacePolicy::Options race_options;
+    race_options.num_local_slots = std::max(1, FLAGS_MAX_SUBPROCS);
+    service_.SetLocalRacePolicy(
+        absl::make_unique<LocalRacePolicy>(race_options));
+  }
   service_.SetMaxSumOutputSize(FLAGS_MAX_SUM_OUTPUT_SIZE_IN_MB * 1024 * 1024);
   service_.SetStoreLocalRunOutput(FLAGS_STORE_LOCAL_RUN_OUTPUT);
   service_.SetShouldFailForUnsupportedCompilerFlag(
       FLAGS_FAIL_FOR_UNSUPPORTED_COMPILER_FLAGS);
   service_.SetTmpDir(tmpdir_);
+  if (!FLAGS_FILE_HASH_CACHE_FILE.empty()) {
+    service_.SetFileHashCacheFile(
+        file::JoinPathRespectAbsolute(GetCacheDirectory(),
+                                      FLAGS_FILE_HASH_CACHE_FILE),
+        FLAGS_FILE_HASH_CACHE_ALIVE_DURATION >= 0
+            ? absl::optional<absl::Duration>(
+                  absl::Seconds(FLAGS_FILE_HASH_CACHE_ALIVE_DURATION))
+            : absl::nullopt);
+  }
   if (FLAGS_ALLOWED_NETWORK_ERROR_DURATION >= 0) {
     service_.SetAllowedNetworkErrorDuration(
         absl::Seconds(FLAGS_ALLOWED_NETWORK_ERROR_DURATION));
@@ -1050,6 +1099,10 @@ int CompilerProxyHttpHandler::HandleHttpRpcRequest(
   ss << "[http rpc]\n\n" << service_.http_rpc()->DebugString();
   ss << "\n\n";
   ss << "[multi store]\n\n" << service_.multi_file_store()->DebugString();
+  if (service_.multi_file_lookup() != nullptr) {
+    ss << "\n\n";
+    ss << "[multi lookup]\n\n" << service_.multi_file_lookup()->DebugString();
+  }
   *response = ss.str();
   return 200;
 }
@@ -10,11 +10,13 @@
 #include "absl/strings/numbers.h"
 #include "absl/strings/str_split.h"
 #include "absl/strings/string_view.h"
+#include "absl/types/optional.h"
 #include "cmdline_parser.h"
 #include "compiler_flag_type.h"
 #include "compiler_flag_type_specific.h"
 #include "compiler_info.h"
 #include "compiler_info_builder.h"
+#include "compiler_info_probe_stats.h"
 #include "counterz.h"
 #include "cxx/include_processor/predefined_macros.h"
 #include "flag_parser.h"
@@ -108,15 +110,55 @@ std::unique_ptr<FlagParser> GetFlagParser(absl::string_view argv0) {
   }
 }
 
-std::string GccDisplayPrograms(
+std::vector<std::string> ProbeEnv(
+    const std::vector<std::string>& compiler_info_envs) {
+  std::vector<std::string> env;
+  env.push_back("LC_ALL=C");
+  copy(compiler_info_envs.begin(), compiler_info_envs.end(),
+       back_inserter(env));
+  return env;
+}
+
+// Sets |empty_file| to a file that can be used as empty input and discarded
+// output of a probe command.
+// A temporary file is created in |tmp_files| on Windows.
+bool ProbeEmptyFile(std::vector<std::unique_ptr<ScopedTmpFile>>* tmp_files,
+                    std::string* empty_file) {
+#ifdef _WIN32
+  // This code is used by NaCl gcc, PNaCl clang and clang-cl on Windows.
+  // Former uses /dev/null as null device, and latter recently uses NUL as
+  // null device.  To provide the same code to both, let me use temporary
+  // file for that.
+  // Each probe uses its own file since probes may run concurrently.
+  auto tmp = absl::make_unique<ScopedTmpFile>("gcc_display_program");
+  if (!tmp->valid()) {
+    LOG(ERROR) << "cannot make an empty file";
+    return false;
+  }
+  tmp->Close();
+  *empty_file = tmp->filename();
+  tmp_files->push_back(std::move(tmp));
+  VLOG(2) << "empty_file=" << *empty_file;
+#else
+  *empty_file = "/dev/null";
+#endif
+  return true;
+}
+
+// Makes a request to run
+// "gcc |lang_flag| |option| -v -E |empty_file| -o |empty_file|".
+CommandOutputRequest GccDisplayProgramsRequest(
     const std::string& normal_compiler_path,
     const std::vector<std::string>& compiler_info_flags,
     const std::vector<std::string>& compiler_info_envs,
     const std::string& lang_flag,
     const std::string& option,
     const std::string& cwd,
-    int32_t* status) {
-  std::vector<std::string> argv;
+    const std::string& empty_file) {
+  CommandOutputRequest request;
+  request.name = "display programs";
+  request.prog = normal_compiler_path;
+  std::vector<std::string>& argv = request.argv;
   argv.push_back(normal_compiler_path);
   copy(compiler_info_flags.begin(), compiler_info_flags.end(),
        back_inserter(argv));
@@ -127,70 +169,33 @@ std::string GccDisplayPrograms(
     }
     argv.push_back(option);
   }
-#ifdef _WIN32
-  // This code is used by NaCl gcc, PNaCl clang and clang-cl on Windows.
-  // Former uses /dev/null as null device, and latter recently uses NUL as
-  // null device.  To provide the same code to both, let me use temporary
-  // file for that.
-  ScopedTmpFile tmp("gcc_display_program");
-  if (!tmp.valid()) {
-    LOG(ERROR) << "cannot make an empty file";
-    *status = -1;
-    return "";
-  }
-  tmp.Close();
-  const std::string& empty_file = tmp.filename();
-  VLOG(2) << "empty_file=" << empty_file;
-#else
-  const std::string& empty_file = "/dev/null";
-#endif
   argv.push_back("-v");
   argv.push_back("-E");
   argv.push_back(empty_file);
   argv.push_back("-o");
   argv.push_back(empty_file);
 
-  std::vector<std::string> env;
-  env.push_back("LC_ALL=C");
-  copy(compiler_info_envs.begin(), compiler_info_envs.end(),
-       back_inserter(env));
-
-  {
-    GOMA_COUNTERZ("ReadCommandOutput(-v)");
-    return ReadCommandOutput(normal_compiler_path, argv, env, cwd,
-                             MERGE_STDOUT_STDERR, status);
-  }
+  request.env = ProbeEnv(compiler_info_envs);
+  request.cwd = cwd;
+  return request;
 }
 
-std::string GccDisplayPredefinedMacros(
+// Makes a request to run
+// "gcc |lang_flag| -E -ffreestanding |empty_file| -dM".
+CommandOutputRequest GccDisplayPredefinedMacrosRequest(
     const std::string& normal_compiler_path,
     const std::vector<std::string>& compiler_info_flags,
     const std::vector<std::string>& compiler_info_envs,
     const std::string& cwd,
     const std::string& lang_flag,
-    int32_t* status) {
-  std::vector<std::string> argv;
+    const std::string& empty_file) {
+  CommandOutputRequest request;
+  request.name = "predefined macros";
+  request.prog = normal_compiler_path;
+  std::vector<std::string>& argv = request.argv;
   argv.push_back(normal_compiler_path);
   copy(compiler_info_flags.begin(), compiler_info_flags.end(),
        back_inserter(argv));
-#ifdef _WIN32
-  // This code is used by NaCl gcc, PNaCl clang and clang-cl on Windows.
-  // Former uses /dev/null as null device, and latter recently uses NUL as
-  // null device.  To provide the same code to both, let me use temporary
-  // file for that.
-  ScopedTmpFile tmp("gcc_display_predefined_macro");
-  if (!tmp.valid()) {
-    LOG(ERROR) << "cannot make an empty file";
-    *status = -1;
-    return "";
-  }
-  tmp.Close();
-  const std::string& empty_file = tmp.filename();
-  VLOG(2) << "empty_file=" << empty_file;
-#else
-  const std::string& empty_file = "/dev/null";
-#endif
-
   argv.push_back(lang_flag);
   argv.push_back("-E");
   argv.push_back("-ffreestanding");  // skip stdc-predef.h
@@ -200,25 +205,228 @@ std::string GccDisplayPredefinedMacros(
   }
   argv.push_back("-dM");
 
-  std::vector<std::string> env;
-  env.push_back("LC_ALL=C");
-  copy(compiler_info_envs.begin(), compiler_info_envs.end(),
-       back_inserter(env));
+  request.env = ProbeEnv(compiler_info_envs);
+  request.cwd = cwd;
+  return request;
+}
 
-  std::string macros;
-  {
-    GOMA_COUNTERZ("ReadCommandOutput(-E -ffreestanding -dM)");
-    macros = ReadCommandOutput(normal_compiler_path, argv, env, cwd,
-                               MERGE_STDOUT_STDERR, status);
-  }
-  if (*status != 0) {
+bool SetPredefinedMacros(const CommandOutputRequest& request,
+                         CompilerInfoData* compiler_info) {
+  if (request.status != 0) {
     LOG(ERROR) << "ReadCommandOutput exited with non zero status code."
-               << " normal_compiler_path=" << normal_compiler_path
-               << " status=" << status << " argv=" << argv << " env=" << env
-               << " cwd=" << cwd << " macros=" << macros;
-    return "";
+               << " normal_compiler_path=" << request.prog
+               << " status=" << request.status << " argv=" << request.argv
+               << " env=" << request.env << " cwd=" << request.cwd
+               << " macros=" << request.output;
+    return false;
+  }
+  compiler_info->mutable_cxx()->set_predefined_macros(request.output);
+  return true;
+}
+
+std::string PredefinedFeaturesSource(const std::string& lang_flag) {
+  std::ostringstream oss;
+
+  int index = 0;
+
+  // Check object-like predefined macros are supported.
+  // For example, __FILE__, __LINE__, __COUNTER__, ...
+  for (int i = 0; i < kPredefinedObjectMacroSize; ++i) {
+    oss << "#ifdef " << kPredefinedObjectMacros[i] << "\n"
+        << '#' << ++index << '\n'
+        << "1\n"
+        << "#else\n";
+    oss << '#' << index << '\n'
+        << "0\n"
+        << "#endif\n";
   }
-  return macros;
+
+  // Check function-like predefined macros are supported.
+  // __has_include(), __has_feature(), __has_extension(), ...
+  for (int i = 0; i < kPredefinedFunctionMacroSize; ++i) {
+    oss << "#ifdef " << kPredefinedFunctionMacros[i] << "\n"
+        << '#' << ++index << '\n'
+        << "1\n"
+        << "#else\n";
+    oss << '#' << index << '\n'
+        << "0\n"
+        << "#endif\n";
+  }
+
+  // Define predefined macros in case they are not defined.
+  oss << "#ifndef __has_feature\n"
+      << "# define __has_feature(x) 0\n"
+      << "#endif\n"
+      << "#ifndef __has_extension\n"
+      << "# define __has_extension(x) 0\n"
+      << "#endif\n"
+      << "#ifndef __has_attribute\n"
+      << "# define __has_attribute(x) 0\n"
+      << "#endif\n"
+      << "#ifndef __has_cpp_attribute\n"
+      << "# define __has_cpp_attribute(x) 0\n"
+      << "#endif\n"
+      << "#ifndef __has_declspec_attribute\n"
+      << "# define __has_declspec_attribute(x) 0\n"
+      << "#endif\n"
+      << "#ifndef __has_builtin\n"
+      << "# define __has_builtin(x) 0\n"
+      << "#endif\n"
+      << "#ifndef __has_warning\n"
+      << "# define __has_warning(x) 0\n"
+      << "#endif\n";
+
+  for (const char* s : KNOWN_FEATURES) {
+    // Specify the line number to tell pre-processor to output newlines.
+    oss << '#' << ++index << '\n';
+    oss << "__has_feature(" << s << ")\n";
+  }
+  for (const char* s : KNOWN_EXTENSIONS) {
+    // Specify the line number to tell pre-processor to output newlines.
+    oss << '#' << ++index << '\n';
+    oss << std::string("__has_extension(") << s << ")\n";
+  }
+  for (const char* s : KNOWN_ATTRIBUTES) {
+    // Specify the line number to tell pre-processor to output newlines.
+    oss << '#' << ++index << '\n';
+    oss << std::string("__has_attribute(") << s << ")\n";
+  }
+  // If the attributes has "::", gcc fails in C-mode,
+  // but works on C++ mode. So, when "::" is detected, we ignore it in C mode.
+  // :: can be used like "clang::", "gsl::"
+  for (const char* s : KNOWN_CPP_ATTRIBUTES) {
+    // Specify the line number to tell pre-processor to output newlines.
+    oss << '#' << ++index << '\n';
+    if (lang_flag == "-xc++" || strchr(s, ':') == nullptr) {
+      oss << "__has_cpp_attribute(" << s << ")\n";
+    } else {
+      oss << "0\n";
+    }
+  }
+  for (const char* s : KNOWN_DECLSPEC_ATTRIBUTES) {
+    oss << '#' << ++index << '\n';
+    oss << "__has_declspec_attribute(" << s << ")\n";
+  }
+  for (const char* s : KNOWN_BUILTINS) {
+    oss << '#' << ++index << '\n';
+    oss << "__has_builtin(" << s << ")\n";
+  }
+  for (const char* s : KNOWN_WARNINGS) {
+    oss << '#' << ++index << '\n';
+    oss << "__has_warning(\"" << s << "\")\n";
+  }
+
+  return oss.str();
+}
+
+// Writes source to check predefined features and extensions into |tmp_file|.
+bool WritePredefinedFeaturesSource(const std::string& lang_flag,
+                                   ScopedTmpFile* tmp_file,
+                                   CompilerInfoData* compiler_info) {
+  const std::string& source = PredefinedFeaturesSource(lang_flag);
+  VLOG(1) << "source=" << source;
+
+  if (!tmp_file->valid()) {
+    PLOG(ERROR) << "failed to make temp file: " << tmp_file->filename();
+    CompilerInfoBuilder::AddErrorMessage(
+        "goma error: failed to create a temp. file.", compiler_info);
+    return false;
+  }
+
+  ssize_t written = tmp_file->Write(source.data(), source.size());
+  if (static_cast<ssize_t>(source.size()) != written) {
+    PLOG(ERROR) << "Failed to write source into " << tmp_file->filename()
+                << ": " << source.size() << " vs " << written;
+    CompilerInfoBuilder::AddErrorMessage(
+        "goma error: failed to write a temp file.", compiler_info);
+    return false;
+  }
+  // We do not need to append data to |tmp_file|.
+  // Keeping it opened may cause a trouble on Windows.
+  // Note: |tmp_file->filename()| is kept until |tmp_file| is destructed.
+  if (!tmp_file->Close()) {
+    PLOG(ERROR) << "failed to close temp file: " << tmp_file->filename();
+    CompilerInfoBuilder::AddErrorMessage(
+        "goma error: failed to close a temp. file.", compiler_info);
+    return false;
+  }
+  return true;
+}
+
+// Makes a request to preprocess |source_file| written by
+// WritePredefinedFeaturesSource.
+CommandOutputRequest PredefinedFeaturesRequest(
+    const std::string& normal_compiler_path,
+    const std::string& lang_flag,
+    const std::vector<std::string>& compiler_info_flags,
+    const std::vector<std::string>& compiler_info_envs,
+    const std::string& cwd,
+    const std::string& source_file) {
+  CommandOutputRequest request;
+  request.name = "predefined features";
+  request.prog = normal_compiler_path;
+  std::vector<std::string>& argv = request.argv;
+  argv.push_back(normal_compiler_path);
+  copy(compiler_info_flags.begin(), compiler_info_flags.end(),
+       back_inserter(argv));
+  argv.push_back(lang_flag);
+  argv.push_back("-E");
+  argv.push_back(source_file);
+  VLOG(1) << "argv=" << argv;
+
+  request.env = ProbeEnv(compiler_info_envs);
+  request.cwd = cwd;
+  request.option = STDOUT_ONLY;
+  return request;
+}
+
+bool SetPredefinedFeaturesAndExtensions(const CommandOutputRequest& request,
+                                        CompilerInfoData* compiler_info) {
+  VLOG(1) << "out=" << request.output;
+  if (request.status != 0) {
+    LOG(ERROR) << "Read of features and extensions did not ends with status 0."
+               << " normal_compiler_path=" << request.prog
+               << " status=" << request.status << " argv=" << request.argv
+               << " env=" << request.env << " cwd=" << request.cwd
+               << " out=" << request.output;
+    int32_t status = 0;
+    std::string outerr =
+        ReadCommandOutput(request.prog, request.argv, request.env,
+                          request.cwd, MERGE_STDOUT_STDERR, &status);
+    absl::string_view piece(outerr);
+    const size_t chunk_size = 20000;
+    LOG(ERROR) << "out/err="
+               << piece.substr(0, std::min(chunk_size, piece.size()));
+    size_t begin_pos = chunk_size;
+    while (begin_pos < piece.size()) {
+      size_t len = std::min(chunk_size, piece.size() - begin_pos);
+      LOG(ERROR) << "out/err continued=" << piece.substr(begin_pos, len);
+      begin_pos += len;
+    }
+    return false;
+  }
+
+  using FeatureList = ClangCompilerInfoBuilderHelper::FeatureList;
+  FeatureList object_macros =
+      std::make_pair(kPredefinedObjectMacros, kPredefinedObjectMacroSize);
+  FeatureList function_macros =
+      std::make_pair(kPredefinedFunctionMacros, kPredefinedFunctionMacroSize);
+  FeatureList features = std::make_pair(KNOWN_FEATURES, NUM_KNOWN_FEATURES);
+  FeatureList extensions =
+      std::make_pair(KNOWN_EXTENSIONS, NUM_KNOWN_EXTENSIONS);
+  FeatureList attributes =
+      std::make_pair(KNOWN_ATTRIBUTES, NUM_KNOWN_ATTRIBUTES);
+  FeatureList cpp_attributes =
+      std::make_pair(KNOWN_CPP_ATTRIBUTES, NUM_KNOWN_CPP_ATTRIBUTES);
+  FeatureList declspec_attributes =
+      std::make_pair(KNOWN_DECLSPEC_ATTRIBUTES, NUM_KNOWN_DECLSPEC_ATTRIBUTES);
+  FeatureList builtins = std::make_pair(KNOWN_BUILTINS, NUM_KNOWN_BUILTINS);
+  FeatureList warnings = std::make_pair(KNOWN_WARNINGS, NUM_KNOWN_WARNINGS);
+
+  return ClangCompilerInfoBuilderHelper::ParseFeatures(
+      request.output, object_macros, function_macros, features, extensions,
+      attributes, cpp_attributes, declspec_attributes, builtins, warnings,
+      compiler_info);
 }
 
 }  // anonymous namespace
@@ -436,14 +644,20 @@ bool ClangCompilerInfoBuilderHelper::GetPredefinedMacros(
     const std::string& cwd,
     const std::string& lang_flag,
     CompilerInfoData* compiler_info) {
-  int32_t status;
-  const std::string& macros =
-      GccDisplayPredefinedMacros(normal_compiler_path, compiler_info_flags,
-                                 compiler_info_envs, cwd, lang_flag, &status);
-  if (status != 0)
+  std::vector<std::unique_ptr<ScopedTmpFile>> tmp_files;
+  std::string empty_file;
+  if (!ProbeEmptyFile(&tmp_files, &empty_file)) {
     return false;
-  compiler_info->mutable_cxx()->set_predefined_macros(macros);
-  return true;
+  }
+  std::vector<CommandOutputRequest> requests;
+  requests.push_back(GccDisplayPredefinedMacrosRequest(
+      normal_compiler_path, compiler_info_flags, compiler_info_envs, cwd,
+      lang_flag, empty_file));
+  {
+    GOMA_COUNTERZ("ReadCommandOutput(-E -ffreestanding -dM)");
+    ReadProbeCommandOutputs(&requests);
+  }
+  return SetPredefinedMacros(requests[0], compiler_info);
 }
 
 /* static */
@@ -628,187 +842,19 @@ bool ClangCompilerInfoBuilderHelper::GetPredefinedFeaturesAndExtensions(
     const std::vector<std::string>& compiler_info_envs,
     const std::string& cwd,
     CompilerInfoData* compiler_info) {
-  std::ostringstream oss;
-
-  int index = 0;
-
-  // Check object-like predefined macros are supported.
-  // For example, __FILE__, __LINE__, __COUNTER__, ...
-  for (int i = 0; i < kPredefinedObjectMacroSize; ++i) {
-    oss << "#ifdef " << kPredefinedObjectMacros[i] << "\n"
-        << '#' << ++index << '\n'
-        << "1\n"
-        << "#else\n";
-    oss << '#' << index << '\n'
-        << "0\n"
-        << "#endif\n";
-  }
-
-  // Check function-like predefined macros are supported.
-  // __has_include(), __has_feature(), __has_extension(), ...
-  for (int i = 0; i < kPredefinedFunctionMacroSize; ++i) {
-    oss << "#ifdef " << kPredefinedFunctionMacros[i] << "\n"
-        << '#' << ++index << '\n'
-        << "1\n"
-        << "#else\n";
-    oss << '#' << index << '\n'
-        << "0\n"
-        << "#endif\n";
-  }
-
-  // Define predefined macros in case they are not defined.
-  oss << "#ifndef __has_feature\n"
-      << "# define __has_feature(x) 0\n"
-      << "#endif\n"
-      << "#ifndef __has_extension\n"
-      << "# define __has_extension(x) 0\n"
-      << "#endif\n"
-      << "#ifndef __has_attribute\n"
-      << "# define __has_attribute(x) 0\n"
-      << "#endif\n"
-      << "#ifndef __has_cpp_attribute\n"
-      << "# define __has_cpp_attribute(x) 0\n"
-      << "#endif\n"
-      << "#ifndef __has_declspec_attribute\n"
-      << "# define __has_declspec_attribute(x) 0\n"
-      << "#endif\n"
-      << "#ifndef __has_builtin\n"
-      << "# define __has_builtin(x) 0\n"
-      << "#endif\n"
-      << "#ifndef __has_warning\n"
-      << "# define __has_warning(x) 0\n"
-      << "#endif\n";
-
-  for (const char* s : KNOWN_FEATURES) {
-    // Specify the line number to tell pre-processor to output newlines.
-    oss << '#' << ++index << '\n';
-    oss << "__has_feature(" << s << ")\n";
-  }
-  for (const char* s : KNOWN_EXTENSIONS) {
-    // Specify the line number to tell pre-processor to output newlines.
-    oss << '#' << ++index << '\n';
-    oss << std::string("__has_extension(") << s << ")\n";
-  }
-  for (const char* s : KNOWN_ATTRIBUTES) {
-    // Specify the line number to tell pre-processor to output newlines.
-    oss << '#' << ++index << '\n';
-    oss << std::string("__has_attribute(") << s << ")\n";
-  }
-  // If the attributes has "::", gcc fails in C-mode,
-  // but works on C++ mode. So, when "::" is detected, we ignore it in C mode.
-  // :: can be used like "clang::", "gsl::"
-  for (const char* s : KNOWN_CPP_ATTRIBUTES) {
-    // Specify the line number to tell pre-processor to output newlines.
-    oss << '#' << ++index << '\n';
-    if (lang_flag == "-xc++" || strchr(s, ':') == nullptr) {
-      oss << "__has_cpp_attribute(" << s << ")\n";
-    } else {
-      oss << "0\n";
-    }
-  }
-  for (const char* s : KNOWN_DECLSPEC_ATTRIBUTES) {
-    oss << '#' << ++index << '\n';
-    oss << "__has_declspec_attribute(" << s << ")\n";
-  }
-  for (const char* s : KNOWN_BUILTINS) {
-    oss << '#' << ++index << '\n';
-    oss << "__has_builtin(" << s << ")\n";
-  }
-  for (const char* s : KNOWN_WARNINGS) {
-    oss << '#' << ++index << '\n';
-    oss << "__has_warning(\"" << s << "\")\n";
-  }
-
-  const std::string& source = oss.str();
-  VLOG(1) << "source=" << source;
-
   ScopedTmpFile tmp_file("goma_compiler_proxy_check_features_");
-  if (!tmp_file.valid()) {
-    PLOG(ERROR) << "failed to make temp file: " << tmp_file.filename();
-    CompilerInfoBuilder::AddErrorMessage(
-        "goma error: failed to create a temp. file.", compiler_info);
-    return false;
-  }
-
-  ssize_t written = tmp_file.Write(source.data(), source.size());
-  if (static_cast<ssize_t>(source.size()) != written) {
-    PLOG(ERROR) << "Failed to write source into " << tmp_file.filename() << ": "
-                << source.size() << " vs " << written;
-    CompilerInfoBuilder::AddErrorMessage(
-        "goma error: failed to write a temp file.", compiler_info);
+  if (!WritePredefinedFeaturesSource(lang_flag, &tmp_file, compiler_info)) {
     return false;
   }
-  // We do not need to append data to |tmp_file|.
-  // Keeping it opened may cause a trouble on Windows.
-  // Note: |tmp_file.filename()| is kept until the end of the scope.
-  if (!tmp_file.Close()) {
-    PLOG(ERROR) << "failed to close temp file: " << tmp_file.filename();
-    CompilerInfoBuilder::AddErrorMessage(
-        "goma error: failed to close a temp. file.", compiler_info);
-    return false;
-  }
-
-  std::vector<std::string> argv;
-  argv.push_back(normal_compiler_path);
-  copy(compiler_info_flags.begin(), compiler_info_flags.end(),
-       back_inserter(argv));
-  argv.push_back(lang_flag);
-  argv.push_back("-E");
-  argv.push_back(tmp_file.filename());
-  VLOG(1) << "argv=" << argv;
-
-  std::vector<std::string> env;
-  env.push_back("LC_ALL=C");
-  copy(compiler_info_envs.begin(), compiler_info_envs.end(),
-       back_inserter(env));
-
-  int32_t status = 0;
-  std::string out;
+  std::vector<CommandOutputRequest> requests;
+  requests.push_back(PredefinedFeaturesRequest(
+      normal_compiler_path, lang_flag, compiler_info_flags, compiler_info_envs,
+      cwd, tmp_file.filename()));
   {
     GOMA_COUNTERZ("ReadCommandOutput(predefined features)");
-    out = ReadCommandOutput(normal_compiler_path, argv, env, cwd, STDOUT_ONLY,
-                            &status);
+    ReadProbeCommandOutputs(&requests);
   }
-  VLOG(1) << "out=" << out;
-  if (status != 0) {
-    LOG(ERROR) << "Read of features and extensions did not ends with status 0."
-               << " normal_compiler_path=" << normal_compiler_path
-               << " status=" << status << " argv=" << argv << " env=" << env
-               << " cwd=" << cwd << " out=" << out;
-    std::string outerr = ReadCommandOutput(normal_compiler_path, argv, env, cwd,
-                                           MERGE_STDOUT_STDERR, &status);
-    absl::string_view piece(outerr);
-    const size_t chunk_size = 20000;
-    LOG(ERROR) << "out/err="
-               << piece.substr(0, std::min(chunk_size, piece.size()));
-    size_t begin_pos = chunk_size;
-    while (begin_pos < piece.size()) {
-      size_t len = std::min(chunk_size, piece.size() - begin_pos);
-      LOG(ERROR) << "out/err continued=" << piece.substr(begin_pos, len);
-      begin_pos += len;
-    }
-    return false;
-  }
-
-  FeatureList object_macros =
-      std::make_pair(kPredefinedObjectMacros, kPredefinedObjectMacroSize);
-  FeatureList function_macros =
-      std::make_pair(kPredefinedFunctionMacros, kPredefinedFunctionMacroSize);
-  FeatureList features = std::make_pair(KNOWN_FEATURES, NUM_KNOWN_FEATURES);
-  FeatureList extensions =
-      std::make_pair(KNOWN_EXTENSIONS, NUM_KNOWN_EXTENSIONS);
-  FeatureList attributes =
-      std::make_pair(KNOWN_ATTRIBUTES, NUM_KNOWN_ATTRIBUTES);
-  FeatureList cpp_attributes =
-      std::make_pair(KNOWN_CPP_ATTRIBUTES, NUM_KNOWN_CPP_ATTRIBUTES);
-  FeatureList declspec_attributes =
-      std::make_pair(KNOWN_DECLSPEC_ATTRIBUTES, NUM_KNOWN_DECLSPEC_ATTRIBUTES);
-  FeatureList builtins = std::make_pair(KNOWN_BUILTINS, NUM_KNOWN_BUILTINS);
-  FeatureList warnings = std::make_pair(KNOWN_WARNINGS, NUM_KNOWN_WARNINGS);
-
-  return ParseFeatures(out, object_macros, function_macros, features,
-                       extensions, attributes, cpp_attributes,
-                       declspec_attributes, builtins, warnings, compiler_info);
+  return SetPredefinedFeaturesAndExtensions(requests[0], compiler_info);
 }
 
 // Return true if everything is fine, and all necessary information
@@ -870,48 +916,96 @@ bool ClangCompilerInfoBuilderHelper::SetBasicCompilerInfo(
   //
   // Note that the way to get system include paths are still under discussion
   // in b/13178705.
-  std::string c_output, cxx_output;
+  //
+  // Probes to get system include paths, predefined macros and features
+  // don't depend on each other, so they are run concurrently.
+  std::vector<std::unique_ptr<ScopedTmpFile>> tmp_files;
+  std::vector<CommandOutputRequest> requests;
+  std::string empty_file;
+  absl::optional<size_t> cxx_index;
   if (is_cplusplus) {
-    int32_t status;
-    cxx_output =
-        GccDisplayPrograms(local_compiler_path, compiler_info_flags,
-                           compiler_info_envs, cxx_lang_flag, "", cwd, &status);
-    if (status != 0) {
+    if (!ProbeEmptyFile(&tmp_files, &empty_file)) {
       CompilerInfoBuilder::AddErrorMessage(
-          "Failed to execute compiler to get c++ system "
-          "include paths for " +
-              local_compiler_path,
-          compiler_info);
-      LOG(ERROR) << compiler_info->error_message() << " status=" << status
-                 << " cxx_output=" << cxx_output;
+          "goma error: failed to create a temp. file.", compiler_info);
       return false;
     }
-    c_output = GccDisplayPrograms(local_compiler_path, compiler_info_flags,
-                                  compiler_info_envs, cxx_lang_flag,
-                                  "-nostdinc++", cwd, &status);
-    if (status != 0) {
+    cxx_index = requests.size();
+    requests.push_back(GccDisplayProgramsRequest(
+        local_compiler_path, compiler_info_flags, compiler_info_envs,
+        cxx_lang_flag, "", cwd, empty_file));
+  }
+  if (!ProbeEmptyFile(&tmp_files, &empty_file)) {
+    CompilerInfoBuilder::AddErrorMessage(
+        "goma error: failed to create a temp. file.", compiler_info);
+    return false;
+  }
+  const size_t c_index = requests.size();
+  if (is_cplusplus) {
+    requests.push_back(GccDisplayProgramsRequest(
+        local_compiler_path, compiler_info_flags, compiler_info_envs,
+        cxx_lang_flag, "-nostdinc++", cwd, empty_file));
+  } else {
+    requests.push_back(GccDisplayProgramsRequest(
+        local_compiler_path, compiler_info_flags, compiler_info_envs,
+        c_lang_flag, "", cwd, empty_file));
+  }
+  if (!ProbeEmptyFile(&tmp_files, &empty_file)) {
+    CompilerInfoBuilder::AddErrorMessage(
+        "goma error: failed to create a temp. file.", compiler_info);
+    return false;
+  }
+  const size_t macros_index = requests.size();
+  requests.push_back(GccDisplayPredefinedMacrosRequest(
+      local_compiler_path, compiler_info_flags, compiler_info_envs, cwd,
+      lang_flag, empty_file));
+
+  ScopedTmpFile features_file("goma_compiler_proxy_check_features_");
+  if (!WritePredefinedFeaturesSource(lang_flag, &features_file,
+                                     compiler_info)) {
+    CompilerInfoBuilder::AddErrorMessage(
+        "failed to get predefined features and extensions for " +
+            local_compiler_path,
+        compiler_info);
+    LOG(ERROR) << compiler_info->error_message();
+    return false;
+  }
+  const size_t features_index = requests.size();
+  requests.push_back(PredefinedFeaturesRequest(
+      local_compiler_path, lang_flag, compiler_info_flags, compiler_info_envs,
+      cwd, features_file.filename()));
+
+  {
+    GOMA_COUNTERZ("ReadCommandOutputs(basic compiler info)");
+    ReadProbeCommandOutputs(&requests);
+  }
+
+  std::string c_output, cxx_output;
+  if (cxx_index.has_value()) {
+    const CommandOutputRequest& request = requests[*cxx_index];
+    cxx_output = request.output;
+    if (request.status != 0) {
       CompilerInfoBuilder::AddErrorMessage(
-          "Failed to execute compiler to get c system "
+          "Failed to execute compiler to get c++ system "
           "include paths for " +
               local_compiler_path,
           compiler_info);
-      LOG(ERROR) << compiler_info->error_message() << " status=" << status
-                 << " c_output=" << c_output;
+      LOG(ERROR) << compiler_info->error_message()
+                 << " status=" << request.status
+                 << " cxx_output=" << cxx_output;
       return false;
     }
-  } else {
-    int32_t status;
-    c_output =
-        GccDisplayPrograms(local_compiler_path, compiler_info_flags,
-                           compiler_info_envs, c_lang_flag, "", cwd, &status);
-    if (status != 0) {
+  }
+  {
+    const CommandOutputRequest& request = requests[c_index];
+    c_output = request.output;
+    if (request.status != 0) {
       CompilerInfoBuilder::AddErrorMessage(
           "Failed to execute compiler to get c system "
           "include paths for " +
               local_compiler_path,
           compiler_info);
-      LOG(ERROR) << compiler_info->error_message() << " status=" << status
-                 << " c_output=" << c_output;
+      LOG(ERROR) << compiler_info->error_message()
+                 << " status=" << request.status << " c_output=" << c_output;
       return false;
     }
   }
@@ -925,8 +1019,7 @@ bool ClangCompilerInfoBuilderHelper::SetBasicCompilerInfo(
     LOG(ERROR) << compiler_info->error_message();
     return false;
   }
-  if (!GetPredefinedMacros(local_compiler_path, compiler_info_flags,
-                           compiler_info_envs, cwd, lang_flag, compiler_info)) {
+  if (!SetPredefinedMacros(requests[macros_index], compiler_info)) {
     CompilerInfoBuilder::AddErrorMessage(
         "Failed to get predefined macros for " + local_compiler_path,
         compiler_info);
@@ -988,9 +1081,8 @@ bool ClangCompilerInfoBuilderHelper::SetBasicCompilerInfo(
     compiler_info->mutable_cxx()->set_cxx_target(compiler_info->target());
   }
 
-  if (!GetPredefinedFeaturesAndExtensions(
-          local_compiler_path, lang_flag, compiler_info_flags,
-          compiler_info_envs, cwd, compiler_info)) {
+  if (!SetPredefinedFeaturesAndExtensions(requests[features_index],
+                                          compiler_info)) {
     CompilerInfoBuilder::AddErrorMessage(
         "failed to get predefined features and extensions for " +
             local_compiler_path,
@@ -7,6 +7,7 @@
 #include "absl/strings/str_split.h"
 #include "cmdline_parser.h"
 #include "compiler_info.h"
+#include "compiler_info_probe_stats.h"
 #include "counterz.h"
 #include "glog/logging.h"
 #include "glog/stl_logging.h"
@@ -107,8 +108,10 @@ bool CxxCompilerInfoBuilder::GetSubprograms(
   std::string gcc_output;
   {
     GOMA_COUNTERZ("ReadCommandOutput(subprogram)");
-    gcc_output = ReadCommandOutput(gcc_path, argv, compiler_info_envs, cwd,
-                                   MERGE_STDOUT_STDERR, &status);
+    gcc_output =
+        ReadProbeCommandOutput("subprograms", gcc_path, argv,
+                               compiler_info_envs, cwd, MERGE_STDOUT_STDERR,
+                               &status);
   }
   if (status != 0) {
     LOG(ERROR) << "ReadCommandOutput exited with non zero status code."
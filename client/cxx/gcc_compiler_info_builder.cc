@@ -7,6 +7,7 @@
 #include "absl/strings/match.h"
 #include "base/path.h"
 #include "client/autolock_timer.h"
+#include "client/compiler_info_probe_stats.h"
 #include "client/counterz.h"
 #include "client/cxx/clang_compiler_info_builder_helper.h"
 #include "client/cxx/nacl_compiler_info_builder_helper.h"
@@ -78,90 +79,93 @@ bool AddSubprogramInfo(
   return true;
 }
 
-// Execute GCC and get the string output for GCC version
-bool GetGccVersion(const std::string& bare_gcc,
-                   const std::vector<std::string>& compiler_info_envs,
-                   const std::string& cwd,
-                   std::string* version) {
-  std::vector<std::string> argv;
-  argv.push_back(bare_gcc);
-  argv.push_back("-dumpversion");
-  std::vector<std::string> env(compiler_info_envs);
-  env.push_back("LC_ALL=C");
-  int32_t status = 0;
-  std::string dumpversion_output;
-  {
-    GOMA_COUNTERZ("ReadCommandOutput(dumpversion)");
-    dumpversion_output = ReadCommandOutput(bare_gcc, argv, env, cwd,
-                                           MERGE_STDOUT_STDERR, &status);
-  }
-
-  if (status != 0) {
-    LOG(ERROR) << "ReadCommandOutput exited with non zero status code."
-               << " bare_gcc=" << bare_gcc << " status=" << status
-               << " argv=" << argv << " env=" << env << " cwd=" << cwd
-               << " dumpversion_output=" << dumpversion_output;
-    return false;
-  }
+CommandOutputRequest GccInfoRequest(
+    const std::string& name,
+    const std::string& bare_gcc,
+    const std::string& flag,
+    const std::vector<std::string>& compiler_info_envs,
+    const std::string& cwd) {
+  CommandOutputRequest request;
+  request.name = name;
+  request.prog = bare_gcc;
+  request.argv.push_back(bare_gcc);
+  request.argv.push_back(flag);
+  request.env = compiler_info_envs;
+  request.env.push_back("LC_ALL=C");
+  request.cwd = cwd;
+  return request;
+}
 
-  argv[1] = "--version";
-  std::string version_output;
-  {
-    GOMA_COUNTERZ("ReadCommandOutput(version)");
-    version_output = ReadCommandOutput(bare_gcc, argv, env, cwd,
-                                       MERGE_STDOUT_STDERR, &status);
-  }
-  if (status != 0) {
-    LOG(ERROR) << "ReadCommandOutput exited with non zero status code."
-               << " bare_gcc=" << bare_gcc << " status=" << status
-               << " argv=" << argv << " env=" << env << " cwd=" << cwd
-               << " version_output=" << version_output;
-    return false;
+// Gets GCC version from outputs of "gcc -dumpversion" and "gcc --version".
+bool GetGccVersion(const CommandOutputRequest& dumpversion,
+                   const CommandOutputRequest& version,
+                   std::string* gcc_version) {
+  for (const auto* request : {&dumpversion, &version}) {
+    if (request->status != 0) {
+      LOG(ERROR) << "ReadCommandOutput exited with non zero status code."
+                 << " bare_gcc=" << request->prog
+                 << " status=" << request->status << " argv=" << request->argv
+                 << " env=" << request->env << " cwd=" << request->cwd
+                 << " output=" << request->output;
+      return false;
+    }
   }
 
-  if (dumpversion_output.empty() || version_output.empty()) {
+  if (dumpversion.output.empty() || version.output.empty()) {
     LOG(ERROR) << "dumpversion_output or version_output is empty."
-               << " bare_gcc=" << bare_gcc << " status=" << status
-               << " argv=" << argv << " env=" << env << " cwd=" << cwd
-               << " dumpversion_output=" << dumpversion_output
-               << " version_output=" << version_output;
+               << " bare_gcc=" << version.prog << " env=" << version.env
+               << " cwd=" << version.cwd
+               << " dumpversion_output=" << dumpversion.output
+               << " version_output=" << version.output;
     return false;
   }
-  *version = GetCxxCompilerVersionFromCommandOutputs(
-      bare_gcc, dumpversion_output, version_output);
+  *gcc_version = GetCxxCompilerVersionFromCommandOutputs(
+      version.prog, dumpversion.output, version.output);
   return true;
 }
 
-// Execute GCC and get the string output for GCC target architecture
-// This target is used to pick the same compiler in the backends, so
-// we don't need to use compiler_info_flags here.
-bool GetGccTarget(const std::string& bare_gcc,
-                  const std::vector<std::string>& compiler_info_envs,
-                  const std::string& cwd,
+// Gets GCC target architecture from output of "gcc -dumpmachine".
+bool GetGccTarget(const CommandOutputRequest& dumpmachine,
                   std::string* target) {
-  std::vector<std::string> argv;
-  argv.push_back(bare_gcc);
-  argv.push_back("-dumpmachine");
-  std::vector<std::string> env(compiler_info_envs);
-  env.push_back("LC_ALL=C");
-  int32_t status = 0;
-  std::string gcc_output;
-  {
-    GOMA_COUNTERZ("ReadCommandOutput(dumpmachine)");
-    gcc_output = ReadCommandOutput(bare_gcc, argv, env, cwd,
-                                   MERGE_STDOUT_STDERR, &status);
-  }
-  if (status != 0) {
+  if (dumpmachine.status != 0) {
     LOG(ERROR) << "ReadCommandOutput exited with non zero status code."
-               << " bare_gcc=" << bare_gcc << " status=" << status
-               << " argv=" << argv << " env=" << env << " cwd=" << cwd
-               << " gcc_output=" << gcc_output;
+               << " bare_gcc=" << dumpmachine.prog
+               << " status=" << dumpmachine.status
+               << " argv=" << dumpmachine.argv << " env=" << dumpmachine.env
+               << " cwd=" << dumpmachine.cwd
+               << " gcc_output=" << dumpmachine.output;
     return false;
   }
-  *target = GetFirstLine(gcc_output);
+  *target = GetFirstLine(dumpmachine.output);
   return !target->empty();
 }
 
+// Execute GCC and get the string output for GCC version and target
+// architecture.  Commands are run concurrently.
+// This target is used to pick the same compiler in the backends, so
+// we don't need to use compiler_info_flags here.
+void GetGccVersionAndTarget(const std::string& bare_gcc,
+                            const std::vector<std::string>& compiler_info_envs,
+                            const std::string& cwd,
+                            bool* has_version,
+                            std::string* version,
+                            bool* has_target,
+                            std::string* target) {
+  std::vector<CommandOutputRequest> requests;
+  requests.push_back(GccInfoRequest("gcc dumpversion", bare_gcc,
+                                    "-dumpversion", compiler_info_envs, cwd));
+  requests.push_back(GccInfoRequest("gcc version", bare_gcc, "--version",
+                                    compiler_info_envs, cwd));
+  requests.push_back(GccInfoRequest("gcc dumpmachine", bare_gcc,
+                                    "-dumpmachine", compiler_info_envs, cwd));
+  {
+    GOMA_COUNTERZ("ReadCommandOutputs(version and target)");
+    ReadProbeCommandOutputs(&requests);
+  }
+  *has_version = GetGccVersion(requests[0], requests[1], version);
+  *has_target = GetGccTarget(requests[2], target);
+}
+
 bool IsExecutable(const std::string& cwd, const std::string& path) {
   const std::string abs_path = file::JoinPathRespectAbsolute(cwd, path);
   return access(abs_path.c_str(), X_OK) == 0;
@@ -187,8 +191,8 @@ std::string GetRealClangPath(const std::string& normal_gcc_path,
   std::string v_output;
   {
     GOMA_COUNTERZ("ReadCommandOutput(-xc -v)");
-    v_output = ReadCommandOutput(normal_gcc_path, argv, envs, cwd,
-                                 MERGE_STDOUT_STDERR, &status);
+    v_output = ReadProbeCommandOutput("real clang path", normal_gcc_path, argv,
+                                      envs, cwd, MERGE_STDOUT_STDERR, &status);
   }
   LOG_IF(ERROR, status != 0)
       << "ReadCommandOutput exited with non zero status code."
@@ -216,10 +220,11 @@ void GCCCompilerInfoBuilder::SetTypeSpecificCompilerInfo(
   // situation, build target could be different.
   // To make goma backend use proper wrapper script, or set proper -target,
   // we should need to use local_compiler_path instead of real path.
-  bool has_version = GetGccVersion(abs_local_compiler_path, compiler_info_envs,
-                                   flags.cwd(), data->mutable_version());
-  bool has_target = GetGccTarget(abs_local_compiler_path, compiler_info_envs,
-                                 flags.cwd(), data->mutable_target());
+  bool has_version = false;
+  bool has_target = false;
+  GetGccVersionAndTarget(abs_local_compiler_path, compiler_info_envs,
+                         flags.cwd(), &has_version, data->mutable_version(),
+                         &has_target, data->mutable_target());
 
 
   const GCCFlags& gcc_flags = static_cast<const GCCFlags&>(flags);
@@ -665,8 +670,8 @@ std::string GCCCompilerInfoBuilder::GetRealCompilerPath(
   std::string v_output;
   {
     GOMA_COUNTERZ("ReadCommandOutput(-v)");
-    v_output = ReadCommandOutput(normal_gcc_path, argv, envs, cwd,
-                                 MERGE_STDOUT_STDERR, &status);
+    v_output = ReadProbeCommandOutput("real gcc path", normal_gcc_path, argv,
+                                      envs, cwd, MERGE_STDOUT_STDERR, &status);
   }
   LOG_IF(ERROR, status != 0)
       << "ReadCommandOutput exited with non zero status code."
@@ -27,6 +27,7 @@
 #include <utility>
 #include <vector>
 
+#include "absl/memory/memory.h"
 #include "absl/strings/match.h"
 #include "absl/strings/str_split.h"
 #include "absl/strings/string_view.h"
@@ -52,6 +53,7 @@
 #include "glog/vlog_is_on.h"
 #include "include_cache.h"
 #include "include_file_utils.h"
+#include "include_prefetcher.h"
 #include "ioutil.h"
 #include "list_dir_cache.h"
 #include "lockhelper.h"
@@ -75,10 +77,12 @@ namespace {
 // If |file_stat_cache| has a FileStat for |filepath|, we use it.
 // Otherwise we take FileStat for |filepath| and stores it to |file_stat_cache|.
 // We don't take |file_stat_cache| ownership.
+// If |prefetcher| is not nullptr, waits for its prefetch of |filepath|.
 IncludeItem TryInclude(const std::string& cwd,
                        const std::string& filepath,
                        std::string* next_current_directory,
-                       FileStatCache* file_stat_cache) {
+                       FileStatCache* file_stat_cache,
+                       IncludePrefetcher* prefetcher) {
   GOMA_COUNTERZ("TryInclude");
 
   const std::string abs_filepath = file::JoinPathRespectAbsolute(cwd, filepath);
@@ -97,6 +101,9 @@ IncludeItem TryInclude(const std::string& cwd,
       << "You forget to call IncludeCache::Init()?";
 
   *next_current_directory = std::string(file::Dirname(filepath));
+  if (prefetcher != nullptr) {
+    prefetcher->Wait(abs_filepath);
+  }
   return IncludeCache::instance()->GetIncludeItem(abs_filepath, file_stat);
 }
 
@@ -108,12 +115,14 @@ class IncludePathsObserver : public CppParser::IncludeObserver {
                        CppParser* parser,
                        std::set<std::string>* shared_include_files,
                        FileStatCache* file_stat_cache,
-                       IncludeFileFinder* include_file_finder)
+                       IncludeFileFinder* include_file_finder,
+                       IncludePrefetcher* prefetcher)
       : cwd_(std::move(cwd)),
         parser_(parser),
         shared_include_files_(shared_include_files),
         file_stat_cache_(file_stat_cache),
-        include_file_finder_(include_file_finder) {
+        include_file_finder_(include_file_finder),
+        prefetcher_(prefetcher) {
     CHECK(parser_);
     CHECK(shared_include_files_);
     CHECK(file_stat_cache_);
@@ -187,8 +196,8 @@ class IncludePathsObserver : public CppParser::IncludeObserver {
       return true;
     }
 
-    IncludeItem include_item =
-        TryInclude(cwd_, filepath, &next_current_directory, file_stat_cache_);
+    IncludeItem include_item = TryInclude(
+        cwd_, filepath, &next_current_directory, file_stat_cache_, prefetcher_);
     if (include_item.IsValid()) {
       if (IncludeFileFinder::gch_hack_enabled() &&
           absl::EndsWith(filepath, GOMA_GCH_SUFFIX) &&
@@ -200,6 +209,7 @@ class IncludePathsObserver : public CppParser::IncludeObserver {
 
       VLOG(2) << "Looking into " << filepath << " index=" << dir_index;
       shared_include_files_->insert(filepath);
+      PrefetchIncludes(include_item, next_current_directory, dir_index);
       parser_->AddFileInput(std::move(include_item), filepath,
                             next_current_directory, dir_index);
       return true;
@@ -242,7 +252,85 @@ class IncludePathsObserver : public CppParser::IncludeObserver {
     return false;
   }
 
+  // Schedules prefetch of headers that |include_item| includes
+  // unconditionally with a literal path, before the parser reaches them.
+  // |current_directory| and |include_dir_index| are the ones used when
+  // |include_item| is added to the parser.
+  void PrefetchIncludes(const IncludeItem& include_item,
+                        const std::string& current_directory,
+                        int include_dir_index) {
+    if (prefetcher_ == nullptr) {
+      return;
+    }
+    // Directives in the include guard are also processed unconditionally.
+    const int unconditional_depth =
+        include_item.include_guard_ident().empty() ? 0 : 1;
+    int depth = 0;
+    for (const auto& directive : *include_item.directives()) {
+      switch (directive->type()) {
+        case CppDirectiveType::DIRECTIVE_IFDEF:
+        case CppDirectiveType::DIRECTIVE_IFNDEF:
+        case CppDirectiveType::DIRECTIVE_IF:
+          ++depth;
+          break;
+        case CppDirectiveType::DIRECTIVE_ENDIF:
+          --depth;
+          break;
+        case CppDirectiveType::DIRECTIVE_ELSE:
+        case CppDirectiveType::DIRECTIVE_ELIF:
+          if (depth <= unconditional_depth) {
+            // e.g. #else of the include guard. It's rare, so just stop here.
+            return;
+          }
+          break;
+        case CppDirectiveType::DIRECTIVE_INCLUDE:
+        case CppDirectiveType::DIRECTIVE_IMPORT: {
+          if (depth > unconditional_depth) {
+            break;
+          }
+          const CppDirectiveIncludeBase& include =
+              AsCppDirectiveIncludeBase(*directive);
+          if (include.delimiter() == '"') {
+            PrefetchInclude(include.filename(), current_directory);
+          } else if (include.delimiter() == '<') {
+            PrefetchInclude(include.filename(), "");
+          }
+          break;
+        }
+        default:
+          break;
+      }
+    }
+  }
+
  private:
+  // Schedules prefetch of |path| with the candidates that HandleInclude
+  // would try. |current_directory| is empty for #include <...>.
+  // Candidates are stat-ed by the prefetcher, not on this thread.
+  void PrefetchInclude(const std::string& path,
+                       const std::string& current_directory) {
+    std::vector<std::string> candidates;
+    if (!current_directory.empty()) {
+      std::string filepath = PathResolver::PlatformConvert(
+          file::JoinPathRespectAbsolute(current_directory, path));
+      if (IncludeFileFinder::gch_hack_enabled()) {
+        candidates.push_back(filepath + GOMA_GCH_SUFFIX);
+      }
+      candidates.push_back(std::move(filepath));
+    }
+    const int dir_index = current_directory.empty()
+                              ? parser_->bracket_include_dir_index()
+                              : CppParser::kIncludeDirIndexStarting;
+    include_file_finder_->LookupCandidates(path, dir_index, &candidates);
+    if (candidates.empty()) {
+      return;
+    }
+    for (auto& candidate : candidates) {
+      candidate = file::JoinPathRespectAbsolute(cwd_, candidate);
+    }
+    prefetcher_->Prefetch(std::move(candidates));
+  }
+
   bool CanPruneWithTopPathComponent(const std::string& dir,
                                     const std::string& path) {
     // we don't need to care about case ignoreness here.
@@ -274,8 +362,8 @@ class IncludePathsObserver : public CppParser::IncludeObserver {
 
     if (IncludeFileFinder::gch_hack_enabled()) {
       const std::string& gchpath = filepath + GOMA_GCH_SUFFIX;
-      IncludeItem include_item(
-          TryInclude(cwd_, gchpath, next_current_directory, file_stat_cache_));
+      IncludeItem include_item(TryInclude(cwd_, gchpath, next_current_directory,
+                                          file_stat_cache_, prefetcher_));
       if (include_item.IsValid()) {
         VLOG(2) << "Found a pre-compiled header: " << gchpath;
         shared_include_files_->insert(gchpath);
@@ -288,10 +376,12 @@ class IncludePathsObserver : public CppParser::IncludeObserver {
       VLOG(2) << "Already processed: \"" << filepath << "\"";
       return true;
     }
-    IncludeItem include_item =
-        TryInclude(cwd_, filepath, next_current_directory, file_stat_cache_);
+    IncludeItem include_item = TryInclude(
+        cwd_, filepath, next_current_directory, file_stat_cache_, prefetcher_);
     if (include_item.IsValid()) {
       shared_include_files_->insert(filepath);
+      PrefetchIncludes(include_item, *next_current_directory,
+                       include_dir_index);
       parser_->AddFileInput(std::move(include_item), filepath,
                             *next_current_directory, include_dir_index);
       return true;
@@ -337,6 +427,7 @@ class IncludePathsObserver : public CppParser::IncludeObserver {
   FileStatCache* file_stat_cache_;
 
   IncludeFileFinder* include_file_finder_;
+  IncludePrefetcher* prefetcher_;
 
   DISALLOW_COPY_AND_ASSIGN(IncludePathsObserver);
 };
@@ -537,6 +628,9 @@ bool CppIncludeProcessor::GetIncludeFiles(const std::string& filename,
     CopyIncludeDirs(compiler_info.system_include_paths(),
                     compiler_info.toolchain_root(), &all_system_include_dirs);
   }
+  if (IncludeCache::IsEnabled()) {
+    IncludeCache::instance()->UseDirectiveSnapshot(all_system_include_dirs);
+  }
 
   // The first element of include_dirs.include_dirs represents the current input
   // directory. It's not specified by -I, but we need to handle it when
@@ -576,9 +670,14 @@ bool CppIncludeProcessor::GetIncludeFiles(const std::string& filename,
   root_includes_with_index.emplace_back(PathResolver::PlatformConvert(filename),
                                         CppParser::kCurrentDirIncludeDirIndex);
 
-  IncludePathsObserver include_observer(current_directory,
-                                        &cpp_parser_, include_files,
-                                        file_stat_cache, &include_file_finder);
+  std::unique_ptr<IncludePrefetcher> prefetcher;
+  if (IncludePrefetcher::IsEnabled() && IncludeCache::IsEnabled()) {
+    prefetcher = absl::make_unique<IncludePrefetcher>();
+  }
+
+  IncludePathsObserver include_observer(
+      current_directory, &cpp_parser_, include_files, file_stat_cache,
+      &include_file_finder, prefetcher.get());
   IncludeErrorObserver error_observer;
   cpp_parser_.set_include_observer(&include_observer);
   if (VLOG_IS_ON(1))
@@ -683,8 +782,10 @@ bool CppIncludeProcessor::GetIncludeFiles(const std::string& filename,
 
     std::string input_basedir = std::string(file::Dirname(input));
 
-    cpp_parser_.AddFileInput(IncludeItem(std::move(directives), ""), input,
-                             input_basedir, dir_index);
+    IncludeItem include_item(std::move(directives), "");
+    include_observer.PrefetchIncludes(include_item, input_basedir, dir_index);
+    cpp_parser_.AddFileInput(std::move(include_item), input, input_basedir,
+                             dir_index);
     if (!cpp_parser_.ProcessDirectives()) {
       LOG(ERROR) << "cpp parser fatal error in " << abs_input;
       return false;
@@ -5,6 +5,7 @@
 
 #include "gtest/gtest.h"
 
+#include "absl/strings/str_cat.h"
 #include "compiler_flags.h"
 #include "compiler_flags_parser.h"
 #include "compiler_info.h"
@@ -14,10 +15,12 @@
 #include "filesystem.h"
 #include "include_cache.h"
 #include "include_file_finder.h"
+#include "include_prefetcher.h"
 #include "list_dir_cache.h"
 #include "options.h"
 #include "path.h"
 #include "unittest_util.h"
+#include "worker_thread_manager.h"
 
 namespace devtools_goma {
 
@@ -1283,4 +1286,43 @@ TEST_F(CppIncludeProcessorTest, undef_content) {
   EXPECT_EQ(expected, files);
 }
 
+TEST_F(CppIncludeProcessorTest, prefetch_jumbo) {
+  WorkerThreadManager wm;
+  wm.Start(1);
+  IncludePrefetcher::Init(&wm, 2);
+
+  std::string jumbo;
+  std::set<std::string> expected;
+  for (int i = 0; i < 20; ++i) {
+    const std::string& cc = file::JoinPath("src", absl::StrCat(i, ".cc"));
+    CreateTmpFile(
+        "#include \"common.h\"\n"
+        "#include <sys.h>\n"
+        "#ifdef NOT_DEFINED\n"
+        "#include \"cond.h\"\n"
+        "#endif\n",
+        cc);
+    jumbo += absl::StrCat("#include \"", cc, "\"\n");
+    expected.insert(tmpdir_util_->FullPath(cc));
+  }
+  const std::string& ac = CreateTmpFile(jumbo, "jumbo.cc");
+  expected.insert(CreateTmpFile(
+      "#ifndef COMMON_H_\n"
+      "#define COMMON_H_\n"
+      "#include \"inner.h\"\n"
+      "#endif\n",
+      file::JoinPath("src", "common.h")));
+  expected.insert(CreateTmpFile("", file::JoinPath("src", "inner.h")));
+  expected.insert(CreateTmpFile("", file::JoinPath("include", "sys.h")));
+  CreateTmpFile("", file::JoinPath("src", "cond.h"));
+
+  std::vector<std::string> args{
+      "/usr/bin/gcc", "-I" + tmpdir_util_->FullPath("include"), "-c", ac};
+  std::set<std::string> files = RunCppIncludeProcessor(ac, args);
+  EXPECT_EQ(expected, files);
+
+  IncludePrefetcher::Quit();
+  wm.Finish();
+}
+
 }  // namespace devtools_goma
@@ -83,6 +83,7 @@ class CppParser {
   void set_bracket_include_dir_index(int index) {
     bracket_include_dir_index_ = index;
   }
+  int bracket_include_dir_index() const { return bracket_include_dir_index_; }
   void set_include_observer(IncludeObserver* obs) { include_observer_ = obs; }
   void set_error_observer(ErrorObserver* obs) { error_observer_ = obs; }
   void SetCompilerInfo(const CxxCompilerInfo* compiler_info);
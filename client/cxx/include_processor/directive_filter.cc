@@ -7,6 +7,14 @@
 
 #include <string.h>
 
+#ifndef NO_SSE2
+#include <emmintrin.h>
+#endif  // NO_SSE2
+
+#ifdef _WIN32
+#include <intrin.h>
+#endif
+
 #include <memory>
 #include <vector>
 
@@ -17,6 +25,90 @@
 #include "content.h"
 #include "glog/logging.h"
 
+namespace {
+
+#ifndef NO_SSE2
+#ifdef _WIN32
+inline int CountZero(int v) {
+  unsigned long r;
+  _BitScanForward(&r, v);
+  return r;
+}
+#else
+inline int CountZero(int v) {
+  return __builtin_ctz(v);
+}
+#endif
+#endif  // NO_SSE2
+
+// Returns the first position in [pos, end) that has |c1| or |c2|.
+// If nothing, |end| will be returned.
+// Headers are mostly made of lines that don't have any character the filter
+// is interested in, so this scans 16 bytes at a time when SSE2 is available.
+const char* FindFirstOf(const char* pos, const char* end, char c1, char c2) {
+#ifndef NO_SSE2
+  const __m128i pattern1 = _mm_set1_epi8(c1);
+  const __m128i pattern2 = _mm_set1_epi8(c2);
+  while (pos + 16 <= end) {
+    __m128i s = _mm_loadu_si128(reinterpret_cast<const __m128i*>(pos));
+    int result = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(s, pattern1),
+                                                _mm_cmpeq_epi8(s, pattern2)));
+    if (result) {
+      return pos + CountZero(result);
+    }
+    pos += 16;
+  }
+#endif  // NO_SSE2
+  for (; pos != end; ++pos) {
+    if (*pos == c1 || *pos == c2) {
+      return pos;
+    }
+  }
+  return end;
+}
+
+// Same as above, but with 3 characters.
+const char* FindFirstOf(const char* pos,
+                        const char* end,
+                        char c1,
+                        char c2,
+                        char c3) {
+#ifndef NO_SSE2
+  const __m128i pattern1 = _mm_set1_epi8(c1);
+  const __m128i pattern2 = _mm_set1_epi8(c2);
+  const __m128i pattern3 = _mm_set1_epi8(c3);
+  while (pos + 16 <= end) {
+    __m128i s = _mm_loadu_si128(reinterpret_cast<const __m128i*>(pos));
+    __m128i test = _mm_or_si128(_mm_cmpeq_epi8(s, pattern1),
+                                _mm_cmpeq_epi8(s, pattern2));
+    test = _mm_or_si128(test, _mm_cmpeq_epi8(s, pattern3));
+    int result = _mm_movemask_epi8(test);
+    if (result) {
+      return pos + CountZero(result);
+    }
+    pos += 16;
+  }
+#endif  // NO_SSE2
+  for (; pos != end; ++pos) {
+    if (*pos == c1 || *pos == c2 || *pos == c3) {
+      return pos;
+    }
+  }
+  return end;
+}
+
+// Returns the first position in [pos, end) that has |c|, or |end|.
+const char* FindChar(const char* pos, const char* end, char c) {
+  // memchr is already vectorized in libc.
+  const void* found = memchr(pos, c, end - pos);
+  if (found == nullptr) {
+    return end;
+  }
+  return static_cast<const char*>(found);
+}
+
+}  // anonymous namespace
+
 namespace devtools_goma {
 
 // static
@@ -60,6 +152,10 @@ const char* DirectiveFilter::SkipSpaces(const char* pos, const char* end) {
 /* static */
 const char* DirectiveFilter::NextLineHead(const char* pos, const char* end) {
   while (pos != end) {
+    pos = FindFirstOf(pos, end, '\n', '\\');
+    if (pos == end)
+      break;
+
     if (*pos == '\n')
       return pos + 1;
 
@@ -185,6 +281,17 @@ size_t DirectiveFilter::RemoveComments(const char* src, const char* end,
   const char* original_dst = dst;
 
   while (src != end) {
+    // Copy characters that cannot start a raw string literal, a string
+    // literal nor a comment at once.
+    const char* special = FindFirstOf(src, end, 'R', '\"', '/');
+    if (special != src) {
+      memmove(dst, src, special - src);
+      dst += special - src;
+      src = special;
+      if (src == end)
+        break;
+    }
+
     // Raw string literal starts.
     if (*src == 'R' && src + 1 < end && *(src + 1) == '\"' &&
         (src == original_src ||
@@ -221,7 +328,10 @@ size_t DirectiveFilter::RemoveComments(const char* src, const char* end,
       const char* end_comment = nullptr;
       const char* pos = src + 2;
       while (pos + 2 <= end) {
-        if (*pos == '*' && *(pos + 1) == '/') {
+        pos = FindChar(pos, end - 1, '*');
+        if (pos == end - 1)
+          break;
+        if (*(pos + 1) == '/') {
           end_comment = pos;
           break;
         }
@@ -259,6 +369,15 @@ size_t DirectiveFilter::RemoveEscapedNewLine(
   const char* initial_dst = dst;
 
   while (src != end) {
+    const char* backslash = FindChar(src, end, '\\');
+    if (backslash != src) {
+      memmove(dst, src, backslash - src);
+      dst += backslash - src;
+      src = backslash;
+      if (src == end)
+        break;
+    }
+
     int newline_bytes = IsEscapedNewLine(src, end);
     if (newline_bytes == 0) {
       *dst++ = *src++;
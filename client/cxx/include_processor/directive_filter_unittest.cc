@@ -553,4 +553,36 @@ TEST_F(DirectiveFilterTest, HandleConcatOfStringAndValueEndingInR) {
                                         filtered->buf_end() - filtered->buf()));
 }
 
+TEST_F(DirectiveFilterTest, LongLinesAtVariousOffsets) {
+  // Characters that the filter is interested in are placed at various
+  // offsets, so that they are found both in and across 16-byte blocks.
+  const std::string kLongCode(40, 'x');
+  for (size_t i = 0; i < 40; ++i) {
+    const std::string padding(i, ' ');
+    const std::string src = absl::StrCat(
+        padding, kLongCode, "\n",
+        padding, "/* ", kLongCode, " */#include <a.h>\n",
+        padding, "#define A \"", kLongCode, "\" // ", kLongCode, "\n",
+        padding, "#if ", kLongCode, " \\\n",
+        "  ", kLongCode, "\n",
+        padding, kLongCode, " R\"(", kLongCode, "\n#x)\" ", kLongCode, "\n",
+        padding, "#endif");
+
+    const std::string expected = absl::StrCat(
+        "#include <a.h>\n",
+        "#define A \"", kLongCode, "\" \n",
+        "#if ", kLongCode, "   ", kLongCode, "\n",
+        "#endif");
+
+    std::unique_ptr<Content> content(Content::CreateFromString(src));
+    std::unique_ptr<Content> filtered(
+        DirectiveFilter::MakeFilteredContent(*content));
+
+    EXPECT_EQ(expected,
+              absl::string_view(filtered->buf(),
+                                filtered->buf_end() - filtered->buf()))
+        << "offset=" << i;
+  }
+}
+
 }  // namespace devtools_goma
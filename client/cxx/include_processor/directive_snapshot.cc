@@ -0,0 +1,449 @@
+// Copyright 2020 The Goma Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "directive_snapshot.h"
+
+#include <string.h>
+
+#include <utility>
+
+#include "absl/memory/memory.h"
+#include "absl/strings/str_join.h"
+#include "autolock_timer.h"
+#include "compiler_specific.h"
+#include "file_stat.h"
+#include "glog/logging.h"
+#include "path.h"
+#include "path_util.h"
+#include "proto_util.h"
+
+MSVC_PUSH_DISABLE_WARNING_FOR_PROTO()
+#include "client/directive_snapshot_data.pb.h"
+MSVC_POP_WARNING()
+
+namespace devtools_goma {
+
+namespace {
+
+static_assert(sizeof(CppToken::value) <= sizeof(int64_t),
+              "CppToken::value must fit in int64");
+
+void TokenToProto(const CppToken& token, CppTokenData* data) {
+  data->set_type(token.type);
+  if (!token.string_value.empty()) {
+    data->set_string_value(token.string_value);
+  }
+  int64_t value = 0;
+  memcpy(&value, &token.v, sizeof(token.v));
+  if (value != 0) {
+    data->set_value(value);
+  }
+}
+
+bool TokenFromProto(const CppTokenData& data, CppToken* token) {
+  if (data.type() < CppToken::IDENTIFIER || data.type() > CppToken::LOR) {
+    return false;
+  }
+  token->type = static_cast<CppToken::Type>(data.type());
+  token->string_value = data.string_value();
+  const int64_t value = data.value();
+  memcpy(&token->v, &value, sizeof(token->v));
+  return true;
+}
+
+void TokensToProto(const std::vector<CppToken>& tokens,
+                   google::protobuf::RepeatedPtrField<CppTokenData>* data) {
+  data->Reserve(tokens.size());
+  for (const auto& token : tokens) {
+    TokenToProto(token, data->Add());
+  }
+}
+
+bool TokensFromProto(
+    const google::protobuf::RepeatedPtrField<CppTokenData>& data,
+    std::vector<CppToken>* tokens) {
+  tokens->resize(data.size());
+  for (int i = 0; i < data.size(); ++i) {
+    if (!TokenFromProto(data.Get(i), &(*tokens)[i])) {
+      return false;
+    }
+  }
+  return true;
+}
+
+template <typename T>
+std::unique_ptr<CppDirective> IncludeFromProto(const CppDirectiveData& data) {
+  if (data.delimiter() == ' ') {
+    std::vector<CppToken> tokens;
+    if (!TokensFromProto(data.token(), &tokens)) {
+      return nullptr;
+    }
+    return absl::make_unique<T>(std::move(tokens));
+  }
+  if (data.delimiter() == '<' || data.delimiter() == '"') {
+    return absl::make_unique<T>(static_cast<char>(data.delimiter()),
+                                data.filename());
+  }
+  return nullptr;
+}
+
+FileStat FileStatFromProto(const DirectiveSnapshotFile& file) {
+  FileStat file_stat;
+  if (file.has_mtime()) {
+    file_stat.mtime = ProtoToTime(file.mtime());
+  }
+  file_stat.size = file.size();
+  return file_stat;
+}
+
+}  // anonymous namespace
+
+DirectiveSnapshot::DirectiveSnapshot(std::string filename,
+                                     std::string built_revision,
+                                     std::vector<std::string> include_dirs,
+                                     size_t max_entries)
+    : cache_file_(std::move(filename)),
+      built_revision_(std::move(built_revision)),
+      include_dirs_(std::move(include_dirs)),
+      max_entries_(max_entries) {}
+
+DirectiveSnapshot::~DirectiveSnapshot() = default;
+
+// static
+std::string DirectiveSnapshot::SnapshotFilename(
+    const std::string& snapshot_dir,
+    const std::vector<std::string>& include_dirs) {
+  std::string hash;
+  ComputeDataHashKey(absl::StrJoin(include_dirs, "\n"), &hash);
+  return file::JoinPath(snapshot_dir, "directive_snapshot_" + hash);
+}
+
+bool DirectiveSnapshot::Load() {
+  DirectiveSnapshotData data;
+  if (!cache_file_.Load(&data)) {
+    LOG(INFO) << "no directive snapshot. filename=" << cache_file_.filename();
+    return false;
+  }
+  if (data.built_revision() != built_revision_) {
+    LOG(INFO) << "directive snapshot is created by other revision."
+              << " filename=" << cache_file_.filename()
+              << " built_revision=" << data.built_revision();
+    return false;
+  }
+  if (std::vector<std::string>(data.include_dir().begin(),
+                               data.include_dir().end()) != include_dirs_) {
+    LOG(WARNING) << "directive snapshot is for other include dirs."
+                 << " filename=" << cache_file_.filename();
+    return false;
+  }
+
+  std::vector<std::shared_ptr<const DirectiveSnapshotFile>> files;
+  files.reserve(data.file_size());
+  for (auto& file : *data.mutable_file()) {
+    files.push_back(std::make_shared<DirectiveSnapshotFile>(std::move(file)));
+  }
+
+  AUTO_EXCLUSIVE_LOCK(lock, &mu_);
+  // Entries added before loading are newer, so loaded entries are added
+  // only for files not in files_.
+  for (auto& file : files) {
+    if (!files_.contains(file->filepath())) {
+      std::string filepath = file->filepath();
+      files_.emplace_back(std::move(filepath),
+                          absl::make_unique<Entry>(std::move(file)));
+    }
+  }
+  EvictUnlocked();
+  LOG(INFO) << "loaded directive snapshot."
+            << " filename=" << cache_file_.filename()
+            << " files=" << files_.size();
+  return true;
+}
+
+bool DirectiveSnapshot::SaveIfUpdated() {
+  DirectiveSnapshotData data;
+  {
+    AUTO_SHARED_LOCK(lock, &mu_);
+    if (!updated_) {
+      return true;
+    }
+    data.set_built_revision(built_revision_);
+    for (const auto& dir : include_dirs_) {
+      data.add_include_dir(dir);
+    }
+    data.mutable_file()->Reserve(files_.size());
+    for (const auto& it : files_) {
+      *data.add_file() = *it.second->file;
+    }
+  }
+
+  if (!cache_file_.Save(data)) {
+    LOG(ERROR) << "failed to save directive snapshot."
+               << " filename=" << cache_file_.filename();
+    return false;
+  }
+  LOG(INFO) << "saved directive snapshot."
+            << " filename=" << cache_file_.filename()
+            << " files=" << data.file_size();
+
+  AUTO_EXCLUSIVE_LOCK(lock, &mu_);
+  updated_ = false;
+  return true;
+}
+
+bool DirectiveSnapshot::Covers(const std::string& filepath) const {
+  for (const auto& dir : include_dirs_) {
+    if (HasPrefixDir(filepath, dir)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+bool DirectiveSnapshot::Lookup(
+    const std::string& filepath,
+    const FileStat& file_stat,
+    bool needs_directive_hash,
+    IncludeItem* include_item,
+    absl::optional<SHA256HashValue>* directive_hash) const {
+  AUTO_SHARED_LOCK(lock, &mu_);
+  auto it = files_.find(filepath);
+  if (it == files_.end()) {
+    return false;
+  }
+  const DirectiveSnapshotFile& file = *it->second->file;
+  if (FileStatFromProto(file) != file_stat) {
+    return false;
+  }
+  it->second->referenced.store(true, std::memory_order_relaxed);
+
+  absl::optional<SHA256HashValue> hash;
+  if (needs_directive_hash) {
+    SHA256HashValue h;
+    if (!SHA256HashValue::ConvertFromHexString(file.directive_hash(), &h)) {
+      return false;
+    }
+    hash = h;
+  }
+
+  CppDirectiveList directives;
+  directives.reserve(file.directive_size());
+  for (const auto& data : file.directive()) {
+    std::unique_ptr<CppDirective> directive = DirectiveFromProto(data);
+    if (!directive) {
+      LOG(WARNING) << "broken directive in snapshot."
+                   << " filepath=" << filepath;
+      return false;
+    }
+    directives.push_back(std::move(directive));
+  }
+
+  *include_item =
+      IncludeItem(std::make_shared<CppDirectiveList>(std::move(directives)),
+                  file.include_guard_ident());
+  *directive_hash = std::move(hash);
+  return true;
+}
+
+// static
+std::shared_ptr<const DirectiveSnapshotFile> DirectiveSnapshot::MakeFile(
+    const std::string& filepath,
+    const FileStat& file_stat,
+    const IncludeItem& include_item,
+    const absl::optional<SHA256HashValue>& directive_hash) {
+  if (!include_item.IsValid() || !file_stat.IsValid() ||
+      !file_stat.mtime.has_value()) {
+    return nullptr;
+  }
+
+  auto file = std::make_shared<DirectiveSnapshotFile>();
+  file->set_filepath(filepath);
+  *file->mutable_mtime() = TimeToProto(*file_stat.mtime);
+  file->set_size(file_stat.size);
+  file->set_include_guard_ident(include_item.include_guard_ident());
+  if (directive_hash.has_value()) {
+    file->set_directive_hash(directive_hash->ToHexString());
+  }
+  file->mutable_directive()->Reserve(include_item.directives()->size());
+  for (const auto& directive : *include_item.directives()) {
+    DirectiveToProto(*directive, file->add_directive());
+  }
+  return file;
+}
+
+void DirectiveSnapshot::Add(std::shared_ptr<const DirectiveSnapshotFile> file) {
+  if (!file) {
+    return;
+  }
+  std::string filepath = file->filepath();
+  AUTO_EXCLUSIVE_LOCK(lock, &mu_);
+  files_.emplace_back(std::move(filepath),
+                      absl::make_unique<Entry>(std::move(file)));
+  updated_ = true;
+  EvictUnlocked();
+}
+
+void DirectiveSnapshot::Add(
+    const std::string& filepath,
+    const FileStat& file_stat,
+    const IncludeItem& include_item,
+    const absl::optional<SHA256HashValue>& directive_hash) {
+  Add(MakeFile(filepath, file_stat, include_item, directive_hash));
+}
+
+void DirectiveSnapshot::EvictUnlocked() {
+  // An entry looked up since the last pass gets a second chance, so the
+  // loop ends after at most two passes.
+  while (max_entries_ < files_.size()) {
+    auto it = files_.begin();
+    if (it->second->referenced.exchange(false, std::memory_order_relaxed)) {
+      files_.MoveToBack(it);
+      continue;
+    }
+    files_.pop_front();
+  }
+}
+
+size_t DirectiveSnapshot::size() const {
+  AUTO_SHARED_LOCK(lock, &mu_);
+  return files_.size();
+}
+
+// static
+void DirectiveSnapshot::DirectiveToProto(const CppDirective& directive,
+                                         CppDirectiveData* data) {
+  data->set_type(static_cast<int>(directive.type()));
+  data->set_position(directive.position());
+
+  switch (directive.type()) {
+    case CppDirectiveType::DIRECTIVE_INCLUDE:
+    case CppDirectiveType::DIRECTIVE_IMPORT:
+    case CppDirectiveType::DIRECTIVE_INCLUDE_NEXT: {
+      const CppDirectiveIncludeBase& d = AsCppDirectiveIncludeBase(directive);
+      data->set_delimiter(d.delimiter());
+      if (d.delimiter() == ' ') {
+        TokensToProto(d.tokens(), data->mutable_token());
+      } else {
+        data->set_filename(d.filename());
+      }
+      return;
+    }
+    case CppDirectiveType::DIRECTIVE_DEFINE: {
+      const CppDirectiveDefine& d = AsCppDirectiveDefine(directive);
+      data->set_name(d.name());
+      if (d.is_function_macro()) {
+        data->set_is_function_macro(true);
+        data->set_num_args(d.num_args());
+        data->set_has_vararg(d.has_vararg());
+      }
+      TokensToProto(d.replacement(), data->mutable_token());
+      return;
+    }
+    case CppDirectiveType::DIRECTIVE_UNDEF:
+      data->set_name(AsCppDirectiveUndef(directive).name());
+      return;
+    case CppDirectiveType::DIRECTIVE_IFDEF:
+      data->set_name(AsCppDirectiveIfdef(directive).name());
+      return;
+    case CppDirectiveType::DIRECTIVE_IFNDEF:
+      data->set_name(AsCppDirectiveIfndef(directive).name());
+      return;
+    case CppDirectiveType::DIRECTIVE_IF:
+      TokensToProto(AsCppDirectiveIf(directive).tokens(),
+                    data->mutable_token());
+      return;
+    case CppDirectiveType::DIRECTIVE_ELIF:
+      TokensToProto(AsCppDirectiveElif(directive).tokens(),
+                    data->mutable_token());
+      return;
+    case CppDirectiveType::DIRECTIVE_ELSE:
+    case CppDirectiveType::DIRECTIVE_ENDIF:
+      return;
+    case CppDirectiveType::DIRECTIVE_PRAGMA:
+      data->set_is_pragma_once(AsCppDirectivePragma(directive).is_pragma_once());
+      return;
+    case CppDirectiveType::DIRECTIVE_ERROR: {
+      const CppDirectiveError& d = AsCppDirectiveError(directive);
+      data->set_error_reason(d.error_reason());
+      data->set_arg(d.arg());
+      return;
+    }
+  }
+  LOG(FATAL) << "unknown directive type: " << directive.DebugString();
+}
+
+// static
+std::unique_ptr<CppDirective> DirectiveSnapshot::DirectiveFromProto(
+    const CppDirectiveData& data) {
+  std::unique_ptr<CppDirective> directive;
+  switch (static_cast<CppDirectiveType>(data.type())) {
+    case CppDirectiveType::DIRECTIVE_INCLUDE:
+      directive = IncludeFromProto<CppDirectiveInclude>(data);
+      break;
+    case CppDirectiveType::DIRECTIVE_IMPORT:
+      directive = IncludeFromProto<CppDirectiveImport>(data);
+      break;
+    case CppDirectiveType::DIRECTIVE_INCLUDE_NEXT:
+      directive = IncludeFromProto<CppDirectiveIncludeNext>(data);
+      break;
+    case CppDirectiveType::DIRECTIVE_DEFINE: {
+      std::vector<CppToken> replacement;
+      if (!TokensFromProto(data.token(), &replacement)) {
+        return nullptr;
+      }
+      if (data.is_function_macro()) {
+        directive = absl::make_unique<CppDirectiveDefine>(
+            data.name(), data.num_args(), data.has_vararg(),
+            std::move(replacement));
+      } else {
+        directive = absl::make_unique<CppDirectiveDefine>(
+            data.name(), std::move(replacement));
+      }
+      break;
+    }
+    case CppDirectiveType::DIRECTIVE_UNDEF:
+      directive = absl::make_unique<CppDirectiveUndef>(data.name());
+      break;
+    case CppDirectiveType::DIRECTIVE_IFDEF:
+      directive = absl::make_unique<CppDirectiveIfdef>(data.name());
+      break;
+    case CppDirectiveType::DIRECTIVE_IFNDEF:
+      directive = absl::make_unique<CppDirectiveIfndef>(data.name());
+      break;
+    case CppDirectiveType::DIRECTIVE_IF:
+    case CppDirectiveType::DIRECTIVE_ELIF: {
+      std::vector<CppToken> tokens;
+      if (!TokensFromProto(data.token(), &tokens)) {
+        return nullptr;
+      }
+      if (data.type() == static_cast<int>(CppDirectiveType::DIRECTIVE_IF)) {
+        directive = absl::make_unique<CppDirectiveIf>(std::move(tokens));
+      } else {
+        directive = absl::make_unique<CppDirectiveElif>(std::move(tokens));
+      }
+      break;
+    }
+    case CppDirectiveType::DIRECTIVE_ELSE:
+      directive = absl::make_unique<CppDirectiveElse>();
+      break;
+    case CppDirectiveType::DIRECTIVE_ENDIF:
+      directive = absl::make_unique<CppDirectiveEndif>();
+      break;
+    case CppDirectiveType::DIRECTIVE_PRAGMA:
+      directive = absl::make_unique<CppDirectivePragma>(data.is_pragma_once());
+      break;
+    case CppDirectiveType::DIRECTIVE_ERROR:
+      directive = absl::make_unique<CppDirectiveError>(data.error_reason(),
+                                                       data.arg());
+      break;
+    default:
+      return nullptr;
+  }
+  if (directive) {
+    directive->set_position(data.position());
+  }
+  return directive;
+}
+
+}  // namespace devtools_goma
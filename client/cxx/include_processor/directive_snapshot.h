@@ -0,0 +1,133 @@
+// Copyright 2020 The Goma Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#ifndef DEVTOOLS_GOMA_CLIENT_CXX_INCLUDE_PROCESSOR_DIRECTIVE_SNAPSHOT_H_
+#define DEVTOOLS_GOMA_CLIENT_CXX_INCLUDE_PROCESSOR_DIRECTIVE_SNAPSHOT_H_
+
+#include <atomic>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "absl/base/thread_annotations.h"
+#include "absl/types/optional.h"
+#include "basictypes.h"
+#include "cache_file.h"
+#include "cxx/include_processor/cpp_directive.h"
+#include "cxx/include_processor/include_item.h"
+#include "goma_hash.h"
+#include "linked_unordered_map.h"
+#include "lockhelper.h"
+
+namespace devtools_goma {
+
+class CppDirectiveData;
+class DirectiveSnapshotFile;
+struct FileStat;
+
+// DirectiveSnapshot keeps parsed directives of headers under a set of
+// system include directories (e.g. /usr/include and libc++ headers of a
+// compiler), and persists them in a file.
+//
+// System headers are rarely modified, but are included by almost all
+// compiles. With a snapshot, the first compile after compiler_proxy starts
+// doesn't need to read and parse them.
+//
+// At most |max_entries| files are kept. Older files are evicted in CLOCK
+// (second chance) order, same as IncludeCache.
+//
+// This class is thread-safe.
+class DirectiveSnapshot {
+ public:
+  DirectiveSnapshot(std::string filename,
+                    std::string built_revision,
+                    std::vector<std::string> include_dirs,
+                    size_t max_entries);
+  ~DirectiveSnapshot();
+
+  // Returns snapshot filename in |snapshot_dir| for |include_dirs|.
+  static std::string SnapshotFilename(
+      const std::string& snapshot_dir,
+      const std::vector<std::string>& include_dirs);
+
+  // Loads the snapshot file. Returns true if loaded.
+  // A snapshot created by other built revision or for other include
+  // directories is ignored.
+  bool Load();
+  // Saves the snapshot file if it was updated since loaded.
+  // Returns true if nothing needs to be saved or it is saved.
+  bool SaveIfUpdated();
+
+  const std::vector<std::string>& include_dirs() const {
+    return include_dirs_;
+  }
+
+  // Returns true if |filepath| is under one of include_dirs().
+  bool Covers(const std::string& filepath) const;
+
+  // Gets IncludeItem (and directive hash if |needs_directive_hash|) of
+  // |filepath| from the snapshot.
+  // Returns false if |filepath| is not in the snapshot, or it was modified
+  // after the snapshot was taken (i.e. FileStat differs).
+  bool Lookup(const std::string& filepath,
+              const FileStat& file_stat,
+              bool needs_directive_hash,
+              IncludeItem* include_item,
+              absl::optional<SHA256HashValue>* directive_hash) const;
+
+  // Converts the parsed result of |filepath| to a snapshot entry, which can
+  // be added to several snapshots without copy.
+  // |file_stat| must be the FileStat when it was parsed.
+  // Returns nullptr if it can't be recorded.
+  static std::shared_ptr<const DirectiveSnapshotFile> MakeFile(
+      const std::string& filepath,
+      const FileStat& file_stat,
+      const IncludeItem& include_item,
+      const absl::optional<SHA256HashValue>& directive_hash);
+
+  // Adds (or replaces) |file| made by MakeFile. Does nothing for nullptr.
+  void Add(std::shared_ptr<const DirectiveSnapshotFile> file);
+  // Same as Add(MakeFile(...)).
+  void Add(const std::string& filepath,
+           const FileStat& file_stat,
+           const IncludeItem& include_item,
+           const absl::optional<SHA256HashValue>& directive_hash);
+
+  size_t size() const;
+
+  // Converts CppDirective to/from CppDirectiveData.
+  static void DirectiveToProto(const CppDirective& directive,
+                               CppDirectiveData* data);
+  static std::unique_ptr<CppDirective> DirectiveFromProto(
+      const CppDirectiveData& data);
+
+ private:
+  struct Entry {
+    explicit Entry(std::shared_ptr<const DirectiveSnapshotFile> file)
+        : file(std::move(file)) {}
+
+    const std::shared_ptr<const DirectiveSnapshotFile> file;
+    // Set by Lookup with shared lock.
+    mutable std::atomic<bool> referenced{false};
+  };
+
+  void EvictUnlocked() ABSL_EXCLUSIVE_LOCKS_REQUIRED(mu_);
+
+  const CacheFile cache_file_;
+  const std::string built_revision_;
+  const std::vector<std::string> include_dirs_;
+  const size_t max_entries_;
+
+  mutable ReadWriteLock mu_;
+  LinkedUnorderedMap<std::string, std::unique_ptr<Entry>> files_
+      ABSL_GUARDED_BY(mu_);
+  bool updated_ ABSL_GUARDED_BY(mu_) = false;
+
+  DISALLOW_COPY_AND_ASSIGN(DirectiveSnapshot);
+};
+
+}  // namespace devtools_goma
+
+#endif  // DEVTOOLS_GOMA_CLIENT_CXX_INCLUDE_PROCESSOR_DIRECTIVE_SNAPSHOT_H_
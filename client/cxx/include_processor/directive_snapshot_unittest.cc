@@ -0,0 +1,295 @@
+// Copyright 2020 The Goma Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "directive_snapshot.h"
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "absl/memory/memory.h"
+#include "absl/time/clock.h"
+#include "absl/time/time.h"
+#include "compiler_specific.h"
+#include "cxx/include_processor/cpp_directive_parser.h"
+#include "file_stat.h"
+#include "glog/logging.h"
+#include "gtest/gtest.h"
+#include "path.h"
+#include "unittest_util.h"
+
+MSVC_PUSH_DISABLE_WARNING_FOR_PROTO()
+#include "client/directive_snapshot_data.pb.h"
+MSVC_POP_WARNING()
+
+namespace devtools_goma {
+
+namespace {
+
+const char kBuiltRevision[] = "revision";
+constexpr size_t kMaxEntries = 16;
+
+const char kHeader[] =
+    "#ifndef FOO_H_\n"
+    "#define FOO_H_\n"
+    "#include <stdio.h>\n"
+    "#include \"bar.h\"\n"
+    "#include_next <foo.h>\n"
+    "#import <baz.h>\n"
+    "#include MACRO_HEADER\n"
+    "#define OBJ(x) (x + 1) * 0x10\n"
+    "#define FUNC(a, b, ...) a ## b # a __VA_ARGS__\n"
+    "#define STR \"str\" 'c' >>= <<\n"
+    "#undef OBJ\n"
+    "#ifdef BAR\n"
+    "#if defined(A) && (B > 10 || C <= -1)\n"
+    "#elif __has_include(<a.h>)\n"
+    "#else\n"
+    "#endif\n"
+    "#endif\n"
+    "#pragma once\n"
+    "#pragma other\n"
+    "#error\n"
+    "#endif\n";
+
+std::string ToDebugString(const CppDirectiveList& directives) {
+  std::string s;
+  for (const auto& directive : directives) {
+    s += directive->DebugString();
+    s += "@" + std::to_string(directive->position());
+    s += "\n";
+  }
+  return s;
+}
+
+}  // anonymous namespace
+
+class DirectiveSnapshotTest : public testing::Test {
+ protected:
+  void SetUp() override {
+    tmpdir_ = absl::make_unique<TmpdirUtil>("directive_snapshot_test");
+    tmpdir_->MkdirForPath("include", true);
+    include_dir_ = tmpdir_->FullPath("include");
+    snapshot_filename_ = DirectiveSnapshot::SnapshotFilename(
+        tmpdir_->tmpdir(), {include_dir_});
+  }
+
+  std::unique_ptr<DirectiveSnapshot> NewSnapshot() const {
+    return absl::make_unique<DirectiveSnapshot>(
+        snapshot_filename_, kBuiltRevision,
+        std::vector<std::string>{include_dir_}, kMaxEntries);
+  }
+
+  // Creates |filename| under include dir, whose mtime is old enough to be
+  // recorded in snapshot.
+  std::string CreateHeader(const std::string& filename,
+                           const std::string& content) {
+    const std::string path = file::JoinPath("include", filename);
+    tmpdir_->CreateTmpFile(path, content);
+    const std::string abs_path = tmpdir_->FullPath(path);
+    CHECK(UpdateMtime(abs_path, absl::Now() - absl::Hours(1)));
+    return abs_path;
+  }
+
+  static IncludeItem Parse(const std::string& content) {
+    return IncludeItem(CppDirectiveParser::ParseFromString(content, "foo.h"),
+                       "FOO_H_");
+  }
+
+  std::unique_ptr<TmpdirUtil> tmpdir_;
+  std::string include_dir_;
+  std::string snapshot_filename_;
+};
+
+TEST_F(DirectiveSnapshotTest, DirectiveRoundTrip) {
+  const IncludeItem item = Parse(kHeader);
+  ASSERT_TRUE(item.IsValid());
+
+  CppDirectiveList restored;
+  for (const auto& directive : *item.directives()) {
+    CppDirectiveData data;
+    DirectiveSnapshot::DirectiveToProto(*directive, &data);
+    std::unique_ptr<CppDirective> d =
+        DirectiveSnapshot::DirectiveFromProto(data);
+    ASSERT_NE(nullptr, d) << directive->DebugString();
+    EXPECT_EQ(directive->type(), d->type());
+    restored.push_back(std::move(d));
+  }
+  EXPECT_EQ(ToDebugString(*item.directives()), ToDebugString(restored));
+
+  ASSERT_EQ(CppDirectiveType::DIRECTIVE_DEFINE, restored[8]->type());
+  const auto& func = static_cast<const CppDirectiveDefine&>(*restored[8]);
+  ASSERT_TRUE(func.is_function_macro());
+  EXPECT_EQ("FUNC", func.name());
+  EXPECT_EQ(2, func.num_args());
+  EXPECT_TRUE(func.has_vararg());
+  EXPECT_EQ(
+      static_cast<const CppDirectiveDefine&>(*(*item.directives())[8])
+          .replacement(),
+      func.replacement());
+}
+
+TEST_F(DirectiveSnapshotTest, BrokenDirective) {
+  CppDirectiveData data;
+  data.set_type(-1);
+  EXPECT_EQ(nullptr, DirectiveSnapshot::DirectiveFromProto(data));
+
+  data.set_type(static_cast<int>(CppDirectiveType::DIRECTIVE_INCLUDE));
+  data.set_delimiter('x');
+  EXPECT_EQ(nullptr, DirectiveSnapshot::DirectiveFromProto(data));
+
+  data.set_type(static_cast<int>(CppDirectiveType::DIRECTIVE_IF));
+  data.add_token()->set_type(-1);
+  EXPECT_EQ(nullptr, DirectiveSnapshot::DirectiveFromProto(data));
+}
+
+TEST_F(DirectiveSnapshotTest, Covers) {
+  std::unique_ptr<DirectiveSnapshot> snapshot = NewSnapshot();
+  EXPECT_TRUE(snapshot->Covers(file::JoinPath(include_dir_, "a.h")));
+  EXPECT_TRUE(snapshot->Covers(file::JoinPath(include_dir_, "sys", "a.h")));
+  EXPECT_FALSE(snapshot->Covers(tmpdir_->FullPath("a.h")));
+  EXPECT_FALSE(snapshot->Covers(include_dir_ + "2/a.h"));
+}
+
+TEST_F(DirectiveSnapshotTest, SaveAndLoad) {
+  const std::string foo = CreateHeader("foo.h", kHeader);
+  SHA256HashValue hash;
+  ComputeDataHashKeyForSHA256HashValue("hash", &hash);
+
+  {
+    std::unique_ptr<DirectiveSnapshot> snapshot = NewSnapshot();
+    EXPECT_FALSE(snapshot->Load());
+    snapshot->Add(foo, FileStat(foo), Parse(kHeader), hash);
+    EXPECT_TRUE(snapshot->SaveIfUpdated());
+  }
+
+  std::unique_ptr<DirectiveSnapshot> snapshot = NewSnapshot();
+  EXPECT_TRUE(snapshot->Load());
+  EXPECT_EQ(1U, snapshot->size());
+
+  IncludeItem item;
+  absl::optional<SHA256HashValue> directive_hash;
+  ASSERT_TRUE(snapshot->Lookup(foo, FileStat(foo), true, &item,
+                               &directive_hash));
+  ASSERT_TRUE(item.IsValid());
+  EXPECT_EQ("FOO_H_", item.include_guard_ident());
+  EXPECT_EQ(ToDebugString(*Parse(kHeader).directives()),
+            ToDebugString(*item.directives()));
+  ASSERT_TRUE(directive_hash.has_value());
+  EXPECT_EQ(hash, *directive_hash);
+
+  // Modified after the snapshot is taken.
+  CreateHeader("foo.h", "#include <bar.h>\n");
+  EXPECT_FALSE(snapshot->Lookup(foo, FileStat(foo), true, &item,
+                                &directive_hash));
+}
+
+TEST_F(DirectiveSnapshotTest, LoadKeepsEntriesAddedBeforeLoad) {
+  const char kNewHeader[] = "#include <bar.h>\n";
+  const std::string foo = CreateHeader("foo.h", kHeader);
+  const std::string bar = CreateHeader("bar.h", kHeader);
+  {
+    std::unique_ptr<DirectiveSnapshot> snapshot = NewSnapshot();
+    snapshot->Add(foo, FileStat(foo), Parse(kHeader), absl::nullopt);
+    snapshot->Add(bar, FileStat(bar), Parse(kHeader), absl::nullopt);
+    EXPECT_TRUE(snapshot->SaveIfUpdated());
+  }
+
+  // foo.h is modified after the snapshot is saved, and parsed again
+  // before the snapshot is loaded.
+  CreateHeader("foo.h", kNewHeader);
+  ASSERT_TRUE(UpdateMtime(foo, absl::Now() - absl::Minutes(30)));
+  const FileStat new_file_stat(foo);
+  std::unique_ptr<DirectiveSnapshot> snapshot = NewSnapshot();
+  snapshot->Add(foo, new_file_stat, Parse(kNewHeader), absl::nullopt);
+  EXPECT_TRUE(snapshot->Load());
+  EXPECT_EQ(2U, snapshot->size());
+
+  IncludeItem item;
+  absl::optional<SHA256HashValue> directive_hash;
+  ASSERT_TRUE(snapshot->Lookup(foo, new_file_stat, false, &item,
+                               &directive_hash));
+  EXPECT_EQ(ToDebugString(*Parse(kNewHeader).directives()),
+            ToDebugString(*item.directives()));
+  // Entry only in the loaded snapshot is used.
+  EXPECT_TRUE(snapshot->Lookup(bar, FileStat(bar), false, &item,
+                               &directive_hash));
+}
+
+TEST_F(DirectiveSnapshotTest, IgnoreOtherRevision) {
+  const std::string foo = CreateHeader("foo.h", kHeader);
+  {
+    DirectiveSnapshot snapshot(snapshot_filename_, "other_revision",
+                               {include_dir_}, kMaxEntries);
+    snapshot.Add(foo, FileStat(foo), Parse(kHeader), absl::nullopt);
+    EXPECT_TRUE(snapshot.SaveIfUpdated());
+  }
+
+  std::unique_ptr<DirectiveSnapshot> snapshot = NewSnapshot();
+  EXPECT_FALSE(snapshot->Load());
+  EXPECT_EQ(0U, snapshot->size());
+}
+
+TEST_F(DirectiveSnapshotTest, LookupWithoutDirectiveHash) {
+  const std::string foo = CreateHeader("foo.h", kHeader);
+  std::unique_ptr<DirectiveSnapshot> snapshot = NewSnapshot();
+  snapshot->Add(foo, FileStat(foo), Parse(kHeader), absl::nullopt);
+
+  IncludeItem item;
+  absl::optional<SHA256HashValue> directive_hash;
+  EXPECT_TRUE(snapshot->Lookup(foo, FileStat(foo), false, &item,
+                               &directive_hash));
+  EXPECT_FALSE(directive_hash.has_value());
+  // Directive hash is required, but not recorded.
+  EXPECT_FALSE(snapshot->Lookup(foo, FileStat(foo), true, &item,
+                                &directive_hash));
+}
+
+TEST_F(DirectiveSnapshotTest, EvictOldEntries) {
+  const std::string foo = CreateHeader("foo.h", kHeader);
+  const std::string bar = CreateHeader("bar.h", kHeader);
+  const std::string baz = CreateHeader("baz.h", kHeader);
+  DirectiveSnapshot snapshot(snapshot_filename_, kBuiltRevision,
+                             {include_dir_}, 2);
+  snapshot.Add(foo, FileStat(foo), Parse(kHeader), absl::nullopt);
+  snapshot.Add(bar, FileStat(bar), Parse(kHeader), absl::nullopt);
+
+  // foo.h is looked up, so bar.h is evicted instead.
+  IncludeItem item;
+  absl::optional<SHA256HashValue> directive_hash;
+  EXPECT_TRUE(snapshot.Lookup(foo, FileStat(foo), false, &item,
+                              &directive_hash));
+  snapshot.Add(baz, FileStat(baz), Parse(kHeader), absl::nullopt);
+  EXPECT_EQ(2U, snapshot.size());
+  EXPECT_TRUE(snapshot.Lookup(foo, FileStat(foo), false, &item,
+                              &directive_hash));
+  EXPECT_FALSE(snapshot.Lookup(bar, FileStat(bar), false, &item,
+                               &directive_hash));
+  EXPECT_TRUE(snapshot.Lookup(baz, FileStat(baz), false, &item,
+                              &directive_hash));
+}
+
+TEST_F(DirectiveSnapshotTest, ShareFileAmongSnapshots) {
+  const std::string foo = CreateHeader("foo.h", kHeader);
+  std::shared_ptr<const DirectiveSnapshotFile> file =
+      DirectiveSnapshot::MakeFile(foo, FileStat(foo), Parse(kHeader),
+                                  absl::nullopt);
+  ASSERT_TRUE(file);
+  std::unique_ptr<DirectiveSnapshot> snapshot1 = NewSnapshot();
+  std::unique_ptr<DirectiveSnapshot> snapshot2 = NewSnapshot();
+  snapshot1->Add(file);
+  snapshot2->Add(file);
+  EXPECT_EQ(3, file.use_count());
+
+  IncludeItem item;
+  absl::optional<SHA256HashValue> directive_hash;
+  EXPECT_TRUE(snapshot2->Lookup(foo, FileStat(foo), false, &item,
+                                &directive_hash));
+
+  // Not recordable.
+  EXPECT_FALSE(DirectiveSnapshot::MakeFile(foo, FileStat(), Parse(kHeader),
+                                           absl::nullopt));
+}
+
+}  // namespace devtools_goma
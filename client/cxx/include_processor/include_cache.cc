@@ -5,17 +5,23 @@
 
 #include "include_cache.h"
 
+#include <algorithm>
+#include <functional>
+
 #include "absl/memory/memory.h"
+#include "absl/strings/str_join.h"
 #include "compiler_specific.h"
 #include "content.h"
 #include "counterz.h"
 #include "cxx/include_processor/cpp_directive_optimizer.h"
 #include "cxx/include_processor/cpp_directive_parser.h"
 #include "cxx/include_processor/directive_filter.h"
+#include "cxx/include_processor/directive_snapshot.h"
 #include "cxx/include_processor/include_guard_detector.h"
 #include "file_stat.h"
 #include "goma_hash.h"
 #include "histogram.h"
+#include "path.h"
 
 MSVC_PUSH_DISABLE_WARNING_FOR_PROTO()
 #include "lib/goma_stats.pb.h"
@@ -32,7 +38,8 @@ class IncludeCache::Item {
       : include_item_(std::move(include_item)),
         directive_hash_(std::move(directive_hash)),
         content_file_stat_(content_file_stat),
-        updated_count_(0) {}
+        updated_count_(0),
+        referenced_(false) {}
 
   ~Item() {}
 
@@ -80,16 +87,46 @@ class IncludeCache::Item {
   size_t updated_count() const { return updated_count_; }
   void set_updated_count(size_t c) { updated_count_ = c; }
 
+  // Marks the item as referred. This is called with shared lock, so
+  // |referenced_| is atomic.
+  void MarkReferenced() const {
+    referenced_.store(true, std::memory_order_relaxed);
+  }
+  // Clears the referred mark, and returns true if it was set.
+  bool ClearReferenced() {
+    return referenced_.exchange(false, std::memory_order_relaxed);
+  }
+
  private:
   const IncludeItem include_item_;
   const absl::optional<SHA256HashValue> directive_hash_;
 
   const FileStat content_file_stat_;
   size_t updated_count_;
+  mutable std::atomic<bool> referenced_;
 
   DISALLOW_COPY_AND_ASSIGN(Item);
 };
 
+namespace {
+
+// Shards are used only when each of them can have at least this number of
+// entries.
+constexpr size_t kMinCacheEntriesPerShard = 64;
+constexpr size_t kMaxShards = 32;
+
+// Compilers with different system include dirs are rarely used at the
+// same time.
+constexpr size_t kMaxDirectiveSnapshots = 8;
+
+}  // anonymous namespace
+
+IncludeCache::Shard::Shard(size_t max_cache_entries)
+    : max_cache_entries(max_cache_entries) {}
+
+IncludeCache::Shard::~Shard() {
+}
+
 IncludeCache* IncludeCache::instance_;
 
 // static
@@ -99,6 +136,9 @@ void IncludeCache::Init(int max_cache_entries, bool calculates_directive_hash) {
 
 // static
 void IncludeCache::Quit() {
+  if (instance_ != nullptr) {
+    instance_->SaveDirectiveSnapshots();
+  }
   delete instance_;
   instance_ = nullptr;
 }
@@ -106,40 +146,52 @@ void IncludeCache::Quit() {
 IncludeCache::IncludeCache(size_t max_cache_entries,
                            bool calculates_directive_hash)
     : max_cache_entries_(max_cache_entries),
-      calculates_directive_hash_(calculates_directive_hash),
-      count_item_updated_(0),
-      count_item_evicted_(0) {}
+      calculates_directive_hash_(calculates_directive_hash) {
+  const size_t num_shards = NumShards(max_cache_entries);
+  const size_t max_shard_entries =
+      (max_cache_entries + num_shards - 1) / num_shards;
+  shards_.reserve(num_shards);
+  for (size_t i = 0; i < num_shards; ++i) {
+    shards_.push_back(absl::make_unique<Shard>(max_shard_entries));
+  }
+}
 
 IncludeCache::~IncludeCache() {
 }
 
+// static
+size_t IncludeCache::NumShards(size_t max_cache_entries) {
+  return std::max<size_t>(
+      1, std::min(kMaxShards, max_cache_entries / kMinCacheEntriesPerShard));
+}
+
+IncludeCache::Shard* IncludeCache::GetShard(const std::string& filepath) const {
+  return shards_[std::hash<std::string>()(filepath) % shards_.size()].get();
+}
+
 IncludeItem IncludeCache::GetIncludeItem(const std::string& filepath,
                                          const FileStat& file_stat) {
   GOMA_COUNTERZ("GetDirectiveList");
 
+  Shard* shard = GetShard(filepath);
   {
-    AUTO_SHARED_LOCK(lock, &rwlock_);
-    if (const Item* item = GetItemIfNotModifiedUnlocked(filepath, file_stat)) {
-      hit_count_.Add(1);
+    AUTO_SHARED_LOCK(lock, &shard->rwlock);
+    if (const Item* item =
+            GetItemIfNotModifiedUnlocked(*shard, filepath, file_stat)) {
+      shard->hit_count.Add(1);
       return item->include_item();
     }
   }
 
-  missed_count_.Add(1);
+  shard->missed_count.Add(1);
 
-  std::unique_ptr<Item> item(
-      Item::CreateFromFile(filepath, file_stat, calculates_directive_hash()));
+  std::unique_ptr<Item> item = CreateItem(filepath, file_stat);
   if (!item) {
     return IncludeItem();
   }
 
   IncludeItem include_item = item->include_item();
-
-  {
-    AUTO_EXCLUSIVE_LOCK(lock, &rwlock_);
-    InsertUnlocked(filepath, std::move(item), file_stat);
-  }
-
+  Insert(shard, filepath, std::move(item));
   return include_item;
 }
 
@@ -148,90 +200,259 @@ absl::optional<SHA256HashValue> IncludeCache::GetDirectiveHash(
     const FileStat& file_stat) {
   DCHECK(calculates_directive_hash_);
 
+  Shard* shard = GetShard(filepath);
   {
-    AUTO_SHARED_LOCK(lock, &rwlock_);
-    if (const Item* item = GetItemIfNotModifiedUnlocked(filepath, file_stat)) {
+    AUTO_SHARED_LOCK(lock, &shard->rwlock);
+    if (const Item* item =
+            GetItemIfNotModifiedUnlocked(*shard, filepath, file_stat)) {
       return item->directive_hash();
     }
   }
 
-  std::unique_ptr<Item> item(
-      Item::CreateFromFile(filepath, file_stat, calculates_directive_hash()));
+  std::unique_ptr<Item> item = CreateItem(filepath, file_stat);
   if (!item) {
     return absl::nullopt;
   }
   absl::optional<SHA256HashValue> directive_hash = item->directive_hash();
+  Insert(shard, filepath, std::move(item));
+  return directive_hash;
+}
+
+std::unique_ptr<IncludeCache::Item> IncludeCache::CreateItem(
+    const std::string& filepath,
+    const FileStat& file_stat) {
+  const std::vector<std::shared_ptr<DirectiveSnapshot>> snapshots =
+      GetDirectiveSnapshots(filepath);
+  for (const auto& snapshot : snapshots) {
+    IncludeItem include_item;
+    absl::optional<SHA256HashValue> directive_hash;
+    if (snapshot->Lookup(filepath, file_stat, calculates_directive_hash(),
+                         &include_item, &directive_hash)) {
+      snapshot_hit_count_.Add(1);
+      return absl::make_unique<Item>(std::move(include_item),
+                                     std::move(directive_hash), file_stat);
+    }
+  }
+
+  std::unique_ptr<Item> item(
+      Item::CreateFromFile(filepath, file_stat, calculates_directive_hash()));
+  // Don't record a file that may be being modified.
+  if (item && !snapshots.empty() && file_stat.mtime.has_value() &&
+      !file_stat.CanBeStale()) {
+    // Snapshots for different include dirs share the same entry.
+    std::shared_ptr<const DirectiveSnapshotFile> file =
+        DirectiveSnapshot::MakeFile(filepath, file_stat, item->include_item(),
+                                    item->directive_hash());
+    for (const auto& snapshot : snapshots) {
+      snapshot->Add(file);
+    }
+  }
+  return item;
+}
 
+std::vector<std::shared_ptr<DirectiveSnapshot>>
+IncludeCache::GetDirectiveSnapshots(const std::string& filepath) const {
+  std::vector<std::shared_ptr<DirectiveSnapshot>> snapshots;
+  if (!has_snapshots_.load(std::memory_order_acquire)) {
+    return snapshots;
+  }
+  AUTO_SHARED_LOCK(lock, &snapshot_mu_);
+  for (const auto& it : snapshots_) {
+    if (it.second->Covers(filepath)) {
+      snapshots.push_back(it.second);
+    }
+  }
+  return snapshots;
+}
+
+void IncludeCache::EnableDirectiveSnapshot(std::string snapshot_dir,
+                                           std::string built_revision) {
+  AUTO_EXCLUSIVE_LOCK(lock, &snapshot_mu_);
+  snapshot_dir_ = std::move(snapshot_dir);
+  built_revision_ = std::move(built_revision);
+}
+
+void IncludeCache::UseDirectiveSnapshot(
+    const std::vector<std::string>& system_include_dirs) {
+  std::vector<std::string> include_dirs;
+  for (const auto& dir : system_include_dirs) {
+    if (file::IsAbsolutePath(dir)) {
+      include_dirs.push_back(dir);
+    }
+  }
+  if (include_dirs.empty()) {
+    return;
+  }
+
+  // This is called for every compile, so just look up by include dirs here.
+  // Snapshot filename (SHA-256 of include dirs) is computed outside the
+  // lock only when a new snapshot is created.
+  std::string key = absl::StrJoin(include_dirs, "\n");
+  std::string snapshot_dir;
+  std::string built_revision;
   {
-    AUTO_EXCLUSIVE_LOCK(lock, &rwlock_);
-    InsertUnlocked(filepath, std::move(item), file_stat);
+    AUTO_SHARED_LOCK(lock, &snapshot_mu_);
+    if (snapshot_dir_.empty() || snapshots_.contains(key)) {
+      return;
+    }
+    snapshot_dir = snapshot_dir_;
+    built_revision = built_revision_;
+  }
+  std::string filename =
+      DirectiveSnapshot::SnapshotFilename(snapshot_dir, include_dirs);
+  auto snapshot = std::make_shared<DirectiveSnapshot>(
+      std::move(filename), std::move(built_revision), std::move(include_dirs),
+      max_cache_entries_);
+  std::shared_ptr<DirectiveSnapshot> evicted;
+  {
+    AUTO_EXCLUSIVE_LOCK(lock, &snapshot_mu_);
+    if (snapshots_.contains(key)) {
+      // Other thread has created it.
+      return;
+    }
+    snapshots_.emplace_back(std::move(key), snapshot);
+    if (snapshots_.size() > kMaxDirectiveSnapshots) {
+      evicted = std::move(snapshots_.begin()->second);
+      snapshots_.pop_front();
+    }
+    has_snapshots_.store(true, std::memory_order_release);
+  }
+  if (evicted) {
+    LOG(INFO) << "too many directive snapshots. drop the oldest one.";
+    evicted->SaveIfUpdated();
+  }
+  // Load outside the lock. Until it is loaded, headers are parsed from
+  // files as usual and recorded to the snapshot.
+  snapshot->Load();
+}
+
+void IncludeCache::SaveDirectiveSnapshots() {
+  std::vector<std::shared_ptr<DirectiveSnapshot>> snapshots;
+  {
+    AUTO_SHARED_LOCK(lock, &snapshot_mu_);
+    for (const auto& it : snapshots_) {
+      snapshots.push_back(it.second);
+    }
+  }
+  for (const auto& snapshot : snapshots) {
+    snapshot->SaveIfUpdated();
   }
-  return directive_hash;
 }
 
 const IncludeCache::Item* IncludeCache::GetItemIfNotModifiedUnlocked(
+    const Shard& shard,
     const std::string& key,
     const FileStat& file_stat) const {
-  auto it = cache_items_.find(key);
-  if (it == cache_items_.end())
+  auto it = shard.cache_items.find(key);
+  if (it == shard.cache_items.end())
     return nullptr;
 
   const Item* item = it->second.get();
   if (file_stat != item->content_file_stat())
     return nullptr;
 
+  item->MarkReferenced();
   return item;
 }
 
-void IncludeCache::InsertUnlocked(const std::string& key,
-                                  std::unique_ptr<Item> item,
-                                  const FileStat& file_stat) {
-  auto it = cache_items_.find(key);
-  if (it == cache_items_.end()) {
-    cache_items_.emplace_back(key, std::move(item));
+void IncludeCache::Insert(Shard* shard,
+                          const std::string& key,
+                          std::unique_ptr<Item> item) {
+  if (shard->num_writers.fetch_add(1, std::memory_order_relaxed) > 0) {
+    shard->contended_count.Add(1);
+  }
+  {
+    AUTO_EXCLUSIVE_LOCK(lock, &shard->rwlock);
+    InsertUnlocked(shard, key, std::move(item));
+  }
+  shard->num_writers.fetch_sub(1, std::memory_order_relaxed);
+}
+
+void IncludeCache::InsertUnlocked(Shard* shard,
+                                  const std::string& key,
+                                  std::unique_ptr<Item> item) {
+  auto it = shard->cache_items.find(key);
+  if (it == shard->cache_items.end()) {
+    shard->cache_items.emplace_back(key, std::move(item));
   } else {
     item->set_updated_count(it->second->updated_count() + 1);
     it->second = std::move(item);
+    shard->count_item_updated++;
   }
 
-  EvictCacheUnlocked();
+  EvictCacheUnlocked(shard);
 }
 
-void IncludeCache::EvictCacheUnlocked() {
-  // Evicts older cache.
-  while (max_cache_entries_ < cache_items_.size()) {
-    DCHECK(!cache_items_.empty());
-    cache_items_.pop_front();
-    count_item_evicted_++;
+void IncludeCache::EvictCacheUnlocked(Shard* shard) {
+  // Evicts older cache. An item referred since the last pass gets a second
+  // chance, so the loop ends after at most two passes.
+  while (shard->max_cache_entries < shard->cache_items.size()) {
+    DCHECK(!shard->cache_items.empty());
+    auto it = shard->cache_items.begin();
+    if (it->second->ClearReferenced()) {
+      shard->cache_items.MoveToBack(it);
+      continue;
+    }
+    shard->cache_items.pop_front();
+    shard->count_item_evicted++;
   }
 }
 
 void IncludeCache::Dump(std::ostringstream* ss) {
-  AUTO_SHARED_LOCK(lock, &rwlock_);
-
-  size_t num_cache_item = cache_items_.size();
+  size_t num_cache_item = 0;
+  int64_t hit_count = 0;
+  int64_t missed_count = 0;
+  int64_t contended_count = 0;
+  size_t count_item_updated = 0;
+  size_t count_item_evicted = 0;
 
   Histogram item_update_count_histogram;
   item_update_count_histogram.SetName("Item Update Count Histogram");
 
-  for (const auto& it : cache_items_) {
-    const Item* item = it.second.get();
-    item_update_count_histogram.Add(item->updated_count());
+  std::ostringstream shard_ss;
+  for (size_t i = 0; i < shards_.size(); ++i) {
+    Shard* shard = shards_[i].get();
+    AUTO_SHARED_LOCK(lock, &shard->rwlock);
+
+    for (const auto& it : shard->cache_items) {
+      const Item* item = it.second.get();
+      item_update_count_histogram.Add(item->updated_count());
+    }
+
+    num_cache_item += shard->cache_items.size();
+    hit_count += shard->hit_count.value();
+    missed_count += shard->missed_count.value();
+    contended_count += shard->contended_count.value();
+    count_item_updated += shard->count_item_updated;
+    count_item_evicted += shard->count_item_evicted;
+
+    shard_ss << " shard[" << i << "]"
+             << " entries=" << shard->cache_items.size()
+             << " hit=" << shard->hit_count.value()
+             << " missed=" << shard->missed_count.value()
+             << " contended=" << shard->contended_count.value()
+             << std::endl;
   }
 
   (*ss) << "IncludeCache summary" << std::endl;
 
   (*ss) << std::endl;
   (*ss) << "current cache entries = " << num_cache_item << std::endl
-        << "entry capacity = " << max_cache_entries_ << std::endl;
+        << "entry capacity = " << max_cache_entries_ << std::endl
+        << "shards = " << shards_.size() << std::endl;
+
+  (*ss) << std::endl;
+  (*ss) << " Hit    = " << hit_count << std::endl;
+  (*ss) << " Missed = " << missed_count << std::endl;
+  (*ss) << " Contended = " << contended_count << std::endl;
+  (*ss) << " Snapshot hit = " << snapshot_hit_count_.value() << std::endl;
 
   (*ss) << std::endl;
-  (*ss) << " Hit    = " << hit_count_.value() << std::endl;
-  (*ss) << " Missed = " << missed_count_.value() << std::endl;
+  (*ss) << "Item updated count = " << count_item_updated << std::endl;
+  (*ss) << "Item evicted count = " << count_item_evicted << std::endl;
 
   (*ss) << std::endl;
-  (*ss) << "Item updated count = " << count_item_updated_ << std::endl;
-  (*ss) << "Item evicted count = " << count_item_evicted_ << std::endl;
+  (*ss) << shard_ss.str();
 
   // TODO: DebugString() will crash when there is no item.
   // Add a unittest and fix it later.
@@ -256,17 +477,39 @@ void IncludeCache::DumpAll(std::ostringstream* ss) {
 }
 
 void IncludeCache::DumpStatsToProto(IncludeCacheStats* stats) {
+  int64_t total_entries = 0;
+  int64_t hit = 0;
+  int64_t missed = 0;
+  int64_t updated = 0;
+  int64_t evicted = 0;
+  int64_t contended = 0;
+
+  for (const auto& shard : shards_) {
+    IncludeCacheShardStats* shard_stats = stats->add_shard_stats();
+    shard_stats->set_hit(shard->hit_count.value());
+    shard_stats->set_missed(shard->missed_count.value());
+    shard_stats->set_contended(shard->contended_count.value());
+    {
+      AUTO_SHARED_LOCK(lock, &shard->rwlock);
+      shard_stats->set_total_entries(shard->cache_items.size());
+      shard_stats->set_evicted(shard->count_item_evicted);
+      updated += shard->count_item_updated;
+    }
 
-  stats->set_hit(hit_count_.value());
-  stats->set_missed(missed_count_.value());
-
-  {
-    AUTO_SHARED_LOCK(lock, &rwlock_);
-    stats->set_total_entries(cache_items_.size());
-
-    stats->set_updated(count_item_updated_);
-    stats->set_evicted(count_item_evicted_);
+    total_entries += shard_stats->total_entries();
+    hit += shard_stats->hit();
+    missed += shard_stats->missed();
+    evicted += shard_stats->evicted();
+    contended += shard_stats->contended();
   }
+
+  stats->set_total_entries(total_entries);
+  stats->set_hit(hit);
+  stats->set_missed(missed);
+  stats->set_updated(updated);
+  stats->set_evicted(evicted);
+  stats->set_contended(contended);
+  stats->set_snapshot_hit(snapshot_hit_count_.value());
 }
 
 }  // namespace devtools_goma
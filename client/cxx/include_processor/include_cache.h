@@ -6,9 +6,10 @@
 #ifndef DEVTOOLS_GOMA_CLIENT_CXX_INCLUDE_PROCESSOR_INCLUDE_CACHE_H_
 #define DEVTOOLS_GOMA_CLIENT_CXX_INCLUDE_PROCESSOR_INCLUDE_CACHE_H_
 
-#include <list>
+#include <atomic>
 #include <memory>
 #include <string>
+#include <vector>
 
 #include "absl/base/thread_annotations.h"
 #include "absl/types/optional.h"
@@ -21,10 +22,13 @@
 
 namespace devtools_goma {
 
+class DirectiveSnapshot;
 struct FileStat;
 class IncludeCacheStats;
 
 // IncludeCache stores the parsed result of include headers.
+// Cache items are split into shards by filepath hash, and each shard has
+// its own lock, eviction queue and stats.
 class IncludeCache {
  public:
   static IncludeCache* instance() { return instance_; }
@@ -50,6 +54,22 @@ class IncludeCache {
   absl::optional<SHA256HashValue> GetDirectiveHash(const std::string& filepath,
                                                    const FileStat& file_stat);
 
+  // Enables directive snapshots, which are saved in |snapshot_dir|.
+  // A snapshot created by other |built_revision| is not used.
+  // Each snapshot keeps at most max_cache_entries files, and only a few
+  // newest snapshots are kept in memory.
+  void EnableDirectiveSnapshot(std::string snapshot_dir,
+                               std::string built_revision);
+
+  // Makes headers under |system_include_dirs| served from (and recorded to)
+  // the directive snapshot for |system_include_dirs|. The snapshot is
+  // loaded at the first call for the same |system_include_dirs|.
+  // No-op if directive snapshot is not enabled.
+  void UseDirectiveSnapshot(const std::vector<std::string>& system_include_dirs);
+
+  // Saves directive snapshots updated since loaded.
+  void SaveDirectiveSnapshots();
+
   void Dump(std::ostringstream* ss);
   static void DumpAll(std::ostringstream* ss);
 
@@ -61,35 +81,90 @@ class IncludeCache {
   class Item;
   friend class IncludeCacheTest;
 
+  // Shard owns a part of cache items, selected by a hash of filepath, so
+  // that threads looking up different files rarely share a lock.
+  // The cache hit path only takes |rwlock| shared; the exclusive lock is
+  // taken only to insert a parsed item (and evict old ones).
+  struct Shard {
+    explicit Shard(size_t max_cache_entries);
+    ~Shard();
+
+    const size_t max_cache_entries;
+
+    ReadWriteLock rwlock;
+    // A map from filepath to unique_ptr<Item>.
+    // Items are evicted in CLOCK (second chance) order, i.e. the oldest
+    // item is evicted unless it has been referred since it was inserted or
+    // last passed over. This approximates LRU without reordering on hit.
+    LinkedUnorderedMap<std::string, std::unique_ptr<Item>> cache_items
+        ABSL_GUARDED_BY(rwlock);
+
+    size_t count_item_updated ABSL_GUARDED_BY(rwlock) = 0;
+    size_t count_item_evicted ABSL_GUARDED_BY(rwlock) = 0;
+
+    StatsCounter hit_count;
+    StatsCounter missed_count;
+    // The number of inserts that found another insert holding or waiting
+    // for |rwlock|.
+    StatsCounter contended_count;
+
+    // The number of threads holding or waiting for |rwlock| exclusively.
+    std::atomic<int> num_writers{0};
+
+    DISALLOW_COPY_AND_ASSIGN(Shard);
+  };
+
   IncludeCache(size_t max_cache_entries, bool calculates_directive_hash);
   ~IncludeCache();
 
+  // Returns the number of shards used for |max_cache_entries|.
+  // Small caches use a single shard so that the capacity is exact.
+  static size_t NumShards(size_t max_cache_entries);
+
+  Shard* GetShard(const std::string& filepath) const;
+
+  // Creates Item of |filepath| from directive snapshot or file.
+  std::unique_ptr<Item> CreateItem(const std::string& filepath,
+                                   const FileStat& file_stat);
+  // Returns directive snapshots that cover |filepath|.
+  std::vector<std::shared_ptr<DirectiveSnapshot>> GetDirectiveSnapshots(
+      const std::string& filepath) const;
+
   const IncludeCache::Item* GetItemIfNotModifiedUnlocked(
+      const Shard& shard,
       const std::string& key,
-      const FileStat& file_stat) const ABSL_SHARED_LOCKS_REQUIRED(rwlock_);
-  void InsertUnlocked(const std::string& key,
-                      std::unique_ptr<Item> include_item,
-                      const FileStat& file_stat)
-      ABSL_EXCLUSIVE_LOCKS_REQUIRED(rwlock_);
-  void EvictCacheUnlocked() ABSL_EXCLUSIVE_LOCKS_REQUIRED(rwlock_);
+      const FileStat& file_stat) const ABSL_SHARED_LOCKS_REQUIRED(shard.rwlock);
+  void Insert(Shard* shard,
+              const std::string& key,
+              std::unique_ptr<Item> include_item);
+  void InsertUnlocked(Shard* shard,
+                      const std::string& key,
+                      std::unique_ptr<Item> include_item)
+      ABSL_EXCLUSIVE_LOCKS_REQUIRED(shard->rwlock);
+  void EvictCacheUnlocked(Shard* shard)
+      ABSL_EXCLUSIVE_LOCKS_REQUIRED(shard->rwlock);
 
   static IncludeCache* instance_;
 
   const size_t max_cache_entries_;
   const bool calculates_directive_hash_;
 
-  ReadWriteLock rwlock_;
-  // A map from filepath to unique_ptr<Item>.
-  // The oldest item comes first.
-  // TODO: We might want to use LRU instead of just queue.
-  // Currently we're not updating |cache_items_| after referring.
-  LinkedUnorderedMap<std::string, std::unique_ptr<Item>> cache_items_;
-
-  size_t count_item_updated_;
-  size_t count_item_evicted_;
-
-  StatsCounter hit_count_;
-  StatsCounter missed_count_;
+  std::vector<std::unique_ptr<Shard>> shards_;
+
+  // True if there is any snapshot, to avoid |snapshot_mu_| on cache miss
+  // when directive snapshot is not used.
+  std::atomic<bool> has_snapshots_{false};
+  // Snapshots are looked up on every cache miss, and rarely added.
+  mutable ReadWriteLock snapshot_mu_;
+  std::string snapshot_dir_ ABSL_GUARDED_BY(snapshot_mu_);
+  std::string built_revision_ ABSL_GUARDED_BY(snapshot_mu_);
+  // A map from include dirs (joined with '\n') to DirectiveSnapshot, in
+  // the order of creation. The oldest one is saved and dropped when there
+  // are too many.
+  LinkedUnorderedMap<std::string, std::shared_ptr<DirectiveSnapshot>>
+      snapshots_ ABSL_GUARDED_BY(snapshot_mu_);
+
+  StatsCounter snapshot_hit_count_;
 
   DISALLOW_COPY_AND_ASSIGN(IncludeCache);
 };
@@ -12,12 +12,17 @@
 
 #include "absl/strings/str_cat.h"
 #include "absl/time/time.h"
+#include "compiler_specific.h"
 #include "content.h"
 #include "file_stat.h"
 #include "file_stat_cache.h"
 #include "goma_hash.h"
 #include "unittest_util.h"
 
+MSVC_PUSH_DISABLE_WARNING_FOR_PROTO()
+#include "lib/goma_stats.pb.h"
+MSVC_POP_WARNING()
+
 namespace devtools_goma {
 
 class IncludeCacheTest : public testing::Test {
@@ -31,14 +36,31 @@ class IncludeCacheTest : public testing::Test {
   }
 
   int Size(IncludeCache* include_cache) const {
-    return include_cache->cache_items_.size();
+    size_t size = 0;
+    for (const auto& shard : include_cache->shards_) {
+      AUTO_SHARED_LOCK(lock, &shard->rwlock);
+      size += shard->cache_items.size();
+    }
+    return size;
   }
 
   size_t HitCount(IncludeCache* include_cache) const {
-    return include_cache->hit_count_.value();
+    size_t count = 0;
+    for (const auto& shard : include_cache->shards_) {
+      count += shard->hit_count.value();
+    }
+    return count;
   }
   size_t MissedCount(IncludeCache* include_cache) const {
-    return include_cache->missed_count_.value();
+    size_t count = 0;
+    for (const auto& shard : include_cache->shards_) {
+      count += shard->missed_count.value();
+    }
+    return count;
+  }
+
+  size_t NumShards(IncludeCache* include_cache) const {
+    return include_cache->shards_.size();
   }
 };
 
@@ -156,6 +178,80 @@ TEST_F(IncludeCacheTest, ExceedMemory) {
   EXPECT_EQ(2, Size(ic));
 }
 
+TEST_F(IncludeCacheTest, EvictNotReferredFirst) {
+  IncludeCache* ic = IncludeCache::instance();
+
+  TmpdirUtil tmpdir("includecache");
+
+  std::vector<std::string> paths;
+  FileStat file_stat;
+  file_stat.size = 7;
+  file_stat.mtime = absl::FromTimeT(100);
+  for (size_t i = 0; i < 3; ++i) {
+    std::string filename = absl::StrCat("a", i, ".h");
+    tmpdir.CreateTmpFile(filename, "content");
+    paths.push_back(tmpdir.FullPath(filename));
+  }
+
+  (void)ic->GetIncludeItem(paths[0], file_stat);
+  (void)ic->GetIncludeItem(paths[1], file_stat);
+  // Refer [0], so [1] will be evicted instead of [0].
+  (void)ic->GetIncludeItem(paths[0], file_stat);
+  (void)ic->GetIncludeItem(paths[2], file_stat);
+  EXPECT_EQ(2, Size(ic));
+
+  size_t hit_count_0 = HitCount(ic);
+  size_t missed_count_0 = MissedCount(ic);
+  (void)ic->GetIncludeItem(paths[0], file_stat);
+  EXPECT_EQ(hit_count_0 + 1, HitCount(ic));
+  EXPECT_EQ(missed_count_0, MissedCount(ic));
+  (void)ic->GetIncludeItem(paths[1], file_stat);
+  EXPECT_EQ(hit_count_0 + 1, HitCount(ic));
+  EXPECT_EQ(missed_count_0 + 1, MissedCount(ic));
+}
+
+TEST_F(IncludeCacheTest, Sharded) {
+  IncludeCache::Quit();
+  IncludeCache::Init(1024, true);
+  IncludeCache* ic = IncludeCache::instance();
+  EXPECT_GT(NumShards(ic), 1U);
+
+  TmpdirUtil tmpdir("includecache");
+
+  const int kNumFiles = 100;
+  FileStat file_stat;
+  file_stat.size = 7;
+  file_stat.mtime = absl::FromTimeT(100);
+  for (int i = 0; i < kNumFiles; ++i) {
+    std::string filename = absl::StrCat("a", i, ".h");
+    tmpdir.CreateTmpFile(filename, "content");
+    (void)ic->GetIncludeItem(tmpdir.FullPath(filename), file_stat);
+    (void)ic->GetIncludeItem(tmpdir.FullPath(filename), file_stat);
+  }
+  EXPECT_EQ(kNumFiles, Size(ic));
+
+  IncludeCacheStats stats;
+  ic->DumpStatsToProto(&stats);
+  EXPECT_EQ(kNumFiles, stats.total_entries());
+  EXPECT_EQ(kNumFiles, stats.hit());
+  EXPECT_EQ(kNumFiles, stats.missed());
+  EXPECT_EQ(0, stats.evicted());
+  ASSERT_EQ(NumShards(ic), static_cast<size_t>(stats.shard_stats_size()));
+
+  int64_t total_entries = 0;
+  int num_used_shards = 0;
+  for (const auto& shard_stats : stats.shard_stats()) {
+    total_entries += shard_stats.total_entries();
+    EXPECT_EQ(shard_stats.total_entries(), shard_stats.hit());
+    EXPECT_EQ(shard_stats.total_entries(), shard_stats.missed());
+    if (shard_stats.total_entries() > 0) {
+      ++num_used_shards;
+    }
+  }
+  EXPECT_EQ(kNumFiles, total_entries);
+  EXPECT_GT(num_used_shards, 1);
+}
+
 TEST_F(IncludeCacheTest, GetDirectiveHash)
 {
   IncludeCache* ic = IncludeCache::instance();
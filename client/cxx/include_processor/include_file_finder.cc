@@ -7,12 +7,16 @@
 #include <utility>
 
 #include "absl/strings/ascii.h"
+#include "absl/memory/memory.h"
 #include "absl/strings/match.h"
+#include "absl/strings/str_cat.h"
 #include "counterz.h"
 #include "cpp_parser.h"
 #include "file_dir.h"
 #include "file_stat_cache.h"
+#include "goma_hash.h"
 #include "include_file_utils.h"
+#include "include_resolution_cache.h"
 #include "list_dir_cache.h"
 #include "path.h"
 #include "path_resolver.h"
@@ -106,6 +110,23 @@ IncludeFileFinder::IncludeFileFinder(
       include_dir_index_lowerbound_.emplace(std::move(name), i);
     }
   }
+
+  // Header maps are not tracked by FileStat of directories, so lookup
+  // results using them are not shared with other translation units.
+  if (IncludeResolutionCache::IsEnabled() && hmap_map_.empty()) {
+    std::string search_dirs = absl::StrCat(cwd_, "\n", ignore_case_, "\n",
+                                           gch_hack_enabled(), "\n");
+    // include_dirs_[0] is the directory of the input file, which is not
+    // searched by Lookup.
+    for (size_t i = CppParser::kIncludeDirIndexStarting;
+         i < include_dirs_->size(); ++i) {
+      absl::StrAppend(&search_dirs, "I", (*include_dirs_)[i], "\n");
+    }
+    for (const auto& dir : *framework_dirs_) {
+      absl::StrAppend(&search_dirs, "F", dir, "\n");
+    }
+    ComputeDataHashKey(search_dirs, &search_key_);
+  }
 }
 
 /* static */
@@ -145,6 +166,25 @@ bool IncludeFileFinder::Lookup(const std::string& path_in_directive,
     }
   }
 
+  // Check cache shared with other translation units.
+  std::string resolution_key;
+  std::unique_ptr<IncludeResolutionCache::Entry> resolution;
+  if (!search_key_.empty() &&
+      *include_dir_index >= CppParser::kIncludeDirIndexStarting) {
+    resolution_key = IncludeResolutionCache::MakeKey(
+        search_key_, *include_dir_index, path_in_directive);
+    int dir_index = *include_dir_index;
+    if (IncludeResolutionCache::instance()->Lookup(
+            resolution_key, file_stat_cache_, filepath, &dir_index)) {
+      include_path_cache_.insert(std::make_pair(
+          std::make_pair(path_in_directive, *include_dir_index),
+          std::make_pair(*filepath, dir_index)));
+      *include_dir_index = dir_index;
+      return true;
+    }
+    resolution = absl::make_unique<IncludeResolutionCache::Entry>();
+  }
+
   // |top| is used to reduce the number of searched include directories
   // by checking precalculated direct children of include dirs.
   // e.g. if #include <foo/bar.h> comes, include directories not having
@@ -161,6 +201,12 @@ bool IncludeFileFinder::Lookup(const std::string& path_in_directive,
     // have "base" entry, then search_start_index becomes 4.
     auto iter = include_dir_index_lowerbound_.find(top);
     if (iter != include_dir_index_lowerbound_.end()) {
+      if (resolution) {
+        // Skipped since these dirs don't have |top|.
+        for (size_t i = search_start_index; i < iter->second; ++i) {
+          AddIncludeDirDependency(i, resolution.get());
+        }
+      }
       search_start_index = std::max(search_start_index, iter->second);
     } else if (!gch_hack_enabled() &&
                !absl::StartsWith(path_in_directive, ".")) {
@@ -185,6 +231,9 @@ bool IncludeFileFinder::Lookup(const std::string& path_in_directive,
     if (!absl::StartsWith(top, ".") &&
         !files_in_include_dirs_[i].contains(top)) {
       VLOG(2) << "not in " << i;
+      if (resolution) {
+        AddIncludeDirDependency(i, resolution.get());
+      }
       continue;
     }
 
@@ -202,6 +251,15 @@ bool IncludeFileFinder::Lookup(const std::string& path_in_directive,
     try_path = RemoveDuplicateSlash(try_path);
     VLOG(2) << "try_path=" << try_path;
 
+    if (resolution) {
+      // Whether try_path (and its gch) exists or not is tracked by
+      // FileStat of its directory.
+      const std::string dir(file::Dirname(
+          file::JoinPathRespectAbsolute(cwd_, try_path)));
+      FileStat dir_stat = file_stat_cache_->Get(dir);
+      resolution->dependencies.emplace_back(dir, std::move(dir_stat));
+    }
+
     if (gch_hack_enabled()) {
       const std::string& gch_path = try_path + GOMA_GCH_SUFFIX;
       FileStat filestat =
@@ -209,6 +267,8 @@ bool IncludeFileFinder::Lookup(const std::string& path_in_directive,
       if (!filestat.is_directory && filestat.IsValid()) {
         *filepath = gch_path;
         *include_dir_index = i;
+        MaybeInsertResolution(resolution_key, *filepath, i,
+                              std::move(resolution));
         return true;
       }
     }
@@ -228,12 +288,88 @@ bool IncludeFileFinder::Lookup(const std::string& path_in_directive,
             std::make_pair(try_path, i)));
     *filepath = try_path;
     *include_dir_index = i;
+    MaybeInsertResolution(resolution_key, *filepath, i, std::move(resolution));
     return true;
   }
 
   return LookupFramework(path_in_directive, filepath);
 }
 
+void IncludeFileFinder::LookupCandidates(
+    const std::string& path_in_directive,
+    int include_dir_index,
+    std::vector<std::string>* candidates) const {
+  {
+    auto iter = include_path_cache_.find(
+        std::make_pair(path_in_directive, include_dir_index));
+    if (iter != include_path_cache_.end()) {
+      candidates->push_back(iter->second.first);
+      return;
+    }
+  }
+
+  // Same pruning as Lookup.
+  std::string top = TopPathComponent(path_in_directive, ignore_case_);
+  size_t search_start_index = include_dir_index;
+  {
+    auto iter = include_dir_index_lowerbound_.find(top);
+    if (iter != include_dir_index_lowerbound_.end()) {
+      search_start_index = std::max(search_start_index, iter->second);
+    } else if (!gch_hack_enabled() &&
+               !absl::StartsWith(path_in_directive, ".")) {
+      return;
+    }
+  }
+
+  for (size_t i = search_start_index; i < include_dirs_->size(); ++i) {
+    if (!absl::StartsWith(top, ".") &&
+        !files_in_include_dirs_[i].contains(top)) {
+      continue;
+    }
+
+    std::string join_path;
+    {
+      auto iter = hmap_map_.find(std::make_pair(i, path_in_directive));
+      if (iter != hmap_map_.end()) {
+        join_path = iter->second;
+      } else {
+        join_path = file::JoinPath((*include_dirs_)[i], path_in_directive);
+      }
+    }
+    std::string try_path;
+    PathResolver::PlatformConvertToString(join_path, &try_path);
+    try_path = RemoveDuplicateSlash(try_path);
+    if (gch_hack_enabled()) {
+      candidates->push_back(try_path + GOMA_GCH_SUFFIX);
+    }
+    candidates->push_back(std::move(try_path));
+  }
+}
+
+void IncludeFileFinder::AddIncludeDirDependency(
+    size_t include_dir_index,
+    IncludeResolutionCache::Entry* resolution) {
+  std::string abs_include_dir =
+      file::JoinPathRespectAbsolute(cwd_, (*include_dirs_)[include_dir_index]);
+  FileStat file_stat = file_stat_cache_->Get(abs_include_dir);
+  resolution->dependencies.emplace_back(std::move(abs_include_dir),
+                                        std::move(file_stat));
+}
+
+void IncludeFileFinder::MaybeInsertResolution(
+    const std::string& resolution_key,
+    const std::string& filepath,
+    int include_dir_index,
+    std::unique_ptr<IncludeResolutionCache::Entry> resolution) {
+  if (!resolution) {
+    return;
+  }
+  resolution->filepath = filepath;
+  resolution->include_dir_index = include_dir_index;
+  IncludeResolutionCache::instance()->Insert(resolution_key,
+                                             std::move(*resolution));
+}
+
 bool IncludeFileFinder::LookupFramework(const std::string& path_in_directive,
                                         std::string* filepath) {
   auto sep_pos = path_in_directive.find('/');
@@ -5,11 +5,13 @@
 #ifndef DEVTOOLS_GOMA_CLIENT_CXX_INCLUDE_PROCESSOR_INCLUDE_FILE_FINDER_H_
 #define DEVTOOLS_GOMA_CLIENT_CXX_INCLUDE_PROCESSOR_INCLUDE_FILE_FINDER_H_
 
+#include <memory>
 #include <string>
 #include <vector>
 
 #include "absl/container/flat_hash_map.h"
 #include "absl/container/flat_hash_set.h"
+#include "include_resolution_cache.h"
 
 namespace devtools_goma {
 
@@ -38,6 +40,13 @@ class IncludeFileFinder {
               std::string* filepath,
               int* include_dir_index);
 
+  // Appends paths that Lookup would try for |path_in_directive| to
+  // |candidates| in order, without accessing the filesystem.
+  // Framework directories are not included.
+  void LookupCandidates(const std::string& path_in_directive,
+                        int include_dir_index,
+                        std::vector<std::string>* candidates) const;
+
   // Calculate |top| component in include directive.
   // e.g.
   // #include <foo/bar.h> -> |top| is "foo"
@@ -60,6 +69,17 @@ class IncludeFileFinder {
   bool LookupFramework(const std::string& path_in_directive,
                        std::string* filepath);
 
+  // Adds FileStat of |include_dir_index|-th include dir to dependencies of
+  // |resolution|.
+  void AddIncludeDirDependency(size_t include_dir_index,
+                               IncludeResolutionCache::Entry* resolution);
+  // Inserts |resolution| to IncludeResolutionCache if it is not nullptr.
+  void MaybeInsertResolution(
+      const std::string& resolution_key,
+      const std::string& filepath,
+      int include_dir_index,
+      std::unique_ptr<IncludeResolutionCache::Entry> resolution);
+
   static bool gch_hack_;
 
   const std::string cwd_;
@@ -86,6 +106,10 @@ class IncludeFileFinder {
 
   // Map for "include_dir idx + (key in .hmap file)" -> filename in .hmap file.
   absl::flat_hash_map<std::pair<int, std::string>, std::string> hmap_map_;
+
+  // Identifies include dirs and other settings for IncludeResolutionCache.
+  // Empty if IncludeResolutionCache is not used.
+  std::string search_key_;
 };
 
 }  // namespace devtools_goma
@@ -8,12 +8,22 @@
 
 #include <gtest/gtest.h>
 
+#include "absl/time/clock.h"
+#include "absl/time/time.h"
+#include "compiler_specific.h"
 #include "cpp_include_processor_unittest_helper.h"
+#include "cpp_parser.h"
 #include "file_stat_cache.h"
 #include "include_file_utils.h"
+#include "include_resolution_cache.h"
+#include "list_dir_cache.h"
 #include "path.h"
 #include "unittest_util.h"
 
+MSVC_PUSH_DISABLE_WARNING_FOR_PROTO()
+#include "lib/goma_stats.pb.h"
+MSVC_POP_WARNING()
+
 namespace devtools_goma {
 
 class IncludeFileFinderTest : public testing::Test {
@@ -91,4 +101,176 @@ TEST_F(IncludeFileFinderTest, LookupFrameworkWithHmap) {
   EXPECT_EQ(1, dir_index);
 }
 
+TEST_F(IncludeFileFinderTest, LookupCandidates) {
+  CreateTmpDir(file::JoinPath("inc1", "foo"));
+  CreateTmpDir("inc2");
+  CreateTmpDir(file::JoinPath("inc3", "foo"));
+  // Used to list entries in include dirs.
+  ListDirCache::Init(4096);
+
+  std::vector<std::string> include_dirs = {tmpdir_util_->realcwd(), "inc1",
+                                           "inc2", "inc3"};
+  std::vector<std::string> framework_dirs;
+  FileStatCache file_stat_cache;
+  IncludeFileFinder finder(tmpdir_util_->realcwd(), /*ignore_case=*/false,
+                           &include_dirs, &framework_dirs, &file_stat_cache);
+
+  // inc2 is skipped since it doesn't have foo.
+  std::vector<std::string> candidates;
+  finder.LookupCandidates("foo/bar.h", CppParser::kIncludeDirIndexStarting,
+                          &candidates);
+  EXPECT_EQ((std::vector<std::string>{file::JoinPath("inc1", "foo", "bar.h"),
+                                      file::JoinPath("inc3", "foo", "bar.h")}),
+            candidates);
+
+  candidates.clear();
+  finder.LookupCandidates("foo/bar.h", 3, &candidates);
+  EXPECT_EQ(
+      (std::vector<std::string>{file::JoinPath("inc3", "foo", "bar.h")}),
+      candidates);
+
+  // Not in any include dirs.
+  candidates.clear();
+  finder.LookupCandidates("baz.h", CppParser::kIncludeDirIndexStarting,
+                          &candidates);
+  EXPECT_TRUE(candidates.empty());
+
+  ListDirCache::Quit();
+}
+
+class IncludeResolutionCacheTest : public IncludeFileFinderTest {
+ public:
+  void SetUp() override {
+    IncludeFileFinderTest::SetUp();
+    ListDirCache::Init(4096);
+    IncludeResolutionCache::Init(1024);
+  }
+
+  void TearDown() override {
+    IncludeResolutionCache::Quit();
+    ListDirCache::Quit();
+  }
+
+  // Makes |path| old enough to be cached.
+  void SetOldMtime(const std::string& path) {
+    ASSERT_TRUE(UpdateMtime(tmpdir_util_->FullPath(path),
+                            absl::Now() - absl::Hours(1)));
+  }
+
+  IncludeResolutionCacheStats Stats() {
+    IncludeResolutionCacheStats stats;
+    IncludeResolutionCache::instance()->DumpStatsToProto(&stats);
+    return stats;
+  }
+
+  // Looks up |path| with a new IncludeFileFinder, as another compile task
+  // does.
+  bool Lookup(const std::string& path,
+              std::string* file_path,
+              int* dir_index) {
+    FileStatCache file_stat_cache;
+    IncludeFileFinder finder(tmpdir_util_->realcwd(), /*ignore_case=*/false,
+                             &include_dirs_, &framework_dirs_,
+                             &file_stat_cache);
+    return finder.Lookup(path, file_path, dir_index);
+  }
+
+ protected:
+  std::vector<std::string> include_dirs_;
+  std::vector<std::string> framework_dirs_;
+};
+
+TEST_F(IncludeResolutionCacheTest, SharedAmongFinders) {
+  CreateTmpDir(file::JoinPath("inc1", "foo"));
+  CreateTmpDir(file::JoinPath("inc2", "foo"));
+  CreateTmpFile(file::JoinPath("inc2", "foo", "bar.h"), "");
+  CreateTmpDir("inc3");
+  for (const auto& dir : {file::JoinPath("inc1", "foo"), std::string("inc1"),
+                          file::JoinPath("inc2", "foo"), std::string("inc2"),
+                          std::string("inc3")}) {
+    SetOldMtime(dir);
+  }
+  include_dirs_ = {tmpdir_util_->realcwd(), "inc3", "inc1", "inc2"};
+
+  std::string file_path;
+  int dir_index = CppParser::kIncludeDirIndexStarting;
+  ASSERT_TRUE(Lookup("foo/bar.h", &file_path, &dir_index));
+  EXPECT_EQ(file::JoinPath("inc2", "foo", "bar.h"), file_path);
+  EXPECT_EQ(3, dir_index);
+  EXPECT_EQ(1, Stats().total_entries());
+  EXPECT_EQ(0, Stats().hit());
+  EXPECT_EQ(1, Stats().missed());
+
+  file_path.clear();
+  dir_index = CppParser::kIncludeDirIndexStarting;
+  ASSERT_TRUE(Lookup("foo/bar.h", &file_path, &dir_index));
+  EXPECT_EQ(file::JoinPath("inc2", "foo", "bar.h"), file_path);
+  EXPECT_EQ(3, dir_index);
+  EXPECT_EQ(1, Stats().hit());
+
+  // Search from other index is cached separately.
+  dir_index = 3;
+  ASSERT_TRUE(Lookup("foo/bar.h", &file_path, &dir_index));
+  EXPECT_EQ(3, dir_index);
+  EXPECT_EQ(2, Stats().total_entries());
+  EXPECT_EQ(2, Stats().missed());
+
+  // Other include dirs doesn't share the cache.
+  include_dirs_ = {tmpdir_util_->realcwd(), "inc2"};
+  dir_index = CppParser::kIncludeDirIndexStarting;
+  ASSERT_TRUE(Lookup("foo/bar.h", &file_path, &dir_index));
+  EXPECT_EQ(1, dir_index);
+  EXPECT_EQ(3, Stats().missed());
+}
+
+TEST_F(IncludeResolutionCacheTest, InvalidatedByShadowingFile) {
+  CreateTmpDir(file::JoinPath("inc1", "foo"));
+  CreateTmpDir(file::JoinPath("inc2", "foo"));
+  CreateTmpFile(file::JoinPath("inc2", "foo", "bar.h"), "");
+  for (const auto& dir : {file::JoinPath("inc1", "foo"), std::string("inc1"),
+                          file::JoinPath("inc2", "foo"),
+                          std::string("inc2")}) {
+    SetOldMtime(dir);
+  }
+  include_dirs_ = {tmpdir_util_->realcwd(), "inc1", "inc2"};
+
+  std::string file_path;
+  int dir_index = CppParser::kIncludeDirIndexStarting;
+  ASSERT_TRUE(Lookup("foo/bar.h", &file_path, &dir_index));
+  EXPECT_EQ(file::JoinPath("inc2", "foo", "bar.h"), file_path);
+
+  // foo/bar.h in inc1 has priority.
+  CreateTmpFile(file::JoinPath("inc1", "foo", "bar.h"), "");
+  dir_index = CppParser::kIncludeDirIndexStarting;
+  ASSERT_TRUE(Lookup("foo/bar.h", &file_path, &dir_index));
+  EXPECT_EQ(file::JoinPath("inc1", "foo", "bar.h"), file_path);
+  EXPECT_EQ(1, dir_index);
+  EXPECT_EQ(0, Stats().hit());
+  EXPECT_EQ(1, Stats().invalidated());
+}
+
+TEST_F(IncludeResolutionCacheTest, InvalidatedByNewTopDirectory) {
+  CreateTmpDir("inc1");
+  CreateTmpDir(file::JoinPath("inc2", "foo"));
+  CreateTmpFile(file::JoinPath("inc2", "foo", "bar.h"), "");
+  for (const auto& dir : {std::string("inc1"), file::JoinPath("inc2", "foo"),
+                          std::string("inc2")}) {
+    SetOldMtime(dir);
+  }
+  include_dirs_ = {tmpdir_util_->realcwd(), "inc1", "inc2"};
+
+  std::string file_path;
+  int dir_index = CppParser::kIncludeDirIndexStarting;
+  ASSERT_TRUE(Lookup("foo/bar.h", &file_path, &dir_index));
+  EXPECT_EQ(2, dir_index);
+
+  // inc1 didn't have foo when it's cached.
+  CreateTmpFile(file::JoinPath("inc1", "foo", "bar.h"), "");
+  dir_index = CppParser::kIncludeDirIndexStarting;
+  ASSERT_TRUE(Lookup("foo/bar.h", &file_path, &dir_index));
+  EXPECT_EQ(file::JoinPath("inc1", "foo", "bar.h"), file_path);
+  EXPECT_EQ(1, dir_index);
+  EXPECT_EQ(1, Stats().invalidated());
+}
+
 }  // namespace devtools_goma
@@ -0,0 +1,174 @@
+// Copyright 2020 The Goma Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "include_prefetcher.h"
+
+#include <utility>
+
+#include "absl/container/flat_hash_map.h"
+#include "absl/strings/match.h"
+#include "callback.h"
+#include "counterz.h"
+#include "file_stat.h"
+#include "file_stat_cache.h"
+#include "glog/logging.h"
+#include "include_cache.h"
+#include "include_file_utils.h"
+#include "lockhelper.h"
+#include "worker_thread_manager.h"
+
+namespace devtools_goma {
+
+WorkerThreadManager* IncludePrefetcher::wm_ = nullptr;
+int IncludePrefetcher::pool_ = WorkerThreadManager::kFreePool;
+
+struct IncludePrefetcher::State {
+  enum class Status {
+    kQueued,
+    kRunning,
+    kDone,
+    kCanceled,
+  };
+
+  Lock mu;
+  ConditionVariable cond;
+  // Keyed by candidates of scheduled prefetch.
+  absl::flat_hash_map<std::string, Status> status ABSL_GUARDED_BY(mu);
+  int num_running ABSL_GUARDED_BY(mu) = 0;
+  // Set when the owner IncludePrefetcher is destructed.
+  bool canceled ABSL_GUARDED_BY(mu) = false;
+};
+
+/* static */
+void IncludePrefetcher::Init(WorkerThreadManager* wm, int num_threads) {
+  CHECK(wm_ == nullptr) << "IncludePrefetcher is already initialized";
+  if (num_threads <= 0) {
+    return;
+  }
+  pool_ = wm->StartPool(num_threads, "include_prefetcher");
+  wm_ = wm;
+  LOG(INFO) << "include_prefetcher_pool=" << pool_
+            << " num_thread=" << num_threads;
+}
+
+/* static */
+void IncludePrefetcher::Quit() {
+  wm_ = nullptr;
+  pool_ = WorkerThreadManager::kFreePool;
+}
+
+IncludePrefetcher::IncludePrefetcher() : state_(std::make_shared<State>()) {}
+
+IncludePrefetcher::~IncludePrefetcher() {
+  AUTOLOCK(lock, &state_->mu);
+  // Prefetch not started yet is canceled.
+  state_->canceled = true;
+  // Running prefetch uses IncludeCache, which must not be destructed
+  // while it is running.
+  while (state_->num_running > 0) {
+    state_->cond.Wait(&state_->mu);
+  }
+}
+
+void IncludePrefetcher::Prefetch(std::vector<std::string> abs_candidates) {
+  DCHECK(IsEnabled());
+  DCHECK(IncludeCache::IsEnabled());
+  {
+    AUTOLOCK(lock, &state_->mu);
+    bool inserted = false;
+    for (const auto& abs_filepath : abs_candidates) {
+      inserted |=
+          state_->status.emplace(abs_filepath, State::Status::kQueued).second;
+    }
+    if (!inserted) {
+      return;
+    }
+  }
+  ++num_scheduled_;
+  wm_->RunClosureInPool(
+      FROM_HERE, pool_,
+      NewCallback(&IncludePrefetcher::Run, state_, std::move(abs_candidates)),
+      WorkerThread::PRIORITY_LOW);
+}
+
+void IncludePrefetcher::Wait(const std::string& abs_filepath) {
+  AUTOLOCK(lock, &state_->mu);
+  auto found = state_->status.find(abs_filepath);
+  if (found == state_->status.end()) {
+    return;
+  }
+  switch (found->second) {
+    case State::Status::kQueued:
+      found->second = State::Status::kCanceled;
+      ++num_canceled_;
+      return;
+    case State::Status::kRunning:
+      ++num_waited_;
+      // Entries are only inserted by this thread, so |found| is still
+      // valid after Wait.
+      while (found->second == State::Status::kRunning) {
+        state_->cond.Wait(&state_->mu);
+      }
+      return;
+    case State::Status::kDone:
+    case State::Status::kCanceled:
+      return;
+  }
+}
+
+/* static */
+void IncludePrefetcher::Run(std::shared_ptr<State> state,
+                            std::vector<std::string> abs_candidates) {
+  GOMA_COUNTERZ("IncludePrefetcher::Run");
+  {
+    AUTOLOCK(lock, &state->mu);
+    if (state->canceled) {
+      return;
+    }
+    ++state->num_running;
+  }
+
+  // Same as include file lookup, the first file in candidates is used.
+  std::string abs_filepath;
+  FileStat file_stat;
+  for (auto& candidate : abs_candidates) {
+    file_stat = GlobalFileStatCache::Instance() != nullptr
+                    ? GlobalFileStatCache::Instance()->Get(candidate)
+                    : FileStat(candidate);
+    if (file_stat.IsValid() && !file_stat.is_directory) {
+      abs_filepath = std::move(candidate);
+      break;
+    }
+  }
+
+  bool run = false;
+  {
+    AUTOLOCK(lock, &state->mu);
+    // Precompiled headers are not parsed.
+    if (!abs_filepath.empty() &&
+        !absl::EndsWith(abs_filepath, GOMA_GCH_SUFFIX)) {
+      auto found = state->status.find(abs_filepath);
+      DCHECK(found != state->status.end()) << abs_filepath;
+      // The file might be loaded by the caller, or by another prefetch.
+      if (found->second == State::Status::kQueued) {
+        found->second = State::Status::kRunning;
+        run = true;
+      }
+    }
+    if (!run) {
+      --state->num_running;
+      state->cond.Broadcast();
+      return;
+    }
+  }
+
+  IncludeCache::instance()->GetIncludeItem(abs_filepath, file_stat);
+
+  AUTOLOCK(lock, &state->mu);
+  state->status.find(abs_filepath)->second = State::Status::kDone;
+  --state->num_running;
+  state->cond.Broadcast();
+}
+
+}  // namespace devtools_goma
@@ -0,0 +1,79 @@
+// Copyright 2020 The Goma Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#ifndef DEVTOOLS_GOMA_CLIENT_CXX_INCLUDE_PROCESSOR_INCLUDE_PREFETCHER_H_
+#define DEVTOOLS_GOMA_CLIENT_CXX_INCLUDE_PROCESSOR_INCLUDE_PREFETCHER_H_
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "basictypes.h"
+
+namespace devtools_goma {
+
+class WorkerThreadManager;
+
+// IncludePrefetcher reads and parses headers into IncludeCache on a
+// dedicated worker pool, ahead of the include processor thread that will
+// process them.
+//
+// An instance is used by one include processor for one translation unit.
+// Prefetch() and Wait() must be called on the same thread.
+// Prefetch only warms IncludeCache, so it never changes the result of
+// include processing; the include processor still evaluates all
+// directives by itself.
+class IncludePrefetcher {
+ public:
+  // Starts |num_threads| threads for prefetch in |wm|.
+  // Prefetch is disabled if |num_threads| <= 0.
+  static void Init(WorkerThreadManager* wm, int num_threads);
+  static void Quit();
+  static bool IsEnabled() { return wm_ != nullptr; }
+
+  IncludePrefetcher();
+  // Cancels prefetches not started yet, and waits for running ones.
+  ~IncludePrefetcher();
+
+  // Schedules to load the first file in |abs_candidates| into IncludeCache.
+  // The candidates are stat-ed in the prefetch task, so that the caller
+  // doesn't need to wait for include file lookup.
+  // Does nothing if all of |abs_candidates| have already been scheduled.
+  void Prefetch(std::vector<std::string> abs_candidates);
+
+  // Must be called before the caller loads |abs_filepath| from IncludeCache.
+  // If prefetch of |abs_filepath| is running, waits for it to finish, so
+  // that the caller doesn't parse the same file again. If it has not
+  // started yet, cancels it, and the caller should load it by itself.
+  void Wait(const std::string& abs_filepath);
+
+  int num_scheduled() const { return num_scheduled_; }
+  // The number of Wait() that needed to wait for running prefetch.
+  int num_waited() const { return num_waited_; }
+  // The number of Wait() that canceled prefetch not started yet.
+  int num_canceled() const { return num_canceled_; }
+
+ private:
+  struct State;
+
+  static void Run(std::shared_ptr<State> state,
+                  std::vector<std::string> abs_candidates);
+
+  static WorkerThreadManager* wm_;
+  static int pool_;
+
+  // Shared with scheduled closures, which may run after this instance is
+  // destructed.
+  std::shared_ptr<State> state_;
+
+  int num_scheduled_ = 0;
+  int num_waited_ = 0;
+  int num_canceled_ = 0;
+
+  DISALLOW_COPY_AND_ASSIGN(IncludePrefetcher);
+};
+
+}  // namespace devtools_goma
+
+#endif  // DEVTOOLS_GOMA_CLIENT_CXX_INCLUDE_PROCESSOR_INCLUDE_PREFETCHER_H_
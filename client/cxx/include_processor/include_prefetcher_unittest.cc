@@ -0,0 +1,137 @@
+// Copyright 2020 The Goma Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "include_prefetcher.h"
+
+#include <memory>
+#include <string>
+
+#include "absl/memory/memory.h"
+#include "absl/time/clock.h"
+#include "absl/time/time.h"
+#include "compiler_specific.h"
+#include "file_stat.h"
+#include "gtest/gtest.h"
+#include "include_cache.h"
+#include "unittest_util.h"
+#include "worker_thread_manager.h"
+
+MSVC_PUSH_DISABLE_WARNING_FOR_PROTO()
+#include "lib/goma_stats.pb.h"
+MSVC_POP_WARNING()
+
+namespace devtools_goma {
+
+class IncludePrefetcherTest : public testing::Test {
+ protected:
+  void SetUp() override {
+    tmpdir_ = absl::make_unique<TmpdirUtil>("include_prefetcher_test");
+    IncludeCache::Init(16, false);
+    wm_ = absl::make_unique<WorkerThreadManager>();
+    wm_->Start(1);
+    IncludePrefetcher::Init(wm_.get(), 1);
+  }
+
+  void TearDown() override {
+    IncludePrefetcher::Quit();
+    wm_->Finish();
+    wm_.reset();
+    IncludeCache::Quit();
+  }
+
+  std::string CreateHeader(const std::string& name,
+                           const std::string& content) {
+    tmpdir_->CreateTmpFile(name, content);
+    return tmpdir_->FullPath(name);
+  }
+
+  static IncludeCacheStats Stats() {
+    IncludeCacheStats stats;
+    IncludeCache::instance()->DumpStatsToProto(&stats);
+    return stats;
+  }
+
+  static bool WaitForMissed(int64_t missed) {
+    const absl::Time deadline = absl::Now() + absl::Seconds(10);
+    while (Stats().missed() < missed) {
+      if (absl::Now() > deadline) {
+        return false;
+      }
+      absl::SleepFor(absl::Milliseconds(1));
+    }
+    return true;
+  }
+
+  std::unique_ptr<TmpdirUtil> tmpdir_;
+  std::unique_ptr<WorkerThreadManager> wm_;
+};
+
+TEST_F(IncludePrefetcherTest, PrefetchLoadsIncludeCache) {
+  ASSERT_TRUE(IncludePrefetcher::IsEnabled());
+  const std::string ah = CreateHeader("a.h", "#include <b.h>\n");
+  const FileStat file_stat(ah);
+
+  IncludePrefetcher prefetcher;
+  prefetcher.Prefetch({ah});
+  // Already scheduled.
+  prefetcher.Prefetch({ah});
+  EXPECT_EQ(1, prefetcher.num_scheduled());
+
+  ASSERT_TRUE(WaitForMissed(1));
+  prefetcher.Wait(ah);
+  EXPECT_EQ(0, prefetcher.num_canceled());
+
+  IncludeItem item = IncludeCache::instance()->GetIncludeItem(ah, file_stat);
+  ASSERT_TRUE(item.IsValid());
+  EXPECT_EQ(1U, item.directives()->size());
+  EXPECT_EQ(1, Stats().missed());
+  EXPECT_EQ(1, Stats().hit());
+}
+
+TEST_F(IncludePrefetcherTest, PrefetchFirstFoundCandidate) {
+  const std::string ah = tmpdir_->FullPath("a.h");
+  const std::string bh = CreateHeader("b.h", "#define B\n");
+  const std::string ch = CreateHeader("c.h", "#define C\n");
+
+  IncludePrefetcher prefetcher;
+  prefetcher.Prefetch({ah, bh, ch});
+  EXPECT_EQ(1, prefetcher.num_scheduled());
+
+  ASSERT_TRUE(WaitForMissed(1));
+  prefetcher.Wait(bh);
+  EXPECT_TRUE(
+      IncludeCache::instance()->GetIncludeItem(bh, FileStat(bh)).IsValid());
+  EXPECT_EQ(1, Stats().missed());
+  EXPECT_EQ(1, Stats().hit());
+}
+
+TEST_F(IncludePrefetcherTest, WaitWithoutPrefetch) {
+  const std::string ah = CreateHeader("a.h", "");
+
+  IncludePrefetcher prefetcher;
+  prefetcher.Wait(ah);
+  EXPECT_EQ(0, prefetcher.num_scheduled());
+  EXPECT_EQ(0, prefetcher.num_waited());
+  EXPECT_EQ(0, prefetcher.num_canceled());
+}
+
+TEST_F(IncludePrefetcherTest, WaitAfterEachPrefetch) {
+  IncludePrefetcher prefetcher;
+  for (int i = 0; i < 10; ++i) {
+    const std::string name = "h" + std::to_string(i) + ".h";
+    const std::string path = CreateHeader(name, "#define X\n");
+    const FileStat file_stat(path);
+    prefetcher.Prefetch({path});
+    // Either waits for prefetch or cancels it, and the item is loaded
+    // only once in both cases.
+    prefetcher.Wait(path);
+    EXPECT_TRUE(
+        IncludeCache::instance()->GetIncludeItem(path, file_stat).IsValid());
+  }
+  EXPECT_EQ(10, prefetcher.num_scheduled());
+  EXPECT_EQ(10, Stats().missed());
+  EXPECT_EQ(10 - prefetcher.num_canceled(), Stats().hit());
+}
+
+}  // namespace devtools_goma
@@ -0,0 +1,109 @@
+// Copyright 2020 The Goma Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "include_resolution_cache.h"
+
+#include "absl/strings/str_cat.h"
+#include "autolock_timer.h"
+#include "compiler_specific.h"
+#include "counterz.h"
+#include "file_stat_cache.h"
+#include "glog/logging.h"
+
+MSVC_PUSH_DISABLE_WARNING_FOR_PROTO()
+#include "lib/goma_stats.pb.h"
+MSVC_POP_WARNING()
+
+namespace devtools_goma {
+
+IncludeResolutionCache* IncludeResolutionCache::instance_;
+
+/* static */
+void IncludeResolutionCache::Init(size_t max_entries) {
+  CHECK(instance_ == nullptr);
+  if (max_entries == 0) {
+    return;
+  }
+  instance_ = new IncludeResolutionCache(max_entries);
+}
+
+/* static */
+void IncludeResolutionCache::Quit() {
+  delete instance_;
+  instance_ = nullptr;
+}
+
+/* static */
+std::string IncludeResolutionCache::MakeKey(
+    const std::string& search_key,
+    int include_dir_index,
+    const std::string& path_in_directive) {
+  return absl::StrCat(search_key, ":", include_dir_index, ":",
+                      path_in_directive);
+}
+
+bool IncludeResolutionCache::Lookup(const std::string& key,
+                                    FileStatCache* file_stat_cache,
+                                    std::string* filepath,
+                                    int* include_dir_index) {
+  GOMA_COUNTERZ("Lookup");
+
+  std::shared_ptr<const Entry> entry;
+  {
+    AUTO_SHARED_LOCK(lock, &rwlock_);
+    auto it = entries_.find(key);
+    if (it != entries_.end()) {
+      entry = it->second;
+    }
+  }
+  if (!entry) {
+    missed_.Add(1);
+    return false;
+  }
+
+  // Dependencies are mostly include directories shared by lookups,
+  // so FileStat of them would be in |file_stat_cache|.
+  for (const auto& dep : entry->dependencies) {
+    if (file_stat_cache->Get(dep.abs_path) != dep.file_stat) {
+      VLOG(2) << "include resolution invalidated: " << key
+              << " modified=" << dep.abs_path;
+      invalidated_.Add(1);
+      return false;
+    }
+  }
+
+  hit_.Add(1);
+  *filepath = entry->filepath;
+  *include_dir_index = entry->include_dir_index;
+  return true;
+}
+
+bool IncludeResolutionCache::Insert(const std::string& key, Entry entry) {
+  for (const auto& dep : entry.dependencies) {
+    if (dep.file_stat.IsValid() && dep.file_stat.CanBeStale()) {
+      return false;
+    }
+  }
+
+  auto shared_entry = std::make_shared<const Entry>(std::move(entry));
+  AUTO_EXCLUSIVE_LOCK(lock, &rwlock_);
+  entries_.emplace_back(key, std::move(shared_entry));
+  while (entries_.size() > max_entries_) {
+    entries_.pop_front();
+  }
+  return true;
+}
+
+void IncludeResolutionCache::DumpStatsToProto(
+    IncludeResolutionCacheStats* stats) {
+  {
+    AUTO_SHARED_LOCK(lock, &rwlock_);
+    stats->set_total_entries(entries_.size());
+  }
+  stats->set_hit(hit_.value());
+  stats->set_missed(missed_.value());
+  stats->set_invalidated(invalidated_.value());
+}
+
+}  // namespace devtools_goma
@@ -0,0 +1,100 @@
+// Copyright 2020 The Goma Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#ifndef DEVTOOLS_GOMA_CLIENT_CXX_INCLUDE_PROCESSOR_INCLUDE_RESOLUTION_CACHE_H_
+#define DEVTOOLS_GOMA_CLIENT_CXX_INCLUDE_PROCESSOR_INCLUDE_RESOLUTION_CACHE_H_
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "absl/base/thread_annotations.h"
+#include "atomic_stats_counter.h"
+#include "basictypes.h"
+#include "file_stat.h"
+#include "linked_unordered_map.h"
+#include "lockhelper.h"
+
+namespace devtools_goma {
+
+class FileStatCache;
+class IncludeResolutionCacheStats;
+
+// IncludeResolutionCache memoizes the result of IncludeFileFinder::Lookup
+// across translation units that use the same include directories.
+//
+// Each entry records FileStat of the files and directories that the
+// lookup looked into (the found file, and the directories where the path
+// was searched). An entry is used only if all of them still have the same
+// FileStat, i.e. no file was added to or removed from those directories.
+//
+// This class is thread-safe.
+class IncludeResolutionCache {
+ public:
+  // A file or directory the lookup result depends on.
+  struct Dependency {
+    Dependency(std::string abs_path, FileStat file_stat)
+        : abs_path(std::move(abs_path)), file_stat(std::move(file_stat)) {}
+
+    std::string abs_path;
+    FileStat file_stat;
+  };
+
+  struct Entry {
+    std::string filepath;
+    int include_dir_index = 0;
+    std::vector<Dependency> dependencies;
+  };
+
+  static IncludeResolutionCache* instance() { return instance_; }
+  static bool IsEnabled() { return instance_ != nullptr; }
+
+  // Initializes IncludeResolutionCache. Does nothing if |max_entries| is 0.
+  static void Init(size_t max_entries);
+  static void Quit();
+
+  // Returns the cache key for |path_in_directive| searched from
+  // |include_dir_index|. |search_key| identifies the include directories
+  // (and other settings) used for the lookup.
+  static std::string MakeKey(const std::string& search_key,
+                             int include_dir_index,
+                             const std::string& path_in_directive);
+
+  // Returns true and sets |filepath| and |include_dir_index| if |key| is
+  // cached and none of its dependencies were modified.
+  // |file_stat_cache| is used to get the current FileStat of dependencies.
+  bool Lookup(const std::string& key,
+              FileStatCache* file_stat_cache,
+              std::string* filepath,
+              int* include_dir_index);
+
+  // Caches |entry| for |key|.
+  // Returns false if |entry| is not cached because one of its dependencies
+  // can be modified in the same mtime granularity.
+  bool Insert(const std::string& key, Entry entry);
+
+  void DumpStatsToProto(IncludeResolutionCacheStats* stats);
+
+ private:
+  explicit IncludeResolutionCache(size_t max_entries)
+      : max_entries_(max_entries) {}
+
+  static IncludeResolutionCache* instance_;
+
+  const size_t max_entries_;
+
+  StatsCounter hit_;
+  StatsCounter missed_;
+  StatsCounter invalidated_;
+
+  ReadWriteLock rwlock_;
+  LinkedUnorderedMap<std::string, std::shared_ptr<const Entry>> entries_
+      ABSL_GUARDED_BY(rwlock_);
+
+  DISALLOW_COPY_AND_ASSIGN(IncludeResolutionCache);
+};
+
+}  // namespace devtools_goma
+
+#endif  // DEVTOOLS_GOMA_CLIENT_CXX_INCLUDE_PROCESSOR_INCLUDE_RESOLUTION_CACHE_H_
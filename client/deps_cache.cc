@@ -42,6 +42,10 @@ MSVC_POP_WARNING()
 
 namespace {
 
+// last_used_time of an entry is updated if it is older than this, so that
+// cache hits don't make the flat file rewritten every time.
+constexpr absl::Duration kUpdateLastUsedTimeDuration = absl::Hours(1);
+
 template<typename Flags>
 void AppendCompilerFlagsInfo(const Flags& flags, std::stringstream* ss) {
   (*ss) << ":include_dirs=";
@@ -67,11 +71,13 @@ DepsCache* DepsCache::instance_;
 DepsCache::DepsCache(const std::string& cache_filename,
                      absl::optional<absl::Duration> identifier_alive_duration,
                      int deps_table_size_threshold,
-                     int max_proto_size_in_mega_bytes)
+                     int max_proto_size_in_mega_bytes,
+                     FileFormat file_format)
     : cache_file_(cache_filename),
       identifier_alive_duration_(identifier_alive_duration),
       deps_table_size_threshold_(deps_table_size_threshold),
       max_proto_size_in_mega_bytes_(max_proto_size_in_mega_bytes),
+      file_format_(file_format),
       hit_count_(0),
       missed_count_(0),
       missed_by_updated_count_(0) {}
@@ -82,7 +88,8 @@ DepsCache::~DepsCache() {}
 void DepsCache::Init(const std::string& cache_filename,
                      absl::optional<absl::Duration> identifier_alive_duration,
                      int deps_table_size_threshold,
-                     int max_proto_size_in_mega_bytes) {
+                     int max_proto_size_in_mega_bytes,
+                     FileFormat file_format) {
   if (cache_filename.empty()) {
     LOG(INFO) << "DepsCache is disabled.";
     return;
@@ -99,10 +106,11 @@ void DepsCache::Init(const std::string& cache_filename,
     return;
   }
 
-  LOG(INFO) << "DepsCache is enabled. cache_filename=" << cache_filename;
+  LOG(INFO) << "DepsCache is enabled. cache_filename=" << cache_filename
+            << " flat=" << (file_format == FileFormat::kFlat);
   instance_ = new DepsCache(cache_filename, identifier_alive_duration,
                             deps_table_size_threshold,
-                            max_proto_size_in_mega_bytes);
+                            max_proto_size_in_mega_bytes, file_format);
 }
 
 // static
@@ -110,7 +118,10 @@ void DepsCache::LoadIfEnabled() {
   if (!instance_) {
     return;
   }
-  if (!instance_->LoadGomaDeps()) {
+  const bool loaded = instance_->file_format_ == FileFormat::kFlat
+                          ? instance_->LoadFlatGomaDeps()
+                          : instance_->LoadGomaDeps();
+  if (!loaded) {
     // If deps cache is broken (or does not exist), clear all cache.
     LOG(INFO) << "couldn't load deps cache file. "
               << "The cache file is broken or too large";
@@ -122,7 +133,11 @@ void DepsCache::Quit() {
   if (!IsEnabled())
     return;
 
-  instance_->SaveGomaDeps();
+  if (instance_->file_format_ == FileFormat::kFlat) {
+    instance_->SaveFlatGomaDeps();
+  } else {
+    instance_->SaveGomaDeps();
+  }
   delete instance_;
   instance_ = nullptr;
 }
@@ -131,6 +146,8 @@ void DepsCache::Clear() {
   {
     AUTO_EXCLUSIVE_LOCK(lock, &mu_);
     deps_table_.clear();
+    removed_flat_keys_.clear();
+    flat_file_.reset();
   }
 
   filename_id_table_.Clear();
@@ -210,13 +227,14 @@ bool DepsCache::SetDependencies(const DepsCache::Identifier& identifier,
 
   AUTO_EXCLUSIVE_LOCK(lock, &mu_);
   if (!all_ok) {
-    deps_table_.erase(identifier.value());
+    EraseUnlocked(identifier.value());
     return false;
   }
 
   auto& deps = deps_table_[identifier.value()];
   deps.last_used_time = absl::ToTimeT(absl::Now());
   deps.deps_hash_ids = std::move(deps_hash_ids);
+  flat_file_dirty_ = true;
 
   return true;
 }
@@ -230,15 +248,26 @@ bool DepsCache::GetDependencies(const DepsCache::Identifier& identifier,
   DCHECK(file::IsAbsolutePath(cwd)) << cwd;
 
   std::vector<DepsHashId> deps_hash_ids;
-  {
+  auto find_deps_hash_ids = [this, &identifier, &deps_hash_ids]() {
     AUTO_SHARED_LOCK(lock, &mu_);
     auto it = deps_table_.find(identifier.value());
     if (it == deps_table_.end()) {
-      IncrMissedCount();
       return false;
     }
-    it->second.last_used_time = absl::ToTimeT(absl::Now());
+    const absl::Time now = absl::Now();
+    if (now - absl::FromTimeT(it->second.last_used_time) >
+        kUpdateLastUsedTimeDuration) {
+      it->second.last_used_time = absl::ToTimeT(now);
+      flat_file_used_time_updated_ = true;
+    }
     deps_hash_ids = it->second.deps_hash_ids;
+    return true;
+  };
+  if (!find_deps_hash_ids()) {
+    if (!LoadFromFlatFile(identifier.value()) || !find_deps_hash_ids()) {
+      IncrMissedCount();
+      return false;
+    }
   }
 
   std::set<std::string> result;
@@ -276,7 +305,61 @@ void DepsCache::RemoveDependency(const DepsCache::Identifier& identifier) {
   DCHECK(identifier.has_value());
 
   AUTO_EXCLUSIVE_LOCK(lock, &mu_);
-  deps_table_.erase(identifier.value());
+  EraseUnlocked(identifier.value());
+}
+
+void DepsCache::EraseUnlocked(const Key& key) {
+  deps_table_.erase(key);
+  if (flat_file_ != nullptr) {
+    removed_flat_keys_.insert(key);
+  }
+  flat_file_dirty_ = true;
+}
+
+bool DepsCache::LoadFromFlatFile(const Key& key) {
+  time_t last_used_time = 0;
+  std::vector<DepsHashId> deps_hash_ids;
+  {
+    // |deps| refer to |flat_file_|, which may be reset by Clear() unless
+    // |mu_| is held.
+    AUTO_SHARED_LOCK(lock, &mu_);
+    if (flat_file_ == nullptr || removed_flat_keys_.contains(key)) {
+      return false;
+    }
+    std::vector<FlatDepsCacheFile::Dep> deps;
+    if (!flat_file_->Find(key, &last_used_time, &deps)) {
+      return false;
+    }
+    if (identifier_alive_duration_.has_value() &&
+        absl::FromTimeT(last_used_time) <
+            absl::Now() - *identifier_alive_duration_) {
+      return false;
+    }
+
+    deps_hash_ids.reserve(deps.size());
+    for (const auto& dep : deps) {
+      FilenameIdTable::Id id =
+          filename_id_table_.InsertFilename(std::string(dep.filename));
+      if (id == FilenameIdTable::kInvalidId) {
+        return false;
+      }
+      deps_hash_ids.emplace_back(
+          id, file_stat_id_table_.GetId(dep.file_stat),
+          directive_hash_id_table_.GetId(dep.directive_hash));
+    }
+  }
+
+  AUTO_EXCLUSIVE_LOCK(lock, &mu_);
+  if (removed_flat_keys_.contains(key)) {
+    return false;
+  }
+  // Another thread might have loaded or set the entry.
+  auto p = deps_table_.try_emplace(key);
+  if (p.second) {
+    p.first->second.last_used_time = last_used_time;
+    p.first->second.deps_hash_ids = std::move(deps_hash_ids);
+  }
+  return true;
 }
 
 void DepsCache::IncrMissedCount() {
@@ -640,6 +723,207 @@ bool DepsCache::SaveGomaDeps() {
   return true;
 }
 
+bool DepsCache::LoadFlatGomaDeps() {
+  std::unique_ptr<FlatDepsCacheFile> flat_file =
+      FlatDepsCacheFile::Open(cache_file_.filename());
+  if (flat_file == nullptr) {
+    LOG(ERROR) << "failed to load cache file " << cache_file_.filename();
+    Clear();
+    SetLoaded();
+    return false;
+  }
+
+  // Version mismatch. Older deps won't be reused.
+  if (flat_file->built_revision() != kBuiltRevisionString) {
+    LOG(INFO) << "Old deps cache was detected. This deps cache is ignored. "
+              << "Current version should be " << kBuiltRevisionString
+              << " but deps cache version is " << flat_file->built_revision();
+    Clear();
+    SetLoaded();
+    return false;
+  }
+
+  // Entries are not loaded here. They are loaded in GetDependencies() when
+  // they are used.
+  const size_t num_identifiers = flat_file->num_identifiers();
+  {
+    AUTO_EXCLUSIVE_LOCK(lock, &mu_);
+    flat_file_ = std::move(flat_file);
+  }
+  SetLoaded();
+  LOG(INFO) << cache_file_.filename() << " has been successfully loaded."
+            << " identifiers=" << num_identifiers;
+  return true;
+}
+
+bool DepsCache::SaveFlatGomaDeps() {
+  AUTO_SHARED_LOCK(lock, &mu_);
+
+  // The flat file needs to be rewritten only if entries were added or
+  // removed. If only last used times of entries loaded from the file were
+  // updated, they are patched in place.
+  // Expired entries are kept in the file until it is rewritten, but they
+  // are ignored when loaded.
+  if (flat_file_ != nullptr && !flat_file_dirty_) {
+    if (!flat_file_used_time_updated_) {
+      LOG(INFO) << "deps cache is not modified. skip saving "
+                << cache_file_.filename();
+      return true;
+    }
+    // All entries in |deps_table_| were loaded from |flat_file_|.
+    std::vector<std::pair<Key, time_t>> used_entries;
+    used_entries.reserve(deps_table_.size());
+    for (const auto& entry : deps_table_) {
+      used_entries.emplace_back(entry.first, entry.second.last_used_time);
+    }
+    if (flat_file_->UpdateLastUsedTimes(cache_file_.filename(),
+                                        used_entries)) {
+      return true;
+    }
+    LOG(WARNING) << "failed to update last used time. rewrite "
+                 << cache_file_.filename();
+  }
+
+  absl::optional<absl::Time> time_threshold;
+  if (identifier_alive_duration_.has_value()) {
+    time_threshold = absl::Now() - *identifier_alive_duration_;
+  }
+  auto is_alive = [&time_threshold](time_t last_used_time) {
+    return !time_threshold.has_value() ||
+           absl::FromTimeT(last_used_time) >= *time_threshold;
+  };
+
+  // Entries to save. Entries in |deps_table_| are used in this run.
+  // Other entries are kept in |flat_file_|, and are copied from the file
+  // without being loaded into |deps_table_|.
+  struct SaveEntry {
+    time_t last_used_time;
+    Key key;
+    // Index in |flat_file_| if the entry is not in |deps_table_|.
+    absl::optional<size_t> flat_index;
+  };
+  std::vector<SaveEntry> entries;
+  entries.reserve(deps_table_.size() +
+                  (flat_file_ ? flat_file_->num_identifiers() : 0));
+  for (const auto& entry : deps_table_) {
+    if (is_alive(entry.second.last_used_time)) {
+      entries.push_back(
+          SaveEntry{entry.second.last_used_time, entry.first, absl::nullopt});
+    }
+  }
+  if (flat_file_ != nullptr) {
+    for (size_t i = 0; i < flat_file_->num_identifiers(); ++i) {
+      SaveEntry entry;
+      if (!flat_file_->GetIdentifierAt(i, &entry.key, &entry.last_used_time)) {
+        continue;
+      }
+      if (deps_table_.contains(entry.key) ||
+          removed_flat_keys_.contains(entry.key) ||
+          !is_alive(entry.last_used_time)) {
+        continue;
+      }
+      entry.flat_index = i;
+      entries.push_back(std::move(entry));
+    }
+  }
+
+  // Checks the size of DepsTable. If it exceeds threshold, we'd like to remove
+  // older identifiers.
+  if (deps_table_size_threshold_ >= 0 &&
+      entries.size() > deps_table_size_threshold_) {
+    LOG(INFO) << "DepsTable size " << entries.size()
+              << " exceeds the threshold " << deps_table_size_threshold_
+              << ". Older cache will be deleted";
+    std::nth_element(entries.begin(),
+                     entries.begin() + deps_table_size_threshold_,
+                     entries.end(),
+                     [](const SaveEntry& lhs, const SaveEntry& rhs) {
+                       return lhs.last_used_time > rhs.last_used_time;
+                     });
+    entries.resize(deps_table_size_threshold_);
+  }
+
+  // Gets deps of |entry|. |filenames| holds filenames that |deps| refer to.
+  auto get_deps = [this](const SaveEntry& entry,
+                         std::vector<std::string>* filenames,
+                         std::vector<FlatDepsCacheFile::Dep>* deps)
+      ABSL_NO_THREAD_SAFETY_ANALYSIS {
+    deps->clear();
+    if (entry.flat_index.has_value()) {
+      return flat_file_->GetDepsAt(*entry.flat_index, deps);
+    }
+    const auto& deps_hash_ids = deps_table_.at(entry.key).deps_hash_ids;
+    filenames->clear();
+    filenames->reserve(deps_hash_ids.size());
+    for (const auto& deps_hash_id : deps_hash_ids) {
+      filenames->push_back(filename_id_table_.ToFilename(deps_hash_id.id));
+      if (filenames->back().empty()) {
+        return false;
+      }
+    }
+    deps->reserve(deps_hash_ids.size());
+    for (size_t i = 0; i < deps_hash_ids.size(); ++i) {
+      deps->emplace_back(
+          (*filenames)[i],
+          file_stat_id_table_.GetValue(deps_hash_ids[i].file_stat_id),
+          directive_hash_id_table_.GetValue(
+              deps_hash_ids[i].directive_hash_id));
+    }
+    return true;
+  };
+
+  std::vector<std::string> filenames;
+  std::vector<FlatDepsCacheFile::Dep> deps;
+
+  // We create a map: filename -> pair<FileStat, directive hash>.
+  // When we saw multiple deps for one filename, we choose the one whose mtime
+  // is the latest.
+  absl::flat_hash_map<std::string, std::pair<FileStat, SHA256HashValue>>
+      latest;
+  for (const auto& entry : entries) {
+    if (!get_deps(entry, &filenames, &deps)) {
+      continue;
+    }
+    for (const auto& dep : deps) {
+      auto p = latest.try_emplace(std::string(dep.filename), dep.file_stat,
+                                  dep.directive_hash);
+      if (!p.second && p.first->second.first.mtime < dep.file_stat.mtime) {
+        p.first->second = std::make_pair(dep.file_stat, dep.directive_hash);
+      }
+    }
+  }
+
+  // We remove entries whose directive_hash is not the latest one, because
+  // it's old. In that case, we need to recalculate deps cache at all next
+  // time, so it's no worth to save them.
+  FlatDepsCacheFile::Writer writer(kBuiltRevisionString);
+  for (const auto& entry : entries) {
+    if (!get_deps(entry, &filenames, &deps)) {
+      continue;
+    }
+    bool ok = true;
+    for (const auto& dep : deps) {
+      auto it = latest.find(dep.filename);
+      if (it == latest.end() || it->second.second != dep.directive_hash) {
+        ok = false;
+        break;
+      }
+    }
+    if (!ok) {
+      continue;
+    }
+    writer.AddEntry(entry.key, entry.last_used_time, deps);
+  }
+
+  if (!writer.WriteToFile(cache_file_.filename())) {
+    LOG(ERROR) << "failed to save cache file " << cache_file_.filename();
+    return false;
+  }
+  LOG(INFO) << "saved to " << cache_file_.filename()
+            << " identifiers=" << writer.num_entries();
+  return true;
+}
+
 // static
 DepsCache::Identifier DepsCache::MakeDepsIdentifier(
     const CompilerInfo& compiler_info,
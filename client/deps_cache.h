@@ -7,17 +7,20 @@
 #define DEVTOOLS_GOMA_CLIENT_DEPS_CACHE_H_
 
 #include <atomic>
+#include <memory>
 #include <set>
 #include <sstream>
 #include <string>
 #include <unordered_map>
 #include <utility>
 
+#include "absl/container/flat_hash_set.h"
 #include "absl/container/node_hash_map.h"
 #include "absl/time/time.h"
 #include "absl/types/optional.h"
 #include "autolock_timer.h"
 #include "cache_file.h"
+#include "deps_cache_file.h"
 #include "file_stat_cache.h"
 #include "filename_id_table.h"
 #include "goma_hash.h"
@@ -44,6 +47,14 @@ class DepsCache {
  public:
   using Identifier = absl::optional<SHA256HashValue>;
 
+  enum class FileFormat {
+    // Serialized GomaDeps protobuf. Whole file is parsed in loading.
+    kProto,
+    // FlatDepsCacheFile. The file is mmapped and entries are loaded on
+    // demand.
+    kFlat,
+  };
+
   static DepsCache* instance() { return instance_; }
   static bool IsEnabled() {
     if (instance_ == nullptr) {
@@ -55,10 +66,12 @@ class DepsCache {
   // Initializes the DepsCache.
   // When |cache_filename| is empty, this won't be enabled.
   // When |cache_filename| file exists, call LoadIfEnabled to load cache file.
+  // |max_proto_size_in_mega_bytes| is only used for FileFormat::kProto.
   static void Init(const std::string& cache_filename,
                    absl::optional<absl::Duration> identifier_alive_duration,
                    int deps_table_size_threshold,
-                   int max_proto_size_in_mega_bytes);
+                   int max_proto_size_in_mega_bytes,
+                   FileFormat file_format);
   // Load cached data from cache_filename,
   // when cache_filename is not empty.
   // Do nothing if cache_filename is empty.
@@ -145,7 +158,8 @@ class DepsCache {
   DepsCache(const std::string& cache_filename,
             absl::optional<absl::Duration> identifier_alive_duration,
             int deps_table_size_threshold,
-            int max_proto_size_in_mega_bytes);
+            int max_proto_size_in_mega_bytes,
+            FileFormat file_format);
   ~DepsCache();
 
   void Clear();
@@ -153,6 +167,17 @@ class DepsCache {
   bool SaveGomaDeps();
   bool LoadGomaDeps();
 
+  bool SaveFlatGomaDeps();
+  bool LoadFlatGomaDeps();
+
+  // Looks up |key| in |flat_file_|, and loads the entry into |deps_table_|.
+  // Returns true if it is loaded.
+  bool LoadFromFlatFile(const Key& key) ABSL_LOCKS_EXCLUDED(mu_);
+
+  // Removes |key| from |deps_table_|, and makes sure the entry in
+  // |flat_file_| won't be used.
+  void EraseUnlocked(const Key& key) ABSL_EXCLUSIVE_LOCKS_REQUIRED(mu_);
+
   void IncrMissedCount();
   void IncrMissedByUpdatedCount();
   void IncrHitCount();
@@ -196,10 +221,25 @@ class DepsCache {
   // If the proto for cache exceeds this size, loading will fail.
   // In that case, cache is just ignored.
   const int max_proto_size_in_mega_bytes_;
+  const FileFormat file_format_;
 
   mutable ReadWriteLock mu_;
   DepsTable deps_table_ ABSL_GUARDED_BY(mu_);
 
+  // Loaded cache file for FileFormat::kFlat. Entries are copied to
+  // |deps_table_| when they are used, and entries in |deps_table_| take
+  // precedence over entries in |flat_file_|.
+  std::unique_ptr<FlatDepsCacheFile> flat_file_ ABSL_GUARDED_BY(mu_);
+  // Keys in |flat_file_| that were removed, and must not be used.
+  absl::flat_hash_set<Key> removed_flat_keys_ ABSL_GUARDED_BY(mu_);
+  // True if any entry was added, removed or modified since loaded. If false,
+  // we don't need to rewrite the flat file.
+  std::atomic<bool> flat_file_dirty_{false};
+  // True if last_used_time of any entry was updated by GetDependencies.
+  // If |flat_file_dirty_| is false, they are updated in the flat file in
+  // place.
+  std::atomic<bool> flat_file_used_time_updated_{false};
+
   mutable Lock loaded_mu_;
   bool loaded_ ABSL_GUARDED_BY(loaded_mu_);
 
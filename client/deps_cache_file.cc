@@ -0,0 +1,524 @@
+// Copyright 2020 The Goma Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "deps_cache_file.h"
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdio>
+#include <cstring>
+#include <utility>
+
+#include "absl/memory/memory.h"
+#include "absl/time/time.h"
+#include "file_helper.h"
+#include "glog/logging.h"
+#include "scoped_fd.h"
+
+namespace devtools_goma {
+
+namespace {
+
+constexpr char kMagic[8] = {'G', 'O', 'M', 'A', 'D', 'E', 'P', 'S'};
+constexpr uint32_t kVersion = 1;
+constexpr size_t kAlignment = 8;
+
+size_t AlignUp(size_t n) {
+  return (n + kAlignment - 1) & ~(kAlignment - 1);
+}
+
+}  // anonymous namespace
+
+struct FlatDepsCacheFile::Header {
+  char magic[8];
+  uint32_t version;
+  uint32_t num_filenames;
+  uint64_t file_size;
+  uint64_t built_revision_offset;
+  uint32_t built_revision_size;
+  uint32_t num_file_stats;
+  // uint32_t[num_filenames + 1]; offsets in filename blob.
+  uint64_t filename_offsets_offset;
+  uint64_t filename_blob_offset;
+  uint64_t filename_blob_size;
+  uint64_t file_stats_offset;
+  uint64_t directive_hashes_offset;
+  uint32_t num_directive_hashes;
+  uint32_t num_identifiers;
+  uint64_t identifiers_offset;
+  uint64_t deps_offset;
+  uint32_t num_deps;
+  uint32_t reserved;
+};
+
+struct FlatDepsCacheFile::FlatFileStat {
+  int64_t mtime_ns;
+  int64_t size;
+};
+
+struct FlatDepsCacheFile::FlatIdentifier {
+  SHA256HashValue identifier;
+  int64_t last_used_time;
+  uint32_t deps_begin;
+  uint32_t num_deps;
+};
+
+struct FlatDepsCacheFile::FlatDep {
+  uint32_t filename_index;
+  uint32_t file_stat_index;
+  uint32_t directive_hash_index;
+};
+
+static_assert(sizeof(SHA256HashValue) == 32,
+              "SHA256HashValue must be stored as is in flat file");
+
+// MappedFile holds the content of the file.
+// On POSIX, the file is mmapped. On Windows, it is read into memory.
+class FlatDepsCacheFile::MappedFile {
+ public:
+  ~MappedFile() {
+#ifndef _WIN32
+    if (data_ != nullptr) {
+      munmap(const_cast<char*>(data_), size_);
+    }
+#endif
+  }
+
+  static std::unique_ptr<MappedFile> Open(const std::string& filename) {
+    std::unique_ptr<MappedFile> mapped(new MappedFile);
+#ifndef _WIN32
+    ScopedFd fd(ScopedFd::OpenForRead(filename));
+    if (!fd.valid()) {
+      return nullptr;
+    }
+    size_t size = 0;
+    if (!fd.GetFileSize(&size) || size == 0) {
+      return nullptr;
+    }
+    void* data = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd.fd(), 0);
+    if (data == MAP_FAILED) {
+      PLOG(ERROR) << "mmap failed: " << filename;
+      return nullptr;
+    }
+    mapped->data_ = static_cast<const char*>(data);
+    mapped->size_ = size;
+#else
+    if (!ReadFileToString(filename, &mapped->content_)) {
+      return nullptr;
+    }
+    mapped->data_ = mapped->content_.data();
+    mapped->size_ = mapped->content_.size();
+#endif
+    return mapped;
+  }
+
+  const char* data() const { return data_; }
+  size_t size() const { return size_; }
+
+  // Returns true if [offset, offset + size) is in the file.
+  bool Contains(uint64_t offset, uint64_t size) const {
+    return offset <= size_ && size <= size_ - offset;
+  }
+
+ private:
+  MappedFile() = default;
+
+  const char* data_ = nullptr;
+  size_t size_ = 0;
+#ifdef _WIN32
+  std::string content_;
+#endif
+
+  DISALLOW_COPY_AND_ASSIGN(MappedFile);
+};
+
+FlatDepsCacheFile::FlatDepsCacheFile(std::unique_ptr<MappedFile> mapped_file,
+                                     const Header* header)
+    : mapped_file_(std::move(mapped_file)), header_(header) {
+  const char* base = mapped_file_->data();
+  built_revision_ = absl::string_view(base + header_->built_revision_offset,
+                                      header_->built_revision_size);
+  filename_offsets_ = reinterpret_cast<const uint32_t*>(
+      base + header_->filename_offsets_offset);
+  filename_blob_ = absl::string_view(base + header_->filename_blob_offset,
+                                     header_->filename_blob_size);
+  file_stats_ =
+      reinterpret_cast<const FlatFileStat*>(base + header_->file_stats_offset);
+  directive_hashes_ = reinterpret_cast<const SHA256HashValue*>(
+      base + header_->directive_hashes_offset);
+  identifiers_ = reinterpret_cast<const FlatIdentifier*>(
+      base + header_->identifiers_offset);
+  deps_ = reinterpret_cast<const FlatDep*>(base + header_->deps_offset);
+}
+
+FlatDepsCacheFile::~FlatDepsCacheFile() {}
+
+// static
+std::unique_ptr<FlatDepsCacheFile> FlatDepsCacheFile::Open(
+    const std::string& filename) {
+  std::unique_ptr<MappedFile> mapped_file = MappedFile::Open(filename);
+  if (!mapped_file) {
+    LOG(INFO) << "failed to open " << filename;
+    return nullptr;
+  }
+  if (mapped_file->size() < sizeof(Header)) {
+    LOG(ERROR) << "too small flat deps cache file: " << filename
+               << " size=" << mapped_file->size();
+    return nullptr;
+  }
+  const Header* header = reinterpret_cast<const Header*>(mapped_file->data());
+  if (memcmp(header->magic, kMagic, sizeof(kMagic)) != 0) {
+    LOG(INFO) << "not a flat deps cache file: " << filename;
+    return nullptr;
+  }
+  if (header->version != kVersion) {
+    LOG(INFO) << "flat deps cache version mismatch: " << filename
+              << " version=" << header->version << " expected=" << kVersion;
+    return nullptr;
+  }
+  if (header->file_size != mapped_file->size()) {
+    LOG(ERROR) << "flat deps cache file is truncated: " << filename
+               << " size=" << mapped_file->size()
+               << " expected=" << header->file_size;
+    return nullptr;
+  }
+
+  // Checks all tables are in the file, so that accessing entries only needs
+  // index checks.
+  struct Section {
+    const char* name;
+    uint64_t offset;
+    uint64_t size;
+  } sections[] = {
+      {"built_revision", header->built_revision_offset,
+       header->built_revision_size},
+      {"filename_offsets", header->filename_offsets_offset,
+       (static_cast<uint64_t>(header->num_filenames) + 1) * sizeof(uint32_t)},
+      {"filename_blob", header->filename_blob_offset,
+       header->filename_blob_size},
+      {"file_stats", header->file_stats_offset,
+       static_cast<uint64_t>(header->num_file_stats) * sizeof(FlatFileStat)},
+      {"directive_hashes", header->directive_hashes_offset,
+       static_cast<uint64_t>(header->num_directive_hashes) *
+           sizeof(SHA256HashValue)},
+      {"identifiers", header->identifiers_offset,
+       static_cast<uint64_t>(header->num_identifiers) *
+           sizeof(FlatIdentifier)},
+      {"deps", header->deps_offset,
+       static_cast<uint64_t>(header->num_deps) * sizeof(FlatDep)},
+  };
+  for (const auto& section : sections) {
+    if (section.offset % kAlignment != 0 ||
+        !mapped_file->Contains(section.offset, section.size)) {
+      LOG(ERROR) << "broken flat deps cache file: " << filename
+                 << " section=" << section.name
+                 << " offset=" << section.offset << " size=" << section.size;
+      return nullptr;
+    }
+  }
+
+  return std::unique_ptr<FlatDepsCacheFile>(
+      new FlatDepsCacheFile(std::move(mapped_file), header));
+}
+
+size_t FlatDepsCacheFile::num_identifiers() const {
+  return header_->num_identifiers;
+}
+
+bool FlatDepsCacheFile::Find(const SHA256HashValue& identifier,
+                             time_t* last_used_time,
+                             std::vector<Dep>* deps) const {
+  const FlatIdentifier* begin = identifiers_;
+  const FlatIdentifier* end = identifiers_ + header_->num_identifiers;
+  const FlatIdentifier* it = std::lower_bound(
+      begin, end, identifier,
+      [](const FlatIdentifier& entry, const SHA256HashValue& value) {
+        return entry.identifier < value;
+      });
+  if (it == end || it->identifier != identifier) {
+    return false;
+  }
+  *last_used_time = it->last_used_time;
+  return GetDeps(*it, deps);
+}
+
+bool FlatDepsCacheFile::GetIdentifierAt(size_t index,
+                                        SHA256HashValue* identifier,
+                                        time_t* last_used_time) const {
+  if (index >= header_->num_identifiers) {
+    return false;
+  }
+  *identifier = identifiers_[index].identifier;
+  *last_used_time = identifiers_[index].last_used_time;
+  return true;
+}
+
+bool FlatDepsCacheFile::GetDepsAt(size_t index,
+                                  std::vector<Dep>* deps) const {
+  if (index >= header_->num_identifiers) {
+    return false;
+  }
+  return GetDeps(identifiers_[index], deps);
+}
+
+bool FlatDepsCacheFile::UpdateLastUsedTimes(
+    const std::string& filename,
+    const std::vector<std::pair<SHA256HashValue, time_t>>& entries) const {
+  ScopedFd fd(ScopedFd::OpenForRewrite(filename));
+  if (!fd.valid()) {
+    LOG(WARNING) << "failed to open " << filename;
+    return false;
+  }
+  // Checks the file is the same as mapped one, because offsets in the
+  // mapped file are used to write.
+  size_t size = 0;
+  Header header;
+  if (!fd.GetFileSize(&size) || size != header_->file_size ||
+      fd.Read(&header, sizeof(header)) != sizeof(header) ||
+      memcmp(&header, header_, sizeof(header)) != 0) {
+    LOG(WARNING) << "flat deps cache file was replaced: " << filename;
+    return false;
+  }
+
+  const FlatIdentifier* begin = identifiers_;
+  const FlatIdentifier* end = identifiers_ + header_->num_identifiers;
+  size_t num_updated = 0;
+  for (const auto& entry : entries) {
+    const FlatIdentifier* it = std::lower_bound(
+        begin, end, entry.first,
+        [](const FlatIdentifier& flat_entry, const SHA256HashValue& value) {
+          return flat_entry.identifier < value;
+        });
+    if (it == end || it->identifier != entry.first ||
+        it->last_used_time == entry.second) {
+      continue;
+    }
+    const int64_t last_used_time = entry.second;
+    const off_t offset = header_->identifiers_offset +
+                         (it - begin) * sizeof(FlatIdentifier) +
+                         offsetof(FlatIdentifier, last_used_time);
+    if (fd.WriteAt(&last_used_time, sizeof(last_used_time), offset) !=
+        sizeof(last_used_time)) {
+      PLOG(ERROR) << "failed to write " << filename << " offset=" << offset;
+      return false;
+    }
+    ++num_updated;
+  }
+  LOG(INFO) << "updated last used time of " << num_updated << " entries in "
+            << filename;
+  return true;
+}
+
+bool FlatDepsCacheFile::GetFilename(uint32_t index,
+                                    absl::string_view* filename) const {
+  if (index >= header_->num_filenames) {
+    return false;
+  }
+  const uint32_t begin = filename_offsets_[index];
+  const uint32_t end = filename_offsets_[index + 1];
+  if (begin > end || end > filename_blob_.size()) {
+    return false;
+  }
+  *filename = filename_blob_.substr(begin, end - begin);
+  return !filename->empty();
+}
+
+bool FlatDepsCacheFile::GetDeps(const FlatIdentifier& identifier,
+                                std::vector<Dep>* deps) const {
+  if (identifier.deps_begin > header_->num_deps ||
+      identifier.num_deps > header_->num_deps - identifier.deps_begin) {
+    LOG(ERROR) << "broken deps range in flat deps cache:"
+               << " identifier=" << identifier.identifier;
+    return false;
+  }
+  deps->clear();
+  deps->reserve(identifier.num_deps);
+  for (uint32_t i = 0; i < identifier.num_deps; ++i) {
+    const FlatDep& dep = deps_[identifier.deps_begin + i];
+    Dep result;
+    if (!GetFilename(dep.filename_index, &result.filename) ||
+        dep.file_stat_index >= header_->num_file_stats ||
+        dep.directive_hash_index >= header_->num_directive_hashes) {
+      LOG(ERROR) << "broken dep in flat deps cache:"
+                 << " identifier=" << identifier.identifier;
+      deps->clear();
+      return false;
+    }
+    const FlatFileStat& file_stat = file_stats_[dep.file_stat_index];
+    result.file_stat.mtime = absl::FromUnixNanos(file_stat.mtime_ns);
+    result.file_stat.size = file_stat.size;
+    result.directive_hash = directive_hashes_[dep.directive_hash_index];
+    deps->push_back(std::move(result));
+  }
+  return true;
+}
+
+FlatDepsCacheFile::Writer::Writer(std::string built_revision)
+    : built_revision_(std::move(built_revision)) {
+  filename_offsets_.push_back(0);
+}
+
+FlatDepsCacheFile::Writer::~Writer() {}
+
+uint32_t FlatDepsCacheFile::Writer::FilenameIndex(
+    absl::string_view filename) {
+  auto p = filename_index_.try_emplace(std::string(filename),
+                                       filename_offsets_.size() - 1);
+  if (p.second) {
+    filename_blob_.append(filename.data(), filename.size());
+    filename_offsets_.push_back(filename_blob_.size());
+  }
+  return p.first->second;
+}
+
+uint32_t FlatDepsCacheFile::Writer::FileStatIndex(const FileStat& file_stat) {
+  auto p = file_stat_index_.try_emplace(file_stat, file_stats_.size());
+  if (p.second) {
+    file_stats_.push_back(file_stat);
+  }
+  return p.first->second;
+}
+
+uint32_t FlatDepsCacheFile::Writer::DirectiveHashIndex(
+    const SHA256HashValue& directive_hash) {
+  auto p = directive_hash_index_.try_emplace(directive_hash,
+                                             directive_hashes_.size());
+  if (p.second) {
+    directive_hashes_.push_back(directive_hash);
+  }
+  return p.first->second;
+}
+
+void FlatDepsCacheFile::Writer::AddEntry(const SHA256HashValue& identifier,
+                                         time_t last_used_time,
+                                         const std::vector<Dep>& deps) {
+  IdentifierEntry entry;
+  entry.identifier = identifier;
+  entry.last_used_time = last_used_time;
+  entry.deps_begin = deps_.size();
+  entry.num_deps = deps.size();
+  for (const auto& dep : deps) {
+    DCHECK(dep.file_stat.IsValid()) << dep.filename;
+    DepEntry dep_entry;
+    dep_entry.filename_index = FilenameIndex(dep.filename);
+    dep_entry.file_stat_index = FileStatIndex(dep.file_stat);
+    dep_entry.directive_hash_index = DirectiveHashIndex(dep.directive_hash);
+    deps_.push_back(dep_entry);
+  }
+  identifiers_.push_back(entry);
+}
+
+bool FlatDepsCacheFile::Writer::WriteToFile(const std::string& filename) {
+  std::sort(identifiers_.begin(), identifiers_.end(),
+            [](const IdentifierEntry& lhs, const IdentifierEntry& rhs) {
+              return lhs.identifier < rhs.identifier;
+            });
+  for (size_t i = 1; i < identifiers_.size(); ++i) {
+    if (identifiers_[i - 1].identifier == identifiers_[i].identifier) {
+      LOG(ERROR) << "duplicated identifier: " << identifiers_[i].identifier;
+      return false;
+    }
+  }
+
+  Header header;
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, kMagic, sizeof(kMagic));
+  header.version = kVersion;
+
+  std::string buf(AlignUp(sizeof(Header)), '\0');
+  auto append_section = [&buf](const void* data, size_t size) {
+    const uint64_t offset = buf.size();
+    buf.append(static_cast<const char*>(data), size);
+    buf.resize(AlignUp(buf.size()), '\0');
+    return offset;
+  };
+
+  header.built_revision_size = built_revision_.size();
+  header.built_revision_offset =
+      append_section(built_revision_.data(), built_revision_.size());
+
+  header.num_filenames = filename_offsets_.size() - 1;
+  header.filename_offsets_offset =
+      append_section(filename_offsets_.data(),
+                     filename_offsets_.size() * sizeof(uint32_t));
+  header.filename_blob_size = filename_blob_.size();
+  header.filename_blob_offset =
+      append_section(filename_blob_.data(), filename_blob_.size());
+
+  std::vector<FlatFileStat> file_stats;
+  file_stats.reserve(file_stats_.size());
+  for (const auto& file_stat : file_stats_) {
+    FlatFileStat flat_file_stat;
+    flat_file_stat.mtime_ns = absl::ToUnixNanos(*file_stat.mtime);
+    flat_file_stat.size = file_stat.size;
+    file_stats.push_back(flat_file_stat);
+  }
+  header.num_file_stats = file_stats.size();
+  header.file_stats_offset = append_section(
+      file_stats.data(), file_stats.size() * sizeof(FlatFileStat));
+
+  header.num_directive_hashes = directive_hashes_.size();
+  header.directive_hashes_offset =
+      append_section(directive_hashes_.data(),
+                     directive_hashes_.size() * sizeof(SHA256HashValue));
+
+  std::vector<FlatIdentifier> identifiers;
+  identifiers.reserve(identifiers_.size());
+  for (const auto& entry : identifiers_) {
+    FlatIdentifier flat_identifier;
+    flat_identifier.identifier = entry.identifier;
+    flat_identifier.last_used_time = entry.last_used_time;
+    flat_identifier.deps_begin = entry.deps_begin;
+    flat_identifier.num_deps = entry.num_deps;
+    identifiers.push_back(flat_identifier);
+  }
+  header.num_identifiers = identifiers.size();
+  header.identifiers_offset = append_section(
+      identifiers.data(), identifiers.size() * sizeof(FlatIdentifier));
+
+  std::vector<FlatDep> deps;
+  deps.reserve(deps_.size());
+  for (const auto& dep : deps_) {
+    FlatDep flat_dep;
+    flat_dep.filename_index = dep.filename_index;
+    flat_dep.file_stat_index = dep.file_stat_index;
+    flat_dep.directive_hash_index = dep.directive_hash_index;
+    deps.push_back(flat_dep);
+  }
+  header.num_deps = deps.size();
+  header.deps_offset =
+      append_section(deps.data(), deps.size() * sizeof(FlatDep));
+
+  header.file_size = buf.size();
+  memcpy(&buf[0], &header, sizeof(header));
+
+  const std::string tmp_filename = filename + ".tmp";
+  if (!WriteStringToFile(buf, tmp_filename)) {
+    LOG(ERROR) << "failed to write " << tmp_filename;
+    return false;
+  }
+#ifdef _WIN32
+  // rename on Windows fails if the destination exists.
+  remove(filename.c_str());
+#endif
+  if (rename(tmp_filename.c_str(), filename.c_str()) != 0) {
+    PLOG(ERROR) << "failed to rename " << tmp_filename << " to " << filename;
+    remove(tmp_filename.c_str());
+    return false;
+  }
+  LOG(INFO) << "flat deps cache file: filename=" << filename
+            << " size=" << buf.size()
+            << " identifiers=" << identifiers.size()
+            << " filenames=" << header.num_filenames;
+  return true;
+}
+
+}  // namespace devtools_goma
@@ -0,0 +1,174 @@
+// Copyright 2020 The Goma Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#ifndef DEVTOOLS_GOMA_CLIENT_DEPS_CACHE_FILE_H_
+#define DEVTOOLS_GOMA_CLIENT_DEPS_CACHE_FILE_H_
+
+#include <time.h>
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "absl/container/flat_hash_map.h"
+#include "absl/strings/string_view.h"
+#include "basictypes.h"
+#include "file_stat.h"
+#include "goma_hash.h"
+
+namespace devtools_goma {
+
+// FlatDepsCacheFile is a read-only view of a DepsCache file in flat binary
+// format.
+//
+// The file consists of a header and fixed-size tables referring to each
+// other by index:
+//   - filenames (offset table + string blob)
+//   - file stats
+//   - directive hashes
+//   - identifiers, sorted by identifier
+//   - deps, each of which refers to a filename, a file stat and
+//     a directive hash.
+// Since nothing needs to be parsed, opening the file costs O(1) regardless of
+// its size; the file is mmapped and an identifier is looked up with binary
+// search in place.
+//
+// The file is local to the machine that wrote it (native byte order).
+// It is always written to a temporary file and renamed, so a partially
+// written file is not observed. Indices are checked on every access, so a
+// corrupted file results in cache misses rather than crashes.
+class FlatDepsCacheFile {
+ public:
+  struct Dep {
+    Dep() = default;
+    Dep(absl::string_view filename,
+        const FileStat& file_stat,
+        const SHA256HashValue& directive_hash)
+        : filename(filename),
+          file_stat(file_stat),
+          directive_hash(directive_hash) {}
+
+    // Points to the mapped file (or Writer's caller), so it must not outlive
+    // FlatDepsCacheFile.
+    absl::string_view filename;
+    FileStat file_stat;
+    SHA256HashValue directive_hash;
+  };
+
+  class Writer {
+   public:
+    explicit Writer(std::string built_revision);
+    ~Writer();
+
+    // Adds an entry for |identifier|. Each identifier must be added once.
+    void AddEntry(const SHA256HashValue& identifier,
+                  time_t last_used_time,
+                  const std::vector<Dep>& deps);
+
+    size_t num_entries() const { return identifiers_.size(); }
+
+    // Writes the file to |filename| atomically.
+    bool WriteToFile(const std::string& filename);
+
+   private:
+    struct IdentifierEntry {
+      SHA256HashValue identifier;
+      int64_t last_used_time;
+      uint32_t deps_begin;
+      uint32_t num_deps;
+    };
+    struct DepEntry {
+      uint32_t filename_index;
+      uint32_t file_stat_index;
+      uint32_t directive_hash_index;
+    };
+
+    uint32_t FilenameIndex(absl::string_view filename);
+    uint32_t FileStatIndex(const FileStat& file_stat);
+    uint32_t DirectiveHashIndex(const SHA256HashValue& directive_hash);
+
+    const std::string built_revision_;
+
+    absl::flat_hash_map<std::string, uint32_t> filename_index_;
+    std::vector<uint32_t> filename_offsets_;
+    std::string filename_blob_;
+
+    absl::flat_hash_map<FileStat, uint32_t> file_stat_index_;
+    std::vector<FileStat> file_stats_;
+
+    absl::flat_hash_map<SHA256HashValue, uint32_t> directive_hash_index_;
+    std::vector<SHA256HashValue> directive_hashes_;
+
+    std::vector<IdentifierEntry> identifiers_;
+    std::vector<DepEntry> deps_;
+
+    DISALLOW_COPY_AND_ASSIGN(Writer);
+  };
+
+  ~FlatDepsCacheFile();
+
+  // Opens |filename|. Returns nullptr if it does not exist, or it is not a
+  // valid flat DepsCache file.
+  static std::unique_ptr<FlatDepsCacheFile> Open(const std::string& filename);
+
+  absl::string_view built_revision() const { return built_revision_; }
+  size_t num_identifiers() const;
+
+  // Finds |identifier| in the file.
+  // Returns true and fills |last_used_time| and |deps| if it is found and
+  // the record is not corrupted.
+  bool Find(const SHA256HashValue& identifier,
+            time_t* last_used_time,
+            std::vector<Dep>* deps) const;
+
+  // Gets the identifier and last used time of |index|-th entry in identifier
+  // order. Used with GetDepsAt to iterate all entries.
+  bool GetIdentifierAt(size_t index,
+                       SHA256HashValue* identifier,
+                       time_t* last_used_time) const;
+  // Gets deps of |index|-th entry in identifier order.
+  bool GetDepsAt(size_t index, std::vector<Dep>* deps) const;
+
+  // Overwrites last used times of |entries| in |filename|, which must be the
+  // file this was opened from.  Since the last used time has fixed size and
+  // position, only it is written in place, instead of rewriting the whole
+  // file; if interrupted, the file is still valid, with some of the times
+  // updated.  Entries not in the file are ignored.
+  // Returns false if the file was replaced, or failed to write.
+  bool UpdateLastUsedTimes(
+      const std::string& filename,
+      const std::vector<std::pair<SHA256HashValue, time_t>>& entries) const;
+
+ private:
+  class MappedFile;
+  struct Header;
+  struct FlatFileStat;
+  struct FlatIdentifier;
+  struct FlatDep;
+
+  FlatDepsCacheFile(std::unique_ptr<MappedFile> mapped_file,
+                    const Header* header);
+
+  bool GetFilename(uint32_t index, absl::string_view* filename) const;
+  bool GetDeps(const FlatIdentifier& identifier,
+               std::vector<Dep>* deps) const;
+
+  std::unique_ptr<MappedFile> mapped_file_;
+  const Header* header_;
+  absl::string_view built_revision_;
+  const uint32_t* filename_offsets_;
+  absl::string_view filename_blob_;
+  const FlatFileStat* file_stats_;
+  const SHA256HashValue* directive_hashes_;
+  const FlatIdentifier* identifiers_;
+  const FlatDep* deps_;
+
+  DISALLOW_COPY_AND_ASSIGN(FlatDepsCacheFile);
+};
+
+}  // namespace devtools_goma
+
+#endif  // DEVTOOLS_GOMA_CLIENT_DEPS_CACHE_FILE_H_
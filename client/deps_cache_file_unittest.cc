@@ -0,0 +1,191 @@
+// Copyright 2020 The Goma Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "deps_cache_file.h"
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "absl/memory/memory.h"
+#include "absl/time/time.h"
+#include "file_helper.h"
+#include "gtest/gtest.h"
+#include "path.h"
+#include "unittest_util.h"
+
+namespace devtools_goma {
+
+class FlatDepsCacheFileTest : public testing::Test {
+ protected:
+  void SetUp() override {
+    tmpdir_ = absl::make_unique<TmpdirUtil>("deps_cache_file_test");
+    filename_ = file::JoinPath(tmpdir_->tmpdir(), "deps_cache");
+  }
+
+  static SHA256HashValue MakeHash(const std::string& s) {
+    SHA256HashValue hash;
+    ComputeDataHashKeyForSHA256HashValue(s, &hash);
+    return hash;
+  }
+
+  static FileStat MakeFileStat(int64_t mtime_sec, int64_t size) {
+    FileStat file_stat;
+    file_stat.mtime = absl::FromUnixSeconds(mtime_sec);
+    file_stat.size = size;
+    return file_stat;
+  }
+
+  std::unique_ptr<TmpdirUtil> tmpdir_;
+  std::string filename_;
+};
+
+TEST_F(FlatDepsCacheFileTest, WriteAndFind) {
+  const SHA256HashValue id1 = MakeHash("id1");
+  const SHA256HashValue id2 = MakeHash("id2");
+  const SHA256HashValue id3 = MakeHash("id3");
+
+  {
+    FlatDepsCacheFile::Writer writer("revision");
+    writer.AddEntry(
+        id1, 100,
+        {
+            FlatDepsCacheFile::Dep("a.cc", MakeFileStat(10, 1), MakeHash("a")),
+            FlatDepsCacheFile::Dep("a.h", MakeFileStat(20, 2), MakeHash("b")),
+        });
+    writer.AddEntry(
+        id2, 200,
+        {
+            FlatDepsCacheFile::Dep("a.h", MakeFileStat(20, 2), MakeHash("b")),
+        });
+    EXPECT_EQ(2U, writer.num_entries());
+    EXPECT_TRUE(writer.WriteToFile(filename_));
+  }
+
+  std::unique_ptr<FlatDepsCacheFile> file = FlatDepsCacheFile::Open(filename_);
+  ASSERT_NE(nullptr, file);
+  EXPECT_EQ("revision", file->built_revision());
+  EXPECT_EQ(2U, file->num_identifiers());
+
+  time_t last_used_time;
+  std::vector<FlatDepsCacheFile::Dep> deps;
+  ASSERT_TRUE(file->Find(id1, &last_used_time, &deps));
+  EXPECT_EQ(100, last_used_time);
+  ASSERT_EQ(2U, deps.size());
+  EXPECT_EQ("a.cc", deps[0].filename);
+  EXPECT_EQ(MakeFileStat(10, 1), deps[0].file_stat);
+  EXPECT_EQ(MakeHash("a"), deps[0].directive_hash);
+  EXPECT_EQ("a.h", deps[1].filename);
+  EXPECT_EQ(MakeFileStat(20, 2), deps[1].file_stat);
+  EXPECT_EQ(MakeHash("b"), deps[1].directive_hash);
+
+  ASSERT_TRUE(file->Find(id2, &last_used_time, &deps));
+  EXPECT_EQ(200, last_used_time);
+  ASSERT_EQ(1U, deps.size());
+  EXPECT_EQ("a.h", deps[0].filename);
+
+  EXPECT_FALSE(file->Find(id3, &last_used_time, &deps));
+
+  // Entries are iterated in identifier order.
+  SHA256HashValue prev;
+  for (size_t i = 0; i < file->num_identifiers(); ++i) {
+    SHA256HashValue identifier;
+    ASSERT_TRUE(file->GetIdentifierAt(i, &identifier, &last_used_time));
+    ASSERT_TRUE(file->GetDepsAt(i, &deps));
+    if (i > 0) {
+      EXPECT_LT(prev, identifier);
+    }
+    prev = identifier;
+  }
+  SHA256HashValue identifier;
+  EXPECT_FALSE(file->GetIdentifierAt(2, &identifier, &last_used_time));
+}
+
+TEST_F(FlatDepsCacheFileTest, DuplicateIdentifier) {
+  const SHA256HashValue id = MakeHash("id");
+
+  FlatDepsCacheFile::Writer writer("revision");
+  writer.AddEntry(id, 100, {});
+  writer.AddEntry(id, 200, {});
+  EXPECT_FALSE(writer.WriteToFile(filename_));
+}
+
+TEST_F(FlatDepsCacheFileTest, UpdateLastUsedTimes) {
+  const SHA256HashValue id1 = MakeHash("id1");
+  const SHA256HashValue id2 = MakeHash("id2");
+  const SHA256HashValue id3 = MakeHash("id3");
+  {
+    FlatDepsCacheFile::Writer writer("revision");
+    writer.AddEntry(
+        id1, 100,
+        {
+            FlatDepsCacheFile::Dep("a.cc", MakeFileStat(10, 1), MakeHash("a")),
+        });
+    writer.AddEntry(id2, 200, {});
+    ASSERT_TRUE(writer.WriteToFile(filename_));
+  }
+
+  {
+    std::unique_ptr<FlatDepsCacheFile> file =
+        FlatDepsCacheFile::Open(filename_);
+    ASSERT_NE(nullptr, file);
+    // id3 is not in the file, and ignored.
+    EXPECT_TRUE(file->UpdateLastUsedTimes(filename_, {{id1, 1000},
+                                                      {id3, 3000}}));
+  }
+
+  std::unique_ptr<FlatDepsCacheFile> file = FlatDepsCacheFile::Open(filename_);
+  ASSERT_NE(nullptr, file);
+  EXPECT_EQ(2U, file->num_identifiers());
+  time_t last_used_time;
+  std::vector<FlatDepsCacheFile::Dep> deps;
+  ASSERT_TRUE(file->Find(id1, &last_used_time, &deps));
+  EXPECT_EQ(1000, last_used_time);
+  ASSERT_EQ(1U, deps.size());
+  EXPECT_EQ("a.cc", deps[0].filename);
+  ASSERT_TRUE(file->Find(id2, &last_used_time, &deps));
+  EXPECT_EQ(200, last_used_time);
+  EXPECT_FALSE(file->Find(id3, &last_used_time, &deps));
+
+  // Doesn't update the file replaced by another one.
+  {
+    FlatDepsCacheFile::Writer writer("revision");
+    writer.AddEntry(id1, 100, {});
+    ASSERT_TRUE(writer.WriteToFile(filename_));
+  }
+  EXPECT_FALSE(file->UpdateLastUsedTimes(filename_, {{id1, 2000}}));
+  file = FlatDepsCacheFile::Open(filename_);
+  ASSERT_NE(nullptr, file);
+  ASSERT_TRUE(file->Find(id1, &last_used_time, &deps));
+  EXPECT_EQ(100, last_used_time);
+}
+
+TEST_F(FlatDepsCacheFileTest, OpenNonExistentFile) {
+  EXPECT_EQ(nullptr, FlatDepsCacheFile::Open(filename_));
+}
+
+TEST_F(FlatDepsCacheFileTest, OpenInvalidFile) {
+  ASSERT_TRUE(WriteStringToFile("GOMADEPS but not a valid file", filename_));
+  EXPECT_EQ(nullptr, FlatDepsCacheFile::Open(filename_));
+}
+
+TEST_F(FlatDepsCacheFileTest, OpenTruncatedFile) {
+  {
+    FlatDepsCacheFile::Writer writer("revision");
+    writer.AddEntry(
+        MakeHash("id"), 100,
+        {
+            FlatDepsCacheFile::Dep("a.cc", MakeFileStat(10, 1), MakeHash("a")),
+        });
+    ASSERT_TRUE(writer.WriteToFile(filename_));
+  }
+
+  std::string content;
+  ASSERT_TRUE(ReadFileToString(filename_, &content));
+  content.resize(content.size() - 8);
+  ASSERT_TRUE(WriteStringToFile(content, filename_));
+  EXPECT_EQ(nullptr, FlatDepsCacheFile::Open(filename_));
+}
+
+}  // namespace devtools_goma
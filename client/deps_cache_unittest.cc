@@ -8,6 +8,10 @@
 #include <glog/logging.h>
 #include <gtest/gtest.h>
 
+#ifndef _WIN32
+#include <sys/stat.h>
+#endif
+
 #include <fstream>
 #include <memory>
 #include <set>
@@ -16,11 +20,14 @@
 
 #include "absl/memory/memory.h"
 #include "absl/time/time.h"
+#include "absl/types/optional.h"
+#include "autolock_timer.h"
 #include "client/deps_cache_data.pb.h"
 #include "compiler_flags.h"
 #include "compiler_info.h"
 #include "cxx/cxx_compiler_info.h"
 #include "cxx/include_processor/include_cache.h"
+#include "deps_cache_file.h"
 #include "file_helper.h"
 #include "gcc_flags.h"
 #include "java/java_compiler_info.h"
@@ -43,13 +50,18 @@ class DepsCacheTest : public testing::Test {
  protected:
   typedef DepsCache::DepsHashId DepsHashId;
 
+  virtual DepsCache::FileFormat file_format() const {
+    return DepsCache::FileFormat::kProto;
+  }
+
   void SetUp() override {
     tmpdir_ = absl::make_unique<TmpdirUtil>("deps_cache_test");
     IncludeCache::Init(32, true);
     DepsCache::Init(file::JoinPath(tmpdir_->tmpdir(), ".goma_deps"),
                     kDepsCacheAliveDuration,
                     kDepsCacheThreshold,
-                    kDepsCacheMaxProtoSizeInMB);
+                    kDepsCacheMaxProtoSizeInMB,
+                    file_format());
     DepsCache::LoadIfEnabled();
     dc_ = DepsCache::instance();
     CHECK(dc_ != nullptr) << "dc_ == nullptr";
@@ -196,6 +208,53 @@ class DepsCacheTest : public testing::Test {
 
   int DepsCacheSize() const { return static_cast<int>(dc_->deps_table_size()); }
 
+  int FlatFileSize() const {
+    AUTO_SHARED_LOCK(lock, &dc_->mu_);
+    if (dc_->flat_file_ == nullptr) {
+      return 0;
+    }
+    return static_cast<int>(dc_->flat_file_->num_identifiers());
+  }
+
+  // Returns last used time of |identifier| in the flat file, or
+  // absl::nullopt if it is not in the file.
+  absl::optional<absl::Time> FlatFileLastUsedTime(
+      const DepsCache::Identifier& identifier) const {
+    AUTO_SHARED_LOCK(lock, &dc_->mu_);
+    time_t last_used_time = 0;
+    std::vector<FlatDepsCacheFile::Dep> deps;
+    if (dc_->flat_file_ == nullptr ||
+        !dc_->flat_file_->Find(identifier.value(), &last_used_time, &deps)) {
+      return absl::nullopt;
+    }
+    return absl::FromTimeT(last_used_time);
+  }
+
+  void SetLastUsedTime(const DepsCache::Identifier& identifier,
+                       absl::Time last_used_time) {
+    AUTO_EXCLUSIVE_LOCK(lock, &dc_->mu_);
+    dc_->deps_table_.at(identifier.value()).last_used_time =
+        absl::ToTimeT(last_used_time);
+  }
+
+  bool FlatFileDirty() const { return dc_->flat_file_dirty_; }
+  bool FlatFileUsedTimeUpdated() const {
+    return dc_->flat_file_used_time_updated_;
+  }
+
+  void Restart(DepsCache::FileFormat file_format) {
+    DepsCache::Quit();
+    IncludeCache::Quit();
+    IncludeCache::Init(32, true);
+    DepsCache::Init(file::JoinPath(tmpdir_->tmpdir(), ".goma_deps"),
+                    kDepsCacheAliveDuration,
+                    kDepsCacheThreshold,
+                    kDepsCacheMaxProtoSizeInMB,
+                    file_format);
+    DepsCache::LoadIfEnabled();
+    dc_ = DepsCache::instance();
+  }
+
   DepsCache::Identifier MakeFreshIdentifier() {
     SHA256HashValue hash_value;
     SHA256HashValue::ConvertFromHexString(
@@ -470,7 +529,8 @@ TEST_F(DepsCacheTest, Restart) {
   DepsCache::Init(file::JoinPath(tmpdir_->tmpdir(), ".goma_deps"),
                   kDepsCacheAliveDuration,
                   kDepsCacheThreshold,
-                  kDepsCacheMaxProtoSizeInMB);
+                  kDepsCacheMaxProtoSizeInMB,
+                  file_format());
   DepsCache::LoadIfEnabled();
   dc_ = DepsCache::instance();
 
@@ -541,7 +601,8 @@ TEST_F(DepsCacheTest, RestartWithFileStatUpdate) {
   DepsCache::Init(file::JoinPath(tmpdir_->tmpdir(), ".goma_deps"),
                   kDepsCacheAliveDuration,
                   kDepsCacheThreshold,
-                  kDepsCacheMaxProtoSizeInMB);
+                  kDepsCacheMaxProtoSizeInMB,
+                  file_format());
   DepsCache::LoadIfEnabled();
   dc_ = DepsCache::instance();
 
@@ -629,7 +690,8 @@ TEST_F(DepsCacheTest, RestartWithDirectiveHashUpdate) {
   DepsCache::Init(file::JoinPath(tmpdir_->tmpdir(), ".goma_deps"),
                   kDepsCacheAliveDuration,
                   kDepsCacheThreshold,
-                  kDepsCacheMaxProtoSizeInMB);
+                  kDepsCacheMaxProtoSizeInMB,
+                  file_format());
   DepsCache::LoadIfEnabled();
   dc_ = DepsCache::instance();
 
@@ -687,7 +749,8 @@ TEST_F(DepsCacheTest, RestartWithOldIdentifier) {
   DepsCache::Init(file::JoinPath(tmpdir_->tmpdir(), ".goma_deps"),
                   kDepsCacheAliveDuration,
                   kDepsCacheThreshold,
-                  kDepsCacheMaxProtoSizeInMB);
+                  kDepsCacheMaxProtoSizeInMB,
+                  file_format());
   DepsCache::LoadIfEnabled();
   dc_ = DepsCache::instance();
 
@@ -716,7 +779,8 @@ TEST_F(DepsCacheTest, RestartWithOldIdentifier) {
   DepsCache::Init(file::JoinPath(tmpdir_->tmpdir(), ".goma_deps"),
                   kDepsCacheAliveDuration,
                   kDepsCacheThreshold,
-                  kDepsCacheMaxProtoSizeInMB);
+                  kDepsCacheMaxProtoSizeInMB,
+                  file_format());
   DepsCache::LoadIfEnabled();
   dc_ = DepsCache::instance();
 
@@ -737,7 +801,8 @@ TEST_F(DepsCacheTest, RestartWithOldIdentifierWithNegativeAliveDuration) {
   IncludeCache::Init(32, true);
   DepsCache::Init(file::JoinPath(tmpdir_->tmpdir(), ".goma_deps"),
                   absl::nullopt, kDepsCacheThreshold,
-                  kDepsCacheMaxProtoSizeInMB);
+                  kDepsCacheMaxProtoSizeInMB,
+                  file_format());
   DepsCache::LoadIfEnabled();
   dc_ = DepsCache::instance();
 
@@ -772,7 +837,8 @@ TEST_F(DepsCacheTest, RestartWithOldIdentifierWithNegativeAliveDuration) {
   IncludeCache::Init(32, true);
   DepsCache::Init(file::JoinPath(tmpdir_->tmpdir(), ".goma_deps"),
                   absl::nullopt, kDepsCacheThreshold,
-                  kDepsCacheMaxProtoSizeInMB);
+                  kDepsCacheMaxProtoSizeInMB,
+                  file_format());
   DepsCache::LoadIfEnabled();
   dc_ = DepsCache::instance();
 
@@ -820,7 +886,8 @@ TEST_F(DepsCacheTest, RestartWithBuiltRevisionUpdate) {
   DepsCache::Init(file::JoinPath(tmpdir_->tmpdir(), ".goma_deps"),
                   kDepsCacheAliveDuration,
                   kDepsCacheThreshold,
-                  kDepsCacheMaxProtoSizeInMB);
+                  kDepsCacheMaxProtoSizeInMB,
+                  file_format());
   DepsCache::LoadIfEnabled();
   dc_ = DepsCache::instance();
 
@@ -871,7 +938,8 @@ TEST_F(DepsCacheTest, RestartWithMissingSha256) {
   DepsCache::Init(file::JoinPath(tmpdir_->tmpdir(), ".goma_deps"),
                   kDepsCacheAliveDuration,
                   kDepsCacheThreshold,
-                  kDepsCacheMaxProtoSizeInMB);
+                  kDepsCacheMaxProtoSizeInMB,
+                  file_format());
   DepsCache::LoadIfEnabled();
   dc_ = DepsCache::instance();
 
@@ -922,7 +990,8 @@ TEST_F(DepsCacheTest, RestartWithInvalidSha256) {
   DepsCache::Init(file::JoinPath(tmpdir_->tmpdir(), ".goma_deps"),
                   kDepsCacheAliveDuration,
                   kDepsCacheThreshold,
-                  kDepsCacheMaxProtoSizeInMB);
+                  kDepsCacheMaxProtoSizeInMB,
+                  file_format());
   DepsCache::LoadIfEnabled();
   dc_ = DepsCache::instance();
 
@@ -986,7 +1055,8 @@ TEST_F(DepsCacheTest, RestartWithUpdatedFilesInSomeIdentifier) {
   DepsCache::Init(file::JoinPath(tmpdir_->tmpdir(), ".goma_deps"),
                   kDepsCacheAliveDuration,
                   kDepsCacheThreshold,
-                  kDepsCacheMaxProtoSizeInMB);
+                  kDepsCacheMaxProtoSizeInMB,
+                  file_format());
   DepsCache::LoadIfEnabled();
   dc_ = DepsCache::instance();
 
@@ -1038,7 +1108,8 @@ TEST_F(DepsCacheTest, RestartWithLargeNumberIdentifiers) {
   DepsCache::Init(file::JoinPath(tmpdir_->tmpdir(), ".goma_deps"),
                   kDepsCacheAliveDuration,
                   kDepsCacheThreshold,
-                  kDepsCacheMaxProtoSizeInMB);
+                  kDepsCacheMaxProtoSizeInMB,
+                  file_format());
   DepsCache::LoadIfEnabled();
   dc_ = DepsCache::instance();
 
@@ -1258,4 +1329,272 @@ TEST_F(DepsCacheTest, MakeDepsIdentifierJavac) {
   EXPECT_FALSE(identifier.has_value());
 }
 
+class FlatDepsCacheTest : public DepsCacheTest {
+ protected:
+  DepsCache::FileFormat file_format() const override {
+    return DepsCache::FileFormat::kFlat;
+  }
+};
+
+TEST_F(FlatDepsCacheTest, Restart) {
+  const DepsCache::Identifier identifier = MakeFreshIdentifier();
+
+  const std::string& ah = tmpdir_->FullPath("a.h");
+  const std::string& acc = tmpdir_->FullPath("a.cc");
+
+  tmpdir_->CreateTmpFile("a.h", "kotori");
+  tmpdir_->CreateTmpFile("a.cc",
+      "#include <stdio.h>\n"
+      "piyo");
+
+  {
+    FileStatCache file_stat_cache;
+    std::set<std::string> deps;
+    deps.insert(ah);
+    EXPECT_TRUE(SetDependencies(identifier, acc, deps, &file_stat_cache));
+  }
+
+  Restart(DepsCache::FileFormat::kFlat);
+
+  // Entries are not loaded until they are used.
+  EXPECT_EQ(1, FlatFileSize());
+  EXPECT_EQ(0, DepsCacheSize());
+  {
+    FileStatCache file_stat_cache;
+    std::set<std::string> deps;
+
+    EXPECT_TRUE(GetDependencies(identifier, acc, &deps, &file_stat_cache));
+
+    std::set<std::string> deps_expected;
+    deps_expected.insert(ah);
+    EXPECT_EQ(deps_expected, deps);
+  }
+  EXPECT_EQ(1, DepsCacheSize());
+}
+
+TEST_F(FlatDepsCacheTest, RestartKeepsUnusedEntries) {
+  const DepsCache::Identifier identifier1 = MakeFreshIdentifier();
+  const DepsCache::Identifier identifier2 = MakeFreshIdentifier();
+  const DepsCache::Identifier identifier3 = MakeFreshIdentifier();
+
+  const std::string& ah = tmpdir_->FullPath("a.h");
+  const std::string& acc = tmpdir_->FullPath("a.cc");
+
+  tmpdir_->CreateTmpFile("a.h", "kotori");
+  tmpdir_->CreateTmpFile("a.cc",
+      "#include <stdio.h>\n"
+      "piyo");
+
+  {
+    FileStatCache file_stat_cache;
+    std::set<std::string> deps;
+    deps.insert(ah);
+    EXPECT_TRUE(SetDependencies(identifier1, acc, deps, &file_stat_cache));
+    EXPECT_TRUE(SetDependencies(identifier2, acc, deps, &file_stat_cache));
+  }
+
+  Restart(DepsCache::FileFormat::kFlat);
+
+  // Use identifier1 only, and add identifier3.
+  {
+    FileStatCache file_stat_cache;
+    std::set<std::string> deps;
+    EXPECT_TRUE(GetDependencies(identifier1, acc, &deps, &file_stat_cache));
+    deps.clear();
+    deps.insert(ah);
+    EXPECT_TRUE(SetDependencies(identifier3, acc, deps, &file_stat_cache));
+  }
+  EXPECT_EQ(2, DepsCacheSize());
+
+  Restart(DepsCache::FileFormat::kFlat);
+
+  EXPECT_EQ(3, FlatFileSize());
+  {
+    FileStatCache file_stat_cache;
+    std::set<std::string> deps;
+    EXPECT_TRUE(GetDependencies(identifier1, acc, &deps, &file_stat_cache));
+    EXPECT_TRUE(GetDependencies(identifier2, acc, &deps, &file_stat_cache));
+    EXPECT_TRUE(GetDependencies(identifier3, acc, &deps, &file_stat_cache));
+  }
+}
+
+TEST_F(FlatDepsCacheTest, RemoveAfterRestart) {
+  const DepsCache::Identifier identifier = MakeFreshIdentifier();
+
+  const std::string& ah = tmpdir_->FullPath("a.h");
+  const std::string& acc = tmpdir_->FullPath("a.cc");
+
+  tmpdir_->CreateTmpFile("a.h", "kotori");
+  tmpdir_->CreateTmpFile("a.cc",
+      "#include <stdio.h>\n"
+      "piyo");
+
+  {
+    FileStatCache file_stat_cache;
+    std::set<std::string> deps;
+    deps.insert(ah);
+    EXPECT_TRUE(SetDependencies(identifier, acc, deps, &file_stat_cache));
+  }
+
+  Restart(DepsCache::FileFormat::kFlat);
+
+  // The entry in the file must not be used after it is removed.
+  RemoveDependency(identifier);
+  {
+    FileStatCache file_stat_cache;
+    std::set<std::string> deps;
+    EXPECT_FALSE(GetDependencies(identifier, acc, &deps, &file_stat_cache));
+  }
+
+  Restart(DepsCache::FileFormat::kFlat);
+
+  EXPECT_EQ(0, FlatFileSize());
+  {
+    FileStatCache file_stat_cache;
+    std::set<std::string> deps;
+    EXPECT_FALSE(GetDependencies(identifier, acc, &deps, &file_stat_cache));
+  }
+}
+
+TEST_F(FlatDepsCacheTest, CacheHitDoesNotDirtyFile) {
+  const DepsCache::Identifier identifier = MakeFreshIdentifier();
+
+  const std::string& ah = tmpdir_->FullPath("a.h");
+  const std::string& acc = tmpdir_->FullPath("a.cc");
+
+  tmpdir_->CreateTmpFile("a.h", "kotori");
+  tmpdir_->CreateTmpFile("a.cc",
+      "#include <stdio.h>\n"
+      "piyo");
+
+  {
+    FileStatCache file_stat_cache;
+    std::set<std::string> deps;
+    deps.insert(ah);
+    EXPECT_TRUE(SetDependencies(identifier, acc, deps, &file_stat_cache));
+  }
+
+  Restart(DepsCache::FileFormat::kFlat);
+  EXPECT_FALSE(FlatFileDirty());
+
+  // The entry was used recently, so the file needs not to be rewritten.
+  {
+    FileStatCache file_stat_cache;
+    std::set<std::string> deps;
+    EXPECT_TRUE(GetDependencies(identifier, acc, &deps, &file_stat_cache));
+    EXPECT_TRUE(GetDependencies(identifier, acc, &deps, &file_stat_cache));
+  }
+  EXPECT_FALSE(FlatFileDirty());
+
+  RemoveDependency(identifier);
+  EXPECT_TRUE(FlatFileDirty());
+}
+
+TEST_F(FlatDepsCacheTest, CacheHitUpdatesLastUsedTimeInPlace) {
+  const DepsCache::Identifier identifier = MakeFreshIdentifier();
+
+  const std::string& ah = tmpdir_->FullPath("a.h");
+  const std::string& acc = tmpdir_->FullPath("a.cc");
+
+  tmpdir_->CreateTmpFile("a.h", "kotori");
+  tmpdir_->CreateTmpFile("a.cc",
+      "#include <stdio.h>\n"
+      "piyo");
+
+  const absl::Time old_time = absl::FromTimeT(
+      absl::ToTimeT(absl::Now() - absl::Hours(2)));
+  {
+    FileStatCache file_stat_cache;
+    std::set<std::string> deps;
+    deps.insert(ah);
+    EXPECT_TRUE(SetDependencies(identifier, acc, deps, &file_stat_cache));
+    SetLastUsedTime(identifier, old_time);
+  }
+
+  Restart(DepsCache::FileFormat::kFlat);
+  EXPECT_EQ(old_time, FlatFileLastUsedTime(identifier));
+#ifndef _WIN32
+  struct stat st;
+  ASSERT_EQ(0, stat(tmpdir_->FullPath(".goma_deps").c_str(), &st));
+  const ino_t ino = st.st_ino;
+#endif
+
+  // Hit of the old entry updates its last used time, but no entry is
+  // added nor removed.
+  {
+    FileStatCache file_stat_cache;
+    std::set<std::string> deps;
+    EXPECT_TRUE(GetDependencies(identifier, acc, &deps, &file_stat_cache));
+  }
+  EXPECT_FALSE(FlatFileDirty());
+  EXPECT_TRUE(FlatFileUsedTimeUpdated());
+
+  const absl::Time restart_time = absl::FromTimeT(absl::ToTimeT(absl::Now()));
+  Restart(DepsCache::FileFormat::kFlat);
+  EXPECT_EQ(1, FlatFileSize());
+  absl::optional<absl::Time> last_used_time =
+      FlatFileLastUsedTime(identifier);
+  ASSERT_TRUE(last_used_time.has_value());
+  EXPECT_GE(*last_used_time, restart_time - absl::Minutes(1));
+#ifndef _WIN32
+  // The file was updated in place, instead of rewritten.
+  ASSERT_EQ(0, stat(tmpdir_->FullPath(".goma_deps").c_str(), &st));
+  EXPECT_EQ(ino, st.st_ino);
+#endif
+}
+
+TEST_F(FlatDepsCacheTest, RestartWithLargeNumberIdentifiers) {
+  const int N = 30;
+  ASSERT_GT(N, kDepsCacheThreshold);
+
+  const std::string& ah = tmpdir_->FullPath("a.h");
+  const std::string& acc = tmpdir_->FullPath("a.cc");
+
+  tmpdir_->CreateTmpFile("a.h", "kotori");
+  tmpdir_->CreateTmpFile("a.cc",
+      "#include <stdio.h>\n"
+      "piyo");
+
+  for (int i = 0; i < N; ++i) {
+    FileStatCache file_stat_cache;
+    std::set<std::string> deps;
+    deps.insert(ah);
+    EXPECT_TRUE(
+        SetDependencies(MakeFreshIdentifier(), acc, deps, &file_stat_cache));
+  }
+
+  Restart(DepsCache::FileFormat::kFlat);
+
+  EXPECT_EQ(kDepsCacheThreshold, FlatFileSize());
+}
+
+TEST_F(FlatDepsCacheTest, IgnoreProtoFile) {
+  const DepsCache::Identifier identifier = MakeFreshIdentifier();
+
+  const std::string& ah = tmpdir_->FullPath("a.h");
+  const std::string& acc = tmpdir_->FullPath("a.cc");
+
+  tmpdir_->CreateTmpFile("a.h", "kotori");
+  tmpdir_->CreateTmpFile("a.cc",
+      "#include <stdio.h>\n"
+      "piyo");
+
+  Restart(DepsCache::FileFormat::kProto);
+  {
+    FileStatCache file_stat_cache;
+    std::set<std::string> deps;
+    deps.insert(ah);
+    EXPECT_TRUE(SetDependencies(identifier, acc, deps, &file_stat_cache));
+  }
+
+  // The file saved in proto format is not loaded, but DepsCache still works.
+  Restart(DepsCache::FileFormat::kFlat);
+  EXPECT_EQ(0, FlatFileSize());
+  {
+    FileStatCache file_stat_cache;
+    std::set<std::string> deps;
+    EXPECT_FALSE(GetDependencies(identifier, acc, &deps, &file_stat_cache));
+  }
+}
+
 }  // namespace devtools_goma
@@ -15,7 +15,9 @@
 #include "config_win.h"
 #endif
 
+#include "absl/strings/string_view.h"
 #include "absl/time/time.h"
+#include "absl/types/span.h"
 
 namespace devtools_goma {
 
@@ -49,6 +51,13 @@ class Descriptor {
   // whether no data transferred or close detected.
   virtual ssize_t Read(void* ptr, size_t len) = 0;
   virtual ssize_t Write(const void* ptr, size_t len) = 0;
+  // Writev writes |bufs| in order, like writev(2), and returns the same
+  // values as Write.  |bufs| must not be empty, and each buffer must not
+  // be empty.
+  // The default implementation writes the first buffer only.
+  virtual ssize_t Writev(absl::Span<const absl::string_view> bufs) {
+    return Write(bufs[0].data(), bufs[0].size());
+  }
   // NeedRetry is true when previous Read or Write is failed but
   // a caller should retry Read or Write.
   virtual bool NeedRetry() const = 0;
@@ -112,6 +112,12 @@ class DescriptorPollerBase : public DescriptorPoller {
 
   SocketDescriptor* poll_breaker() const { return poll_breaker_.get(); }
 
+  // Returns true if called on the thread polling events.
+  // Must be called with lock held.
+  bool IsPollThread() const {
+    return poll_thread_ && THREAD_ID_IS_SELF(poll_thread_);
+  }
+
  private:
   std::unique_ptr<SocketDescriptor> poll_breaker_;
   ScopedSocket poll_signaler_;
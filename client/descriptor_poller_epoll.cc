@@ -6,6 +6,7 @@
 #include "descriptor_poller.h"
 
 #include <memory>
+#include <utility>
 
 #include <linux/version.h>
 #if LINUX_VERSION_CODE < KERNEL_VERSION(2, 6, 19)
@@ -15,6 +16,7 @@
 #define EPOLL_SIZE_HINT FD_SETSIZE  // Any value but not 0 should be ok.
 
 #include "absl/base/call_once.h"
+#include "absl/container/flat_hash_map.h"
 #include "absl/container/flat_hash_set.h"
 #include "absl/memory/memory.h"
 #include "absl/time/time.h"
@@ -49,51 +51,43 @@ class EpollDescriptorPoller : public DescriptorPollerBase {
     LOG(INFO) << "descriptor_poller will use \"epoll\"";
   }
 
+  // Interest changes are not applied to epoll immediately, but batched
+  // until the next PreparePollEvents, since a descriptor usually changes
+  // its interest several times in a callback (e.g. ClearWritable and
+  // NotifyWhenReadable after sending a request).  Only the last interest
+  // of a descriptor is applied, and epoll_ctl is skipped if the interest
+  // is the same as registered.
+  // When called on other thread than the polling thread, it is applied
+  // immediately, since the polling thread may be waiting in epoll_wait.
   void RegisterPollEvent(SocketDescriptor* d, EventType type) override {
     DCHECK(d->wait_writable() || d->wait_readable());
-    struct epoll_event ev = {};
-    ev.data.ptr = d;
+    uint32_t events = 0;
     if (type == DescriptorEventType::kReadEvent || d->wait_readable()) {
       DCHECK(d->wait_readable());
-      ev.events |= EPOLLIN;
+      events |= EPOLLIN;
     }
     if (type == DescriptorEventType::kWriteEvent || d->wait_writable()) {
       DCHECK(d->wait_writable());
-      ev.events |= EPOLLOUT;
+      events |= EPOLLOUT;
     }
-    int r = epoll_ctl(epoll_fd_.fd(), EPOLL_CTL_ADD, d->fd(), &ev);
-    if (r < 0 && errno == EEXIST) {
-      r = epoll_ctl(epoll_fd_.fd(), EPOLL_CTL_MOD, d->fd(), &ev);
-    }
-    PCHECK(r != -1) << "Cannot add fd for epoll:" << d->fd();
-    // Since we allow to register twice, we do not check existence of
-    // the fd.
-    registered_fds_.insert(d->fd());
+    UpdateInterest(d, events);
   }
 
   void UnregisterPollEvent(SocketDescriptor* d,
                            EventType type ALLOW_UNUSED) override {
-    if (!registered_fds_.contains(d->fd())) {
+    if (!registered_events_.contains(d->fd()) &&
+        !pending_events_.contains(d->fd())) {
       VLOG(1) << "fd has already been removed. fd=" << d->fd();
       return;
     }
-    struct epoll_event ev = {};
-    ev.data.ptr = d;
-    int op = EPOLL_CTL_DEL;
+    uint32_t events = 0;
     if (d->wait_readable()) {
-      ev.events |= EPOLLIN;
-      op = EPOLL_CTL_MOD;
+      events |= EPOLLIN;
     }
     if (d->wait_writable()) {
-      ev.events |= EPOLLOUT;
-      op = EPOLL_CTL_MOD;
+      events |= EPOLLOUT;
     }
-    if (op == EPOLL_CTL_DEL) {
-      registered_fds_.erase(d->fd());
-    }
-    PCHECK(epoll_ctl(epoll_fd_.fd(), op, d->fd(), &ev) != -1)
-        << "Cannot modify fd for epoll:" << d->fd()
-        << " ev.events=" << ev.events;
+    UpdateInterest(d, events);
   }
 
   void RegisterTimeoutEvent(SocketDescriptor* d) override {
@@ -107,6 +101,10 @@ class EpollDescriptorPoller : public DescriptorPollerBase {
   void UnregisterDescriptor(SocketDescriptor* d) override {
     CHECK(d);
     timeout_waiters_.erase(d);
+    pending_events_.erase(d->fd());
+    if (registered_events_.erase(d->fd()) == 0) {
+      return;
+    }
     int r = epoll_ctl(epoll_fd_.fd(), EPOLL_CTL_DEL, d->fd(), nullptr);
     PCHECK(r != -1 || errno == ENOENT)
         << "Cannot delete fd for epoll:" << d->fd();
@@ -114,6 +112,10 @@ class EpollDescriptorPoller : public DescriptorPollerBase {
 
  protected:
   void PreparePollEvents(const DescriptorMap& descriptors) override {
+    for (const auto& it : pending_events_) {
+      ApplyInterest(it.second.first, it.second.second);
+    }
+    pending_events_.clear();
     nevents_ = descriptors.size() + 1;
     if (last_nevents_ < nevents_) {
       events_ = absl::make_unique<struct epoll_event[]>(nevents_);
@@ -177,12 +179,67 @@ class EpollDescriptorPoller : public DescriptorPollerBase {
   }
 
  private:
+  void UpdateInterest(SocketDescriptor* d, uint32_t events) {
+    if (!IsPollThread()) {
+      pending_events_.erase(d->fd());
+      ApplyInterest(d, events);
+      return;
+    }
+    pending_events_[d->fd()] = std::make_pair(d, events);
+  }
+
+  // Makes epoll watch |events| on |d|.  |events| == 0 removes |d|.
+  void ApplyInterest(SocketDescriptor* d, uint32_t events) {
+    auto found = registered_events_.find(d->fd());
+    // If the fd is registered for other descriptor, the fd has been closed
+    // (so removed from epoll by kernel) and reused by |d|.
+    const bool registered = found != registered_events_.end() &&
+                            found->second.first == d;
+    if (events == 0) {
+      if (found == registered_events_.end()) {
+        return;
+      }
+      registered_events_.erase(found);
+      if (!registered) {
+        return;
+      }
+      int r = epoll_ctl(epoll_fd_.fd(), EPOLL_CTL_DEL, d->fd(), nullptr);
+      PCHECK(r != -1 || errno == ENOENT)
+          << "Cannot delete fd for epoll:" << d->fd();
+      return;
+    }
+    if (registered && found->second.second == events) {
+      return;
+    }
+    struct epoll_event ev = {};
+    ev.data.ptr = d;
+    ev.events = events;
+    int op = registered ? EPOLL_CTL_MOD : EPOLL_CTL_ADD;
+    int r = epoll_ctl(epoll_fd_.fd(), op, d->fd(), &ev);
+    if (r < 0 && errno == EEXIST) {
+      r = epoll_ctl(epoll_fd_.fd(), EPOLL_CTL_MOD, d->fd(), &ev);
+    } else if (r < 0 && errno == ENOENT) {
+      // The fd was closed and reused without UnregisterDescriptor.
+      r = epoll_ctl(epoll_fd_.fd(), EPOLL_CTL_ADD, d->fd(), &ev);
+    }
+    PCHECK(r != -1) << "Cannot add fd for epoll:" << d->fd()
+                    << " ev.events=" << ev.events;
+    registered_events_[d->fd()] = std::make_pair(d, events);
+  }
+
   friend class EpollEventEnumerator;
   static absl::once_flag s_init_once_;
   ScopedFd epoll_fd_;
   std::unique_ptr<struct epoll_event[]> events_;
   absl::flat_hash_set<SocketDescriptor*> timeout_waiters_;
-  absl::flat_hash_set<int> registered_fds_;
+  // descriptor and its epoll events registered in |epoll_fd_| for each fd.
+  // The entry must be removed when the fd is unregistered, since the fd
+  // number may be reused by other descriptor.
+  absl::flat_hash_map<int, std::pair<SocketDescriptor*, uint32_t>>
+      registered_events_;
+  // epoll events to be registered by the next PreparePollEvents.
+  absl::flat_hash_map<int, std::pair<SocketDescriptor*, uint32_t>>
+      pending_events_;
   int nevents_;
   int last_nevents_;
   int nfds_;
@@ -15,12 +15,19 @@
 #include "absl/time/clock.h"
 #include "atomic_stats_counter.h"
 #include "autolock_timer.h"
+#include "cache_file.h"
+#include "compiler_specific.h"
 #include "env_flags.h"
 #include "file_hash_cache.h"
 #include "glog/logging.h"
 #include "path.h"
+#include "proto_util.h"
 #include "util.h"
 
+MSVC_PUSH_DISABLE_WARNING_FOR_PROTO()
+#include "client/file_hash_cache_data.pb.h"
+MSVC_POP_WARNING()
+
 namespace devtools_goma {
 
 // Returns cache ID if it was found in cache.
@@ -137,6 +144,103 @@ bool FileHashCache::IsKnownCacheKey(const std::string& cache_key) {
 FileHashCache::FileHashCache() {
 }
 
+bool FileHashCache::Load(const CacheFile& cache_file,
+                         absl::optional<absl::Duration> alive_duration) {
+  FileHashCacheData data;
+  if (!cache_file.Load(&data)) {
+    LOG(INFO) << "failed to load file hash cache " << cache_file.filename();
+    return false;
+  }
+  if (alive_duration.has_value() &&
+      (!data.has_saved_time() ||
+       ProtoToTime(data.saved_time()) < absl::Now() - *alive_duration)) {
+    LOG(INFO) << "file hash cache is too old. ignored. "
+              << cache_file.filename();
+    return false;
+  }
+
+  absl::flat_hash_map<std::string, FileInfo> file_cache;
+  file_cache.reserve(data.record_size());
+  for (const auto& record : data.record()) {
+    FileInfo info;
+    info.cache_key = record.cache_key();
+    if (record.has_mtime()) {
+      info.file_stat.mtime = ProtoToTime(record.mtime());
+    }
+    info.file_stat.size = record.size();
+    info.file_stat.is_directory = record.is_directory();
+    if (!info.file_stat.IsValid()) {
+      continue;
+    }
+    if (record.has_last_checked()) {
+      info.last_checked = ProtoToTime(record.last_checked());
+    }
+    if (record.has_last_uploaded()) {
+      info.last_uploaded_timestamp = ProtoToTime(record.last_uploaded());
+    }
+    file_cache.emplace(record.filename(), std::move(info));
+  }
+
+  const size_t num_loaded = file_cache.size();
+  {
+    AUTO_EXCLUSIVE_LOCK(lock, &file_cache_mutex_);
+    // Entries stored after startup are newer than the snapshot, so keep them.
+    file_cache_.merge(file_cache);
+  }
+  {
+    AUTO_EXCLUSIVE_LOCK(lock, &known_cache_keys_mutex_);
+    known_cache_keys_.insert(data.known_cache_key().begin(),
+                             data.known_cache_key().end());
+  }
+  num_loaded_.Add(num_loaded);
+  LOG(INFO) << "file hash cache has been loaded from "
+            << cache_file.filename() << " records=" << num_loaded
+            << " known_cache_keys=" << data.known_cache_key_size();
+  return true;
+}
+
+bool FileHashCache::Save(const CacheFile& cache_file) const {
+  FileHashCacheData data;
+  {
+    AUTO_SHARED_LOCK(lock, &file_cache_mutex_);
+    data.mutable_record()->Reserve(file_cache_.size());
+    for (const auto& it : file_cache_) {
+      const FileInfo& info = it.second;
+      if (!info.file_stat.IsValid() || !info.last_checked.has_value()) {
+        continue;
+      }
+      FileHashCacheRecord* record = data.add_record();
+      record->set_filename(it.first);
+      record->set_cache_key(info.cache_key);
+      *record->mutable_mtime() = TimeToProto(*info.file_stat.mtime);
+      record->set_size(info.file_stat.size);
+      record->set_is_directory(info.file_stat.is_directory);
+      *record->mutable_last_checked() = TimeToProto(*info.last_checked);
+      if (info.last_uploaded_timestamp.has_value()) {
+        *record->mutable_last_uploaded() =
+            TimeToProto(*info.last_uploaded_timestamp);
+      }
+    }
+  }
+  {
+    AUTO_SHARED_LOCK(lock, &known_cache_keys_mutex_);
+    data.mutable_known_cache_key()->Reserve(known_cache_keys_.size());
+    for (const auto& key : known_cache_keys_) {
+      data.add_known_cache_key(key);
+    }
+  }
+  *data.mutable_saved_time() = TimeToProto(absl::Now());
+
+  if (!cache_file.Save(data)) {
+    LOG(ERROR) << "failed to save file hash cache " << cache_file.filename();
+    return false;
+  }
+  LOG(INFO) << "saved file hash cache to " << cache_file.filename()
+            << " records=" << data.record_size()
+            << " known_cache_keys=" << data.known_cache_key_size();
+  return true;
+}
+
 std::string FileHashCache::DebugString() {
   std::stringstream ss;
   ss << "[GetFileCacheKey]" << std::endl;
@@ -146,7 +250,9 @@ std::string FileHashCache::DebugString() {
   ss << "clear obsolete=" << num_clear_obsolete_.value() << std::endl;
   ss << "[StoreFileCacheKey]" << std::endl;
   ss << "store cache=" << num_store_cache_.value() << std::endl;
-  ss << "clear cache=" << num_clear_cache_.value() << std::endl << std::endl;
+  ss << "clear cache=" << num_clear_cache_.value() << std::endl;
+  ss << "[Load]" << std::endl;
+  ss << "loaded=" << num_loaded_.value() << std::endl << std::endl;
 
   AUTO_SHARED_LOCK(lock, &file_cache_mutex_);
   ss << "[file_cache] size=" << file_cache_.size() << std::endl;
@@ -20,6 +20,8 @@
 
 namespace devtools_goma {
 
+class CacheFile;
+
 class FileHashCache {
  public:
   FileHashCache();
@@ -65,9 +67,23 @@ class FileHashCache {
 
   bool IsKnownCacheKey(const std::string& cache_key);
 
+  // Loads a snapshot saved by Save() from |cache_file|.
+  // Entries are not verified here. Since each entry keeps the FileStat taken
+  // when its cache key was stored, GetFileCacheKey() drops it if the file was
+  // modified after the snapshot was saved.
+  // If the snapshot is older than |alive_duration|, it is ignored.
+  // Returns true if the snapshot is loaded.
+  bool Load(const CacheFile& cache_file,
+            absl::optional<absl::Duration> alive_duration);
+
+  // Saves a snapshot of the cache to |cache_file|.
+  bool Save(const CacheFile& cache_file) const;
+
   std::string DebugString();
 
  private:
+  friend class FileHashCacheTest;
+
   struct FileInfo {
     std::string cache_key;
     FileStat file_stat;
@@ -84,13 +100,13 @@ class FileHashCache {
   };
 
   // A map from filename to file cache info.
-  ReadWriteLock file_cache_mutex_;
+  mutable ReadWriteLock file_cache_mutex_;
   absl::flat_hash_map<std::string, struct FileInfo> file_cache_
       ABSL_GUARDED_BY(file_cache_mutex_);
 
   // A set of cache keys that have been stored, so we could believe a cache_key
   // in this set is in goma cache.
-  ReadWriteLock known_cache_keys_mutex_;
+  mutable ReadWriteLock known_cache_keys_mutex_;
   absl::flat_hash_set<std::string> known_cache_keys_
       ABSL_GUARDED_BY(known_cache_keys_mutex_);
 
@@ -100,6 +116,7 @@ class FileHashCache {
   StatsCounter num_clear_obsolete_;
   StatsCounter num_store_cache_;
   StatsCounter num_clear_cache_;
+  StatsCounter num_loaded_;
 
   DISALLOW_COPY_AND_ASSIGN(FileHashCache);
 };
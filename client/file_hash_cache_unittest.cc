@@ -0,0 +1,143 @@
+// Copyright 2020 The Goma Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "file_hash_cache.h"
+
+#include <memory>
+#include <string>
+
+#include "absl/memory/memory.h"
+#include "absl/time/clock.h"
+#include "absl/time/time.h"
+#include "autolock_timer.h"
+#include "cache_file.h"
+#include "file_stat.h"
+#include "glog/logging.h"
+#include "gtest/gtest.h"
+#include "path.h"
+#include "unittest_util.h"
+
+namespace devtools_goma {
+
+class FileHashCacheTest : public testing::Test {
+ protected:
+  void SetUp() override {
+    tmpdir_ = absl::make_unique<TmpdirUtil>("file_hash_cache_test");
+    cache_file_ = absl::make_unique<CacheFile>(
+        file::JoinPath(tmpdir_->tmpdir(), "file_hash_cache"));
+  }
+
+  // Creates |path| whose mtime is old enough to trust its cache key.
+  std::string CreateFile(const std::string& path, const std::string& data) {
+    tmpdir_->CreateTmpFile(path, data);
+    const std::string abs_path = tmpdir_->FullPath(path);
+    CHECK(UpdateMtime(abs_path, absl::Now() - absl::Hours(1)));
+    return abs_path;
+  }
+
+  static size_t FileCacheSize(const FileHashCache& cache) {
+    AUTO_SHARED_LOCK(lock, &cache.file_cache_mutex_);
+    return cache.file_cache_.size();
+  }
+
+  std::unique_ptr<TmpdirUtil> tmpdir_;
+  std::unique_ptr<CacheFile> cache_file_;
+};
+
+TEST_F(FileHashCacheTest, SaveAndLoad) {
+  const std::string a = CreateFile("a.h", "a");
+  const std::string b = CreateFile("b.h", "bb");
+
+  {
+    FileHashCache cache;
+    EXPECT_TRUE(cache.StoreFileCacheKey(a, "key_a", absl::nullopt,
+                                        FileStat(a)));
+    EXPECT_TRUE(cache.StoreFileCacheKey(b, "key_b", absl::Now(),
+                                        FileStat(b)));
+    EXPECT_TRUE(cache.Save(*cache_file_));
+  }
+
+  FileHashCache cache;
+  EXPECT_TRUE(cache.Load(*cache_file_, absl::Hours(1)));
+  EXPECT_EQ(2U, FileCacheSize(cache));
+  EXPECT_TRUE(cache.IsKnownCacheKey("key_a"));
+  EXPECT_TRUE(cache.IsKnownCacheKey("key_b"));
+
+  std::string cache_key;
+  EXPECT_TRUE(cache.GetFileCacheKey(a, absl::nullopt, FileStat(a),
+                                    &cache_key));
+  EXPECT_EQ("key_a", cache_key);
+
+  // last uploaded timestamp is also restored.
+  EXPECT_TRUE(cache.GetFileCacheKey(b, absl::Now() - absl::Hours(1),
+                                    FileStat(b), &cache_key));
+  EXPECT_EQ("key_b", cache_key);
+  EXPECT_FALSE(cache.GetFileCacheKey(a, absl::Now() - absl::Hours(1),
+                                     FileStat(a), &cache_key));
+}
+
+TEST_F(FileHashCacheTest, ModifiedAfterSave) {
+  const std::string a = CreateFile("a.h", "a");
+
+  {
+    FileHashCache cache;
+    EXPECT_TRUE(cache.StoreFileCacheKey(a, "key_a", absl::nullopt,
+                                        FileStat(a)));
+    EXPECT_TRUE(cache.Save(*cache_file_));
+  }
+
+  CreateFile("a.h", "modified");
+
+  FileHashCache cache;
+  EXPECT_TRUE(cache.Load(*cache_file_, absl::Hours(1)));
+  std::string cache_key;
+  EXPECT_FALSE(cache.GetFileCacheKey(a, absl::nullopt, FileStat(a),
+                                     &cache_key));
+  EXPECT_EQ(0U, FileCacheSize(cache));
+  // cache key itself is still known.
+  EXPECT_TRUE(cache.IsKnownCacheKey("key_a"));
+}
+
+TEST_F(FileHashCacheTest, LoadKeepsNewerEntries) {
+  const std::string a = CreateFile("a.h", "a");
+
+  {
+    FileHashCache cache;
+    EXPECT_TRUE(cache.StoreFileCacheKey(a, "old_key", absl::nullopt,
+                                        FileStat(a)));
+    EXPECT_TRUE(cache.Save(*cache_file_));
+  }
+
+  FileHashCache cache;
+  EXPECT_TRUE(cache.StoreFileCacheKey(a, "new_key", absl::nullopt,
+                                      FileStat(a)));
+  EXPECT_TRUE(cache.Load(*cache_file_, absl::Hours(1)));
+  std::string cache_key;
+  EXPECT_TRUE(cache.GetFileCacheKey(a, absl::nullopt, FileStat(a),
+                                    &cache_key));
+  EXPECT_EQ("new_key", cache_key);
+}
+
+TEST_F(FileHashCacheTest, IgnoreOldSnapshot) {
+  const std::string a = CreateFile("a.h", "a");
+
+  {
+    FileHashCache cache;
+    EXPECT_TRUE(cache.StoreFileCacheKey(a, "key_a", absl::nullopt,
+                                        FileStat(a)));
+    EXPECT_TRUE(cache.Save(*cache_file_));
+  }
+
+  FileHashCache cache;
+  EXPECT_FALSE(cache.Load(*cache_file_, absl::ZeroDuration()));
+  EXPECT_EQ(0U, FileCacheSize(cache));
+  EXPECT_FALSE(cache.IsKnownCacheKey("key_a"));
+}
+
+TEST_F(FileHashCacheTest, LoadNonExistentFile) {
+  FileHashCache cache;
+  EXPECT_FALSE(cache.Load(*cache_file_, absl::nullopt));
+}
+
+}  // namespace devtools_goma
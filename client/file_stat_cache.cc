@@ -5,6 +5,10 @@
 
 #include "file_stat_cache.h"
 
+#ifndef _WIN32
+#include <sys/stat.h>
+#endif
+
 #include <string>
 
 #include <glog/logging.h>
@@ -26,6 +30,10 @@ FileStat GlobalFileStatCache::Get(const std::string& path) {
     }
   }
 
+  if (watcher_ != nullptr) {
+    return GetWatched(path);
+  }
+
   FileStat id(path);
   if (!id.IsValid() || id.is_directory) {
     return id;
@@ -38,17 +46,76 @@ FileStat GlobalFileStatCache::Get(const std::string& path) {
   return id;
 }
 
+FileStat GlobalFileStatCache::GetWatched(const std::string& path) {
+  // Watch before stat, so that modification after stat is notified.
+  const std::string dir(file::Dirname(path));
+  if (!watcher_->Watch(dir)) {
+    return FileStat(path);
+  }
+  // Invalidation of |path| (or of all paths) is counted in the sequence of
+  // |dir|.  Directory's FileStat is invalidated as an entry of |dir| too.
+  const uint64_t sequence = watcher_->sequence(dir);
+
+#ifndef _WIN32
+  // FileStat follows symlinks, but modification of the target (or
+  // retargeting to a file in another directory) is not notified in the
+  // watched directory.  Don't cache FileStat of symlinks.
+  struct stat st;
+  if (lstat(path.c_str(), &st) == 0 && S_ISLNK(st.st_mode)) {
+    GOMA_COUNTERZ("symlink");
+    return FileStat(path);
+  }
+#endif
+
+  FileStat id(path);
+  if (id.is_directory) {
+    // Directory's FileStat is changed by its entries.
+    if (!watcher_->Watch(path)) {
+      return id;
+    }
+    // |path| might be modified before it was watched.
+    id = FileStat(path);
+  }
+
+  {
+    AUTO_EXCLUSIVE_LOCK(lock, &mu_);
+    // Don't cache |id| if it might be invalidated before we take the lock.
+    if (watcher_->sequence(dir) != sequence) {
+      GOMA_COUNTERZ("invalidated while stat");
+      return id;
+    }
+    file_stats_.emplace(path, id);
+  }
+  return id;
+}
+
+void GlobalFileStatCache::OnInvalidated(const std::string& path) {
+  AUTO_EXCLUSIVE_LOCK(lock, &mu_);
+  file_stats_.erase(path);
+}
+
+void GlobalFileStatCache::OnInvalidatedAll() {
+  AUTO_EXCLUSIVE_LOCK(lock, &mu_);
+  file_stats_.clear();
+}
+
 GlobalFileStatCache* GlobalFileStatCache::instance_ = nullptr;
 
 /* static */
 void GlobalFileStatCache::Init() {
   CHECK(instance_ == nullptr);
-  instance_ = new GlobalFileStatCache;
+  instance_ = new GlobalFileStatCache(FileWatcher::instance());
+  if (instance_->watcher_ != nullptr) {
+    instance_->watcher_->AddObserver(instance_);
+  }
 }
 
 /* static */
 void GlobalFileStatCache::Quit() {
   CHECK(instance_ != nullptr);
+  if (instance_->watcher_ != nullptr) {
+    instance_->watcher_->RemoveObserver(instance_);
+  }
   delete instance_;
   instance_ = nullptr;
 }
@@ -14,23 +14,39 @@
 #include "absl/container/flat_hash_map.h"
 #include "basictypes.h"
 #include "file_stat.h"
+#include "file_watcher.h"
 #include "lockhelper.h"
 #include "platform_thread.h"
 
 namespace devtools_goma {
 
 // GlobalFileStatCache caches FileStats globally.
-// This only holds valid and non-directory FileStats.
+// If FileWatcher is enabled, this holds FileStats of paths in watched
+// directories (including watched directories themselves, but excluding
+// symlinks), and drops them when FileWatcher notifies modification.
+// Otherwise, this only holds valid and non-directory FileStats, and never
+// invalidates them.
 // The instance of this class is thread-safe.
-class GlobalFileStatCache {
+class GlobalFileStatCache : public FileWatcher::Observer {
  public:
   FileStat Get(const std::string& path);
 
+  // FileWatcher::Observer
+  void OnInvalidated(const std::string& path) override;
+  void OnInvalidatedAll() override;
+
+  // FileWatcher should be initialized before Init, if it is used.
   static void Init();
   static void Quit();
   static GlobalFileStatCache* Instance();
 
  private:
+  explicit GlobalFileStatCache(FileWatcher* watcher) : watcher_(watcher) {}
+
+  // Returns FileStat of |path| watched by |watcher_|.
+  FileStat GetWatched(const std::string& path);
+
+  FileWatcher* const watcher_;
   mutable ReadWriteLock mu_;
   absl::flat_hash_map<std::string, FileStat> file_stats_ ABSL_GUARDED_BY(mu_);
 
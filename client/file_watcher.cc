@@ -0,0 +1,341 @@
+// Copyright 2020 The Goma Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "file_watcher.h"
+
+#ifdef __linux__
+#include <errno.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+#endif
+
+#include <algorithm>
+
+#include "absl/strings/match.h"
+#include "autolock_timer.h"
+#include "counterz.h"
+#include "glog/logging.h"
+#include "path.h"
+
+namespace devtools_goma {
+
+namespace {
+
+#ifdef __linux__
+constexpr uint32_t kWatchMask = IN_ATTRIB | IN_CREATE | IN_DELETE |
+                                IN_DELETE_SELF | IN_MODIFY | IN_MOVE_SELF |
+                                IN_MOVED_FROM | IN_MOVED_TO | IN_ONLYDIR;
+// Changes in a directory entry also modify its parent directory.
+constexpr uint32_t kDirModifyMask =
+    IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO;
+// After these events, paths under the watched directory are not known.
+constexpr uint32_t kInvalidateAllMask =
+    IN_DELETE_SELF | IN_MOVE_SELF | IN_UNMOUNT | IN_Q_OVERFLOW;
+
+constexpr int kPollTimeoutMillisec = 100;
+#endif
+
+}  // anonymous namespace
+
+FileWatcher* FileWatcher::instance_ = nullptr;
+
+/* static */
+void FileWatcher::Init(size_t max_watches) {
+  CHECK(instance_ == nullptr);
+  if (max_watches == 0) {
+    return;
+  }
+#ifdef __linux__
+  int fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+  if (fd < 0) {
+    PLOG(WARNING) << "inotify_init1 failed. file watcher is disabled.";
+    return;
+  }
+  instance_ = new FileWatcher(fd, max_watches);
+  CHECK(PlatformThread::Create(instance_, &instance_->thread_handle_));
+  PlatformThread::SetName(instance_->thread_handle_, "file_watcher");
+  LOG(INFO) << "file watcher started. max_watches=" << max_watches;
+#else
+  LOG(WARNING) << "file watcher is not supported on this platform.";
+#endif
+}
+
+/* static */
+void FileWatcher::Quit() {
+  if (instance_ == nullptr) {
+    return;
+  }
+  instance_->quit_ = true;
+  PlatformThread::Join(instance_->thread_handle_);
+  delete instance_;
+  instance_ = nullptr;
+}
+
+FileWatcher::FileWatcher(int inotify_fd, size_t max_watches)
+    : inotify_fd_(inotify_fd),
+      max_watches_(max_watches),
+      thread_handle_(kNullThreadHandle),
+      quit_(false) {}
+
+FileWatcher::~FileWatcher() {
+#ifdef __linux__
+  close(inotify_fd_);
+#endif
+}
+
+bool FileWatcher::Watch(const std::string& abs_dir) {
+  DCHECK(file::IsAbsolutePath(abs_dir)) << abs_dir;
+  {
+    AUTOLOCK(lock, &mu_);
+    if (watch_descriptors_.contains(abs_dir)) {
+      return true;
+    }
+    if (unwatchable_dirs_.contains(abs_dir) ||
+        watch_descriptors_.size() >= max_watches_) {
+      return false;
+    }
+  }
+
+#ifdef __linux__
+  // Moving an ancestor is not notified in |abs_dir|, so ancestors are
+  // watched before |abs_dir|.
+  const std::string parent(file::Dirname(abs_dir));
+  if (parent != abs_dir && !Watch(parent)) {
+    return false;
+  }
+
+  // inotify resolves symlinks only when the watch is added, and retargeting
+  // a symlink is not notified in the directory it points to.  Don't watch
+  // a directory reached through symlinks.
+  char* real_dir = realpath(abs_dir.c_str(), nullptr);
+  if (real_dir == nullptr) {
+    // |abs_dir| might be created as a directory later.
+    return false;
+  }
+  const bool via_symlink = abs_dir != real_dir;
+  free(real_dir);
+
+  // inotify_add_watch is called with |mu_| held, so that the watch is not
+  // removed by RemoveWatches before it is registered.
+  AUTOLOCK(lock, &mu_);
+  if (via_symlink) {
+    unwatchable_dirs_.insert(abs_dir);
+    return false;
+  }
+  if (watch_descriptors_.contains(abs_dir)) {
+    return true;
+  }
+  if (parent != abs_dir && !watch_descriptors_.contains(parent)) {
+    // |parent| was moved or removed meanwhile.
+    return false;
+  }
+  if (watch_descriptors_.size() >= max_watches_) {
+    return false;
+  }
+
+  GOMA_COUNTERZ("inotify_add_watch");
+  int wd = inotify_add_watch(inotify_fd_, abs_dir.c_str(), kWatchMask);
+  if (wd < 0) {
+    if (errno == ENOENT || errno == ENOTDIR) {
+      // |abs_dir| might be created as a directory later.
+      return false;
+    }
+    PLOG_IF(WARNING, num_watch_failures_.value() == 0)
+        << "failed to watch " << abs_dir
+        << ". cached file stats in unwatched directories are not used.";
+    num_watch_failures_.Add(1);
+    unwatchable_dirs_.insert(abs_dir);
+    return false;
+  }
+
+  auto inserted = watched_dirs_.emplace(wd, abs_dir);
+  if (!inserted.second && inserted.first->second != abs_dir) {
+    // Same directory is watched via another path (e.g. symlink).
+    // Events are reported only for the first path, so paths in
+    // |abs_dir| are not watched.
+    unwatchable_dirs_.insert(abs_dir);
+    return false;
+  }
+  watch_descriptors_.emplace(abs_dir, wd);
+  return true;
+#else
+  return false;
+#endif
+}
+
+bool FileWatcher::RemoveWatches(const std::string& abs_dir) {
+#ifdef __linux__
+  const std::string prefix =
+      absl::EndsWith(abs_dir, "/") ? abs_dir : abs_dir + "/";
+  bool removed = false;
+  AUTOLOCK(lock, &mu_);
+  for (auto it = watch_descriptors_.begin();
+       it != watch_descriptors_.end();) {
+    if (it->first != abs_dir && !absl::StartsWith(it->first, prefix)) {
+      ++it;
+      continue;
+    }
+    VLOG(1) << "unwatch " << it->first;
+    // IN_IGNORED for |wd| is ignored since it is no longer in
+    // |watched_dirs_|.
+    inotify_rm_watch(inotify_fd_, it->second);
+    watched_dirs_.erase(it->second);
+    watch_descriptors_.erase(it++);
+    removed = true;
+  }
+  return removed;
+#else
+  return false;
+#endif
+}
+
+uint64_t FileWatcher::sequence(const std::string& abs_dir) const {
+  AUTOLOCK(lock, &mu_);
+  // Both are monotonically increasing, so is the sum.
+  auto found = dir_sequences_.find(abs_dir);
+  return all_sequence_ + (found == dir_sequences_.end() ? 0 : found->second);
+}
+
+void FileWatcher::AddObserver(Observer* observer) {
+  AUTOLOCK(lock, &mu_);
+  observers_.push_back(observer);
+}
+
+void FileWatcher::RemoveObserver(Observer* observer) {
+  AUTOLOCK(lock, &mu_);
+  observers_.erase(
+      std::remove(observers_.begin(), observers_.end(), observer),
+      observers_.end());
+}
+
+size_t FileWatcher::num_watches() const {
+  AUTOLOCK(lock, &mu_);
+  return watch_descriptors_.size();
+}
+
+void FileWatcher::ThreadMain() {
+#ifdef __linux__
+  while (!quit_) {
+    struct pollfd pfd;
+    pfd.fd = inotify_fd_;
+    pfd.events = POLLIN;
+    pfd.revents = 0;
+    int r = poll(&pfd, 1, kPollTimeoutMillisec);
+    if (r < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      PLOG(ERROR) << "poll on inotify fd failed";
+      break;
+    }
+    if (r == 0) {
+      continue;
+    }
+    if (!ReadEvents()) {
+      break;
+    }
+  }
+#endif
+}
+
+bool FileWatcher::ReadEvents() {
+#ifdef __linux__
+  alignas(struct inotify_event) char buf[64 * 1024];
+  for (;;) {
+    ssize_t len = read(inotify_fd_, buf, sizeof(buf));
+    if (len < 0) {
+      if (errno == EAGAIN || errno == EINTR) {
+        return true;
+      }
+      PLOG(ERROR) << "read on inotify fd failed";
+      // We cannot know modification any more.
+      InvalidateAll();
+      return false;
+    }
+
+    for (char* p = buf; p < buf + len;) {
+      const struct inotify_event* event =
+          reinterpret_cast<const struct inotify_event*>(p);
+      p += sizeof(struct inotify_event) + event->len;
+      num_events_.Add(1);
+
+      if (event->mask & IN_Q_OVERFLOW) {
+        LOG(WARNING) << "inotify event queue overflowed.";
+        num_overflows_.Add(1);
+        // Moved directories might be missed, and then watched paths are
+        // not reliable.
+        RemoveWatches("/");
+        InvalidateAll();
+        continue;
+      }
+
+      std::string dir;
+      {
+        AUTOLOCK(lock, &mu_);
+        auto found = watched_dirs_.find(event->wd);
+        if (found == watched_dirs_.end()) {
+          continue;
+        }
+        dir = found->second;
+        if (event->mask & IN_IGNORED) {
+          // The watch was removed by the kernel, e.g. |dir| was removed.
+          watch_descriptors_.erase(dir);
+          watched_dirs_.erase(found);
+        }
+      }
+
+      if (event->mask & (IN_DELETE_SELF | IN_MOVE_SELF)) {
+        // Watches under |dir| no longer report events of paths under |dir|.
+        RemoveWatches(dir);
+      }
+      if (event->mask & (kInvalidateAllMask | IN_IGNORED)) {
+        InvalidateAll();
+        continue;
+      }
+      if (event->len == 0) {
+        // Event on the watched directory itself.
+        Invalidate(dir);
+        continue;
+      }
+      const std::string path = file::JoinPath(dir, event->name);
+      if ((event->mask & IN_ISDIR) && (event->mask & kDirModifyMask) &&
+          RemoveWatches(path)) {
+        // A watched directory was moved or replaced (e.g. by
+        // `mv out out.old && mkdir out`), which is not notified in the
+        // directories under it.
+        InvalidateAll();
+        continue;
+      }
+      Invalidate(path);
+      if (event->mask & kDirModifyMask) {
+        Invalidate(dir);
+      }
+    }
+  }
+#else
+  return false;
+#endif
+}
+
+void FileWatcher::Invalidate(const std::string& path) {
+  VLOG(2) << "invalidated: " << path;
+  AUTOLOCK(lock, &mu_);
+  ++dir_sequences_[std::string(file::Dirname(path))];
+  for (auto* observer : observers_) {
+    observer->OnInvalidated(path);
+  }
+}
+
+void FileWatcher::InvalidateAll() {
+  VLOG(1) << "invalidated all";
+  AUTOLOCK(lock, &mu_);
+  ++all_sequence_;
+  for (auto* observer : observers_) {
+    observer->OnInvalidatedAll();
+  }
+}
+
+}  // namespace devtools_goma
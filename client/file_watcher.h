@@ -0,0 +1,121 @@
+// Copyright 2020 The Goma Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#ifndef DEVTOOLS_GOMA_CLIENT_FILE_WATCHER_H_
+#define DEVTOOLS_GOMA_CLIENT_FILE_WATCHER_H_
+
+#include <atomic>
+#include <string>
+#include <vector>
+
+#include "absl/base/thread_annotations.h"
+#include "absl/container/flat_hash_map.h"
+#include "absl/container/flat_hash_set.h"
+#include "atomic_stats_counter.h"
+#include "basictypes.h"
+#include "lockhelper.h"
+#include "platform_thread.h"
+
+namespace devtools_goma {
+
+// FileWatcher watches directories with inotify, and notifies observers
+// of paths that might be modified in the watched directories.
+//
+// With FileWatcher, a cached FileStat of a file in a watched directory
+// (or of a watched directory itself) can be trusted without stat until
+// it is invalidated.  Ancestors of a watched directory are watched too,
+// since moving an ancestor is not notified in the directory itself.
+//
+// Note that inotify does not notify writes through shared memory mapping,
+// so such modifications are not detected.
+//
+// FileWatcher is available only on Linux. On other platforms, Init does
+// nothing and IsEnabled() returns false.
+//
+// This class is thread-safe.
+class FileWatcher : public PlatformThread::Delegate {
+ public:
+  class Observer {
+   public:
+    virtual ~Observer() = default;
+
+    // Called when |path| might be modified, created or removed.
+    virtual void OnInvalidated(const std::string& path) = 0;
+    // Called when any path might be modified, e.g. when the event queue
+    // overflowed, or a watched directory was moved.
+    virtual void OnInvalidatedAll() = 0;
+  };
+
+  static FileWatcher* instance() { return instance_; }
+  static bool IsEnabled() { return instance_ != nullptr; }
+
+  // Starts FileWatcher thread. Does nothing if |max_watches| is 0 or
+  // inotify is not available.
+  static void Init(size_t max_watches);
+  static void Quit();
+
+  // Starts watching directory |abs_dir| and its ancestors. Returns true if
+  // |abs_dir| is watched. Returns false if |abs_dir| is not a directory,
+  // it is reached through symlinks, or it could not be watched because of
+  // the watch limit. In that case, callers should not trust cached FileStat
+  // of paths in |abs_dir|.
+  bool Watch(const std::string& abs_dir);
+
+  // Returns the number of invalidations of paths in |abs_dir|, including
+  // invalidations of all paths. Callers may compare this before and after
+  // stat to know an invalidation happened meanwhile.
+  uint64_t sequence(const std::string& abs_dir) const;
+
+  // Observers are called on the FileWatcher thread.
+  void AddObserver(Observer* observer);
+  void RemoveObserver(Observer* observer);
+
+  size_t num_watches() const;
+  int64_t num_events() const { return num_events_.value(); }
+  int64_t num_overflows() const { return num_overflows_.value(); }
+  int64_t num_watch_failures() const { return num_watch_failures_.value(); }
+
+ private:
+  FileWatcher(int inotify_fd, size_t max_watches);
+  ~FileWatcher() override;
+
+  void ThreadMain() override;
+
+  // Returns false if no more events will be read.
+  bool ReadEvents();
+  // Removes watches of |abs_dir| and directories under it. Returns true if
+  // any watch was removed.
+  bool RemoveWatches(const std::string& abs_dir);
+  void Invalidate(const std::string& path);
+  void InvalidateAll();
+
+  static FileWatcher* instance_;
+
+  const int inotify_fd_;
+  const size_t max_watches_;
+  PlatformThreadHandle thread_handle_;
+  std::atomic<bool> quit_;
+
+  mutable Lock mu_;
+  absl::flat_hash_map<std::string, int> watch_descriptors_
+      ABSL_GUARDED_BY(mu_);
+  absl::flat_hash_map<int, std::string> watched_dirs_ ABSL_GUARDED_BY(mu_);
+  // Directories failed to watch. Kept to avoid retrying inotify_add_watch.
+  absl::flat_hash_set<std::string> unwatchable_dirs_ ABSL_GUARDED_BY(mu_);
+  std::vector<Observer*> observers_ ABSL_GUARDED_BY(mu_);
+  // Sequences of invalidations per directory, and of all paths.
+  absl::flat_hash_map<std::string, uint64_t> dir_sequences_
+      ABSL_GUARDED_BY(mu_);
+  uint64_t all_sequence_ ABSL_GUARDED_BY(mu_) = 0;
+
+  StatsCounter num_events_;
+  StatsCounter num_overflows_;
+  StatsCounter num_watch_failures_;
+
+  DISALLOW_COPY_AND_ASSIGN(FileWatcher);
+};
+
+}  // namespace devtools_goma
+
+#endif  // DEVTOOLS_GOMA_CLIENT_FILE_WATCHER_H_
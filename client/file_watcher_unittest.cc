@@ -0,0 +1,218 @@
+// Copyright 2020 The Goma Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "file_watcher.h"
+
+#ifdef __linux__
+#include <stdio.h>
+#include <unistd.h>
+#endif
+
+#include <algorithm>
+#include <memory>
+#include <string>
+
+#include "absl/container/flat_hash_set.h"
+#include "absl/memory/memory.h"
+#include "absl/time/clock.h"
+#include "absl/time/time.h"
+#include "autolock_timer.h"
+#include "file_stat.h"
+#include "file_stat_cache.h"
+#include "gtest/gtest.h"
+#include "path.h"
+#include "unittest_util.h"
+
+namespace devtools_goma {
+
+#ifdef __linux__
+
+namespace {
+
+class RecordingObserver : public FileWatcher::Observer {
+ public:
+  void OnInvalidated(const std::string& path) override {
+    AUTOLOCK(lock, &mu_);
+    paths_.insert(path);
+  }
+  void OnInvalidatedAll() override {}
+
+  bool Contains(const std::string& path) const {
+    AUTOLOCK(lock, &mu_);
+    return paths_.contains(path);
+  }
+
+ private:
+  mutable Lock mu_;
+  absl::flat_hash_set<std::string> paths_ ABSL_GUARDED_BY(mu_);
+};
+
+// Events are notified asynchronously.
+template <typename Pred>
+bool WaitUntil(Pred pred) {
+  const absl::Time deadline = absl::Now() + absl::Seconds(10);
+  while (!pred()) {
+    if (absl::Now() > deadline) {
+      return false;
+    }
+    absl::SleepFor(absl::Milliseconds(1));
+  }
+  return true;
+}
+
+// Returns the number of directories from |abs_dir| up to the root.
+size_t NumDirsToRoot(const std::string& abs_dir) {
+  return std::count(abs_dir.begin(), abs_dir.end(), '/') + 1;
+}
+
+}  // anonymous namespace
+
+class FileWatcherTest : public testing::Test {
+ protected:
+  void SetUp() override {
+    tmpdir_ = absl::make_unique<TmpdirUtil>("file_watcher_test");
+    tmpdir_->MkdirForPath("dir", true);
+    tmpdir_->MkdirForPath("another", true);
+  }
+
+  void TearDown() override { FileWatcher::Quit(); }
+
+  std::unique_ptr<TmpdirUtil> tmpdir_;
+};
+
+TEST_F(FileWatcherTest, NotifyModification) {
+  FileWatcher::Init(16);
+  ASSERT_TRUE(FileWatcher::IsEnabled());
+  FileWatcher* watcher = FileWatcher::instance();
+  RecordingObserver observer;
+  watcher->AddObserver(&observer);
+
+  const std::string dir = tmpdir_->FullPath("dir");
+  EXPECT_TRUE(watcher->Watch(dir));
+  // Already watched.
+  EXPECT_TRUE(watcher->Watch(dir));
+  // Ancestors are watched too.
+  EXPECT_EQ(NumDirsToRoot(dir), watcher->num_watches());
+
+  tmpdir_->CreateTmpFile("dir/a.h", "");
+  EXPECT_TRUE(WaitUntil([&]() {
+    return observer.Contains(tmpdir_->FullPath("dir/a.h")) &&
+           observer.Contains(dir);
+  }));
+  EXPECT_FALSE(observer.Contains(tmpdir_->FullPath("another")));
+
+  watcher->RemoveObserver(&observer);
+}
+
+TEST_F(FileWatcherTest, WatchLimit) {
+  const std::string dir = tmpdir_->FullPath("dir");
+  FileWatcher::Init(NumDirsToRoot(dir));
+  FileWatcher* watcher = FileWatcher::instance();
+
+  EXPECT_TRUE(watcher->Watch(dir));
+  EXPECT_FALSE(watcher->Watch(tmpdir_->FullPath("another")));
+  EXPECT_EQ(NumDirsToRoot(dir), watcher->num_watches());
+}
+
+TEST_F(FileWatcherTest, WatchNonDirectory) {
+  FileWatcher::Init(16);
+  FileWatcher* watcher = FileWatcher::instance();
+
+  tmpdir_->CreateTmpFile("file", "");
+  const std::string file = tmpdir_->FullPath("file");
+  EXPECT_FALSE(watcher->Watch(file));
+  EXPECT_FALSE(watcher->Watch(tmpdir_->FullPath("nonexistent")));
+  // Only ancestors are watched.
+  EXPECT_EQ(NumDirsToRoot(std::string(file::Dirname(file))),
+            watcher->num_watches());
+}
+
+TEST_F(FileWatcherTest, GlobalFileStatCacheIsInvalidated) {
+  FileWatcher::Init(16);
+  GlobalFileStatCache::Init();
+  GlobalFileStatCache* cache = GlobalFileStatCache::Instance();
+
+  tmpdir_->CreateTmpFile("dir/a.h", "a");
+  const std::string ah = tmpdir_->FullPath("dir/a.h");
+  const std::string bh = tmpdir_->FullPath("dir/b.h");
+  EXPECT_EQ(1, cache->Get(ah).size);
+  EXPECT_FALSE(cache->Get(bh).IsValid());
+  // Parent directory and its ancestors are watched.
+  EXPECT_EQ(NumDirsToRoot(tmpdir_->FullPath("dir")),
+            FileWatcher::instance()->num_watches());
+
+  tmpdir_->CreateTmpFile("dir/a.h", "aaa");
+  tmpdir_->CreateTmpFile("dir/b.h", "bb");
+  EXPECT_TRUE(WaitUntil([&]() {
+    return cache->Get(ah).size == 3 && cache->Get(bh).size == 2;
+  }));
+
+  GlobalFileStatCache::Quit();
+}
+
+TEST_F(FileWatcherTest, GlobalFileStatCacheIsInvalidatedByMovingAncestor) {
+  FileWatcher::Init(64);
+  GlobalFileStatCache::Init();
+  GlobalFileStatCache* cache = GlobalFileStatCache::Instance();
+
+  tmpdir_->CreateTmpFile("out/gen/a.h", "a");
+  const std::string ah = tmpdir_->FullPath("out/gen/a.h");
+  EXPECT_EQ(1, cache->Get(ah).size);
+
+  // Nothing is notified in out/gen itself.
+  const std::string out = tmpdir_->FullPath("out");
+  ASSERT_EQ(0, rename(out.c_str(), tmpdir_->FullPath("out.old").c_str()));
+  tmpdir_->CreateTmpFile("out/gen/a.h", "aa");
+  EXPECT_TRUE(WaitUntil([&]() { return cache->Get(ah).size == 2; }));
+
+  // New out/gen is watched.
+  tmpdir_->CreateTmpFile("out/gen/a.h", "aaa");
+  EXPECT_TRUE(WaitUntil([&]() { return cache->Get(ah).size == 3; }));
+
+  GlobalFileStatCache::Quit();
+}
+
+TEST_F(FileWatcherTest, GlobalFileStatCacheDoesNotCacheSymlink) {
+  FileWatcher::Init(16);
+  GlobalFileStatCache::Init();
+  GlobalFileStatCache* cache = GlobalFileStatCache::Instance();
+
+  tmpdir_->CreateTmpFile("another/target.h", "a");
+  tmpdir_->CreateTmpFile("another/other.h", "bb");
+  const std::string target = tmpdir_->FullPath("another/target.h");
+  const std::string link = tmpdir_->FullPath("dir/link.h");
+  ASSERT_EQ(0, symlink(target.c_str(), link.c_str()));
+  EXPECT_EQ(1, cache->Get(link).size);
+
+  // The target is not in a watched directory, so no event is notified.
+  tmpdir_->CreateTmpFile("another/target.h", "aaa");
+  EXPECT_EQ(3, cache->Get(link).size);
+
+  // Retargets to a file in another directory.
+  const std::string new_link = tmpdir_->FullPath("another/link.h");
+  ASSERT_EQ(0, symlink(tmpdir_->FullPath("another/other.h").c_str(),
+                       new_link.c_str()));
+  ASSERT_EQ(0, rename(new_link.c_str(), link.c_str()));
+  EXPECT_TRUE(WaitUntil([&]() { return cache->Get(link).size == 2; }));
+  tmpdir_->CreateTmpFile("another/other.h", "bbbb");
+  EXPECT_EQ(4, cache->Get(link).size);
+
+  // Directory reached through symlink is not watched.
+  const std::string link_dir = tmpdir_->FullPath("link_dir");
+  ASSERT_EQ(0, symlink(tmpdir_->FullPath("another").c_str(),
+                       link_dir.c_str()));
+  const std::string via_link_dir = file::JoinPath(link_dir, "target.h");
+  EXPECT_EQ(3, cache->Get(via_link_dir).size);
+  tmpdir_->CreateTmpFile("another/target.h", "a");
+  EXPECT_EQ(1, cache->Get(via_link_dir).size);
+
+  // TmpdirUtil can't remove symlink to directory.
+  ASSERT_EQ(0, unlink(link_dir.c_str()));
+
+  GlobalFileStatCache::Quit();
+}
+
+#endif  // __linux__
+
+}  // namespace devtools_goma
@@ -39,12 +39,25 @@ class BlobClient {
     // Uploads file blob to server.
     virtual bool Upload() = 0;
 
+    // Uploads file blob to server, including its parts known to be
+    // uploaded already. Used when the server reported the file is missing.
+    virtual bool ForceUpload() { return Upload(); }
+
+    // Returns true if the server already has the file blob of hash_key(),
+    // so it doesn't need to be uploaded.  Valid after ComputeKey().
+    virtual bool IsStoredInServer() { return false; }
+
     // Embeds file blob in input.
     virtual bool Embed() = 0;
 
     // Following methods are valid only after one of above 3 methods call.
     const std::string& hash_key() const { return hash_key_; }
     virtual const HttpClient::Status& http_status() const = 0;
+    // Time spent to read, hash and store the file.
+    virtual FileServiceClient::CreateFileBlobStats create_file_blob_stats()
+        const {
+      return FileServiceClient::CreateFileBlobStats();
+    }
 
     // Fills in input.
     virtual bool GetInput(ExecReq_Input* input) const = 0;
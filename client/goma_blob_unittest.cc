@@ -6,17 +6,21 @@
 
 #include <memory>
 #include <string>
+#include <vector>
 
 #include "absl/memory/memory.h"
 #include "basictypes.h"
 #include "compiler_specific.h"
 #include "file_helper.h"
+#include "goma_data_util.h"
 #include "goma_file_http.h"
 MSVC_PUSH_DISABLE_WARNING_FOR_PROTO()
 #include "lib/goma_data.pb.h"
 MSVC_POP_WARNING()
 #include "gtest/gtest.h"
 #include "scoped_tmp_file.h"
+#include "stored_file_chunk_cache.h"
+#include "worker_thread_manager.h"
 
 namespace devtools_goma {
 
@@ -256,4 +260,117 @@ TEST(FileBlobClient, ExampleDownloadEmbedded) {
             info_string.content);
 }
 
+TEST(FileServiceHttpClient, CreateFileBlobWithChunkHashPool) {
+  // 5 chunks and a partial chunk.
+  const size_t kFileSize = 5 * 2 * 1024 * 1024 + 12345;
+  std::string content(kFileSize, '\0');
+  for (size_t i = 0; i < content.size(); ++i) {
+    content[i] = static_cast<char>(i * 31 / 7);
+  }
+  ScopedTmpFile temp_file("large");
+  ASSERT_TRUE(temp_file.valid());
+  ASSERT_EQ(static_cast<ssize_t>(content.size()),
+            temp_file.Write(content.data(), content.size()));
+  ASSERT_TRUE(temp_file.Close());
+
+  ExampleFileServiceHttpClient serial_client;
+  FileBlob serial_blob;
+  ASSERT_TRUE(serial_client.CreateFileBlob(temp_file.filename(), false,
+                                           &serial_blob));
+  EXPECT_EQ(FileBlob::FILE_META, serial_blob.blob_type());
+  EXPECT_EQ(6, serial_blob.hash_key_size());
+
+  WorkerThreadManager wm;
+  wm.Start(1);
+  ExampleFileServiceHttpClient parallel_client;
+  parallel_client.SetChunkHashPool(&wm, wm.StartPool(2, "file_chunk_hash"));
+  FileBlob parallel_blob;
+  ASSERT_TRUE(parallel_client.CreateFileBlob(temp_file.filename(), false,
+                                             &parallel_blob));
+  wm.Finish();
+
+  EXPECT_EQ(serial_blob.SerializeAsString(),
+            parallel_blob.SerializeAsString());
+  EXPECT_EQ(ComputeFileBlobHashKey(serial_blob),
+            ComputeFileBlobHashKey(parallel_blob));
+  EXPECT_GT(parallel_client.create_file_blob_stats().read_time,
+            absl::ZeroDuration());
+  EXPECT_GT(parallel_client.create_file_blob_stats().hash_time,
+            absl::ZeroDuration());
+}
+
+// Local stand-in of file service, which records offsets of stored chunks.
+class RecordingFileServiceHttpClient : public ExampleFileServiceHttpClient {
+ public:
+  bool StoreFile(const StoreFileReq* req, StoreFileResp* resp) override {
+    for (const auto& blob : req->blob()) {
+      stored_offsets_.push_back(blob.offset());
+      resp->add_hash_key(ComputeFileBlobHashKey(blob));
+    }
+    return true;
+  }
+
+  const std::vector<int64_t>& stored_offsets() const {
+    return stored_offsets_;
+  }
+
+ private:
+  std::vector<int64_t> stored_offsets_;
+};
+
+TEST(FileServiceHttpClient, CreateFileBlobSkipsStoredChunks) {
+  const int64_t kChunkSize = 2 * 1024 * 1024;
+  // 5 chunks and a partial chunk.
+  std::string content(5 * kChunkSize + 12345, '\0');
+  for (size_t i = 0; i < content.size(); ++i) {
+    content[i] = static_cast<char>(i * 31 / 7);
+  }
+  ScopedTmpFile temp_file("large");
+  ASSERT_TRUE(temp_file.valid());
+  ASSERT_EQ(static_cast<ssize_t>(content.size()),
+            temp_file.Write(content.data(), content.size()));
+  ASSERT_TRUE(temp_file.Close());
+
+  StoredFileChunkCache::Init(100);
+
+  RecordingFileServiceHttpClient first_client;
+  FileBlob first_blob;
+  ASSERT_TRUE(first_client.CreateFileBlob(temp_file.filename(), true,
+                                          &first_blob));
+  EXPECT_EQ(6, first_blob.hash_key_size());
+  EXPECT_EQ(6U, first_client.stored_offsets().size());
+  EXPECT_EQ(0, first_client.create_file_blob_stats().num_skipped_chunks);
+
+  // Modify a byte in the 3rd chunk, and append some data.
+  content[2 * kChunkSize + 10] ^= 1;
+  content.append(100, 'x');
+  ASSERT_TRUE(WriteStringToFile(content, temp_file.filename()));
+
+  RecordingFileServiceHttpClient second_client;
+  FileBlob second_blob;
+  ASSERT_TRUE(second_client.CreateFileBlob(temp_file.filename(), true,
+                                           &second_blob));
+  EXPECT_EQ(6, second_blob.hash_key_size());
+  // Only modified chunks are stored.
+  EXPECT_EQ(std::vector<int64_t>({2 * kChunkSize, 5 * kChunkSize}),
+            second_client.stored_offsets());
+  EXPECT_EQ(6, second_client.create_file_blob_stats().num_chunks);
+  EXPECT_EQ(4, second_client.create_file_blob_stats().num_skipped_chunks);
+  for (int i : {0, 1, 3, 4}) {
+    EXPECT_EQ(first_blob.hash_key(i), second_blob.hash_key(i));
+  }
+  EXPECT_EQ(4, StoredFileChunkCache::instance()->hit());
+
+  // e.g. the server reported the file is missing.
+  RecordingFileServiceHttpClient third_client;
+  third_client.set_skip_stored_chunks(false);
+  FileBlob third_blob;
+  ASSERT_TRUE(third_client.CreateFileBlob(temp_file.filename(), true,
+                                          &third_blob));
+  EXPECT_EQ(6U, third_client.stored_offsets().size());
+  EXPECT_EQ(second_blob.SerializeAsString(), third_blob.SerializeAsString());
+
+  StoredFileChunkCache::Quit();
+}
+
 }  // namespace devtools_goma
@@ -9,14 +9,19 @@
 #include <utility>
 
 #include "absl/memory/memory.h"
+#include "autolock_timer.h"
+#include "callback.h"
 #include "compiler_specific.h"
 #include "glog/logging.h"
 MSVC_PUSH_DISABLE_WARNING_FOR_PROTO()
 #include "lib/goma_data.pb.h"
 MSVC_POP_WARNING()
+#include "goma_data_util.h"
 #include "goma_file.h"
 #include "http_rpc.h"
 #include "lockhelper.h"
+#include "stored_file_chunk_cache.h"
+#include "worker_thread_manager.h"
 
 namespace {
 
@@ -71,6 +76,26 @@ class HttpTask : public devtools_goma::FileServiceClient::AsyncTask<Req, Resp> {
 
 namespace devtools_goma {
 
+namespace {
+
+struct ChunkHashState {
+  Lock mu;
+  ConditionVariable cond;
+  size_t num_pending ABSL_GUARDED_BY(mu) = 0;
+};
+
+void ComputeChunkHashKey(const FileBlob* chunk,
+                         std::string* hash_key,
+                         ChunkHashState* state) {
+  *hash_key = ComputeFileBlobHashKey(*chunk);
+  AUTOLOCK(lock, &state->mu);
+  if (--state->num_pending == 0) {
+    state->cond.Signal();
+  }
+}
+
+}  // anonymous namespace
+
 FileServiceHttpClient::FileServiceHttpClient(HttpRPC* http,
                                              std::string store_path,
                                              std::string lookup_path,
@@ -94,9 +119,60 @@ FileServiceHttpClient::WithRequesterInfoAndTraceId(
   cloned->requester_info_ = absl::make_unique<RequesterInfo>();
   *cloned->requester_info_ = requester_info;
   cloned->trace_id_ = trace_id;
+  cloned->wm_ = wm_;
+  cloned->chunk_hash_pool_ = chunk_hash_pool_;
+  cloned->multi_file_lookup_ = multi_file_lookup_;
   return cloned;
 }
 
+void FileServiceHttpClient::SetChunkHashPool(WorkerThreadManager* wm,
+                                             int pool) {
+  wm_ = wm;
+  chunk_hash_pool_ = pool;
+}
+
+std::vector<std::string> FileServiceHttpClient::ComputeChunkHashKeys(
+    const std::vector<const FileBlob*>& chunks) {
+  if (wm_ == nullptr || chunks.size() <= 1) {
+    return FileServiceClient::ComputeChunkHashKeys(chunks);
+  }
+
+  std::vector<std::string> hash_keys(chunks.size());
+  ChunkHashState state;
+  {
+    AUTOLOCK(lock, &state.mu);
+    state.num_pending = chunks.size() - 1;
+  }
+  for (size_t i = 1; i < chunks.size(); ++i) {
+    wm_->RunClosureInPool(
+        FROM_HERE, chunk_hash_pool_,
+        NewCallback(&ComputeChunkHashKey, chunks[i], &hash_keys[i], &state),
+        WorkerThread::PRIORITY_MED);
+  }
+  // This thread also computes one, instead of just waiting.
+  hash_keys[0] = ComputeFileBlobHashKey(*chunks[0]);
+
+  AUTOLOCK(lock, &state.mu);
+  while (state.num_pending > 0) {
+    state.cond.Wait(&state.mu);
+  }
+  return hash_keys;
+}
+
+bool FileServiceHttpClient::IsChunkStored(const std::string& hash_key) {
+  if (!StoredFileChunkCache::IsEnabled()) {
+    return false;
+  }
+  return StoredFileChunkCache::instance()->Lookup(hash_key);
+}
+
+void FileServiceHttpClient::OnChunkStored(const std::string& hash_key) {
+  if (!StoredFileChunkCache::IsEnabled()) {
+    return;
+  }
+  StoredFileChunkCache::instance()->Insert(hash_key);
+}
+
 std::unique_ptr<FileServiceClient::AsyncTask<StoreFileReq, StoreFileResp>>
 FileServiceHttpClient::NewAsyncStoreFileTask() {
   return std::unique_ptr<
@@ -143,6 +219,34 @@ bool FileServiceHttpClient::LookupFile(
   return ret;
 }
 
+bool FileServiceHttpClient::HasFileBlob(const std::string& hash_key) {
+  if (multi_file_lookup_ == nullptr) {
+    return false;
+  }
+  LookupFileReq req;
+  LookupFileResp resp;
+  req.add_hash_key(hash_key);
+  if (requester_info_ != nullptr) {
+    *req.mutable_requester_info() = *requester_info_;
+  }
+  HttpRPC::Status status;
+  std::ostringstream ss;
+  if (!trace_id_.empty()) {
+    ss << trace_id_ << " ";
+  }
+  ss << "LookupFile " << hash_key;
+  status.trace_id = ss.str();
+  status.timeout_should_be_http_error = false;
+  multi_file_lookup_->LookupFile(&status, &req, &resp, nullptr);
+  http_->Wait(&status);
+  AddHttpRPCStatus(status);
+  if (status.err != 0) {
+    LOG(WARNING) << status.trace_id << " failed: " << status.err_message;
+    return false;
+  }
+  return resp.blob_size() == 1 && IsValidFileBlob(resp.blob(0));
+}
+
 void FileServiceHttpClient::AddHttpRPCStatus(const HttpRPC::Status& status) {
   ++num_rpc_;
   status_.req_size += status.req_size;
@@ -8,6 +8,7 @@
 
 #include <memory>
 #include <string>
+#include <vector>
 
 #include "goma_file.h"
 #include "http_rpc.h"
@@ -17,6 +18,7 @@ namespace devtools_goma {
 
 class Closure;
 class RequesterInfo;
+class WorkerThreadManager;
 
 class FileServiceHttpClient : public FileServiceClient {
  public:
@@ -27,6 +29,16 @@ class FileServiceHttpClient : public FileServiceClient {
                         MultiFileStore* multi_file_store);
   ~FileServiceHttpClient() override;
 
+  // Computes hash keys of file chunks concurrently in |pool| of |wm|.
+  // It doesn't take ownership of |wm|.
+  void SetChunkHashPool(WorkerThreadManager* wm, int pool);
+
+  // Looks up file blobs with |multi_file_lookup| in HasFileBlob().
+  // It doesn't take ownership of |multi_file_lookup|.
+  void SetMultiFileLookup(MultiFileLookup* multi_file_lookup) {
+    multi_file_lookup_ = multi_file_lookup;
+  }
+
   // This function doesn't clone |status_|.
   std::unique_ptr<FileServiceHttpClient> WithRequesterInfoAndTraceId(
       const RequesterInfo& requester_info,
@@ -40,6 +52,11 @@ class FileServiceHttpClient : public FileServiceClient {
   bool StoreFile(const StoreFileReq* req, StoreFileResp* resp) override;
   bool LookupFile(const LookupFileReq* req, LookupFileResp* resp) override;
 
+  // Returns true if file service already has a valid blob of |hash_key|.
+  // The lookup is batched with concurrent ones by MultiFileLookup.
+  // Returns false if MultiFileLookup is not set, or the lookup failed.
+  bool HasFileBlob(const std::string& hash_key);
+
   HttpRPC* http() { return http_; }
 
   void AddHttpRPCStatus(const HttpRPC::Status& status);
@@ -50,6 +67,13 @@ class FileServiceHttpClient : public FileServiceClient {
     return multi_file_store_;
   }
 
+ protected:
+  std::vector<std::string> ComputeChunkHashKeys(
+      const std::vector<const FileBlob*>& chunks) override;
+  // Uses StoredFileChunkCache if it is enabled.
+  bool IsChunkStored(const std::string& hash_key) override;
+  void OnChunkStored(const std::string& hash_key) override;
+
  private:
   HttpRPC* http_;
   const std::string store_path_;
@@ -62,6 +86,13 @@ class FileServiceHttpClient : public FileServiceClient {
   // for multi store
   MultiFileStore* multi_file_store_;
 
+  // for batched lookup before store.
+  MultiFileLookup* multi_file_lookup_ = nullptr;
+
+  // for chunk hash.
+  WorkerThreadManager* wm_ = nullptr;
+  int chunk_hash_pool_ = 0;
+
   DISALLOW_COPY_AND_ASSIGN(FileServiceHttpClient);
 };
 
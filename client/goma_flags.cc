@@ -223,6 +223,16 @@ GOMA_DEFINE_int32(COMPILER_PROXY_PORT, DEFAULT_COMPILER_PROXY_PORT,
 
 GOMA_DEFINE_bool(COMPILER_PROXY_REUSE_CONNECTION, true,
                  "Connection is reused for multiple rpcs.");
+GOMA_DEFINE_bool(USE_HTTP2, false,
+                 "Multiplex rpcs on HTTP/2 connections. "
+                 "Falls back to HTTP/1.1 if the server doesn't support h2.");
+GOMA_DEFINE_int32(HTTP2_MAX_CONNECTIONS, 2,
+                  "Max number of HTTP/2 connections to the server.");
+GOMA_DEFINE_int32(HTTP_PREWARM_SOCKETS, 4,
+                  "Number of HTTP/1.1 connections to the server to open in "
+                  "advance when requests start after idle. TLS handshake is "
+                  "also done in advance unless a proxy is used. "
+                  "0 to disable.");
 
 // See  http://smallvoid.com/article/winnt-tcpip-max-limit.html
 // Remember to read the comments by the author.  For Vista/Win7 (where goma is
@@ -242,6 +252,10 @@ GOMA_DEFINE_AUTOCONF_int32(COMPILER_PROXY_HTTP_THREADS,
                            "http/ipc request.");
 GOMA_DEFINE_AUTOCONF_int32(INCLUDE_PROCESSOR_THREADS, NumDefaultProxyThreads,
                            "Number of threads for include processor.");
+GOMA_DEFINE_int32(INCLUDE_PREFETCH_THREADS, 0,
+                  "Number of threads to read and parse headers ahead of "
+                  "include processor. Helps huge translation units, e.g. "
+                  "jumbo builds. 0 to disable.");
 #ifdef _WIN32
 #define DEFAULT_MAX_OVERCOMIT_INCOMING_SOCKETS 64
 #else
@@ -295,7 +309,14 @@ GOMA_DEFINE_int32(LOCAL_RUN_PREFERENCE, 3,
 GOMA_DEFINE_bool(LOCAL_RUN_FOR_FAILED_INPUT, true,
                  "Prefer local run for previous failed input filename. ");
 GOMA_DEFINE_int32(LOCAL_RUN_DELAY_MSEC, 0,
-                  "msec to delay for idle fallback.");
+                  "msec to delay for idle fallback. "
+                  "Not used once LOCAL_RACE_POLICY learned the command.");
+GOMA_DEFINE_bool(LOCAL_RACE_POLICY, true,
+                 "Decide when to start local run racing against goma from "
+                 "history of goma and local durations per command. "
+                 "Local run starts immediately only if it is expected to "
+                 "finish earlier than 90 percentile of goma, considering "
+                 "pending local runs. Otherwise it starts after that.");
 GOMA_DEFINE_AUTOCONF_int32(
     MAX_SUBPROCS,
     MaxSubProcs,
@@ -325,6 +346,16 @@ GOMA_DEFINE_AUTOCONF_int32(BURST_MAX_SUBPROCS_LOW, MaxBurstSubProcs,
 GOMA_DEFINE_AUTOCONF_int32(BURST_MAX_SUBPROCS_HEAVY, MaxBurstSubProcsHeavy,
                            "Maximum number of subprocesses with heavy weight "
                            "when remote server is not available.");
+GOMA_DEFINE_bool(RESOURCE_AWARE_SUBPROCS, true,
+                 "Defer starting subprocesses while the host is under memory "
+                 "or CPU pressure (Linux PSI, load average, available "
+                 "memory and memory cgroup), even if below MAX_SUBPROCS. "
+                 "Subprocess memory usage is estimated from past "
+                 "subprocesses.");
+GOMA_DEFINE_bool(DIRECT_SPAWN_SUBPROCS, true,
+                 "Spawn subprocesses with vfork and exec on Linux, without "
+                 "forking a monitor process for each subprocess. "
+                 "Detached subprocesses always use a monitor process.");
 GOMA_DEFINE_int32(MAX_SUBPROCS_PENDING, 3,
                   "Threshold to prefer local run to remote goma.");
 // TODO: autoconf
@@ -354,8 +385,44 @@ GOMA_DEFINE_int32(MULTI_STORE_IN_CALL, 128,
                   "Number of FileBlob in StoreFileReq");
 GOMA_DEFINE_int32(MULTI_STORE_THRESHOLD_SIZE_IN_CALL, 12 * 1024 * 1024,
                   "Threshold size to issue StoreFileReq");
+GOMA_DEFINE_int32(FILE_CHUNK_HASH_THREADS, 4,
+                  "Number of threads to compute hash keys of chunks of "
+                  "large input files concurrently. 0 to compute them in "
+                  "the thread reading the file.");
+GOMA_DEFINE_int32(MAX_STORED_FILE_CHUNK_CACHE_ENTRIES, 65536,
+                  "The max count of hash keys of file chunks remembered as "
+                  "stored, so that unchanged chunks of modified large files "
+                  "are not uploaded again. 0 to disable.");
 GOMA_DEFINE_int32(MULTI_STORE_PENDING_MS, 100,
                   "Pending time in ms to issue StoreFileReq.");
+GOMA_DEFINE_bool(MULTI_RPC_ADAPTIVE_BATCHING, false,
+                 "If true, adapts the number of requests, the request size "
+                 "threshold and the pending time of StoreFileReq and "
+                 "LookupFileReq to observed latency and throughput. "
+                 "MULTI_STORE_* and MULTI_LOOKUP_* become upper bounds.");
+GOMA_DEFINE_int32(MULTI_RPC_MIN_PENDING_MS, 5,
+                  "Min pending time in ms to issue StoreFileReq and "
+                  "LookupFileReq with MULTI_RPC_ADAPTIVE_BATCHING.");
+GOMA_DEFINE_int32(EXEC_HEDGE_BUDGET_PERCENT, 0,
+                  "Max percentage of ExecReq that may be hedged, i.e. "
+                  "duplicated when it doesn't return in the hedge delay. "
+                  "0 to disable hedging.");
+GOMA_DEFINE_int32(EXEC_HEDGE_PERCENTILE, 95,
+                  "Percentile of RPC call time used as the hedge delay of "
+                  "ExecReq with EXEC_HEDGE_BUDGET_PERCENT.");
+GOMA_DEFINE_int32(EXEC_HEDGE_MIN_DELAY_MS, 1000,
+                  "Min hedge delay in ms of ExecReq with "
+                  "EXEC_HEDGE_BUDGET_PERCENT.");
+GOMA_DEFINE_bool(LOOKUP_FILE_BEFORE_STORE, true,
+                 "If true, looks up large input files in file service before "
+                 "storing them, so that files the server already has are "
+                 "not uploaded.");
+GOMA_DEFINE_int32(MULTI_LOOKUP_IN_CALL, 128,
+                  "Number of hash keys in LookupFileReq to look up files "
+                  "before storing them.");
+GOMA_DEFINE_int32(MULTI_LOOKUP_PENDING_MS, 20,
+                  "Pending time in ms to issue LookupFileReq to look up files "
+                  "before storing them.");
 GOMA_DEFINE_int32(NUM_LOG_IN_SAVE_LOG, 512,
                   "Number of ExecLog in SaveLogReq");
 GOMA_DEFINE_int32(LOG_PENDING_MS, 30 * 1000,
@@ -375,8 +442,17 @@ GOMA_DEFINE_bool(ENABLE_GCH_HACK, false,
 GOMA_DEFINE_int32(MAX_INCLUDE_CACHE_ENTRIES,
                   140000,
                   "The max count of include cache.");
+GOMA_DEFINE_bool(DIRECTIVE_SNAPSHOT, false,
+                 "If true, parsed directives of headers in system include "
+                 "directories are saved in the cache directory when "
+                 "compiler_proxy quits, and loaded when a compiler with "
+                 "the same system include directories is used first.");
 GOMA_DEFINE_int32(MAX_LIST_DIR_CACHE_ENTRY_NUM, 32768,
                   "The entry limit in list dir cache.");
+GOMA_DEFINE_int32(MAX_INCLUDE_RESOLUTION_CACHE_ENTRIES, 262144,
+                  "The max count of include resolution cache, which shares "
+                  "the results of include file lookup among compile tasks. "
+                  "0 to disable.");
 GOMA_DEFINE_bool(ENABLE_REMOTE_CLANG_MODULES,
                  false,
                  "Experimental: Enable clang modules (-fmodules) support.");
@@ -460,6 +536,19 @@ GOMA_DEFINE_int32(DEPS_CACHE_MAX_PROTO_SIZE_IN_MB,
                   "The max size of DepsCache file. If the file size exceeds "
                   "this limit, loading will fail. Unit is MB."
                   "If negative, the default limit is used. i.e. INT_MAX");
+GOMA_DEFINE_bool(DEPS_CACHE_FLAT_FILE, false,
+                 "If true, DepsCache file is saved in flat binary format, "
+                 "which is mmapped on load and its entries are read on "
+                 "demand, instead of parsing the whole protobuf.");
+GOMA_DEFINE_string(FILE_HASH_CACHE_FILE, "",
+                   "Path to the FileHashCache cache file. If set, hash keys "
+                   "of files are kept across compiler_proxy restarts, so "
+                   "files are not rehashed if they are not modified. "
+                   "If empty, file hash cache won't be persisted. "
+                   "If not absolute path, it will be in GOMA_CACHE_DIR.");
+GOMA_DEFINE_int32(FILE_HASH_CACHE_ALIVE_DURATION, 24 * 3600,
+                  "File hash cache file older than this value (in second) "
+                  "is ignored in loading. If negative, it is always loaded.");
 GOMA_DEFINE_string(COMPILER_INFO_CACHE_FILE, "compiler_info_cache",
                    "Filename of compiler_info's cache. "
                    "If empty, compiler_info cache file is not used. "
@@ -469,6 +558,13 @@ GOMA_DEFINE_bool(ENABLE_GLOBAL_FILE_STAT_CACHE,
                  "Enable global file stat cache. "
                  "Do not enable this flag when any source file would be "
                  "changed between compilations.");
+GOMA_DEFINE_int32(FILE_WATCHER_MAX_WATCHES, 0,
+                  "The max number of directories watched by inotify. "
+                  "If positive, global file stat cache is enabled, and "
+                  "file stats in watched directories are invalidated by "
+                  "inotify events instead of stat on each compile. "
+                  "Files in directories beyond the limit are always "
+                  "stat-ed. Only supported on Linux. 0 to disable.");
 GOMA_DEFINE_int32(COMPILER_INFO_CACHE_NUM_ENTRIES,
                   10000,
                   "Maximum number of entries of CompilerInfo in cache "
@@ -477,6 +573,16 @@ GOMA_DEFINE_int32(COMPILER_INFO_CACHE_HOLDING_TIME_SEC, 60 * 60 * 24 * 30,
                   "CompilerInfo is not evicted if it is used within "
                   "COMPILER_INFO_CACHE_HOLDING_TIME_SEC. "
                   "Otherwise it is evicted when it is loaded from file.");
+GOMA_DEFINE_bool(COMPILER_INFO_CACHE_JOURNAL, true,
+                 "If true, updates of compiler_info cache are appended to "
+                 "journal file next to COMPILER_INFO_CACHE_FILE, so that "
+                 "they are not lost even if compiler_proxy exits uncleanly. "
+                 "The journal is compacted into COMPILER_INFO_CACHE_FILE "
+                 "when it gets larger than the cache file.");
+GOMA_DEFINE_int32(COMPILER_INFO_CACHE_JOURNAL_SYNC_INTERVAL_SEC, 10,
+                  "Interval in seconds to fsync or compact compiler_info "
+                  "cache journal. If 0 or negative, it is done only at "
+                  "exit.");
 GOMA_DEFINE_string(DUMP_STATS_FILE, "",
                    "Filename to dump stats at the end of compiler_proxy."
                    "If empty, nothing will be dumped.");
@@ -668,7 +774,13 @@ GOMA_DEFINE_int32(HTTP_RPC_COMPRESSION_LEVEL, 3,
                   "0 forces to disable compression.");
 GOMA_DEFINE_string(HTTP_ACCEPT_ENCODING,
                    "gzip",
-                   "Accept-Encoding of goma's requests (e.g., lzma2)");
+                   "Accept-Encoding of goma's requests (e.g., zstd, lzma2)");
+GOMA_DEFINE_string(HTTP_RPC_ZSTD_DICTIONARY, "",
+                   "Path to zstd dictionary to compress ExecReq with, "
+                   "e.g. trained by `zstd --train` with ExecReqs dumped in "
+                   "exec_req.data.  Its ID is sent to the server, and it "
+                   "is used only if zstd is negotiated and the server "
+                   "acknowledged the ID.");
 GOMA_DEFINE_bool(HTTP_RPC_START_COMPRESSION, true,
                  "Starts with compressed request. "
                  "Compression will be enabled/disabled by Accept-Encoding "
@@ -0,0 +1,116 @@
+// Copyright 2020 The Goma Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "hedge_policy.h"
+
+#include <algorithm>
+#include <sstream>
+
+#include "autolock_timer.h"
+#include "compiler_specific.h"
+#include "glog/logging.h"
+
+MSVC_PUSH_DISABLE_WARNING_FOR_PROTO()
+#include "lib/goma_stats.pb.h"
+MSVC_POP_WARNING()
+
+namespace devtools_goma {
+
+HedgePolicy::HedgePolicy(const Options& options)
+    : options_(options), budget_(options.max_budget) {
+  CHECK_GT(options_.percentile, 0);
+  CHECK_LT(options_.percentile, 100);
+  CHECK_GE(options_.budget_ratio, 0);
+  CHECK_GE(options_.max_budget, 1);
+}
+
+void HedgePolicy::UpdateDelay(int64_t num_samples,
+                              absl::Duration percentile_latency) {
+  AUTOLOCK(lock, &mu_);
+  if (num_samples < options_.min_samples) {
+    return;
+  }
+  delay_ = std::max(percentile_latency, options_.min_delay);
+  VLOG(1) << "hedge delay=" << *delay_ << " num_samples=" << num_samples;
+}
+
+absl::optional<absl::Duration> HedgePolicy::OnRequest() {
+  AUTOLOCK(lock, &mu_);
+  ++num_requests_;
+  budget_ = std::min(budget_ + options_.budget_ratio, options_.max_budget);
+  return delay_;
+}
+
+bool HedgePolicy::TryHedge() {
+  AUTOLOCK(lock, &mu_);
+  if (budget_ < 1) {
+    ++num_budget_exhausted_;
+    return false;
+  }
+  budget_ -= 1;
+  ++num_hedged_;
+  return true;
+}
+
+void HedgePolicy::OnHedgeDone(bool hedge_won) {
+  AUTOLOCK(lock, &mu_);
+  if (hedge_won) {
+    ++num_hedge_won_;
+  }
+}
+
+absl::optional<absl::Duration> HedgePolicy::delay() const {
+  AUTOLOCK(lock, &mu_);
+  return delay_;
+}
+
+int64_t HedgePolicy::num_requests() const {
+  AUTOLOCK(lock, &mu_);
+  return num_requests_;
+}
+
+int64_t HedgePolicy::num_hedged() const {
+  AUTOLOCK(lock, &mu_);
+  return num_hedged_;
+}
+
+int64_t HedgePolicy::num_hedge_won() const {
+  AUTOLOCK(lock, &mu_);
+  return num_hedge_won_;
+}
+
+int64_t HedgePolicy::num_budget_exhausted() const {
+  AUTOLOCK(lock, &mu_);
+  return num_budget_exhausted_;
+}
+
+void HedgePolicy::DumpStatsToProto(HttpRPCStats* stats) const {
+  AUTOLOCK(lock, &mu_);
+  stats->set_exec_query(num_requests_);
+  stats->set_exec_hedged(num_hedged_);
+  stats->set_exec_hedge_won(num_hedge_won_);
+  stats->set_exec_hedge_budget_exhausted(num_budget_exhausted_);
+  if (delay_) {
+    stats->set_exec_hedge_delay_ms(absl::ToInt64Milliseconds(*delay_));
+  }
+}
+
+std::string HedgePolicy::DebugString() const {
+  AUTOLOCK(lock, &mu_);
+  std::ostringstream ss;
+  ss << "delay=";
+  if (delay_) {
+    ss << *delay_;
+  } else {
+    ss << "unknown";
+  }
+  ss << " budget=" << budget_
+     << " requests=" << num_requests_
+     << " hedged=" << num_hedged_
+     << " hedge_won=" << num_hedge_won_
+     << " budget_exhausted=" << num_budget_exhausted_;
+  return ss.str();
+}
+
+}  // namespace devtools_goma
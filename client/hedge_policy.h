@@ -0,0 +1,91 @@
+// Copyright 2020 The Goma Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#ifndef DEVTOOLS_GOMA_CLIENT_HEDGE_POLICY_H_
+#define DEVTOOLS_GOMA_CLIENT_HEDGE_POLICY_H_
+
+#include <stdint.h>
+
+#include <string>
+
+#include "absl/base/thread_annotations.h"
+#include "absl/time/time.h"
+#include "absl/types/optional.h"
+#include "basictypes.h"
+#include "lockhelper.h"
+
+namespace devtools_goma {
+
+class HttpRPCStats;
+
+// HedgePolicy decides when a duplicate (hedged) request is issued for a
+// request that hasn't returned yet, and whether it is allowed to.
+//
+// The hedge delay is the |percentile| latency of requests, so roughly
+// (100 - |percentile|)% of requests that are slower than usual are hedged.
+// It is unknown until |min_samples| requests are observed, and it is never
+// shorter than |min_delay|.
+// The extra load is capped by a token bucket: each request earns
+// |budget_ratio| tokens up to |max_budget|, and each hedge spends a token.
+// So hedges are at most |budget_ratio| of requests in the long run, even
+// when the backend is slow overall and most requests exceed the delay.
+//
+// This class is thread-safe.
+class HedgePolicy {
+ public:
+  struct Options {
+    double percentile = 95;
+    int64_t min_samples = 100;
+    absl::Duration min_delay = absl::Seconds(1);
+    double budget_ratio = 0.05;
+    double max_budget = 10;
+  };
+
+  explicit HedgePolicy(const Options& options);
+
+  const Options& options() const { return options_; }
+
+  // Updates the hedge delay from |percentile_latency|, the |percentile|
+  // latency of |num_samples| requests.
+  void UpdateDelay(int64_t num_samples, absl::Duration percentile_latency)
+      ABSL_LOCKS_EXCLUDED(mu_);
+
+  // Records a new request and returns the delay after which it should be
+  // hedged, or nullopt if it should not be hedged.
+  absl::optional<absl::Duration> OnRequest() ABSL_LOCKS_EXCLUDED(mu_);
+
+  // Returns true if a hedged request can be issued now, and spends
+  // the budget for it.
+  bool TryHedge() ABSL_LOCKS_EXCLUDED(mu_);
+
+  // Records the result of a hedged request.  |hedge_won| is true if the
+  // hedged request finished successfully before the original one.
+  void OnHedgeDone(bool hedge_won) ABSL_LOCKS_EXCLUDED(mu_);
+
+  absl::optional<absl::Duration> delay() const ABSL_LOCKS_EXCLUDED(mu_);
+  int64_t num_requests() const ABSL_LOCKS_EXCLUDED(mu_);
+  int64_t num_hedged() const ABSL_LOCKS_EXCLUDED(mu_);
+  int64_t num_hedge_won() const ABSL_LOCKS_EXCLUDED(mu_);
+  int64_t num_budget_exhausted() const ABSL_LOCKS_EXCLUDED(mu_);
+
+  void DumpStatsToProto(HttpRPCStats* stats) const ABSL_LOCKS_EXCLUDED(mu_);
+  std::string DebugString() const ABSL_LOCKS_EXCLUDED(mu_);
+
+ private:
+  const Options options_;
+
+  mutable Lock mu_;
+  absl::optional<absl::Duration> delay_ ABSL_GUARDED_BY(mu_);
+  double budget_ ABSL_GUARDED_BY(mu_);
+  int64_t num_requests_ ABSL_GUARDED_BY(mu_) = 0;
+  int64_t num_hedged_ ABSL_GUARDED_BY(mu_) = 0;
+  int64_t num_hedge_won_ ABSL_GUARDED_BY(mu_) = 0;
+  int64_t num_budget_exhausted_ ABSL_GUARDED_BY(mu_) = 0;
+
+  DISALLOW_COPY_AND_ASSIGN(HedgePolicy);
+};
+
+}  // namespace devtools_goma
+
+#endif  // DEVTOOLS_GOMA_CLIENT_HEDGE_POLICY_H_
@@ -0,0 +1,113 @@
+// Copyright 2020 The Goma Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "hedge_policy.h"
+
+#include "gtest/gtest.h"
+#include "lib/goma_stats.pb.h"
+
+namespace devtools_goma {
+
+namespace {
+
+HedgePolicy::Options TestOptions() {
+  HedgePolicy::Options options;
+  options.percentile = 95;
+  options.min_samples = 100;
+  options.min_delay = absl::Milliseconds(500);
+  options.budget_ratio = 0.125;
+  options.max_budget = 2;
+  return options;
+}
+
+}  // anonymous namespace
+
+TEST(HedgePolicyTest, NoHedgeUntilEnoughSamples) {
+  HedgePolicy policy(TestOptions());
+  EXPECT_FALSE(policy.OnRequest());
+
+  policy.UpdateDelay(99, absl::Seconds(3));
+  EXPECT_FALSE(policy.OnRequest());
+
+  policy.UpdateDelay(100, absl::Seconds(3));
+  EXPECT_EQ(absl::Seconds(3), policy.OnRequest());
+  EXPECT_EQ(3, policy.num_requests());
+}
+
+TEST(HedgePolicyTest, MinDelay) {
+  HedgePolicy policy(TestOptions());
+  policy.UpdateDelay(1000, absl::Milliseconds(10));
+  EXPECT_EQ(absl::Milliseconds(500), policy.delay());
+
+  policy.UpdateDelay(1000, absl::Seconds(2));
+  EXPECT_EQ(absl::Seconds(2), policy.delay());
+}
+
+TEST(HedgePolicyTest, Budget) {
+  HedgePolicy policy(TestOptions());
+  policy.UpdateDelay(1000, absl::Seconds(1));
+
+  // Starts with the max budget.
+  EXPECT_TRUE(policy.TryHedge());
+  EXPECT_TRUE(policy.TryHedge());
+  EXPECT_FALSE(policy.TryHedge());
+  EXPECT_EQ(2, policy.num_hedged());
+  EXPECT_EQ(1, policy.num_budget_exhausted());
+
+  // Each request earns 1/8.
+  for (int i = 0; i < 7; ++i) {
+    policy.OnRequest();
+  }
+  EXPECT_FALSE(policy.TryHedge());
+  policy.OnRequest();
+  EXPECT_TRUE(policy.TryHedge());
+  EXPECT_FALSE(policy.TryHedge());
+
+  // Budget doesn't exceed the max even after many requests.
+  for (int i = 0; i < 1000; ++i) {
+    policy.OnRequest();
+  }
+  EXPECT_TRUE(policy.TryHedge());
+  EXPECT_TRUE(policy.TryHedge());
+  EXPECT_FALSE(policy.TryHedge());
+}
+
+TEST(HedgePolicyTest, HedgeRateIsBoundedWhenAllRequestsAreSlow) {
+  HedgePolicy policy(TestOptions());
+  policy.UpdateDelay(1000, absl::Seconds(1));
+  for (int i = 0; i < 10000; ++i) {
+    if (policy.OnRequest()) {
+      policy.TryHedge();
+    }
+  }
+  // 1/8 of requests, plus the initial budget.
+  EXPECT_LE(policy.num_hedged(), 10000 / 8 + 2);
+  EXPECT_GE(policy.num_hedged(), 10000 / 8 - 1);
+}
+
+TEST(HedgePolicyTest, DumpStatsToProto) {
+  HedgePolicy policy(TestOptions());
+  HttpRPCStats stats;
+  policy.DumpStatsToProto(&stats);
+  EXPECT_FALSE(stats.has_exec_hedge_delay_ms());
+
+  policy.UpdateDelay(1000, absl::Seconds(2));
+  for (int i = 0; i < 4; ++i) {
+    policy.OnRequest();
+  }
+  ASSERT_TRUE(policy.TryHedge());
+  policy.OnHedgeDone(true);
+  ASSERT_TRUE(policy.TryHedge());
+  policy.OnHedgeDone(false);
+  EXPECT_FALSE(policy.TryHedge());
+
+  policy.DumpStatsToProto(&stats);
+  EXPECT_EQ(4, stats.exec_query());
+  EXPECT_EQ(2, stats.exec_hedged());
+  EXPECT_EQ(1, stats.exec_hedge_won());
+  EXPECT_EQ(1, stats.exec_hedge_budget_exhausted());
+  EXPECT_EQ(2000, stats.exec_hedge_delay_ms());
+}
+
+}  // namespace devtools_goma
@@ -154,6 +154,25 @@ int64_t Histogram::BucketValue(int n) const {
   return static_cast<int64_t>(pow(logbase_, n - 1));
 }
 
+int64_t Histogram::Percentile(double percentile) const {
+  if (count_ == 0) {
+    return 0;
+  }
+  const double rank = count_ * std::min(std::max(percentile, 0.0), 100.0) / 100;
+  int64_t num_below = 0;
+  for (const auto& it : buckets_) {
+    if (num_below + it.second < rank) {
+      num_below += it.second;
+      continue;
+    }
+    const int64_t lower = std::max(BucketValue(it.first), min_);
+    const int64_t upper = std::min(BucketValue(it.first + 1), max_);
+    const double ratio = (rank - num_below) / it.second;
+    return lower + static_cast<int64_t>((upper - lower) * ratio);
+  }
+  return max_;
+}
+
 int64_t Histogram::standard_deviation() const {
   double squared_mean = (double)sum_ * sum_ / count_ / count_;
   return static_cast<int64_t>(sqrt(sum_of_squares_ / count_ - squared_mean));
@@ -52,6 +52,9 @@ class Histogram {
   int64_t standard_deviation() const;
   int64_t mean() const { return sum_ / count_; }
   int64_t count() const { return count_; }
+  // Returns estimated |percentile| (0..100) of the added values,
+  // interpolating linearly in the bucket.  Returns 0 if no value is added.
+  int64_t Percentile(double percentile) const;
   const std::string& name() const { return name_; }
   std::string DebugString() const;
   void DumpToProto(DistributionProto* dist);
@@ -44,4 +44,28 @@ TEST(HistogramTest, BucketValue)
   EXPECT_EQ(0, histogram.BucketValue(-100));
 }
 
+TEST(HistogramTest, Percentile)
+{
+  Histogram histogram;
+  EXPECT_EQ(0, histogram.Percentile(50));
+
+  for (int i = 1; i <= 100; ++i) {
+    histogram.Add(i);
+  }
+  EXPECT_EQ(1, histogram.Percentile(0));
+  EXPECT_EQ(100, histogram.Percentile(100));
+  // Estimated in buckets [32-64) and [64-100].
+  EXPECT_NEAR(50, histogram.Percentile(50), 5);
+  EXPECT_NEAR(95, histogram.Percentile(95), 5);
+
+  // Skewed: most values are small, but the tail is large.
+  Histogram skewed;
+  for (int i = 0; i < 99; ++i) {
+    skewed.Add(10);
+  }
+  skewed.Add(10000);
+  EXPECT_LE(skewed.Percentile(90), 16);
+  EXPECT_EQ(10000, skewed.Percentile(100));
+}
+
 } // namespace devtools_goma
@@ -0,0 +1,463 @@
+// Copyright 2020 The Goma Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "hpack.h"
+
+#include "absl/base/macros.h"
+#include "glog/logging.h"
+
+namespace devtools_goma {
+
+namespace {
+
+struct HuffmanSym {
+  uint32_t code;
+  int len;
+};
+
+struct HeaderField {
+  const char* name;
+  const char* value;
+};
+
+// Huffman code of each symbol from RFC 7541 Appendix B.
+const HuffmanSym kHuffmanSyms[257] = {
+    {0x1ff8, 13}, {0x7fffd8, 23}, {0xfffffe2, 28}, {0xfffffe3, 28},
+    {0xfffffe4, 28}, {0xfffffe5, 28}, {0xfffffe6, 28}, {0xfffffe7, 28},
+    {0xfffffe8, 28}, {0xffffea, 24}, {0x3ffffffc, 30}, {0xfffffe9, 28},
+    {0xfffffea, 28}, {0x3ffffffd, 30}, {0xfffffeb, 28}, {0xfffffec, 28},
+    {0xfffffed, 28}, {0xfffffee, 28}, {0xfffffef, 28}, {0xffffff0, 28},
+    {0xffffff1, 28}, {0xffffff2, 28}, {0x3ffffffe, 30}, {0xffffff3, 28},
+    {0xffffff4, 28}, {0xffffff5, 28}, {0xffffff6, 28}, {0xffffff7, 28},
+    {0xffffff8, 28}, {0xffffff9, 28}, {0xffffffa, 28}, {0xffffffb, 28},
+    {0x14, 6}, {0x3f8, 10}, {0x3f9, 10}, {0xffa, 12}, {0x1ff9, 13}, {0x15, 6},
+    {0xf8, 8}, {0x7fa, 11}, {0x3fa, 10}, {0x3fb, 10}, {0xf9, 8}, {0x7fb, 11},
+    {0xfa, 8}, {0x16, 6}, {0x17, 6}, {0x18, 6}, {0x0, 5}, {0x1, 5}, {0x2, 5},
+    {0x19, 6}, {0x1a, 6}, {0x1b, 6}, {0x1c, 6}, {0x1d, 6}, {0x1e, 6}, {0x1f, 6},
+    {0x5c, 7}, {0xfb, 8}, {0x7ffc, 15}, {0x20, 6}, {0xffb, 12}, {0x3fc, 10},
+    {0x1ffa, 13}, {0x21, 6}, {0x5d, 7}, {0x5e, 7}, {0x5f, 7}, {0x60, 7},
+    {0x61, 7}, {0x62, 7}, {0x63, 7}, {0x64, 7}, {0x65, 7}, {0x66, 7}, {0x67, 7},
+    {0x68, 7}, {0x69, 7}, {0x6a, 7}, {0x6b, 7}, {0x6c, 7}, {0x6d, 7}, {0x6e, 7},
+    {0x6f, 7}, {0x70, 7}, {0x71, 7}, {0x72, 7}, {0xfc, 8}, {0x73, 7}, {0xfd, 8},
+    {0x1ffb, 13}, {0x7fff0, 19}, {0x1ffc, 13}, {0x3ffc, 14}, {0x22, 6},
+    {0x7ffd, 15}, {0x3, 5}, {0x23, 6}, {0x4, 5}, {0x24, 6}, {0x5, 5}, {0x25, 6},
+    {0x26, 6}, {0x27, 6}, {0x6, 5}, {0x74, 7}, {0x75, 7}, {0x28, 6}, {0x29, 6},
+    {0x2a, 6}, {0x7, 5}, {0x2b, 6}, {0x76, 7}, {0x2c, 6}, {0x8, 5}, {0x9, 5},
+    {0x2d, 6}, {0x77, 7}, {0x78, 7}, {0x79, 7}, {0x7a, 7}, {0x7b, 7},
+    {0x7ffe, 15}, {0x7fc, 11}, {0x3ffd, 14}, {0x1ffd, 13}, {0xffffffc, 28},
+    {0xfffe6, 20}, {0x3fffd2, 22}, {0xfffe7, 20}, {0xfffe8, 20}, {0x3fffd3, 22},
+    {0x3fffd4, 22}, {0x3fffd5, 22}, {0x7fffd9, 23}, {0x3fffd6, 22},
+    {0x7fffda, 23}, {0x7fffdb, 23}, {0x7fffdc, 23}, {0x7fffdd, 23},
+    {0x7fffde, 23}, {0xffffeb, 24}, {0x7fffdf, 23}, {0xffffec, 24},
+    {0xffffed, 24}, {0x3fffd7, 22}, {0x7fffe0, 23}, {0xffffee, 24},
+    {0x7fffe1, 23}, {0x7fffe2, 23}, {0x7fffe3, 23}, {0x7fffe4, 23},
+    {0x1fffdc, 21}, {0x3fffd8, 22}, {0x7fffe5, 23}, {0x3fffd9, 22},
+    {0x7fffe6, 23}, {0x7fffe7, 23}, {0xffffef, 24}, {0x3fffda, 22},
+    {0x1fffdd, 21}, {0xfffe9, 20}, {0x3fffdb, 22}, {0x3fffdc, 22},
+    {0x7fffe8, 23}, {0x7fffe9, 23}, {0x1fffde, 21}, {0x7fffea, 23},
+    {0x3fffdd, 22}, {0x3fffde, 22}, {0xfffff0, 24}, {0x1fffdf, 21},
+    {0x3fffdf, 22}, {0x7fffeb, 23}, {0x7fffec, 23}, {0x1fffe0, 21},
+    {0x1fffe1, 21}, {0x3fffe0, 22}, {0x1fffe2, 21}, {0x7fffed, 23},
+    {0x3fffe1, 22}, {0x7fffee, 23}, {0x7fffef, 23}, {0xfffea, 20},
+    {0x3fffe2, 22}, {0x3fffe3, 22}, {0x3fffe4, 22}, {0x7ffff0, 23},
+    {0x3fffe5, 22}, {0x3fffe6, 22}, {0x7ffff1, 23}, {0x3ffffe0, 26},
+    {0x3ffffe1, 26}, {0xfffeb, 20}, {0x7fff1, 19}, {0x3fffe7, 22},
+    {0x7ffff2, 23}, {0x3fffe8, 22}, {0x1ffffec, 25}, {0x3ffffe2, 26},
+    {0x3ffffe3, 26}, {0x3ffffe4, 26}, {0x7ffffde, 27}, {0x7ffffdf, 27},
+    {0x3ffffe5, 26}, {0xfffff1, 24}, {0x1ffffed, 25}, {0x7fff2, 19},
+    {0x1fffe3, 21}, {0x3ffffe6, 26}, {0x7ffffe0, 27}, {0x7ffffe1, 27},
+    {0x3ffffe7, 26}, {0x7ffffe2, 27}, {0xfffff2, 24}, {0x1fffe4, 21},
+    {0x1fffe5, 21}, {0x3ffffe8, 26}, {0x3ffffe9, 26}, {0xffffffd, 28},
+    {0x7ffffe3, 27}, {0x7ffffe4, 27}, {0x7ffffe5, 27}, {0xfffec, 20},
+    {0xfffff3, 24}, {0xfffed, 20}, {0x1fffe6, 21}, {0x3fffe9, 22},
+    {0x1fffe7, 21}, {0x1fffe8, 21}, {0x7ffff3, 23}, {0x3fffea, 22},
+    {0x3fffeb, 22}, {0x1ffffee, 25}, {0x1ffffef, 25}, {0xfffff4, 24},
+    {0xfffff5, 24}, {0x3ffffea, 26}, {0x7ffff4, 23}, {0x3ffffeb, 26},
+    {0x7ffffe6, 27}, {0x3ffffec, 26}, {0x3ffffed, 26}, {0x7ffffe7, 27},
+    {0x7ffffe8, 27}, {0x7ffffe9, 27}, {0x7ffffea, 27}, {0x7ffffeb, 27},
+    {0xffffffe, 28}, {0x7ffffec, 27}, {0x7ffffed, 27}, {0x7ffffee, 27},
+    {0x7ffffef, 27}, {0x7fffff0, 27}, {0x3ffffee, 26}, {0x3fffffff, 30},  // EOS
+};
+
+// Static table from RFC 7541 Appendix A. Index starts from 1.
+const HeaderField kStaticTable[] = {
+    {":authority", ""},
+    {":method", "GET"},
+    {":method", "POST"},
+    {":path", "/"},
+    {":path", "/index.html"},
+    {":scheme", "http"},
+    {":scheme", "https"},
+    {":status", "200"},
+    {":status", "204"},
+    {":status", "206"},
+    {":status", "304"},
+    {":status", "400"},
+    {":status", "404"},
+    {":status", "500"},
+    {"accept-charset", ""},
+    {"accept-encoding", "gzip, deflate"},
+    {"accept-language", ""},
+    {"accept-ranges", ""},
+    {"accept", ""},
+    {"access-control-allow-origin", ""},
+    {"age", ""},
+    {"allow", ""},
+    {"authorization", ""},
+    {"cache-control", ""},
+    {"content-disposition", ""},
+    {"content-encoding", ""},
+    {"content-language", ""},
+    {"content-length", ""},
+    {"content-location", ""},
+    {"content-range", ""},
+    {"content-type", ""},
+    {"cookie", ""},
+    {"date", ""},
+    {"etag", ""},
+    {"expect", ""},
+    {"expires", ""},
+    {"from", ""},
+    {"host", ""},
+    {"if-match", ""},
+    {"if-modified-since", ""},
+    {"if-none-match", ""},
+    {"if-range", ""},
+    {"if-unmodified-since", ""},
+    {"last-modified", ""},
+    {"link", ""},
+    {"location", ""},
+    {"max-forwards", ""},
+    {"proxy-authenticate", ""},
+    {"proxy-authorization", ""},
+    {"range", ""},
+    {"referer", ""},
+    {"refresh", ""},
+    {"retry-after", ""},
+    {"server", ""},
+    {"set-cookie", ""},
+    {"strict-transport-security", ""},
+    {"transfer-encoding", ""},
+    {"user-agent", ""},
+    {"vary", ""},
+    {"via", ""},
+    {"www-authenticate", ""},
+};
+
+constexpr int kEosSymbol = 256;
+// Overhead of an entry in the dynamic table. RFC 7541 4.1.
+constexpr size_t kEntryOverhead = 32;
+
+// HuffmanTree is a binary tree to decode Huffman code bit by bit.
+class HuffmanTree {
+ public:
+  HuffmanTree() {
+    nodes_.push_back(Node());
+    for (int sym = 0; sym < static_cast<int>(ABSL_ARRAYSIZE(kHuffmanSyms));
+         ++sym) {
+      const HuffmanSym& h = kHuffmanSyms[sym];
+      int node = 0;
+      for (int i = h.len - 1; i >= 0; --i) {
+        const int bit = (h.code >> i) & 1;
+        if (nodes_[node].child[bit] < 0) {
+          nodes_[node].child[bit] = nodes_.size();
+          nodes_.push_back(Node());
+        }
+        node = nodes_[node].child[bit];
+      }
+      nodes_[node].sym = sym;
+    }
+  }
+
+  bool Decode(absl::string_view data, std::string* out) const {
+    int node = 0;
+    // Bits read after the last symbol, and whether they are all 1.
+    int num_bits = 0;
+    bool all_ones = true;
+    for (unsigned char c : data) {
+      for (int i = 7; i >= 0; --i) {
+        const int bit = (c >> i) & 1;
+        node = nodes_[node].child[bit];
+        if (node < 0) {
+          return false;
+        }
+        ++num_bits;
+        all_ones = all_ones && bit == 1;
+        const int sym = nodes_[node].sym;
+        if (sym < 0) {
+          continue;
+        }
+        if (sym == kEosSymbol) {
+          return false;
+        }
+        out->push_back(static_cast<char>(sym));
+        node = 0;
+        num_bits = 0;
+        all_ones = true;
+      }
+    }
+    // Padding must be the most significant bits of EOS, and
+    // shorter than 8 bits.  RFC 7541 5.2.
+    return num_bits < 8 && all_ones;
+  }
+
+ private:
+  struct Node {
+    int child[2] = {-1, -1};
+    int sym = -1;
+  };
+  std::vector<Node> nodes_;
+};
+
+const HuffmanTree& GetHuffmanTree() {
+  static const HuffmanTree* tree = new HuffmanTree();
+  return *tree;
+}
+
+size_t EntrySize(const std::pair<std::string, std::string>& field) {
+  return field.first.size() + field.second.size() + kEntryOverhead;
+}
+
+// Returns index of |name| and |value| in the static table.
+// Returns 0 if not found. |*name_index| is set if the same name exists.
+size_t FindStaticTable(absl::string_view name, absl::string_view value,
+                       size_t* name_index) {
+  *name_index = 0;
+  for (size_t i = 0; i < ABSL_ARRAYSIZE(kStaticTable); ++i) {
+    if (name != kStaticTable[i].name) {
+      continue;
+    }
+    if (*name_index == 0) {
+      *name_index = i + 1;
+    }
+    if (value == kStaticTable[i].value) {
+      return i + 1;
+    }
+  }
+  return 0;
+}
+
+void EncodeString(absl::string_view str, std::string* out) {
+  const size_t huffman_len = HpackHuffmanEncodedLength(str);
+  if (huffman_len < str.size()) {
+    HpackEncodeInteger(huffman_len, 7, 0x80, out);
+    HpackHuffmanEncode(str, out);
+    return;
+  }
+  HpackEncodeInteger(str.size(), 7, 0, out);
+  out->append(str.data(), str.size());
+}
+
+bool DecodeString(absl::string_view* in, std::string* str) {
+  if (in->empty()) {
+    return false;
+  }
+  const bool huffman = ((*in)[0] & 0x80) != 0;
+  uint64_t len;
+  if (!HpackDecodeInteger(in, 7, &len) || len > in->size()) {
+    return false;
+  }
+  absl::string_view data = in->substr(0, len);
+  in->remove_prefix(len);
+  str->clear();
+  if (huffman) {
+    return HpackHuffmanDecode(data, str);
+  }
+  str->assign(data.data(), data.size());
+  return true;
+}
+
+}  // anonymous namespace
+
+void HpackEncodeInteger(uint64_t value, int prefix_bits, uint8_t first_byte,
+                        std::string* out) {
+  DCHECK(prefix_bits >= 1 && prefix_bits <= 8) << prefix_bits;
+  const uint64_t max_prefix = (1 << prefix_bits) - 1;
+  if (value < max_prefix) {
+    out->push_back(static_cast<char>(first_byte | value));
+    return;
+  }
+  out->push_back(static_cast<char>(first_byte | max_prefix));
+  value -= max_prefix;
+  while (value >= 128) {
+    out->push_back(static_cast<char>((value & 0x7f) | 0x80));
+    value >>= 7;
+  }
+  out->push_back(static_cast<char>(value));
+}
+
+bool HpackDecodeInteger(absl::string_view* in, int prefix_bits,
+                        uint64_t* value) {
+  DCHECK(prefix_bits >= 1 && prefix_bits <= 8) << prefix_bits;
+  if (in->empty()) {
+    return false;
+  }
+  const uint64_t max_prefix = (1 << prefix_bits) - 1;
+  *value = static_cast<unsigned char>((*in)[0]) & max_prefix;
+  in->remove_prefix(1);
+  if (*value < max_prefix) {
+    return true;
+  }
+  for (int shift = 0; !in->empty(); shift += 7) {
+    // Larger value is not needed for HTTP/2.
+    if (shift > 56) {
+      return false;
+    }
+    const unsigned char c = (*in)[0];
+    in->remove_prefix(1);
+    *value += static_cast<uint64_t>(c & 0x7f) << shift;
+    if ((c & 0x80) == 0) {
+      return true;
+    }
+  }
+  return false;
+}
+
+size_t HpackHuffmanEncodedLength(absl::string_view data) {
+  size_t bits = 0;
+  for (unsigned char c : data) {
+    bits += kHuffmanSyms[c].len;
+  }
+  return (bits + 7) / 8;
+}
+
+void HpackHuffmanEncode(absl::string_view data, std::string* out) {
+  uint64_t buf = 0;
+  int num_bits = 0;
+  for (unsigned char c : data) {
+    const HuffmanSym& h = kHuffmanSyms[c];
+    buf = (buf << h.len) | h.code;
+    num_bits += h.len;
+    while (num_bits >= 8) {
+      num_bits -= 8;
+      out->push_back(static_cast<char>(buf >> num_bits));
+    }
+  }
+  if (num_bits > 0) {
+    // Pad with the most significant bits of EOS.
+    buf = (buf << (8 - num_bits)) | ((1 << (8 - num_bits)) - 1);
+    out->push_back(static_cast<char>(buf));
+  }
+}
+
+bool HpackHuffmanDecode(absl::string_view data, std::string* out) {
+  return GetHuffmanTree().Decode(data, out);
+}
+
+void HpackEncoder::Encode(const HpackHeaderList& headers,
+                          std::string* out) const {
+  for (const auto& field : headers) {
+    DCHECK(!field.first.empty());
+    size_t name_index;
+    const size_t index =
+        FindStaticTable(field.first, field.second, &name_index);
+    if (index > 0) {
+      // Indexed header field.  RFC 7541 6.1.
+      HpackEncodeInteger(index, 7, 0x80, out);
+      continue;
+    }
+    // Literal header field without indexing.  RFC 7541 6.2.2.
+    HpackEncodeInteger(name_index, 4, 0, out);
+    if (name_index == 0) {
+      EncodeString(field.first, out);
+    }
+    EncodeString(field.second, out);
+  }
+}
+
+bool HpackDecoder::Decode(absl::string_view block, HpackHeaderList* headers) {
+  bool field_decoded = false;
+  while (!block.empty()) {
+    const unsigned char c = block[0];
+    if (c & 0x80) {
+      // Indexed header field.  RFC 7541 6.1.
+      uint64_t index;
+      std::pair<std::string, std::string> field;
+      if (!HpackDecodeInteger(&block, 7, &index) || !Lookup(index, &field)) {
+        return false;
+      }
+      headers->push_back(std::move(field));
+      field_decoded = true;
+      continue;
+    }
+    if ((c & 0xe0) == 0x20) {
+      // Dynamic table size update.  RFC 7541 6.3.
+      // It must be at the beginning of a header block.  RFC 7541 4.2.
+      uint64_t size;
+      if (field_decoded || !HpackDecodeInteger(&block, 5, &size) ||
+          size > max_table_size_) {
+        return false;
+      }
+      table_size_limit_ = size;
+      Evict();
+      continue;
+    }
+    // Literal header field with incremental indexing (01xxxxxx),
+    // without indexing (0000xxxx) or never indexed (0001xxxx).
+    // RFC 7541 6.2.
+    const bool indexing = (c & 0xc0) == 0x40;
+    uint64_t name_index;
+    if (!HpackDecodeInteger(&block, indexing ? 6 : 4, &name_index)) {
+      return false;
+    }
+    std::pair<std::string, std::string> field;
+    if (name_index > 0) {
+      if (!Lookup(name_index, &field)) {
+        return false;
+      }
+    } else if (!DecodeString(&block, &field.first)) {
+      return false;
+    }
+    if (!DecodeString(&block, &field.second)) {
+      return false;
+    }
+    if (indexing) {
+      Insert(field);
+    }
+    headers->push_back(std::move(field));
+    field_decoded = true;
+  }
+  return true;
+}
+
+bool HpackDecoder::Lookup(uint64_t index,
+                          std::pair<std::string, std::string>* field) const {
+  if (index == 0) {
+    return false;
+  }
+  if (index <= ABSL_ARRAYSIZE(kStaticTable)) {
+    field->first = kStaticTable[index - 1].name;
+    field->second = kStaticTable[index - 1].value;
+    return true;
+  }
+  index -= ABSL_ARRAYSIZE(kStaticTable) + 1;
+  if (index >= dynamic_table_.size()) {
+    return false;
+  }
+  *field = dynamic_table_[index];
+  return true;
+}
+
+void HpackDecoder::Insert(std::pair<std::string, std::string> field) {
+  const size_t size = EntrySize(field);
+  if (size > table_size_limit_) {
+    // Adding a too large entry empties the table.  RFC 7541 4.4.
+    dynamic_table_.clear();
+    table_size_ = 0;
+    return;
+  }
+  table_size_ += size;
+  dynamic_table_.push_front(std::move(field));
+  Evict();
+}
+
+void HpackDecoder::Evict() {
+  while (table_size_ > table_size_limit_) {
+    DCHECK(!dynamic_table_.empty());
+    table_size_ -= EntrySize(dynamic_table_.back());
+    dynamic_table_.pop_back();
+  }
+}
+
+}  // namespace devtools_goma
@@ -0,0 +1,96 @@
+// Copyright 2020 The Goma Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+// HPACK: Header Compression for HTTP/2 (RFC 7541).
+
+#ifndef DEVTOOLS_GOMA_CLIENT_HPACK_H_
+#define DEVTOOLS_GOMA_CLIENT_HPACK_H_
+
+#include <deque>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "absl/strings/string_view.h"
+#include "basictypes.h"
+
+namespace devtools_goma {
+
+// A header list. Names must be lowercase in HTTP/2.
+using HpackHeaderList = std::vector<std::pair<std::string, std::string>>;
+
+// Default SETTINGS_HEADER_TABLE_SIZE.
+constexpr size_t kHpackDefaultTableSize = 4096;
+
+// Appends |value| encoded as an integer with |prefix_bits| prefix to |out|.
+// |first_byte| has flags in bits above the prefix.
+void HpackEncodeInteger(uint64_t value, int prefix_bits, uint8_t first_byte,
+                        std::string* out);
+// Decodes an integer with |prefix_bits| prefix at the beginning of |in|,
+// and consumes it. Returns false if |in| is truncated or overflowed.
+bool HpackDecodeInteger(absl::string_view* in, int prefix_bits,
+                        uint64_t* value);
+
+// Returns the length of |data| in Huffman code.
+size_t HpackHuffmanEncodedLength(absl::string_view data);
+// Appends |data| in Huffman code to |out|.
+void HpackHuffmanEncode(absl::string_view data, std::string* out);
+// Appends Huffman decoded |data| to |out|.
+// Returns false if |data| is not valid Huffman code, e.g. it has EOS or
+// invalid padding.
+bool HpackHuffmanDecode(absl::string_view data, std::string* out);
+
+// HpackEncoder encodes header lists.
+// It does not insert any entry to the dynamic table, so the peer's
+// SETTINGS_HEADER_TABLE_SIZE does not matter. A field is encoded as
+// an indexed field if it is in the static table, otherwise as a literal
+// field without indexing.
+class HpackEncoder {
+ public:
+  HpackEncoder() = default;
+
+  // Appends header block of |headers| to |out|.
+  void Encode(const HpackHeaderList& headers, std::string* out) const;
+
+ private:
+  DISALLOW_COPY_AND_ASSIGN(HpackEncoder);
+};
+
+// HpackDecoder decodes header blocks.
+// It keeps the dynamic table, so all header blocks on a connection must be
+// decoded in order even if they are for closed streams.
+class HpackDecoder {
+ public:
+  explicit HpackDecoder(size_t max_table_size = kHpackDefaultTableSize)
+      : max_table_size_(max_table_size),
+        table_size_limit_(max_table_size) {}
+
+  // Decodes a complete header block, and appends fields to |headers|.
+  // Returns false on decoding error, which should be treated as
+  // a connection error of type COMPRESSION_ERROR.
+  bool Decode(absl::string_view block, HpackHeaderList* headers);
+
+  size_t table_size() const { return table_size_; }
+  size_t num_dynamic_entries() const { return dynamic_table_.size(); }
+
+ private:
+  // Looks up the field of |index| in the static and dynamic table.
+  bool Lookup(uint64_t index, std::pair<std::string, std::string>* field) const;
+  void Insert(std::pair<std::string, std::string> field);
+  void Evict();
+
+  // Upper limit of table size, i.e. SETTINGS_HEADER_TABLE_SIZE we sent.
+  const size_t max_table_size_;
+  // Current limit of table size set by dynamic table size update.
+  size_t table_size_limit_;
+  size_t table_size_ = 0;
+  // The newest entry is at front.
+  std::deque<std::pair<std::string, std::string>> dynamic_table_;
+
+  DISALLOW_COPY_AND_ASSIGN(HpackDecoder);
+};
+
+}  // namespace devtools_goma
+
+#endif  // DEVTOOLS_GOMA_CLIENT_HPACK_H_
@@ -0,0 +1,175 @@
+// Copyright 2020 The Goma Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "hpack.h"
+
+#include "absl/strings/escaping.h"
+#include "gtest/gtest.h"
+
+namespace devtools_goma {
+
+namespace {
+
+std::string Hex(absl::string_view hex) {
+  return absl::HexStringToBytes(hex);
+}
+
+}  // anonymous namespace
+
+// RFC 7541 C.1.
+TEST(HpackTest, Integer) {
+  std::string out;
+  HpackEncodeInteger(10, 5, 0, &out);
+  EXPECT_EQ(Hex("0a"), out);
+
+  out.clear();
+  HpackEncodeInteger(1337, 5, 0, &out);
+  EXPECT_EQ(Hex("1f9a0a"), out);
+
+  out.clear();
+  HpackEncodeInteger(42, 8, 0, &out);
+  EXPECT_EQ(Hex("2a"), out);
+
+  out.clear();
+  HpackEncodeInteger(31, 5, 0xe0, &out);
+  EXPECT_EQ(Hex("ff00"), out);
+
+  const std::string data = Hex("1f9a0a2a");
+  absl::string_view in(data);
+  uint64_t value = 0;
+  EXPECT_TRUE(HpackDecodeInteger(&in, 5, &value));
+  EXPECT_EQ(1337U, value);
+  EXPECT_TRUE(HpackDecodeInteger(&in, 8, &value));
+  EXPECT_EQ(42U, value);
+  EXPECT_TRUE(in.empty());
+
+  // Truncated.
+  const std::string truncated = Hex("1f9a");
+  in = truncated;
+  EXPECT_FALSE(HpackDecodeInteger(&in, 5, &value));
+}
+
+TEST(HpackTest, Huffman) {
+  std::string out;
+  HpackHuffmanEncode("www.example.com", &out);
+  EXPECT_EQ(Hex("f1e3c2e5f23a6ba0ab90f4ff"), out);
+  EXPECT_EQ(out.size(), HpackHuffmanEncodedLength("www.example.com"));
+
+  std::string decoded;
+  EXPECT_TRUE(HpackHuffmanDecode(out, &decoded));
+  EXPECT_EQ("www.example.com", decoded);
+
+  decoded.clear();
+  EXPECT_TRUE(HpackHuffmanDecode(Hex("a8eb10649cbf"), &decoded));
+  EXPECT_EQ("no-cache", decoded);
+
+  // Padding longer than 7 bits.
+  decoded.clear();
+  EXPECT_FALSE(HpackHuffmanDecode(Hex("a8eb10649cbfff"), &decoded));
+  // Padding that is not all ones.
+  decoded.clear();
+  EXPECT_FALSE(HpackHuffmanDecode(Hex("a8eb10649cbe"), &decoded));
+}
+
+// RFC 7541 C.4.  Requests with Huffman coding.
+TEST(HpackTest, DecodeRequestsWithDynamicTable) {
+  HpackDecoder decoder;
+
+  HpackHeaderList headers;
+  ASSERT_TRUE(decoder.Decode(Hex("828684418cf1e3c2e5f23a6ba0ab90f4ff"),
+                             &headers));
+  EXPECT_EQ((HpackHeaderList{
+                {":method", "GET"},
+                {":scheme", "http"},
+                {":path", "/"},
+                {":authority", "www.example.com"},
+            }),
+            headers);
+  EXPECT_EQ(57U, decoder.table_size());
+  EXPECT_EQ(1U, decoder.num_dynamic_entries());
+
+  headers.clear();
+  ASSERT_TRUE(decoder.Decode(Hex("828684be5886a8eb10649cbf"), &headers));
+  EXPECT_EQ((HpackHeaderList{
+                {":method", "GET"},
+                {":scheme", "http"},
+                {":path", "/"},
+                {":authority", "www.example.com"},
+                {"cache-control", "no-cache"},
+            }),
+            headers);
+  EXPECT_EQ(110U, decoder.table_size());
+  EXPECT_EQ(2U, decoder.num_dynamic_entries());
+
+  headers.clear();
+  ASSERT_TRUE(decoder.Decode(
+      Hex("828785bf408825a849e95ba97d7f8925a849e95bb8e8b4bf"), &headers));
+  EXPECT_EQ((HpackHeaderList{
+                {":method", "GET"},
+                {":scheme", "https"},
+                {":path", "/index.html"},
+                {":authority", "www.example.com"},
+                {"custom-key", "custom-value"},
+            }),
+            headers);
+  EXPECT_EQ(164U, decoder.table_size());
+  EXPECT_EQ(3U, decoder.num_dynamic_entries());
+}
+
+TEST(HpackTest, DecodeTableSizeUpdate) {
+  HpackDecoder decoder;
+  HpackHeaderList headers;
+  ASSERT_TRUE(decoder.Decode(Hex("828684418cf1e3c2e5f23a6ba0ab90f4ff"),
+                             &headers));
+  EXPECT_EQ(1U, decoder.num_dynamic_entries());
+
+  // Size update to 0 evicts all entries.
+  headers.clear();
+  ASSERT_TRUE(decoder.Decode(Hex("2082"), &headers));
+  EXPECT_EQ((HpackHeaderList{{":method", "GET"}}), headers);
+  EXPECT_EQ(0U, decoder.table_size());
+  EXPECT_EQ(0U, decoder.num_dynamic_entries());
+
+  // Larger than SETTINGS_HEADER_TABLE_SIZE.
+  headers.clear();
+  EXPECT_FALSE(decoder.Decode(Hex("3fe21f"), &headers));
+}
+
+TEST(HpackTest, DecodeInvalid) {
+  HpackDecoder decoder;
+  HpackHeaderList headers;
+  // Index 0.
+  EXPECT_FALSE(decoder.Decode(Hex("80"), &headers));
+  // Index out of the tables.
+  EXPECT_FALSE(decoder.Decode(Hex("be"), &headers));
+  // Truncated string.
+  EXPECT_FALSE(decoder.Decode(Hex("418c"), &headers));
+}
+
+TEST(HpackTest, EncodeRoundTrip) {
+  const HpackHeaderList headers = {
+      {":method", "POST"},
+      {":scheme", "https"},
+      {":authority", "goma.example.com"},
+      {":path", "/cxx-compiler-service/e"},
+      {"user-agent", "compiler-proxy built by goma"},
+      {"content-type", "binary/x-protocol-buffer"},
+      {"content-length", "12345"},
+      {"authorization", "Bearer token"},
+  };
+  HpackEncoder encoder;
+  std::string block;
+  encoder.Encode(headers, &block);
+  // :method POST is in the static table.
+  EXPECT_EQ('\x83', block[0]);
+
+  HpackDecoder decoder;
+  HpackHeaderList decoded;
+  ASSERT_TRUE(decoder.Decode(block, &decoded));
+  EXPECT_EQ(headers, decoded);
+  // Encoder doesn't add entries to the dynamic table.
+  EXPECT_EQ(0U, decoder.num_dynamic_entries());
+}
+
+}  // namespace devtools_goma
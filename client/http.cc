@@ -45,6 +45,7 @@ MSVC_PUSH_DISABLE_WARNING_FOR_PROTO()
 #include "google/protobuf/message.h"
 MSVC_POP_WARNING()
 #include "histogram.h"
+#include "http2_transport.h"
 #include "http_util.h"
 #include "oauth2.h"
 #include "oauth2_token.h"
@@ -80,6 +81,13 @@ constexpr absl::Duration kRampUpDuration = absl::Minutes(10);
 
 constexpr int kMaxConnectionFailure = 5;
 
+// Max number of request stream buffers written by one system call.
+constexpr size_t kMaxWriteBuffers = 16;
+
+// Idle sockets in SocketPool would have been expired if no request has been
+// made for this period, so the next requests would need to connect.
+constexpr absl::Duration kPrewarmIdleThreshold = absl::Seconds(5);
+
 template <typename T>
 Json::Value VectorToJson(const std::vector<T>& vec) {
   Json::Value v;
@@ -243,6 +251,10 @@ std::string HttpClient::Options::DebugString() const {
     ss << " capture_response_header";
   if (use_ssl)
     ss << " use_ssl";
+  if (use_http2)
+    ss << " use_http2 max_connections=" << http2_max_connections;
+  if (prewarm_sockets > 0)
+    ss << " prewarm_sockets=" << prewarm_sockets;
   if (!ssl_extra_cert.empty())
     ss << " ssl_extra_cert=" << ssl_extra_cert;
   if (!ssl_extra_cert_data.empty())
@@ -436,6 +448,7 @@ class HttpClient::Task {
     const absl::Duration timeout = status_->timeouts.front();
     status_->timeouts.pop_front();
     timer_.Start();
+    write_buffers_.clear();
     request_stream_ = req_->NewStream();
     if (!request_stream_) {
       LOG(WARNING) << status_->trace_id << " failed to create request stream";
@@ -477,9 +490,21 @@ class HttpClient::Task {
     }
     CHECK(descriptor_);
     VLOG(7) << status_->trace_id << " DoWrite " << descriptor_;
-    const void* data = nullptr;
-    int size = 0;
-    if (!request_stream_->Next(&data, &size)) {
+    // Gathers buffers of the request stream to write them by one system
+    // call, if the buffers remain valid after the following Next().
+    const size_t max_write_buffers =
+        req_->HasStableStreamBuffers() ? kMaxWriteBuffers : 1;
+    while (write_buffers_.size() < max_write_buffers) {
+      const void* data = nullptr;
+      int size = 0;
+      if (!request_stream_->Next(&data, &size)) {
+        break;
+      }
+      if (size > 0) {
+        write_buffers_.emplace_back(static_cast<const char*>(data), size);
+      }
+    }
+    if (write_buffers_.empty()) {
       // Request has been sent.
       DCHECK_EQ(Status::SENDING_REQUEST, status_->state);
       status_->req_size = request_stream_->ByteCount();
@@ -492,11 +517,10 @@ class HttpClient::Task {
           WorkerThread::PRIORITY_IMMEDIATE);
       return;
     }
-    ssize_t write_size = descriptor_->Write(data, size);
+    ssize_t write_size = descriptor_->Writev(write_buffers_);
     VLOG(3) << status_->trace_id << " DoWrite "
-            << size << " -> " << write_size;
+            << write_buffers_.size() << " buffers -> " << write_size;
     if (write_size < 0 && descriptor_->NeedRetry()) {
-      request_stream_->BackUp(size);
       return;
     }
     if (write_size <= 0) {
@@ -507,15 +531,38 @@ class HttpClient::Task {
       std::ostringstream err_message;
       err_message << status_->trace_id
                   << " Write failed write_size=" << write_size
-                  << " @" << request_stream_->ByteCount()
+                  << " @" << WrittenByteCount()
                   << " : " << descriptor_->GetLastErrorMessage();
       RunCallback(FAIL, err_message.str());
       return;
     }
-    request_stream_->BackUp(size - write_size);
+    ConsumeWriteBuffers(write_size);
     client_->IncWriteByte(write_size);
   }
 
+  // Drops |n| bytes written from the head of |write_buffers_|.
+  void ConsumeWriteBuffers(size_t n) {
+    auto it = write_buffers_.begin();
+    while (it != write_buffers_.end() && n >= it->size()) {
+      n -= it->size();
+      ++it;
+    }
+    it = write_buffers_.erase(write_buffers_.begin(), it);
+    if (n > 0) {
+      CHECK(it != write_buffers_.end()) << status_->trace_id;
+      it->remove_prefix(n);
+    }
+  }
+
+  // Returns bytes of the request written to |descriptor_|.
+  int64_t WrittenByteCount() const {
+    int64_t n = request_stream_->ByteCount();
+    for (const auto& buf : write_buffers_) {
+      n -= buf.size();
+    }
+    return n;
+  }
+
   void DoRead() {
     if (!active_) {
       LOG(WARNING) << status_->trace_id << " Already finished?";
@@ -614,7 +661,7 @@ class HttpClient::Task {
       err_message << "Timed out: ";
       if (request_stream_) {
         err_message << "sending request header "
-                    << request_stream_->ByteCount()
+                    << WrittenByteCount()
                     << " " << timer_.GetDuration();
       } else if (resp_->total_recv_len() == 0) {
         err_message << "waiting response "
@@ -672,6 +719,7 @@ class HttpClient::Task {
     descriptor_ = nullptr;
     client_->ReleaseDescriptor(d, HttpClient::ERROR_CLOSE);
     active_ = false;
+    write_buffers_.clear();
     request_stream_.reset();
     resp_->Reset();
     ++status_->num_retry;
@@ -683,6 +731,7 @@ class HttpClient::Task {
     if (!active_)
       return;
     status_->req_send_time = timer_.GetDuration();
+    write_buffers_.clear();
     request_stream_.reset();
     descriptor_->ClearWritable();
     descriptor_->NotifyWhenReadable(
@@ -735,6 +784,8 @@ class HttpClient::Task {
   AuthorizationStatus auth_status_;
 
   std::unique_ptr<google::protobuf::io::ZeroCopyInputStream> request_stream_;
+  // Data of |request_stream_| not written yet.
+  std::vector<absl::string_view> write_buffers_;
 
   const bool is_ping_;
 
@@ -900,6 +951,26 @@ HttpClient::HttpClient(std::unique_ptr<SocketFactory> socket_factory,
     DCHECK(tls_engine_factory_.get() != nullptr);
     socket_pool_->SetObserver(tls_engine_factory_.get());
   }
+  if (options_.prewarm_sockets > 0) {
+    prewarm_pool_ = wm_->StartPool(1, "http_prewarm");
+  }
+  if (options_.use_http2) {
+    if (options_.UseProxy() && !options_.use_ssl) {
+      LOG(WARNING) << "http2 is not used with http proxy without ssl.";
+    } else {
+      Http2Transport::Options http2_options;
+      http2_options.authority = options_.Host();
+      http2_options.use_ssl = options_.use_ssl;
+      if (options_.UseProxy()) {
+        http2_options.tls_options.use_proxy = true;
+        http2_options.tls_options.dest_host_name = options_.dest_host_name;
+        http2_options.tls_options.dest_port = options_.dest_port;
+      }
+      http2_options.max_connections = options_.http2_max_connections;
+      http2_transport_ = absl::make_unique<Http2Transport>(
+          socket_pool_.get(), tls_engine_factory_.get(), http2_options, wm_);
+    }
+  }
   HttpClient::Options oauth2_options;
   oauth2_options.proxy_host_name = options.proxy_host_name;
   oauth2_options.proxy_port = options.proxy_port;
@@ -1000,6 +1071,19 @@ bool HttpClient::shutting_down() const {
 }
 
 Descriptor* HttpClient::NewDescriptor() {
+  if (http2_transport_ != nullptr && http2_transport_->IsAvailable()) {
+    Descriptor* d = http2_transport_->NewStream();
+    if (d != nullptr) {
+      return d;
+    }
+    // If the server turned out not to support HTTP/2, fall back to HTTP/1.1.
+    if (http2_transport_->IsAvailable()) {
+      AUTOLOCK(lock, &mu_);
+      NetworkErrorDetectedUnlocked();
+      return nullptr;
+    }
+  }
+  MaybePrewarmSockets();
   ScopedSocket fd(socket_pool_->NewSocket());
   // Note that unlike our past implementation, even on seeing previous network
   // error we can get at least one socket if getaddrinfo succeeds.
@@ -1030,13 +1114,47 @@ Descriptor* HttpClient::NewDescriptor() {
                                        WorkerThread::PRIORITY_MED);
 }
 
+void HttpClient::MaybePrewarmSockets() {
+  if (options_.prewarm_sockets <= 0) {
+    return;
+  }
+  const absl::Time now = absl::Now();
+  {
+    AUTOLOCK(lock, &mu_);
+    const absl::Time last_time = last_new_descriptor_time_;
+    last_new_descriptor_time_ = now;
+    if (now - last_time < kPrewarmIdleThreshold || shutting_down_) {
+      return;
+    }
+    // Keep HttpClient alive until PrewarmSockets is done.
+    IncNumActiveUnlocked();
+  }
+  // Don't block worker threads shared with other tasks.
+  wm_->RunClosureInPool(FROM_HERE, prewarm_pool_,
+                        NewCallback(this, &HttpClient::PrewarmSockets),
+                        WorkerThread::PRIORITY_LOW);
+}
+
+void HttpClient::PrewarmSockets() {
+  socket_pool_->Prewarm(options_.prewarm_sockets);
+  DecNumActive();
+}
+
 void HttpClient::ReleaseDescriptor(
     Descriptor* d, ConnectionCloseState close_state) {
   if (d == nullptr)
     return;
 
-  bool reuse_socket = (close_state == NO_CLOSE) && d->CanReuse();
   SocketDescriptor* sd = d->socket_descriptor();
+  if (sd == nullptr) {
+    // HTTP/2 stream.  The connection is managed by Http2Transport.
+    http2_transport_->ReleaseStream(d, close_state == NO_CLOSE);
+    if (close_state == ERROR_CLOSE) {
+      InvalidateOAuth2AccessToken();
+    }
+    return;
+  }
+  bool reuse_socket = (close_state == NO_CLOSE) && d->CanReuse();
   DCHECK(!reuse_socket || !sd->IsClosed())
     << "should not reuse the socket if it has already been closed."
     << " fd=" << sd->fd()
@@ -1162,6 +1280,9 @@ std::string HttpClient::DebugString() const {
   ss << std::endl;
   ss << "User-Agent: " << kUserAgentString << std::endl;
   ss << "SocketPool: " << socket_pool_->DebugString() << std::endl;
+  if (http2_transport_ != nullptr) {
+    ss << "HTTP/2: " << http2_transport_->DebugString() << std::endl;
+  }
   if (!options_.authorization.empty())
     ss << "Authorization: enabled" << std::endl;
   if (!options_.cookie.empty())
@@ -1236,6 +1357,8 @@ std::string HttpClient::DebugString() const {
   ss << std::endl;
   if (options_.use_ssl) {
     ss << "SSL enabled" << std::endl;
+    ss << "Handshakes: " << tls_engine_factory_->GetHandshakeStats()
+       << std::endl;
     ss << "Certificate(s) and CRLs:" << std::endl;
     ss << tls_engine_factory_->GetCertsInfo();
   } else {
@@ -2244,6 +2367,14 @@ HttpResponse::Body::ParsedStream() const {
 #else
       LOG(WARNING) << "unsuported encoding: lzma2.  need ENABLE_LZMA";
       return nullptr;
+#endif
+    case EncodingType::ZSTD:
+#ifdef ENABLE_ZSTD
+      return absl::make_unique<ZstdInputStream>(std::move(input),
+                                                zstd_dictionary_);
+#else
+      LOG(WARNING) << "unsuported encoding: zstd.  need ENABLE_ZSTD";
+      return nullptr;
 #endif
     default:
       VLOG(1) << "encoding: not specified";
@@ -2398,7 +2529,7 @@ HttpFileDownloadResponse::NewBody(
     size_t content_length, bool is_chunked,
     EncodingType encoding_type) {
   if (encoding_type != EncodingType::NO_ENCODING) {
-    // TODO: support deflate, lzma2
+    // TODO: support deflate, lzma2, zstd
     LOG(ERROR) << "unsupported encoding is requested:"
                << GetEncodingName(encoding_type);
     return nullptr;
@@ -49,6 +49,7 @@ class Histogram;
 class HttpRequest;
 class HttpResponse;
 class HttpRPCStats;
+class Http2Transport;
 class OAuth2AccessTokenRefreshTask;
 class OneshotClosure;
 class SocketFactory;
@@ -92,6 +93,16 @@ class HttpClient {
 
     bool reuse_connection = true;
 
+    // Multiplexes requests on HTTP/2 connections if the server supports it.
+    // Not used with an HTTP proxy without use_ssl.
+    bool use_http2 = false;
+    int http2_max_connections = 2;
+
+    // Number of HTTP/1.1 connections to open in advance when requests
+    // start after idle.  TLS handshake is also done in advance if use_ssl
+    // and no proxy is used.  0 to disable.
+    int prewarm_sockets = 0;
+
     bool InitFromURL(absl::string_view url);
 
     // Socket{Host,Port} represents where HttpClient connects.
@@ -254,6 +265,11 @@ class HttpClient {
     virtual std::unique_ptr<google::protobuf::io::ZeroCopyInputStream>
       NewStream() const = 0;
 
+    // Returns true if buffers returned by Next() of NewStream() remain
+    // valid until the stream is destroyed, so that several buffers can be
+    // written at once.
+    virtual bool HasStableStreamBuffers() const { return false; }
+
    protected:
     // CreateHeader creates a header line.
     static std::string CreateHeader(absl::string_view key,
@@ -587,6 +603,10 @@ class HttpClient {
   Descriptor* NewDescriptor() ABSL_LOCKS_EXCLUDED(mu_);
   void ReleaseDescriptor(Descriptor* d, ConnectionCloseState close_state);
 
+  // Opens sockets in background if it is the first request after idle.
+  void MaybePrewarmSockets() ABSL_LOCKS_EXCLUDED(mu_);
+  void PrewarmSockets() ABSL_LOCKS_EXCLUDED(mu_);
+
   absl::Duration EstimatedRecvTime(size_t bytes) ABSL_LOCKS_EXCLUDED(mu_);
 
   std::string GetOAuth2Authorization() const;
@@ -634,9 +654,14 @@ class HttpClient {
   const Options options_;
   const std::unique_ptr<TLSEngineFactory> tls_engine_factory_;
   const std::unique_ptr<SocketFactory> socket_pool_;
+  // nullptr if HTTP/2 is not used.
+  std::unique_ptr<Http2Transport> http2_transport_;
   std::unique_ptr<OAuth2AccessTokenRefreshTask> oauth_refresh_task_;
 
   WorkerThreadManager* const wm_;
+  // Pool to prewarm sockets, since it blocks in connect and TLS handshake.
+  // Started only if options_.prewarm_sockets > 0.
+  int prewarm_pool_ = WorkerThreadManager::kFreePool;
 
   mutable Lock mu_;
   ConditionVariable cond_
@@ -678,6 +703,9 @@ class HttpClient {
   size_t total_resp_byte_ ABSL_GUARDED_BY(mu_);
   absl::Duration total_resp_time_ ABSL_GUARDED_BY(mu_);  // msec.
 
+  absl::Time last_new_descriptor_time_ ABSL_GUARDED_BY(mu_) =
+      absl::InfinitePast();
+
   int ping_http_return_code_ ABSL_GUARDED_BY(mu_);
   absl::optional<absl::Duration> ping_round_trip_time_ ABSL_GUARDED_BY(mu_);
 
@@ -713,6 +741,7 @@ class HttpRequest : public HttpClient::Request {
   void SetBody(const std::string& body);
   std::unique_ptr<google::protobuf::io::ZeroCopyInputStream>
     NewStream() const override;
+  bool HasStableStreamBuffers() const override { return true; }
 
   std::unique_ptr<HttpClient::Request> Clone() const override {
     return std::unique_ptr<HttpClient::Request>(new HttpRequest(*this));
@@ -761,10 +790,17 @@ class HttpResponse : public HttpClient::Response {
     std::unique_ptr<google::protobuf::io::ZeroCopyInputStream>
       ParsedStream() const;
 
+    // Sets dictionary to decompress zstd body compressed with it.
+    // It doesn't take ownership of |dictionary|.
+    void set_zstd_dictionary(const ZstdDictionary* dictionary) {
+      zstd_dictionary_ = dictionary;
+    }
+
    private:
     const size_t content_length_;
     std::unique_ptr<HttpChunkParser> chunk_parser_;
     const EncodingType encoding_type_;
+    const ZstdDictionary* zstd_dictionary_ = nullptr;
 
     // buffer_ holds receiving data.
     // each char[] has kNetworkBufSize.
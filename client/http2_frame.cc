@@ -0,0 +1,139 @@
+// Copyright 2020 The Goma Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "http2_frame.h"
+
+#include <algorithm>
+
+#include "glog/logging.h"
+
+namespace devtools_goma {
+
+namespace {
+
+void AppendUint16(uint16_t v, std::string* out) {
+  out->push_back(static_cast<char>(v >> 8));
+  out->push_back(static_cast<char>(v));
+}
+
+void AppendUint32(uint32_t v, std::string* out) {
+  out->push_back(static_cast<char>(v >> 24));
+  out->push_back(static_cast<char>(v >> 16));
+  out->push_back(static_cast<char>(v >> 8));
+  out->push_back(static_cast<char>(v));
+}
+
+}  // anonymous namespace
+
+uint32_t Http2ReadUint32(absl::string_view data) {
+  DCHECK_GE(data.size(), 4U);
+  const unsigned char* p = reinterpret_cast<const unsigned char*>(data.data());
+  return (static_cast<uint32_t>(p[0]) << 24) |
+         (static_cast<uint32_t>(p[1]) << 16) |
+         (static_cast<uint32_t>(p[2]) << 8) | p[3];
+}
+
+Http2FrameHeader ParseHttp2FrameHeader(absl::string_view data) {
+  DCHECK_GE(data.size(), kHttp2FrameHeaderSize);
+  const unsigned char* p = reinterpret_cast<const unsigned char*>(data.data());
+  Http2FrameHeader header;
+  header.length = (static_cast<uint32_t>(p[0]) << 16) |
+                  (static_cast<uint32_t>(p[1]) << 8) | p[2];
+  header.type = p[3];
+  header.flags = p[4];
+  // Ignores reserved bit.
+  header.stream_id = Http2ReadUint32(data.substr(5)) & 0x7fffffff;
+  return header;
+}
+
+bool RemoveHttp2Padding(absl::string_view* payload) {
+  if (payload->empty()) {
+    return false;
+  }
+  const size_t pad_length = static_cast<unsigned char>((*payload)[0]);
+  payload->remove_prefix(1);
+  if (pad_length > payload->size()) {
+    return false;
+  }
+  payload->remove_suffix(pad_length);
+  return true;
+}
+
+bool ParseHttp2Settings(absl::string_view payload, Http2Settings* settings) {
+  if (payload.size() % 6 != 0) {
+    return false;
+  }
+  for (; !payload.empty(); payload.remove_prefix(6)) {
+    const unsigned char* p =
+        reinterpret_cast<const unsigned char*>(payload.data());
+    const uint16_t id = (static_cast<uint16_t>(p[0]) << 8) | p[1];
+    settings->emplace_back(static_cast<Http2SettingsId>(id),
+                           Http2ReadUint32(payload.substr(2)));
+  }
+  return true;
+}
+
+void AppendHttp2Frame(Http2FrameType type, uint8_t flags, uint32_t stream_id,
+                      absl::string_view payload, std::string* out) {
+  DCHECK_LE(payload.size(), kHttp2MaxAllowedFrameSize);
+  const uint32_t length = payload.size();
+  out->push_back(static_cast<char>(length >> 16));
+  AppendUint16(static_cast<uint16_t>(length), out);
+  out->push_back(static_cast<char>(type));
+  out->push_back(static_cast<char>(flags));
+  AppendUint32(stream_id & 0x7fffffff, out);
+  out->append(payload.data(), payload.size());
+}
+
+void AppendHttp2Headers(uint32_t stream_id, absl::string_view header_block,
+                        bool end_stream, size_t max_frame_size,
+                        std::string* out) {
+  Http2FrameType type = Http2FrameType::kHeaders;
+  uint8_t flags = end_stream ? kHttp2FlagEndStream : 0;
+  do {
+    const size_t size = std::min(header_block.size(), max_frame_size);
+    if (size == header_block.size()) {
+      flags |= kHttp2FlagEndHeaders;
+    }
+    AppendHttp2Frame(type, flags, stream_id, header_block.substr(0, size),
+                     out);
+    header_block.remove_prefix(size);
+    type = Http2FrameType::kContinuation;
+    flags = 0;
+  } while (!header_block.empty());
+}
+
+void AppendHttp2Settings(const Http2Settings& settings, std::string* out) {
+  std::string payload;
+  for (const auto& setting : settings) {
+    AppendUint16(static_cast<uint16_t>(setting.first), &payload);
+    AppendUint32(setting.second, &payload);
+  }
+  AppendHttp2Frame(Http2FrameType::kSettings, 0, 0, payload, out);
+}
+
+void AppendHttp2WindowUpdate(uint32_t stream_id, uint32_t increment,
+                             std::string* out) {
+  DCHECK_GT(increment, 0U);
+  std::string payload;
+  AppendUint32(increment & 0x7fffffff, &payload);
+  AppendHttp2Frame(Http2FrameType::kWindowUpdate, 0, stream_id, payload, out);
+}
+
+void AppendHttp2RstStream(uint32_t stream_id, Http2ErrorCode error_code,
+                          std::string* out) {
+  std::string payload;
+  AppendUint32(static_cast<uint32_t>(error_code), &payload);
+  AppendHttp2Frame(Http2FrameType::kRstStream, 0, stream_id, payload, out);
+}
+
+void AppendHttp2GoAway(uint32_t last_stream_id, Http2ErrorCode error_code,
+                       std::string* out) {
+  std::string payload;
+  AppendUint32(last_stream_id & 0x7fffffff, &payload);
+  AppendUint32(static_cast<uint32_t>(error_code), &payload);
+  AppendHttp2Frame(Http2FrameType::kGoAway, 0, 0, payload, out);
+}
+
+}  // namespace devtools_goma
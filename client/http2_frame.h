@@ -0,0 +1,117 @@
+// Copyright 2020 The Goma Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+// HTTP/2 frame format (RFC 7540 Section 4 and 6).
+
+#ifndef DEVTOOLS_GOMA_CLIENT_HTTP2_FRAME_H_
+#define DEVTOOLS_GOMA_CLIENT_HTTP2_FRAME_H_
+
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "absl/strings/string_view.h"
+
+namespace devtools_goma {
+
+constexpr absl::string_view kHttp2ConnectionPreface =
+    "PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n";
+
+constexpr size_t kHttp2FrameHeaderSize = 9;
+// Initial SETTINGS_MAX_FRAME_SIZE.
+constexpr size_t kHttp2DefaultMaxFrameSize = 16384;
+constexpr size_t kHttp2MaxAllowedFrameSize = (1 << 24) - 1;
+// Initial flow-control window size for both stream and connection.
+constexpr int64_t kHttp2DefaultWindowSize = 65535;
+constexpr int64_t kHttp2MaxWindowSize = (1LL << 31) - 1;
+
+enum class Http2FrameType : uint8_t {
+  kData = 0x0,
+  kHeaders = 0x1,
+  kPriority = 0x2,
+  kRstStream = 0x3,
+  kSettings = 0x4,
+  kPushPromise = 0x5,
+  kPing = 0x6,
+  kGoAway = 0x7,
+  kWindowUpdate = 0x8,
+  kContinuation = 0x9,
+};
+
+// Frame flags.
+constexpr uint8_t kHttp2FlagEndStream = 0x1;
+constexpr uint8_t kHttp2FlagAck = 0x1;
+constexpr uint8_t kHttp2FlagEndHeaders = 0x4;
+constexpr uint8_t kHttp2FlagPadded = 0x8;
+constexpr uint8_t kHttp2FlagPriority = 0x20;
+
+enum class Http2SettingsId : uint16_t {
+  kHeaderTableSize = 0x1,
+  kEnablePush = 0x2,
+  kMaxConcurrentStreams = 0x3,
+  kInitialWindowSize = 0x4,
+  kMaxFrameSize = 0x5,
+  kMaxHeaderListSize = 0x6,
+};
+
+enum class Http2ErrorCode : uint32_t {
+  kNoError = 0x0,
+  kProtocolError = 0x1,
+  kInternalError = 0x2,
+  kFlowControlError = 0x3,
+  kSettingsTimeout = 0x4,
+  kStreamClosed = 0x5,
+  kFrameSizeError = 0x6,
+  kRefusedStream = 0x7,
+  kCancel = 0x8,
+  kCompressionError = 0x9,
+  kConnectError = 0xa,
+  kEnhanceYourCalm = 0xb,
+  kInadequateSecurity = 0xc,
+  kHttp11Required = 0xd,
+};
+
+using Http2Settings = std::vector<std::pair<Http2SettingsId, uint32_t>>;
+
+struct Http2FrameHeader {
+  uint32_t length = 0;
+  // Not Http2FrameType, since unknown frame types must be ignored.
+  uint8_t type = 0;
+  uint8_t flags = 0;
+  uint32_t stream_id = 0;
+};
+
+// Reads 32 bit big endian integer at the beginning of |data|.
+uint32_t Http2ReadUint32(absl::string_view data);
+
+// Parses frame header at the beginning of |data|, which must have at least
+// kHttp2FrameHeaderSize bytes.
+Http2FrameHeader ParseHttp2FrameHeader(absl::string_view data);
+
+// Removes padding from |payload| of DATA or HEADERS frame that has
+// PADDED flag.  Returns false if the padding is invalid.
+bool RemoveHttp2Padding(absl::string_view* payload);
+
+// Parses payload of SETTINGS frame.  Returns false if the length is invalid.
+bool ParseHttp2Settings(absl::string_view payload, Http2Settings* settings);
+
+// Append* functions append a frame to |out|.
+void AppendHttp2Frame(Http2FrameType type, uint8_t flags, uint32_t stream_id,
+                      absl::string_view payload, std::string* out);
+// Appends HEADERS frame followed by CONTINUATION frames if |header_block|
+// is larger than |max_frame_size|.
+void AppendHttp2Headers(uint32_t stream_id, absl::string_view header_block,
+                        bool end_stream, size_t max_frame_size,
+                        std::string* out);
+void AppendHttp2Settings(const Http2Settings& settings, std::string* out);
+void AppendHttp2WindowUpdate(uint32_t stream_id, uint32_t increment,
+                             std::string* out);
+void AppendHttp2RstStream(uint32_t stream_id, Http2ErrorCode error_code,
+                          std::string* out);
+void AppendHttp2GoAway(uint32_t last_stream_id, Http2ErrorCode error_code,
+                       std::string* out);
+
+}  // namespace devtools_goma
+
+#endif  // DEVTOOLS_GOMA_CLIENT_HTTP2_FRAME_H_
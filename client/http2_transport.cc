@@ -0,0 +1,1677 @@
+// Copyright 2020 The Goma Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "http2_transport.h"
+
+#include <algorithm>
+#include <deque>
+#include <sstream>
+#include <utility>
+
+#include "absl/container/flat_hash_map.h"
+#include "absl/memory/memory.h"
+#include "absl/strings/ascii.h"
+#include "absl/strings/match.h"
+#include "absl/strings/numbers.h"
+#include "absl/strings/str_cat.h"
+#include "absl/strings/str_split.h"
+#include "absl/time/clock.h"
+#include "absl/time/time.h"
+#include "autolock_timer.h"
+#include "callback.h"
+#include "descriptor.h"
+#include "glog/logging.h"
+#include "hpack.h"
+#include "http2_frame.h"
+#include "http_util.h"
+#include "scoped_fd.h"
+#include "socket_descriptor.h"
+#include "socket_factory.h"
+#include "tls_engine.h"
+#include "worker_thread.h"
+#include "worker_thread_manager.h"
+
+namespace devtools_goma {
+
+namespace {
+
+constexpr absl::string_view kAlpnHttp2 = "h2";
+
+// Flow-control windows we advertise.
+constexpr int64_t kStreamRecvWindow = 1 << 20;
+constexpr int64_t kConnectionRecvWindow = 16 << 20;
+// Max size of request body buffered in a stream.
+constexpr size_t kStreamSendBufferSize = 128 * 1024;
+// Stops making frames while this size of output is not written yet.
+constexpr size_t kMaxPendingOutput = 256 * 1024;
+constexpr size_t kMaxRequestHeaderSize = 64 * 1024;
+constexpr size_t kMaxHeaderBlockSize = 1024 * 1024;
+constexpr uint32_t kMaxStreamId = 0x7fffffff;
+// Max number of sockets to try to get a socket not used for HTTP/1.1.
+constexpr int kMaxNewSocketAttempts = 8;
+
+// Converts HTTP/1.1 request header to HTTP/2 header list.
+// RFC 7540 8.1.2.
+bool ConvertRequestHeader(absl::string_view header,
+                          absl::string_view scheme,
+                          absl::string_view authority,
+                          HpackHeaderList* headers,
+                          int64_t* content_length,
+                          std::string* err) {
+  std::vector<absl::string_view> lines =
+      absl::StrSplit(header, "\r\n", absl::SkipEmpty());
+  if (lines.empty()) {
+    *err = "empty request header";
+    return false;
+  }
+  // Request-Line = Method SP Request-URI SP HTTP-Version
+  std::vector<absl::string_view> request_line =
+      absl::StrSplit(lines[0], ' ', absl::SkipEmpty());
+  if (request_line.size() != 3 || !absl::StartsWith(request_line[1], "/")) {
+    *err = absl::StrCat("unsupported request line: ", lines[0]);
+    return false;
+  }
+  std::string host(authority);
+  HpackHeaderList fields;
+  *content_length = 0;
+  for (size_t i = 1; i < lines.size(); ++i) {
+    const absl::string_view line = lines[i];
+    absl::string_view::size_type colon = line.find(':');
+    if (colon == absl::string_view::npos || colon == 0) {
+      *err = absl::StrCat("invalid request header field: ", line);
+      return false;
+    }
+    std::string name = absl::AsciiStrToLower(line.substr(0, colon));
+    std::string value(absl::StripAsciiWhitespace(line.substr(colon + 1)));
+    if (name == "host") {
+      host = std::move(value);
+      continue;
+    }
+    if (name == "transfer-encoding") {
+      *err = absl::StrCat("unsupported transfer-encoding: ", value);
+      return false;
+    }
+    // Connection-specific header fields must not be used.
+    if (name == "connection" || name == "keep-alive" ||
+        name == "proxy-connection" || name == "upgrade" || name == "te") {
+      continue;
+    }
+    if (name == "content-length" &&
+        !absl::SimpleAtoi(value, content_length)) {
+      *err = absl::StrCat("invalid content-length: ", value);
+      return false;
+    }
+    fields.emplace_back(std::move(name), std::move(value));
+  }
+  headers->emplace_back(":method", std::string(request_line[0]));
+  headers->emplace_back(":scheme", std::string(scheme));
+  headers->emplace_back(":authority", std::move(host));
+  headers->emplace_back(":path", std::string(request_line[1]));
+  for (auto& field : fields) {
+    headers->push_back(std::move(field));
+  }
+  return true;
+}
+
+}  // anonymous namespace
+
+// Stream is shared by the session thread and the thread where the stream
+// is used.
+class Http2Transport::Stream : public std::enable_shared_from_this<Stream> {
+ public:
+  Stream(Http2Transport* transport, WorkerThread::ThreadId thread_id)
+      : transport_(transport), thread_id_(thread_id) {}
+
+  // Called on the stream thread.
+  void SetRequestHeaders(HpackHeaderList headers, int64_t content_length) {
+    {
+      AUTOLOCK(lock, &mu_);
+      request_headers_ = std::move(headers);
+      body_unsent_ = content_length;
+      headers_set_ = true;
+    }
+    NotifySession();
+  }
+
+  // Buffers |data| of request body, and returns the size buffered.
+  // Returns -1 if the stream has failed.
+  ssize_t AppendRequestBody(absl::string_view data) {
+    size_t size;
+    {
+      AUTOLOCK(lock, &mu_);
+      if (!error_.empty()) {
+        return -1;
+      }
+      DCHECK(headers_set_);
+      size = std::min(data.size(), kStreamSendBufferSize -
+                                       std::min(kStreamSendBufferSize,
+                                                send_buf_.size()));
+      send_buf_.append(data.data(), size);
+    }
+    if (size > 0) {
+      NotifySession();
+    }
+    return size;
+  }
+
+  // Reads synthesized HTTP/1.1 response.
+  ssize_t ReadResponse(char* buf, size_t len, bool* need_retry) {
+    *need_retry = false;
+    size_t size = 0;
+    bool notify = false;
+    {
+      AUTOLOCK(lock, &mu_);
+      if (recv_offset_ == recv_buf_.size()) {
+        if (eof_) {
+          return 0;
+        }
+        if (!error_.empty()) {
+          return -1;
+        }
+        *need_retry = true;
+        return -1;
+      }
+      size = std::min(len, recv_buf_.size() - recv_offset_);
+      memcpy(buf, recv_buf_.data() + recv_offset_, size);
+      recv_offset_ += size;
+      if (recv_offset_ == recv_buf_.size()) {
+        recv_buf_.clear();
+        recv_offset_ = 0;
+      }
+      // Lets the session thread send WINDOW_UPDATE.
+      consumed_ += size;
+      if (consumed_ >= kStreamRecvWindow / 4 ||
+          (recv_buf_.empty() && !eof_)) {
+        consumed_ = 0;
+        notify = true;
+      }
+    }
+    if (notify) {
+      NotifySession();
+    }
+    return size;
+  }
+
+  bool IsReadable() const {
+    AUTOLOCK(lock, &mu_);
+    return recv_offset_ < recv_buf_.size() || eof_ || !error_.empty();
+  }
+
+  bool IsWritable() const {
+    AUTOLOCK(lock, &mu_);
+    return !headers_set_ || send_buf_.size() < kStreamSendBufferSize ||
+           !error_.empty();
+  }
+
+  std::string error() const {
+    AUTOLOCK(lock, &mu_);
+    return error_;
+  }
+
+  // Called on the session thread.
+  bool HasRequestHeaders() const {
+    AUTOLOCK(lock, &mu_);
+    return headers_set_;
+  }
+
+  void TakeRequestHeaders(HpackHeaderList* headers, int64_t* content_length) {
+    AUTOLOCK(lock, &mu_);
+    DCHECK(headers_set_);
+    *headers = std::move(request_headers_);
+    *content_length = body_unsent_;
+  }
+
+  // Takes at most |max_size| of request body.
+  // |end_stream| is set to true if it is the end of the request body.
+  std::string TakeRequestBody(size_t max_size, bool* end_stream) {
+    std::string data;
+    bool notify = false;
+    {
+      AUTOLOCK(lock, &mu_);
+      const size_t size = std::min(max_size, send_buf_.size());
+      notify = send_buf_.size() >= kStreamSendBufferSize && size > 0;
+      data = send_buf_.substr(0, size);
+      send_buf_.erase(0, size);
+      body_unsent_ -= size;
+      *end_stream = body_unsent_ == 0;
+    }
+    if (notify) {
+      NotifyTask();
+    }
+    return data;
+  }
+
+  size_t UnreadSize() const {
+    AUTOLOCK(lock, &mu_);
+    return recv_buf_.size() - recv_offset_;
+  }
+
+  void OnResponseHeaders(int status, const HpackHeaderList& headers,
+                         bool end_stream) {
+    {
+      AUTOLOCK(lock, &mu_);
+      // Only status code is used by HttpClient.
+      absl::StrAppend(&recv_buf_, "HTTP/1.1 ", status, " ",
+                      status == 200 ? "OK" : "", "\r\n");
+      bool has_content_length = false;
+      for (const auto& field : headers) {
+        if (absl::StartsWith(field.first, ":") ||
+            field.first == "connection" ||
+            field.first == "transfer-encoding") {
+          continue;
+        }
+        if (field.first == "content-length") {
+          has_content_length = true;
+        }
+        absl::StrAppend(&recv_buf_, field.first, ": ", field.second, "\r\n");
+      }
+      if (end_stream) {
+        if (!has_content_length) {
+          recv_buf_.append("content-length: 0\r\n");
+        }
+        eof_ = true;
+      } else if (!has_content_length) {
+        recv_buf_.append("transfer-encoding: chunked\r\n");
+        chunked_ = true;
+      }
+      recv_buf_.append("\r\n");
+    }
+    NotifyTask();
+  }
+
+  void OnResponseData(absl::string_view data) {
+    {
+      AUTOLOCK(lock, &mu_);
+      if (chunked_) {
+        std::ostringstream ss;
+        ss << std::hex << data.size() << "\r\n";
+        recv_buf_.append(ss.str());
+      }
+      recv_buf_.append(data.data(), data.size());
+      if (chunked_) {
+        recv_buf_.append("\r\n");
+      }
+    }
+    NotifyTask();
+  }
+
+  void OnResponseEnd() {
+    {
+      AUTOLOCK(lock, &mu_);
+      if (eof_) {
+        return;
+      }
+      if (chunked_) {
+        recv_buf_.append("0\r\n\r\n");
+      }
+      eof_ = true;
+    }
+    NotifyTask();
+  }
+
+  // Called on any thread.
+  void Fail(const std::string& reason) {
+    {
+      AUTOLOCK(lock, &mu_);
+      // Keep the response if it has been received.
+      if (eof_ || !error_.empty()) {
+        return;
+      }
+      error_ = reason;
+    }
+    NotifyTask();
+  }
+
+  // Runs StreamDescriptor's notification on the stream thread.
+  void NotifyTask() {
+    {
+      AUTOLOCK(lock, &mu_);
+      if (task_notified_) {
+        return;
+      }
+      task_notified_ = true;
+    }
+    transport_->wm_->RunClosureInThread(
+        FROM_HERE, thread_id_,
+        NewCallback(&Stream::RunTaskNotification, shared_from_this()),
+        WorkerThread::PRIORITY_IMMEDIATE);
+  }
+
+  // Lets the session handle the update of the stream.
+  void NotifySession() {
+    {
+      AUTOLOCK(lock, &mu_);
+      if (session_notified_) {
+        return;
+      }
+      session_notified_ = true;
+    }
+    transport_->RunInSessionThread(
+        NewCallback(&Stream::RunSessionNotification, shared_from_this()));
+  }
+
+  static void RunTaskNotification(std::shared_ptr<Stream> stream);
+  static void RunSessionNotification(std::shared_ptr<Stream> stream);
+  static void RunRelease(std::shared_ptr<Stream> stream, bool completed);
+
+  Http2Transport* const transport_;
+  const WorkerThread::ThreadId thread_id_;
+
+  // Accessed only on the stream thread.
+  StreamDescriptor* descriptor_ = nullptr;
+
+  // Accessed only on the session thread.
+  Session* session_ = nullptr;
+  uint32_t id_ = 0;
+  int64_t send_window_ = 0;
+  int64_t recv_window_ = 0;
+  bool queued_ = false;
+  bool released_ = false;
+  bool response_started_ = false;
+  // END_STREAM has been sent or received.
+  bool local_closed_ = false;
+  bool remote_closed_ = false;
+
+ private:
+  mutable Lock mu_;
+  HpackHeaderList request_headers_ ABSL_GUARDED_BY(mu_);
+  bool headers_set_ ABSL_GUARDED_BY(mu_) = false;
+  // Request body not taken by the session yet.
+  int64_t body_unsent_ ABSL_GUARDED_BY(mu_) = 0;
+  std::string send_buf_ ABSL_GUARDED_BY(mu_);
+  // Synthesized HTTP/1.1 response.
+  std::string recv_buf_ ABSL_GUARDED_BY(mu_);
+  size_t recv_offset_ ABSL_GUARDED_BY(mu_) = 0;
+  bool chunked_ ABSL_GUARDED_BY(mu_) = false;
+  bool eof_ ABSL_GUARDED_BY(mu_) = false;
+  std::string error_ ABSL_GUARDED_BY(mu_);
+  int64_t consumed_ ABSL_GUARDED_BY(mu_) = 0;
+  bool task_notified_ ABSL_GUARDED_BY(mu_) = false;
+  bool session_notified_ ABSL_GUARDED_BY(mu_) = false;
+
+  friend class StreamDescriptor;
+
+  DISALLOW_COPY_AND_ASSIGN(Stream);
+};
+
+// StreamDescriptor is a Descriptor of a stream for HttpClient::Task.
+// Readable and writable notifications are level-triggered like
+// SocketDescriptor; notification closures keep running while the stream is
+// readable or writable.
+class Http2Transport::StreamDescriptor : public Descriptor {
+ public:
+  StreamDescriptor(Http2Transport* transport, std::shared_ptr<Stream> stream)
+      : transport_(transport),
+        stream_(std::move(stream)),
+        thread_id_(stream_->thread_id_),
+        last_time_(absl::Now()) {
+    stream_->descriptor_ = this;
+  }
+  ~StreamDescriptor() override {
+    DCHECK(THREAD_ID_IS_SELF(thread_id_));
+    if (timeout_check_ != nullptr) {
+      timeout_check_->Cancel();
+    }
+    stream_->descriptor_ = nullptr;
+  }
+
+  const std::shared_ptr<Stream>& stream() const { return stream_; }
+
+  void NotifyWhenReadable(std::unique_ptr<PermanentClosure> closure) override {
+    DCHECK(THREAD_ID_IS_SELF(thread_id_));
+    readable_closure_ = std::move(closure);
+    active_read_ = true;
+    last_time_ = absl::Now();
+    stream_->NotifyTask();
+  }
+
+  void NotifyWhenWritable(std::unique_ptr<PermanentClosure> closure) override {
+    DCHECK(THREAD_ID_IS_SELF(thread_id_));
+    writable_closure_ = std::move(closure);
+    active_write_ = true;
+    last_time_ = absl::Now();
+    stream_->NotifyTask();
+  }
+
+  void ClearWritable() override {
+    DCHECK(THREAD_ID_IS_SELF(thread_id_));
+    writable_closure_.reset();
+    active_write_ = false;
+  }
+
+  void NotifyWhenTimedout(absl::Duration timeout,
+                          OneshotClosure* closure) override {
+    DCHECK(THREAD_ID_IS_SELF(thread_id_));
+    DCHECK(!timeout_closure_);
+    timeout_ = timeout;
+    timeout_closure_.reset(closure);
+    last_time_ = absl::Now();
+    ScheduleTimeoutCheck(timeout);
+  }
+
+  void ChangeTimeout(absl::Duration timeout) override {
+    DCHECK(THREAD_ID_IS_SELF(thread_id_));
+    timeout_ = timeout;
+    last_time_ = absl::Now();
+  }
+
+  ssize_t Read(void* ptr, size_t len) override {
+    CHECK_GT(len, 0U);
+    ssize_t r =
+        stream_->ReadResponse(static_cast<char*>(ptr), len, &need_retry_);
+    if (r < 0 && !need_retry_) {
+      error_message_ = stream_->error();
+    }
+    return r;
+  }
+
+  ssize_t Write(const void* ptr, size_t len) override {
+    CHECK_GT(len, 0U);
+    need_retry_ = false;
+    absl::string_view data(static_cast<const char*>(ptr), len);
+    size_t consumed = 0;
+    if (!request_header_done_) {
+      const size_t prev = request_header_.size();
+      request_header_.append(data.data(), data.size());
+      absl::string_view::size_type pos =
+          request_header_.find("\r\n\r\n", prev < 3 ? 0 : prev - 3);
+      if (pos == std::string::npos) {
+        if (request_header_.size() > kMaxRequestHeaderSize) {
+          return Fail("too large request header");
+        }
+        return len;
+      }
+      request_header_.resize(pos + 4);
+      consumed = request_header_.size() - prev;
+      data.remove_prefix(consumed);
+
+      HpackHeaderList headers;
+      std::string err;
+      if (!ConvertRequestHeader(request_header_,
+                                transport_->options_.use_ssl ? "https"
+                                                             : "http",
+                                transport_->options_.authority, &headers,
+                                &body_remaining_, &err)) {
+        return Fail(err);
+      }
+      request_header_done_ = true;
+      stream_->SetRequestHeaders(std::move(headers), body_remaining_);
+      if (data.empty()) {
+        return consumed;
+      }
+    }
+    if (static_cast<int64_t>(data.size()) > body_remaining_) {
+      return Fail("request body is larger than content-length");
+    }
+    ssize_t r = stream_->AppendRequestBody(data);
+    if (r < 0) {
+      error_message_ = stream_->error();
+      return consumed > 0 ? consumed : -1;
+    }
+    body_remaining_ -= r;
+    if (r == 0 && consumed == 0) {
+      need_retry_ = true;
+      return -1;
+    }
+    return consumed + r;
+  }
+
+  bool NeedRetry() const override { return need_retry_; }
+  // Streams are not reused.  Connections are reused by Http2Transport.
+  bool CanReuse() const override { return false; }
+  std::string GetLastErrorMessage() const override {
+    return absl::StrCat("http2 stream: ", error_message_);
+  }
+
+  void StopRead() override {
+    DCHECK(THREAD_ID_IS_SELF(thread_id_));
+    active_read_ = false;
+  }
+  void StopWrite() override {
+    DCHECK(THREAD_ID_IS_SELF(thread_id_));
+    active_write_ = false;
+  }
+
+  SocketDescriptor* socket_descriptor() override { return nullptr; }
+
+  // Runs notification closures while the stream is readable or writable.
+  void OnNotify() {
+    DCHECK(THREAD_ID_IS_SELF(thread_id_));
+    if (WaitWritable() && stream_->IsWritable()) {
+      last_time_ = absl::Now();
+      writable_closure_->Run();
+    }
+    if (WaitReadable() && stream_->IsReadable()) {
+      last_time_ = absl::Now();
+      readable_closure_->Run();
+    }
+    if ((WaitWritable() && stream_->IsWritable()) ||
+        (WaitReadable() && stream_->IsReadable())) {
+      stream_->NotifyTask();
+    }
+  }
+
+ private:
+  bool WaitReadable() const { return active_read_ && readable_closure_; }
+  bool WaitWritable() const { return active_write_ && writable_closure_; }
+
+  ssize_t Fail(const std::string& reason) {
+    LOG(WARNING) << "http2 stream failed: " << reason;
+    error_message_ = reason;
+    stream_->Fail(reason);
+    return -1;
+  }
+
+  void ScheduleTimeoutCheck(absl::Duration delay) {
+    if (timeout_check_ != nullptr) {
+      timeout_check_->Cancel();
+    }
+    timeout_check_ = transport_->wm_->RunDelayedClosureInThread(
+        FROM_HERE, thread_id_, delay,
+        NewCallback(this, &StreamDescriptor::CheckTimeout));
+  }
+
+  void CheckTimeout() {
+    timeout_check_ = nullptr;
+    if (!timeout_closure_) {
+      return;
+    }
+    const absl::Duration elapsed = absl::Now() - last_time_;
+    if (elapsed < timeout_ || (!active_read_ && !active_write_)) {
+      ScheduleTimeoutCheck(std::max(timeout_ - elapsed, absl::Milliseconds(1)));
+      return;
+    }
+    LOG(INFO) << "http2 stream timeout=" << timeout_;
+    OneshotClosure* closure = timeout_closure_.release();
+    closure->Run();
+  }
+
+  Http2Transport* const transport_;
+  const std::shared_ptr<Stream> stream_;
+  const WorkerThread::ThreadId thread_id_;
+
+  std::unique_ptr<PermanentClosure> readable_closure_;
+  std::unique_ptr<PermanentClosure> writable_closure_;
+  bool active_read_ = false;
+  bool active_write_ = false;
+  bool need_retry_ = false;
+  std::string error_message_;
+
+  std::string request_header_;
+  bool request_header_done_ = false;
+  int64_t body_remaining_ = 0;
+
+  absl::Duration timeout_;
+  std::unique_ptr<OneshotClosure> timeout_closure_;
+  absl::Time last_time_;
+  WorkerThread::CancelableClosure* timeout_check_ = nullptr;
+};
+
+// Session is an HTTP/2 connection.  It runs on the session thread.
+class Http2Transport::Session {
+ public:
+  Session(Http2Transport* transport, int id)
+      : transport_(transport), id_(id) {}
+
+  int id() const { return id_; }
+  bool torn_down() const { return torn_down_; }
+
+  // Starts the connection on |fd|.  If |fd| is invalid, the session is
+  // closed.  If |engine| is not nullptr, TLS is used.
+  void Start(int fd, TLSEngine* engine) {
+    thread_id_ = transport_->wm_->GetCurrentThreadId();
+    ScopedSocket sock(fd);
+    if (!sock.valid()) {
+      Close("failed to connect", true);
+      return;
+    }
+    socket_ = transport_->wm_->RegisterSocketDescriptor(
+        std::move(sock), WorkerThread::PRIORITY_MED);
+    if (engine != nullptr) {
+      engine_ = engine;
+      tls_ = absl::make_unique<TLSDescriptor>(
+          socket_, engine, transport_->options_.tls_options, transport_->wm_);
+      tls_->Init();
+      conn_ = tls_.get();
+    } else {
+      conn_ = socket_;
+      connected_ = true;
+    }
+    // Connection preface.  RFC 7540 3.5.
+    output_.append(kHttp2ConnectionPreface.data(),
+                   kHttp2ConnectionPreface.size());
+    AppendHttp2Settings(
+        {
+            {Http2SettingsId::kEnablePush, 0},
+            {Http2SettingsId::kInitialWindowSize, kStreamRecvWindow},
+        },
+        &output_);
+    AppendHttp2WindowUpdate(0, kConnectionRecvWindow - kHttp2DefaultWindowSize,
+                            &output_);
+    conn_recv_window_ = kConnectionRecvWindow;
+    conn_->NotifyWhenReadable(NewPermanentCallback(this, &Session::OnReadable));
+    conn_->NotifyWhenWritable(NewPermanentCallback(this, &Session::OnWritable));
+    Pump();
+  }
+
+  void AddStream(std::shared_ptr<Stream> stream) {
+    stream->session_ = this;
+    if (closed_) {
+      stream->Fail(close_reason_);
+      return;
+    }
+    OnStreamUpdated(std::move(stream));
+  }
+
+  void OnStreamUpdated(std::shared_ptr<Stream> stream) {
+    if (closed_ || stream->released_) {
+      return;
+    }
+    if (stream->id_ == 0) {
+      if (!stream->queued_ && stream->HasRequestHeaders()) {
+        stream->queued_ = true;
+        waiting_streams_.push_back(std::move(stream));
+      }
+    } else {
+      MaybeUpdateStreamWindow(stream.get());
+    }
+    Pump();
+  }
+
+  void OnStreamReleased(std::shared_ptr<Stream> stream, bool completed) {
+    stream->released_ = true;
+    if (!closed_ && stream->id_ != 0) {
+      auto found = active_streams_.find(stream->id_);
+      if (found != active_streams_.end()) {
+        // The stream is still open.  RFC 7540 8.1.
+        AppendHttp2RstStream(stream->id_,
+                             completed ? Http2ErrorCode::kNoError
+                                       : Http2ErrorCode::kCancel,
+                             &output_);
+        active_streams_.erase(found);
+        if (!completed) {
+          transport_->num_canceled_streams_.Add(1);
+        }
+      }
+    }
+    {
+      AUTOLOCK(lock, &transport_->mu_);
+      --num_streams_;
+    }
+    if (closed_) {
+      // |this| may be deleted.
+      transport_->MaybeDeleteSession(this);
+      return;
+    }
+    MaybeCloseGoingAway();
+    Pump();
+  }
+
+  // Closes the connection.  Streams on the connection fail.
+  void Close(const std::string& reason, bool error) {
+    if (closed_) {
+      return;
+    }
+    LOG_IF(WARNING, error) << "http2 session " << id_ << " closed: " << reason;
+    LOG_IF(INFO, !error) << "http2 session " << id_ << " closed: " << reason;
+    closed_ = true;
+    close_reason_ = reason;
+    close_error_ = error;
+    if (error) {
+      transport_->num_connection_errors_.Add(1);
+    }
+    StopAccepting();
+    for (auto& stream : waiting_streams_) {
+      stream->Fail(reason);
+    }
+    waiting_streams_.clear();
+    for (auto& entry : active_streams_) {
+      entry.second->Fail(reason);
+    }
+    active_streams_.clear();
+    if (conn_ == nullptr) {
+      torn_down_ = true;
+      transport_->MaybeDeleteSession(this);
+      return;
+    }
+    conn_->StopRead();
+    conn_->StopWrite();
+    // Lower priority than descriptors so that notification closures
+    // already in the queue run before TLSDescriptor is deleted.
+    transport_->wm_->RunClosureInThread(
+        FROM_HERE, thread_id_, NewCallback(this, &Session::TearDown),
+        WorkerThread::PRIORITY_MED);
+  }
+
+  // Guarded by transport's mu_.
+  int num_streams_ = 0;
+  bool accepting_ = true;
+
+ private:
+  void StopAccepting() {
+    AUTOLOCK(lock, &transport_->mu_);
+    accepting_ = false;
+  }
+
+  void TearDown() {
+    tls_.reset();
+    ScopedSocket fd(transport_->wm_->DeleteSocketDescriptor(socket_));
+    socket_ = nullptr;
+    conn_ = nullptr;
+    if (fd.valid()) {
+      transport_->socket_factory_->CloseSocket(std::move(fd), close_error_);
+    }
+    torn_down_ = true;
+    // |this| may be deleted.
+    transport_->MaybeDeleteSession(this);
+  }
+
+  // Checks the protocol negotiated by ALPN.
+  bool CheckProtocol() {
+    if (protocol_checked_ || engine_ == nullptr || !engine_->IsReady()) {
+      return true;
+    }
+    protocol_checked_ = true;
+    const std::string protocol = engine_->GetAlpnSelected();
+    if (protocol == kAlpnHttp2) {
+      return true;
+    }
+    const std::string reason =
+        absl::StrCat("server does not support h2. alpn=", protocol);
+    transport_->OnHttp2Unavailable(reason);
+    Close(reason, false);
+    return false;
+  }
+
+  void OnReadable() {
+    connected_ = true;
+    if (closed_ || !CheckProtocol()) {
+      return;
+    }
+    for (;;) {
+      const ssize_t n = conn_->Read(read_buf_, sizeof(read_buf_));
+      if (n < 0 && conn_->NeedRetry()) {
+        break;
+      }
+      if (n == 0) {
+        Close("connection closed by server", going_away_ ? false : true);
+        return;
+      }
+      if (n < 0) {
+        Close(absl::StrCat("read failed: ", conn_->GetLastErrorMessage()),
+              true);
+        return;
+      }
+      input_.append(read_buf_, n);
+      if (!ProcessInput()) {
+        return;
+      }
+      // The socket is notified again while it is readable, but
+      // TLSDescriptor does not notify for data buffered in TLS engine.
+      if (tls_ == nullptr) {
+        break;
+      }
+    }
+    Pump();
+  }
+
+  void OnWritable() {
+    connected_ = true;
+    if (closed_ || !CheckProtocol()) {
+      return;
+    }
+    Flush();
+    Pump();
+  }
+
+  size_t PendingOutput() const {
+    return output_.size() + write_buf_.size() - write_offset_;
+  }
+
+  void Pump() {
+    ProcessSend();
+    Flush();
+  }
+
+  void Flush() {
+    if (closed_ || !connected_) {
+      return;
+    }
+    for (;;) {
+      if (write_offset_ == write_buf_.size()) {
+        write_buf_.clear();
+        write_offset_ = 0;
+        if (output_.empty()) {
+          break;
+        }
+        // |write_buf_| is not modified until it is written, since TLS
+        // needs to retry with the same buffer.
+        write_buf_.swap(output_);
+      }
+      const ssize_t n = conn_->Write(write_buf_.data() + write_offset_,
+                                     write_buf_.size() - write_offset_);
+      if (n < 0 && conn_->NeedRetry()) {
+        break;
+      }
+      if (n <= 0) {
+        Close(absl::StrCat("write failed: ", conn_->GetLastErrorMessage()),
+              true);
+        return;
+      }
+      write_offset_ += n;
+      if (tls_ == nullptr) {
+        // Rest will be written when the socket gets writable.
+        break;
+      }
+    }
+    if (tls_ != nullptr) {
+      // TLSDescriptor calls OnWritable when TLS engine gets ready to write.
+      return;
+    }
+    if (PendingOutput() > 0) {
+      socket_->RestartWrite();
+    } else {
+      socket_->StopWrite();
+      socket_->UnregisterWritable();
+    }
+  }
+
+  // Makes HEADERS and DATA frames of requests.
+  void ProcessSend() {
+    if (closed_) {
+      return;
+    }
+    while (!waiting_streams_.empty() && !going_away_ &&
+           active_streams_.size() < peer_max_concurrent_streams_ &&
+           PendingOutput() < kMaxPendingOutput) {
+      std::shared_ptr<Stream> stream = std::move(waiting_streams_.front());
+      waiting_streams_.pop_front();
+      if (stream->released_) {
+        continue;
+      }
+      if (next_stream_id_ > kMaxStreamId) {
+        // All stream ids have been used.
+        StopAccepting();
+        going_away_ = true;
+        stream->Fail("no stream id available");
+        continue;
+      }
+      HpackHeaderList headers;
+      int64_t content_length;
+      stream->TakeRequestHeaders(&headers, &content_length);
+      stream->id_ = next_stream_id_;
+      next_stream_id_ += 2;
+      stream->send_window_ = peer_initial_window_;
+      stream->recv_window_ = kStreamRecvWindow;
+      std::string block;
+      encoder_.Encode(headers, &block);
+      AppendHttp2Headers(stream->id_, block, content_length == 0,
+                         peer_max_frame_size_, &output_);
+      stream->local_closed_ = content_length == 0;
+      active_streams_.emplace(stream->id_, std::move(stream));
+    }
+
+    std::vector<uint32_t> closed_streams;
+    bool progress = true;
+    while (progress && conn_send_window_ > 0 &&
+           PendingOutput() < kMaxPendingOutput) {
+      progress = false;
+      for (auto& entry : active_streams_) {
+        Stream* stream = entry.second.get();
+        if (stream->local_closed_ || stream->send_window_ <= 0) {
+          continue;
+        }
+        const size_t max_size = std::min<int64_t>(
+            {stream->send_window_, conn_send_window_,
+             static_cast<int64_t>(peer_max_frame_size_)});
+        bool end_stream = false;
+        std::string data = stream->TakeRequestBody(max_size, &end_stream);
+        if (data.empty() && !end_stream) {
+          continue;
+        }
+        AppendHttp2Frame(Http2FrameType::kData,
+                         end_stream ? kHttp2FlagEndStream : 0, stream->id_,
+                         data, &output_);
+        stream->send_window_ -= data.size();
+        conn_send_window_ -= data.size();
+        progress = true;
+        if (end_stream) {
+          stream->local_closed_ = true;
+          if (stream->remote_closed_) {
+            closed_streams.push_back(stream->id_);
+          }
+        }
+        if (conn_send_window_ <= 0 || PendingOutput() >= kMaxPendingOutput) {
+          break;
+        }
+      }
+    }
+    for (uint32_t id : closed_streams) {
+      active_streams_.erase(id);
+    }
+  }
+
+  bool ProcessInput() {
+    size_t pos = 0;
+    while (input_.size() - pos >= kHttp2FrameHeaderSize) {
+      absl::string_view data(input_);
+      data.remove_prefix(pos);
+      const Http2FrameHeader header = ParseHttp2FrameHeader(data);
+      // We don't change SETTINGS_MAX_FRAME_SIZE.
+      if (header.length > kHttp2DefaultMaxFrameSize) {
+        return ConnectionError(Http2ErrorCode::kFrameSizeError,
+                               absl::StrCat("too large frame: ",
+                                            header.length));
+      }
+      if (data.size() - kHttp2FrameHeaderSize < header.length) {
+        break;
+      }
+      if (!HandleFrame(header,
+                       data.substr(kHttp2FrameHeaderSize, header.length))) {
+        return false;
+      }
+      pos += kHttp2FrameHeaderSize + header.length;
+    }
+    input_.erase(0, pos);
+    return true;
+  }
+
+  // Sends GOAWAY and closes the connection.  Always returns false.
+  bool ConnectionError(Http2ErrorCode code, const std::string& reason) {
+    AppendHttp2GoAway(0, code, &output_);
+    Flush();
+    Close(absl::StrCat("http2 connection error: ", reason), true);
+    return false;
+  }
+
+  // Sends RST_STREAM and closes the stream.
+  void ResetStream(uint32_t id, Http2ErrorCode code,
+                   const std::string& reason) {
+    AppendHttp2RstStream(id, code, &output_);
+    auto found = active_streams_.find(id);
+    if (found == active_streams_.end()) {
+      return;
+    }
+    found->second->Fail(absl::StrCat("http2 stream error: ", reason));
+    active_streams_.erase(found);
+  }
+
+  void OnRemoteClosed(Stream* stream) {
+    stream->remote_closed_ = true;
+    if (stream->local_closed_) {
+      // |stream| may be deleted.
+      active_streams_.erase(stream->id_);
+    }
+  }
+
+  // Returns true if |id| has not been used yet, or is a server-initiated
+  // stream, which is not allowed since push is disabled.
+  bool IsInvalidStreamId(uint32_t id) const {
+    return id >= next_stream_id_ || id % 2 == 0;
+  }
+
+  bool HandleFrame(const Http2FrameHeader& header, absl::string_view payload) {
+    const Http2FrameType type = static_cast<Http2FrameType>(header.type);
+    if (continuation_stream_id_ != 0 &&
+        (type != Http2FrameType::kContinuation ||
+         header.stream_id != continuation_stream_id_)) {
+      return ConnectionError(Http2ErrorCode::kProtocolError,
+                             "CONTINUATION expected");
+    }
+    switch (type) {
+      case Http2FrameType::kData:
+        return HandleData(header, payload);
+      case Http2FrameType::kHeaders:
+        return HandleHeaders(header, payload);
+      case Http2FrameType::kContinuation:
+        return HandleContinuation(header, payload);
+      case Http2FrameType::kRstStream:
+        return HandleRstStream(header, payload);
+      case Http2FrameType::kSettings:
+        return HandleSettings(header, payload);
+      case Http2FrameType::kPing:
+        return HandlePing(header, payload);
+      case Http2FrameType::kGoAway:
+        return HandleGoAway(header, payload);
+      case Http2FrameType::kWindowUpdate:
+        return HandleWindowUpdate(header, payload);
+      case Http2FrameType::kPushPromise:
+        return ConnectionError(Http2ErrorCode::kProtocolError,
+                               "PUSH_PROMISE while push is disabled");
+      case Http2FrameType::kPriority:
+        return true;
+    }
+    // Unknown frame type must be ignored.  RFC 7540 4.1.
+    return true;
+  }
+
+  bool HandleData(const Http2FrameHeader& header, absl::string_view payload) {
+    if (header.stream_id == 0) {
+      return ConnectionError(Http2ErrorCode::kProtocolError,
+                             "DATA on stream 0");
+    }
+    // Flow control counts entire payload including padding.
+    conn_recv_window_ -= header.length;
+    if (conn_recv_window_ < 0) {
+      return ConnectionError(Http2ErrorCode::kFlowControlError,
+                             "connection window exceeded");
+    }
+    MaybeUpdateConnectionWindow();
+    if ((header.flags & kHttp2FlagPadded) && !RemoveHttp2Padding(&payload)) {
+      return ConnectionError(Http2ErrorCode::kProtocolError,
+                             "invalid padding");
+    }
+    auto found = active_streams_.find(header.stream_id);
+    if (found == active_streams_.end()) {
+      if (IsInvalidStreamId(header.stream_id)) {
+        return ConnectionError(Http2ErrorCode::kProtocolError,
+                               "DATA on idle stream");
+      }
+      // Canceled or reset stream.
+      return true;
+    }
+    std::shared_ptr<Stream> stream = found->second;
+    if (stream->remote_closed_) {
+      ResetStream(stream->id_, Http2ErrorCode::kStreamClosed,
+                  "DATA after END_STREAM");
+      return true;
+    }
+    stream->recv_window_ -= header.length;
+    if (stream->recv_window_ < 0) {
+      ResetStream(stream->id_, Http2ErrorCode::kFlowControlError,
+                  "stream window exceeded");
+      return true;
+    }
+    if (!stream->response_started_) {
+      ResetStream(stream->id_, Http2ErrorCode::kProtocolError,
+                  "DATA before HEADERS");
+      return true;
+    }
+    if (!payload.empty()) {
+      stream->OnResponseData(payload);
+    }
+    if (header.flags & kHttp2FlagEndStream) {
+      stream->OnResponseEnd();
+      OnRemoteClosed(stream.get());
+      return true;
+    }
+    MaybeUpdateStreamWindow(stream.get());
+    return true;
+  }
+
+  bool HandleHeaders(const Http2FrameHeader& header,
+                     absl::string_view payload) {
+    if (header.stream_id == 0) {
+      return ConnectionError(Http2ErrorCode::kProtocolError,
+                             "HEADERS on stream 0");
+    }
+    if ((header.flags & kHttp2FlagPadded) && !RemoveHttp2Padding(&payload)) {
+      return ConnectionError(Http2ErrorCode::kProtocolError,
+                             "invalid padding");
+    }
+    if (header.flags & kHttp2FlagPriority) {
+      // Stream dependency and weight are not used.
+      if (payload.size() < 5) {
+        return ConnectionError(Http2ErrorCode::kFrameSizeError,
+                               "too short HEADERS");
+      }
+      payload.remove_prefix(5);
+    }
+    header_block_.assign(payload.data(), payload.size());
+    if (header.flags & kHttp2FlagEndHeaders) {
+      return OnHeaderBlock(header.stream_id, header.flags);
+    }
+    continuation_stream_id_ = header.stream_id;
+    continuation_flags_ = header.flags;
+    return true;
+  }
+
+  bool HandleContinuation(const Http2FrameHeader& header,
+                          absl::string_view payload) {
+    if (continuation_stream_id_ == 0) {
+      return ConnectionError(Http2ErrorCode::kProtocolError,
+                             "unexpected CONTINUATION");
+    }
+    header_block_.append(payload.data(), payload.size());
+    if (header_block_.size() > kMaxHeaderBlockSize) {
+      return ConnectionError(Http2ErrorCode::kEnhanceYourCalm,
+                             "too large header block");
+    }
+    if ((header.flags & kHttp2FlagEndHeaders) == 0) {
+      return true;
+    }
+    const uint32_t stream_id = continuation_stream_id_;
+    continuation_stream_id_ = 0;
+    return OnHeaderBlock(stream_id, continuation_flags_);
+  }
+
+  bool OnHeaderBlock(uint32_t stream_id, uint8_t flags) {
+    HpackHeaderList headers;
+    // Header block must be decoded even for closed streams to keep
+    // the decoder state.
+    if (!decoder_.Decode(header_block_, &headers)) {
+      return ConnectionError(Http2ErrorCode::kCompressionError,
+                             "failed to decode header block");
+    }
+    header_block_.clear();
+    auto found = active_streams_.find(stream_id);
+    if (found == active_streams_.end()) {
+      if (IsInvalidStreamId(stream_id)) {
+        return ConnectionError(Http2ErrorCode::kProtocolError,
+                               "HEADERS on idle stream");
+      }
+      return true;
+    }
+    std::shared_ptr<Stream> stream = found->second;
+    const bool end_stream = (flags & kHttp2FlagEndStream) != 0;
+    if (stream->response_started_) {
+      // Trailers are ignored.
+      if (!end_stream) {
+        ResetStream(stream_id, Http2ErrorCode::kProtocolError,
+                    "trailers without END_STREAM");
+        return true;
+      }
+      stream->OnResponseEnd();
+      OnRemoteClosed(stream.get());
+      return true;
+    }
+    int status = 0;
+    for (const auto& field : headers) {
+      if (field.first == ":status") {
+        if (!absl::SimpleAtoi(field.second, &status)) {
+          status = 0;
+        }
+        break;
+      }
+    }
+    if (status < 100 || status > 999) {
+      ResetStream(stream_id, Http2ErrorCode::kProtocolError,
+                  "invalid :status");
+      return true;
+    }
+    if (status / 100 == 1) {
+      // Informational response is ignored.
+      if (end_stream) {
+        ResetStream(stream_id, Http2ErrorCode::kProtocolError,
+                    "END_STREAM on informational response");
+      }
+      return true;
+    }
+    stream->response_started_ = true;
+    stream->OnResponseHeaders(status, headers, end_stream);
+    if (end_stream) {
+      OnRemoteClosed(stream.get());
+    }
+    return true;
+  }
+
+  bool HandleRstStream(const Http2FrameHeader& header,
+                       absl::string_view payload) {
+    if (header.stream_id == 0) {
+      return ConnectionError(Http2ErrorCode::kProtocolError,
+                             "RST_STREAM on stream 0");
+    }
+    if (payload.size() != 4) {
+      return ConnectionError(Http2ErrorCode::kFrameSizeError,
+                             "invalid RST_STREAM");
+    }
+    auto found = active_streams_.find(header.stream_id);
+    if (found == active_streams_.end()) {
+      if (IsInvalidStreamId(header.stream_id)) {
+        return ConnectionError(Http2ErrorCode::kProtocolError,
+                               "RST_STREAM on idle stream");
+      }
+      return true;
+    }
+    found->second->Fail(absl::StrCat("stream reset by server. error_code=",
+                                     Http2ReadUint32(payload)));
+    active_streams_.erase(found);
+    MaybeCloseGoingAway();
+    return !closed_;
+  }
+
+  bool HandleSettings(const Http2FrameHeader& header,
+                      absl::string_view payload) {
+    if (header.stream_id != 0) {
+      return ConnectionError(Http2ErrorCode::kProtocolError,
+                             "SETTINGS on non-zero stream");
+    }
+    if (header.flags & kHttp2FlagAck) {
+      if (!payload.empty()) {
+        return ConnectionError(Http2ErrorCode::kFrameSizeError,
+                               "SETTINGS ack with payload");
+      }
+      return true;
+    }
+    Http2Settings settings;
+    if (!ParseHttp2Settings(payload, &settings)) {
+      return ConnectionError(Http2ErrorCode::kFrameSizeError,
+                             "invalid SETTINGS");
+    }
+    for (const auto& setting : settings) {
+      const uint32_t value = setting.second;
+      switch (setting.first) {
+        case Http2SettingsId::kMaxConcurrentStreams:
+          peer_max_concurrent_streams_ = value;
+          break;
+        case Http2SettingsId::kInitialWindowSize: {
+          if (value > kHttp2MaxWindowSize) {
+            return ConnectionError(Http2ErrorCode::kFlowControlError,
+                                   "too large initial window size");
+          }
+          const int64_t delta = value - peer_initial_window_;
+          for (auto& entry : active_streams_) {
+            entry.second->send_window_ += delta;
+            if (entry.second->send_window_ > kHttp2MaxWindowSize) {
+              return ConnectionError(Http2ErrorCode::kFlowControlError,
+                                     "stream window overflow");
+            }
+          }
+          peer_initial_window_ = value;
+          break;
+        }
+        case Http2SettingsId::kMaxFrameSize:
+          if (value < kHttp2DefaultMaxFrameSize ||
+              value > kHttp2MaxAllowedFrameSize) {
+            return ConnectionError(Http2ErrorCode::kProtocolError,
+                                   "invalid max frame size");
+          }
+          peer_max_frame_size_ = value;
+          break;
+        default:
+          // HpackEncoder doesn't use the dynamic table, and other
+          // settings are not relevant to the client.
+          break;
+      }
+    }
+    AppendHttp2Frame(Http2FrameType::kSettings, kHttp2FlagAck, 0, "",
+                     &output_);
+    return true;
+  }
+
+  bool HandlePing(const Http2FrameHeader& header, absl::string_view payload) {
+    if (header.stream_id != 0) {
+      return ConnectionError(Http2ErrorCode::kProtocolError,
+                             "PING on non-zero stream");
+    }
+    if (payload.size() != 8) {
+      return ConnectionError(Http2ErrorCode::kFrameSizeError, "invalid PING");
+    }
+    if ((header.flags & kHttp2FlagAck) == 0) {
+      AppendHttp2Frame(Http2FrameType::kPing, kHttp2FlagAck, 0, payload,
+                       &output_);
+    }
+    return true;
+  }
+
+  bool HandleGoAway(const Http2FrameHeader& header, absl::string_view payload) {
+    if (header.stream_id != 0) {
+      return ConnectionError(Http2ErrorCode::kProtocolError,
+                             "GOAWAY on non-zero stream");
+    }
+    if (payload.size() < 8) {
+      return ConnectionError(Http2ErrorCode::kFrameSizeError,
+                             "invalid GOAWAY");
+    }
+    const uint32_t last_stream_id = Http2ReadUint32(payload) & kMaxStreamId;
+    const uint32_t error_code = Http2ReadUint32(payload.substr(4));
+    LOG(INFO) << "http2 session " << id_ << " got GOAWAY"
+              << " last_stream_id=" << last_stream_id
+              << " error_code=" << error_code;
+    transport_->num_goaway_.Add(1);
+    going_away_ = true;
+    StopAccepting();
+    // Streams not processed by the server.  They can be retried by callers.
+    const std::string reason =
+        absl::StrCat("refused by GOAWAY. error_code=", error_code);
+    for (auto& stream : waiting_streams_) {
+      stream->Fail(reason);
+    }
+    waiting_streams_.clear();
+    for (auto it = active_streams_.begin(); it != active_streams_.end();) {
+      if (it->first > last_stream_id) {
+        it->second->Fail(reason);
+        active_streams_.erase(it++);
+      } else {
+        ++it;
+      }
+    }
+    MaybeCloseGoingAway();
+    return !closed_;
+  }
+
+  bool HandleWindowUpdate(const Http2FrameHeader& header,
+                          absl::string_view payload) {
+    if (payload.size() != 4) {
+      return ConnectionError(Http2ErrorCode::kFrameSizeError,
+                             "invalid WINDOW_UPDATE");
+    }
+    const uint32_t increment = Http2ReadUint32(payload) & 0x7fffffff;
+    if (header.stream_id == 0) {
+      if (increment == 0) {
+        return ConnectionError(Http2ErrorCode::kProtocolError,
+                               "zero WINDOW_UPDATE");
+      }
+      conn_send_window_ += increment;
+      if (conn_send_window_ > kHttp2MaxWindowSize) {
+        return ConnectionError(Http2ErrorCode::kFlowControlError,
+                               "connection window overflow");
+      }
+      return true;
+    }
+    auto found = active_streams_.find(header.stream_id);
+    if (found == active_streams_.end()) {
+      return true;
+    }
+    if (increment == 0) {
+      ResetStream(header.stream_id, Http2ErrorCode::kProtocolError,
+                  "zero WINDOW_UPDATE");
+      return true;
+    }
+    found->second->send_window_ += increment;
+    if (found->second->send_window_ > kHttp2MaxWindowSize) {
+      ResetStream(header.stream_id, Http2ErrorCode::kFlowControlError,
+                  "stream window overflow");
+    }
+    return true;
+  }
+
+  void MaybeUpdateConnectionWindow() {
+    if (conn_recv_window_ > kConnectionRecvWindow / 2) {
+      return;
+    }
+    AppendHttp2WindowUpdate(0, kConnectionRecvWindow - conn_recv_window_,
+                            &output_);
+    conn_recv_window_ = kConnectionRecvWindow;
+  }
+
+  // Gives window for data consumed by the stream thread.
+  void MaybeUpdateStreamWindow(Stream* stream) {
+    if (stream->remote_closed_) {
+      return;
+    }
+    const int64_t unread =
+        std::min<int64_t>(stream->UnreadSize(), kStreamRecvWindow);
+    const int64_t increment =
+        kStreamRecvWindow - unread - stream->recv_window_;
+    if (increment < kStreamRecvWindow / 2) {
+      return;
+    }
+    AppendHttp2WindowUpdate(stream->id_, increment, &output_);
+    stream->recv_window_ += increment;
+  }
+
+  void MaybeCloseGoingAway() {
+    if (going_away_ && active_streams_.empty() && waiting_streams_.empty()) {
+      Flush();
+      Close("going away", false);
+    }
+  }
+
+  Http2Transport* const transport_;
+  const int id_;
+  WorkerThread::ThreadId thread_id_;
+
+  SocketDescriptor* socket_ = nullptr;
+  std::unique_ptr<TLSDescriptor> tls_;
+  // |tls_| or |socket_|.
+  Descriptor* conn_ = nullptr;
+  TLSEngine* engine_ = nullptr;
+  // True if |conn_| is ready to read or write.
+  bool connected_ = false;
+  bool protocol_checked_ = false;
+  bool going_away_ = false;
+  bool closed_ = false;
+  bool close_error_ = false;
+  std::string close_reason_;
+  bool torn_down_ = false;
+
+  char read_buf_[kNetworkBufSize];
+  std::string input_;
+  // Frames to be written.
+  std::string output_;
+  // Frames being written.
+  std::string write_buf_;
+  size_t write_offset_ = 0;
+
+  HpackEncoder encoder_;
+  HpackDecoder decoder_;
+  std::string header_block_;
+  uint32_t continuation_stream_id_ = 0;
+  uint8_t continuation_flags_ = 0;
+
+  // Streams waiting for a stream id.
+  std::deque<std::shared_ptr<Stream>> waiting_streams_;
+  // Streams not closed yet.
+  absl::flat_hash_map<uint32_t, std::shared_ptr<Stream>> active_streams_;
+  uint32_t next_stream_id_ = 1;
+
+  int64_t conn_send_window_ = kHttp2DefaultWindowSize;
+  int64_t conn_recv_window_ = kHttp2DefaultWindowSize;
+  int64_t peer_initial_window_ = kHttp2DefaultWindowSize;
+  size_t peer_max_frame_size_ = kHttp2DefaultMaxFrameSize;
+  size_t peer_max_concurrent_streams_ = std::numeric_limits<uint32_t>::max();
+
+  DISALLOW_COPY_AND_ASSIGN(Session);
+};
+
+/* static */
+void Http2Transport::Stream::RunTaskNotification(
+    std::shared_ptr<Stream> stream) {
+  {
+    AUTOLOCK(lock, &stream->mu_);
+    stream->task_notified_ = false;
+  }
+  if (stream->descriptor_ != nullptr) {
+    stream->descriptor_->OnNotify();
+  }
+}
+
+/* static */
+void Http2Transport::Stream::RunSessionNotification(
+    std::shared_ptr<Stream> stream) {
+  {
+    AUTOLOCK(lock, &stream->mu_);
+    stream->session_notified_ = false;
+  }
+  if (stream->session_ != nullptr) {
+    stream->session_->OnStreamUpdated(std::move(stream));
+  }
+}
+
+/* static */
+void Http2Transport::Stream::RunRelease(std::shared_ptr<Stream> stream,
+                                        bool completed) {
+  DCHECK(stream->session_ != nullptr);
+  Session* session = stream->session_;
+  session->OnStreamReleased(std::move(stream), completed);
+}
+
+Http2Transport::Http2Transport(SocketFactory* socket_factory,
+                               TLSEngineFactory* tls_engine_factory,
+                               const Options& options,
+                               WorkerThreadManager* wm)
+    : socket_factory_(socket_factory),
+      tls_engine_factory_(tls_engine_factory),
+      options_(options),
+      wm_(wm),
+      pool_(wm->StartPool(1, "http2")) {
+  CHECK(!options_.use_ssl || tls_engine_factory_ != nullptr);
+  CHECK_GT(options_.max_connections, 0);
+  CHECK_GT(options_.max_concurrent_streams, 0);
+}
+
+Http2Transport::~Http2Transport() {
+  RunInSessionThread(NewCallback(this, &Http2Transport::ShutdownSessions));
+  AUTOLOCK(lock, &mu_);
+  while (!sessions_.empty()) {
+    cond_.Wait(&mu_);
+  }
+}
+
+bool Http2Transport::IsAvailable() const {
+  AUTOLOCK(lock, &mu_);
+  return available_;
+}
+
+Descriptor* Http2Transport::NewStream() {
+  Session* session = nullptr;
+  bool need_connect = false;
+  {
+    AUTOLOCK(lock, &mu_);
+    if (!available_) {
+      return nullptr;
+    }
+    session = PickSessionUnlocked();
+    if (session == nullptr) {
+      // Other threads may add streams to the new session while connecting.
+      sessions_.push_back(absl::make_unique<Session>(this, next_session_id_++));
+      session = sessions_.back().get();
+      need_connect = true;
+    }
+    ++session->num_streams_;
+  }
+  if (need_connect && !Connect(session)) {
+    AUTOLOCK(lock, &mu_);
+    --session->num_streams_;
+    return nullptr;
+  }
+  num_streams_.Add(1);
+  std::shared_ptr<Stream> stream =
+      std::make_shared<Stream>(this, wm_->GetCurrentThreadId());
+  StreamDescriptor* d = new StreamDescriptor(this, stream);
+  RunInSessionThread(NewCallback(session, &Session::AddStream, stream));
+  return d;
+}
+
+void Http2Transport::ReleaseStream(Descriptor* d, bool completed) {
+  StreamDescriptor* sd = static_cast<StreamDescriptor*>(d);
+  std::shared_ptr<Stream> stream = sd->stream();
+  delete sd;
+  RunInSessionThread(NewCallback(&Stream::RunRelease, stream, completed));
+}
+
+std::string Http2Transport::DebugString() const {
+  std::ostringstream ss;
+  {
+    AUTOLOCK(lock, &mu_);
+    ss << "available=" << available_;
+    if (!available_) {
+      ss << " (" << unavailable_reason_ << ")";
+    }
+    ss << " sessions=" << sessions_.size() << " [";
+    for (const auto& session : sessions_) {
+      ss << " " << session->id() << ":" << session->num_streams_
+         << (session->accepting_ ? "" : "(closing)");
+    }
+    ss << " ]";
+  }
+  ss << " connections=" << num_connections_.value()
+     << " connection_errors=" << num_connection_errors_.value()
+     << " streams=" << num_streams_.value()
+     << " canceled_streams=" << num_canceled_streams_.value()
+     << " goaway=" << num_goaway_.value();
+  return ss.str();
+}
+
+Http2Transport::Session* Http2Transport::PickSessionUnlocked() {
+  Session* best = nullptr;
+  int num_accepting = 0;
+  for (const auto& session : sessions_) {
+    if (!session->accepting_) {
+      continue;
+    }
+    ++num_accepting;
+    if (best == nullptr || session->num_streams_ < best->num_streams_) {
+      best = session.get();
+    }
+  }
+  if (best == nullptr) {
+    return nullptr;
+  }
+  if (best->num_streams_ < options_.max_concurrent_streams ||
+      num_accepting >= options_.max_connections) {
+    return best;
+  }
+  return nullptr;
+}
+
+bool Http2Transport::Connect(Session* session) {
+  for (int i = 0; i < kMaxNewSocketAttempts; ++i) {
+    ScopedSocket fd(socket_factory_->NewSocket());
+    if (!fd.valid()) {
+      break;
+    }
+    TLSEngine* engine = nullptr;
+    if (options_.use_ssl) {
+      engine = tls_engine_factory_->NewTLSEngineWithAlpn(
+          fd.get(), {std::string(kAlpnHttp2)});
+      if (engine == nullptr) {
+        // |fd| has been used for HTTP/1.1.
+        socket_factory_->CloseSocket(std::move(fd), false);
+        continue;
+      }
+    }
+    num_connections_.Add(1);
+    RunInSessionThread(
+        NewCallback(session, &Session::Start, fd.release(), engine));
+    return true;
+  }
+  {
+    AUTOLOCK(lock, &mu_);
+    session->accepting_ = false;
+  }
+  // Let streams added to |session| fail, and delete |session|.
+  RunInSessionThread(NewCallback(session, &Session::Start, -1,
+                                 static_cast<TLSEngine*>(nullptr)));
+  return false;
+}
+
+void Http2Transport::RunInSessionThread(OneshotClosure* closure) {
+  wm_->RunClosureInPool(FROM_HERE, pool_, closure, WorkerThread::PRIORITY_MED);
+}
+
+void Http2Transport::OnHttp2Unavailable(const std::string& reason) {
+  AUTOLOCK(lock, &mu_);
+  if (!available_) {
+    return;
+  }
+  LOG(WARNING) << "http2 is not available. fallback to http/1.1: " << reason;
+  available_ = false;
+  unavailable_reason_ = reason;
+}
+
+void Http2Transport::MaybeDeleteSession(Session* session) {
+  std::unique_ptr<Session> deleted;
+  AUTOLOCK(lock, &mu_);
+  if (!session->torn_down() || session->num_streams_ > 0) {
+    return;
+  }
+  for (auto it = sessions_.begin(); it != sessions_.end(); ++it) {
+    if (it->get() == session) {
+      deleted = std::move(*it);
+      sessions_.erase(it);
+      break;
+    }
+  }
+  cond_.Signal();
+}
+
+void Http2Transport::ShutdownSessions() {
+  std::vector<Session*> sessions;
+  {
+    AUTOLOCK(lock, &mu_);
+    for (const auto& session : sessions_) {
+      LOG_IF(ERROR, session->num_streams_ > 0)
+          << "http2 session " << session->id()
+          << " has streams on shutdown: " << session->num_streams_;
+      sessions.push_back(session.get());
+    }
+  }
+  for (Session* session : sessions) {
+    session->Close("shutting down", false);
+  }
+}
+
+}  // namespace devtools_goma
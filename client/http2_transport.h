@@ -0,0 +1,120 @@
+// Copyright 2020 The Goma Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#ifndef DEVTOOLS_GOMA_CLIENT_HTTP2_TRANSPORT_H_
+#define DEVTOOLS_GOMA_CLIENT_HTTP2_TRANSPORT_H_
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "absl/base/thread_annotations.h"
+#include "atomic_stats_counter.h"
+#include "basictypes.h"
+#include "lockhelper.h"
+#include "tls_descriptor.h"
+
+namespace devtools_goma {
+
+class Descriptor;
+class OneshotClosure;
+class SocketFactory;
+class TLSEngineFactory;
+class WorkerThreadManager;
+
+// Http2Transport multiplexes HTTP requests on a few HTTP/2 connections
+// (RFC 7540).
+//
+// Each request is sent on a stream exposed as Descriptor, so HttpClient::Task
+// writes an HTTP/1.1 request message and reads an HTTP/1.1 response message
+// on it as if it is a dedicated connection.  Http2Transport translates them
+// into HTTP/2 frames.  A request must have Content-Length.
+//
+// Connections are served on a dedicated worker thread.  TLS connections
+// negotiate "h2" with ALPN, and non-TLS connections use HTTP/2 with prior
+// knowledge.  If a server does not accept HTTP/2, IsAvailable() becomes false
+// and the caller should fall back to HTTP/1.1.
+//
+// This class is thread-safe.
+class Http2Transport {
+ public:
+  struct Options {
+    // :authority pseudo header, i.e. Host.
+    std::string authority;
+    bool use_ssl = false;
+    // Used to connect through an HTTP proxy if use_ssl.
+    TLSDescriptor::Options tls_options;
+    int max_connections = 2;
+    // Another connection is opened if all connections have this number of
+    // streams.  The server's SETTINGS_MAX_CONCURRENT_STREAMS is also
+    // respected.
+    int max_concurrent_streams = 100;
+  };
+
+  // Doesn't take ownership of |socket_factory|, |tls_engine_factory| and
+  // |wm|.  |tls_engine_factory| is used only if use_ssl.
+  // Must not be called on a worker thread.
+  Http2Transport(SocketFactory* socket_factory,
+                 TLSEngineFactory* tls_engine_factory,
+                 const Options& options,
+                 WorkerThreadManager* wm);
+  // All streams must be released before.
+  ~Http2Transport();
+
+  // Returns false if the server does not support HTTP/2.
+  bool IsAvailable() const ABSL_LOCKS_EXCLUDED(mu_);
+
+  // Returns a new stream for a request, which must be used on the calling
+  // thread.  Returns nullptr if it failed to connect to the server.
+  Descriptor* NewStream() ABSL_LOCKS_EXCLUDED(mu_);
+
+  // Releases |d| returned by NewStream() on the same thread.
+  // If |completed| is false and the stream is not closed yet,
+  // the stream is canceled with RST_STREAM.
+  void ReleaseStream(Descriptor* d, bool completed);
+
+  std::string DebugString() const ABSL_LOCKS_EXCLUDED(mu_);
+
+ private:
+  class Session;
+  class Stream;
+  class StreamDescriptor;
+
+  // Returns a session to add a stream, or nullptr if a new connection is
+  // needed.
+  Session* PickSessionUnlocked() ABSL_EXCLUSIVE_LOCKS_REQUIRED(mu_);
+  // Connects to the server, and starts |session| on the session thread.
+  bool Connect(Session* session);
+  void RunInSessionThread(OneshotClosure* closure);
+
+  // Called on the session thread.
+  void OnHttp2Unavailable(const std::string& reason) ABSL_LOCKS_EXCLUDED(mu_);
+  void MaybeDeleteSession(Session* session) ABSL_LOCKS_EXCLUDED(mu_);
+  void ShutdownSessions() ABSL_LOCKS_EXCLUDED(mu_);
+
+  SocketFactory* const socket_factory_;
+  TLSEngineFactory* const tls_engine_factory_;
+  const Options options_;
+  WorkerThreadManager* const wm_;
+  int pool_;
+
+  mutable Lock mu_;
+  ConditionVariable cond_;
+  bool available_ ABSL_GUARDED_BY(mu_) = true;
+  std::string unavailable_reason_ ABSL_GUARDED_BY(mu_);
+  std::vector<std::unique_ptr<Session>> sessions_ ABSL_GUARDED_BY(mu_);
+  int next_session_id_ ABSL_GUARDED_BY(mu_) = 0;
+
+  StatsCounter num_connections_;
+  StatsCounter num_connection_errors_;
+  StatsCounter num_streams_;
+  StatsCounter num_canceled_streams_;
+  StatsCounter num_goaway_;
+
+  DISALLOW_COPY_AND_ASSIGN(Http2Transport);
+};
+
+}  // namespace devtools_goma
+
+#endif  // DEVTOOLS_GOMA_CLIENT_HTTP2_TRANSPORT_H_
@@ -0,0 +1,449 @@
+// Copyright 2020 The Goma Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "http2_transport.h"
+
+#ifndef _WIN32
+#include <signal.h>
+#include <unistd.h>
+#endif
+
+#include <algorithm>
+#include <map>
+#include <set>
+
+#include "absl/memory/memory.h"
+#include "absl/strings/numbers.h"
+#include "absl/strings/str_cat.h"
+#include "callback.h"
+#include "glog/logging.h"
+#include "gtest/gtest.h"
+#include "hpack.h"
+#include "http.h"
+#include "http2_frame.h"
+#include "lockhelper.h"
+#include "mock_socket_factory.h"
+#include "worker_thread.h"
+#include "worker_thread_manager.h"
+
+namespace devtools_goma {
+
+namespace {
+
+std::string FindHeader(const HpackHeaderList& headers,
+                       absl::string_view name) {
+  for (const auto& field : headers) {
+    if (field.first == name) {
+      return field.second;
+    }
+  }
+  return "";
+}
+
+}  // anonymous namespace
+
+// Tests HttpClient with Http2Transport.  The test thread works as an HTTP/2
+// server on a socketpair.
+class Http2TransportTest : public ::testing::Test {
+ protected:
+  struct Call {
+    HttpRequest req;
+    HttpResponse resp;
+    HttpClient::Status status;
+    bool done = false;
+  };
+
+  struct ServerRequest {
+    HpackHeaderList headers;
+    std::string body;
+    bool ended = false;
+  };
+
+  void SetUp() override {
+#ifndef _WIN32
+    // Do not die with SIGPIPE (i.e. write after client finished).
+    signal(SIGPIPE, SIG_IGN);
+#endif
+    wm_ = absl::make_unique<WorkerThreadManager>();
+    wm_->Start(1);
+    pool_ = wm_->StartPool(1, "test");
+    ASSERT_EQ(0, OpenSocketPairForTest(socks_));
+  }
+
+  void TearDown() override {
+    wm_->Finish();
+    wm_.reset();
+#ifndef _WIN32
+    close(socks_[0]);
+#else
+    closesocket(socks_[0]);
+#endif
+  }
+
+  std::unique_ptr<HttpClient> NewHttpClient() {
+    std::unique_ptr<MockSocketFactory> socket_factory(
+        absl::make_unique<MockSocketFactory>(socks_[1], &socket_status_));
+    socket_factory->set_dest("example.com:80");
+    socket_factory->set_host_name("example.com");
+    socket_factory->set_port(80);
+
+    HttpClient::Options options;
+    options.InitFromURL("http://example.com/");
+    options.use_http2 = true;
+    options.http2_max_connections = 1;
+    return absl::make_unique<HttpClient>(std::move(socket_factory), nullptr,
+                                         options, wm_.get());
+  }
+
+  void StartCall(HttpClient* client, Call* call, const std::string& body) {
+    client->InitHttpRequest(&call->req, "POST", "");
+    call->req.SetContentType("text/plain");
+    call->req.SetBody(body);
+    wm_->RunClosureInPool(
+        FROM_HERE, pool_,
+        NewCallback(this, &Http2TransportTest::DoCall, client, call),
+        WorkerThread::PRIORITY_LOW);
+  }
+
+  void DoCall(HttpClient* client, Call* call) {
+    client->DoAsync(&call->req, &call->resp, &call->status,
+                    NewCallback(this, &Http2TransportTest::DoneCall, call));
+  }
+
+  void DoneCall(Call* call) {
+    AutoLock lock(&mu_);
+    call->done = true;
+    cond_.Signal();
+  }
+
+  void WaitCall(Call* call) {
+    AutoLock lock(&mu_);
+    while (!call->done) {
+      cond_.Wait(&mu_);
+    }
+  }
+
+  std::string ServerRead(size_t size) {
+    std::string buf(size, '\0');
+    size_t nread = 0;
+    while (nread < size) {
+#ifndef _WIN32
+      int n = read(socks_[0], &buf[nread], size - nread);
+#else
+      int n = recv(socks_[0], &buf[nread], size - nread, 0);
+#endif
+      if (n <= 0) {
+        PLOG(ERROR) << "read n=" << n;
+        buf.resize(nread);
+        return buf;
+      }
+      nread += n;
+    }
+    return buf;
+  }
+
+  void ServerWrite(absl::string_view data) {
+    size_t written = 0;
+    while (written < data.size()) {
+#ifndef _WIN32
+      int n = write(socks_[0], data.data() + written, data.size() - written);
+#else
+      int n = send(socks_[0], data.data() + written, data.size() - written, 0);
+#endif
+      ASSERT_GT(n, 0);
+      written += n;
+    }
+  }
+
+  bool ReadFrame(Http2FrameHeader* header, std::string* payload) {
+    const std::string buf = ServerRead(kHttp2FrameHeaderSize);
+    if (buf.size() != kHttp2FrameHeaderSize) {
+      return false;
+    }
+    *header = ParseHttp2FrameHeader(buf);
+    *payload = ServerRead(header->length);
+    return payload->size() == header->length;
+  }
+
+  // Reads the connection preface, and sends |settings|.
+  void StartSession(const Http2Settings& settings) {
+    EXPECT_EQ(kHttp2ConnectionPreface,
+              ServerRead(kHttp2ConnectionPreface.size()));
+    Http2FrameHeader header;
+    std::string payload;
+    ASSERT_TRUE(ReadFrame(&header, &payload));
+    EXPECT_EQ(static_cast<uint8_t>(Http2FrameType::kSettings), header.type);
+    Http2Settings client_settings;
+    ASSERT_TRUE(ParseHttp2Settings(payload, &client_settings));
+    EXPECT_NE(client_settings.end(),
+              std::find(client_settings.begin(), client_settings.end(),
+                        std::make_pair(Http2SettingsId::kEnablePush, 0U)));
+    std::string out;
+    AppendHttp2Settings(settings, &out);
+    AppendHttp2Frame(Http2FrameType::kSettings, kHttp2FlagAck, 0, "", &out);
+    ServerWrite(out);
+  }
+
+  // Handles a frame from the client.  Returns false if the connection was
+  // closed.
+  bool HandleFrame(std::map<uint32_t, ServerRequest>* requests,
+                   Http2FrameHeader* header) {
+    std::string payload;
+    if (!ReadFrame(header, &payload)) {
+      return false;
+    }
+    switch (static_cast<Http2FrameType>(header->type)) {
+      case Http2FrameType::kHeaders: {
+        ServerRequest* req = &(*requests)[header->stream_id];
+        EXPECT_NE(0, header->flags & kHttp2FlagEndHeaders);
+        EXPECT_TRUE(decoder_.Decode(payload, &req->headers));
+        req->ended = (header->flags & kHttp2FlagEndStream) != 0;
+        break;
+      }
+      case Http2FrameType::kData: {
+        ServerRequest* req = &(*requests)[header->stream_id];
+        EXPECT_FALSE(req->ended);
+        req->body += payload;
+        req->ended = (header->flags & kHttp2FlagEndStream) != 0;
+        break;
+      }
+      case Http2FrameType::kRstStream:
+        rst_streams_[header->stream_id] = Http2ReadUint32(payload);
+        break;
+      case Http2FrameType::kWindowUpdate:
+        window_updates_[header->stream_id] += Http2ReadUint32(payload);
+        break;
+      default:
+        break;
+    }
+    return true;
+  }
+
+  // Reads frames until |num_requests| requests are received.
+  void ReadRequests(size_t num_requests,
+                    std::map<uint32_t, ServerRequest>* requests) {
+    for (;;) {
+      size_t num_ended = 0;
+      for (const auto& entry : *requests) {
+        if (entry.second.ended) {
+          ++num_ended;
+        }
+      }
+      if (num_ended == num_requests) {
+        return;
+      }
+      Http2FrameHeader header;
+      ASSERT_TRUE(HandleFrame(requests, &header));
+    }
+  }
+
+  void Respond(uint32_t stream_id, int status, absl::string_view body) {
+    HpackHeaderList headers = {
+        {":status", absl::StrCat(status)},
+        {"content-type", "text/plain"},
+        {"content-length", absl::StrCat(body.size())},
+    };
+    std::string block;
+    encoder_.Encode(headers, &block);
+    std::string out;
+    AppendHttp2Headers(stream_id, block, body.empty(),
+                       kHttp2DefaultMaxFrameSize, &out);
+    while (!body.empty()) {
+      const size_t size = std::min(body.size(), kHttp2DefaultMaxFrameSize);
+      AppendHttp2Frame(Http2FrameType::kData,
+                       size == body.size() ? kHttp2FlagEndStream : 0,
+                       stream_id, body.substr(0, size), &out);
+      body.remove_prefix(size);
+    }
+    ServerWrite(out);
+  }
+
+  std::unique_ptr<WorkerThreadManager> wm_;
+  int pool_ = -1;
+  MockSocketFactory::SocketStatus socket_status_;
+  int socks_[2];
+
+  HpackEncoder encoder_;
+  HpackDecoder decoder_;
+  std::map<uint32_t, uint32_t> rst_streams_;
+  std::map<uint32_t, int64_t> window_updates_;
+
+  Lock mu_;
+  ConditionVariable cond_;
+};
+
+TEST_F(Http2TransportTest, Multiplex) {
+ 
+  std::unique_ptr<HttpClient> client(NewHttpClient());
+ 
+
+  constexpr int kNumCalls = 3;
+  Call calls[kNumCalls];
+  for (int i = 0; i < kNumCalls; ++i) {
+    StartCall(client.get(), &calls[i], absl::StrCat("request ", i));
+  }
+
+  StartSession({{Http2SettingsId::kMaxConcurrentStreams, 100}});
+  std::map<uint32_t, ServerRequest> requests;
+  ReadRequests(kNumCalls, &requests);
+  ASSERT_EQ(static_cast<size_t>(kNumCalls), requests.size());
+
+  std::set<std::string> bodies;
+  for (const auto& entry : requests) {
+    const ServerRequest& req = entry.second;
+    EXPECT_EQ(1U, entry.first % 2);
+    EXPECT_EQ("POST", FindHeader(req.headers, ":method"));
+    EXPECT_EQ("http", FindHeader(req.headers, ":scheme"));
+    EXPECT_EQ("example.com", FindHeader(req.headers, ":authority"));
+    EXPECT_EQ("/", FindHeader(req.headers, ":path"));
+    EXPECT_EQ("text/plain", FindHeader(req.headers, "content-type"));
+    EXPECT_EQ(absl::StrCat(req.body.size()),
+              FindHeader(req.headers, "content-length"));
+    EXPECT_EQ("", FindHeader(req.headers, "host"));
+    bodies.insert(req.body);
+  }
+  EXPECT_EQ((std::set<std::string>{"request 0", "request 1", "request 2"}),
+            bodies);
+
+  // Respond in reverse order.
+  for (auto it = requests.rbegin(); it != requests.rend(); ++it) {
+    Respond(it->first, 200, absl::StrCat("response to ", it->second.body));
+  }
+  for (int i = 0; i < kNumCalls; ++i) {
+    WaitCall(&calls[i]);
+    EXPECT_EQ(OK, calls[i].status.err) << calls[i].status.err_message;
+    EXPECT_EQ(200, calls[i].status.http_return_code);
+    EXPECT_EQ(absl::StrCat("response to request ", i),
+              calls[i].resp.parsed_body());
+  }
+  // Completed streams are not reset.
+  EXPECT_TRUE(rst_streams_.empty());
+
+  client.reset();
+  // MockSocketFactory would crash if the second socket is requested.
+  EXPECT_TRUE(socket_status_.is_closed());
+}
+
+TEST_F(Http2TransportTest, CancelOnTimeout) {
+  std::unique_ptr<HttpClient> client(NewHttpClient());
+
+  Call call;
+  call.status.timeouts.push_back(absl::Milliseconds(500));
+  StartCall(client.get(), &call, "request");
+
+  StartSession({});
+  std::map<uint32_t, ServerRequest> requests;
+  ReadRequests(1, &requests);
+  ASSERT_EQ(1U, requests.size());
+  const uint32_t stream_id = requests.begin()->first;
+
+  // Don't respond, and the client should cancel the stream.
+  while (rst_streams_.empty()) {
+    Http2FrameHeader header;
+    ASSERT_TRUE(HandleFrame(&requests, &header));
+  }
+  EXPECT_EQ((std::map<uint32_t, uint32_t>{
+                {stream_id, static_cast<uint32_t>(Http2ErrorCode::kCancel)}}),
+            rst_streams_);
+
+  WaitCall(&call);
+  EXPECT_NE(OK, call.status.err);
+  client.reset();
+}
+
+TEST_F(Http2TransportTest, RequestFlowControl) {
+  std::unique_ptr<HttpClient> client(NewHttpClient());
+
+  const std::string body(100000, 'x');
+  Call call;
+  StartCall(client.get(), &call, body);
+
+  StartSession({});
+  std::map<uint32_t, ServerRequest> requests;
+  int64_t window = kHttp2DefaultWindowSize;
+  for (;;) {
+    Http2FrameHeader header;
+    ASSERT_TRUE(HandleFrame(&requests, &header));
+    if (requests.empty()) {
+      continue;
+    }
+    const ServerRequest& req = requests.begin()->second;
+    if (req.ended) {
+      break;
+    }
+    // Both stream and connection windows are |window|.
+    ASSERT_LE(static_cast<int64_t>(req.body.size()), window);
+    if (static_cast<int64_t>(req.body.size()) == window) {
+      std::string out;
+      AppendHttp2WindowUpdate(0, kHttp2DefaultWindowSize, &out);
+      AppendHttp2WindowUpdate(requests.begin()->first,
+                              kHttp2DefaultWindowSize, &out);
+      ServerWrite(out);
+      window += kHttp2DefaultWindowSize;
+    }
+  }
+  EXPECT_EQ(body, requests.begin()->second.body);
+  EXPECT_EQ(2 * kHttp2DefaultWindowSize, window);
+
+  Respond(requests.begin()->first, 200, "ok");
+  WaitCall(&call);
+  EXPECT_EQ(OK, call.status.err) << call.status.err_message;
+  EXPECT_EQ("ok", call.resp.parsed_body());
+  client.reset();
+}
+
+TEST_F(Http2TransportTest, ResponseFlowControl) {
+  std::unique_ptr<HttpClient> client(NewHttpClient());
+
+  Call call;
+  StartCall(client.get(), &call, "request");
+
+  StartSession({});
+  std::map<uint32_t, ServerRequest> requests;
+  ReadRequests(1, &requests);
+  const uint32_t stream_id = requests.begin()->first;
+
+  // Initial stream window advertised by the client.
+  constexpr size_t kWindow = 1 << 20;
+  const std::string body(kWindow + kWindow / 2, 'y');
+  HpackHeaderList headers = {
+      {":status", "200"},
+      {"content-length", absl::StrCat(body.size())},
+  };
+  std::string block;
+  encoder_.Encode(headers, &block);
+  std::string out;
+  AppendHttp2Headers(stream_id, block, false, kHttp2DefaultMaxFrameSize,
+                     &out);
+  absl::string_view data(body);
+  while (data.size() > kWindow / 2) {
+    const size_t size = std::min(data.size(), kHttp2DefaultMaxFrameSize);
+    AppendHttp2Frame(Http2FrameType::kData, 0, stream_id,
+                     data.substr(0, size), &out);
+    data.remove_prefix(size);
+  }
+  ServerWrite(out);
+
+  // The client should give more window as it consumes the data.
+  while (window_updates_[stream_id] < static_cast<int64_t>(kWindow / 2)) {
+    Http2FrameHeader header;
+    ASSERT_TRUE(HandleFrame(&requests, &header));
+  }
+  out.clear();
+  while (!data.empty()) {
+    const size_t size = std::min(data.size(), kHttp2DefaultMaxFrameSize);
+    AppendHttp2Frame(Http2FrameType::kData,
+                     size == data.size() ? kHttp2FlagEndStream : 0, stream_id,
+                     data.substr(0, size), &out);
+    data.remove_prefix(size);
+  }
+  ServerWrite(out);
+
+  WaitCall(&call);
+  EXPECT_EQ(OK, call.status.err) << call.status.err_message;
+  EXPECT_EQ(body, call.resp.parsed_body());
+  client.reset();
+}
+
+}  // namespace devtools_goma
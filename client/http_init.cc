@@ -114,6 +114,9 @@ void InitHttpClientOptions(HttpClient::Options* http_options) {
   http_options->fail_fast = FLAGS_FAIL_FAST;
 
   http_options->reuse_connection = FLAGS_COMPILER_PROXY_REUSE_CONNECTION;
+  http_options->use_http2 = FLAGS_USE_HTTP2;
+  http_options->http2_max_connections = FLAGS_HTTP2_MAX_CONNECTIONS;
+  http_options->prewarm_sockets = FLAGS_HTTP_PREWARM_SOCKETS;
 
   // Attempt to load and interpret LUCI_CONTEXT. It may define options for an
   // ambient authentication in LUCI environment. We'll decide whether we will
@@ -14,6 +14,7 @@
 #include "absl/memory/memory.h"
 #include "absl/strings/ascii.h"
 #include "absl/strings/match.h"
+#include "absl/strings/numbers.h"
 #include "absl/strings/str_cat.h"
 #include "absl/strings/str_split.h"
 #include "absl/strings/string_view.h"
@@ -22,6 +23,7 @@
 #include "absl/types/optional.h"
 #include "autolock_timer.h"
 #include "callback.h"
+#include "compiler_proxy_histogram.h"
 #include "compiler_specific.h"
 #include "glog/logging.h"
 MSVC_PUSH_DISABLE_WARNING_FOR_PROTO()
@@ -39,10 +41,46 @@ MSVC_POP_WARNING()
 #include "simple_timer.h"
 #include "util.h"
 #include "worker_thread.h"
+#include "worker_thread_manager.h"
 #include "zero_copy_stream_impl.h"
 
 namespace devtools_goma {
 
+namespace {
+
+// Returns encodings that HttpRPC can compress requests with.
+std::vector<EncodingType> CapableRequestEncodings() {
+  return {
+#ifdef ENABLE_ZSTD
+      EncodingType::ZSTD,
+#endif
+      EncodingType::GZIP,
+      // TODO: deprecate deflate compression.
+      EncodingType::DEFLATE,
+  };
+}
+
+// The client sends the ID of its zstd dictionary in this header, and the
+// server echoes it back in response header if it has the dictionary.
+// Until then, requests are not compressed with the dictionary.
+constexpr absl::string_view kZstdDictionaryId = "X-Goma-Zstd-Dictionary-Id";
+
+// Returns ID of |dictionary|, or 0 if no dictionary.
+unsigned int ZstdDictionaryId(const ZstdDictionary* dictionary) {
+#ifdef ENABLE_ZSTD
+  if (dictionary != nullptr) {
+    return dictionary->id();
+  }
+#endif
+  return 0;
+}
+
+// The hedge delay is updated from the histogram every this number of
+// ExecReq.
+constexpr int64_t kHedgeUpdateDelayInterval = 20;
+
+}  // anonymous namespace
+
 class HttpRPC::Request : public HttpClient::Request {
  public:
   Request(const google::protobuf::Message* req,
@@ -69,15 +107,23 @@ class HttpRPC::CallRequest : public HttpRPC::Request {
  public:
   CallRequest(const google::protobuf::Message* req, HttpRPC::Status* status);
   ~CallRequest() override {}
+  // |zstd_dictionary| is used if |encoding| is zstd and not nullptr.
   void EnableCompression(EncodingType encoding,
                          int level,
-                         const std::string& accept_encoding) {
+                         const std::string& accept_encoding,
+                         const ZstdDictionary* zstd_dictionary) {
     request_encoding_type_ = encoding;
     compression_level_ = level;
     accept_encoding_ = accept_encoding;
+    zstd_dictionary_ = zstd_dictionary;
+  }
+  // Advertises zstd dictionary the client has, if |id| is not 0.
+  void set_zstd_dictionary_id(unsigned int id) {
+    zstd_dictionary_id_ = id;
   }
   std::unique_ptr<google::protobuf::io::ZeroCopyInputStream>
     NewStream() const override;
+  bool HasStableStreamBuffers() const override { return true; }
 
   std::unique_ptr<HttpClient::Request> Clone() const override {
     return std::unique_ptr<HttpClient::Request>(
@@ -88,6 +134,8 @@ class HttpRPC::CallRequest : public HttpRPC::Request {
   EncodingType request_encoding_type_ = EncodingType::NO_ENCODING;
   int compression_level_ = 0;
   std::string accept_encoding_;
+  const ZstdDictionary* zstd_dictionary_ = nullptr;
+  unsigned int zstd_dictionary_id_ = 0;
   DISALLOW_ASSIGN(CallRequest);
 };
 
@@ -106,9 +154,14 @@ class HttpRPC::Response : public HttpClient::Response {
     response_body_ =
         absl::make_unique<HttpResponse::Body>(
             content_length, is_chunked, encoding_type);
+    response_body_->set_zstd_dictionary(zstd_dictionary_);
     return response_body_.get();
   }
 
+  void set_zstd_dictionary(const ZstdDictionary* dictionary) {
+    zstd_dictionary_ = dictionary;
+  }
+
  protected:
   void ParseBody() override;
 
@@ -117,6 +170,7 @@ class HttpRPC::Response : public HttpClient::Response {
 
  private:
   std::unique_ptr<HttpResponse::Body> response_body_;
+  const ZstdDictionary* zstd_dictionary_ = nullptr;
   DISALLOW_COPY_AND_ASSIGN(Response);
 };
 
@@ -168,6 +222,9 @@ std::string HttpRPC::Options::DebugString() const {
     ss << " start_compression";
   ss << " accept_encoding=" << accept_encoding;
   ss << " content_type_for_protobuf=" << content_type_for_protobuf;
+  if (zstd_dictionary) {
+    ss << " zstd_dictionary=" << ZstdDictionaryId(zstd_dictionary.get());
+  }
   return ss.str();
 }
 
@@ -184,9 +241,7 @@ HttpRPC::HttpRPC(HttpClient* client,
       << options_.content_type_for_protobuf;
   std::vector<EncodingType> encodings =
       ParseAcceptEncoding(options_.accept_encoding);
-  // TODO: deprecate deflate compression.
-  std::vector<EncodingType> capable{EncodingType::GZIP, EncodingType::DEFLATE};
-  request_encoding_type_ = PickEncoding(capable, encodings);
+  request_encoding_type_ = PickEncoding(CapableRequestEncodings(), encodings);
   LOG(INFO) << "request encoding=" << GetEncodingName(request_encoding_type_);
 }
 
@@ -313,14 +368,25 @@ void HttpRPC::CallWithCallback(const std::string& path,
     VLOG(2) << "compression enabled level=" << options_.compression_level
             << " request_encoding=" << GetEncodingName(encoding)
             << " accept_encoding=" << options_.accept_encoding;
-    call_req->EnableCompression(
-        encoding, options_.compression_level, options_.accept_encoding);
+    // The dictionary is trained with ExecReq, so it won't help other
+    // requests (e.g. file blobs).  It is used only after the server
+    // acknowledged it has the same dictionary.
+    const ZstdDictionary* zstd_dictionary =
+        req != nullptr && req->GetDescriptor() == ExecReq::descriptor() &&
+                IsZstdDictionaryAcked()
+            ? options_.zstd_dictionary.get()
+            : nullptr;
+    call_req->EnableCompression(encoding, options_.compression_level,
+                                options_.accept_encoding, zstd_dictionary);
   } else {
     VLOG(2) << "compression is not enabled";
   }
+  call_req->set_zstd_dictionary_id(
+      ZstdDictionaryId(options_.zstd_dictionary.get()));
   std::unique_ptr<Request> http_req = std::move(call_req);
   client_->InitHttpRequest(http_req.get(), "POST", path);
   std::unique_ptr<Response> http_resp(new CallResponse(resp, status));
+  http_resp->set_zstd_dictionary(options_.zstd_dictionary.get());
   http_req->SetContentType(options_.content_type_for_protobuf);
   std::unique_ptr<CallData> call(
       new CallData(std::move(http_req), std::move(http_resp), callback));
@@ -390,13 +456,27 @@ void HttpRPC::DisableCompression() {
 
 void HttpRPC::EnableCompression(absl::string_view header) {
   AUTOLOCK(lock, &mu_);
+  const unsigned int zstd_dictionary_id =
+      ZstdDictionaryId(options_.zstd_dictionary.get());
+  if (zstd_dictionary_id != 0) {
+    unsigned int acked_id = 0;
+    const bool acked =
+        absl::SimpleAtoi(ExtractHeaderField(header, kZstdDictionaryId),
+                         &acked_id) &&
+        acked_id == zstd_dictionary_id;
+    if (acked != zstd_dictionary_acked_) {
+      LOG(INFO) << "zstd dictionary id=" << zstd_dictionary_id
+                << (acked ? " acknowledged" : " not acknowledged")
+                << " by server";
+      zstd_dictionary_acked_ = acked;
+    }
+  }
   absl::string_view accept_encoding =
       ExtractHeaderField(header, kAcceptEncoding);
   std::vector<EncodingType> server_accepts =
       ParseAcceptEncoding(accept_encoding);
-  // TODO: deprecate deflate compression.
-  std::vector<EncodingType> capable{EncodingType::GZIP, EncodingType::DEFLATE};
-  EncodingType encoding = PickEncoding(capable, server_accepts);
+  EncodingType encoding =
+      PickEncoding(CapableRequestEncodings(), server_accepts);
   if (request_encoding_type_ == encoding) {
     return;
   }
@@ -416,6 +496,11 @@ EncodingType HttpRPC::request_encoding_type() const {
   return request_encoding_type_;
 }
 
+bool HttpRPC::IsZstdDictionaryAcked() const {
+  AUTOLOCK(lock, &mu_);
+  return zstd_dictionary_acked_;
+}
+
 bool HttpRPC::IsCompressionEnabled() const {
   AUTOLOCK(lock, &mu_);
   if (request_encoding_type_ == EncodingType::NO_ENCODING)
@@ -439,16 +524,20 @@ HttpRPC::CallRequest::NewStream() const {
   if (!accept_encoding_.empty()) {
     headers.push_back(CreateHeader(kAcceptEncoding, accept_encoding_));
   }
-  // note: we don't send with lzma2.
+  if (zstd_dictionary_id_ != 0) {
+    headers.push_back(
+        CreateHeader(kZstdDictionaryId, absl::StrCat(zstd_dictionary_id_)));
+  }
+  // note: we don't send with lzma2, which is too slow to compress.
   if (request_encoding_type_ != EncodingType::NO_ENCODING &&
       compression_level_ > 0 && req_) {
     switch (request_encoding_type_) {
       // TODO: deprecate deflate compression.
       case EncodingType::DEFLATE:
         {
-        std::string compressed;
-        SimpleTimer compression_timer;
-        google::protobuf::io::StringOutputStream stream(&compressed);
+        // Compresses into blocks that will be sent as is, to avoid
+        // copying the (potentially large) compressed request.
+        BlockChainOutputStream stream;
         google::protobuf::io::GzipOutputStream::Options options;
         options.format = google::protobuf::io::GzipOutputStream::ZLIB;
         options.compression_level = compression_level_;
@@ -457,20 +546,20 @@ HttpRPC::CallRequest::NewStream() const {
         if (!gzip_stream.Close()) {
           LOG(ERROR) << "GzipOutputStream error:"
                      << gzip_stream.ZlibErrorMessage();
-        } else if (compressed.size() > 1 && (compressed[1] >> 5 & 1)) {
+        } else if (stream.ByteCount() > 1 && (stream.at(1) >> 5 & 1)) {
           LOG(WARNING) << "response has FDICT, which should not be supported";
         } else {
           headers.push_back(CreateHeader(
               kContentEncoding, GetEncodingName(request_encoding_type_)));
           status_->raw_req_size = gzip_stream.ByteCount();
-          absl::string_view body(compressed);
           // Omit zlib header (since server assumes no zlib header).
-          body.remove_prefix(2);
+          std::unique_ptr<BlockChainInputStream> body =
+              stream.ReleaseAsInputStream(2);
+          const google::protobuf::int64 body_size = body->BytesRemaining();
           streams.reserve(2);
           streams.push_back(absl::make_unique<StringInputStream>(
-              BuildHeader(headers, body.size())));
-          streams.push_back(
-              absl::make_unique<StringInputStream>(std::string(body)));
+              BuildHeader(headers, body_size)));
+          streams.push_back(std::move(body));
           return absl::make_unique<ChainedInputStream>(std::move(streams));
         }
         }
@@ -478,9 +567,7 @@ HttpRPC::CallRequest::NewStream() const {
 
       case EncodingType::GZIP:
         {
-        std::string compressed;
-        SimpleTimer compression_timer;
-        google::protobuf::io::StringOutputStream stream(&compressed);
+        BlockChainOutputStream stream;
         google::protobuf::io::GzipOutputStream::Options options;
         options.format = google::protobuf::io::GzipOutputStream::GZIP;
         options.compression_level = compression_level_;
@@ -495,16 +582,49 @@ HttpRPC::CallRequest::NewStream() const {
               CreateHeader(kContentEncoding,
                            GetEncodingName(request_encoding_type_)));
           status_->raw_req_size = gzip_stream.ByteCount();
+          std::unique_ptr<BlockChainInputStream> body =
+              stream.ReleaseAsInputStream(0);
+          const google::protobuf::int64 body_size = body->BytesRemaining();
           streams.reserve(2);
           streams.push_back(
               absl::make_unique<StringInputStream>(
-                  BuildHeader(headers, compressed.size())));
-          streams.push_back(
-              absl::make_unique<StringInputStream>(compressed));
+                  BuildHeader(headers, body_size)));
+          streams.push_back(std::move(body));
           return absl::make_unique<ChainedInputStream>(std::move(streams));
         }
         break;
 
+#ifdef ENABLE_ZSTD
+      case EncodingType::ZSTD:
+        {
+        BlockChainOutputStream stream;
+        ZstdOutputStream::Options options;
+        options.compression_level = compression_level_;
+        options.dictionary = zstd_dictionary_;
+        ZstdOutputStream zstd_stream(&stream, options);
+        req_->SerializeToZeroCopyStream(&zstd_stream);
+        if (!zstd_stream.Close()) {
+          LOG(ERROR) << "ZstdOutputStream error:"
+                     << zstd_stream.ErrorMessage();
+          break;
+        }
+        headers.push_back(
+            CreateHeader(kContentEncoding,
+                         GetEncodingName(request_encoding_type_)));
+        status_->raw_req_size = zstd_stream.ByteCount();
+        std::unique_ptr<BlockChainInputStream> body =
+            stream.ReleaseAsInputStream(0);
+        const google::protobuf::int64 body_size = body->BytesRemaining();
+        streams.reserve(2);
+        streams.push_back(
+            absl::make_unique<StringInputStream>(
+                BuildHeader(headers, body_size)));
+        streams.push_back(std::move(body));
+        return absl::make_unique<ChainedInputStream>(std::move(streams));
+        }
+        break;
+#endif
+
       default:
         LOG(FATAL) << "unsupported encoding type:"
                    << GetEncodingName(request_encoding_type_);
@@ -552,10 +672,12 @@ void HttpRPC::Response::ParseBody() {
 ExecServiceClient::ExecServiceClient(HttpRPC* http_rpc, std::string path)
     : http_rpc_(http_rpc), path_(std::move(path)) {}
 
-void ExecServiceClient::ExecAsync(const ExecReq* req, ExecResp* resp,
+void ExecServiceClient::ExecAsync(std::shared_ptr<const ExecReq> req,
+                                  ExecResp* resp,
                                   HttpClient::Status* status,
                                   OneshotClosure* callback) {
-  http_rpc_->CallWithCallback(path_, req, resp, status, callback);
+  // The caller holds |req| until |callback| is called.
+  http_rpc_->CallWithCallback(path_, req.get(), resp, status, callback);
 }
 
 void ExecServiceClient::Exec(const ExecReq* req, ExecResp* resp,
@@ -563,4 +685,148 @@ void ExecServiceClient::Exec(const ExecReq* req, ExecResp* resp,
   http_rpc_->Call(path_, req, resp, status);
 }
 
+// HedgedCall runs the original ExecReq and, if it doesn't return in the
+// hedge delay, a hedged one, and passes the result that succeeded first
+// (or the original one's if both failed) to the caller.
+// HttpRPC calls back in the thread where the call was issued, so all methods
+// run in the caller's thread.
+// It deletes itself once both calls are done.
+class HedgedExecServiceClient::HedgedCall {
+ public:
+  // Shares |req| with the caller, since the other call may still be
+  // running after |callback| is called.
+  HedgedCall(HedgedExecServiceClient* client,
+             std::shared_ptr<const ExecReq> req,
+             ExecResp* resp,
+             HttpClient::Status* status,
+             OneshotClosure* callback)
+      : client_(client),
+        req_(std::move(req)),
+        resp_(resp),
+        status_(status),
+        callback_(callback) {}
+
+  void Start(absl::Duration delay) {
+    hedge_timer_ = client_->wm_->RunDelayedClosureInThread(
+        FROM_HERE, client_->wm_->GetCurrentThreadId(), delay,
+        NewCallback(this, &HedgedCall::StartHedge));
+    Run(&primary_, status_->trace_id);
+  }
+
+ private:
+  struct Call {
+    ExecResp resp;
+    HttpClient::Status status;
+    bool running = false;
+  };
+
+  void Run(Call* call, std::string trace_id) {
+    // Inherits timeouts etc. from the caller.
+    call->status = *status_;
+    call->status.trace_id = std::move(trace_id);
+    call->running = true;
+    client_->ExecServiceClient::ExecAsync(
+        req_, &call->resp, &call->status,
+        NewCallback(this, &HedgedCall::Done, call));
+  }
+
+  void StartHedge() {
+    hedge_timer_ = nullptr;
+    DCHECK(primary_.running);
+    if (!client_->policy_.TryHedge()) {
+      VLOG(1) << status_->trace_id << " hedge budget exhausted";
+      return;
+    }
+    LOG(INFO) << status_->trace_id << " hedge ExecReq";
+    hedged_ = true;
+    Run(&hedge_, absl::StrCat(status_->trace_id, "-hedge"));
+  }
+
+  void Done(Call* call) {
+    call->running = false;
+    if (hedge_timer_ != nullptr) {
+      hedge_timer_->Cancel();
+      hedge_timer_ = nullptr;
+    }
+    const Call* other = (call == &primary_) ? &hedge_ : &primary_;
+    if (!other->running) {
+      // Releases |req_| before calling back, so that the caller doesn't
+      // need to copy it to modify it.
+      req_.reset();
+    }
+    if (callback_ != nullptr) {
+      if (call->status.err == OK) {
+        Deliver(call);
+      } else if (!other->running) {
+        Deliver(&primary_);
+      }
+    }
+    if (!primary_.running && !hedge_.running) {
+      delete this;
+    }
+  }
+
+  void Deliver(Call* call) {
+    if (hedged_) {
+      client_->policy_.OnHedgeDone(call == &hedge_);
+    }
+    resp_->Swap(&call->resp);
+    const std::string trace_id = std::move(status_->trace_id);
+    *status_ = call->status;
+    status_->trace_id = trace_id;
+    OneshotClosure* callback = callback_;
+    callback_ = nullptr;
+    callback->Run();
+  }
+
+  HedgedExecServiceClient* client_;
+  std::shared_ptr<const ExecReq> req_;
+  ExecResp* resp_;
+  HttpClient::Status* status_;
+  OneshotClosure* callback_;
+
+  WorkerThread::CancelableClosure* hedge_timer_ = nullptr;
+  bool hedged_ = false;
+  Call primary_;
+  Call hedge_;
+
+  DISALLOW_COPY_AND_ASSIGN(HedgedCall);
+};
+
+HedgedExecServiceClient::HedgedExecServiceClient(
+    HttpRPC* http_rpc,
+    std::string path,
+    WorkerThreadManager* wm,
+    const CompilerProxyHistogram* histogram,
+    const HedgePolicy::Options& options)
+    : ExecServiceClient(http_rpc, std::move(path)),
+      wm_(wm),
+      histogram_(histogram),
+      policy_(options) {}
+
+void HedgedExecServiceClient::ExecAsync(std::shared_ptr<const ExecReq> req,
+                                        ExecResp* resp,
+                                        HttpClient::Status* status,
+                                        OneshotClosure* callback) {
+  MaybeUpdateDelay();
+  absl::optional<absl::Duration> delay = policy_.OnRequest();
+  if (!delay) {
+    ExecServiceClient::ExecAsync(std::move(req), resp, status, callback);
+    return;
+  }
+  HedgedCall* call =
+      new HedgedCall(this, std::move(req), resp, status, callback);
+  call->Start(*delay);
+}
+
+void HedgedExecServiceClient::MaybeUpdateDelay() {
+  if (num_exec_.fetch_add(1) % kHedgeUpdateDelayInterval != 0) {
+    return;
+  }
+  policy_.UpdateDelay(
+      histogram_->GetStatCount(CompilerProxyHistogram::RPCCallTime),
+      absl::Milliseconds(histogram_->GetStatPercentile(
+          CompilerProxyHistogram::RPCCallTime, policy_.options().percentile)));
+}
+
 }  // namespace devtools_goma
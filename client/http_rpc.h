@@ -6,6 +6,7 @@
 #ifndef DEVTOOLS_GOMA_CLIENT_HTTP_RPC_H_
 #define DEVTOOLS_GOMA_CLIENT_HTTP_RPC_H_
 
+#include <atomic>
 #include <memory>
 #include <string>
 
@@ -13,6 +14,7 @@
 
 #include "basictypes.h"
 #include "gtest/gtest_prod.h"
+#include "hedge_policy.h"
 #include "lockhelper.h"
 #include "http.h"
 
@@ -28,6 +30,7 @@ class ExecReq;
 class ExecResp;
 class HttpRPCStats;
 class OneshotClosure;
+class CompilerProxyHistogram;
 class SimpleTimer;
 class WorkerThreadManager;
 
@@ -40,6 +43,10 @@ class HttpRPC {
     bool start_compression;
     std::string accept_encoding;
     std::string content_type_for_protobuf;
+    // If set, its ID is sent to the server, and zstd compresses ExecReq with
+    // the dictionary once the server acknowledged the ID.  Responses
+    // compressed with it are decompressed with it.
+    std::shared_ptr<const ZstdDictionary> zstd_dictionary;
 
     std::string DebugString() const;
   };
@@ -100,14 +107,17 @@ class HttpRPC {
   void EnableCompression(absl::string_view header);
   // Initial request_encoding_type is determined by options_.accept_encoding.
   // Once it received response, use server's Accept-Encoding: response header.
-  // Prefers gzip to deflate.  no lzma2 support yet.
+  // Prefers the order of Accept-Encoding.  no lzma2 support yet.
   EncodingType request_encoding_type() const;
   bool IsCompressionEnabled() const;
+  // Returns true if the server acknowledged options_.zstd_dictionary.
+  bool IsZstdDictionaryAcked() const;
 
   HttpClient* client_;
   const Options options_;
   mutable Lock mu_;
   EncodingType request_encoding_type_ ABSL_GUARDED_BY(mu_);
+  bool zstd_dictionary_acked_ ABSL_GUARDED_BY(mu_) = false;
 
   DISALLOW_COPY_AND_ASSIGN(HttpRPC);
 };
@@ -120,17 +130,58 @@ class ExecServiceClient {
   ExecServiceClient(const ExecServiceClient&) = delete;
   ExecServiceClient& operator=(const ExecServiceClient&) = delete;
 
-  virtual void ExecAsync(const ExecReq* req, ExecResp* resp,
+  // |req| is shared with the client, since it may still be used after
+  // |callback| is called (e.g. by a hedged request still running), so the
+  // caller must not modify |req| while the client holds it.
+  virtual void ExecAsync(std::shared_ptr<const ExecReq> req, ExecResp* resp,
                          HttpClient::Status* status, OneshotClosure* callback);
 
   virtual void Exec(const ExecReq* req, ExecResp* resp,
                     HttpClient::Status* status);
 
+  // Returns the hedge policy if requests are hedged, or nullptr.
+  virtual const HedgePolicy* hedge_policy() const { return nullptr; }
+
  private:
   HttpRPC* http_rpc_;
   const std::string path_;
 };
 
+// HedgedExecServiceClient issues a duplicate ExecReq if the first one hasn't
+// returned in the hedge delay, and takes the result that succeeded first,
+// to cut the tail latency caused by a slow backend.
+// The hedge delay is a percentile of RPCCallTime in |histogram|.
+// The number of hedged requests is capped by the budget of HedgePolicy.
+// ExecAsync must be called on a worker thread of |wm|.
+class HedgedExecServiceClient : public ExecServiceClient {
+ public:
+  // It doesn't take ownership of http_rpc, wm and histogram.
+  HedgedExecServiceClient(HttpRPC* http_rpc,
+                          std::string path,
+                          WorkerThreadManager* wm,
+                          const CompilerProxyHistogram* histogram,
+                          const HedgePolicy::Options& options);
+  ~HedgedExecServiceClient() override = default;
+
+  void ExecAsync(std::shared_ptr<const ExecReq> req, ExecResp* resp,
+                 HttpClient::Status* status,
+                 OneshotClosure* callback) override;
+
+  const HedgePolicy* hedge_policy() const override { return &policy_; }
+
+ private:
+  class HedgedCall;
+
+  // Updates the hedge delay from |histogram_| every |kUpdateDelayInterval|
+  // requests.
+  void MaybeUpdateDelay();
+
+  WorkerThreadManager* wm_;
+  const CompilerProxyHistogram* histogram_;
+  HedgePolicy policy_;
+  std::atomic<int64_t> num_exec_{0};
+};
+
 }  // namespace devtools_goma
 
 #endif  // DEVTOOLS_GOMA_CLIENT_HTTP_RPC_H_
@@ -4,6 +4,12 @@
 
 #include "http_rpc_init.h"
 
+#include <string>
+
+#include "compress_util.h"
+#include "file_helper.h"
+#include "glog/logging.h"
+
 #define GOMA_DECLARE_FLAGS_ONLY
 #include "goma_flags.cc"
 
@@ -15,6 +21,20 @@ void InitHttpRPCOptions(HttpRPC::Options* options) {
   options->accept_encoding = FLAGS_HTTP_ACCEPT_ENCODING;
   options->content_type_for_protobuf =
       FLAGS_CONTENT_TYPE_FOR_PROTOBUF;
+  if (!FLAGS_HTTP_RPC_ZSTD_DICTIONARY.empty()) {
+#ifdef ENABLE_ZSTD
+    std::string dict;
+    if (!ReadFileToString(FLAGS_HTTP_RPC_ZSTD_DICTIONARY, &dict)) {
+      LOG(ERROR) << "failed to read zstd dictionary "
+                 << FLAGS_HTTP_RPC_ZSTD_DICTIONARY;
+      return;
+    }
+    options->zstd_dictionary =
+        ZstdDictionary::Create(dict, FLAGS_HTTP_RPC_COMPRESSION_LEVEL);
+#else
+    LOG(WARNING) << "zstd dictionary is not supported.  need ENABLE_ZSTD";
+#endif
+  }
 }
 
 }  // namespace devtools_goma
@@ -0,0 +1,50 @@
+// Copyright 2020 The Goma Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "in_flight_uploads.h"
+
+#include "autolock_timer.h"
+#include "callback.h"
+#include "glog/logging.h"
+
+namespace devtools_goma {
+
+bool InFlightUploads::Join(const std::string& hash_key,
+                           bool* success,
+                           std::unique_ptr<OneshotClosure> done) {
+  AUTOLOCK(lock, &mu_);
+  auto p = waiters_.emplace(hash_key, std::vector<Waiter>());
+  if (p.second) {
+    // No one is uploading the same content.
+    return false;
+  }
+  p.first->second.push_back(Waiter{success, done.release()});
+  return true;
+}
+
+std::vector<OneshotClosure*> InFlightUploads::Finish(
+    const std::string& hash_key,
+    bool success) {
+  std::vector<OneshotClosure*> closures;
+  AUTOLOCK(lock, &mu_);
+  auto found = waiters_.find(hash_key);
+  DCHECK(found != waiters_.end()) << hash_key;
+  if (found == waiters_.end()) {
+    return closures;
+  }
+  closures.reserve(found->second.size());
+  for (const auto& waiter : found->second) {
+    *waiter.success = success;
+    closures.push_back(waiter.done);
+  }
+  waiters_.erase(found);
+  return closures;
+}
+
+size_t InFlightUploads::size() const {
+  AUTOLOCK(lock, &mu_);
+  return waiters_.size();
+}
+
+}  // namespace devtools_goma
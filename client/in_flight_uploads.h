@@ -0,0 +1,62 @@
+// Copyright 2020 The Goma Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#ifndef DEVTOOLS_GOMA_CLIENT_IN_FLIGHT_UPLOADS_H_
+#define DEVTOOLS_GOMA_CLIENT_IN_FLIGHT_UPLOADS_H_
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "absl/base/thread_annotations.h"
+#include "absl/container/flat_hash_map.h"
+#include "basictypes.h"
+#include "lockhelper.h"
+
+namespace devtools_goma {
+
+class OneshotClosure;
+
+// InFlightUploads keeps track of contents being uploaded, keyed by hash key,
+// so that the same content used by several files (e.g. a generated file
+// copied to other output directories) is uploaded once.
+//
+// This class is thread-safe.
+class InFlightUploads {
+ public:
+  InFlightUploads() = default;
+
+  // Returns false if |hash_key| is not being uploaded.  Then the caller
+  // becomes the uploader of |hash_key|, must call Finish() after upload,
+  // and |done| is deleted without running.
+  // Otherwise, |done| will be returned by Finish() of the uploader, after
+  // its result is set in |*success|.
+  bool Join(const std::string& hash_key,
+            bool* success,
+            std::unique_ptr<OneshotClosure> done);
+
+  // Finishes upload of |hash_key| with |success|, and returns closures of
+  // the callers joined to it.  The caller must run them.
+  std::vector<OneshotClosure*> Finish(const std::string& hash_key,
+                                      bool success);
+
+  // Returns the number of contents being uploaded.
+  size_t size() const;
+
+ private:
+  struct Waiter {
+    bool* success;
+    OneshotClosure* done;
+  };
+
+  mutable Lock mu_;
+  absl::flat_hash_map<std::string, std::vector<Waiter>> waiters_
+      ABSL_GUARDED_BY(mu_);
+
+  DISALLOW_COPY_AND_ASSIGN(InFlightUploads);
+};
+
+}  // namespace devtools_goma
+
+#endif  // DEVTOOLS_GOMA_CLIENT_IN_FLIGHT_UPLOADS_H_
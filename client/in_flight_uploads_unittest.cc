@@ -0,0 +1,102 @@
+// Copyright 2020 The Goma Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "in_flight_uploads.h"
+
+#include <memory>
+#include <vector>
+
+#include "absl/memory/memory.h"
+#include "callback.h"
+#include "gtest/gtest.h"
+
+namespace devtools_goma {
+
+namespace {
+
+constexpr char kHashKey[] =
+    "0123456789abcdef0123456789abcdef0123456789abcdef0123456789abcdef";
+
+class Waiter {
+ public:
+  std::unique_ptr<OneshotClosure> NewDone() {
+    return absl::WrapUnique<OneshotClosure>(NewCallback(this, &Waiter::Done));
+  }
+
+  void Done() { ++num_done; }
+
+  bool success = false;
+  int num_done = 0;
+};
+
+void RunAll(const std::vector<OneshotClosure*>& closures) {
+  for (auto* closure : closures) {
+    closure->Run();
+  }
+}
+
+}  // anonymous namespace
+
+TEST(InFlightUploadsTest, JoinWakesUpOnSuccess) {
+  InFlightUploads uploads;
+  Waiter uploader;
+  EXPECT_FALSE(uploads.Join(kHashKey, &uploader.success, uploader.NewDone()));
+  EXPECT_EQ(1U, uploads.size());
+
+  Waiter waiter1;
+  Waiter waiter2;
+  EXPECT_TRUE(uploads.Join(kHashKey, &waiter1.success, waiter1.NewDone()));
+  EXPECT_TRUE(uploads.Join(kHashKey, &waiter2.success, waiter2.NewDone()));
+  EXPECT_EQ(0, waiter1.num_done);
+  EXPECT_EQ(0, waiter2.num_done);
+
+  std::vector<OneshotClosure*> closures = uploads.Finish(kHashKey, true);
+  EXPECT_EQ(2U, closures.size());
+  EXPECT_EQ(0U, uploads.size());
+  RunAll(closures);
+  EXPECT_TRUE(waiter1.success);
+  EXPECT_EQ(1, waiter1.num_done);
+  EXPECT_TRUE(waiter2.success);
+  EXPECT_EQ(1, waiter2.num_done);
+  // The uploader's closure is not used.
+  EXPECT_EQ(0, uploader.num_done);
+}
+
+TEST(InFlightUploadsTest, JoinWakesUpOnFailure) {
+  InFlightUploads uploads;
+  Waiter uploader;
+  ASSERT_FALSE(uploads.Join(kHashKey, &uploader.success, uploader.NewDone()));
+
+  Waiter waiter;
+  waiter.success = true;
+  ASSERT_TRUE(uploads.Join(kHashKey, &waiter.success, waiter.NewDone()));
+  RunAll(uploads.Finish(kHashKey, false));
+  EXPECT_FALSE(waiter.success);
+  EXPECT_EQ(1, waiter.num_done);
+
+  // Next upload of the same content is not joined to the failed one.
+  Waiter retry;
+  EXPECT_FALSE(uploads.Join(kHashKey, &retry.success, retry.NewDone()));
+  EXPECT_TRUE(uploads.Finish(kHashKey, true).empty());
+  EXPECT_EQ(0, retry.num_done);
+}
+
+TEST(InFlightUploadsTest, DifferentContents) {
+  InFlightUploads uploads;
+  Waiter uploader1;
+  Waiter uploader2;
+  EXPECT_FALSE(uploads.Join("hash1", &uploader1.success, uploader1.NewDone()));
+  EXPECT_FALSE(uploads.Join("hash2", &uploader2.success, uploader2.NewDone()));
+  EXPECT_EQ(2U, uploads.size());
+
+  Waiter waiter;
+  EXPECT_TRUE(uploads.Join("hash2", &waiter.success, waiter.NewDone()));
+  EXPECT_TRUE(uploads.Finish("hash1", true).empty());
+  EXPECT_EQ(0, waiter.num_done);
+  RunAll(uploads.Finish("hash2", true));
+  EXPECT_EQ(1, waiter.num_done);
+  EXPECT_EQ(0U, uploads.size());
+}
+
+}  // namespace devtools_goma
@@ -0,0 +1,207 @@
+// Copyright 2020 The Goma Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "local_race_policy.h"
+
+#include <math.h>
+
+#include <algorithm>
+#include <sstream>
+#include <vector>
+
+#include "autolock_timer.h"
+#include "compiler_specific.h"
+#include "glog/logging.h"
+
+MSVC_PUSH_DISABLE_WARNING_FOR_PROTO()
+#include "lib/goma_stats.pb.h"
+MSVC_POP_WARNING()
+
+namespace devtools_goma {
+
+LocalRacePolicy::LocalRacePolicy(const Options& options) : options_(options) {
+  CHECK_GT(options_.percentile, 0);
+  CHECK_LT(options_.percentile, 100);
+  CHECK_GT(options_.window_size, 0U);
+  CHECK_GT(options_.num_local_slots, 0);
+  CHECK_GT(options_.explore_interval, 0);
+}
+
+absl::optional<absl::Duration> LocalRacePolicy::LocalRunDelay(
+    const std::string& key, int num_pending) {
+  AUTOLOCK(lock, &mu_);
+  auto found = histories_.find(key);
+  if (found == histories_.end() || !IsKnown(found->second)) {
+    return absl::nullopt;
+  }
+  const History& history = found->second;
+  const absl::Duration expected_local =
+      history.local_mean *
+      (1 + static_cast<double>(num_pending) / options_.num_local_slots);
+  const absl::Duration remote =
+      RemotePercentile(history, options_.percentile);
+  VLOG(2) << "local race " << key << " expected_local=" << expected_local
+          << " remote=" << remote << " num_pending=" << num_pending;
+  if (expected_local < remote) {
+    ++num_local_started_;
+    return absl::ZeroDuration();
+  }
+  ++num_local_delayed_;
+  return remote;
+}
+
+bool LocalRacePolicy::PreferLocal(const std::string& key) {
+  AUTOLOCK(lock, &mu_);
+  auto found = histories_.find(key);
+  if (found == histories_.end() || !IsKnown(found->second)) {
+    return false;
+  }
+  if (found->second.local_mean >= RemotePercentile(found->second, 50)) {
+    return false;
+  }
+  ++num_prefer_local_;
+  return num_prefer_local_ % options_.explore_interval != 0;
+}
+
+void LocalRacePolicy::RecordRemote(const std::string& key,
+                                   absl::Duration duration) {
+  AUTOLOCK(lock, &mu_);
+  History* history = &histories_[key];
+  history->remote.push_back(duration);
+  if (history->remote.size() > options_.window_size) {
+    history->remote.pop_front();
+  }
+}
+
+void LocalRacePolicy::RecordRemoteLowerBound(const std::string& key,
+                                             absl::Duration duration) {
+  // The real duration is only used via percentiles, which are not affected
+  // as long as this is beyond them.
+  RecordRemote(key, duration);
+}
+
+void LocalRacePolicy::RecordLocal(const std::string& key,
+                                  absl::Duration duration) {
+  AUTOLOCK(lock, &mu_);
+  History* history = &histories_[key];
+  if (history->num_local == 0) {
+    history->local_mean = duration;
+  } else {
+    history->local_mean +=
+        options_.local_alpha * (duration - history->local_mean);
+  }
+  ++history->num_local;
+}
+
+void LocalRacePolicy::RecordLocalLowerBound(const std::string& key,
+                                            absl::Duration duration) {
+  AUTOLOCK(lock, &mu_);
+  auto found = histories_.find(key);
+  if (found == histories_.end() || found->second.num_local == 0) {
+    // Not a measurement, so don't seed the mean with it.
+    return;
+  }
+  History* history = &found->second;
+  if (history->local_mean < duration) {
+    history->local_mean +=
+        options_.local_alpha * (duration - history->local_mean);
+  }
+}
+
+void LocalRacePolicy::RecordRace(const std::string& key, bool local_won,
+                                 absl::Duration wall_time,
+                                 absl::Duration local_run_time) {
+  AUTOLOCK(lock, &mu_);
+  if (!local_won) {
+    ++num_remote_won_;
+    wasted_local_time_ += local_run_time;
+    return;
+  }
+  ++num_local_won_;
+  auto found = histories_.find(key);
+  if (found == histories_.end() || found->second.remote.empty()) {
+    return;
+  }
+  const absl::Duration remote = RemotePercentile(found->second, 50);
+  if (remote > wall_time) {
+    saved_wall_time_ += remote - wall_time;
+  }
+}
+
+int64_t LocalRacePolicy::num_local_started() const {
+  AUTOLOCK(lock, &mu_);
+  return num_local_started_;
+}
+
+int64_t LocalRacePolicy::num_local_delayed() const {
+  AUTOLOCK(lock, &mu_);
+  return num_local_delayed_;
+}
+
+int64_t LocalRacePolicy::num_local_won() const {
+  AUTOLOCK(lock, &mu_);
+  return num_local_won_;
+}
+
+int64_t LocalRacePolicy::num_remote_won() const {
+  AUTOLOCK(lock, &mu_);
+  return num_remote_won_;
+}
+
+absl::Duration LocalRacePolicy::wasted_local_time() const {
+  AUTOLOCK(lock, &mu_);
+  return wasted_local_time_;
+}
+
+absl::Duration LocalRacePolicy::saved_wall_time() const {
+  AUTOLOCK(lock, &mu_);
+  return saved_wall_time_;
+}
+
+void LocalRacePolicy::DumpStatsToProto(LocalCompileStats* stats) const {
+  AUTOLOCK(lock, &mu_);
+  stats->set_race_started(num_local_started_);
+  stats->set_race_delayed(num_local_delayed_);
+  stats->set_race_local_won(num_local_won_);
+  stats->set_race_remote_won(num_remote_won_);
+  stats->set_race_wasted_local_time_ms(
+      absl::ToInt64Milliseconds(wasted_local_time_));
+  stats->set_race_saved_wall_time_ms(
+      absl::ToInt64Milliseconds(saved_wall_time_));
+}
+
+std::string LocalRacePolicy::DebugString() const {
+  AUTOLOCK(lock, &mu_);
+  std::ostringstream ss;
+  ss << "commands=" << histories_.size()
+     << " started=" << num_local_started_
+     << " delayed=" << num_local_delayed_
+     << " local_won=" << num_local_won_
+     << " remote_won=" << num_remote_won_
+     << " wasted_local=" << wasted_local_time_
+     << " saved_wall=" << saved_wall_time_;
+  return ss.str();
+}
+
+/* static */
+absl::Duration LocalRacePolicy::RemotePercentile(const History& history,
+                                                 double percentile) {
+  DCHECK(!history.remote.empty());
+  std::vector<absl::Duration> durations(history.remote.begin(),
+                                        history.remote.end());
+  size_t index = static_cast<size_t>(
+      ceil(durations.size() * percentile / 100.0));
+  index = std::min(std::max<size_t>(index, 1), durations.size()) - 1;
+  std::nth_element(durations.begin(), durations.begin() + index,
+                   durations.end());
+  return durations[index];
+}
+
+bool LocalRacePolicy::IsKnown(const History& history) const {
+  return static_cast<int64_t>(history.remote.size()) >=
+             options_.min_samples &&
+         history.num_local >= options_.min_samples;
+}
+
+}  // namespace devtools_goma
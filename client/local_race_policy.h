@@ -0,0 +1,139 @@
+// Copyright 2020 The Goma Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#ifndef DEVTOOLS_GOMA_CLIENT_LOCAL_RACE_POLICY_H_
+#define DEVTOOLS_GOMA_CLIENT_LOCAL_RACE_POLICY_H_
+
+#include <stdint.h>
+
+#include <deque>
+#include <string>
+#include <unordered_map>
+
+#include "absl/base/thread_annotations.h"
+#include "absl/time/time.h"
+#include "absl/types/optional.h"
+#include "basictypes.h"
+#include "lockhelper.h"
+
+namespace devtools_goma {
+
+class LocalCompileStats;
+
+// LocalRacePolicy decides when a local run is started to race against
+// the remote compile, from history of remote and local durations per
+// command (e.g. local compiler and task weight).
+//
+// The expected completion time of a local run is its mean run time,
+// plus the time to wait for |num_local_slots| to serve pending local runs.
+// If it beats the |percentile| remote duration, the local run is started
+// immediately.  Otherwise it is started after the |percentile| remote
+// duration, i.e. only for the remote compiles that are slower than usual.
+// Until |min_samples| of both are observed for the command, the decision
+// is left to the caller.
+// PreferLocal() tells whether the remote compile can be stopped once the
+// local run started.  Since it stops learning remote durations, one in
+// |explore_interval| calls returns false to keep remote history fresh.
+//
+// The side that lost a race is not measured, and learning only from the
+// winners makes both look faster than they are.  The elapsed time of the
+// lost side is recorded as a lower bound instead: a remote lower bound is
+// kept with the remote durations, which doesn't change the percentile as
+// long as it is beyond the percentile, and a local lower bound only raises
+// the local mean.
+//
+// This class is thread-safe.
+class LocalRacePolicy {
+ public:
+  struct Options {
+    double percentile = 90;
+    int64_t min_samples = 10;
+    // Number of recent remote durations kept per command.
+    size_t window_size = 100;
+    // Weight of new sample in moving average of local run time.
+    double local_alpha = 0.2;
+    int num_local_slots = 1;
+    int64_t explore_interval = 10;
+  };
+
+  explicit LocalRacePolicy(const Options& options);
+
+  // Returns the delay to start a local run of |key| while |num_pending|
+  // local runs are pending, or nullopt if it is not known yet.
+  absl::optional<absl::Duration> LocalRunDelay(const std::string& key,
+                                               int num_pending)
+      ABSL_LOCKS_EXCLUDED(mu_);
+
+  // Returns true if a local run of |key| is expected to finish earlier than
+  // the median remote compile, so a remote compile is not worth continuing
+  // once the local run started.
+  bool PreferLocal(const std::string& key) ABSL_LOCKS_EXCLUDED(mu_);
+
+  // Records the duration of a remote compile of |key|.
+  void RecordRemote(const std::string& key, absl::Duration duration)
+      ABSL_LOCKS_EXCLUDED(mu_);
+  // Records that a remote compile of |key| didn't finish in |duration|,
+  // i.e. it was stopped because the local run finished first.
+  void RecordRemoteLowerBound(const std::string& key, absl::Duration duration)
+      ABSL_LOCKS_EXCLUDED(mu_);
+  // Records the run time of a local run of |key| that wasn't killed.
+  void RecordLocal(const std::string& key, absl::Duration duration)
+      ABSL_LOCKS_EXCLUDED(mu_);
+  // Records that a local run of |key| was killed after |duration|, because
+  // the remote compile finished first.
+  void RecordLocalLowerBound(const std::string& key, absl::Duration duration)
+      ABSL_LOCKS_EXCLUDED(mu_);
+  // Records the result of a race of |key|.
+  // If |local_won|, the local run finished first and |wall_time| is the
+  // time the task took.  Otherwise the local run was killed after
+  // |local_run_time|.
+  void RecordRace(const std::string& key, bool local_won,
+                  absl::Duration wall_time, absl::Duration local_run_time)
+      ABSL_LOCKS_EXCLUDED(mu_);
+
+  int64_t num_local_started() const ABSL_LOCKS_EXCLUDED(mu_);
+  int64_t num_local_delayed() const ABSL_LOCKS_EXCLUDED(mu_);
+  int64_t num_local_won() const ABSL_LOCKS_EXCLUDED(mu_);
+  int64_t num_remote_won() const ABSL_LOCKS_EXCLUDED(mu_);
+  // Local run time spent for local runs killed by remote results.
+  absl::Duration wasted_local_time() const ABSL_LOCKS_EXCLUDED(mu_);
+  // Estimated wall time saved by local runs finished earlier than the
+  // median remote compile.
+  absl::Duration saved_wall_time() const ABSL_LOCKS_EXCLUDED(mu_);
+
+  void DumpStatsToProto(LocalCompileStats* stats) const
+      ABSL_LOCKS_EXCLUDED(mu_);
+  std::string DebugString() const ABSL_LOCKS_EXCLUDED(mu_);
+
+ private:
+  struct History {
+    // Recent remote durations or their lower bounds, the newest last.
+    std::deque<absl::Duration> remote;
+    int64_t num_local = 0;
+    absl::Duration local_mean;
+  };
+
+  // Returns |percentile| of remote durations in |history|.
+  static absl::Duration RemotePercentile(const History& history,
+                                         double percentile);
+  bool IsKnown(const History& history) const;
+
+  const Options options_;
+
+  mutable Lock mu_;
+  std::unordered_map<std::string, History> histories_ ABSL_GUARDED_BY(mu_);
+  int64_t num_prefer_local_ ABSL_GUARDED_BY(mu_) = 0;
+  int64_t num_local_started_ ABSL_GUARDED_BY(mu_) = 0;
+  int64_t num_local_delayed_ ABSL_GUARDED_BY(mu_) = 0;
+  int64_t num_local_won_ ABSL_GUARDED_BY(mu_) = 0;
+  int64_t num_remote_won_ ABSL_GUARDED_BY(mu_) = 0;
+  absl::Duration wasted_local_time_ ABSL_GUARDED_BY(mu_);
+  absl::Duration saved_wall_time_ ABSL_GUARDED_BY(mu_);
+
+  DISALLOW_COPY_AND_ASSIGN(LocalRacePolicy);
+};
+
+}  // namespace devtools_goma
+
+#endif  // DEVTOOLS_GOMA_CLIENT_LOCAL_RACE_POLICY_H_
@@ -0,0 +1,157 @@
+// Copyright 2020 The Goma Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "local_race_policy.h"
+
+#include "gtest/gtest.h"
+
+namespace devtools_goma {
+
+namespace {
+
+constexpr char kKey[] = "/usr/bin/clang";
+
+LocalRacePolicy::Options TestOptions() {
+  LocalRacePolicy::Options options;
+  options.percentile = 90;
+  options.min_samples = 10;
+  options.window_size = 100;
+  options.local_alpha = 0.5;
+  options.num_local_slots = 2;
+  return options;
+}
+
+// Records remote durations 1s, 2s, ..., 10s and local durations |local|.
+void RecordHistory(absl::Duration local, LocalRacePolicy* policy) {
+  for (int i = 1; i <= 10; ++i) {
+    policy->RecordRemote(kKey, absl::Seconds(i));
+    policy->RecordLocal(kKey, local);
+  }
+}
+
+}  // anonymous namespace
+
+TEST(LocalRacePolicyTest, UnknownUntilMinSamples) {
+  LocalRacePolicy policy(TestOptions());
+  EXPECT_FALSE(policy.LocalRunDelay(kKey, 0).has_value());
+  EXPECT_FALSE(policy.PreferLocal(kKey));
+
+  for (int i = 0; i < 9; ++i) {
+    policy.RecordRemote(kKey, absl::Seconds(1));
+    policy.RecordLocal(kKey, absl::Seconds(1));
+  }
+  EXPECT_FALSE(policy.LocalRunDelay(kKey, 0).has_value());
+  policy.RecordRemote(kKey, absl::Seconds(1));
+  EXPECT_FALSE(policy.LocalRunDelay(kKey, 0).has_value());
+  policy.RecordLocal(kKey, absl::Seconds(1));
+  EXPECT_TRUE(policy.LocalRunDelay(kKey, 0).has_value());
+
+  EXPECT_FALSE(policy.LocalRunDelay("/usr/bin/gcc", 0).has_value());
+}
+
+TEST(LocalRacePolicyTest, StartLocalIfFasterThanRemotePercentile) {
+  LocalRacePolicy policy(TestOptions());
+  RecordHistory(absl::Seconds(4), &policy);
+
+  // p90 of remote is 9s, and local is expected to finish in 4s.
+  EXPECT_EQ(absl::ZeroDuration(), policy.LocalRunDelay(kKey, 0));
+  // 4 pending local runs on 2 slots: 4s + 8s.
+  EXPECT_EQ(absl::Seconds(9), policy.LocalRunDelay(kKey, 4));
+  EXPECT_EQ(1, policy.num_local_started());
+  EXPECT_EQ(1, policy.num_local_delayed());
+}
+
+TEST(LocalRacePolicyTest, DelayLocalIfSlowerThanRemotePercentile) {
+  LocalRacePolicy policy(TestOptions());
+  RecordHistory(absl::Seconds(20), &policy);
+
+  EXPECT_EQ(absl::Seconds(9), policy.LocalRunDelay(kKey, 0));
+  EXPECT_FALSE(policy.PreferLocal(kKey));
+}
+
+TEST(LocalRacePolicyTest, PreferLocal) {
+  LocalRacePolicy policy(TestOptions());
+  RecordHistory(absl::Seconds(2), &policy);
+  // The median of remote is 5s.
+  int num_prefer_local = 0;
+  for (int i = 0; i < 100; ++i) {
+    if (policy.PreferLocal(kKey)) {
+      ++num_prefer_local;
+    }
+  }
+  // Remote is continued sometimes to learn remote durations.
+  EXPECT_EQ(90, num_prefer_local);
+}
+
+TEST(LocalRacePolicyTest, RemoteWindow) {
+  LocalRacePolicy::Options options = TestOptions();
+  options.window_size = 10;
+  LocalRacePolicy policy(options);
+  RecordHistory(absl::Seconds(4), &policy);
+  for (int i = 0; i < 10; ++i) {
+    policy.RecordRemote(kKey, absl::Seconds(1));
+  }
+  // Old slow remote durations are forgotten.
+  EXPECT_EQ(absl::Seconds(1), policy.LocalRunDelay(kKey, 0));
+}
+
+TEST(LocalRacePolicyTest, RemoteLowerBoundOfLostRaces) {
+  LocalRacePolicy winners_only(TestOptions());
+  LocalRacePolicy policy(TestOptions());
+  // Local takes 3s.  Remote takes 1s usually, but one in five is slow and
+  // stopped after 4s because the local run finished first.
+  for (int i = 0; i < 20; ++i) {
+    winners_only.RecordLocal(kKey, absl::Seconds(3));
+    policy.RecordLocal(kKey, absl::Seconds(3));
+    if (i % 5 == 4) {
+      policy.RecordRemoteLowerBound(kKey, absl::Seconds(4));
+      continue;
+    }
+    winners_only.RecordRemote(kKey, absl::Seconds(1));
+    policy.RecordRemote(kKey, absl::Seconds(1));
+  }
+  // Learning only from the races remote won biases to remote.
+  EXPECT_EQ(absl::Seconds(1), winners_only.LocalRunDelay(kKey, 0));
+  // p90 of remote is 4s at least.
+  EXPECT_EQ(absl::ZeroDuration(), policy.LocalRunDelay(kKey, 0));
+}
+
+TEST(LocalRacePolicyTest, LocalLowerBoundOfLostRaces) {
+  LocalRacePolicy policy(TestOptions());
+  // Not a measurement, so it doesn't make the command known.
+  policy.RecordLocalLowerBound(kKey, absl::Seconds(1));
+  for (int i = 1; i <= 10; ++i) {
+    policy.RecordRemote(kKey, absl::Seconds(i));
+  }
+  EXPECT_FALSE(policy.LocalRunDelay(kKey, 0).has_value());
+
+  for (int i = 0; i < 10; ++i) {
+    policy.RecordLocal(kKey, absl::Seconds(2));
+  }
+  EXPECT_EQ(absl::ZeroDuration(), policy.LocalRunDelay(kKey, 0));
+  // Shorter than the mean tells nothing.
+  policy.RecordLocalLowerBound(kKey, absl::Seconds(1));
+  EXPECT_EQ(absl::ZeroDuration(), policy.LocalRunDelay(kKey, 0));
+  // Killed after 20s: the mean becomes 11s, slower than p90 of remote.
+  policy.RecordLocalLowerBound(kKey, absl::Seconds(20));
+  EXPECT_EQ(absl::Seconds(9), policy.LocalRunDelay(kKey, 0));
+}
+
+TEST(LocalRacePolicyTest, RecordRace) {
+  LocalRacePolicy policy(TestOptions());
+  RecordHistory(absl::Seconds(4), &policy);
+
+  policy.RecordRace(kKey, true, absl::Seconds(3), absl::Seconds(3));
+  policy.RecordRace(kKey, true, absl::Seconds(7), absl::Seconds(7));
+  policy.RecordRace(kKey, false, absl::Seconds(2), absl::Seconds(1));
+  policy.RecordRace(kKey, false, absl::Seconds(3), absl::Seconds(2));
+
+  EXPECT_EQ(2, policy.num_local_won());
+  EXPECT_EQ(2, policy.num_remote_won());
+  EXPECT_EQ(absl::Seconds(3), policy.wasted_local_time());
+  // The median of remote is 5s.
+  EXPECT_EQ(absl::Seconds(2), policy.saved_wall_time());
+}
+
+}  // namespace devtools_goma
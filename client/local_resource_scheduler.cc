@@ -0,0 +1,311 @@
+// Copyright 2020 The Goma Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "local_resource_scheduler.h"
+
+#ifdef __linux__
+#include <unistd.h>
+#endif
+
+#include <algorithm>
+#include <sstream>
+#include <vector>
+
+#include "absl/strings/ascii.h"
+#include "absl/strings/match.h"
+#include "absl/strings/numbers.h"
+#include "absl/strings/str_cat.h"
+#include "absl/strings/str_split.h"
+#include "absl/strings/strip.h"
+#include "file_helper.h"
+#include "glog/logging.h"
+
+namespace devtools_goma {
+
+std::string ResourcePressure::DebugString() const {
+  std::ostringstream ss;
+  ss << "cpu_some_avg10=" << cpu_some_avg10
+     << " memory_some_avg10=" << memory_some_avg10
+     << " loadavg1=" << loadavg1
+     << " available_mem_kb=" << available_mem_kb;
+  return ss.str();
+}
+
+ResourcePressure ReadResourcePressure() {
+  ResourcePressure pressure;
+#ifdef __linux__
+  std::string content;
+  if (ReadFileToString("/proc/pressure/cpu", &content)) {
+    ParsePressureSomeAvg10(content, &pressure.cpu_some_avg10);
+  }
+  if (ReadFileToString("/proc/pressure/memory", &content)) {
+    ParsePressureSomeAvg10(content, &pressure.memory_some_avg10);
+  }
+  if (ReadFileToString("/proc/loadavg", &content)) {
+    ParseLoadAvg1(content, &pressure.loadavg1);
+  }
+  if (ReadFileToString("/proc/meminfo", &content)) {
+    ParseMemAvailableKb(content, &pressure.available_mem_kb);
+  }
+  int64_t cgroup_available_kb = -1;
+  std::string cgroup_path;
+  bool is_v2 = false;
+  if (ReadFileToString("/proc/self/cgroup", &content) &&
+      ParseMemoryCgroupPath(content, &cgroup_path, &is_v2)) {
+    cgroup_available_kb = ReadCgroupAvailableMemKb(
+        is_v2 ? "/sys/fs/cgroup" : "/sys/fs/cgroup/memory", cgroup_path,
+        is_v2);
+  }
+  if (cgroup_available_kb >= 0 &&
+      (pressure.available_mem_kb < 0 ||
+       cgroup_available_kb < pressure.available_mem_kb)) {
+    pressure.available_mem_kb = cgroup_available_kb;
+  }
+#endif
+  return pressure;
+}
+
+bool ParsePressureSomeAvg10(absl::string_view content, double* avg10) {
+  // some avg10=0.00 avg60=0.00 avg300=0.00 total=0
+  // full avg10=0.00 avg60=0.00 avg300=0.00 total=0
+  for (absl::string_view line : absl::StrSplit(content, '\n')) {
+    if (!absl::ConsumePrefix(&line, "some ")) {
+      continue;
+    }
+    for (absl::string_view field :
+         absl::StrSplit(line, ' ', absl::SkipEmpty())) {
+      if (absl::ConsumePrefix(&field, "avg10=")) {
+        return absl::SimpleAtod(field, avg10);
+      }
+    }
+  }
+  return false;
+}
+
+bool ParseLoadAvg1(absl::string_view content, double* loadavg1) {
+  // 0.50 0.40 0.30 1/123 4567
+  std::vector<absl::string_view> fields =
+      absl::StrSplit(content, ' ', absl::SkipEmpty());
+  if (fields.empty()) {
+    return false;
+  }
+  return absl::SimpleAtod(fields[0], loadavg1);
+}
+
+bool ParseMemAvailableKb(absl::string_view content, int64_t* mem_kb) {
+  // MemAvailable:   12345678 kB
+  for (absl::string_view line : absl::StrSplit(content, '\n')) {
+    if (!absl::ConsumePrefix(&line, "MemAvailable:")) {
+      continue;
+    }
+    line = absl::StripAsciiWhitespace(line);
+    if (!absl::ConsumeSuffix(&line, "kB")) {
+      return false;
+    }
+    return absl::SimpleAtoi(absl::StripAsciiWhitespace(line), mem_kb);
+  }
+  return false;
+}
+
+int64_t ReadProcessRssKb(int pid) {
+#ifdef __linux__
+  std::string content;
+  int64_t pages = 0;
+  if (ReadFileToString(absl::StrCat("/proc/", pid, "/statm"), &content) &&
+      ParseStatmRssPages(content, &pages)) {
+    return pages * (sysconf(_SC_PAGESIZE) / 1024);
+  }
+#endif
+  return -1;
+}
+
+bool ParseStatmRssPages(absl::string_view content, int64_t* pages) {
+  // size resident shared text lib data dt
+  std::vector<absl::string_view> fields =
+      absl::StrSplit(content, ' ', absl::SkipEmpty());
+  if (fields.size() < 2) {
+    return false;
+  }
+  return absl::SimpleAtoi(fields[1], pages);
+}
+
+bool ParseMemoryCgroupPath(absl::string_view content, std::string* path,
+                           bool* is_v2) {
+  // cgroup v1: "4:memory:/user.slice"
+  // cgroup v2: "0::/user.slice/user-1000.slice/session-1.scope"
+  // On hybrid hierarchy, memory controller is in v1 if it is listed.
+  bool found_v2 = false;
+  for (absl::string_view line : absl::StrSplit(content, '\n')) {
+    std::vector<absl::string_view> fields = absl::StrSplit(line, ':');
+    if (fields.size() != 3) {
+      continue;
+    }
+    if (fields[1].empty() && fields[0] == "0") {
+      *path = std::string(fields[2]);
+      found_v2 = true;
+      continue;
+    }
+    for (absl::string_view controller : absl::StrSplit(fields[1], ',')) {
+      if (controller == "memory") {
+        *path = std::string(fields[2]);
+        *is_v2 = false;
+        return true;
+      }
+    }
+  }
+  *is_v2 = found_v2;
+  return found_v2;
+}
+
+bool ParseMemoryStatInactiveFile(absl::string_view content, bool is_v2,
+                                 int64_t* bytes) {
+  // cgroup v2: "inactive_file 123456"
+  // cgroup v1: "total_inactive_file 123456", including descendants.
+  const absl::string_view key =
+      is_v2 ? "inactive_file" : "total_inactive_file";
+  for (absl::string_view line : absl::StrSplit(content, '\n')) {
+    std::vector<absl::string_view> fields =
+        absl::StrSplit(line, ' ', absl::SkipEmpty());
+    if (fields.size() == 2 && fields[0] == key) {
+      return absl::SimpleAtoi(fields[1], bytes);
+    }
+  }
+  return false;
+}
+
+int64_t ReadCgroupAvailableMemKb(const std::string& root, std::string path,
+                                 bool is_v2) {
+  const char* limit_file = is_v2 ? "memory.max" : "memory.limit_in_bytes";
+  const char* usage_file = is_v2 ? "memory.current" : "memory.usage_in_bytes";
+
+  int64_t available_kb = -1;
+  for (;;) {
+    const std::string dir = absl::StrCat(root, path);
+    std::string limit_str, usage_str, stat_str;
+    int64_t limit = 0;
+    int64_t usage = 0;
+    if (ReadFileToString(absl::StrCat(dir, "/", limit_file), &limit_str) &&
+        ReadFileToString(absl::StrCat(dir, "/", usage_file), &usage_str) &&
+        absl::SimpleAtoi(absl::StripAsciiWhitespace(limit_str), &limit) &&
+        absl::SimpleAtoi(absl::StripAsciiWhitespace(usage_str), &usage)) {
+      // usage includes page cache, which is reclaimed under the limit.
+      // Subtract inactive file cache to get the working set, as kubelet
+      // does, or the cgroup looks full after reading many files.
+      int64_t inactive_file = 0;
+      if (ReadFileToString(absl::StrCat(dir, "/memory.stat"), &stat_str) &&
+          ParseMemoryStatInactiveFile(stat_str, is_v2, &inactive_file)) {
+        usage = std::max<int64_t>(0, usage - inactive_file);
+      }
+      // "max" in cgroup v2 fails to parse, and no limit in cgroup v1 is
+      // a huge number, which doesn't affect the min.
+      const int64_t kb = std::max<int64_t>(0, limit - usage) / 1024;
+      if (available_kb < 0 || kb < available_kb) {
+        available_kb = kb;
+      }
+    }
+    if (path.empty() || path == "/") {
+      break;
+    }
+    path = path.substr(0, path.rfind('/'));
+  }
+  return available_kb;
+}
+
+LocalResourceScheduler::LocalResourceScheduler(const Options& options)
+    : options_(options),
+      heavy_weight_mem_kb_(options.default_heavy_weight_mem_kb),
+      light_weight_mem_kb_(options.default_light_weight_mem_kb) {
+}
+
+void LocalResourceScheduler::UpdatePressure(
+    const ResourcePressure& pressure) {
+  pressure_ = pressure;
+}
+
+LocalResourceScheduler::Decision LocalResourceScheduler::Admit(
+    int id, SubProcessReq::Weight weight, int num_running) {
+  const int64_t mem_kb = EstimatedMemKb(weight);
+  if (num_running > 0) {
+    if (pressure_.memory_some_avg10 >= options_.memory_pressure_threshold) {
+      return DEFER_BY_MEMORY;
+    }
+    if (pressure_.available_mem_kb >= 0 &&
+        reserved_mem_kb() + mem_kb + options_.min_free_mem_kb >
+            pressure_.available_mem_kb) {
+      return DEFER_BY_MEMORY;
+    }
+    if (pressure_.cpu_some_avg10 >= options_.cpu_pressure_threshold) {
+      return DEFER_BY_CPU;
+    }
+    if (options_.num_cpus > 0 &&
+        pressure_.loadavg1 >= options_.load_threshold * options_.num_cpus) {
+      return DEFER_BY_CPU;
+    }
+  }
+  reservations_[id] = Reservation{mem_kb, mem_kb};
+  return ADMIT;
+}
+
+void LocalResourceScheduler::UpdateReservation(int id, int64_t rss_kb) {
+  auto found = reservations_.find(id);
+  if (found == reservations_.end() || rss_kb < 0) {
+    return;
+  }
+  Reservation* reservation = &found->second;
+  reservation->reserved_kb =
+      std::max<int64_t>(0, reservation->estimated_kb - rss_kb);
+}
+
+void LocalResourceScheduler::OnTerminated(int id,
+                                          SubProcessReq::Weight weight,
+                                          int64_t mem_kb) {
+  reservations_.erase(id);
+  if (mem_kb <= 0) {
+    return;
+  }
+  double* estimate = weight == SubProcessReq::HEAVY_WEIGHT
+                         ? &heavy_weight_mem_kb_
+                         : &light_weight_mem_kb_;
+  *estimate += options_.mem_estimate_alpha * (mem_kb - *estimate);
+}
+
+int64_t LocalResourceScheduler::reserved_mem_kb() const {
+  int64_t reserved_kb = 0;
+  for (const auto& it : reservations_) {
+    reserved_kb += it.second.reserved_kb;
+  }
+  return reserved_kb;
+}
+
+int64_t LocalResourceScheduler::EstimatedMemKb(
+    SubProcessReq::Weight weight) const {
+  if (weight == SubProcessReq::HEAVY_WEIGHT) {
+    return static_cast<int64_t>(heavy_weight_mem_kb_);
+  }
+  return static_cast<int64_t>(light_weight_mem_kb_);
+}
+
+/* static */
+const char* LocalResourceScheduler::DecisionName(Decision decision) {
+  switch (decision) {
+    case ADMIT:
+      return "admit";
+    case DEFER_BY_MEMORY:
+      return "defer_by_memory";
+    case DEFER_BY_CPU:
+      return "defer_by_cpu";
+  }
+  return "unknown";
+}
+
+std::string LocalResourceScheduler::DebugString() const {
+  std::ostringstream ss;
+  ss << pressure_.DebugString()
+     << " reserved_mem_kb=" << reserved_mem_kb()
+     << " heavy_weight_mem_kb=" << EstimatedMemKb(SubProcessReq::HEAVY_WEIGHT)
+     << " light_weight_mem_kb=" << EstimatedMemKb(SubProcessReq::LIGHT_WEIGHT);
+  return ss.str();
+}
+
+}  // namespace devtools_goma
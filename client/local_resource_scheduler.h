@@ -0,0 +1,152 @@
+// Copyright 2020 The Goma Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#ifndef DEVTOOLS_GOMA_CLIENT_LOCAL_RESOURCE_SCHEDULER_H_
+#define DEVTOOLS_GOMA_CLIENT_LOCAL_RESOURCE_SCHEDULER_H_
+
+#include <stdint.h>
+
+#include <string>
+
+#include "absl/container/flat_hash_map.h"
+#include "absl/strings/string_view.h"
+#include "absl/time/time.h"
+#include "basictypes.h"
+#include "compiler_specific.h"
+MSVC_PUSH_DISABLE_WARNING_FOR_PROTO()
+#include "client/subprocess.pb.h"
+MSVC_POP_WARNING()
+
+namespace devtools_goma {
+
+// Snapshot of CPU and memory pressure of the host.
+// Negative value means unknown.
+struct ResourcePressure {
+  // "some avg10" of /proc/pressure/cpu and /proc/pressure/memory,
+  // i.e. percentage of time some tasks were stalled in the last 10 seconds.
+  double cpu_some_avg10 = -1;
+  double memory_some_avg10 = -1;
+  // 1 minute load average.
+  double loadavg1 = -1;
+  // Memory available for new processes: MemAvailable in /proc/meminfo,
+  // or the room left in the memory cgroup if it is smaller.
+  int64_t available_mem_kb = -1;
+
+  std::string DebugString() const;
+};
+
+// Reads the current ResourcePressure.
+// Only Linux is supported.  On other platforms, all values are unknown.
+ResourcePressure ReadResourcePressure();
+
+// Parses "some avg10" of /proc/pressure/* |content|.
+bool ParsePressureSomeAvg10(absl::string_view content, double* avg10);
+// Parses 1 minute load average of /proc/loadavg |content|.
+bool ParseLoadAvg1(absl::string_view content, double* loadavg1);
+// Parses MemAvailable of /proc/meminfo |content|.
+bool ParseMemAvailableKb(absl::string_view content, int64_t* mem_kb);
+// Reads current RSS of process |pid|.  Returns -1 if unknown.
+int64_t ReadProcessRssKb(int pid);
+// Parses resident pages of /proc/<pid>/statm |content|.
+bool ParseStatmRssPages(absl::string_view content, int64_t* pages);
+// Parses memory cgroup directory of /proc/self/cgroup |content|, relative to
+// the cgroup mount point.  |is_v2| is set to true for the unified hierarchy.
+bool ParseMemoryCgroupPath(absl::string_view content, std::string* path,
+                           bool* is_v2);
+// Parses inactive file cache in bytes of memory.stat |content| of memory
+// cgroup.
+bool ParseMemoryStatInactiveFile(absl::string_view content, bool is_v2,
+                                 int64_t* bytes);
+// Reads memory available in memory cgroup |path| under cgroup mount point
+// |root| and its ancestors, i.e. the min of limit minus working set (usage
+// minus inactive file cache).  Returns -1 if there is no limit.
+int64_t ReadCgroupAvailableMemKb(const std::string& root, std::string path,
+                                 bool is_v2);
+
+// LocalResourceScheduler decides whether a local subprocess may start now,
+// in addition to the static max_subprocs limits.
+//
+// A subprocess is deferred if its estimated peak memory doesn't fit in the
+// available memory, or the host is under memory or CPU pressure (PSI
+// avg10 or load average per CPU beyond the thresholds).
+// The peak memory is estimated per SubProcessReq::Weight, from the max RSS
+// of terminated subprocesses (exponential moving average).
+// Since a started subprocess takes some time to allocate its memory, and
+// until then it is not reflected in the available memory, each running
+// subprocess reserves its estimate minus its current RSS (floored at 0),
+// until it terminates.
+// A subprocess is always admitted when nothing is running, so it never
+// stalls local compiles.
+//
+// This class is thread-compatible.
+class LocalResourceScheduler {
+ public:
+  struct Options {
+    double cpu_pressure_threshold = 60;
+    double memory_pressure_threshold = 10;
+    // Load average per CPU.
+    double load_threshold = 1.5;
+    int num_cpus = 0;
+    // Memory kept free for others.
+    int64_t min_free_mem_kb = 512 * 1024;
+    int64_t default_heavy_weight_mem_kb = 1024 * 1024;
+    int64_t default_light_weight_mem_kb = 256 * 1024;
+    // Weight of new sample in moving average of memory estimate.
+    double mem_estimate_alpha = 0.25;
+  };
+
+  enum Decision {
+    ADMIT,
+    DEFER_BY_MEMORY,
+    DEFER_BY_CPU,
+  };
+
+  explicit LocalResourceScheduler(const Options& options);
+
+  // Sets the current pressure.
+  void UpdatePressure(const ResourcePressure& pressure);
+
+  // Decides whether subprocess |id| of |weight| may start while
+  // |num_running| subprocesses are running.  Reserves its memory if
+  // admitted.
+  Decision Admit(int id, SubProcessReq::Weight weight, int num_running);
+
+  // Updates the reservation of running subprocess |id| to its estimate
+  // minus its current RSS |rss_kb|, which is already counted in the
+  // available memory.
+  void UpdateReservation(int id, int64_t rss_kb);
+
+  // Releases the reservation of subprocess |id|, and learns memory usage
+  // from it if it terminated with max RSS |mem_kb| (<= 0 if unknown).
+  void OnTerminated(int id, SubProcessReq::Weight weight, int64_t mem_kb);
+
+  int64_t EstimatedMemKb(SubProcessReq::Weight weight) const;
+  const ResourcePressure& pressure() const { return pressure_; }
+  int64_t reserved_mem_kb() const;
+
+  static const char* DecisionName(Decision decision);
+
+  std::string DebugString() const;
+
+ private:
+  const Options options_;
+
+  ResourcePressure pressure_;
+  struct Reservation {
+    // Estimated peak memory when admitted.
+    int64_t estimated_kb;
+    // Part of estimated_kb not used by the subprocess yet.
+    int64_t reserved_kb;
+  };
+  // Reservations of running subprocesses, keyed by subprocess id.
+  absl::flat_hash_map<int, Reservation> reservations_;
+  double heavy_weight_mem_kb_;
+  double light_weight_mem_kb_;
+
+  DISALLOW_COPY_AND_ASSIGN(LocalResourceScheduler);
+};
+
+}  // namespace devtools_goma
+
+#endif  // DEVTOOLS_GOMA_CLIENT_LOCAL_RESOURCE_SCHEDULER_H_
@@ -0,0 +1,286 @@
+// Copyright 2020 The Goma Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "local_resource_scheduler.h"
+
+#include "gtest/gtest.h"
+#include "unittest_util.h"
+
+namespace devtools_goma {
+
+namespace {
+
+LocalResourceScheduler::Options TestOptions() {
+  LocalResourceScheduler::Options options;
+  options.num_cpus = 4;
+  options.min_free_mem_kb = 100;
+  options.default_heavy_weight_mem_kb = 1000;
+  options.default_light_weight_mem_kb = 100;
+  options.mem_estimate_alpha = 0.5;
+  return options;
+}
+
+ResourcePressure IdlePressure() {
+  ResourcePressure pressure;
+  pressure.cpu_some_avg10 = 0;
+  pressure.memory_some_avg10 = 0;
+  pressure.loadavg1 = 0.5;
+  pressure.available_mem_kb = 10000;
+  return pressure;
+}
+
+}  // anonymous namespace
+
+TEST(LocalResourceSchedulerTest, ParsePressureSomeAvg10) {
+  double avg10 = -1;
+  EXPECT_TRUE(ParsePressureSomeAvg10(
+      "some avg10=12.34 avg60=5.00 avg300=1.00 total=123456\n"
+      "full avg10=1.00 avg60=0.50 avg300=0.10 total=1234\n",
+      &avg10));
+  EXPECT_DOUBLE_EQ(12.34, avg10);
+
+  EXPECT_FALSE(ParsePressureSomeAvg10(
+      "full avg10=1.00 avg60=0.50 avg300=0.10 total=1234\n", &avg10));
+  EXPECT_FALSE(ParsePressureSomeAvg10("", &avg10));
+}
+
+TEST(LocalResourceSchedulerTest, ParseLoadAvg1) {
+  double loadavg1 = -1;
+  EXPECT_TRUE(ParseLoadAvg1("3.25 2.00 1.50 2/345 6789\n", &loadavg1));
+  EXPECT_DOUBLE_EQ(3.25, loadavg1);
+  EXPECT_FALSE(ParseLoadAvg1("", &loadavg1));
+}
+
+TEST(LocalResourceSchedulerTest, ParseMemAvailableKb) {
+  int64_t mem_kb = -1;
+  EXPECT_TRUE(ParseMemAvailableKb(
+      "MemTotal:       32768000 kB\n"
+      "MemFree:         1024000 kB\n"
+      "MemAvailable:   16384000 kB\n"
+      "Buffers:          512000 kB\n",
+      &mem_kb));
+  EXPECT_EQ(16384000, mem_kb);
+  EXPECT_FALSE(ParseMemAvailableKb("MemTotal:       32768000 kB\n", &mem_kb));
+}
+
+TEST(LocalResourceSchedulerTest, ParseStatmRssPages) {
+  int64_t pages = -1;
+  EXPECT_TRUE(ParseStatmRssPages("12345 678 90 12 0 3456 0\n", &pages));
+  EXPECT_EQ(678, pages);
+  EXPECT_FALSE(ParseStatmRssPages("12345\n", &pages));
+  EXPECT_FALSE(ParseStatmRssPages("", &pages));
+}
+
+TEST(LocalResourceSchedulerTest, ParseMemoryCgroupPath) {
+  std::string path;
+  bool is_v2 = false;
+  EXPECT_TRUE(ParseMemoryCgroupPath(
+      "0::/user.slice/user-1000.slice/session-1.scope\n", &path, &is_v2));
+  EXPECT_EQ("/user.slice/user-1000.slice/session-1.scope", path);
+  EXPECT_TRUE(is_v2);
+
+  EXPECT_TRUE(ParseMemoryCgroupPath(
+      "12:cpu,cpuacct:/build\n"
+      "4:memory:/build/goma\n"
+      "0::/build\n",
+      &path, &is_v2));
+  EXPECT_EQ("/build/goma", path);
+  EXPECT_FALSE(is_v2);
+
+  EXPECT_FALSE(ParseMemoryCgroupPath("12:cpu,cpuacct:/build\n",
+                                     &path, &is_v2));
+}
+
+TEST(LocalResourceSchedulerTest, ParseMemoryStatInactiveFile) {
+  int64_t bytes = -1;
+  EXPECT_TRUE(ParseMemoryStatInactiveFile(
+      "anon 1000\n"
+      "file 9000\n"
+      "active_file 1000\n"
+      "inactive_file 8000\n",
+      true, &bytes));
+  EXPECT_EQ(8000, bytes);
+  EXPECT_TRUE(ParseMemoryStatInactiveFile(
+      "inactive_file 100\n"
+      "total_inactive_file 8000\n",
+      false, &bytes));
+  EXPECT_EQ(8000, bytes);
+  EXPECT_FALSE(ParseMemoryStatInactiveFile("anon 1000\n", true, &bytes));
+}
+
+TEST(LocalResourceSchedulerTest, CgroupAvailableMemExcludesPageCache) {
+  TmpdirUtil tmpdir("local_resource_scheduler_unittest");
+  // The build cgroup is almost full of page cache, but most of it is
+  // inactive, and reclaimable.
+  tmpdir.CreateTmpFile("v2/build/memory.max", "4294967296\n");
+  tmpdir.CreateTmpFile("v2/build/memory.current", "4194304000\n");
+  tmpdir.CreateTmpFile("v2/build/memory.stat",
+                       "anon 1073741824\n"
+                       "file 3120562176\n"
+                       "active_file 73400320\n"
+                       "inactive_file 3047161856\n");
+  tmpdir.CreateTmpFile("v2/memory.max", "max\n");
+  tmpdir.CreateTmpFile("v2/memory.current", "8589934592\n");
+  EXPECT_EQ((4096 - (4000 - 2906)) * 1024,
+            ReadCgroupAvailableMemKb(tmpdir.FullPath("v2"), "/build", true));
+
+  tmpdir.CreateTmpFile("v1/build/memory.limit_in_bytes", "2147483648\n");
+  tmpdir.CreateTmpFile("v1/build/memory.usage_in_bytes", "2097152000\n");
+  tmpdir.CreateTmpFile("v1/build/memory.stat",
+                       "inactive_file 0\n"
+                       "total_inactive_file 1048576000\n");
+  // The parent has smaller room, which is taken.
+  tmpdir.CreateTmpFile("v1/memory.limit_in_bytes", "1073741824\n");
+  tmpdir.CreateTmpFile("v1/memory.usage_in_bytes", "524288000\n");
+  EXPECT_EQ((1024 - 500) * 1024,
+            ReadCgroupAvailableMemKb(tmpdir.FullPath("v1"), "/build", false));
+
+  // No memory.stat; usage is used as is.
+  tmpdir.CreateTmpFile("nostat/build/memory.max", "4294967296\n");
+  tmpdir.CreateTmpFile("nostat/build/memory.current", "4194304000\n");
+  EXPECT_EQ((4096 - 4000) * 1024,
+            ReadCgroupAvailableMemKb(tmpdir.FullPath("nostat"), "/build",
+                                     true));
+
+  // No limit.
+  EXPECT_EQ(-1, ReadCgroupAvailableMemKb(tmpdir.FullPath("none"), "/build",
+                                         true));
+}
+
+TEST(LocalResourceSchedulerTest, AdmitWhenIdle) {
+  LocalResourceScheduler scheduler(TestOptions());
+  scheduler.UpdatePressure(IdlePressure());
+  EXPECT_EQ(LocalResourceScheduler::ADMIT,
+            scheduler.Admit(1, SubProcessReq::HEAVY_WEIGHT, 1));
+  EXPECT_EQ(LocalResourceScheduler::ADMIT,
+            scheduler.Admit(2, SubProcessReq::LIGHT_WEIGHT, 2));
+  EXPECT_EQ(1100, scheduler.reserved_mem_kb());
+}
+
+TEST(LocalResourceSchedulerTest, AdmitWhenUnknown) {
+  LocalResourceScheduler scheduler(TestOptions());
+  scheduler.UpdatePressure(ResourcePressure());
+  EXPECT_EQ(LocalResourceScheduler::ADMIT,
+            scheduler.Admit(1, SubProcessReq::HEAVY_WEIGHT, 10));
+}
+
+TEST(LocalResourceSchedulerTest, DeferByAvailableMemory) {
+  LocalResourceScheduler scheduler(TestOptions());
+  ResourcePressure pressure = IdlePressure();
+  pressure.available_mem_kb = 2000;
+  scheduler.UpdatePressure(pressure);
+
+  EXPECT_EQ(LocalResourceScheduler::ADMIT,
+            scheduler.Admit(1, SubProcessReq::HEAVY_WEIGHT, 1));
+  // The first one is reserved while it is running.
+  EXPECT_EQ(LocalResourceScheduler::DEFER_BY_MEMORY,
+            scheduler.Admit(2, SubProcessReq::HEAVY_WEIGHT, 2));
+  EXPECT_EQ(LocalResourceScheduler::ADMIT,
+            scheduler.Admit(3, SubProcessReq::LIGHT_WEIGHT, 2));
+
+  scheduler.OnTerminated(1, SubProcessReq::HEAVY_WEIGHT, -1);
+  EXPECT_EQ(100, scheduler.reserved_mem_kb());
+  EXPECT_EQ(LocalResourceScheduler::ADMIT,
+            scheduler.Admit(2, SubProcessReq::HEAVY_WEIGHT, 2));
+}
+
+TEST(LocalResourceSchedulerTest, KeepReservationOverPressureUpdate) {
+  LocalResourceScheduler scheduler(TestOptions());
+  ResourcePressure pressure = IdlePressure();
+  pressure.available_mem_kb = 2000;
+  scheduler.UpdatePressure(pressure);
+  EXPECT_EQ(LocalResourceScheduler::ADMIT,
+            scheduler.Admit(1, SubProcessReq::HEAVY_WEIGHT, 1));
+
+  // The first one hasn't allocated its memory yet, so the available memory
+  // is unchanged.
+  scheduler.UpdatePressure(pressure);
+  EXPECT_EQ(1000, scheduler.reserved_mem_kb());
+  EXPECT_EQ(LocalResourceScheduler::DEFER_BY_MEMORY,
+            scheduler.Admit(2, SubProcessReq::HEAVY_WEIGHT, 2));
+
+  // RSS of the first one is counted in the available memory, so only the
+  // rest of its estimate is reserved.
+  scheduler.UpdateReservation(1, 600);
+  pressure.available_mem_kb = 1400;
+  scheduler.UpdatePressure(pressure);
+  EXPECT_EQ(400, scheduler.reserved_mem_kb());
+  EXPECT_EQ(LocalResourceScheduler::DEFER_BY_MEMORY,
+            scheduler.Admit(2, SubProcessReq::HEAVY_WEIGHT, 2));
+
+  scheduler.UpdateReservation(1, 1500);
+  EXPECT_EQ(0, scheduler.reserved_mem_kb());
+  pressure.available_mem_kb = 3000;
+  scheduler.UpdatePressure(pressure);
+  EXPECT_EQ(LocalResourceScheduler::ADMIT,
+            scheduler.Admit(2, SubProcessReq::HEAVY_WEIGHT, 2));
+  EXPECT_EQ(1000, scheduler.reserved_mem_kb());
+
+  // Unknown RSS doesn't change the reservation.
+  scheduler.UpdateReservation(2, -1);
+  EXPECT_EQ(1000, scheduler.reserved_mem_kb());
+  scheduler.OnTerminated(2, SubProcessReq::HEAVY_WEIGHT, -1);
+  EXPECT_EQ(0, scheduler.reserved_mem_kb());
+}
+
+TEST(LocalResourceSchedulerTest, AlwaysAdmitWhenNothingRunning) {
+  LocalResourceScheduler scheduler(TestOptions());
+  ResourcePressure pressure = IdlePressure();
+  pressure.available_mem_kb = 0;
+  pressure.cpu_some_avg10 = 100;
+  pressure.memory_some_avg10 = 100;
+  scheduler.UpdatePressure(pressure);
+  EXPECT_EQ(LocalResourceScheduler::ADMIT,
+            scheduler.Admit(1, SubProcessReq::HEAVY_WEIGHT, 0));
+  EXPECT_EQ(LocalResourceScheduler::DEFER_BY_MEMORY,
+            scheduler.Admit(1, SubProcessReq::HEAVY_WEIGHT, 1));
+}
+
+TEST(LocalResourceSchedulerTest, DeferByMemoryPressure) {
+  LocalResourceScheduler scheduler(TestOptions());
+  ResourcePressure pressure = IdlePressure();
+  pressure.memory_some_avg10 = 20;
+  scheduler.UpdatePressure(pressure);
+  EXPECT_EQ(LocalResourceScheduler::DEFER_BY_MEMORY,
+            scheduler.Admit(1, SubProcessReq::LIGHT_WEIGHT, 1));
+}
+
+TEST(LocalResourceSchedulerTest, DeferByCpuPressure) {
+  LocalResourceScheduler scheduler(TestOptions());
+  ResourcePressure pressure = IdlePressure();
+  pressure.cpu_some_avg10 = 80;
+  scheduler.UpdatePressure(pressure);
+  EXPECT_EQ(LocalResourceScheduler::DEFER_BY_CPU,
+            scheduler.Admit(1, SubProcessReq::LIGHT_WEIGHT, 1));
+
+  pressure = IdlePressure();
+  pressure.cpu_some_avg10 = -1;
+  pressure.loadavg1 = 8;
+  scheduler.UpdatePressure(pressure);
+  EXPECT_EQ(LocalResourceScheduler::DEFER_BY_CPU,
+            scheduler.Admit(1, SubProcessReq::LIGHT_WEIGHT, 1));
+}
+
+TEST(LocalResourceSchedulerTest, LearnMemoryEstimate) {
+  LocalResourceScheduler scheduler(TestOptions());
+  EXPECT_EQ(1000, scheduler.EstimatedMemKb(SubProcessReq::HEAVY_WEIGHT));
+  EXPECT_EQ(100, scheduler.EstimatedMemKb(SubProcessReq::LIGHT_WEIGHT));
+
+  scheduler.OnTerminated(1, SubProcessReq::HEAVY_WEIGHT, 3000);
+  EXPECT_EQ(2000, scheduler.EstimatedMemKb(SubProcessReq::HEAVY_WEIGHT));
+  scheduler.OnTerminated(1, SubProcessReq::HEAVY_WEIGHT, 3000);
+  EXPECT_EQ(2500, scheduler.EstimatedMemKb(SubProcessReq::HEAVY_WEIGHT));
+  // Unknown memory usage is ignored.
+  scheduler.OnTerminated(1, SubProcessReq::HEAVY_WEIGHT, -1);
+  EXPECT_EQ(2500, scheduler.EstimatedMemKb(SubProcessReq::HEAVY_WEIGHT));
+  EXPECT_EQ(100, scheduler.EstimatedMemKb(SubProcessReq::LIGHT_WEIGHT));
+
+  ResourcePressure pressure = IdlePressure();
+  pressure.available_mem_kb = 2500;
+  scheduler.UpdatePressure(pressure);
+  EXPECT_EQ(LocalResourceScheduler::DEFER_BY_MEMORY,
+            scheduler.Admit(1, SubProcessReq::HEAVY_WEIGHT, 1));
+}
+
+}  // namespace devtools_goma
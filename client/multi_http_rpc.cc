@@ -5,12 +5,14 @@
 
 #include "multi_http_rpc.h"
 
+#include <algorithm>
 #include <iostream>
 #include <sstream>
 #include <string>
 #include <utility>
 #include <vector>
 
+#include "absl/memory/memory.h"
 #include "autolock_timer.h"
 #include "callback.h"
 #include "compiler_specific.h"
@@ -27,7 +29,9 @@ namespace devtools_goma {
 
 MultiHttpRPC::Options::Options()
     : max_req_in_call(0),
-      req_size_threshold_in_call(0) {
+      req_size_threshold_in_call(0),
+      adaptive(false),
+      min_check_interval(absl::Milliseconds(5)) {
 }
 
 class MultiHttpRPC::MultiJob {
@@ -95,6 +99,7 @@ class MultiHttpRPC::MultiJob {
       : wm_(wm),
         multi_rpc_(multi_rpc),
         req_size_(0) {
+    pending_timer_.Start();
   }
 
   // Adds single call to this Multi call.
@@ -109,6 +114,8 @@ class MultiHttpRPC::MultiJob {
   }
   size_t num_call() const { return jobs_.size(); }
   size_t req_size() const { return req_size_; }
+  // Time since this MultiJob was created for the first call.
+  absl::Duration pending_time() const { return pending_timer_.GetDuration(); }
 
   // Calls requests added by AddCall.
   // This MultiJob will be deleted once responses are handled.
@@ -116,6 +123,7 @@ class MultiHttpRPC::MultiJob {
     DCHECK_GT(jobs_.size(), 0U);
     VLOG(1) << "multi rpc " << multi_rpc_->multi_path_
             << " Call num_call=" << num_call();
+    call_timer_.Start();
     if (num_call() == 1) {
       jobs_[0]->StartCall(nullptr);
       // Uses other HttpRPC::Status for underlying http rpc call.
@@ -229,7 +237,8 @@ class MultiHttpRPC::MultiJob {
       job->Done();  // job will be deleted.
       jobs_[i] = nullptr;
     }
-    multi_rpc_->JobDone();
+    multi_rpc_->JobDone(num_call(), req_size_, call_timer_.GetDuration(),
+                        http_rpc_stat_.err == OK);
     delete this;
   }
 
@@ -248,7 +257,8 @@ class MultiHttpRPC::MultiJob {
     *jobs_[0]->http_rpc_stat() = status;
     jobs_[0]->Done();  // job will be deleted.
     jobs_[0] = nullptr;
-    multi_rpc_->JobDone();
+    multi_rpc_->JobDone(num_call(), req_size_, call_timer_.GetDuration(),
+                        http_rpc_stat_.err == OK);
     delete this;
   }
 
@@ -260,6 +270,8 @@ class MultiHttpRPC::MultiJob {
   HttpRPC::Status http_rpc_stat_;
   std::vector<Job*> jobs_;
   size_t req_size_;
+  SimpleTimer pending_timer_;
+  SimpleTimer call_timer_;
 
   DISALLOW_COPY_AND_ASSIGN(MultiJob);
 };
@@ -279,9 +291,22 @@ MultiHttpRPC::MultiHttpRPC(HttpRPC* http_rpc,
       available_(true),
       num_call_by_req_num_(0),
       num_call_by_req_size_(0),
-      num_call_by_latency_(0) {
+      num_call_by_latency_(0),
+      num_call_by_idle_(0) {
   CHECK_GT(options_.max_req_in_call, 0U);
   num_call_by_multi_.resize(options_.max_req_in_call + 1);
+  if (options_.adaptive) {
+    AdaptiveBatchPolicy::Options policy_options;
+    policy_options.max_req_in_call = options_.max_req_in_call;
+    policy_options.max_req_size_threshold = options_.req_size_threshold_in_call;
+    policy_options.min_req_size_threshold =
+        std::min(policy_options.min_req_size_threshold,
+                 options_.req_size_threshold_in_call);
+    policy_options.max_flush_interval = options_.check_interval;
+    policy_options.min_flush_interval =
+        std::min(options_.min_check_interval, options_.check_interval);
+    batch_policy_ = absl::make_unique<AdaptiveBatchPolicy>(policy_options);
+  }
 }
 
 MultiHttpRPC::~MultiHttpRPC() {
@@ -311,7 +336,10 @@ void MultiHttpRPC::Call(
     if (!http_rpc_->client()->shutting_down() &&
         periodic_callback_id_ == kInvalidPeriodicClosureId) {
       periodic_callback_id_ = wm_->RegisterPeriodicClosure(
-          FROM_HERE, options_.check_interval,
+          FROM_HERE,
+          options_.adaptive ? std::min(options_.min_check_interval,
+                                       options_.check_interval)
+                            : options_.check_interval,
           NewPermanentCallback(this, &MultiHttpRPC::CheckPending));
     }
 
@@ -322,13 +350,16 @@ void MultiHttpRPC::Call(
     }
     pending_multi_job->AddCall(http_rpc_stat, req, resp, callback);
     bool call_now = http_rpc_->client()->shutting_down();
-    if (pending_multi_job->num_call() == options_.max_req_in_call) {
+    if (pending_multi_job->num_call() >= MaxReqInCallUnlocked()) {
       ++num_call_by_req_num_;
       call_now = true;
-    } else if (pending_multi_job->req_size() >=
-               options_.req_size_threshold_in_call) {
+    } else if (pending_multi_job->req_size() >= ReqSizeThresholdUnlocked()) {
       ++num_call_by_req_size_;
       call_now = true;
+    } else if (batch_policy_ != nullptr && num_multi_job_ == 0) {
+      // No call on-the-fly.  Don't wait for others.
+      ++num_call_by_idle_;
+      call_now = true;
     }
     if (call_now) {
       multi_job = pending_multi_job;
@@ -392,8 +423,14 @@ void MultiHttpRPC::CheckPending() {
       MultiJob* pending_multi_job = entry.second;
       if (pending_multi_job != nullptr &&
           pending_multi_job->num_call() > 0) {
+        if (batch_policy_ != nullptr && num_multi_job_ > 0 &&
+            pending_multi_job->pending_time() <
+                batch_policy_->flush_interval()) {
+          continue;
+        }
         multi_jobs.push_back(pending_multi_job);
         entry.second = nullptr;
+        ++num_multi_job_;
         DCHECK_LE(pending_multi_job->num_call(), options_.max_req_in_call);
         ++num_call_by_latency_;
         ++num_call_by_multi_[pending_multi_job->num_call()];
@@ -435,9 +472,56 @@ void MultiHttpRPC::Disable() {
   available_ = false;
 }
 
-void MultiHttpRPC::JobDone() {
+void MultiHttpRPC::JobDone(size_t num_call,
+                           size_t req_size,
+                           absl::Duration rtt,
+                           bool ok) {
   AUTOLOCK(lock, &mu_);
   --num_multi_job_;
+  if (batch_policy_ != nullptr) {
+    batch_policy_->OnCallDone(num_call, req_size, rtt, ok);
+  }
+  cond_.Signal();
+}
+
+size_t MultiHttpRPC::MaxReqInCallUnlocked() const {
+  if (batch_policy_ != nullptr) {
+    return batch_policy_->max_req_in_call();
+  }
+  return options_.max_req_in_call;
+}
+
+size_t MultiHttpRPC::ReqSizeThresholdUnlocked() const {
+  if (batch_policy_ != nullptr) {
+    return batch_policy_->req_size_threshold();
+  }
+  return options_.req_size_threshold_in_call;
+}
+
+std::string MultiHttpRPC::BatchPolicyDebugString() const {
+  AUTOLOCK(lock, &mu_);
+  if (batch_policy_ == nullptr) {
+    return "";
+  }
+  return batch_policy_->DebugString();
+}
+
+int64_t MultiHttpRPC::num_requests() const {
+  AUTOLOCK(lock, &mu_);
+  int64_t num_requests = 0;
+  for (size_t i = 1; i < num_call_by_multi_.size(); ++i) {
+    num_requests += i * num_call_by_multi_[i];
+  }
+  return num_requests;
+}
+
+int64_t MultiHttpRPC::num_http_calls() const {
+  AUTOLOCK(lock, &mu_);
+  int64_t num_http_calls = 0;
+  for (size_t i = 1; i < num_call_by_multi_.size(); ++i) {
+    num_http_calls += num_call_by_multi_[i];
+  }
+  return num_http_calls;
 }
 
 std::string MultiHttpRPC::DebugString() const {
@@ -453,6 +537,10 @@ std::string MultiHttpRPC::DebugString() const {
        << " : call=" << num_call_by_req_size_ << std::endl
        << " check interval=" << options_.check_interval
        << " : call=" << num_call_by_latency_ << std::endl;
+    if (batch_policy_ != nullptr) {
+      ss << " no call on-the-fly : call=" << num_call_by_idle_ << std::endl
+         << "adaptive: " << batch_policy_->DebugString() << std::endl;
+    }
   } else {
     ss << "multi_call disabled" << std::endl;
   }
@@ -518,4 +606,48 @@ void MultiFileStore::Done(MultiHttpRPC::MultiJob* multi_job,
   }
 }
 
+MultiFileLookup::MultiFileLookup(HttpRPC* http_rpc,
+                                 const std::string& path,
+                                 const MultiHttpRPC::Options& options,
+                                 WorkerThreadManager* wm)
+    : MultiHttpRPC(http_rpc, path, path, options, wm) {}
+
+MultiFileLookup::~MultiFileLookup() {
+}
+
+void MultiFileLookup::LookupFile(
+    HttpRPC::Status* http_rpc_stat,
+    const LookupFileReq* req, LookupFileResp* resp,
+    OneshotClosure* callback) {
+  Call(http_rpc_stat, req, resp, callback);
+}
+
+void MultiFileLookup::Setup(MultiHttpRPC::MultiJob* job) {
+  std::unique_ptr<LookupFileReq> req(new LookupFileReq);
+  for (auto* j : job->jobs()) {
+    const LookupFileReq* one_req = static_cast<const LookupFileReq*>(j->req());
+    DCHECK_EQ(1, one_req->hash_key_size());
+    req->add_hash_key(one_req->hash_key(0));
+  }
+  const LookupFileReq* one_req =
+      static_cast<const LookupFileReq*>(job->jobs()[0]->req());
+  *req->mutable_requester_info() = one_req->requester_info();
+  job->SetReq(std::move(req));
+  job->SetResp(std::unique_ptr<google::protobuf::Message>(new LookupFileResp));
+}
+
+void MultiFileLookup::Done(MultiHttpRPC::MultiJob* multi_job,
+                           int i, HttpRPC::Status* stat,
+                           google::protobuf::Message* resp) {
+  LookupFileResp* multi_resp =
+      static_cast<LookupFileResp*>(multi_job->mutable_resp());
+  LookupFileResp* one_resp = static_cast<LookupFileResp*>(resp);
+  if (i < multi_resp->blob_size()) {
+    stat->http_return_code = 200;
+    one_resp->add_blob()->Swap(multi_resp->mutable_blob(i));
+  } else {
+    stat->http_return_code = 500;
+  }
+}
+
 }  // namespace devtools_goma
@@ -6,11 +6,13 @@
 #ifndef DEVTOOLS_GOMA_CLIENT_MULTI_HTTP_RPC_H_
 #define DEVTOOLS_GOMA_CLIENT_MULTI_HTTP_RPC_H_
 
+#include <memory>
 #include <string>
 #include <vector>
 
 #include "absl/container/flat_hash_map.h"
 #include "absl/time/time.h"
+#include "adaptive_batch_policy.h"
 #include "basictypes.h"
 #include "http_rpc.h"
 #include "lockhelper.h"
@@ -25,6 +27,8 @@ namespace devtools_goma {
 
 class ExecReq;
 class ExecResp;
+class LookupFileReq;
+class LookupFileResp;
 class OneshotClosure;
 class StoreFileReq;
 class StoreFileResp;
@@ -43,6 +47,12 @@ class MultiHttpRPC {
     size_t max_req_in_call;
     size_t req_size_threshold_in_call;
     absl::Duration check_interval;
+    // If true, the above are upper bounds, and the actual values are
+    // adapted by AdaptiveBatchPolicy from latency of calls.  Pending
+    // requests are checked in each min_check_interval, and also sent when
+    // no call is on-the-fly (like Nagle's algorithm).
+    bool adaptive;
+    absl::Duration min_check_interval;
   };
 
   virtual ~MultiHttpRPC();
@@ -57,7 +67,14 @@ class MultiHttpRPC {
   const Options& options() { return options_; }
   bool available();
 
+  // Number of requests, and number of http calls issued for them.
+  int64_t num_requests() const;
+  int64_t num_http_calls() const;
+
   std::string DebugString() const;
+  // Returns the current decisions of AdaptiveBatchPolicy, or "" if
+  // options.adaptive is false.
+  std::string BatchPolicyDebugString() const;
 
  protected:
   class MultiJob;
@@ -82,7 +99,13 @@ class MultiHttpRPC {
   void UnregisterCheckPending(PeriodicClosureId id);
   void Disable();
 
-  void JobDone();
+  // Called when a call of |num_call| requests of |req_size| bytes is done
+  // in |rtt|.
+  void JobDone(size_t num_call, size_t req_size, absl::Duration rtt, bool ok);
+
+  // Current batching thresholds.
+  size_t MaxReqInCallUnlocked() const ABSL_EXCLUSIVE_LOCKS_REQUIRED(mu_);
+  size_t ReqSizeThresholdUnlocked() const ABSL_EXCLUSIVE_LOCKS_REQUIRED(mu_);
 
   WorkerThreadManager* wm_;
   HttpRPC* http_rpc_;
@@ -103,6 +126,10 @@ class MultiHttpRPC {
   int num_call_by_req_num_;
   int num_call_by_req_size_;
   int num_call_by_latency_;
+  int num_call_by_idle_;
+
+  // nullptr unless options_.adaptive.
+  std::unique_ptr<AdaptiveBatchPolicy> batch_policy_ ABSL_GUARDED_BY(mu_);
 
  private:
   DISALLOW_COPY_AND_ASSIGN(MultiHttpRPC);
@@ -129,6 +156,29 @@ class MultiFileStore : public MultiHttpRPC {
   DISALLOW_COPY_AND_ASSIGN(MultiFileStore);
 };
 
+// MultiFileLookup batches LookupFileReq, each of which has one hash_key,
+// into one LookupFileReq.
+class MultiFileLookup : public MultiHttpRPC {
+ public:
+  MultiFileLookup(HttpRPC* http_rpc,
+                  const std::string& path,
+                  const MultiHttpRPC::Options& options,
+                  WorkerThreadManager* wm);
+  ~MultiFileLookup() override;
+
+  void LookupFile(HttpRPC::Status* http_rpc_stat,
+                  const LookupFileReq* req, LookupFileResp* resp,
+                  OneshotClosure* callback);
+
+  void Setup(MultiHttpRPC::MultiJob* job) override;
+  void Done(MultiHttpRPC::MultiJob* job,
+            int i, HttpRPC::Status* stat,
+            google::protobuf::Message* resp) override;
+
+ private:
+  DISALLOW_COPY_AND_ASSIGN(MultiFileLookup);
+};
+
 }  // namespace devtools_goma
 
 #endif  // DEVTOOLS_GOMA_CLIENT_MULTI_HTTP_RPC_H_
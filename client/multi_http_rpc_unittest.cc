@@ -0,0 +1,249 @@
+// Copyright 2020 The Goma Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "multi_http_rpc.h"
+
+#include <memory>
+#include <sstream>
+#include <string>
+
+#include "absl/memory/memory.h"
+#include "absl/time/time.h"
+#include "callback.h"
+#include "compiler_proxy_info.h"
+#include "compiler_specific.h"
+#include "glog/logging.h"
+#include "gtest/gtest.h"
+#include "http.h"
+#include "http_rpc.h"
+#include "lockhelper.h"
+#include "mock_socket_factory.h"
+MSVC_PUSH_DISABLE_WARNING_FOR_PROTO()
+#include "lib/goma_data.pb.h"
+MSVC_POP_WARNING()
+#include "worker_thread.h"
+#include "worker_thread_manager.h"
+
+namespace devtools_goma {
+
+class MultiFileLookupTest : public ::testing::Test {
+ protected:
+  struct LookupContext {
+    LookupFileReq req;
+    LookupFileResp resp;
+    HttpRPC::Status status;
+    bool done = false;
+  };
+
+  void SetUp() override {
+    wm_ = absl::make_unique<WorkerThreadManager>();
+    wm_->Start(1);
+    pool_ = wm_->StartPool(1, "test");
+    mock_server_ = absl::make_unique<MockSocketServer>(wm_.get());
+  }
+  void TearDown() override {
+    mock_server_.reset();
+    wm_->Finish();
+    wm_.reset();
+    pool_ = -1;
+  }
+
+  // Looks up |contexts| on a worker thread, as the batched calls must be
+  // issued on worker threads.
+  void RunLookupFiles(MultiFileLookup* multi_file_lookup,
+                      std::vector<LookupContext*> contexts) {
+    wm_->RunClosureInPool(
+        FROM_HERE, pool_,
+        NewCallback(this, &MultiFileLookupTest::DoLookupFiles,
+                    multi_file_lookup, std::move(contexts)),
+        WorkerThread::PRIORITY_LOW);
+  }
+
+  void DoLookupFiles(MultiFileLookup* multi_file_lookup,
+                     std::vector<LookupContext*> contexts) {
+    for (auto* c : contexts) {
+      multi_file_lookup->LookupFile(
+          &c->status, &c->req, &c->resp,
+          NewCallback(this, &MultiFileLookupTest::LookupDone, c));
+    }
+  }
+
+  void LookupDone(LookupContext* c) {
+    AutoLock lock(&mu_);
+    c->done = true;
+    cond_.Signal();
+  }
+
+  void WaitLookupDone(LookupContext* c) {
+    AutoLock lock(&mu_);
+    while (!c->done) {
+      cond_.Wait(&mu_);
+    }
+  }
+
+  static std::string HttpRequest(const google::protobuf::Message& req) {
+    std::string serialized_req;
+    req.SerializeToString(&serialized_req);
+    std::ostringstream ss;
+    ss << "POST /l HTTP/1.1\r\n"
+       << "Host: goma.chromium.org\r\n"
+       << "User-Agent: " << kUserAgentString << "\r\n"
+       << "Content-Type: binary/x-protocol-buffer\r\n"
+       << "Content-Length: " << serialized_req.size() << "\r\n\r\n"
+       << serialized_req;
+    return ss.str();
+  }
+
+  static std::string HttpResponse(const google::protobuf::Message& resp) {
+    std::string serialized_resp;
+    resp.SerializeToString(&serialized_resp);
+    std::ostringstream ss;
+    ss << "HTTP/1.1 200 OK\r\n"
+       << "Content-Type: text/x-protocol-buffer\r\n"
+       << "Content-Length: " << serialized_resp.size() << "\r\n\r\n"
+       << serialized_resp;
+    return ss.str();
+  }
+
+  std::unique_ptr<WorkerThreadManager> wm_;
+  int pool_ = -1;
+  std::unique_ptr<MockSocketServer> mock_server_;
+  Lock mu_;
+  ConditionVariable cond_;
+};
+
+TEST_F(MultiFileLookupTest, BatchLookups) {
+  int socks[2];
+  ASSERT_EQ(0, OpenSocketPairForTest(socks));
+
+  LookupContext lookup1;
+  lookup1.req.add_hash_key("hash1");
+  lookup1.req.mutable_requester_info()->set_compiler_proxy_id("proxy1");
+  LookupContext lookup2;
+  lookup2.req.add_hash_key("hash2");
+  lookup2.req.mutable_requester_info()->set_compiler_proxy_id("proxy2");
+
+  // One request has both hash keys, with the first requester info.
+  LookupFileReq multi_req;
+  multi_req.add_hash_key("hash1");
+  multi_req.add_hash_key("hash2");
+  multi_req.mutable_requester_info()->set_compiler_proxy_id("proxy1");
+  const std::string req_expected = HttpRequest(multi_req);
+  std::string req_buf;
+  req_buf.resize(req_expected.size());
+  mock_server_->ServerRead(socks[0], &req_buf);
+
+  LookupFileResp multi_resp;
+  FileBlob* blob = multi_resp.add_blob();
+  blob->set_blob_type(FileBlob::FILE_META);
+  blob->set_file_size(4 * 1024 * 1024);
+  blob->add_hash_key("chunk1");
+  blob = multi_resp.add_blob();
+  blob->set_blob_type(FileBlob::FILE_UNSPECIFIED);
+  mock_server_->ServerWrite(socks[0], HttpResponse(multi_resp));
+
+  MockSocketFactory::SocketStatus socket_status;
+  std::unique_ptr<MockSocketFactory> socket_factory(
+      new MockSocketFactory(socks[1], &socket_status));
+  socket_factory->set_dest("goma.chromium.org:80");
+  socket_factory->set_host_name("goma.chromium.org");
+  socket_factory->set_port(80);
+  HttpClient::Options options;
+  options.dest_host_name = "goma.chromium.org";
+  options.dest_port = 80;
+  HttpClient http_client(
+      std::move(socket_factory), nullptr, options, wm_.get());
+  HttpRPC::Options rpc_options;
+  rpc_options.content_type_for_protobuf = "binary/x-protocol-buffer";
+  rpc_options.start_compression = false;
+  HttpRPC http_rpc(&http_client, rpc_options);
+
+  MultiHttpRPC::Options multi_options;
+  multi_options.max_req_in_call = 2;
+  multi_options.req_size_threshold_in_call = 1024 * 1024;
+  multi_options.check_interval = absl::Seconds(10);
+  MultiFileLookup multi_file_lookup(&http_rpc, "/l", multi_options, wm_.get());
+
+  RunLookupFiles(&multi_file_lookup, {&lookup1, &lookup2});
+  WaitLookupDone(&lookup1);
+  WaitLookupDone(&lookup2);
+
+  EXPECT_EQ(req_expected, req_buf);
+  EXPECT_EQ(0, lookup1.status.err);
+  EXPECT_EQ(200, lookup1.status.http_return_code);
+  ASSERT_EQ(1, lookup1.resp.blob_size());
+  EXPECT_EQ(FileBlob::FILE_META, lookup1.resp.blob(0).blob_type());
+  EXPECT_EQ(0, lookup2.status.err);
+  ASSERT_EQ(1, lookup2.resp.blob_size());
+  EXPECT_EQ(FileBlob::FILE_UNSPECIFIED, lookup2.resp.blob(0).blob_type());
+  EXPECT_EQ(2, multi_file_lookup.num_requests());
+  EXPECT_EQ(1, multi_file_lookup.num_http_calls());
+
+  http_client.WaitNoActive();
+  http_client.Shutdown();
+  multi_file_lookup.Wait();
+}
+
+TEST_F(MultiFileLookupTest, MissingResponse) {
+  int socks[2];
+  ASSERT_EQ(0, OpenSocketPairForTest(socks));
+
+  LookupContext lookup1;
+  lookup1.req.add_hash_key("hash1");
+  LookupContext lookup2;
+  lookup2.req.add_hash_key("hash2");
+
+  LookupFileReq multi_req;
+  multi_req.add_hash_key("hash1");
+  multi_req.add_hash_key("hash2");
+  multi_req.mutable_requester_info();
+  const std::string req_expected = HttpRequest(multi_req);
+  std::string req_buf;
+  req_buf.resize(req_expected.size());
+  mock_server_->ServerRead(socks[0], &req_buf);
+
+  // The response has a blob only for the first hash key.
+  LookupFileResp multi_resp;
+  multi_resp.add_blob()->set_blob_type(FileBlob::FILE_META);
+  mock_server_->ServerWrite(socks[0], HttpResponse(multi_resp));
+
+  MockSocketFactory::SocketStatus socket_status;
+  std::unique_ptr<MockSocketFactory> socket_factory(
+      new MockSocketFactory(socks[1], &socket_status));
+  socket_factory->set_dest("goma.chromium.org:80");
+  socket_factory->set_host_name("goma.chromium.org");
+  socket_factory->set_port(80);
+  HttpClient::Options options;
+  options.dest_host_name = "goma.chromium.org";
+  options.dest_port = 80;
+  HttpClient http_client(
+      std::move(socket_factory), nullptr, options, wm_.get());
+  HttpRPC::Options rpc_options;
+  rpc_options.content_type_for_protobuf = "binary/x-protocol-buffer";
+  rpc_options.start_compression = false;
+  HttpRPC http_rpc(&http_client, rpc_options);
+
+  MultiHttpRPC::Options multi_options;
+  multi_options.max_req_in_call = 2;
+  multi_options.req_size_threshold_in_call = 1024 * 1024;
+  multi_options.check_interval = absl::Seconds(10);
+  MultiFileLookup multi_file_lookup(&http_rpc, "/l", multi_options, wm_.get());
+
+  RunLookupFiles(&multi_file_lookup, {&lookup1, &lookup2});
+  WaitLookupDone(&lookup1);
+  WaitLookupDone(&lookup2);
+
+  EXPECT_EQ(req_expected, req_buf);
+  EXPECT_EQ(0, lookup1.status.err);
+  EXPECT_EQ(1, lookup1.resp.blob_size());
+  EXPECT_NE(0, lookup2.status.err);
+  EXPECT_EQ(500, lookup2.status.http_return_code);
+  EXPECT_EQ(0, lookup2.resp.blob_size());
+
+  http_client.WaitNoActive();
+  http_client.Shutdown();
+  multi_file_lookup.Wait();
+}
+
+}  // namespace devtools_goma
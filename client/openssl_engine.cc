@@ -44,6 +44,7 @@ MSVC_POP_WARNING()
 #include "path.h"
 #include "platform_thread.h"
 #include "scoped_fd.h"
+#include "simple_timer.h"
 #include "socket_pool.h"
 
 #ifndef OPENSSL_IS_BORINGSSL
@@ -60,6 +61,9 @@ constexpr absl::Duration kErrorTimeout = absl::Seconds(60);
 // Wait for this period if no more sockets are in the pool.
 constexpr absl::Duration kWaitForThingsGetsBetter = absl::Seconds(1);
 
+// Give up TLS handshake for prewarming a socket after this period.
+constexpr absl::Duration kPrewarmHandshakeTimeout = absl::Seconds(5);
+
 absl::once_flag g_openssl_init_once;
 
 // TODO: use bssl::UniquePtr instead.
@@ -1141,6 +1145,9 @@ OpenSSLEngine::OpenSSLEngine()
       want_write_(false),
       recycled_(false),
       need_self_verify_(false),
+      ctx_(nullptr),
+      stats_(nullptr),
+      connect_time_(absl::ZeroDuration()),
       state_(BEFORE_INIT) {}
 
 OpenSSLEngine::~OpenSSLEngine() {
@@ -1154,7 +1161,8 @@ OpenSSLEngine::~OpenSSLEngine() {
   }
 }
 
-void OpenSSLEngine::Init(OpenSSLContext* ctx) {
+void OpenSSLEngine::Init(OpenSSLContext* ctx, const std::string& alpn_protos,
+                         OpenSSLHandshakeStats* stats) {
   DCHECK(ctx);
   DCHECK(!ssl_);
   DCHECK_EQ(state_, BEFORE_INIT);
@@ -1180,7 +1188,18 @@ void OpenSSLEngine::Init(OpenSSLContext* ctx) {
   SSL_set0_rbio(ssl_, internal_bio);
   SSL_set0_wbio(ssl_, internal_bio);
 
+  if (!alpn_protos.empty()) {
+    // Note that SSL_set_alpn_protos returns 0 on success.
+    CHECK_EQ(SSL_set_alpn_protos(
+                 ssl_, reinterpret_cast<const uint8_t*>(alpn_protos.data()),
+                 alpn_protos.size()),
+             0)
+        << "SSL_set_alpn_protos failed.";
+  }
+
   ctx_ = ctx;
+  stats_ = stats;
+  handshake_start_time_ = absl::Now();
   Connect();  // Do not check anything since nothing has started here.
   state_ = IN_CONNECT;
 }
@@ -1279,11 +1298,24 @@ int OpenSSLEngine::UpdateStatus(int return_value) {
 }
 
 int OpenSSLEngine::Connect() {
+  const absl::Time connect_start_time = absl::Now();
   int ret = SSL_connect(ssl_);
+  connect_time_ += absl::Now() - connect_start_time;
   if (ret > 0) {
     VLOG(3) << "ctx:" << ctx_
-            << ": session reused=" << SSL_session_reused(ssl_);
+            << ": session reused=" << SSL_session_reused(ssl_)
+            << " connect_time=" << connect_time_;
     state_ = READY;
+    if (stats_ != nullptr) {
+      if (SSL_session_reused(ssl_)) {
+        stats_->num_resumed.Add(1);
+      } else {
+        stats_->num_full.Add(1);
+      }
+      stats_->connect_usec.Add(absl::ToInt64Microseconds(connect_time_));
+      stats_->latency_usec.Add(
+          absl::ToInt64Microseconds(absl::Now() - handshake_start_time_));
+    }
     if (need_self_verify_) {
       LOG(INFO) << GetHumanReadableSSLInfo(ssl_);
 
@@ -1339,6 +1371,16 @@ std::string OpenSSLEngine::GetErrorString() const {
   return error_message;
 }
 
+std::string OpenSSLEngine::GetAlpnSelected() const {
+  const uint8_t* protocol = nullptr;
+  unsigned int len = 0;
+  SSL_get0_alpn_selected(ssl_, &protocol, &len);
+  if (protocol == nullptr) {
+    return "";
+  }
+  return std::string(reinterpret_cast<const char*>(protocol), len);
+}
+
 std::string OpenSSLEngine::GetLastErrorMessage() const {
   std::ostringstream oss;
   oss << GetErrorString();
@@ -1368,7 +1410,8 @@ OpenSSLEngineCache::~OpenSSLEngineCache() {
   CHECK(!ctx_.get() || ctx_->ref_cnt() == 0UL);
 }
 
-std::unique_ptr<OpenSSLEngine> OpenSSLEngineCache::GetOpenSSLEngineUnlocked() {
+std::unique_ptr<OpenSSLEngine> OpenSSLEngineCache::GetOpenSSLEngineUnlocked(
+    const std::string& alpn_protos) {
   if (ctx_.get() == nullptr) {
     CHECK(OpenSSLCertificateStore::IsReady())
         << "OpenSSLCertificateStore does not have any certificates.";
@@ -1379,7 +1422,7 @@ std::unique_ptr<OpenSSLEngine> OpenSSLEngineCache::GetOpenSSLEngineUnlocked() {
       ctx_->SetProxy(proxy_host_, proxy_port_);
   }
   std::unique_ptr<OpenSSLEngine> engine(new OpenSSLEngine());
-  engine->Init(ctx_.get());
+  engine->Init(ctx_.get(), alpn_protos, &stats_);
   return engine;
 }
 
@@ -1399,7 +1442,7 @@ TLSEngine* OpenSSLEngineCache::NewTLSEngine(int sock) {
     found->second->SetRecycled();
     return found->second.get();
   }
-  std::unique_ptr<OpenSSLEngine> engine = GetOpenSSLEngineUnlocked();
+  std::unique_ptr<OpenSSLEngine> engine = GetOpenSSLEngineUnlocked("");
   OpenSSLEngine* engine_ptr = engine.get();
   CHECK(ssl_map_.emplace(sock, std::move(engine)).second)
       << "ssl_map_ should not have the same key:" << sock;
@@ -1407,6 +1450,25 @@ TLSEngine* OpenSSLEngineCache::NewTLSEngine(int sock) {
   return engine_ptr;
 }
 
+TLSEngine* OpenSSLEngineCache::NewTLSEngineWithAlpn(
+    int sock, const std::vector<std::string>& protocols) {
+  std::string alpn_protos;
+  for (const auto& protocol : protocols) {
+    CHECK(!protocol.empty() && protocol.size() < 256) << protocol;
+    alpn_protos.push_back(static_cast<char>(protocol.size()));
+    alpn_protos.append(protocol);
+  }
+  AUTOLOCK(lock, &mu_);
+  if (ssl_map_.contains(sock)) {
+    return nullptr;
+  }
+  std::unique_ptr<OpenSSLEngine> engine = GetOpenSSLEngineUnlocked(alpn_protos);
+  OpenSSLEngine* engine_ptr = engine.get();
+  ssl_map_.emplace(sock, std::move(engine));
+  VLOG(1) << "SSL engine allocated with ALPN. sock=" << sock;
+  return engine_ptr;
+}
+
 void OpenSSLEngineCache::WillCloseSocket(int sock) {
   AUTOLOCK(lock, &mu_);
   VLOG(1) << "SSL engine release. sock=" << sock;
@@ -1428,6 +1490,90 @@ void OpenSSLEngineCache::WillCloseSocket(int sock) {
   }
 }
 
+bool OpenSSLEngineCache::PrewarmSocket(int sock) {
+  {
+    AUTOLOCK(lock, &mu_);
+    if (!proxy_host_.empty()) {
+      return true;
+    }
+  }
+  // |sock| is not in the socket pool yet, so nobody else uses the engine.
+  TLSEngine* engine = NewTLSEngine(sock);
+  ScopedSocket socket(sock);
+  SimpleTimer timer;
+  bool ok = true;
+  for (;;) {
+    const absl::Duration timeout =
+        kPrewarmHandshakeTimeout - timer.GetDuration();
+    if (timeout <= absl::ZeroDuration()) {
+      LOG(WARNING) << "prewarm handshake timeout. sock=" << sock;
+      ok = false;
+      break;
+    }
+    // Flush data even after the engine gets ready, since the last
+    // handshake message may be left.
+    std::string data;
+    int r = engine->GetDataToSendTransport(&data);
+    if (r < 0) {
+      LOG(WARNING) << "prewarm handshake failed. sock=" << sock
+                   << " err=" << engine->GetLastErrorMessage();
+      ok = false;
+      break;
+    }
+    if (!data.empty()) {
+      if (socket.WriteString(data, timeout) != OK) {
+        LOG(WARNING) << "prewarm handshake write failed. sock=" << sock;
+        ok = false;
+        break;
+      }
+      continue;
+    }
+    if (engine->IsReady()) {
+      break;
+    }
+    char buf[kNetworkBufSize];
+    size_t size = std::min(sizeof(buf), engine->GetBufSizeFromTransport());
+    ssize_t n = socket.ReadWithTimeout(buf, size, timeout);
+    if (n <= 0) {
+      LOG(WARNING) << "prewarm handshake read failed. sock=" << sock
+                   << " n=" << n;
+      ok = false;
+      break;
+    }
+    if (engine->SetDataFromTransport(absl::string_view(buf, n)) < 0) {
+      LOG(WARNING) << "prewarm handshake failed. sock=" << sock
+                   << " err=" << engine->GetLastErrorMessage();
+      ok = false;
+      break;
+    }
+  }
+  // The caller keeps the ownership of |sock|.
+  socket.release();
+  if (ok) {
+    stats_.num_prewarmed.Add(1);
+    VLOG(1) << "prewarm handshake done. sock=" << sock
+            << " time=" << timer.GetDuration();
+  }
+  return ok;
+}
+
+std::string OpenSSLEngineCache::GetHandshakeStats() const {
+  std::ostringstream ss;
+  const int64_t num_full = stats_.num_full.value();
+  const int64_t num_resumed = stats_.num_resumed.value();
+  ss << "full=" << num_full << " resumed=" << num_resumed
+     << " prewarmed=" << stats_.num_prewarmed.value();
+  if (num_full + num_resumed > 0) {
+    ss << " avg_connect_time="
+       << absl::Microseconds(stats_.connect_usec.value()) /
+              (num_full + num_resumed)
+       << " avg_latency="
+       << absl::Microseconds(stats_.latency_usec.value()) /
+              (num_full + num_resumed);
+  }
+  return ss.str();
+}
+
 void OpenSSLEngineCache::InvalidateContext() {
   AUTOLOCK(lock, &mu_);
   // OpenSSLContext instance should be held until ref_cnt become zero
@@ -19,6 +19,7 @@
 #include "absl/container/flat_hash_map.h"
 #include "absl/time/time.h"
 #include "absl/types/optional.h"
+#include "atomic_stats_counter.h"
 #include "autolock_timer.h"
 #include "tls_engine.h"
 
@@ -124,6 +125,19 @@ class OpenSSLContext {
   DISALLOW_COPY_AND_ASSIGN(OpenSSLContext);
 };
 
+// Counters of TLS handshakes done by OpenSSLEngine.
+struct OpenSSLHandshakeStats {
+  StatsCounter num_full;
+  StatsCounter num_resumed;
+  StatsCounter num_prewarmed;
+  // Time spent in SSL_connect.  Since OpenSSLEngine does not do network I/O
+  // in SSL_connect, this is the CPU time used for handshakes.
+  StatsCounter connect_usec;
+  // Time from the start of a handshake until it gets ready, including
+  // network round trips.
+  StatsCounter latency_usec;
+};
+
 // OpenSSLEngine is not synchronized.
 class OpenSSLEngine : public TLSEngine {
  public:
@@ -142,12 +156,18 @@ class OpenSSLEngine : public TLSEngine {
   // Shows this engine has already used before.
   bool IsRecycled() const override { return recycled_; }
 
+  std::string GetAlpnSelected() const override;
+
  protected:
   friend class OpenSSLEngineCache;
   OpenSSLEngine();
   ~OpenSSLEngine() override;
   // Will not take ownership of ctx.
-  void Init(OpenSSLContext* ctx);
+  // |alpn_protos| is a list of protocols in ALPN wire format.  ALPN is not
+  // used if it is empty.
+  // Results of the handshake are recorded in |stats| if it is not nullptr.
+  void Init(OpenSSLContext* ctx, const std::string& alpn_protos,
+            OpenSSLHandshakeStats* stats);
   void SetRecycled() { recycled_ = true; }
 
  private:
@@ -174,6 +194,9 @@ class OpenSSLEngine : public TLSEngine {
   bool recycled_;
   bool need_self_verify_;
   OpenSSLContext* ctx_;  // OpenSSLEngineCache has ownership.
+  OpenSSLHandshakeStats* stats_;  // OpenSSLEngineCache has ownership.
+  absl::Time handshake_start_time_;
+  absl::Duration connect_time_;
 
   enum SSL_ENGINE_STATE { BEFORE_INIT, IN_CONNECT, READY } state_;
 
@@ -185,7 +208,16 @@ class OpenSSLEngineCache : public TLSEngineFactory {
   OpenSSLEngineCache();
   ~OpenSSLEngineCache() override;
   TLSEngine* NewTLSEngine(int sock) override ABSL_LOCKS_EXCLUDED(mu_);
+  TLSEngine* NewTLSEngineWithAlpn(int sock,
+                                  const std::vector<std::string>& protocols)
+      override ABSL_LOCKS_EXCLUDED(mu_);
   void WillCloseSocket(int sock) override ABSL_LOCKS_EXCLUDED(mu_);
+  // Does TLS handshake on |sock| in blocking mode, so that the engine
+  // is ready when NewTLSEngine is called with |sock|.
+  // The handshake is skipped if a proxy is used, since TLSDescriptor needs
+  // to send CONNECT before the handshake.
+  bool PrewarmSocket(int sock) override ABSL_LOCKS_EXCLUDED(mu_);
+  std::string GetHandshakeStats() const override;
   void AddCertificateFromFile(const std::string& ssl_cert_filename);
   void AddCertificateFromString(const std::string& ssl_cert);
   std::string GetCertsInfo() override ABSL_LOCKS_EXCLUDED(mu_) {
@@ -209,9 +241,23 @@ class OpenSSLEngineCache : public TLSEngineFactory {
     crl_max_valid_duration_ = std::move(duration);
   }
 
+  int64_t num_full_handshakes() const { return stats_.num_full.value(); }
+  int64_t num_resumed_handshakes() const {
+    return stats_.num_resumed.value();
+  }
+  int64_t num_prewarmed_handshakes() const {
+    return stats_.num_prewarmed.value();
+  }
+  absl::Duration handshake_connect_time() const {
+    return absl::Microseconds(stats_.connect_usec.value());
+  }
+  absl::Duration handshake_latency() const {
+    return absl::Microseconds(stats_.latency_usec.value());
+  }
+
  private:
-  std::unique_ptr<OpenSSLEngine> GetOpenSSLEngineUnlocked()
-      ABSL_EXCLUSIVE_LOCKS_REQUIRED(mu_);
+  std::unique_ptr<OpenSSLEngine> GetOpenSSLEngineUnlocked(
+      const std::string& alpn_protos) ABSL_EXCLUSIVE_LOCKS_REQUIRED(mu_);
   void InvalidateContext() ABSL_LOCKS_EXCLUDED(mu_);
 
   mutable Lock mu_;
@@ -225,6 +271,7 @@ class OpenSSLEngineCache : public TLSEngineFactory {
   std::string proxy_host_ ABSL_GUARDED_BY(mu_);
   int proxy_port_ ABSL_GUARDED_BY(mu_);
   absl::optional<absl::Duration> crl_max_valid_duration_ ABSL_GUARDED_BY(mu_);
+  OpenSSLHandshakeStats stats_;
 
   DISALLOW_COPY_AND_ASSIGN(OpenSSLEngineCache);
 };
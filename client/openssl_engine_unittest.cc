@@ -11,8 +11,15 @@
 #include <openssl/bio.h>
 #include <memory>
 #include <string>
+#include <thread>
+
+#ifndef _WIN32
+#include <sys/socket.h>
+#include <unistd.h>
+#endif
 
 #include "absl/strings/string_view.h"
+#include "absl/time/time.h"
 #include "glog/logging.h"
 #include "gtest/gtest.h"
 #include "unittest_util.h"
@@ -233,10 +240,15 @@ class OpenSSLEngineTest : public :: testing::Test {
   }
 
   void AddCertificateFromFile(const std::string& filename) {
-    static_cast<OpenSSLEngineCache*>(factory_.get())->AddCertificateFromFile(
-        GetTestFilePath(filename));
+    cache()->AddCertificateFromFile(GetTestFilePath(filename));
+  }
+
+  OpenSSLEngineCache* cache() {
+    return static_cast<OpenSSLEngineCache*>(factory_.get());
   }
 
+  TLSEngineFactory* factory() { return factory_.get(); }
+
   void SetHostname(const std::string& hostname) {
     factory_->SetHostname(hostname);
   }
@@ -384,6 +396,64 @@ TEST_F(OpenSSLEngineTest, SuccessfulCommunication) {
   EXPECT_TRUE(Communicate(s_ctx.get()));
 }
 
+TEST_F(OpenSSLEngineTest, SessionResumption) {
+  std::unique_ptr<SSL_CTX, ScopedSSLCtxFree> s_ctx(
+      SetupServerContext(kCert, kKey));
+  EXPECT_TRUE(Communicate(s_ctx.get()));
+  EXPECT_EQ(1, cache()->num_full_handshakes());
+  EXPECT_EQ(0, cache()->num_resumed_handshakes());
+  const absl::Duration full_connect_time = cache()->handshake_connect_time();
+  const absl::Duration full_latency = cache()->handshake_latency();
+  EXPECT_GT(full_connect_time, absl::ZeroDuration());
+
+  // A new connection to the same host should resume the session.
+  TearDownEngine();
+  EXPECT_TRUE(Communicate(s_ctx.get()));
+  EXPECT_EQ(1, cache()->num_full_handshakes());
+  EXPECT_EQ(1, cache()->num_resumed_handshakes());
+  LOG(INFO) << "full handshake:"
+            << " connect_time=" << full_connect_time
+            << " latency=" << full_latency
+            << " resumed handshake:"
+            << " connect_time="
+            << cache()->handshake_connect_time() - full_connect_time
+            << " latency=" << cache()->handshake_latency() - full_latency;
+}
+
+#ifndef _WIN32
+TEST_F(OpenSSLEngineTest, PrewarmSocket) {
+  std::unique_ptr<SSL_CTX, ScopedSSLCtxFree> s_ctx(
+      SetupServerContext(kCert, kKey));
+  int fds[2];
+  ASSERT_EQ(0, socketpair(AF_UNIX, SOCK_STREAM, 0, fds));
+
+  bool accepted = false;
+  std::thread server([&s_ctx, &fds, &accepted]() {
+    SSL* ssl = SSL_new(s_ctx.get());
+    CHECK(ssl);
+    CHECK(SSL_set_fd(ssl, fds[1]));
+    accepted = SSL_accept(ssl) > 0;
+    SSL_free(ssl);
+  });
+  EXPECT_TRUE(cache()->PrewarmSocket(fds[0]));
+  server.join();
+  EXPECT_TRUE(accepted);
+  EXPECT_EQ(1, cache()->num_prewarmed_handshakes());
+
+  // The engine made by PrewarmSocket should be used for the socket.
+  TLSEngine* engine = factory()->NewTLSEngine(fds[0]);
+  EXPECT_TRUE(engine->IsRecycled());
+  EXPECT_TRUE(engine->IsReady());
+  LOG(INFO) << "prewarm handshake: "
+            << " connect_time=" << cache()->handshake_connect_time()
+            << " latency=" << cache()->handshake_latency();
+
+  factory()->WillCloseSocket(fds[0]);
+  close(fds[0]);
+  close(fds[1]);
+}
+#endif
+
 TEST_F(OpenSSLEngineTest, VerifyByIPAddr) {
   // Get SSL_CTX having the certificate set in the client.
   std::unique_ptr<SSL_CTX, ScopedSSLCtxFree> s_ctx(
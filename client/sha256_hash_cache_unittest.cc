@@ -9,6 +9,7 @@
 #include "absl/time/clock.h"
 #include "absl/time/time.h"
 #include "autolock_timer.h"
+#include "goma_hash.h"
 #include "unittest_util.h"
 
 namespace devtools_goma {
@@ -55,4 +56,21 @@ TEST_F(SHA256HashCacheTest, BasicTest) {
   EXPECT_EQ(1, cache_.hit());
 }
 
+TEST_F(SHA256HashCacheTest, LargeFile) {
+  TmpdirUtil tmpdir("sha256_hash_cache");
+
+  // Larger than the read buffer of GomaSha256FromFile.
+  std::string content(3 * 1024 * 1024 + 1, '\0');
+  for (size_t i = 0; i < content.size(); ++i) {
+    content[i] = static_cast<char>(i % 251);
+  }
+  tmpdir.CreateTmpFile("large", content);
+
+  std::string hash;
+  EXPECT_TRUE(cache_.GetHashFromCacheOrFile(tmpdir.FullPath("large"), &hash));
+  std::string expected;
+  ComputeDataHashKey(content, &expected);
+  EXPECT_EQ(expected, hash);
+}
+
 }  // namespace devtools_goma
@@ -152,6 +152,16 @@ ssize_t SocketDescriptor::Write(const void* ptr, size_t len) {
   return r;
 }
 
+ssize_t SocketDescriptor::Writev(absl::Span<const absl::string_view> bufs) {
+  CHECK(!bufs.empty()) << "fd=" << fd_.get();
+  need_retry_ = false;
+  last_time_ = worker_->NowCached();
+  ssize_t r = fd_.Writev(bufs);
+  if (r < 0)
+    UpdateLastErrorStatus();
+  return r;
+}
+
 bool SocketDescriptor::NeedRetry() const {
   return need_retry_;
 }
@@ -43,6 +43,7 @@ class SocketDescriptor : public Descriptor {
   virtual void ClearTimeout();
   ssize_t Read(void* ptr, size_t len) override;
   ssize_t Write(const void* ptr, size_t len) override;
+  ssize_t Writev(absl::Span<const absl::string_view> bufs) override;
 
   bool NeedRetry() const override;
   virtual int ShutdownForSend();
@@ -23,6 +23,10 @@ class SocketFactoryObserver {
  public:
   virtual ~SocketFactoryObserver() {}
   virtual void WillCloseSocket(int sock) = 0;
+  // Called when |sock| is opened in advance by SocketFactory::Prewarm.
+  // Returns false if |sock| should be closed instead of being pooled.
+  // It may block.
+  virtual bool PrewarmSocket(int sock) { return true; }
 };
 
 // TODO: template for ScopedSocket and ScopedNamedPipe.
@@ -69,6 +73,12 @@ class SocketFactory {
   // Closes used socket. It will notify observer if the observer is set.
   virtual void CloseSocket(ScopedSocket&& sock, bool err) = 0;
 
+  // Opens sockets in advance so that |num_sockets| sockets are available
+  // for NewSocket() without connecting, e.g. at the beginning of a burst of
+  // requests.  It may block while connecting.
+  // The observer may set up each opened socket by PrewarmSocket.
+  virtual void Prewarm(int num_sockets) {}
+
   // Destination name in form of "host:port".
   virtual std::string DestName() const = 0;
   virtual std::string host_name() const { return ""; }
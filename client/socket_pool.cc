@@ -16,6 +16,7 @@
 #include <unistd.h>
 #endif
 
+#include <algorithm>
 #include <map>
 #include <sstream>
 #include <unordered_map>
@@ -50,6 +51,15 @@ constexpr absl::Duration kSocketPoolSetupTimeout = absl::Seconds(10);
 // Wait connection success for this period.
 constexpr absl::Duration kConnTimeout = absl::Seconds(3);
 
+// Bounds of the delay to start connecting to the next address while
+// connecting to an address.  RFC 8305 recommends 250ms by default, and
+// 10ms at least.
+constexpr absl::Duration kMinConnectionAttemptDelay = absl::Milliseconds(10);
+constexpr absl::Duration kMaxConnectionAttemptDelay = absl::Milliseconds(250);
+
+// Weight of a new sample in the smoothed RTT, as TCP's SRTT.
+constexpr double kRttGain = 1.0 / 8;
+
 SocketPool::SocketPool(const std::string& host_name, int port)
     : host_name_(host_name), port_(port), current_addr_(nullptr) {
   SimpleTimer timer;
@@ -120,99 +130,91 @@ ScopedSocket SocketPool::NewSocket() {
   if (new_fd >= 0)
     return ScopedSocket(new_fd);
 
-  int addrs_size;
+  ScopedSocket sock = Connect();
+  if (sock.valid()) {
+    return sock;
+  }
+
+  // Even if no address is available, it should retry again to resolve
+  // again in new network for EHOSTUNREACH etc.
+  // http://b/199172870
+  AUTOLOCK(lock, &mu_);
+  LOG(INFO) << "need to retry with other address for " << host_name_;
+  if (InitializeUnlocked() != OK) {
+    DCHECK(current_addr_ == nullptr);
+    LOG(ERROR) << "no other address available";
+    return ScopedSocket();
+  }
+  DCHECK(!socket_pool_.empty());
+  const auto duration = socket_pool_.front().second.GetDuration();
+  if (duration > kIdleSocketTimeout) {
+    // This is expected to have been deleted from pool in NewSocket, but
+    // some time has been elapsed, so duration might exceed
+    // kIdleSocketTimeout here.
+    // http://b/155220622
+    LOG(WARNING) << "socket id=" << socket_pool_.front().first
+                 << " long duration=" << duration;
+  }
+  new_fd = socket_pool_.front().first;
+  socket_pool_.pop_front();
+  DCHECK_GE(new_fd, 0);
+  return ScopedSocket(new_fd);
+}
+
+ScopedSocket SocketPool::Connect() {
+  std::vector<AddrData> addrs;
   {
     AUTOLOCK(lock, &mu_);
-    addrs_size = static_cast<int>(addrs_.size());
+    addrs = addrs_;
   }
-  new_fd = -1;
-  absl::Time error_time = absl::InfinitePast();
-  // even if addrs_size is 1, it should retry again
-  // to resolve again in new network for EHOSTUNREACH etc.
-  // http://b/199172870
-  for (int retry = 0; retry < std::max(2, addrs_size); ++retry) {
-    AddrData addr;
-    {
-      AUTOLOCK(lock, &mu_);
-      if (new_fd >= 0) {
-        SetErrorTimestampUnlocked(new_fd, error_time);
-      }
-      if (current_addr_ == nullptr ||
-          current_addr_->error_timestamp != absl::InfinitePast()) {
-        LOG(INFO) << "need to retry with other address for " << host_name_;
-        if (InitializeUnlocked() != OK) {
-          DCHECK(current_addr_ == nullptr);
-          LOG(ERROR) << "no other address available";
-          return ScopedSocket();
-        }
-        DCHECK(!socket_pool_.empty());
-        const auto duration = socket_pool_.front().second.GetDuration();
-        if (duration > kIdleSocketTimeout) {
-          // This is expected to have been deleted from pool in NewSocket, but
-          // some time has been elapsed, so duration might exceed
-          // kIdleSocketTimeout here.
-          // http://b/155220622
-          LOG(WARNING) << "socket id=" << socket_pool_.front().first
-                       << " long duration=" << duration;
-        }
-        new_fd = socket_pool_.front().first;
-        socket_pool_.pop_front();
-        DCHECK_GE(new_fd, 0);
-        return ScopedSocket(new_fd);
-      }
-      DCHECK(current_addr_ != nullptr);
-      addr = *current_addr_;
-    }
+  const std::vector<size_t> order = ConnectOrder(addrs, absl::Now());
+  size_t connected = 0;
+  std::vector<ConnectAttempt> attempts;
+  ScopedSocket sock =
+      RaceConnect(addrs, order, kConnTimeout, &connected, &attempts);
 
-    ScopedSocket socket_fd(socket(addr.storage.ss_family, SOCK_STREAM, 0));
-    if (!socket_fd.valid()) {
-#ifndef _WIN32
-      PLOG(WARNING) << "socket";
-#else
-      LOG(WARNING) << "socket error=" << WSAGetLastError();
-#endif
-      return socket_fd;
+  AUTOLOCK(lock, &mu_);
+  RecordConnectAttemptsUnlocked(addrs, attempts);
+  if (!sock.valid()) {
+    return sock;
+  }
+  const std::string& name = addrs[connected].name;
+  fd_addrs_.insert(std::make_pair(sock.get(), name));
+  for (auto& addr : addrs_) {
+    if (addr.name == name) {
+      current_addr_ = &addr;
+      break;
     }
+  }
+  return sock;
+}
 
-    int r;
-    // TODO: use nonblocking connect with timeout.
-    while ((r = connect(socket_fd.get(), addr.addr_ptr(), addr.len)) < 0) {
-      if (errno == EINTR) {
-        continue;
+void SocketPool::Prewarm(int num_sockets) {
+  int num_idle = 0;
+  {
+    AUTOLOCK(lock, &mu_);
+    for (const auto& it : socket_pool_) {
+      if (it.second.GetDuration() < kIdleSocketTimeout) {
+        ++num_idle;
       }
-#ifndef _WIN32
-      PLOG(WARNING) << "connect " << addr.name;
-#else
-      LOG(WARNING) << "connect " << addr.name
-                   << " error=" << WSAGetLastError();
-#endif
-      break;
-    }
-    {
-      AUTOLOCK(lock, &mu_);
-      fd_addrs_.insert(std::make_pair(socket_fd.get(), addr.name));
     }
-    if (r < 0) {
-      new_fd = socket_fd.get();
-      error_time = absl::Now();
-      continue;  // try other address.
-    }
-    if (!socket_fd.SetCloseOnExec()) {
-      LOG(ERROR) << "failed to set FD_CLOEXEC";
-      AUTOLOCK(lock, &mu_);
-      fd_addrs_.erase(socket_fd.get());
-      return ScopedSocket();
+  }
+  VLOG(1) << "prewarm " << host_name_ << " idle=" << num_idle
+          << " num_sockets=" << num_sockets;
+  for (; num_idle < num_sockets; ++num_idle) {
+    ScopedSocket sock = Connect();
+    if (!sock.valid()) {
+      LOG(WARNING) << "failed to prewarm socket to " << host_name_;
+      return;
     }
-    if (!socket_fd.SetNonBlocking()) {
-      LOG(ERROR) << "failed to set O_NONBLOCK";
-      AUTOLOCK(lock, &mu_);
-      fd_addrs_.erase(socket_fd.get());
-      return ScopedSocket();
+    if (observer_ != nullptr && !observer_->PrewarmSocket(sock.get())) {
+      LOG(WARNING) << "failed to prewarm socket to " << host_name_
+                   << " by observer. sock=" << sock.get();
+      CloseSocket(std::move(sock), false);
+      return;
     }
-    return socket_fd;
+    ReleaseSocket(std::move(sock));
   }
-  LOG(ERROR) << "Too many retries in NewSocket";
-  return ScopedSocket();
 }
 
 void SocketPool::ReleaseSocket(ScopedSocket&& sock) {
@@ -261,10 +263,23 @@ void SocketPool::SetErrorTimestampUnlocked(int sock, absl::Time time) {
   LOG(WARNING) << "sock " << sock << " addr:" << addr_name << " not found";
 }
 
-SocketPool::AddrData::AddrData() : len(0), ai_socktype(0), ai_protocol(0) {
+SocketPool::AddrData::AddrData()
+    : len(0),
+      ai_socktype(0),
+      ai_protocol(0),
+      error_timestamp(absl::InfinitePast()),
+      smoothed_rtt(absl::InfiniteDuration()) {
   memset(&storage, 0, sizeof storage);
 }
 
+void SocketPool::AddrData::UpdateRtt(absl::Duration rtt) {
+  if (smoothed_rtt == absl::InfiniteDuration()) {
+    smoothed_rtt = rtt;
+    return;
+  }
+  smoothed_rtt += (rtt - smoothed_rtt) * kRttGain;
+}
+
 const struct sockaddr* SocketPool::AddrData::addr_ptr() const {
   return reinterpret_cast<const struct sockaddr*>(&storage);
 }
@@ -381,117 +396,115 @@ void SocketPool::ResolveAddress(const std::string& hostname,
 class SocketPool::ScopedSocketList {
  public:
   // Doesn't take ownership of addrs.
-  explicit ScopedSocketList(std::vector<AddrData>* addrs)
+  explicit ScopedSocketList(const std::vector<AddrData>* addrs)
       : addrs_(addrs) {
     socks_.resize(addrs->size());
   }
 
-  // Connect to initiate connection to all addrs with nonblocking socket.
-  // Returns socket if connection is established.
-  // Returns -1 otherwise.
-  // *nfds will be the number of connection initiated.
-  ScopedSocket Connect(int* nfds, AddrData** addr) {
-    *nfds = 0;
-    *addr = nullptr;
-    absl::Time now = absl::Now();
-    absl::Time min_error_timestamp = now;
-    for (const auto& address : *addrs_) {
-      if (address.error_timestamp < min_error_timestamp) {
-        min_error_timestamp = address.error_timestamp;
-      }
-    }
-    for (size_t i = 0; i < addrs_->size(); ++i) {
-      const auto& current_addr = (*addrs_)[i];
-      if (current_addr.error_timestamp == min_error_timestamp) {
-        // Use this addr even if it not marked as inifite past.
-        // Most case, min_error_timestamp is infinite past (i.e. some ip
-        // wasn't marked as error).
-        // If all addresses had marked as error, this addr had error most
-        // long time ago in addrs_.
-        // Note that if len(addrs_)==1, the addr is used regardless of
-        // error_timestamp to avoid "no other address available" by just
-        // one error on the addr.
-        // The addr, however, mignt not be used if connect fails.
-        LOG(INFO) << "addrs[" << i << "] " << current_addr.name
-                  << " min_error_timestamp=" << min_error_timestamp;
-      } else {
-        CHECK_GT(current_addr.error_timestamp, min_error_timestamp);
-        if (now < current_addr.error_timestamp + kErrorAddressTimeout) {
-          LOG(WARNING) << "addrs[" << i << "] " << current_addr.name
-                       << " don't use until "
-                       << current_addr.error_timestamp + kErrorAddressTimeout
-                       << " error_timestamp=" << current_addr.error_timestamp
-                       << " now=" << now;
-          continue;
-        }
-        if (min_error_timestamp == absl::InfinitePast()) {
-          // prefer address that not marked as error.
-          continue;
-        }
-        // else error happened long time ago, so try again.
-      }
-
-      socks_[i] = ScopedSocket(
-          socket((*addrs_)[i].storage.ss_family, SOCK_STREAM, 0));
-      if (!socks_[i].valid()) {
+  // Initiates connection to addrs[i] with nonblocking socket.
+  // Returns socket if connection is established immediately.
+  // Returns invalid socket otherwise.
+  ScopedSocket Connect(size_t i) {
+    attempts_.push_back(
+        ConnectAttempt{i, ConnectAttempt::CONNECTING, absl::ZeroDuration()});
+    start_times_.push_back(absl::Now());
+    const AddrData& address = (*addrs_)[i];
+    socks_[i] = ScopedSocket(socket(address.storage.ss_family, SOCK_STREAM, 0));
+    if (!socks_[i].valid()) {
 #ifndef _WIN32
-        PLOG(WARNING) << "socket:" << (*addrs_)[i].name;
+      PLOG(WARNING) << "socket:" << address.name;
 #else
-        LOG(WARNING) << "socket:" << (*addrs_)[i].name
-                     << " error=" << WSAGetLastError();
+      LOG(WARNING) << "socket:" << address.name
+                   << " error=" << WSAGetLastError();
 #endif
-        continue;
-      }
-      if (!socks_[i].SetCloseOnExec()) {
-        LOG(WARNING) << "failed to set FD_CLOEXEC";
-        socks_[i].Close();
-        continue;
-      }
-      if (!socks_[i].SetNonBlocking()) {
-        LOG(WARNING) << "failed to set O_NONBLOCK";
-        socks_[i].Close();
-        continue;
-      }
+      Failed(i);
+      return ScopedSocket();
+    }
+    if (!socks_[i].SetCloseOnExec()) {
+      LOG(WARNING) << "failed to set FD_CLOEXEC";
+      Failed(i);
+      return ScopedSocket();
+    }
+    if (!socks_[i].SetNonBlocking()) {
+      LOG(WARNING) << "failed to set O_NONBLOCK";
+      Failed(i);
+      return ScopedSocket();
+    }
 
-      ++*nfds;
-      // connect with nonblocking socket.
-      if (connect(socks_[i].get(),
-                  (*addrs_)[i].addr_ptr(),
-                  (*addrs_)[i].len) == 0) {
-        // If connect returns immediately on nonblocking socket,
-        // it's fast enough so use it.
-        *addr = &(*addrs_)[i];
-        return std::move(socks_[i]);
-      }
+    // connect with nonblocking socket.
+    if (connect(socks_[i].get(), address.addr_ptr(), address.len) == 0) {
+      // If connect returns immediately on nonblocking socket,
+      // it's fast enough so use it.
+      return Connected(i);
+    }
 #ifdef WIN32
-      if (WSAGetLastError() != WSAEWOULDBLOCK) {
-        LOG(WARNING) << "connect to " << (*addrs_)[i].name
-                     << " WSA:" << WSAGetLastError();
-        socks_[i].Close();
-        continue;
-      }
+    if (WSAGetLastError() != WSAEWOULDBLOCK) {
+      LOG(WARNING) << "connect to " << address.name
+                   << " WSA:" << WSAGetLastError();
+      Failed(i);
+    }
 #else
-      if (errno != EINPROGRESS) {
-        PLOG(WARNING) << "connect to " << (*addrs_)[i].name;
-        socks_[i].Close();
-        continue;
-      }
-#endif
+    if (errno != EINPROGRESS) {
+      PLOG(WARNING) << "connect to " << address.name;
+      Failed(i);
     }
+#endif
     return ScopedSocket();
   }
 
   // Poll nonblocking connect with timeout.
   // Returns a connected socket, if connection has been established,
+  // and sets *index to the index of its address.
   // Returns -1 if poll has not yet finished.
   // nfds will be number of socket that is connecting.
-  // if *nfds <= 0, no need to call Poll again.
+  // if *nfds <= 0, no need to call Poll again until next Connect.
   // TODO: reuse DescriptorPoller?
-  ScopedSocket Poll(absl::Duration timeout, int* nfds, AddrData** addr);
+  ScopedSocket Poll(absl::Duration timeout, int* nfds, size_t* index);
+
+  // Returns results of all connection attempts.
+  std::vector<ConnectAttempt> TakeAttempts() {
+    const absl::Time now = absl::Now();
+    for (size_t k = 0; k < attempts_.size(); ++k) {
+      if (attempts_[k].state == ConnectAttempt::CONNECTING) {
+        attempts_[k].elapsed = now - start_times_[k];
+      }
+    }
+    return std::move(attempts_);
+  }
 
  private:
-  std::vector<AddrData>* addrs_;
+  ConnectAttempt* FindAttempt(size_t i) {
+    for (auto& attempt : attempts_) {
+      if (attempt.index == i) {
+        return &attempt;
+      }
+    }
+    LOG(FATAL) << "no attempt for addrs[" << i << "]";
+    return nullptr;
+  }
+
+  absl::Duration Elapsed(const ConnectAttempt* attempt) const {
+    return absl::Now() - start_times_[attempt - &attempts_[0]];
+  }
+
+  ScopedSocket Connected(size_t i) {
+    ConnectAttempt* attempt = FindAttempt(i);
+    attempt->state = ConnectAttempt::CONNECTED;
+    attempt->elapsed = Elapsed(attempt);
+    return std::move(socks_[i]);
+  }
+
+  void Failed(size_t i) {
+    ConnectAttempt* attempt = FindAttempt(i);
+    attempt->state = ConnectAttempt::FAILED;
+    attempt->elapsed = Elapsed(attempt);
+    socks_[i].Close();
+  }
+
+  const std::vector<AddrData>* addrs_;
   std::vector<ScopedSocket> socks_;
+  std::vector<ConnectAttempt> attempts_;
+  std::vector<absl::Time> start_times_;
 
 #ifdef WIN32
   fd_set fdset_;
@@ -502,10 +515,9 @@ class SocketPool::ScopedSocketList {
 };
 
 ScopedSocket SocketPool::ScopedSocketList::Poll(
-    absl::Duration timeout, int* nfds, AddrData** addr) {
+    absl::Duration timeout, int* nfds, size_t* index) {
 #ifdef WIN32
   *nfds = 0;
-  *addr = nullptr;
   fd_set exceptfds;
   FD_ZERO(&fdset_);
   FD_ZERO(&exceptfds);
@@ -530,7 +542,7 @@ ScopedSocket SocketPool::ScopedSocketList::Poll(
     return ScopedSocket();
   }
   if (r == 0) {
-    LOG(ERROR) << "connect timeout:" << timeout;
+    VLOG(1) << "connect timeout:" << timeout;
     return ScopedSocket();
   }
   for (size_t i = 0; i < socks_.size(); ++i) {
@@ -547,11 +559,11 @@ ScopedSocket SocketPool::ScopedSocketList::Poll(
                      << " name=" << (*addrs_)[i].name
                      << " sock=" << socks_[i].get()
                      << " WSA:" << WSAGetLastError();
-        socks_[i].Close();
+        Failed(i);
         continue;
       }
-      *addr = &(*addrs_)[i];
-      return std::move(socks_[i]);
+      *index = i;
+      return Connected(i);
     }
     if (FD_ISSET(socks_[i].get(), &exceptfds)) {
       int val = 0;
@@ -562,7 +574,7 @@ ScopedSocket SocketPool::ScopedSocketList::Poll(
                    << " name=" << (*addrs_)[i].name
                    << " sock=" << socks_[i].get()
                    << " WSA:" << WSAGetLastError();
-        socks_[i].Close();
+        Failed(i);
         continue;
       }
       if (val_size != sizeof(val)) {
@@ -570,19 +582,18 @@ ScopedSocket SocketPool::ScopedSocketList::Poll(
                    << " name=" << (*addrs_)[i].name
                    << " sock=" << socks_[i].get()
                    << " val_size=" << val_size;
-        socks_[i].Close();
+        Failed(i);
         continue;
       }
       LOG(ERROR) << "getsockopt(SO_ERROR)."
                  << " name=" << (*addrs_)[i].name
                  << " sock=" << socks_[i].get()
                  << " val=" << val;
-      socks_[i].Close();
+      Failed(i);
     }
   }
 #else
   *nfds = 0;
-  *addr = nullptr;
   pfds_.resize(socks_.size());
   for (const auto& sock : socks_) {
     if (!sock.valid())
@@ -600,7 +611,7 @@ ScopedSocket SocketPool::ScopedSocketList::Poll(
     return ScopedSocket();
   }
   if (r == 0) {
-    PLOG(ERROR) << "connect timeout:" << timeout;
+    VLOG(1) << "connect timeout:" << timeout;
     return ScopedSocket();
   }
   for (int i = 0; i < *nfds; ++i) {
@@ -613,7 +624,7 @@ ScopedSocket SocketPool::ScopedSocketList::Poll(
           LOG(WARNING) << "connect error"
                        << " name=" << (*addrs_)[j].name
                        << " sock=" << socks_[j].get();
-          socks_[j].Close();
+          Failed(j);
           break;
         }
       }
@@ -635,11 +646,11 @@ ScopedSocket SocketPool::ScopedSocketList::Poll(
             PLOG(WARNING) << "getpeername failed"
                           << " name=" << (*addrs_)[j].name
                           << " sock=" << socks_[j].get();
-            socks_[j].Close();
+            Failed(j);
             break;
           }
-          *addr = &(*addrs_)[j];
-          return std::move(socks_[j]);
+          *index = j;
+          return Connected(j);
         }
       }
     }
@@ -648,12 +659,175 @@ ScopedSocket SocketPool::ScopedSocketList::Poll(
   return ScopedSocket();
 }
 
+/* static */
+std::vector<size_t> SocketPool::ConnectOrder(
+    const std::vector<AddrData>& addrs, absl::Time now) {
+  absl::Time min_error_timestamp = now;
+  for (const auto& address : addrs) {
+    if (address.error_timestamp < min_error_timestamp) {
+      min_error_timestamp = address.error_timestamp;
+    }
+  }
+  std::vector<size_t> candidates;
+  for (size_t i = 0; i < addrs.size(); ++i) {
+    const auto& current_addr = addrs[i];
+    if (current_addr.error_timestamp == min_error_timestamp) {
+      // Use this addr even if it not marked as inifite past.
+      // Most case, min_error_timestamp is infinite past (i.e. some ip
+      // wasn't marked as error).
+      // If all addresses had marked as error, this addr had error most
+      // long time ago in addrs.
+      // Note that if len(addrs)==1, the addr is used regardless of
+      // error_timestamp to avoid "no other address available" by just
+      // one error on the addr.
+      // The addr, however, mignt not be used if connect fails.
+      VLOG(1) << "addrs[" << i << "] " << current_addr.name
+              << " min_error_timestamp=" << min_error_timestamp
+              << " smoothed_rtt=" << current_addr.smoothed_rtt;
+    } else {
+      CHECK_GT(current_addr.error_timestamp, min_error_timestamp);
+      if (now < current_addr.error_timestamp + kErrorAddressTimeout) {
+        VLOG(1) << "addrs[" << i << "] " << current_addr.name
+                << " don't use until "
+                << current_addr.error_timestamp + kErrorAddressTimeout
+                << " error_timestamp=" << current_addr.error_timestamp
+                << " now=" << now;
+        continue;
+      }
+      if (min_error_timestamp == absl::InfinitePast()) {
+        // prefer address that not marked as error.
+        continue;
+      }
+      // else error happened long time ago, so try again.
+    }
+    candidates.push_back(i);
+  }
+
+  // Lower latency first.  Addresses not measured yet come after the
+  // measured ones in resolved order, and will be measured when the
+  // measured ones are slow.
+  std::stable_sort(candidates.begin(), candidates.end(),
+                   [&addrs](size_t a, size_t b) {
+                     return addrs[a].smoothed_rtt < addrs[b].smoothed_rtt;
+                   });
+
+  // Interleave address families after the first address (RFC 8305
+  // section 4), so that a broken IPv6 (or IPv4) network doesn't delay
+  // connection by many attempts.
+  std::vector<size_t> same_family;
+  std::vector<size_t> other_family;
+  for (const auto& i : candidates) {
+    if (addrs[i].storage.ss_family == addrs[candidates[0]].storage.ss_family) {
+      same_family.push_back(i);
+    } else {
+      other_family.push_back(i);
+    }
+  }
+  std::vector<size_t> order;
+  order.reserve(candidates.size());
+  for (size_t k = 0; k < std::max(same_family.size(), other_family.size());
+       ++k) {
+    if (k < same_family.size()) {
+      order.push_back(same_family[k]);
+    }
+    if (k < other_family.size()) {
+      order.push_back(other_family[k]);
+    }
+  }
+  return order;
+}
+
+/* static */
+absl::Duration SocketPool::ConnectionAttemptDelay(const AddrData& addr) {
+  if (addr.smoothed_rtt == absl::InfiniteDuration()) {
+    return kMaxConnectionAttemptDelay;
+  }
+  return std::min(std::max(addr.smoothed_rtt * 2, kMinConnectionAttemptDelay),
+                  kMaxConnectionAttemptDelay);
+}
+
+/* static */
+ScopedSocket SocketPool::RaceConnect(const std::vector<AddrData>& addrs,
+                                     const std::vector<size_t>& order,
+                                     absl::Duration timeout,
+                                     size_t* connected,
+                                     std::vector<ConnectAttempt>* attempts) {
+  ScopedSocketList socks(&addrs);
+  SimpleTimer timer;
+  size_t next = 0;
+  ScopedSocket s;
+  absl::Duration remaining_timeout;
+  while ((remaining_timeout = timeout - timer.GetDuration()) >
+         absl::ZeroDuration()) {
+    absl::Duration wait = remaining_timeout;
+    if (next < order.size()) {
+      const size_t i = order[next++];
+      s = socks.Connect(i);
+      if (s.valid()) {
+        *connected = i;
+        break;
+      }
+      if (next < order.size()) {
+        wait = std::min(wait, ConnectionAttemptDelay(addrs[i]));
+      }
+    }
+    int nfds = 0;
+    s = socks.Poll(wait, &nfds, connected);
+    if (s.valid()) {
+      break;
+    }
+    if (nfds <= 0 && next >= order.size()) {
+      break;
+    }
+  }
+  *attempts = socks.TakeAttempts();
+  if (!s.valid() && remaining_timeout <= absl::ZeroDuration()) {
+    LOG(ERROR) << "connect timeout:" << timeout;
+  }
+  return s;
+}
+
+void SocketPool::RecordConnectAttemptsUnlocked(
+    const std::vector<AddrData>& addrs,
+    const std::vector<ConnectAttempt>& attempts) {
+  const absl::Time now = absl::Now();
+  for (const auto& attempt : attempts) {
+    const std::string& name = addrs[attempt.index].name;
+    auto found = std::find_if(
+        addrs_.begin(), addrs_.end(),
+        [&name](const AddrData& addr) { return addr.name == name; });
+    if (found == addrs_.end()) {
+      // addrs_ was resolved again.
+      continue;
+    }
+    switch (attempt.state) {
+      case ConnectAttempt::CONNECTED:
+        found->UpdateRtt(attempt.elapsed);
+        found->error_timestamp = absl::InfinitePast();
+        break;
+      case ConnectAttempt::FAILED:
+        found->error_timestamp = now;
+        break;
+      case ConnectAttempt::CONNECTING:
+        // It takes longer than this at least, but this is not a
+        // measurement.  Don't seed RTT of the address not measured yet,
+        // or it could sort ahead of the measured healthy address that
+        // won the race.
+        if (found->smoothed_rtt != absl::InfiniteDuration() &&
+            found->smoothed_rtt < attempt.elapsed) {
+          found->UpdateRtt(attempt.elapsed);
+        }
+        break;
+    }
+  }
+}
+
 Errno SocketPool::InitializeUnlocked() {
   // lock held.
   current_addr_ = nullptr;
-  std::map<std::string, absl::Time> last_errors;
+  std::map<std::string, AddrData> last_addrs;
   for (const auto& addr : addrs_) {
-    last_errors.insert(std::make_pair(addr.name, addr.error_timestamp));
+    last_addrs.insert(std::make_pair(addr.name, addr));
   }
   addrs_.clear();
   SimpleTimer timer;
@@ -661,12 +835,14 @@ Errno SocketPool::InitializeUnlocked() {
   // again?
   ResolveAddress(host_name_, port_, &addrs_);
   for (auto& addr : addrs_) {
-    const auto found = last_errors.find(addr.name);
-    if (found != last_errors.end()) {
-      addr.error_timestamp = found->second;
+    const auto found = last_addrs.find(addr.name);
+    if (found != last_addrs.end()) {
+      addr.error_timestamp = found->second.error_timestamp;
+      addr.smoothed_rtt = found->second.smoothed_rtt;
     }
     LOG(INFO) << host_name_ << " resolved as " << addr.name
-              << " error_timestamp:" << addr.error_timestamp;
+              << " error_timestamp:" << addr.error_timestamp
+              << " smoothed_rtt:" << addr.smoothed_rtt;
   }
   absl::Duration resolve_duration = timer.GetDuration();
   if (resolve_duration > absl::Seconds(1)) {
@@ -678,58 +854,39 @@ Errno SocketPool::InitializeUnlocked() {
   }
 
   timer.Start();
-  ScopedSocketList socks(&addrs_);
-
-  int nfds;
-  ScopedSocket s(socks.Connect(&nfds, &current_addr_));
-  if (s.valid()) {
-    DCHECK(current_addr_ != nullptr);
-    DCHECK(current_addr_->IsValid());
-    absl::Duration connect_duration = timer.GetDuration();
-    if (connect_duration > absl::Seconds(1)) {
-      LOG(ERROR) << "SLOW connected"
-                 << ": use addr:" << current_addr_->name
-                 << " for " << host_name_
-                 << " in " << connect_duration;
-    } else {
-      LOG(INFO) << "connected"
-                << ": use addr:" << current_addr_->name
-                << " for " << host_name_
-                << " in " << connect_duration;
-    }
-    fd_addrs_.insert(std::make_pair(s.get(), current_addr_->name));
-    socket_pool_.emplace_back(s.release(), SimpleTimer());
-    return OK;
-  }
-  if (nfds <= 0) {
+  const std::vector<size_t> order = ConnectOrder(addrs_, absl::Now());
+  if (order.empty()) {
     LOG(ERROR) << "Server at "
                << host_name_ << ":" << port_ << " not reachable.";
-    DCHECK(current_addr_ == nullptr);
     return FAIL;
   }
-  absl::Duration remaining_timeout;
-  while ((remaining_timeout = kConnTimeout - timer.GetDuration()) >
-         absl::ZeroDuration()) {
-    s = socks.Poll(remaining_timeout, &nfds, &current_addr_);
-    if (s.valid()) {
-      break;
-    }
-    if (nfds <= 0) {
-      break;
-    }
-  }
-  LOG(INFO) << "connect done in " << timer.GetDuration();
+  size_t connected = 0;
+  std::vector<ConnectAttempt> attempts;
+  ScopedSocket s(
+      RaceConnect(addrs_, order, kConnTimeout, &connected, &attempts));
+  RecordConnectAttemptsUnlocked(addrs_, attempts);
+  absl::Duration connect_duration = timer.GetDuration();
   if (!s.valid()) {
-    DCHECK(current_addr_ == nullptr);
     LOG(ERROR) << "Server at "
-               << host_name_ << ":" << port_ << " not reachable.";
-    if (remaining_timeout <= absl::ZeroDuration())
+               << host_name_ << ":" << port_ << " not reachable"
+               << " in " << connect_duration;
+    if (connect_duration >= kConnTimeout)
       return ERR_TIMEOUT;
     return FAIL;
   }
-  DCHECK(current_addr_ != nullptr);
+  current_addr_ = &addrs_[connected];
   DCHECK(current_addr_->IsValid());
-  LOG(INFO) << "use addr:" << current_addr_->name << " for " << host_name_;
+  if (connect_duration > absl::Seconds(1)) {
+    LOG(ERROR) << "SLOW connected"
+               << ": use addr:" << current_addr_->name
+               << " for " << host_name_
+               << " in " << connect_duration;
+  } else {
+    LOG(INFO) << "connected"
+              << ": use addr:" << current_addr_->name
+              << " for " << host_name_
+              << " in " << connect_duration;
+  }
   fd_addrs_.insert(std::make_pair(s.get(), current_addr_->name));
   socket_pool_.emplace_back(s.release(), SimpleTimer());
   return OK;
@@ -757,6 +914,7 @@ std::string SocketPool::DebugString() const {
   std::string name;
   size_t socket_pool_size = 0;
   size_t open_sockets = 0;
+  std::ostringstream rtts;
   {
     AUTOLOCK(lock, &mu_);
     if (current_addr_ != nullptr) {
@@ -766,10 +924,14 @@ std::string SocketPool::DebugString() const {
     }
     socket_pool_size = socket_pool_.size();
     open_sockets = fd_addrs_.size();
+    for (const auto& addr : addrs_) {
+      rtts << " " << addr.name << "=" << addr.smoothed_rtt;
+    }
   }
   ss << " addr:" << name;
   ss << " pool_size:" << socket_pool_size;
   ss << " open_sockets:" << open_sockets;
+  ss << " rtt:[" << rtts.str() << " ]";
   return ss.str();
 }
 
@@ -29,6 +29,15 @@ namespace devtools_goma {
 
 class SimpleTimer;
 
+// SocketPool keeps idle sockets to host_name:port for reuse, and opens
+// new sockets to one of the resolved addresses.
+//
+// It tracks time to connect of each address, and tries the address with
+// the lowest latency first.  If it is not connected in a short delay, it
+// also tries the next address in parallel, alternating address families
+// (a.k.a. happy eyeballs, RFC 8305), and uses whichever connected first.
+// So a degraded address is not used while the others are healthy.
+//
 // TODO: template for ScopedSocket and ScopedNamedPipe.
 class SocketPool : public SocketFactory {
  public:
@@ -47,6 +56,8 @@ class SocketPool : public SocketFactory {
   // it needs to open new connection.
   void CloseSocket(ScopedSocket&& sock, bool err) override;
 
+  void Prewarm(int num_sockets) override;
+
   std::string DestName() const override;
   std::string host_name() const override { return host_name_; }
   int port() const override { return port_; }
@@ -64,15 +75,31 @@ class SocketPool : public SocketFactory {
     int ai_protocol;
     std::string name;
     absl::Time error_timestamp;  // infinite-past if no error observed.
+    // Smoothed time to connect.  infinite if not measured yet.
+    absl::Duration smoothed_rtt;
 
     const struct sockaddr* addr_ptr() const;
+    void UpdateRtt(absl::Duration rtt);
     void Invalidate();
     bool IsValid() const;
     bool InitFromIPv4Addr(const std::string& ipv4, int port);
     void InitFromAddrInfo(const struct addrinfo* ai);
   };
+  // Result of a connection attempt to an address.
+  struct ConnectAttempt {
+    enum State {
+      CONNECTING,  // not connected until the other address connected.
+      CONNECTED,
+      FAILED,
+    };
+    size_t index;  // in addrs.
+    State state;
+    absl::Duration elapsed;
+  };
   class ScopedSocketList;
 
+  friend class SocketPoolTest;
+
   // Resolves hostname:port and stores in addrs.
   static void ResolveAddress(const std::string& hostname,
                              int port,
@@ -88,6 +115,37 @@ class SocketPool : public SocketFactory {
   // Sets error_timetamp in AddrData for sock to |time|.
   void SetErrorTimestampUnlocked(int sock, absl::Time time);
 
+  // Returns indices of |addrs| in the order to try to connect.
+  // Addresses that had error recently are not used if other addresses are
+  // available.
+  static std::vector<size_t> ConnectOrder(const std::vector<AddrData>& addrs,
+                                          absl::Time now);
+
+  // Returns how long it waits for a connection to |addr| before it also
+  // tries the next address.
+  static absl::Duration ConnectionAttemptDelay(const AddrData& addr);
+
+  // Connects to |addrs| in |order|, racing with the next address if not
+  // connected in ConnectionAttemptDelay.
+  // Returns the first connected socket, and sets |*connected| to its index
+  // in |addrs|.  Returns invalid socket if no address is connected in
+  // |timeout|.  |attempts| will have the results of all attempts.
+  static ScopedSocket RaceConnect(const std::vector<AddrData>& addrs,
+                                  const std::vector<size_t>& order,
+                                  absl::Duration timeout,
+                                  size_t* connected,
+                                  std::vector<ConnectAttempt>* attempts);
+
+  // Connects to the best address of addrs_.
+  // Returns invalid socket if no address is connected.
+  ScopedSocket Connect() ABSL_LOCKS_EXCLUDED(mu_);
+
+  // Updates addrs_ with |attempts| to |addrs|.
+  void RecordConnectAttemptsUnlocked(
+      const std::vector<AddrData>& addrs,
+      const std::vector<ConnectAttempt>& attempts)
+      ABSL_EXCLUSIVE_LOCKS_REQUIRED(mu_);
+
   // This host:port is for means the address we will connect directly.
   // So, this can be either a destination address or a proxy address.
   std::string host_name_;
@@ -0,0 +1,327 @@
+// Copyright 2020 The Goma Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "socket_pool.h"
+
+#ifndef _WIN32
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#endif
+
+#include <string>
+#include <vector>
+
+#include "absl/time/time.h"
+#include "autolock_timer.h"
+#include "glog/logging.h"
+#include "gtest/gtest.h"
+#include "scoped_fd.h"
+#include "simple_timer.h"
+
+namespace devtools_goma {
+
+class SocketPoolTest : public testing::Test {
+ protected:
+  using AddrData = SocketPool::AddrData;
+
+  static AddrData IPv4Addr(const std::string& ip,
+                           int port,
+                           absl::Duration rtt = absl::InfiniteDuration()) {
+    AddrData addr;
+    EXPECT_TRUE(addr.InitFromIPv4Addr(ip, port));
+    addr.smoothed_rtt = rtt;
+    return addr;
+  }
+
+  static AddrData IPv6Addr(const std::string& name, absl::Duration rtt) {
+    AddrData addr;
+    addr.storage.ss_family = AF_INET6;
+    addr.len = sizeof(struct sockaddr_in6);
+    addr.name = name;
+    addr.smoothed_rtt = rtt;
+    return addr;
+  }
+
+  static std::vector<std::string> ConnectOrder(
+      const std::vector<AddrData>& addrs, absl::Time now) {
+    std::vector<std::string> names;
+    for (const auto& i : SocketPool::ConnectOrder(addrs, now)) {
+      names.push_back(addrs[i].name);
+    }
+    return names;
+  }
+
+  static void SetAddrs(SocketPool* pool, std::vector<AddrData> addrs) {
+    AUTOLOCK(lock, &pool->mu_);
+    pool->current_addr_ = nullptr;
+    pool->addrs_ = std::move(addrs);
+  }
+
+  static void RecordConnectAttempts(
+      SocketPool* pool,
+      const std::vector<SocketPool::ConnectAttempt>& attempts) {
+    AUTOLOCK(lock, &pool->mu_);
+    pool->RecordConnectAttemptsUnlocked(pool->addrs_, attempts);
+  }
+
+  static std::vector<std::string> ConnectOrder(const SocketPool& pool) {
+    AUTOLOCK(lock, &pool.mu_);
+    return ConnectOrder(pool.addrs_, absl::Now());
+  }
+
+  static absl::Duration SmoothedRtt(const SocketPool& pool,
+                                    const std::string& name) {
+    AUTOLOCK(lock, &pool.mu_);
+    for (const auto& addr : pool.addrs_) {
+      if (addr.name == name) {
+        return addr.smoothed_rtt;
+      }
+    }
+    ADD_FAILURE() << "no addr " << name;
+    return absl::ZeroDuration();
+  }
+
+  static bool HasError(const SocketPool& pool, const std::string& name) {
+    AUTOLOCK(lock, &pool.mu_);
+    for (const auto& addr : pool.addrs_) {
+      if (addr.name == name) {
+        return addr.error_timestamp != absl::InfinitePast();
+      }
+    }
+    ADD_FAILURE() << "no addr " << name;
+    return false;
+  }
+
+  static size_t NumIdleSockets(const SocketPool& pool) {
+    AUTOLOCK(lock, &pool.mu_);
+    return pool.socket_pool_.size();
+  }
+};
+
+TEST_F(SocketPoolTest, ConnectOrderPrefersLowerRtt) {
+  const std::vector<AddrData> addrs = {
+      IPv4Addr("10.0.0.1", 443),
+      IPv4Addr("10.0.0.2", 443, absl::Milliseconds(50)),
+      IPv4Addr("10.0.0.3", 443, absl::Milliseconds(5)),
+      IPv4Addr("10.0.0.4", 443),
+  };
+  EXPECT_EQ(
+      (std::vector<std::string>{"10.0.0.3", "10.0.0.2", "10.0.0.1",
+                                "10.0.0.4"}),
+      ConnectOrder(addrs, absl::Now()));
+}
+
+TEST_F(SocketPoolTest, ConnectOrderInterleavesAddressFamilies) {
+  const std::vector<AddrData> addrs = {
+      IPv4Addr("10.0.0.1", 443, absl::Milliseconds(3)),
+      IPv4Addr("10.0.0.2", 443, absl::Milliseconds(4)),
+      IPv6Addr("2001:db8::1", absl::Milliseconds(1)),
+      IPv6Addr("2001:db8::2", absl::Milliseconds(2)),
+      IPv6Addr("2001:db8::3", absl::Milliseconds(5)),
+  };
+  EXPECT_EQ((std::vector<std::string>{"2001:db8::1", "10.0.0.1",
+                                      "2001:db8::2", "10.0.0.2",
+                                      "2001:db8::3"}),
+            ConnectOrder(addrs, absl::Now()));
+}
+
+TEST_F(SocketPoolTest, ConnectOrderSkipsErrorAddress) {
+  const absl::Time now = absl::Now();
+  std::vector<AddrData> addrs = {
+      IPv4Addr("10.0.0.1", 443, absl::Milliseconds(1)),
+      IPv4Addr("10.0.0.2", 443, absl::Milliseconds(50)),
+  };
+  addrs[0].error_timestamp = now - absl::Seconds(1);
+  EXPECT_EQ(std::vector<std::string>{"10.0.0.2"}, ConnectOrder(addrs, now));
+
+  // Uses the address that had error long time ago if all had errors.
+  addrs[1].error_timestamp = now - absl::Milliseconds(500);
+  EXPECT_EQ(std::vector<std::string>{"10.0.0.1"}, ConnectOrder(addrs, now));
+
+  // Error has expired.
+  EXPECT_EQ((std::vector<std::string>{"10.0.0.1", "10.0.0.2"}),
+            ConnectOrder(addrs, now + absl::Minutes(5)));
+}
+
+#ifndef _WIN32
+
+namespace {
+
+// Listens on |ip|:|*port|.  If |*port| is 0, it is set to the bound port.
+ScopedSocket Listen(const std::string& ip, int backlog, int* port) {
+  ScopedSocket sock(socket(AF_INET, SOCK_STREAM, 0));
+  if (!sock.valid()) {
+    return sock;
+  }
+  struct sockaddr_in addr = {};
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(*port);
+  if (inet_pton(AF_INET, ip.c_str(), &addr.sin_addr) <= 0 ||
+      bind(sock.get(), reinterpret_cast<struct sockaddr*>(&addr),
+           sizeof addr) < 0 ||
+      listen(sock.get(), backlog) < 0) {
+    return ScopedSocket();
+  }
+  socklen_t len = sizeof addr;
+  if (getsockname(sock.get(), reinterpret_cast<struct sockaddr*>(&addr),
+                  &len) < 0) {
+    return ScopedSocket();
+  }
+  *port = ntohs(addr.sin_port);
+  return sock;
+}
+
+std::string PeerName(const ScopedSocket& sock) {
+  struct sockaddr_in addr = {};
+  socklen_t len = sizeof addr;
+  if (getpeername(sock.get(), reinterpret_cast<struct sockaddr*>(&addr),
+                  &len) < 0) {
+    return "";
+  }
+  char buf[INET_ADDRSTRLEN];
+  return inet_ntop(AF_INET, &addr.sin_addr, buf, sizeof buf);
+}
+
+// Fills the accept queue of the listener on |ip|:|port|, so that it drops
+// SYN of new connections and connect takes a few seconds, like a degraded
+// frontend.
+ScopedSocket SaturateListener(const std::string& ip, int port) {
+  ScopedSocket sock(socket(AF_INET, SOCK_STREAM, 0));
+  struct sockaddr_in addr = {};
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(port);
+  inet_pton(AF_INET, ip.c_str(), &addr.sin_addr);
+  if (connect(sock.get(), reinterpret_cast<struct sockaddr*>(&addr),
+              sizeof addr) < 0) {
+    return ScopedSocket();
+  }
+  return sock;
+}
+
+}  // anonymous namespace
+
+TEST_F(SocketPoolTest, AvoidsDegradedAddress) {
+  int port = 0;
+  ScopedSocket healthy = Listen("127.0.0.1", 128, &port);
+  ASSERT_TRUE(healthy.valid());
+  // Not accepting, with full accept queue.
+  ScopedSocket degraded = Listen("127.0.0.2", 0, &port);
+  if (!degraded.valid()) {
+    LOG(WARNING) << "can't listen on 127.0.0.2:" << port;
+    return;
+  }
+  ScopedSocket pending = SaturateListener("127.0.0.2", port);
+  ASSERT_TRUE(pending.valid());
+
+  SocketPool pool("127.0.0.1", port);
+  ASSERT_TRUE(pool.IsInitialized());
+  // Resolved in this order, and not measured yet.
+  SetAddrs(&pool, {IPv4Addr("127.0.0.2", port), IPv4Addr("127.0.0.1", port)});
+  // Drains the socket opened by initialization.
+  ScopedSocket initial = pool.NewSocket();
+  ASSERT_TRUE(initial.valid());
+  ASSERT_EQ(0U, NumIdleSockets(pool));
+
+  // Connects to the degraded address first, but races with the healthy one.
+  SimpleTimer timer;
+  ScopedSocket sock = pool.NewSocket();
+  ASSERT_TRUE(sock.valid());
+  EXPECT_EQ("127.0.0.1", PeerName(sock));
+  EXPECT_LT(timer.GetDuration(), absl::Seconds(1));
+  EXPECT_LT(SmoothedRtt(pool, "127.0.0.1"), SmoothedRtt(pool, "127.0.0.2"));
+  // Slow, but not error.
+  EXPECT_FALSE(HasError(pool, "127.0.0.2"));
+
+  // Now the healthy address is tried first.
+  for (int i = 0; i < 3; ++i) {
+    timer.Start();
+    ScopedSocket s = pool.NewSocket();
+    ASSERT_TRUE(s.valid());
+    EXPECT_EQ("127.0.0.1", PeerName(s));
+    EXPECT_LT(timer.GetDuration(), absl::Seconds(1));
+  }
+}
+
+TEST_F(SocketPoolTest, LosingAddressIsNotPreferredOverMeasured) {
+  int port = 0;
+  ScopedSocket listener = Listen("127.0.0.1", 128, &port);
+  ASSERT_TRUE(listener.valid());
+
+  SocketPool pool("127.0.0.1", port);
+  ASSERT_TRUE(pool.IsInitialized());
+  SetAddrs(&pool, {IPv4Addr("127.0.0.2", port),
+                   IPv4Addr("127.0.0.1", port, absl::Milliseconds(20))});
+  ASSERT_EQ((std::vector<std::string>{"127.0.0.1", "127.0.0.2"}),
+            ConnectOrder(pool));
+
+  // 127.0.0.1 was slow this time, so 127.0.0.2 was tried after 40ms,
+  // and 127.0.0.1 connected 5ms later.  127.0.0.2 is not measured by this.
+  RecordConnectAttempts(
+      &pool, {{1, SocketPool::ConnectAttempt::CONNECTED,
+               absl::Milliseconds(45)},
+              {0, SocketPool::ConnectAttempt::CONNECTING,
+               absl::Milliseconds(5)}});
+  EXPECT_EQ(absl::InfiniteDuration(), SmoothedRtt(pool, "127.0.0.2"));
+  EXPECT_FALSE(HasError(pool, "127.0.0.2"));
+  EXPECT_EQ((std::vector<std::string>{"127.0.0.1", "127.0.0.2"}),
+            ConnectOrder(pool));
+
+  // Measured address that lost takes longer than the elapsed time at least.
+  RecordConnectAttempts(
+      &pool, {{0, SocketPool::ConnectAttempt::CONNECTED,
+               absl::Milliseconds(1)},
+              {1, SocketPool::ConnectAttempt::CONNECTING,
+               absl::Milliseconds(100)}});
+  EXPECT_GT(SmoothedRtt(pool, "127.0.0.1"), absl::Milliseconds(20));
+  EXPECT_EQ((std::vector<std::string>{"127.0.0.2", "127.0.0.1"}),
+            ConnectOrder(pool));
+}
+
+TEST_F(SocketPoolTest, ErrorAddressIsNotUsed) {
+  int port = 0;
+  ScopedSocket healthy = Listen("127.0.0.1", 128, &port);
+  ASSERT_TRUE(healthy.valid());
+
+  SocketPool pool("127.0.0.1", port);
+  ASSERT_TRUE(pool.IsInitialized());
+  // Nothing listens on 127.0.0.3, so connect will be refused.
+  SetAddrs(&pool, {IPv4Addr("127.0.0.3", port), IPv4Addr("127.0.0.1", port)});
+  ScopedSocket initial = pool.NewSocket();
+  ASSERT_TRUE(initial.valid());
+
+  ScopedSocket sock = pool.NewSocket();
+  ASSERT_TRUE(sock.valid());
+  EXPECT_EQ("127.0.0.1", PeerName(sock));
+  EXPECT_TRUE(HasError(pool, "127.0.0.3"));
+  EXPECT_FALSE(HasError(pool, "127.0.0.1"));
+}
+
+TEST_F(SocketPoolTest, Prewarm) {
+  int port = 0;
+  ScopedSocket listener = Listen("127.0.0.1", 128, &port);
+  ASSERT_TRUE(listener.valid());
+
+  SocketPool pool("127.0.0.1", port);
+  ASSERT_TRUE(pool.IsInitialized());
+  EXPECT_EQ(1U, NumIdleSockets(pool));
+
+  pool.Prewarm(4);
+  EXPECT_EQ(4U, NumIdleSockets(pool));
+  // Already warm.
+  pool.Prewarm(2);
+  EXPECT_EQ(4U, NumIdleSockets(pool));
+
+  std::vector<ScopedSocket> socks;
+  for (int i = 0; i < 4; ++i) {
+    socks.push_back(pool.NewSocket());
+    EXPECT_TRUE(socks.back().valid());
+  }
+  EXPECT_EQ(0U, NumIdleSockets(pool));
+}
+
+#endif  // _WIN32
+
+}  // namespace devtools_goma
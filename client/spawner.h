@@ -85,12 +85,19 @@ class Spawner {
   // Note: this feature only works on SpawnerPosix.
   void SetUmask(int32_t umask) { umask_ = umask; }
 
+  // If |direct| is true, the Spawner spawns the process without a monitor
+  // process if possible.  See SpawnerPosix.
+  // Note: this feature only works on SpawnerPosix.
+  void SetDirectSpawn(bool direct) { direct_spawn_ = direct; }
+
   // Spawns a child process.
   // On Success,
   // * returns spawned process id in SpawnerWin.
   // * returns a monitor process id that spawned |cmd| in SpawnerPosix.
   // Note: SpawnerPosix::Run first spawn a monitor process, and then monitor
   // process spawn a child process not to inherit signal handlers.
+  // With SetDirectSpawn(true), SpawnerPosix::Run may spawn |cmd| directly and
+  // return its process id.
   // Returns kInvalidPid on non fatal error, and dies with fatal error. |prog|
   // is a program name, |args| is its arguments, |envs| is its environment, and
   // |cwd| is a current working directory.
@@ -131,6 +138,7 @@ class Spawner {
  protected:
   Spawner() :
       console_output_(NULL), detach_(false), keep_env_(false), umask_(-1),
+      direct_spawn_(false),
       console_output_option_(MERGE_STDOUT_STDERR) {}
 
   std::string stdin_filename_, stdout_filename_, stderr_filename_;
@@ -138,6 +146,7 @@ class Spawner {
   bool detach_;
   bool keep_env_;
   int32_t umask_;
+  bool direct_spawn_;
   ConsoleOutputOption console_output_option_;
 
  private:
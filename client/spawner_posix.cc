@@ -59,6 +59,104 @@ void __attribute__((__noreturn__)) SubprocExitReport(
   _exit(exit_value);
 }
 
+#ifdef __linux__
+
+struct DirectSpawnParam {
+  const char* prog;
+  const char* dir;
+  char* const* argv;
+  char* const* envp;
+  int stdin_fd;
+  int stdout_fd;
+  int stderr_fd;
+  int umask;
+  // Close-on-exec fd to report failure before execve.
+  int exit_fd;
+};
+
+// Runs in a child process created by vfork(2).
+// The child process shares memory with the parent process, which is suspended
+// until execve(2) or _exit(2).  You can use only async-signal safe functions
+// here, and must not return.
+void __attribute__((__noreturn__)) ExecDirectChild(
+    const DirectSpawnParam& param) {
+  SubprocExit se;
+
+  // Signal handlers of the parent process must not run in this process,
+  // since memory is shared.  Reset them before unblocking signals.
+  // SIGINT and SIGTERM are also reset, as the monitor process does.
+  struct sigaction sa;
+  memset(&sa, 0, sizeof sa);
+  sa.sa_handler = SIG_DFL;
+  for (int sig = 1; sig < NSIG; ++sig) {
+    struct sigaction old_sa;
+    if (sigaction(sig, nullptr, &old_sa) != 0 ||
+        old_sa.sa_handler == SIG_DFL) {
+      continue;
+    }
+    if (old_sa.sa_handler == SIG_IGN && sig != SIGINT && sig != SIGTERM) {
+      continue;
+    }
+    sigaction(sig, &sa, nullptr);
+  }
+
+  if (param.stdin_fd >= 0 && dup2(param.stdin_fd, STDIN_FILENO) < 0) {
+    se.lineno = __LINE__ - 1;
+    se.last_errno = errno;
+    SubprocExitReport(param.exit_fd, se, 127);
+  }
+  if (param.stdout_fd >= 0 && dup2(param.stdout_fd, STDOUT_FILENO) < 0) {
+    se.lineno = __LINE__ - 1;
+    se.last_errno = errno;
+    SubprocExitReport(param.exit_fd, se, 127);
+  }
+  if (param.stderr_fd >= 0 && dup2(param.stderr_fd, STDERR_FILENO) < 0) {
+    se.lineno = __LINE__ - 1;
+    se.last_errno = errno;
+    SubprocExitReport(param.exit_fd, se, 127);
+  }
+  for (int i = STDERR_FILENO + 1; i < 256; ++i) {
+    if (i == param.exit_fd) {
+      continue;
+    }
+    close(i);
+  }
+
+  // Let spawned process has its own pid/pgid.
+  // The parent is suspended until execve, so it can kill the process group
+  // as soon as vfork returns.
+  if (setpgid(0, 0) < 0) {
+    se.lineno = __LINE__ - 1;
+    se.last_errno = errno;
+    SubprocExitReport(param.exit_fd, se, 127);
+  }
+  if (param.umask >= 0) {
+    umask(param.umask);
+  }
+  if (chdir(param.dir) < 0) {
+    se.lineno = __LINE__ - 1;
+    se.last_errno = errno;
+    SubprocExitReport(param.exit_fd, se, 127);
+  }
+
+  // Don't mask any signals in child process.
+  sigset_t sigmask;
+  sigemptyset(&sigmask);
+  if (sigprocmask(SIG_SETMASK, &sigmask, nullptr) != 0) {
+    se.lineno = __LINE__ - 1;
+    se.last_errno = errno;
+    SubprocExitReport(param.exit_fd, se, 127);
+  }
+
+  execve(param.prog, param.argv, param.envp);
+  // Exits with 127 as a shell does for a command failed to exec.
+  se.lineno = __LINE__ - 2;
+  se.last_errno = errno;
+  SubprocExitReport(param.exit_fd, se, 127);
+}
+
+#endif  // __linux__
+
 }  // namespace
 
 namespace devtools_goma {
@@ -66,6 +164,7 @@ namespace devtools_goma {
 SpawnerPosix::SpawnerPosix()
     : monitor_pid_(Spawner::kInvalidPid),
       prog_pid_(Spawner::kInvalidPid),
+      is_direct_(false),
       is_signaled_(false),
       sent_sig_(0),
       status_(kInvalidProcessStatus),
@@ -117,17 +216,6 @@ int SpawnerPosix::Run(const std::string& cmd,
     }
   }
 
-  // Pipe for passing SubprocExit information.
-  // pipe(7) says write(2) of less than PIPE_BUF bytes must be atomic.
-  int pipe_fd[2];
-  PCHECK(pipe(pipe_fd) == 0);
-  exit_fd_.reset(pipe_fd[0]);
-  ScopedFd child_exit_fd(pipe_fd[1]);
-  // Make another pipe. Use this for report pid.
-  PCHECK(pipe(pipe_fd) == 0);
-  ScopedFd exit_pid_fd(pipe_fd[0]);
-  ScopedFd child_pid_fd(pipe_fd[1]);
-
   // We can't use posix_spawn, because we'd like to control
   // current directory of each subprocess.
   const char* dir = cwd.c_str();
@@ -148,6 +236,23 @@ int SpawnerPosix::Run(const std::string& cmd,
   envp.push_back(tmpdir_env.c_str());
   envp.push_back(nullptr);
 
+#ifdef __linux__
+  if (direct_spawn_ && !detach_) {
+    return RunDirect(prog, dir, argvp, envp, stdin_fd, stdout_fd, stderr_fd);
+  }
+#endif
+
+  // Pipe for passing SubprocExit information.
+  // pipe(7) says write(2) of less than PIPE_BUF bytes must be atomic.
+  int pipe_fd[2];
+  PCHECK(pipe(pipe_fd) == 0);
+  exit_fd_.reset(pipe_fd[0]);
+  ScopedFd child_exit_fd(pipe_fd[1]);
+  // Make another pipe. Use this for report pid.
+  PCHECK(pipe(pipe_fd) == 0);
+  ScopedFd exit_pid_fd(pipe_fd[0]);
+  ScopedFd child_pid_fd(pipe_fd[1]);
+
   // SubprocessImpl will try to send SIGINT or SIGTERM to kill the subprocess
   // but ignore them in this process. This process will wait for child process
   // termination (child process will be killed by SIGINT or SIGTERM to
@@ -332,6 +437,74 @@ int SpawnerPosix::Run(const std::string& cmd,
   return monitor_pid_;
 }
 
+int SpawnerPosix::RunDirect(const char* prog,
+                            const char* dir,
+                            const std::vector<const char*>& argvp,
+                            const std::vector<const char*>& envp,
+                            const ScopedFd& stdin_fd,
+                            const ScopedFd& stdout_fd,
+                            const ScopedFd& stderr_fd) {
+#ifdef __linux__
+  // Pipe for passing SubprocExit information if it failed to exec.
+  // The child's end is closed by execve on success.
+  int pipe_fd[2];
+  PCHECK(pipe2(pipe_fd, O_CLOEXEC) == 0);
+  ScopedFd exit_fd(pipe_fd[0]);
+  ScopedFd child_exit_fd(pipe_fd[1]);
+
+  DirectSpawnParam param;
+  param.prog = prog;
+  param.dir = dir;
+  param.argv = const_cast<char* const*>(&argvp[0]);
+  param.envp = const_cast<char* const*>(&envp[0]);
+  param.stdin_fd = stdin_fd.fd();
+  param.stdout_fd = stdout_fd.fd();
+  param.stderr_fd = stderr_fd.fd();
+  param.umask = umask_;
+  param.exit_fd = child_exit_fd.fd();
+
+  // Block all signals, so no signal handler runs in the child process
+  // until it resets signal handlers.
+  sigset_t sigset;
+  sigset_t old_sigset;
+  sigfillset(&sigset);
+  PCHECK(sigprocmask(SIG_BLOCK, &sigset, &old_sigset) == 0);
+  pid_t pid = vfork();
+  if (pid == 0) {
+    ExecDirectChild(param);
+  }
+  PCHECK(sigprocmask(SIG_SETMASK, &old_sigset, nullptr) == 0);
+  if (pid < 0) {
+    PLOG(ERROR) << "vfork failed. pid=" << pid;
+    monitor_pid_ = Spawner::kInvalidPid;
+    return Spawner::kInvalidPid;
+  }
+  // close writer (otherwise read(2) will be blocked)
+  child_exit_fd.Close();
+
+  // The child process has already called execve or _exit here.
+  SubprocExit se;
+  int r = read(exit_fd.fd(), &se, sizeof(se));
+  if (r == sizeof(se)) {
+    // Wait will get exit status 127.
+    LOG(WARNING) << "subproc abort: pid=" << pid << " at "
+                 << __FILE__ << ":" << se.lineno
+                 << " err=" << strerror(se.last_errno) << "["
+                 << se.last_errno << "]";
+  } else if (r != 0) {
+    PLOG(ERROR) << "read SubprocExit: pid=" << pid << " ret=" << r;
+  }
+
+  is_direct_ = true;
+  monitor_pid_ = pid;
+  prog_pid_ = pid;
+  return pid;
+#else
+  LOG(FATAL) << "direct spawn is not supported";
+  return Spawner::kInvalidPid;
+#endif
+}
+
 Spawner::ProcessStatus SpawnerPosix::Kill() {
   int sig = SIGINT;
   CHECK_NE(monitor_pid_, Spawner::kInvalidPid)
@@ -369,12 +542,16 @@ Spawner::ProcessStatus SpawnerPosix::Kill() {
 }
 
 SpawnerPosix::ProcessStatus SpawnerPosix::Wait(WaitPolicy wait_policy) {
+  std::string sig_source;
   if (monitor_pid_ != Spawner::kInvalidPid) {
     const bool need_kill = (wait_policy == NEED_KILL);
     const int waitpid_options = (wait_policy == WAIT_INFINITE) ? 0 : WNOHANG;
     int r;
     int status = -1;
-    while ((r = waitpid(monitor_pid_, &status, waitpid_options)) == -1) {
+    // Resource usage of the spawned process if |is_direct_|.
+    struct rusage ru;
+    memset(&ru, 0, sizeof(ru));
+    while ((r = wait4(monitor_pid_, &status, waitpid_options, &ru)) == -1) {
       if (errno == EINTR) {
         // Retry after 10 milliseconds wait.
         absl::SleepFor(absl::Milliseconds(10));
@@ -400,7 +577,7 @@ SpawnerPosix::ProcessStatus SpawnerPosix::Wait(WaitPolicy wait_policy) {
       CHECK_EQ(ProcessStatus::RUNNING, Kill())
           << "Should not call Kill when monitor process is not running.";
 
-      while ((r = waitpid(monitor_pid_, &status, 0)) == -1) {
+      while ((r = wait4(monitor_pid_, &status, 0, &ru)) == -1) {
         if (errno == EINTR) {
           // Retry after 10 milliseconds wait.
           absl::SleepFor(absl::Milliseconds(10));
@@ -424,12 +601,12 @@ SpawnerPosix::ProcessStatus SpawnerPosix::Wait(WaitPolicy wait_policy) {
                 << " WEXITSTATUS=" << WEXITSTATUS(status);
     } else if (r == monitor_pid_) {
       // monitor changed the status.
-      CHECK(WIFEXITED(status))
+      CHECK(is_direct_ || WIFEXITED(status))
           << "unexpected waitpid status:"
           << " status=" << status << " monitor_pid=" << monitor_pid_
           << " prog_pid=" << prog_pid_;
 
-      if (WEXITSTATUS(status) != 0) {
+      if (!is_direct_ && WEXITSTATUS(status) != 0) {
         LOG(ERROR) << "monitor process died with non-zero exit status,"
                    << " exit_status=" << WEXITSTATUS(status)
                    << " status=" << status;
@@ -444,9 +621,12 @@ SpawnerPosix::ProcessStatus SpawnerPosix::Wait(WaitPolicy wait_policy) {
                  << " monitor_pid=" << monitor_pid_
                  << " prog_pid=" << prog_pid_;
     }
+    if (is_direct_) {
+      process_mem_kb_ = ru.ru_maxrss;
+      SetProgStatus(status, &sig_source);
+    }
   }
 
-  std::string sig_source;
   if (exit_fd_.valid()) {
     SubprocExit se;
     int r = read(exit_fd_.fd(), &se, sizeof(se));
@@ -459,32 +639,14 @@ SpawnerPosix::ProcessStatus SpawnerPosix::Wait(WaitPolicy wait_policy) {
       }
       process_mem_kb_ = se.ru.ru_maxrss;
       if (se.status != kInvalidProcessStatus) {
-        if (WIFSIGNALED(se.status)) {
-          signal_ = WTERMSIG(se.status);
-          sig_source = "wtermsig";
-          status_ = 1;
-        } else if (WIFEXITED(se.status)) {
-          sig_source = "subproc_exit";
-          status_ = WEXITSTATUS(se.status);
-        } else {
-          LOG(FATAL) << "Unexpected status from subproc."
-                     << " monitor_pid=" << monitor_pid_
-                     << " prog_pid=" << prog_pid_ << " status=" << se.status;
-        }
-      }
-
-      if (signal_ != 0 && signal_ != sent_sig_) {
-        LOG(ERROR) << "subproc was terminated unexpectedly."
-                   << " monitor_pid=" << monitor_pid_
-                   << " sent_sig=" << sent_sig_ << " prog_pid=" << prog_pid_
-                   << " signal=" << signal_ << " status=" << se.status;
+        SetProgStatus(se.status, &sig_source);
       }
     } else {
       sig_source = "exit_fd_read_err";
       PLOG(ERROR) << "read SubprocExit:"
                   << " monitor_pid=" << monitor_pid_ << " ret=" << r;
     }
-  } else {
+  } else if (!is_direct_) {
     sig_source = "exit_fd_invalid";
   }
   if (console_output_) {
@@ -500,6 +662,28 @@ SpawnerPosix::ProcessStatus SpawnerPosix::Wait(WaitPolicy wait_policy) {
   return ProcessStatus::EXITED;
 }
 
+void SpawnerPosix::SetProgStatus(int status, std::string* sig_source) {
+  if (WIFSIGNALED(status)) {
+    signal_ = WTERMSIG(status);
+    *sig_source = "wtermsig";
+    status_ = 1;
+  } else if (WIFEXITED(status)) {
+    *sig_source = "subproc_exit";
+    status_ = WEXITSTATUS(status);
+  } else {
+    LOG(FATAL) << "Unexpected status from subproc."
+               << " monitor_pid=" << monitor_pid_
+               << " prog_pid=" << prog_pid_ << " status=" << status;
+  }
+
+  if (signal_ != 0 && signal_ != sent_sig_) {
+    LOG(ERROR) << "subproc was terminated unexpectedly."
+               << " monitor_pid=" << monitor_pid_
+               << " sent_sig=" << sent_sig_ << " prog_pid=" << prog_pid_
+               << " signal=" << signal_ << " status=" << status;
+  }
+}
+
 bool SpawnerPosix::IsChildRunning() const {
   return monitor_pid_ != Spawner::kInvalidPid &&
          status_ == kInvalidProcessStatus;
@@ -19,6 +19,12 @@ namespace devtools_goma {
 
 // A subclass of Spawner for POSIX.
 // It spawns a process internally to capture child process' output.
+//
+// With SetDirectSpawn(true), it spawns |cmd| directly with vfork(2) on Linux,
+// i.e. clone(CLONE_VM|CLONE_VFORK), instead of fork(2) of a monitor process,
+// to avoid copying page tables of the caller.  The spawned process gets the
+// same fds, signal dispositions, signal mask, rlimits and process group as
+// via the monitor process.  Detached processes still use a monitor process.
 class SpawnerPosix : public Spawner {
  public:
   SpawnerPosix();
@@ -38,15 +44,30 @@ class SpawnerPosix : public Spawner {
   int ChildTermSignal() const override { return signal_; }
   int prog_pid() const { return prog_pid_; }
   int monitor_pid() const { return monitor_pid_; }
+  // Returns true if |cmd| was spawned without a monitor process.
+  bool is_direct() const { return is_direct_; }
 
  private:
+  int RunDirect(const char* prog,
+                const char* dir,
+                const std::vector<const char*>& argvp,
+                const std::vector<const char*>& envp,
+                const ScopedFd& stdin_fd,
+                const ScopedFd& stdout_fd,
+                const ScopedFd& stderr_fd);
+  // Sets status_ and signal_ from |status| of waitpid(2) for the spawned
+  // process.
+  void SetProgStatus(int status, std::string* sig_source);
+
   // Process id monitoring spawned process.
+  // Same as |prog_pid_| if |is_direct_|.
   pid_t monitor_pid_;
 
   // Process id spawned by |cmd| in Run.
   pid_t prog_pid_;
 
   ScopedFd exit_fd_;
+  bool is_direct_;
   bool is_signaled_;
   int sent_sig_;
   SimpleTimer sig_timer_;
@@ -4,12 +4,56 @@
 
 #include "spawner_posix.h"
 
+#include <signal.h>
+#include <string.h>
 #include <unistd.h>
 
+#include "absl/strings/str_cat.h"
+#include "basictypes.h"
 #include "gtest/gtest.h"
+#include "scoped_fd.h"
 
 namespace devtools_goma {
 
+namespace {
+
+// Ignores and blocks |signum| in the scope, and restores its disposition
+// and the signal mask on exit, even if an assertion failed.
+class ScopedIgnoreAndBlockSignal {
+ public:
+  explicit ScopedIgnoreAndBlockSignal(int signum) : signum_(signum) {
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = SIG_IGN;
+    action_saved_ = sigaction(signum_, &sa, &old_sa_) == 0;
+    sigset_t sigset;
+    sigemptyset(&sigset);
+    sigaddset(&sigset, signum_);
+    mask_saved_ = sigprocmask(SIG_BLOCK, &sigset, &old_sigset_) == 0;
+  }
+  ~ScopedIgnoreAndBlockSignal() {
+    if (mask_saved_) {
+      sigprocmask(SIG_SETMASK, &old_sigset_, nullptr);
+    }
+    if (action_saved_) {
+      sigaction(signum_, &old_sa_, nullptr);
+    }
+  }
+
+  bool ok() const { return action_saved_ && mask_saved_; }
+
+ private:
+  const int signum_;
+  struct sigaction old_sa_;
+  sigset_t old_sigset_;
+  bool action_saved_ = false;
+  bool mask_saved_ = false;
+
+  DISALLOW_COPY_AND_ASSIGN(ScopedIgnoreAndBlockSignal);
+};
+
+}  // namespace
+
 TEST(SpawnerPosix, RunTrueTest) {
   SpawnerPosix spawner;
 #ifdef __MACH__
@@ -133,4 +177,132 @@ TEST(SpawnerPosix, RunDetachTest) {
   EXPECT_NE(detached_sid, mysid);
 }
 
+#ifdef __linux__
+
+TEST(SpawnerPosix, RunDirectTrueTest) {
+  SpawnerPosix spawner;
+  spawner.SetDirectSpawn(true);
+  const std::vector<std::string> args{"/bin/true"};
+  const std::vector<std::string> envs;
+  const int pid = spawner.Run(args[0], args, envs, ".");
+  EXPECT_NE(Spawner::kInvalidPid, pid);
+  EXPECT_TRUE(spawner.is_direct());
+  EXPECT_EQ(pid, spawner.prog_pid());
+  EXPECT_EQ(pid, spawner.monitor_pid());
+
+  EXPECT_EQ(Spawner::ProcessStatus::EXITED,
+            spawner.Wait(Spawner::WAIT_INFINITE));
+
+  EXPECT_FALSE(spawner.IsChildRunning());
+  EXPECT_FALSE(spawner.IsSignaled());
+  EXPECT_EQ(0, spawner.ChildStatus());
+  EXPECT_GT(spawner.ChildMemKb(), 0);
+}
+
+TEST(SpawnerPosix, RunDirectFalseTest) {
+  SpawnerPosix spawner;
+  spawner.SetDirectSpawn(true);
+  const std::vector<std::string> args{"/bin/false"};
+  const std::vector<std::string> envs;
+  EXPECT_NE(Spawner::kInvalidPid, spawner.Run(args[0], args, envs, "."));
+
+  EXPECT_EQ(Spawner::ProcessStatus::EXITED,
+            spawner.Wait(Spawner::WAIT_INFINITE));
+
+  EXPECT_FALSE(spawner.IsChildRunning());
+  EXPECT_EQ(1, spawner.ChildStatus());
+  EXPECT_FALSE(spawner.IsSignaled());
+}
+
+TEST(SpawnerPosix, RunDirectMissingTest) {
+  SpawnerPosix spawner;
+  spawner.SetDirectSpawn(true);
+  const std::string non_existent_path = "/path/should/not/exist";
+  ASSERT_NE(0, access(non_existent_path.c_str(), F_OK));
+  const std::vector<std::string> args { non_existent_path };
+  const std::vector<std::string> envs;
+  EXPECT_NE(Spawner::kInvalidPid, spawner.Run(args[0], args, envs, "."));
+
+  EXPECT_EQ(Spawner::ProcessStatus::EXITED,
+            spawner.Wait(Spawner::WAIT_INFINITE));
+
+  EXPECT_FALSE(spawner.IsChildRunning());
+  EXPECT_EQ(127, spawner.ChildStatus());
+  EXPECT_FALSE(spawner.IsSignaled());
+}
+
+TEST(SpawnerPosix, RunDirectKillTest) {
+  SpawnerPosix spawner;
+  spawner.SetDirectSpawn(true);
+  const std::vector<std::string> args{"/bin/sleep", "10"};
+  const std::vector<std::string> envs;
+  const int pid = spawner.Run(args[0], args, envs, ".");
+  EXPECT_NE(Spawner::kInvalidPid, pid);
+
+  // Spawned process has its own process group.
+  EXPECT_EQ(pid, getpgid(pid));
+
+  EXPECT_EQ(Spawner::ProcessStatus::RUNNING, spawner.Wait(Spawner::NO_HANG));
+
+  EXPECT_EQ(Spawner::ProcessStatus::RUNNING, spawner.Kill());
+  EXPECT_EQ(Spawner::ProcessStatus::EXITED,
+            spawner.Wait(Spawner::WAIT_INFINITE));
+
+  EXPECT_FALSE(spawner.IsChildRunning());
+  EXPECT_EQ(1, spawner.ChildStatus());
+
+  EXPECT_TRUE(spawner.IsSignaled());
+  EXPECT_EQ(SIGINT, spawner.ChildTermSignal());
+}
+
+TEST(SpawnerPosix, RunDirectSignalMaskTest) {
+  // SIGINT is reset to default and unblocked in the spawned process,
+  // even if it is ignored and blocked in the caller.
+  ScopedIgnoreAndBlockSignal ignore_sigint(SIGINT);
+  ASSERT_TRUE(ignore_sigint.ok());
+
+  SpawnerPosix spawner;
+  spawner.SetDirectSpawn(true);
+  const std::vector<std::string> args{"/bin/sleep", "10"};
+  const std::vector<std::string> envs;
+  EXPECT_NE(Spawner::kInvalidPid, spawner.Run(args[0], args, envs, "."));
+  EXPECT_EQ(Spawner::ProcessStatus::EXITED, spawner.Wait(Spawner::NEED_KILL));
+  EXPECT_EQ(SIGINT, spawner.ChildTermSignal());
+}
+
+TEST(SpawnerPosix, RunDirectCwdUmaskTest) {
+  SpawnerPosix spawner;
+  spawner.SetDirectSpawn(true);
+  spawner.SetUmask(027);
+  std::string output;
+  spawner.SetConsoleOutputBuffer(&output, Spawner::MERGE_STDOUT_STDERR);
+  // fd opened in the caller is not inherited.
+  ScopedFd fd(dup(STDERR_FILENO));
+  ASSERT_TRUE(fd.valid());
+  const std::vector<std::string> args{
+      "/bin/sh", "-c",
+      absl::StrCat("umask; pwd; test -e /proc/$$/fd/", fd.fd(),
+                   " || echo closed")};
+  const std::vector<std::string> envs;
+  EXPECT_NE(Spawner::kInvalidPid, spawner.Run(args[0], args, envs, "/"));
+  EXPECT_EQ(Spawner::ProcessStatus::EXITED,
+            spawner.Wait(Spawner::WAIT_INFINITE));
+  EXPECT_EQ(0, spawner.ChildStatus());
+  EXPECT_EQ("0027\n/\n", output.substr(0, 7));
+  EXPECT_NE(std::string::npos, output.find("closed\n")) << output;
+}
+
+TEST(SpawnerPosix, RunDirectDetachTest) {
+  SpawnerPosix spawner;
+  spawner.SetDirectSpawn(true);
+  spawner.SetDetach(true);
+  const std::vector<std::string> args{"/bin/true"};
+  const std::vector<std::string> envs;
+  EXPECT_NE(Spawner::kInvalidPid, spawner.Run(args[0], args, envs, "."));
+  // Detached process is spawned via monitor process.
+  EXPECT_FALSE(spawner.is_direct());
+}
+
+#endif  // __linux__
+
 }  // namespace devtools_goma
@@ -0,0 +1,54 @@
+// Copyright 2020 The Goma Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "stored_file_chunk_cache.h"
+
+#include "autolock_timer.h"
+#include "glog/logging.h"
+
+namespace devtools_goma {
+
+StoredFileChunkCache* StoredFileChunkCache::instance_;
+
+/* static */
+void StoredFileChunkCache::Init(size_t max_entries) {
+  CHECK(instance_ == nullptr);
+  if (max_entries == 0) {
+    return;
+  }
+  instance_ = new StoredFileChunkCache(max_entries);
+}
+
+/* static */
+void StoredFileChunkCache::Quit() {
+  delete instance_;
+  instance_ = nullptr;
+}
+
+bool StoredFileChunkCache::Lookup(const std::string& hash_key) {
+  AUTOLOCK(lock, &mu_);
+  auto it = hash_keys_.find(hash_key);
+  if (it == hash_keys_.end()) {
+    missed_.Add(1);
+    return false;
+  }
+  hash_keys_.MoveToBack(it);
+  hit_.Add(1);
+  return true;
+}
+
+void StoredFileChunkCache::Insert(const std::string& hash_key) {
+  AUTOLOCK(lock, &mu_);
+  hash_keys_.emplace_back(hash_key, true);
+  while (hash_keys_.size() > max_entries_) {
+    hash_keys_.pop_front();
+  }
+}
+
+size_t StoredFileChunkCache::size() const {
+  AUTOLOCK(lock, &mu_);
+  return hash_keys_.size();
+}
+
+}  // namespace devtools_goma
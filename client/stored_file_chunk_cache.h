@@ -0,0 +1,68 @@
+// Copyright 2020 The Goma Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#ifndef DEVTOOLS_GOMA_CLIENT_STORED_FILE_CHUNK_CACHE_H_
+#define DEVTOOLS_GOMA_CLIENT_STORED_FILE_CHUNK_CACHE_H_
+
+#include <string>
+
+#include "absl/base/thread_annotations.h"
+#include "atomic_stats_counter.h"
+#include "basictypes.h"
+#include "linked_unordered_map.h"
+#include "lockhelper.h"
+
+namespace devtools_goma {
+
+// StoredFileChunkCache remembers hash keys of FILE_CHUNK blobs that were
+// stored in file service by this compiler_proxy, so that unchanged chunks
+// of a large file are not uploaded again when the file is modified
+// (e.g. an object file or a static library rebuilt with small changes).
+//
+// Since the hash key of a chunk covers its offset, only chunks at the same
+// offset with the same content are deduped.
+//
+// If the least recently used entry exceeds |max_entries|, it is evicted.
+//
+// This class is thread-safe.
+class StoredFileChunkCache {
+ public:
+  static StoredFileChunkCache* instance() { return instance_; }
+  static bool IsEnabled() { return instance_ != nullptr; }
+
+  // Initializes StoredFileChunkCache. Does nothing if |max_entries| is 0.
+  static void Init(size_t max_entries);
+  static void Quit();
+
+  // Returns true if a chunk of |hash_key| has been stored.
+  bool Lookup(const std::string& hash_key);
+
+  // Records that a chunk of |hash_key| has been stored.
+  void Insert(const std::string& hash_key);
+
+  size_t size() const;
+  int64_t hit() const { return hit_.value(); }
+  int64_t missed() const { return missed_.value(); }
+
+ private:
+  explicit StoredFileChunkCache(size_t max_entries)
+      : max_entries_(max_entries) {}
+
+  static StoredFileChunkCache* instance_;
+
+  const size_t max_entries_;
+
+  StatsCounter hit_;
+  StatsCounter missed_;
+
+  mutable Lock mu_;
+  // value is not used.
+  LinkedUnorderedMap<std::string, bool> hash_keys_ ABSL_GUARDED_BY(mu_);
+
+  DISALLOW_COPY_AND_ASSIGN(StoredFileChunkCache);
+};
+
+}  // namespace devtools_goma
+
+#endif  // DEVTOOLS_GOMA_CLIENT_STORED_FILE_CHUNK_CACHE_H_
@@ -54,7 +54,9 @@ SubProcessController::Options::Options()
     : max_subprocs(kMaxSubProcs),
       max_subprocs_low_priority(kMaxSubProcsForLowPriority),
       max_subprocs_heavy_weight(kMaxSubProcsForHeavyWeight),
-      dont_kill_subprocess(false) {
+      dont_kill_subprocess(false),
+      resource_aware_scheduling(false),
+      direct_spawn(false) {
 }
 
 std::string SubProcessController::Options::DebugString() const {
@@ -62,7 +64,9 @@ std::string SubProcessController::Options::DebugString() const {
   ss << " max_subprocs=" << max_subprocs
      << " max_subprocs_low_priority=" << max_subprocs_low_priority
      << " max_subprocs_heavy_weight=" << max_subprocs_heavy_weight
-     << " dont_kill_subprocess=" << dont_kill_subprocess;
+     << " dont_kill_subprocess=" << dont_kill_subprocess
+     << " resource_aware_scheduling=" << resource_aware_scheduling
+     << " direct_spawn=" << direct_spawn;
   return ss.str();
 }
 
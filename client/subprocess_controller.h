@@ -60,6 +60,12 @@ class SubProcessController {
     int max_subprocs_low_priority;
     int max_subprocs_heavy_weight;
     bool dont_kill_subprocess;
+    // If true, subprocesses are also deferred by memory and CPU pressure
+    // of the host.  See LocalResourceScheduler.
+    bool resource_aware_scheduling;
+    // If true, subprocesses are spawned without a monitor process if
+    // possible.  See SpawnerPosix.
+    bool direct_spawn;
 
     std::string DebugString() const;
   };
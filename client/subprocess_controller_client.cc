@@ -28,6 +28,7 @@
 #include "glog/stl_logging.h"
 MSVC_PUSH_DISABLE_WARNING_FOR_PROTO()
 #include "client/subprocess.pb.h"
+#include "lib/goma_stats.pb.h"
 MSVC_POP_WARNING()
 #include "subprocess_task.h"
 #include "worker_thread.h"
@@ -339,6 +340,9 @@ void SubProcessControllerClient::Started(
   SubProcessTask* task = nullptr;
   {
     AUTOLOCK(lock, &mu_);
+    if (started->has_scheduler_stats()) {
+      scheduler_stats_ = started->scheduler_stats();
+    }
     std::map<int, SubProcessTask*>::iterator found =
         subproc_tasks_.find(id);
     if (found != subproc_tasks_.end()) {
@@ -425,6 +429,19 @@ int SubProcessControllerClient::NumPending() const {
   return num_pending;
 }
 
+void SubProcessControllerClient::DumpStatsToProto(
+    SubProcessStats* stats) const {
+  AUTOLOCK(lock, &mu_);
+  if (!scheduler_stats_.has_heavy_weight_mem_kb()) {
+    return;
+  }
+  stats->set_count_deferred_by_memory(
+      scheduler_stats_.count_deferred_by_memory());
+  stats->set_count_deferred_by_cpu(scheduler_stats_.count_deferred_by_cpu());
+  stats->set_heavy_weight_mem_kb(scheduler_stats_.heavy_weight_mem_kb());
+  stats->set_light_weight_mem_kb(scheduler_stats_.light_weight_mem_kb());
+}
+
 bool SubProcessControllerClient::BelongsToCurrentThread() const {
   return THREAD_ID_IS_SELF(thread_id_);
 }
@@ -11,14 +11,19 @@
 #include <string>
 
 #include "basictypes.h"
+#include "compiler_specific.h"
 #include "lockhelper.h"
 #include "scoped_fd.h"
 #include "subprocess_controller.h"
 #include "worker_thread.h"
+MSVC_PUSH_DISABLE_WARNING_FOR_PROTO()
+#include "client/subprocess.pb.h"
+MSVC_POP_WARNING()
 #include "worker_thread_manager.h"
 
 namespace devtools_goma {
 
+class SubProcessStats;
 class SubProcessTask;
 
 // SubPrcessControllerClient runs in multi-thread mode, and communicates
@@ -60,6 +65,9 @@ class SubProcessControllerClient: public SubProcessController {
 
   int NumPending() const;
 
+  // Dumps stats of resource aware scheduling in the server.
+  void DumpStatsToProto(SubProcessStats* stats) const ABSL_LOCKS_EXCLUDED(mu_);
+
   bool BelongsToCurrentThread() const;
 
   std::string DebugString() const;
@@ -112,6 +120,8 @@ class SubProcessControllerClient: public SubProcessController {
   int next_id_ ABSL_GUARDED_BY(mu_);
   std::map<int, SubProcessTask*> subproc_tasks_ ABSL_GUARDED_BY(mu_);
   Options current_options_ ABSL_GUARDED_BY(mu_);
+  // The latest stats reported by the server.
+  SubProcessSchedulerStats scheduler_stats_ ABSL_GUARDED_BY(mu_);
   PeriodicClosureId periodic_closure_id_ ABSL_GUARDED_BY(mu_);
   bool quit_ ABSL_GUARDED_BY(mu_);
   bool closed_ ABSL_GUARDED_BY(mu_);
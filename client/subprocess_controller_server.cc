@@ -18,6 +18,7 @@
 #include <unistd.h>
 #endif
 
+#include "absl/memory/memory.h"
 #include "absl/time/clock.h"
 #include "absl/time/time.h"
 #include "compiler_specific.h"
@@ -25,6 +26,7 @@
 #include "glog/logging.h"
 #include "glog/stl_logging.h"
 #include "ioutil.h"
+#include "machine_info.h"
 #include "path.h"
 #include "platform_thread.h"
 #include "subprocess_impl.h"
@@ -52,6 +54,10 @@ static const int kIdleIntervalMilliSec = 500;
 static const int kWaitIntervalMilliSec = 5;
 #endif
 
+// Interval to read resource pressure for resource aware scheduling.
+static constexpr absl::Duration kResourcePressureUpdateInterval =
+    absl::Seconds(1);
+
 #ifndef _WIN32
 // siginfo is passed from signal handler to SubProcessControllerServer loop.
 static int g_signal_fd;
@@ -75,6 +81,12 @@ SubProcessControllerServer::SubProcessControllerServer(
       options_(std::move(options)) {
   LOG(INFO) << "SubProcessControllerServer started fd=" << sock_fd
             << " " << options_.DebugString();
+  if (options_.resource_aware_scheduling) {
+    LocalResourceScheduler::Options scheduler_options;
+    scheduler_options.num_cpus = GetNumCPUs();
+    resource_scheduler_ =
+        absl::make_unique<LocalResourceScheduler>(scheduler_options);
+  }
 #ifdef _WIN32
   SpawnerWin::Setup();
 #endif
@@ -209,7 +221,8 @@ void SubProcessControllerServer::Register(std::unique_ptr<SubProcessReq> req) {
   VLOG(1) << "id=" << req->id() << " Kill? " << req->trace_id()
           << " prog=" << req->prog()
           << " dont_kill=" << dont_kill;
-  SubProcessImpl* s = new SubProcessImpl(*req, dont_kill);
+  SubProcessImpl* s =
+      new SubProcessImpl(*req, dont_kill, options_.direct_spawn);
   CHECK(subprocs_.insert(std::make_pair(req->id(), s)).second);
   TrySpawnSubProcess();
 }
@@ -310,6 +323,14 @@ void SubProcessControllerServer::Terminated(
       << "id=" << terminated->id() << " Terminated"
       << " status=" << terminated->status();
 
+  if (resource_scheduler_ != nullptr) {
+    auto found = subprocs_.find(terminated->id());
+    if (found != subprocs_.end()) {
+      resource_scheduler_->OnTerminated(terminated->id(),
+                                        found->second->req().weight(),
+                                        terminated->mem_kb());
+    }
+  }
   subprocs_.erase(terminated->id());
   SendNotify(SubProcessController::TERMINATED, *terminated);
 
@@ -402,17 +423,89 @@ void SubProcessControllerServer::TrySpawnSubProcess() {
     VLOG(1) << "candidate priority is low";
     return;
   }
+  if (!AdmitByResource(*candidate, running)) {
+    return;
+  }
   std::unique_ptr<SubProcessStarted> started(candidate->Spawn());
   if (started != nullptr) {
+    if (resource_scheduler_ != nullptr) {
+      DumpSchedulerStats(started->mutable_scheduler_stats());
+    }
     Started(std::move(started));
     return;
   }
   if (candidate->req().detach()) {
+    if (resource_scheduler_ != nullptr) {
+      resource_scheduler_->OnTerminated(candidate->req().id(),
+                                        candidate->req().weight(), -1);
+    }
     return;
   }
   ErrorTerminate(candidate->req().id(), SubProcessTerminated::kFailedToSpawn);
 }
 
+bool SubProcessControllerServer::AdmitByResource(
+    const SubProcessImpl& candidate, int running) {
+  if (resource_scheduler_ == nullptr ||
+      candidate.req().priority() == SubProcessReq::HIGHEST_PRIORITY) {
+    return true;
+  }
+  MaybeUpdateResourcePressure();
+  LocalResourceScheduler::Decision decision =
+      resource_scheduler_->Admit(candidate.req().id(),
+                                 candidate.req().weight(), running);
+  if (decision == LocalResourceScheduler::ADMIT) {
+    return true;
+  }
+  if (last_deferred_id_ != candidate.req().id() ||
+      last_deferred_decision_ != decision) {
+    last_deferred_id_ = candidate.req().id();
+    last_deferred_decision_ = decision;
+    if (decision == LocalResourceScheduler::DEFER_BY_MEMORY) {
+      ++count_deferred_by_memory_;
+    } else {
+      ++count_deferred_by_cpu_;
+    }
+    LOG(INFO) << "id=" << candidate.req().id() << " "
+              << LocalResourceScheduler::DecisionName(decision)
+              << " running=" << running << " "
+              << resource_scheduler_->DebugString();
+  }
+  return false;
+}
+
+void SubProcessControllerServer::MaybeUpdateResourcePressure() {
+  const absl::Time now = absl::Now();
+  if (now - last_pressure_update_ < kResourcePressureUpdateInterval) {
+    return;
+  }
+  last_pressure_update_ = now;
+  resource_scheduler_->UpdatePressure(ReadResourcePressure());
+  for (const auto& it : subprocs_) {
+    const SubProcessImpl& s = *it.second;
+    if (s.state() == SubProcessState::RUN && s.started().pid() > 0) {
+      resource_scheduler_->UpdateReservation(
+          it.first, ReadProcessRssKb(s.started().pid()));
+    }
+  }
+  VLOG(1) << "resource pressure: " << resource_scheduler_->DebugString();
+}
+
+void SubProcessControllerServer::DumpSchedulerStats(
+    SubProcessSchedulerStats* stats) const {
+  stats->set_count_deferred_by_memory(count_deferred_by_memory_);
+  stats->set_count_deferred_by_cpu(count_deferred_by_cpu_);
+  stats->set_heavy_weight_mem_kb(
+      resource_scheduler_->EstimatedMemKb(SubProcessReq::HEAVY_WEIGHT));
+  stats->set_light_weight_mem_kb(
+      resource_scheduler_->EstimatedMemKb(SubProcessReq::LIGHT_WEIGHT));
+  const ResourcePressure& pressure = resource_scheduler_->pressure();
+  stats->set_cpu_some_avg10(pressure.cpu_some_avg10);
+  stats->set_memory_some_avg10(pressure.memory_some_avg10);
+  stats->set_loadavg1(pressure.loadavg1);
+  stats->set_available_mem_kb(pressure.available_mem_kb);
+}
+
 void SubProcessControllerServer::ErrorTerminate(
     int id, SubProcessTerminated_ErrorTerminate reason) {
   VLOG(1) << "id=" << id << " ErrorTerminate";
@@ -566,6 +659,10 @@ void SubProcessControllerServer::DoTimeout() {
   // task in kWaitIntervalMilliSec.
   if (!in_signaled)
     timeout_millisec_ = kIdleIntervalMilliSec;
+  // A subprocess deferred by resource pressure may start now.
+  if (resource_scheduler_ != nullptr && !shutdowned_) {
+    TrySpawnSubProcess();
+  }
 }
 
 }  // namespace devtools_goma
@@ -16,10 +16,12 @@
 #include "basictypes.h"
 #include "scoped_fd.h"
 #endif
+#include "absl/time/time.h"
 #include "compiler_specific.h"
 MSVC_PUSH_DISABLE_WARNING_FOR_PROTO()
 #include "client/subprocess.pb.h"
 MSVC_POP_WARNING()
+#include "local_resource_scheduler.h"
 #include "subprocess_controller.h"
 
 namespace devtools_goma {
@@ -53,6 +55,12 @@ class SubProcessControllerServer: public SubProcessController {
 
   void TrySpawnSubProcess();
 
+  // Returns true if |candidate| may start now with the resource aware
+  // scheduling.
+  bool AdmitByResource(const SubProcessImpl& candidate, int running);
+  void MaybeUpdateResourcePressure();
+  void DumpSchedulerStats(SubProcessSchedulerStats* stats) const;
+
   void ErrorTerminate(int id, SubProcessTerminated_ErrorTerminate reason);
 
   void SendNotify(int op, const google::protobuf::Message& message);
@@ -75,6 +83,17 @@ class SubProcessControllerServer: public SubProcessController {
   SubProcessController::Options options_;
   bool shutdowned_ = false;
 
+  // Set if options_.resource_aware_scheduling is true.
+  std::unique_ptr<LocalResourceScheduler> resource_scheduler_;
+  absl::Time last_pressure_update_;
+  // The last deferred subprocess and the reason, to count deferrals once
+  // per subprocess.
+  int last_deferred_id_ = -1;
+  LocalResourceScheduler::Decision last_deferred_decision_ =
+      LocalResourceScheduler::ADMIT;
+  int64_t count_deferred_by_memory_ = 0;
+  int64_t count_deferred_by_cpu_ = 0;
+
   DISALLOW_COPY_AND_ASSIGN(SubProcessControllerServer);
 };
 
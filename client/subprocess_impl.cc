@@ -20,10 +20,12 @@
 namespace devtools_goma {
 
 SubProcessImpl::SubProcessImpl(const SubProcessReq& req,
-                               bool dont_kill_subprocess)
+                               bool dont_kill_subprocess,
+                               bool direct_spawn)
     : state_(SubProcessState::PENDING),
       spawner_(new PlatformSpawner),
       kill_subprocess_(!dont_kill_subprocess) {
+  spawner_->SetDirectSpawn(direct_spawn);
   VLOG(1) << "new SubProcessImpl " << req.id()
           << " " << req.trace_id();
   req_ = req;
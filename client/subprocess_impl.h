@@ -23,7 +23,9 @@ namespace devtools_goma {
 // It is created and owned by SubProcessControllerServer.
 class SubProcessImpl {
  public:
-  SubProcessImpl(const SubProcessReq& req, bool dont_kill_subprocess);
+  SubProcessImpl(const SubProcessReq& req,
+                 bool dont_kill_subprocess,
+                 bool direct_spawn);
   ~SubProcessImpl();
 
   SubProcessState::State state() const { return state_; }
@@ -81,6 +81,9 @@ void SubProcessOptionSetter::DumpStatsToProto(SubProcessStats* stats) {
       stats_count_burst_by_network_error_.value());
   stats->set_count_burst_by_compiler_disabled(
       stats_count_burst_by_compiler_disabled_.value());
+  if (SubProcessControllerClient::IsRunning()) {
+    SubProcessControllerClient::Get()->DumpStatsToProto(stats);
+  }
 }
 
 }  // namespace devtools_goma
@@ -36,58 +36,99 @@ std::string SubProcessTask::ReadCommandOutput(
     const std::string& cwd,
     CommandOutputOption option,
     int32_t* status) {
-  CHECK(!SubProcessControllerClient::Get()->BelongsToCurrentThread());
-  std::vector<const char*> args;
-  for (const auto& arg : argv)
-    args.push_back(arg.c_str());
-  args.push_back(nullptr);
-
-  SubProcessTask s(prog, prog.c_str(), const_cast<char**>(&args[0]));
-  SubProcessReq* req = s.mutable_req();
-  for (const auto& env : envs)
-    req->add_env(env);
-  if (cwd.empty()) {
-    req->set_cwd(SubProcessControllerClient::Get()->TmpDir());
-  } else {
-    req->set_cwd(cwd);
-  }
-  ScopedTmpFile tmpfile("goma_compiler_proxy.subproc");
-  if (!tmpfile.valid()) {
-    PLOG(ERROR) << "Failed to create tempfile to store stdout.";
-    *status = SubProcessTerminated::kInternalError;
-    return "";
-  }
-  tmpfile.Close();
-  const std::string& tempfilename_stdout = tmpfile.filename();
-  req->set_stdout_filename(tempfilename_stdout);
-  if (option == STDOUT_ONLY)
-    req->set_output_option(SubProcessReq::STDOUT_ONLY);
-
-  req->set_priority(SubProcessReq::HIGHEST_PRIORITY);
-  req->set_weight(SubProcessReq::LIGHT_WEIGHT);
-
-  s.StartInternal(nullptr);  // blocking.
-  std::string output;
-  if (!ReadFileToString(tempfilename_stdout, &output)) {
-    LOG(ERROR) << "Failed to read tempfile for storing stdout."
-               << " tempfilename_stdout=" << tempfilename_stdout;
-    *status = SubProcessTerminated::kInternalError;
-    return "";
-  }
-  VLOG(3) << "output=" << output;
-  int32_t exit_status = s.terminated().status();
+  std::vector<CommandOutputRequest> requests(1);
+  CommandOutputRequest* request = &requests[0];
+  request->prog = prog;
+  request->argv = argv;
+  request->env = envs;
+  request->cwd = cwd;
+  request->option = option;
+  ReadCommandOutputs(&requests);
+
   if (status) {
-    *status = exit_status;
+    *status = request->status;
   } else {
-    LOG_IF(FATAL, exit_status != 0)
+    LOG_IF(FATAL, request->status != 0)
         << "If the caller expects the non-zero exit status, "
         << "the caller must set non-nullptr status in the argument."
         << " prog=" << prog
         << " cwd=" << cwd
-        << " exit_status=" << exit_status
+        << " exit_status=" << request->status
         << " argv=" << argv;
   }
-  return output;
+  return std::move(request->output);
+}
+
+/* static */
+void SubProcessTask::ReadCommandOutputs(
+    std::vector<CommandOutputRequest>* requests) {
+  CHECK(!SubProcessControllerClient::Get()->BelongsToCurrentThread());
+  // Starts all subprocesses first, and then waits for them, so they run
+  // concurrently.
+  std::vector<std::unique_ptr<ScopedTmpFile>> tmpfiles;
+  std::vector<SubProcessTask*> tasks;
+  for (auto& request : *requests) {
+    std::vector<const char*> args;
+    for (const auto& arg : request.argv)
+      args.push_back(arg.c_str());
+    args.push_back(nullptr);
+
+    tmpfiles.push_back(
+        absl::make_unique<ScopedTmpFile>("goma_compiler_proxy.subproc"));
+    ScopedTmpFile* tmpfile = tmpfiles.back().get();
+    if (!tmpfile->valid()) {
+      PLOG(ERROR) << "Failed to create tempfile to store stdout.";
+      request.status = SubProcessTerminated::kInternalError;
+      tasks.push_back(nullptr);
+      continue;
+    }
+    tmpfile->Close();
+
+    const std::string& trace_id =
+        request.name.empty() ? request.prog : request.name;
+    SubProcessTask* s = new SubProcessTask(
+        trace_id, request.prog.c_str(), const_cast<char**>(&args[0]));
+    SubProcessReq* req = s->mutable_req();
+    for (const auto& env : request.env)
+      req->add_env(env);
+    if (request.cwd.empty()) {
+      req->set_cwd(SubProcessControllerClient::Get()->TmpDir());
+    } else {
+      req->set_cwd(request.cwd);
+    }
+    req->set_stdout_filename(tmpfile->filename());
+    if (request.option == STDOUT_ONLY)
+      req->set_output_option(SubProcessReq::STDOUT_ONLY);
+
+    req->set_priority(SubProcessReq::HIGHEST_PRIORITY);
+    req->set_weight(SubProcessReq::LIGHT_WEIGHT);
+
+    s->StartNoWait();
+    tasks.push_back(s);
+  }
+
+  for (size_t i = 0; i < tasks.size(); ++i) {
+    SubProcessTask* s = tasks[i];
+    if (s == nullptr) {
+      continue;
+    }
+    s->WaitFinished();
+    CommandOutputRequest* request = &(*requests)[i];
+    request->run_time = absl::Milliseconds(s->started().pending_ms() +
+                                           s->terminated().run_ms());
+    request->status = s->terminated().status();
+    delete s;
+
+    const std::string& tempfilename_stdout = tmpfiles[i]->filename();
+    if (!ReadFileToString(tempfilename_stdout, &request->output)) {
+      LOG(ERROR) << "Failed to read tempfile for storing stdout."
+                 << " tempfilename_stdout=" << tempfilename_stdout;
+      request->output.clear();
+      request->status = SubProcessTerminated::kInternalError;
+      continue;
+    }
+    VLOG(3) << "output=" << request->output;
+  }
 }
 
 SubProcessTask::SubProcessTask(const std::string& trace_id,
@@ -154,10 +195,26 @@ void SubProcessTask::StartInternal(OneshotClosure* callback) {
   }
   if (callback == nullptr) {
     // blocking mode.
+    WaitFinished();
+  }
+}
+
+void SubProcessTask::StartNoWait() {
+  DCHECK(BelongsToCurrentThread());
+  DCHECK(!req_.detach());
+  {
     AUTOLOCK(lock, &mu_);
-    while (state_ != SubProcessState::FINISHED) {
-      cond_.Wait(&mu_);
-    }
+    DCHECK_EQ(SubProcessState::SETUP, state_);
+    state_ = SubProcessState::PENDING;
+  }
+  SubProcessControllerClient::Get()->RegisterTask(this);
+}
+
+void SubProcessTask::WaitFinished() {
+  DCHECK(!async_callback());
+  AUTOLOCK(lock, &mu_);
+  while (state_ != SubProcessState::FINISHED) {
+    cond_.Wait(&mu_);
   }
 }
 
@@ -51,6 +51,11 @@ class SubProcessTask {
                                        CommandOutputOption option,
                                        int32_t* status);
 
+  // Provides ReadCommandOutputs interface.
+  // It starts all commands in |requests| in blocking mode, and then waits
+  // for all of them, so they run concurrently.
+  static void ReadCommandOutputs(std::vector<CommandOutputRequest>* requests);
+
   // Creates new sub process task.
   // The created instance will be used on the thread where it was created.
   SubProcessTask(const std::string& trace_id,
@@ -107,6 +112,15 @@ class SubProcessTask {
   // Caller should delete it.
   void StartInternal(OneshotClosure* callback);
 
+  // Starts subprocess in blocking mode, but returns without waiting for
+  // subprocess termination.  Caller should call WaitFinished() and delete it.
+  // state(): SETUP -> PENDING.
+  void StartNoWait();
+
+  // Waits for subprocess termination in blocking mode.
+  // state(): -> FINISHED.
+  void WaitFinished();
+
   // Feedback from subprocess controller.
 
   // The subprocess is started with pid.
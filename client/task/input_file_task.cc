@@ -5,6 +5,7 @@
 #include "task/input_file_task.h"
 
 #include "absl/base/call_once.h"
+#include "absl/memory/memory.h"
 #include "absl/strings/match.h"
 #include "absl/time/clock.h"
 #include "compile_task.h"
@@ -115,9 +116,31 @@ void InputFileTask::Run(CompileTask* task, OneshotClosure* closure) {
       LOG(INFO) << task->trace_id() << "(" << num_tasks() << " tasks)"
                 << " upload:" << filename_ << " size:" << file_stat_.size
                 << " reason:" << upload_reason(hash_key);
-      success_ = blob_uploader_->Upload();
+      if (missed_content_) {
+        // If the server reported it's missing, file chunks might also be
+        // missing even if they were stored before.
+        success_ = blob_uploader_->ForceUpload();
+      } else if (!blob_uploader_->hash_key().empty()) {
+        // The same content might be uploaded for another file
+        // (e.g. a generated file copied to other output directories).
+        // hash_key() is available only if it was computed above, so
+        // it is not stale.
+        if (JoinInFlightUpload(task, blob_uploader_->hash_key(), closure)) {
+          return;
+        }
+        success_ = UploadUnlessStored(task);
+        FinishInFlightUpload(blob_uploader_->hash_key(), success_);
+      } else {
+        success_ = blob_uploader_->Upload();
+      }
       if (success_) {
         uploaded_in_side_channel = true;
+        const FileServiceClient::CreateFileBlobStats blob_stats =
+            blob_uploader_->create_file_blob_stats();
+        LOG_IF(INFO, blob_stats.num_skipped_chunks > 0)
+            << task->trace_id() << " (" << num_tasks() << " tasks)"
+            << " skipped stored chunks:" << filename_ << " "
+            << blob_stats.num_skipped_chunks << "/" << blob_stats.num_chunks;
       }
     } else {
       // upload embedded.
@@ -142,11 +165,18 @@ void InputFileTask::Run(CompileTask* task, OneshotClosure* closure) {
             << " new_cache_key:" << new_cache_key_ << " success:" << success_;
   }
 
+  FinishRun(task, closure, uploaded_in_side_channel);
+}
+
+void InputFileTask::FinishRun(CompileTask* task,
+                              OneshotClosure* closure,
+                              bool uploaded_in_side_channel) {
+  WorkerThread::ThreadId thread_id = task->thread_id_;
   if (!success_) {
     LOG(WARNING) << task->trace_id() << " (" << num_tasks() << " tasks)"
                  << " input file failed:" << filename_;
   } else {
-    hash_key = blob_uploader_->hash_key();
+    const std::string& hash_key = blob_uploader_->hash_key();
     CHECK(!hash_key.empty())
         << task->trace_id() << " (" << num_tasks() << " tasks)"
         << " no hash key?" << filename_;
@@ -205,6 +235,64 @@ void InputFileTask::Run(CompileTask* task, OneshotClosure* closure) {
                             WorkerThread::PRIORITY_LOW);
 }
 
+bool InputFileTask::UploadUnlessStored(CompileTask* task) {
+  // A large file is looked up before it is uploaded, since the server may
+  // already have it, e.g. uploaded by another compiler_proxy.
+  // The file blob on the server is FILE_META, so its lookup response is
+  // small.  A smaller file is just uploaded, since its lookup response
+  // would have the whole content.
+  if (file_stat_.size > kLargeFileThreshold &&
+      blob_uploader_->IsStoredInServer()) {
+    LOG(INFO) << task->trace_id() << " (" << num_tasks() << " tasks)"
+              << " already stored:" << filename_
+              << " size:" << file_stat_.size;
+    num_uploads_found_stored_.Add(1);
+    upload_bytes_found_stored_.Add(file_stat_.size);
+    return true;
+  }
+  return blob_uploader_->Upload();
+}
+
+bool InputFileTask::JoinInFlightUpload(CompileTask* task,
+                                       const std::string& hash_key,
+                                       OneshotClosure* closure) {
+  if (!in_flight_uploads_->Join(
+          hash_key, &in_flight_upload_success_,
+          absl::WrapUnique<OneshotClosure>(
+              NewCallback(this, &InputFileTask::InFlightUploadDone,
+                          task, closure)))) {
+    // No other task is uploading the same content.
+    return false;
+  }
+  VLOG(1) << task->trace_id() << " (" << num_tasks() << " tasks)"
+          << " wait for in-flight upload:" << filename_ << " " << hash_key;
+  return true;
+}
+
+void InputFileTask::FinishInFlightUpload(const std::string& hash_key,
+                                         bool success) {
+  for (auto* closure : in_flight_uploads_->Finish(hash_key, success)) {
+    wm_->RunClosure(FROM_HERE, closure, WorkerThread::PRIORITY_LOW);
+  }
+}
+
+void InputFileTask::InFlightUploadDone(CompileTask* task,
+                                       OneshotClosure* closure) {
+  if (in_flight_upload_success_) {
+    LOG(INFO) << task->trace_id() << " (" << num_tasks() << " tasks)"
+              << " uploaded for another file:" << filename_
+              << " size:" << file_stat_.size;
+    num_uploads_joined_.Add(1);
+    upload_bytes_joined_.Add(file_stat_.size);
+    success_ = true;
+  } else {
+    LOG(INFO) << task->trace_id() << " (" << num_tasks() << " tasks)"
+              << " in-flight upload failed. upload:" << filename_;
+    success_ = blob_uploader_->Upload();
+  }
+  FinishRun(task, closure, success_);
+}
+
 void InputFileTask::Done(CompileTask* task) {
   bool all_finished = false;
   {
@@ -304,7 +392,8 @@ InputFileTask::InputFileTask(
       is_new_file_(is_new_file),
       old_hash_key_(std::move(old_hash_key)),
       success_(false),
-      new_cache_key_(false) {
+      new_cache_key_(false),
+      in_flight_upload_success_(false) {
   timer_.Start();
 }
 
@@ -320,6 +409,7 @@ void InputFileTask::SetTaskInput(CompileTask* task, ExecReq_Input* input) {
 void InputFileTask::InitializeStaticOnce() {
   AUTOLOCK(lock, &global_mu_);
   task_by_filename_ = new FileToTaskMap();
+  in_flight_uploads_ = new InFlightUploads();
 }
 
 // static
@@ -331,4 +421,19 @@ Lock InputFileTask::global_mu_;
 // static
 InputFileTask::FileToTaskMap* InputFileTask::task_by_filename_;
 
+// static
+InFlightUploads* InputFileTask::in_flight_uploads_;
+
+// static
+StatsCounter InputFileTask::num_uploads_joined_;
+
+// static
+StatsCounter InputFileTask::upload_bytes_joined_;
+
+// static
+StatsCounter InputFileTask::num_uploads_found_stored_;
+
+// static
+StatsCounter InputFileTask::upload_bytes_found_stored_;
+
 }  // namespace devtools_goma
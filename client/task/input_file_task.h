@@ -6,14 +6,18 @@
 #define DEVTOOLS_GOMA_CLIENT_TASK_INPUT_FILE_TASK_H_
 
 #include <memory>
+#include <string>
+#include <vector>
 
 #include "absl/container/flat_hash_map.h"
 #include "absl/memory/memory.h"
 #include "absl/time/time.h"
+#include "atomic_stats_counter.h"
 #include "base/lockhelper.h"
 #include "compile_task.h"
 #include "file_hash_cache.h"
 #include "goma_blob.h"
+#include "in_flight_uploads.h"
 #include "lib/goma_data.pb.h"
 #include "simple_timer.h"
 #include "worker_thread_manager.h"
@@ -76,6 +80,22 @@ class InputFileTask {
     return blob_uploader_->http_status();
   }
 
+  FileServiceClient::CreateFileBlobStats create_file_blob_stats() const {
+    return blob_uploader_->create_file_blob_stats();
+  }
+
+  // Stats of uploads skipped because the same content was uploaded for
+  // another file at the same time.
+  static int64_t num_uploads_joined() { return num_uploads_joined_.value(); }
+  static int64_t upload_bytes_joined() { return upload_bytes_joined_.value(); }
+  // Stats of uploads skipped because the server already had the content.
+  static int64_t num_uploads_found_stored() {
+    return num_uploads_found_stored_.value();
+  }
+  static int64_t upload_bytes_found_stored() {
+    return upload_bytes_found_stored_.value();
+  }
+
  private:
   enum State {
     INIT,
@@ -96,6 +116,25 @@ class InputFileTask {
 
   void SetTaskInput(CompileTask* task, ExecReq_Input* input);
 
+  // Runs after the content is uploaded or embedded, and |closure| runs
+  // in |task|'s thread.
+  void FinishRun(CompileTask* task,
+                 OneshotClosure* closure,
+                 bool uploaded_in_side_channel);
+
+  // Uploads the content, unless the server already has it.
+  bool UploadUnlessStored(CompileTask* task);
+
+  // Returns true if the content of |hash_key| is being uploaded by another
+  // InputFileTask.  Then InFlightUploadDone() will be called when it is done.
+  // Otherwise, this task becomes the uploader of |hash_key|, and must call
+  // FinishInFlightUpload() after upload.
+  bool JoinInFlightUpload(CompileTask* task,
+                          const std::string& hash_key,
+                          OneshotClosure* closure);
+  void FinishInFlightUpload(const std::string& hash_key, bool success);
+  void InFlightUploadDone(CompileTask* task, OneshotClosure* closure);
+
   static void InitializeStaticOnce();
 
   WorkerThreadManager* wm_;
@@ -135,11 +174,21 @@ class InputFileTask {
   // true if the hash_key_ is first inserted in file hash cache.
   bool new_cache_key_;
 
+  // Result of the in-flight upload this task joined.
+  bool in_flight_upload_success_;
+
   static absl::once_flag init_once_;
 
   static Lock global_mu_;
   using FileToTaskMap = absl::flat_hash_map<std::string, InputFileTask*>;
   static FileToTaskMap* task_by_filename_ ABSL_GUARDED_BY(global_mu_);
+  // Content being uploaded in side channel.
+  static InFlightUploads* in_flight_uploads_;
+
+  static StatsCounter num_uploads_joined_;
+  static StatsCounter upload_bytes_joined_;
+  static StatsCounter num_uploads_found_stored_;
+  static StatsCounter upload_bytes_found_stored_;
 };
 
 }  // namespace devtools_goma
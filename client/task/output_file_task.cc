@@ -18,7 +18,7 @@ OutputFileTask::OutputFileTask(
     std::unique_ptr<BlobClient::Downloader> blob_downloader,
     CompileTask* task,
     int output_index,
-    const ExecResult_Output& output,
+    ExecResult_Output* output,
     OutputFileInfo* info)
     : wm_(wm),
       thread_id_(wm->GetCurrentThreadId()),
@@ -26,7 +26,7 @@ OutputFileTask::OutputFileTask(
       task_(task),
       output_index_(output_index),
       output_(output),
-      output_size_(output.blob().file_size()),
+      output_size_(output->blob().file_size()),
       info_(info),
       success_(false) {
   timer_.Start();
@@ -39,11 +39,16 @@ OutputFileTask::~OutputFileTask() {
 
 void OutputFileTask::Run(OneshotClosure* closure) {
   VLOG(1) << task_->trace_id() << " output " << info_->filename;
-  success_ = blob_downloader_->Download(output_, info_);
-  if (success_) {
-    // TODO: fix to support cas digest.
-    info_->hash_key = ComputeFileBlobHashKey(output_.blob());
+  if (MoveEmbeddedContent()) {
+    success_ = true;
   } else {
+    success_ = blob_downloader_->Download(*output_, info_);
+    if (success_) {
+      // TODO: fix to support cas digest.
+      info_->hash_key = ComputeFileBlobHashKey(output_->blob());
+    }
+  }
+  if (!success_) {
     LOG(WARNING) << task_->trace_id() << " "
                  << (task_->cache_hit() ? "cached" : "no-cached")
                  << " output file failed:" << info_->filename;
@@ -52,6 +57,21 @@ void OutputFileTask::Run(OneshotClosure* closure) {
                           WorkerThread::PRIORITY_LOW);
 }
 
+bool OutputFileTask::MoveEmbeddedContent() {
+  const FileBlob& blob = output_->blob();
+  if (!IsInMemory() || blob.blob_type() != FileBlob::FILE ||
+      !IsValidFileBlob(blob) ||
+      blob.content().size() != info_->content.size()) {
+    return false;
+  }
+  // Since the blob is cleared once the task is finished, it is not
+  // necessary to keep its content.  The output buffer acquired for |info_|
+  // has the same size, so it can be swapped.
+  info_->hash_key = ComputeFileBlobHashKey(blob);
+  info_->content.swap(*output_->mutable_blob()->mutable_content());
+  return true;
+}
+
 bool OutputFileTask::IsInMemory() const {
   return info_->tmp_filename.empty();
 }
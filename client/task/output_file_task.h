@@ -22,12 +22,13 @@ class OutputFileTask {
  public:
   using OutputFileInfo = BlobClient::Downloader::OutputFileInfo;
 
-  // Doesn't take ownership of |info|.
+  // Doesn't take ownership of |output| and |info|.
+  // Content embedded in |output| may be moved to |info|.
   OutputFileTask(WorkerThreadManager* wm,
                  std::unique_ptr<BlobClient::Downloader> blob_downloader,
                  CompileTask* task,
                  int output_index,
-                 const ExecResult_Output& output,
+                 ExecResult_Output* output,
                  OutputFileInfo* info);
   ~OutputFileTask();
   OutputFileTask(const OutputFileTask&) = delete;
@@ -36,7 +37,7 @@ class OutputFileTask {
   void Run(OneshotClosure* closure);
 
   CompileTask* task() const { return task_; }
-  const ExecResult_Output& output() const { return output_; }
+  const ExecResult_Output& output() const { return *output_; }
   const SimpleTimer& timer() const { return timer_; }
   bool success() const { return success_; }
   bool IsInMemory() const;
@@ -51,12 +52,16 @@ class OutputFileTask {
   }
 
  private:
+  // Moves content of FILE blob to in-memory output instead of copying it.
+  // Returns false if it can't.
+  bool MoveEmbeddedContent();
+
   WorkerThreadManager* wm_;
   WorkerThread::ThreadId thread_id_;
   std::unique_ptr<BlobClient::Downloader> blob_downloader_;
   CompileTask* task_;
   int output_index_;
-  const ExecResult_Output& output_;
+  ExecResult_Output* output_;
   size_t output_size_;
   OutputFileInfo* info_;
   SimpleTimer timer_;
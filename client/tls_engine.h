@@ -15,6 +15,7 @@
 #define DEVTOOLS_GOMA_CLIENT_TLS_ENGINE_H_
 
 #include <string>
+#include <vector>
 
 #include "absl/strings/string_view.h"
 #include "socket_factory.h"
@@ -62,6 +63,10 @@ class TLSEngine {
   // This is usually used for skipping initialize process.
   virtual bool IsRecycled() const = 0;
 
+  // Returns the protocol selected by ALPN, or empty string if none was
+  // selected.  Valid after it gets ready.
+  virtual std::string GetAlpnSelected() const { return ""; }
+
  protected:
   virtual ~TLSEngine() {}
 };
@@ -74,11 +79,21 @@ class TLSEngineFactory : public SocketFactoryObserver {
   // If this get the known |sock|, TLSEngine will be returned from a pool.
   // i.e. caller does not have an ownership of returned value.
   virtual TLSEngine* NewTLSEngine(int sock) = 0;
+  // Returns new TLSEngine instance used for |sock| that offers |protocols|
+  // with ALPN (RFC 7301).  Unlike NewTLSEngine, returns nullptr if |sock|
+  // is known, since the protocol of the recycled session was already
+  // negotiated.  Also returns nullptr if ALPN is not supported.
+  virtual TLSEngine* NewTLSEngineWithAlpn(
+      int sock, const std::vector<std::string>& protocols) {
+    return nullptr;
+  }
   // A SocketFactoryObserver interface.
   // Releases TLSEngine associated with the |sock|.
   virtual void WillCloseSocket(int sock) = 0;
   // Returns human readable string of certificates and CRLs TLSEngine's use.
   virtual std::string GetCertsInfo() = 0;
+  // Returns human readable string of TLS handshake statistics.
+  virtual std::string GetHandshakeStats() const { return ""; }
   // Set a hostname to connect.
   // A subjectAltName of type dNSName in a server certificate should
   // match with |hostname|, or TLSEngine returns TLS_VERIFY_ERROR.
@@ -6,6 +6,7 @@
 #include <algorithm>
 #include <deque>
 
+#include "absl/time/clock.h"
 #include "absl/types/optional.h"
 #include "env_flags.h"
 #include "file_stat.h"
@@ -38,6 +39,26 @@ std::string ReadCommandOutput(const std::string& prog,
   return gReadCommandOutput(prog, argv, env, cwd, option, status);
 }
 
+static ReadCommandOutputsFunc gReadCommandOutputs = nullptr;
+
+void InstallReadCommandOutputsFunc(ReadCommandOutputsFunc func) {
+  gReadCommandOutputs = func;
+}
+
+void ReadCommandOutputs(std::vector<CommandOutputRequest>* requests) {
+  if (gReadCommandOutputs != nullptr) {
+    gReadCommandOutputs(requests);
+    return;
+  }
+  for (auto& request : *requests) {
+    const absl::Time start = absl::Now();
+    request.output =
+        ReadCommandOutput(request.prog, request.argv, request.env, request.cwd,
+                          request.option, &request.status);
+    request.run_time = absl::Now() - start;
+  }
+}
+
 // Platform independent getenv.
 absl::optional<std::string> GetEnv(const std::string& name) {
 #ifndef _WIN32
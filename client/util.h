@@ -22,6 +22,7 @@
 #endif
 
 #include "absl/strings/ascii.h"
+#include "absl/time/time.h"
 #include "absl/types/optional.h"
 #include "google/protobuf/repeated_field.h"
 
@@ -57,6 +58,34 @@ std::string ReadCommandOutput(const std::string& prog,
                               CommandOutputOption option,
                               int32_t* status);
 
+// A command to run with ReadCommandOutputs.
+struct CommandOutputRequest {
+  // Name of the command, used for logging and stats.
+  std::string name;
+  std::string prog;
+  std::vector<std::string> argv;
+  std::vector<std::string> env;
+  std::string cwd;
+  CommandOutputOption option = MERGE_STDOUT_STDERR;
+
+  // Set by ReadCommandOutputs.
+  std::string output;
+  int32_t status = 0;
+  absl::Duration run_time;
+};
+
+typedef void (*ReadCommandOutputsFunc)(
+    std::vector<CommandOutputRequest>* requests);
+
+// Installs new ReadCommandOutputs function.
+void InstallReadCommandOutputsFunc(ReadCommandOutputsFunc func);
+
+// Runs all commands in |requests|, and sets their output, exit status and
+// run time.
+// Commands are run concurrently by ReadCommandOutputs function if installed.
+// Otherwise, they are run one by one by ReadCommandOutput function.
+void ReadCommandOutputs(std::vector<CommandOutputRequest>* requests);
+
 // Platform independent getenv.
 // Note: in chromium/win, gomacc can only get environments that was
 // extracted by build/toolchain/win/setup_toolchain.py.
@@ -5,8 +5,21 @@
 
 #include "worker_thread.h"
 
+#ifndef _WIN32
+#include <unistd.h>
+#endif
+
+#include <thread>
+
+#include "absl/time/clock.h"
 #include "absl/time/time.h"
+#include "callback.h"
 #include "compiler_specific.h"
+#include "descriptor_poller.h"
+#include "lockhelper.h"
+#include "mock_socket_factory.h"
+#include "scoped_fd.h"
+#include "simple_timer.h"
 #include "socket_descriptor.h"
 #include "glog/logging.h"
 
@@ -54,10 +67,143 @@ class WorkerThreadTest : public ::testing::Test {
 
     ASSERT_TRUE(delayed_pendings.empty());
   }
+
+  // Polls events of |worker| once on the current thread, as WorkerThread
+  // does in Dispatch, and runs the closures of descriptors whose priority
+  // is higher than |priority|.  Returns the number of closures run.
+  static int PollEvents(WorkerThread* worker,
+                        absl::Duration timeout,
+                        int priority) {
+    DescriptorPoller::CallbackQueue callbacks;
+    AutoLockStat* stat = nullptr;
+    {
+      AutoLock lock(&worker->mu_);
+      worker->poller_->PollEvents(worker->descriptors_, timeout, priority,
+                                  &callbacks, &worker->mu_, &stat);
+    }
+    int num_run = 0;
+    for (const auto& it : callbacks) {
+      for (auto* closure : it.second) {
+        closure->Run();
+        ++num_run;
+      }
+    }
+    return num_run;
+  }
+
+  std::unique_ptr<PermanentClosure> NewReadable() {
+    return NewPermanentCallback(this, &WorkerThreadTest::Readable);
+  }
+
+  void Readable() { ++num_readable_; }
+
+  int num_readable_ = 0;
 };
 
 TEST_F(WorkerThreadTest, DelayedClosureQueue) {
   TestDelayedClosureQueue();
 }
 
+TEST_F(WorkerThreadTest, RegisterUnregisterInOnePoll) {
+  WorkerThread worker(0, "test");
+  int socks[2];
+  ASSERT_EQ(0, OpenSocketPairForTest(socks));
+  ScopedSocket peer(socks[1]);
+  SocketDescriptor* d = worker.RegisterSocketDescriptor(
+      ScopedSocket(socks[0]), WorkerThread::PRIORITY_HIGH);
+  // Makes this thread the polling thread, so that interest changes below
+  // are batched until the next poll.
+  EXPECT_EQ(0, PollEvents(&worker, absl::ZeroDuration(),
+                          WorkerThread::PRIORITY_LOW));
+
+  d->NotifyWhenReadable(NewReadable());
+  d->ClearReadable();
+  char buf[1] = { 42 };
+  ASSERT_EQ(1, peer.Write(buf, 1));
+  EXPECT_EQ(0, PollEvents(&worker, absl::Milliseconds(100),
+                          WorkerThread::PRIORITY_LOW));
+  EXPECT_EQ(0, num_readable_);
+
+  d->NotifyWhenReadable(NewReadable());
+  EXPECT_EQ(1, PollEvents(&worker, absl::Seconds(10),
+                          WorkerThread::PRIORITY_LOW));
+  EXPECT_EQ(1, num_readable_);
+
+  d->ClearReadable();
+  ScopedSocket sock(worker.DeleteSocketDescriptor(d));
+  EXPECT_TRUE(sock.valid());
+}
+
+TEST_F(WorkerThreadTest, InterestChangeFromOtherThread) {
+  WorkerThread worker(0, "test");
+  int socks[2];
+  ASSERT_EQ(0, OpenSocketPairForTest(socks));
+  ScopedSocket peer(socks[1]);
+  // The descriptor is not dispatched by the polling thread, since it has
+  // the same priority with polling, but its readiness still wakes up polling.
+  SocketDescriptor* d = worker.RegisterSocketDescriptor(
+      ScopedSocket(socks[0]), WorkerThread::PRIORITY_LOW);
+  char buf[1] = { 42 };
+  ASSERT_EQ(1, peer.Write(buf, 1));
+
+  const absl::Duration kTimeout = absl::Seconds(10);
+  absl::Duration poll_time;
+  std::thread poll_thread([&worker, &poll_time, kTimeout]() {
+    SimpleTimer timer;
+    PollEvents(&worker, kTimeout, WorkerThread::PRIORITY_LOW);
+    poll_time = timer.GetDuration();
+  });
+  // Lets |poll_thread| wait in polling.
+  absl::SleepFor(absl::Milliseconds(100));
+  // Must be applied immediately, not when |poll_thread| polls next time.
+  d->NotifyWhenReadable(NewReadable());
+  poll_thread.join();
+  EXPECT_LT(poll_time, kTimeout);
+  EXPECT_EQ(0, num_readable_);
+
+  d->ClearReadable();
+  ScopedSocket sock(worker.DeleteSocketDescriptor(d));
+  EXPECT_TRUE(sock.valid());
+}
+
+#ifndef _WIN32
+TEST_F(WorkerThreadTest, CloseAndReuseFd) {
+  WorkerThread worker(0, "test");
+  int socks[2];
+  ASSERT_EQ(0, OpenSocketPairForTest(socks));
+  ScopedSocket peer(socks[1]);
+  const int fd = socks[0];
+  SocketDescriptor* d = worker.RegisterSocketDescriptor(
+      ScopedSocket(fd), WorkerThread::PRIORITY_HIGH);
+  d->NotifyWhenReadable(NewReadable());
+  // Registers |fd| in the poller.
+  EXPECT_EQ(0, PollEvents(&worker, absl::ZeroDuration(),
+                          WorkerThread::PRIORITY_LOW));
+  // Closes |fd| while it is watched.
+  worker.DeleteSocketDescriptor(d).Close();
+  peer.Close();
+
+  ASSERT_EQ(0, OpenSocketPairForTest(socks));
+  peer.reset(socks[1]);
+  ScopedSocket sock(socks[0]);
+  if (sock.get() != fd) {
+    // Makes the new socket have the same fd number.
+    ASSERT_EQ(fd, dup2(sock.get(), fd));
+    sock.reset(fd);
+  }
+  d = worker.RegisterSocketDescriptor(std::move(sock),
+                                      WorkerThread::PRIORITY_HIGH);
+  d->NotifyWhenReadable(NewReadable());
+  char buf[1] = { 42 };
+  ASSERT_EQ(1, peer.Write(buf, 1));
+  EXPECT_EQ(1, PollEvents(&worker, absl::Seconds(10),
+                          WorkerThread::PRIORITY_LOW));
+  EXPECT_EQ(1, num_readable_);
+
+  d->ClearReadable();
+  sock = worker.DeleteSocketDescriptor(d);
+  EXPECT_EQ(fd, sock.get());
+}
+#endif
+
 }  // namespace devtools_goma
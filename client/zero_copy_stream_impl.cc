@@ -5,6 +5,7 @@
 
 #include "zero_copy_stream_impl.h"
 
+#include <algorithm>
 #include <cstring>
 
 #include "absl/memory/memory.h"
@@ -80,6 +81,98 @@ ChainedInputStream::ChainedInputStream(
           input_streams_array_.data(), input_streams_array_.size());
 }
 
+BlockChainInputStream::BlockChainInputStream(
+    std::vector<std::unique_ptr<char[]>> blocks,
+    int block_size,
+    google::protobuf::int64 offset,
+    google::protobuf::int64 size)
+    : blocks_(std::move(blocks)),
+      block_size_(block_size),
+      offset_(offset),
+      size_(size),
+      position_(offset) {
+  CHECK_GT(block_size_, 0);
+  CHECK_LE(offset_, size_);
+  CHECK_LE(size_, static_cast<google::protobuf::int64>(blocks_.size()) *
+                      block_size_);
+}
+
+bool BlockChainInputStream::Next(const void** data, int* size) {
+  if (position_ >= size_) {
+    last_returned_size_ = 0;
+    return false;
+  }
+  const google::protobuf::int64 index = position_ / block_size_;
+  const int offset_in_block = position_ % block_size_;
+  const int n = static_cast<int>(std::min<google::protobuf::int64>(
+      block_size_ - offset_in_block, size_ - position_));
+  *data = blocks_[index].get() + offset_in_block;
+  *size = n;
+  position_ += n;
+  last_returned_size_ = n;
+  return true;
+}
+
+void BlockChainInputStream::BackUp(int count) {
+  CHECK_GE(count, 0);
+  CHECK_LE(count, last_returned_size_)
+      << "BackUp() can only be called after Next()";
+  position_ -= count;
+  last_returned_size_ = 0;
+}
+
+bool BlockChainInputStream::Skip(int count) {
+  CHECK_GE(count, 0);
+  last_returned_size_ = 0;
+  if (count > size_ - position_) {
+    position_ = size_;
+    return false;
+  }
+  position_ += count;
+  return true;
+}
+
+BlockChainOutputStream::BlockChainOutputStream(int block_size)
+    : block_size_(block_size) {
+  CHECK_GT(block_size_, 0);
+}
+
+bool BlockChainOutputStream::Next(void** data, int* size) {
+  if (blocks_.empty() || last_block_used_ == block_size_) {
+    // Not initialized by make_unique, since it will be overwritten.
+    blocks_.emplace_back(new char[block_size_]);
+    last_block_used_ = 0;
+  }
+  *data = blocks_.back().get() + last_block_used_;
+  *size = block_size_ - last_block_used_;
+  byte_count_ += *size;
+  last_block_used_ = block_size_;
+  return true;
+}
+
+void BlockChainOutputStream::BackUp(int count) {
+  CHECK_GE(count, 0);
+  CHECK_LE(count, last_block_used_);
+  last_block_used_ -= count;
+  byte_count_ -= count;
+}
+
+char BlockChainOutputStream::at(google::protobuf::int64 pos) const {
+  CHECK_GE(pos, 0);
+  CHECK_LT(pos, byte_count_);
+  return blocks_[pos / block_size_][pos % block_size_];
+}
+
+std::unique_ptr<BlockChainInputStream>
+BlockChainOutputStream::ReleaseAsInputStream(google::protobuf::int64 offset) {
+  auto input = absl::make_unique<BlockChainInputStream>(
+      std::move(blocks_), block_size_, offset, byte_count_);
+  blocks_.clear();
+  last_block_used_ = 0;
+  byte_count_ = 0;
+  return input;
+}
+
 GzipInputStream::GzipInputStream(std::unique_ptr<ZeroCopyInputStream> input)
     : gzip_stream_(absl::make_unique<google::protobuf::io::GzipInputStream>(
           input.get(),
@@ -10,6 +10,7 @@
 #include <string>
 #include <vector>
 
+#include "basictypes.h"
 #include "compiler_specific.h"
 MSVC_PUSH_DISABLE_WARNING_FOR_PROTO()
 #include "google/protobuf/io/gzip_stream.h"
@@ -105,6 +106,73 @@ class ChainedInputStream : public google::protobuf::io::ZeroCopyInputStream {
       concat_stream_;
 };
 
+// BlockChainInputStream reads data stored in a chain of fixed size blocks.
+// It owns the blocks.  Buffers returned by Next() remain valid until
+// the stream is destroyed.
+class BlockChainInputStream : public google::protobuf::io::ZeroCopyInputStream {
+ public:
+  // Reads [offset, size) of |blocks|, each of which has |block_size| bytes,
+  // except the last one.
+  BlockChainInputStream(std::vector<std::unique_ptr<char[]>> blocks,
+                        int block_size,
+                        google::protobuf::int64 offset,
+                        google::protobuf::int64 size);
+  ~BlockChainInputStream() override = default;
+
+  bool Next(const void** data, int* size) override;
+  void BackUp(int count) override;
+  bool Skip(int count) override;
+  google::protobuf::int64 ByteCount() const override {
+    return position_ - offset_;
+  }
+  google::protobuf::int64 BytesRemaining() const { return size_ - position_; }
+
+ private:
+  const std::vector<std::unique_ptr<char[]>> blocks_;
+  const int block_size_;
+  const google::protobuf::int64 offset_;
+  const google::protobuf::int64 size_;
+  google::protobuf::int64 position_;
+  int last_returned_size_ = 0;
+
+  DISALLOW_COPY_AND_ASSIGN(BlockChainInputStream);
+};
+
+// BlockChainOutputStream writes data in a chain of fixed size blocks.
+// Unlike StringOutputStream, it never reallocates nor copies data written
+// so far, so serializing (or compressing) a large message doesn't need
+// twice of its size in peak, and the data can be sent from the blocks
+// as is by BlockChainInputStream.
+class BlockChainOutputStream
+    : public google::protobuf::io::ZeroCopyOutputStream {
+ public:
+  static constexpr int kDefaultBlockSize = 64 * 1024;
+
+  explicit BlockChainOutputStream(int block_size = kDefaultBlockSize);
+  ~BlockChainOutputStream() override = default;
+
+  bool Next(void** data, int* size) override;
+  void BackUp(int count) override;
+  google::protobuf::int64 ByteCount() const override { return byte_count_; }
+
+  // Returns a byte of data at |pos|, which must be < ByteCount().
+  char at(google::protobuf::int64 pos) const;
+
+  // Moves data written so far to input stream, which starts at |offset|.
+  // The output stream becomes empty.
+  std::unique_ptr<BlockChainInputStream> ReleaseAsInputStream(
+      google::protobuf::int64 offset);
+
+ private:
+  const int block_size_;
+  std::vector<std::unique_ptr<char[]>> blocks_;
+  // bytes used in the last block.
+  int last_block_used_ = 0;
+  google::protobuf::int64 byte_count_ = 0;
+
+  DISALLOW_COPY_AND_ASSIGN(BlockChainOutputStream);
+};
+
 // GzipInputStream is similar with google::protobuf::io::GzipInputStream,
 // but it owns input stream, and always uses GZIP stream.
 class GzipInputStream : public google::protobuf::io::ZeroCopyInputStream {
@@ -4,13 +4,16 @@
 
 #include "zero_copy_stream_impl.h"
 
+#include <cstring>
 #include <string>
 
 #include "absl/memory/memory.h"
 #include "absl/strings/escaping.h"
 #include "absl/strings/match.h"
+#include "absl/strings/str_cat.h"
 #include "absl/strings/string_view.h"
 #include "glog/logging.h"
+#include "google/protobuf/io/coded_stream.h"
 #include "gtest/gtest.h"
 #include "http_util.h"
 
@@ -64,4 +67,85 @@ TEST(ZeroCopyStreamImplTest, GzipRequestInputStream) {
   EXPECT_EQ(kInputData, decompressed_data);
 }
 
+TEST(ZeroCopyStreamImplTest, BlockChainStream) {
+  std::string data;
+  for (int i = 0; i < 1000; ++i) {
+    data += absl::StrCat(i, ",");
+  }
+
+  BlockChainOutputStream output(/*block_size=*/100);
+  {
+    google::protobuf::io::CodedOutputStream coded_output(&output);
+    coded_output.WriteRaw(data.data(), data.size());
+  }
+  EXPECT_EQ(data.size(), output.ByteCount());
+  EXPECT_EQ(data[0], output.at(0));
+  EXPECT_EQ(data[150], output.at(150));
+
+  std::unique_ptr<BlockChainInputStream> input =
+      output.ReleaseAsInputStream(0);
+  EXPECT_EQ(0, output.ByteCount());
+  EXPECT_EQ(data.size(), input->BytesRemaining());
+
+  const void* buffer = nullptr;
+  int size = 0;
+  ASSERT_TRUE(input->Next(&buffer, &size));
+  EXPECT_EQ(100, size);
+  const void* first_buffer = buffer;
+  input->BackUp(10);
+  EXPECT_EQ(90, input->ByteCount());
+  ASSERT_TRUE(input->Next(&buffer, &size));
+  EXPECT_EQ(10, size);
+  EXPECT_EQ(static_cast<const char*>(first_buffer) + 90, buffer);
+  EXPECT_TRUE(input->Skip(50));
+  EXPECT_EQ(150, input->ByteCount());
+
+  std::string rest = ReadAllFromZeroCopyInputStream(input.get());
+  EXPECT_EQ(data.substr(150), rest);
+  // Buffers returned earlier are still valid.
+  EXPECT_EQ(data.substr(0, 100),
+            absl::string_view(static_cast<const char*>(first_buffer), 100));
+  EXPECT_FALSE(input->Skip(1));
+}
+
+TEST(ZeroCopyStreamImplTest, BlockChainStreamWithOffset) {
+  BlockChainOutputStream output(/*block_size=*/4);
+  void* buffer = nullptr;
+  int size = 0;
+  ASSERT_TRUE(output.Next(&buffer, &size));
+  ASSERT_EQ(4, size);
+  memcpy(buffer, "xxab", 4);
+  ASSERT_TRUE(output.Next(&buffer, &size));
+  ASSERT_EQ(4, size);
+  memcpy(buffer, "c", 1);
+  output.BackUp(3);
+  EXPECT_EQ(5, output.ByteCount());
+
+  std::unique_ptr<BlockChainInputStream> input =
+      output.ReleaseAsInputStream(2);
+  EXPECT_EQ(3, input->BytesRemaining());
+  EXPECT_EQ("abc", ReadAllFromZeroCopyInputStream(input.get()));
+  EXPECT_EQ(3, input->ByteCount());
+}
+
+TEST(ZeroCopyStreamImplTest, BlockChainStreamGzip) {
+  std::string data;
+  for (int i = 0; i < 100000; ++i) {
+    data += absl::StrCat(i, ",");
+  }
+
+  BlockChainOutputStream output;
+  {
+    google::protobuf::io::GzipOutputStream::Options options;
+    options.format = google::protobuf::io::GzipOutputStream::GZIP;
+    google::protobuf::io::GzipOutputStream gzip_output(&output, options);
+    google::protobuf::io::CodedOutputStream coded_output(&gzip_output);
+    coded_output.WriteRaw(data.data(), data.size());
+    coded_output.Trim();
+    ASSERT_TRUE(gzip_output.Close());
+  }
+  GzipInputStream gzip_input(output.ReleaseAsInputStream(0));
+  EXPECT_EQ(data, ReadAllFromZeroCopyInputStream(&gzip_input));
+}
+
 }  // namespace devtools_goma
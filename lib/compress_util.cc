@@ -5,6 +5,8 @@
 
 #include <string.h>
 
+#include <algorithm>
+
 #include "absl/memory/memory.h"
 #include "absl/strings/ascii.h"
 #include "absl/strings/match.h"
@@ -13,6 +15,10 @@
 #include "glog/logging.h"
 #include "google/protobuf/io/gzip_stream.h"
 
+#ifdef ENABLE_ZSTD
+#include "zstd_errors.h"
+#endif  // ENABLE_ZSTD
+
 using google::protobuf::io::GzipInputStream;
 
 namespace {
@@ -35,6 +41,8 @@ const char* GetEncodingName(EncodingType type) {
       return "gzip";
     case EncodingType::LZMA2:
       return "lzma2";
+    case EncodingType::ZSTD:
+      return "zstd";
     default:
       return "unknown encoding";
   }
@@ -50,6 +58,9 @@ EncodingType ParseEncodingName(absl::string_view s) {
   if (absl::StartsWith(s, "lzma2")) {
     return EncodingType::LZMA2;
   }
+  if (absl::StartsWith(s, "zstd")) {
+    return EncodingType::ZSTD;
+  }
   return EncodingType::NO_ENCODING;
 }
 
@@ -76,6 +87,7 @@ EncodingType PickEncoding(const std::vector<EncodingType>& accepts,
 
 EncodingType GetEncodingFromHeader(absl::string_view header) {
   std::vector<EncodingType> prefs = {
+    EncodingType::ZSTD,
     EncodingType::LZMA2,
     EncodingType::GZIP,
     EncodingType::DEFLATE,
@@ -322,6 +334,278 @@ bool LZMAOutputStream::Close() {
 
 #endif
 
+#ifdef ENABLE_ZSTD
+std::unique_ptr<ZstdDictionary> ZstdDictionary::Create(
+    absl::string_view dict, int compression_level) {
+  const unsigned int id = ZSTD_getDictID_fromDict(dict.data(), dict.size());
+  if (id == 0) {
+    LOG(ERROR) << "not a zstd dictionary size=" << dict.size();
+    return nullptr;
+  }
+  ZSTD_CDict* cdict =
+      ZSTD_createCDict(dict.data(), dict.size(), compression_level);
+  ZSTD_DDict* ddict = ZSTD_createDDict(dict.data(), dict.size());
+  if (cdict == nullptr || ddict == nullptr) {
+    LOG(ERROR) << "failed to load zstd dictionary id=" << id;
+    ZSTD_freeCDict(cdict);
+    ZSTD_freeDDict(ddict);
+    return nullptr;
+  }
+  return std::unique_ptr<ZstdDictionary>(
+      new ZstdDictionary(cdict, ddict, id));
+}
+
+ZstdDictionary::ZstdDictionary(ZSTD_CDict* cdict, ZSTD_DDict* ddict,
+                               unsigned int id)
+    : cdict_(cdict), ddict_(ddict), id_(id) {}
+
+ZstdDictionary::~ZstdDictionary() {
+  ZSTD_freeCDict(cdict_);
+  ZSTD_freeDDict(ddict_);
+}
+
+ZstdInputStream::ZstdInputStream(
+    std::unique_ptr<ZeroCopyInputStream> sub_stream,
+    const ZstdDictionary* dictionary)
+    : sub_stream_(std::move(sub_stream)),
+      dictionary_(dictionary),
+      dctx_(ZSTD_createDCtx()),
+      input_{nullptr, 0, 0},
+      output_buffer_size_(ZSTD_DStreamOutSize()) {
+  CHECK(dctx_ != nullptr);
+  output_buffer_ = absl::make_unique<char[]>(output_buffer_size_);
+}
+
+ZstdInputStream::~ZstdInputStream() {
+  ZSTD_freeDCtx(dctx_);
+}
+
+const char* ZstdInputStream::ErrorMessage() const {
+  if (!ZSTD_isError(zstd_error_)) {
+    return nullptr;
+  }
+  return ZSTD_getErrorName(zstd_error_);
+}
+
+bool ZstdInputStream::StartFrame() {
+  size_t len = input_.size - input_.pos;
+  if (len > 0) {
+    if (input_.src == frame_header_) {
+      memmove(frame_header_, frame_header_ + input_.pos, len);
+    } else {
+      // Gives back the rest, so that the header is read into frame_header_.
+      sub_stream_->BackUp(len);
+      len = 0;
+    }
+  }
+  while (len < kFrameHeaderSizeMax) {
+    const void* in;
+    int in_size;
+    if (!sub_stream_->Next(&in, &in_size)) {
+      break;
+    }
+    const size_t n =
+        std::min<size_t>(in_size, kFrameHeaderSizeMax - len);
+    memcpy(frame_header_ + len, in, n);
+    len += n;
+    if (n < static_cast<size_t>(in_size)) {
+      sub_stream_->BackUp(in_size - n);
+    }
+  }
+  input_ = ZSTD_inBuffer{frame_header_, len, 0};
+  if (len == 0) {
+    return false;
+  }
+  in_frame_ = true;
+
+  // Refers the dictionary only for the frame compressed with it.
+  // A frame compressed without dictionary has dictionary ID 0.
+  const ZSTD_DDict* ddict = nullptr;
+  const unsigned int dict_id = ZSTD_getDictID_fromFrame(frame_header_, len);
+  if (dict_id != 0) {
+    if (dictionary_ == nullptr || dictionary_->id() != dict_id) {
+      LOG(ERROR) << "zstd: frame is compressed with unknown dictionary"
+                 << " id=" << dict_id
+                 << " want=" << (dictionary_ ? dictionary_->id() : 0);
+      zstd_error_ = static_cast<size_t>(-ZSTD_error_dictionary_wrong);
+      return false;
+    }
+    ddict = dictionary_->ddict();
+  }
+  size_t r = ZSTD_DCtx_reset(dctx_, ZSTD_reset_session_only);
+  if (!ZSTD_isError(r)) {
+    r = ZSTD_DCtx_refDDict(dctx_, ddict);
+  }
+  if (ZSTD_isError(r)) {
+    zstd_error_ = r;
+    LOG(ERROR) << "zstd: failed to set dictionary " << ZSTD_getErrorName(r);
+    return false;
+  }
+  return true;
+}
+
+bool ZstdInputStream::Next(const void** data, int* size) {
+  if (ZSTD_isError(zstd_error_)) {
+    return false;
+  }
+  if (output_position_ == output_end_) {
+    ZSTD_outBuffer output{output_buffer_.get(), output_buffer_size_, 0};
+    while (output.pos == 0) {
+      if (!in_frame_) {
+        if (!StartFrame()) {
+          return false;
+        }
+      } else if (input_.pos == input_.size) {
+        const void* in;
+        int in_size;
+        if (!sub_stream_->Next(&in, &in_size)) {
+          LOG(ERROR) << "zstd: truncated frame";
+          return false;
+        }
+        input_ = ZSTD_inBuffer{in, static_cast<size_t>(in_size), 0};
+      }
+      const size_t r = ZSTD_decompressStream(dctx_, &output, &input_);
+      if (ZSTD_isError(r)) {
+        zstd_error_ = r;
+        LOG(ERROR) << "zstd decompress error " << ZSTD_getErrorName(r);
+        return false;
+      }
+      // r == 0 means the frame is finished.
+      in_frame_ = r != 0;
+    }
+    output_position_ = 0;
+    output_end_ = output.pos;
+  }
+  *data = output_buffer_.get() + output_position_;
+  *size = output_end_ - output_position_;
+  byte_count_ += *size;
+  output_position_ = output_end_;
+  return true;
+}
+
+void ZstdInputStream::BackUp(int count) {
+  CHECK_GE(count, 0);
+  CHECK_LE(static_cast<size_t>(count), output_position_);
+  output_position_ -= count;
+  byte_count_ -= count;
+}
+
+bool ZstdInputStream::Skip(int count) {
+  const void* data;
+  int size;
+  while (count > 0 && Next(&data, &size)) {
+    if (size > count) {
+      BackUp(size - count);
+      return true;
+    }
+    count -= size;
+  }
+  return count == 0;
+}
+
+int64_t ZstdInputStream::ByteCount() const {
+  return byte_count_;
+}
+
+ZstdOutputStream::ZstdOutputStream(ZeroCopyOutputStream* sub_stream,
+                                   const Options& options)
+    : sub_stream_(sub_stream),
+      output_{nullptr, 0, 0},
+      cctx_(ZSTD_createCCtx()),
+      input_buffer_size_(options.buffer_size) {
+  CHECK(cctx_ != nullptr);
+  CHECK_GT(input_buffer_size_, 0);
+  if (options.dictionary != nullptr) {
+    zstd_error_ = ZSTD_CCtx_refCDict(cctx_, options.dictionary->cdict());
+  } else {
+    zstd_error_ = ZSTD_CCtx_setParameter(cctx_, ZSTD_c_compressionLevel,
+                                         options.compression_level);
+  }
+  LOG_IF(ERROR, ZSTD_isError(zstd_error_))
+      << "zstd init error " << ZSTD_getErrorName(zstd_error_);
+  input_buffer_ = absl::make_unique<char[]>(input_buffer_size_);
+}
+
+ZstdOutputStream::~ZstdOutputStream() {
+  if (!closed_) {
+    Close();
+  }
+  ZSTD_freeCCtx(cctx_);
+}
+
+const char* ZstdOutputStream::ErrorMessage() const {
+  if (!ZSTD_isError(zstd_error_)) {
+    return nullptr;
+  }
+  return ZSTD_getErrorName(zstd_error_);
+}
+
+bool ZstdOutputStream::Compress(ZSTD_EndDirective end_op) {
+  ZSTD_inBuffer input{input_buffer_.get(), input_length_, 0};
+  for (;;) {
+    if (output_.pos == output_.size) {
+      void* out;
+      int out_size;
+      if (!sub_stream_->Next(&out, &out_size)) {
+        LOG(ERROR) << "zstd: failed to get output buffer";
+        output_ = ZSTD_outBuffer{nullptr, 0, 0};
+        return false;
+      }
+      output_ = ZSTD_outBuffer{out, static_cast<size_t>(out_size), 0};
+    }
+    const size_t r = ZSTD_compressStream2(cctx_, &output_, &input, end_op);
+    if (ZSTD_isError(r)) {
+      zstd_error_ = r;
+      LOG(ERROR) << "zstd compress error " << ZSTD_getErrorName(r);
+      return false;
+    }
+    if (end_op == ZSTD_e_continue ? input.pos == input.size : r == 0) {
+      break;
+    }
+  }
+  input_length_ = 0;
+  return true;
+}
+
+bool ZstdOutputStream::Next(void** data, int* size) {
+  if (closed_ || ZSTD_isError(zstd_error_)) {
+    return false;
+  }
+  if (input_length_ > 0 && !Compress(ZSTD_e_continue)) {
+    return false;
+  }
+  *data = input_buffer_.get();
+  *size = input_buffer_size_;
+  input_length_ = input_buffer_size_;
+  byte_count_ += input_buffer_size_;
+  return true;
+}
+
+void ZstdOutputStream::BackUp(int count) {
+  CHECK_GE(count, 0);
+  CHECK_LE(static_cast<size_t>(count), input_length_);
+  input_length_ -= count;
+  byte_count_ -= count;
+}
+
+bool ZstdOutputStream::Close() {
+  if (closed_) {
+    return !ZSTD_isError(zstd_error_);
+  }
+  closed_ = true;
+  if (ZSTD_isError(zstd_error_)) {
+    return false;
+  }
+  bool ok = Compress(ZSTD_e_end);
+  if (output_.size > 0) {
+    // Notify lower layer of data.
+    sub_stream_->BackUp(output_.size - output_.pos);
+    output_ = ZSTD_outBuffer{nullptr, 0, 0};
+  }
+  return ok;
+}
+#endif  // ENABLE_ZSTD
+
 InflateInputStream::InflateInputStream(
     std::unique_ptr<ZeroCopyInputStream> sub_stream)
     : zlib_content_(std::move(sub_stream)) {
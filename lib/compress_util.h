@@ -19,6 +19,9 @@
 # endif  // _WIN32
 #include "lzma.h"
 #endif  // ENABLE_LZMA
+#ifdef ENABLE_ZSTD
+#include "zstd.h"
+#endif  // ENABLE_ZSTD
 
 namespace devtools_goma {
 
@@ -27,11 +30,14 @@ using google::protobuf::io::ConcatenatingInputStream;
 using google::protobuf::io::ZeroCopyInputStream;
 using google::protobuf::io::ZeroCopyOutputStream;
 
+class ZstdDictionary;
+
 enum class EncodingType {
   NO_ENCODING,
   DEFLATE,
   GZIP,
   LZMA2,
+  ZSTD,
 };
 
 const char* GetEncodingName(EncodingType type);
@@ -175,6 +181,149 @@ class LZMAOutputStream : public ZeroCopyOutputStream {
 
 #endif
 
+#ifdef ENABLE_ZSTD
+// ZstdDictionary is a zstd dictionary, e.g. trained by `zstd --train` with
+// serialized ExecReqs.  A peer needs the same dictionary to decompress data
+// compressed with it.  It is identified by id() in zstd frames.
+// ZstdDictionary is thread-safe, and can be shared by streams.
+class ZstdDictionary {
+ public:
+  // Returns nullptr if |dict| is not a valid dictionary.
+  static std::unique_ptr<ZstdDictionary> Create(absl::string_view dict,
+                                                int compression_level);
+  ~ZstdDictionary();
+
+  ZstdDictionary(const ZstdDictionary&) = delete;
+  ZstdDictionary& operator=(const ZstdDictionary&) = delete;
+
+  unsigned int id() const { return id_; }
+  const ZSTD_CDict* cdict() const { return cdict_; }
+  const ZSTD_DDict* ddict() const { return ddict_; }
+
+ private:
+  ZstdDictionary(ZSTD_CDict* cdict, ZSTD_DDict* ddict, unsigned int id);
+
+  ZSTD_CDict* const cdict_;
+  ZSTD_DDict* const ddict_;
+  const unsigned int id_;
+};
+
+// ZstdInputStream is a ZeroCopyInputStream that decompresses zstd frames
+// read from sub_stream.
+class ZstdInputStream : public ZeroCopyInputStream {
+ public:
+  // |dictionary| is needed if data is compressed with dictionary.
+  // It is used only for frames having the same dictionary ID, and frames
+  // compressed with other dictionaries fail to decompress.
+  // It must outlive the stream.
+  explicit ZstdInputStream(std::unique_ptr<ZeroCopyInputStream> sub_stream,
+                           const ZstdDictionary* dictionary = nullptr);
+  ~ZstdInputStream() override;
+
+  ZstdInputStream(ZstdInputStream&&) = delete;
+  ZstdInputStream(const ZstdInputStream&) = delete;
+  ZstdInputStream& operator=(const ZstdInputStream&) = delete;
+  ZstdInputStream& operator=(ZstdInputStream&&) = delete;
+
+  // Returns error message of the last zstd error, or nullptr if no error.
+  const char* ErrorMessage() const;
+
+  // implements ZeroCopyInputStream ---
+  bool Next(const void** data, int* size) override;
+  void BackUp(int count) override;
+  bool Skip(int count) override;
+  int64_t ByteCount() const override;
+
+ private:
+  // Enough to hold a zstd frame header (ZSTD_FRAMEHEADERSIZE_MAX).
+  static constexpr size_t kFrameHeaderSizeMax = 18;
+
+  // Reads the next frame header into frame_header_, and refers dictionary_
+  // if the frame is compressed with it.
+  // Returns false at the end of sub_stream_ or on error.
+  bool StartFrame();
+
+  std::unique_ptr<ZeroCopyInputStream> sub_stream_;
+  const ZstdDictionary* const dictionary_;
+  ZSTD_DCtx* dctx_;
+  // zstd error code of the last call, or 0.
+  size_t zstd_error_ = 0;
+  // true if the last frame is not finished.
+  bool in_frame_ = false;
+  // input_ points either frame_header_ or data given by sub_stream_.
+  ZSTD_inBuffer input_;
+  char frame_header_[kFrameHeaderSizeMax];
+
+  std::unique_ptr<char[]> output_buffer_;
+  const size_t output_buffer_size_;
+  // [output_position_, output_end_) is decompressed data not returned yet,
+  // e.g. by BackUp.
+  size_t output_position_ = 0;
+  size_t output_end_ = 0;
+  int64_t byte_count_ = 0;
+};
+
+// ZstdOutputStream is a ZeroCopyOutputStream that compresses data to
+// sub_stream in a zstd frame.
+class ZstdOutputStream : public ZeroCopyOutputStream {
+ public:
+  struct Options {
+    Options() {}
+
+    // Note: level of zstd is 1..19 (and 20..22 for ultra).
+    // 3 is default, which is faster than deflate and compresses better.
+    int compression_level = 3;
+    // If not nullptr, compresses with |dictionary| instead of
+    // |compression_level|.  It must outlive the stream.
+    const ZstdDictionary* dictionary = nullptr;
+    size_t buffer_size = 65536;
+  };
+  // It doesn't take ownership of sub_stream, which must outlive the stream
+  // like google::protobuf::io::GzipOutputStream, so that caller can use
+  // the compressed data.
+  ZstdOutputStream(ZeroCopyOutputStream* sub_stream,
+                   const Options& options = Options());
+  ~ZstdOutputStream() override;
+
+  ZstdOutputStream(ZstdOutputStream&&) = delete;
+  ZstdOutputStream(const ZstdOutputStream&) = delete;
+  ZstdOutputStream& operator=(const ZstdOutputStream&) = delete;
+  ZstdOutputStream& operator=(ZstdOutputStream&&) = delete;
+
+  // Writes out all data and ends the zstd frame.
+  // Returns true if no error.
+  bool Close();
+
+  // Returns error message of the last zstd error, or nullptr if no error.
+  const char* ErrorMessage() const;
+
+  // implements ZeroCopyOutputStream ---
+  bool Next(void** data, int* size) override;
+  void BackUp(int count) override;
+  int64_t ByteCount() const override { return byte_count_; }
+
+ private:
+  // Compresses data in input buffer to sub_stream_.
+  // Returns false on error.
+  bool Compress(ZSTD_EndDirective end_op);
+
+  ZeroCopyOutputStream* sub_stream_;
+  // Result from calling Next() on sub_stream_.
+  ZSTD_outBuffer output_;
+
+  ZSTD_CCtx* cctx_;
+  // zstd error code of the last call, or 0.
+  size_t zstd_error_ = 0;
+  bool closed_ = false;
+
+  std::unique_ptr<char[]> input_buffer_;
+  const size_t input_buffer_size_;
+  // bytes in input_buffer_ given to caller and not compressed yet.
+  size_t input_length_ = 0;
+  int64_t byte_count_ = 0;
+};
+#endif  // ENABLE_ZSTD
+
 // InflateInputStream assumes sub_stream as deflate compressed stream.
 // It automatically inserts zlib header to make sub_stream handled by
 // GzipInputStream.
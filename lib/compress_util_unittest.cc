@@ -5,6 +5,8 @@
 
 #include "lib/compress_util.h"
 
+#include <algorithm>
+#include <cstring>
 #include <memory>
 #include <vector>
 
@@ -21,12 +23,19 @@ using google::protobuf::io::ConcatenatingInputStream;
 using google::protobuf::io::StringOutputStream;
 #endif  // ENABLE_LZMA
 
+#ifdef ENABLE_ZSTD
+#include "absl/strings/str_cat.h"
+#include "google/protobuf/io/zero_copy_stream_impl_lite.h"
+#include "lib/goma_data.pb.h"
+#endif  // ENABLE_ZSTD
+
 namespace devtools_goma {
 
 TEST(CompressUtilTest, ParseEncodingName) {
   EXPECT_EQ(EncodingType::DEFLATE, ParseEncodingName("deflate"));
   EXPECT_EQ(EncodingType::GZIP, ParseEncodingName("gzip"));
   EXPECT_EQ(EncodingType::LZMA2, ParseEncodingName("lzma2"));
+  EXPECT_EQ(EncodingType::ZSTD, ParseEncodingName("zstd"));
 
   // TODO: better weight handling?
   EXPECT_EQ(EncodingType::DEFLATE, ParseEncodingName("deflate;q=1.0"));
@@ -53,6 +62,8 @@ TEST(CompressUtilTest, ParseAcceptEncoding) {
   EXPECT_EQ(want, ParseAcceptEncoding("deflate;q=1,gzip"));
   want = {EncodingType::GZIP, EncodingType::DEFLATE};
   EXPECT_EQ(want, ParseAcceptEncoding("gzip, deflate"));
+  want = {EncodingType::ZSTD, EncodingType::GZIP};
+  EXPECT_EQ(want, ParseAcceptEncoding("zstd, gzip"));
 }
 
 TEST(COmpressUtilTest, PickEncoding) {
@@ -90,6 +101,8 @@ TEST(CompressUtilTest, GetEncodingFromHeader) {
   EXPECT_EQ(EncodingType::GZIP, GetEncodingFromHeader("deflate, gzip"));
   EXPECT_EQ(EncodingType::LZMA2, GetEncodingFromHeader("lzma2"));
   EXPECT_EQ(EncodingType::LZMA2, GetEncodingFromHeader("deflate,lzma2"));
+  EXPECT_EQ(EncodingType::ZSTD, GetEncodingFromHeader("zstd"));
+  EXPECT_EQ(EncodingType::ZSTD, GetEncodingFromHeader("gzip, zstd"));
   EXPECT_EQ(EncodingType::NO_ENCODING, GetEncodingFromHeader(""));
   EXPECT_EQ(EncodingType::NO_ENCODING, GetEncodingFromHeader(nullptr));
 }
@@ -271,4 +284,255 @@ TEST_F(LZMATest, LZMAStreamEndToEnd) {
 
 #endif
 
+#ifdef ENABLE_ZSTD
+namespace {
+
+// zstd dictionary (id=32768) trained by
+//   zstd --train --maxdict=512 --dictID=32768
+// with 1000 serialized ExecReqs made by MakeTestExecReq.
+const unsigned char kTestZstdDictionary[] = {
+    0x37, 0xa4, 0x30, 0xec, 0x00, 0x80, 0x00, 0x00, 0x1d, 0x10, 0xd0, 0x0a,
+    0x52, 0x48, 0x07, 0xff, 0xff, 0xff, 0xff, 0xff, 0x3f, 0x6a, 0x5e, 0xd9,
+    0xea, 0xc2, 0x64, 0xef, 0xbd, 0xf7, 0x96, 0xf9, 0x50, 0x11, 0xac, 0xf1,
+    0xee, 0x09, 0xb3, 0x0a, 0x00, 0xc0, 0x72, 0x10, 0x91, 0xc3, 0x30, 0x00,
+    0x00, 0x04, 0x20, 0x42, 0xc3, 0x83, 0x85, 0x41, 0x02, 0xc4, 0x84, 0xd0,
+    0x02, 0x00, 0x00, 0x44, 0x42, 0x02, 0x00, 0x0f, 0x8a, 0xa1, 0x00, 0xb8,
+    0x15, 0x07, 0x80, 0x08, 0x30, 0x90, 0x42, 0x00, 0x80, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x54, 0x67, 0xb2, 0x4f, 0x9d, 0x21, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x01, 0x00,
+    0x00, 0x00, 0x04, 0x00, 0x00, 0x00, 0x08, 0x00, 0x00, 0x00, 0x74, 0x68,
+    0x69, 0x72, 0x64, 0x5f, 0x70, 0x61, 0x72, 0x74, 0x79, 0x2f, 0x68, 0x65,
+    0x61, 0x64, 0x65, 0x72, 0x33, 0x32, 0x2e, 0x68, 0x62, 0x09, 0x68, 0x61,
+    0x73, 0x68, 0x38, 0x31, 0x33, 0x31, 0x34, 0x54, 0x53, 0x5a, 0x14, 0x2e,
+    0x2e, 0x2f, 0x2e, 0x2e, 0x2f, 0x73, 0x72, 0x63, 0x2f, 0x68, 0x65, 0x61,
+    0x64, 0x65, 0x72, 0x34, 0x35, 0x2e, 0x68, 0x62, 0x09, 0x68, 0x61, 0x73,
+    0x68, 0x65, 0x61, 0x64, 0x65, 0x72, 0x34, 0x30, 0x2e, 0x68, 0x62, 0x09,
+    0x68, 0x61, 0x73, 0x68, 0x39, 0x33, 0x38, 0x30, 0x35, 0x54, 0x53, 0x5a,
+    0x14, 0x2e, 0x2e, 0x2f, 0x2e, 0x2e, 0x2f, 0x73, 0x72, 0x63, 0x2f, 0x68,
+    0x65, 0x61, 0x64, 0x65, 0x72, 0x32, 0x38, 0x2e, 0x68, 0x62, 0x09, 0x68,
+    0x61, 0x73, 0x6e, 0x75, 0x12, 0x07, 0x63, 0x6c, 0x61, 0x6e, 0x67, 0x2b,
+    0x2b, 0x12, 0x02, 0x2d, 0x63, 0x12, 0x13, 0x2e, 0x2e, 0x2f, 0x2e, 0x2e,
+    0x2f, 0x73, 0x72, 0x63, 0x2f, 0x66, 0x6f, 0x6f, 0x36, 0x31, 0x39, 0x2e,
+    0x63, 0x63, 0x12, 0x02, 0x2d, 0x6f, 0x12, 0x10, 0x6f, 0x62, 0x6a, 0x2f,
+    0x73, 0x72, 0x63, 0x2f, 0x2f, 0x68, 0x65, 0x61, 0x64, 0x65, 0x72, 0x33,
+    0x30, 0x2e, 0x68, 0x62, 0x09, 0x68, 0x61, 0x73, 0x68, 0x35, 0x38, 0x30,
+    0x31, 0x31, 0x54, 0x53, 0x5a, 0x14, 0x2e, 0x2e, 0x2f, 0x2e, 0x2e, 0x2f,
+    0x73, 0x72, 0x63, 0x2f, 0x68, 0x65, 0x61, 0x64, 0x65, 0x72, 0x31, 0x30,
+    0x2e, 0x68, 0x62, 0x09, 0x68, 0x61, 0x2f, 0x68, 0x65, 0x61, 0x64, 0x65,
+    0x72, 0x32, 0x30, 0x2e, 0x68, 0x62, 0x09, 0x68, 0x61, 0x73, 0x68, 0x37,
+    0x33, 0x34, 0x30, 0x35, 0x54, 0x53, 0x5a, 0x13, 0x2e, 0x2e, 0x2f, 0x2e,
+    0x2e, 0x2f, 0x73, 0x72, 0x63, 0x2f, 0x68, 0x65, 0x61, 0x64, 0x65, 0x72,
+    0x34, 0x2e, 0x68, 0x62, 0x09, 0x68, 0x61, 0x73, 0x2f, 0x2e, 0x2e, 0x2f,
+    0x74, 0x68, 0x69, 0x72, 0x64, 0x5f, 0x70, 0x61, 0x72, 0x74, 0x79, 0x2f,
+    0x6c, 0x69, 0x62, 0x31, 0x34, 0x22, 0x1a, 0x2f, 0x68, 0x6f, 0x6d, 0x65,
+    0x2f, 0x67, 0x6f, 0x6d, 0x61, 0x2f, 0x73, 0x72, 0x63, 0x2f, 0x6f, 0x75,
+    0x74, 0x2f, 0x52, 0x65, 0x6c, 0x65, 0x61, 0x73, 0x65, 0x53, 0x36, 0x2e,
+    0x68, 0x62, 0x09, 0x68, 0x61, 0x73, 0x68, 0x32, 0x39, 0x34, 0x31, 0x39,
+    0x54, 0x0a, 0x40, 0x0a, 0x07, 0x63, 0x6c, 0x61, 0x6e, 0x67, 0x2b, 0x2b,
+    0x12, 0x1b, 0x34, 0x2e, 0x32, 0x2e, 0x31, 0x5b, 0x63, 0x6c, 0x61, 0x6e,
+    0x67, 0x20, 0x76, 0x65, 0x72, 0x73, 0x69, 0x6f, 0x6e, 0x20, 0x31, 0x32,
+    0x73, 0x69, 0x6f, 0x6e, 0x20, 0x31, 0x32, 0x2e, 0x30, 0x2e, 0x30, 0x5d,
+    0x1a, 0x18, 0x78, 0x38, 0x36, 0x5f, 0x36, 0x34, 0x2d, 0x75, 0x6e, 0x6b,
+    0x6e, 0x6f, 0x77, 0x6e, 0x2d, 0x6c, 0x69, 0x6e,
+};
+
+std::string TestZstdDictionary() {
+  return std::string(reinterpret_cast<const char*>(kTestZstdDictionary),
+                     sizeof kTestZstdDictionary);
+}
+
+ExecReq MakeTestExecReq(int i) {
+  ExecReq req;
+  req.mutable_command_spec()->set_name("clang++");
+  req.mutable_command_spec()->set_version("4.2.1[clang version 12.0.0]");
+  req.mutable_command_spec()->set_target("x86_64-unknown-linux-gnu");
+  req.add_arg("clang++");
+  req.add_arg("-c");
+  req.add_arg(absl::StrCat("../../src/foo", i, ".cc"));
+  req.add_arg("-o");
+  req.add_arg(absl::StrCat("obj/src/foo", i, ".o"));
+  for (int j = 0; j < 20; ++j) {
+    req.add_arg(absl::StrCat("-I../../third_party/lib", (i + j) % 30));
+    ExecReq_Input* input = req.add_input();
+    input->set_filename(absl::StrCat("../../src/header", (i * j) % 50, ".h"));
+    input->set_hash_key(absl::StrCat("hash", i * 100 + j));
+  }
+  req.set_cwd("/home/goma/src/out/Release");
+  return req;
+}
+
+// Compresses |input| to zstd, with |buffer_size| of ZstdOutputStream.
+std::string ZstdCompress(absl::string_view input, size_t buffer_size,
+                         const ZstdDictionary* dictionary) {
+  std::string compressed;
+  google::protobuf::io::StringOutputStream output(&compressed);
+  ZstdOutputStream::Options options;
+  options.buffer_size = buffer_size;
+  options.dictionary = dictionary;
+  ZstdOutputStream zstd_output(&output, options);
+  while (!input.empty()) {
+    void* data;
+    int size;
+    CHECK(zstd_output.Next(&data, &size));
+    const size_t n = std::min<size_t>(size, input.size());
+    memcpy(data, input.data(), n);
+    zstd_output.BackUp(size - n);
+    input.remove_prefix(n);
+  }
+  CHECK(zstd_output.Close()) << zstd_output.ErrorMessage();
+  return compressed;
+}
+
+std::string ReadAll(ZeroCopyInputStream* input) {
+  std::string data;
+  const void* buffer;
+  int size;
+  while (input->Next(&buffer, &size)) {
+    data.append(static_cast<const char*>(buffer), size);
+  }
+  return data;
+}
+
+}  // namespace
+
+TEST(ZstdTest, CompressAndDecompress) {
+  std::string original;
+  for (int i = 0; i < 100000; ++i) {
+    absl::StrAppend(&original, i, " ");
+  }
+  for (size_t buffer_size : {7, 4096, 65536}) {
+    SCOPED_TRACE(buffer_size);
+    const std::string compressed =
+        ZstdCompress(original, buffer_size, nullptr);
+    EXPECT_LT(compressed.size(), original.size() / 2);
+
+    // Feeds compressed data in small chunks.
+    std::vector<std::unique_ptr<ArrayInputStream>> chunks;
+    std::vector<ZeroCopyInputStream*> chunk_ptrs;
+    for (size_t pos = 0; pos < compressed.size(); pos += 100) {
+      chunks.push_back(absl::make_unique<ArrayInputStream>(
+          compressed.data() + pos,
+          std::min<size_t>(100, compressed.size() - pos)));
+      chunk_ptrs.push_back(chunks.back().get());
+    }
+    ZstdInputStream input(absl::make_unique<ConcatenatingInputStream>(
+        chunk_ptrs.data(), chunk_ptrs.size()));
+    EXPECT_EQ(original, ReadAll(&input));
+    EXPECT_EQ(nullptr, input.ErrorMessage());
+    EXPECT_EQ(static_cast<int64_t>(original.size()), input.ByteCount());
+  }
+}
+
+TEST(ZstdTest, BackUpAndSkip) {
+  const std::string original(200000, 'x');
+  const std::string compressed = ZstdCompress(original, 65536, nullptr);
+  ZstdInputStream input(
+      absl::make_unique<ArrayInputStream>(compressed.data(),
+                                          compressed.size()));
+  const void* data;
+  int size;
+  ASSERT_TRUE(input.Next(&data, &size));
+  ASSERT_GT(size, 10);
+  input.BackUp(10);
+  EXPECT_EQ(size - 10, input.ByteCount());
+  EXPECT_TRUE(input.Skip(1000));
+  EXPECT_EQ(size - 10 + 1000, input.ByteCount());
+  EXPECT_EQ(original.size() - (size - 10 + 1000), ReadAll(&input).size());
+  EXPECT_FALSE(input.Skip(1));
+}
+
+TEST(ZstdTest, Truncated) {
+  std::string original;
+  for (int i = 0; i < 10000; ++i) {
+    absl::StrAppend(&original, i, " ");
+  }
+  const std::string compressed = ZstdCompress(original, 65536, nullptr);
+  ZstdInputStream input(absl::make_unique<ArrayInputStream>(
+      compressed.data(), compressed.size() / 2));
+  EXPECT_GT(original.size(), ReadAll(&input).size());
+}
+
+TEST(ZstdTest, ExecReqWithDictionary) {
+  std::unique_ptr<ZstdDictionary> dictionary =
+      ZstdDictionary::Create(TestZstdDictionary(), 3);
+  ASSERT_NE(nullptr, dictionary);
+  EXPECT_EQ(32768U, dictionary->id());
+  EXPECT_EQ(nullptr, ZstdDictionary::Create("not a dictionary", 3));
+
+  const std::string req = MakeTestExecReq(12345).SerializeAsString();
+  const std::string compressed = ZstdCompress(req, 65536, dictionary.get());
+  const std::string compressed_without_dict =
+      ZstdCompress(req, 65536, nullptr);
+  LOG(INFO) << "ExecReq " << req.size() << " => " << compressed.size()
+            << " with dictionary, " << compressed_without_dict.size()
+            << " without dictionary";
+  EXPECT_LT(compressed.size(), compressed_without_dict.size());
+
+  ZstdInputStream input(
+      absl::make_unique<ArrayInputStream>(compressed.data(),
+                                          compressed.size()),
+      dictionary.get());
+  ExecReq got;
+  EXPECT_TRUE(got.ParseFromZeroCopyStream(&input));
+  EXPECT_EQ(req, got.SerializeAsString());
+
+  // Can't decompress without dictionary.
+  ZstdInputStream input_without_dict(absl::make_unique<ArrayInputStream>(
+      compressed.data(), compressed.size()));
+  ReadAll(&input_without_dict);
+  EXPECT_NE(nullptr, input_without_dict.ErrorMessage());
+}
+
+TEST(ZstdTest, DictionaryOnlyForFrameWithDictionaryID) {
+  std::unique_ptr<ZstdDictionary> dictionary =
+      ZstdDictionary::Create(TestZstdDictionary(), 3);
+  ASSERT_NE(nullptr, dictionary);
+  // The same dictionary content, but other dictionary ID.
+  std::string other_dict = TestZstdDictionary();
+  other_dict[4] = 0x01;
+  std::unique_ptr<ZstdDictionary> other_dictionary =
+      ZstdDictionary::Create(other_dict, 3);
+  ASSERT_NE(nullptr, other_dictionary);
+  ASSERT_NE(dictionary->id(), other_dictionary->id());
+
+  const std::string req = MakeTestExecReq(42).SerializeAsString();
+  const std::string with_dict = ZstdCompress(req, 65536, dictionary.get());
+  const std::string without_dict = ZstdCompress(req, 65536, nullptr);
+  const std::string with_other_dict =
+      ZstdCompress(req, 65536, other_dictionary.get());
+
+  // Frame without dictionary ID is decompressed without dictionary,
+  // even if the stream has dictionary.
+  {
+    ZstdInputStream input(absl::make_unique<ArrayInputStream>(
+                              without_dict.data(), without_dict.size()),
+                          dictionary.get());
+    EXPECT_EQ(req, ReadAll(&input));
+    EXPECT_EQ(nullptr, input.ErrorMessage());
+  }
+
+  // Frame compressed with other dictionary must not be decompressed
+  // with the dictionary.
+  {
+    ZstdInputStream input(absl::make_unique<ArrayInputStream>(
+                              with_other_dict.data(), with_other_dict.size()),
+                          dictionary.get());
+    EXPECT_EQ("", ReadAll(&input));
+    EXPECT_NE(nullptr, input.ErrorMessage());
+  }
+
+  // Frames with and without dictionary in one stream, fed byte by byte
+  // so that frame headers are split.
+  {
+    const std::string frames = with_dict + without_dict + with_dict;
+    ZstdInputStream input(
+        absl::make_unique<ArrayInputStream>(frames.data(), frames.size(), 1),
+        dictionary.get());
+    EXPECT_EQ(req + req + req, ReadAll(&input));
+    EXPECT_EQ(nullptr, input.ErrorMessage());
+  }
+}
+
+#endif  // ENABLE_ZSTD
+
 }  // namespace devtools_goma
@@ -105,17 +105,11 @@ class FileOutputImpl : public FileDataOutput {
   FileOutputImpl& operator=(const FileOutputImpl&) = delete;
 
   bool IsValid() const override { return fd_.valid(); }
-  bool WriteAt(off_t offset, const std::string& content) override {
-    off_t pos = fd_.Seek(offset, devtools_goma::ScopedFd::SeekAbsolute);
-    if (pos < 0 || pos != offset) {
-      PLOG(ERROR) << "seek failed? " << filename_ << " pos=" << pos
-                  << " offset=" << offset;
-      error_ = true;
-      return false;
-    }
+  bool WriteAt(off_t offset, absl::string_view content) override {
     size_t written = 0;
     while (written < content.size()) {
-      int n = fd_.Write(content.data() + written, content.size() - written);
+      ssize_t n = fd_.WriteAt(content.data() + written,
+                              content.size() - written, offset + written);
       if (n < 0) {
         PLOG(WARNING) << "write failed " << filename_;
         error_ = true;
@@ -151,7 +145,7 @@ class StringOutputImpl : public FileDataOutput {
   StringOutputImpl& operator=(const StringOutputImpl&) = delete;
 
   bool IsValid() const override { return buf_ != nullptr; }
-  bool WriteAt(off_t offset, const std::string& content) override {
+  bool WriteAt(off_t offset, absl::string_view content) override {
     if (buf_->size() < offset + content.size()) {
       buf_->resize(offset + content.size());
     }
@@ -4,9 +4,14 @@
 
 #include "lib/file_data_output.h"
 
+#include <stdio.h>
+
 #include <memory>
+#include <string>
 
+#include "base/path.h"
 #include "gtest/gtest.h"
+#include "lib/file_helper.h"
 
 namespace devtools_goma {
 
@@ -21,4 +26,20 @@ TEST(StringOutput, EmptyContent) {
   EXPECT_EQ(buf, content);
 }
 
+TEST(FileOutput, WriteAtOutOfOrder) {
+  const std::string filename =
+      file::JoinPath(testing::TempDir(), "file_output_out_of_order");
+  std::unique_ptr<FileDataOutput> output =
+      FileDataOutput::NewFileOutput(filename, 0644);
+  ASSERT_TRUE(output->IsValid());
+  EXPECT_TRUE(output->WriteAt(6, "world"));
+  EXPECT_TRUE(output->WriteAt(0, "hello "));
+  EXPECT_TRUE(output->Close());
+
+  std::string content;
+  EXPECT_TRUE(ReadFileToString(filename, &content));
+  EXPECT_EQ("hello world", content);
+  remove(filename.c_str());
+}
+
 }  // namespace devtools_goma
@@ -18,6 +18,7 @@
 #include <stack>
 #include <utility>
 
+#include "absl/time/clock.h"
 #include "base/compiler_specific.h"
 #include "glog/logging.h"
 #include "goma_data_util.h"
@@ -34,6 +35,9 @@ const size_t kLargeFileThreshold = 2 * 1024 * 1024UL;  // 2MB
 const off_t kFileChunkSize = 2 * 1024 * 1024L;
 
 const int kNumChunksInStreamRequest = 5;
+// The number of chunks read before computing their hash keys when
+// chunks are not stored in streaming mode.
+const size_t kNumChunksInHashBatch = 8;
 
 }  // anonymous namespace
 
@@ -69,7 +73,9 @@ bool FileServiceClient::CreateFileBlob(const std::string& filename,
   if (file_size > kLargeFileThreshold) {
     ok = CreateFileChunks(reader.get(), file_size, store_large, blob);
   } else {
+    const absl::Time read_start = absl::Now();
     ok = ReadFileContent(reader.get(), 0, file_size, blob);
+    create_file_blob_stats_.read_time += absl::Now() - read_start;
   }
 
   if (ok) {
@@ -245,6 +251,9 @@ bool FileServiceClient::FinishStoreFileTask(
     LOG(WARNING) << "StoreFileTask failed " << num_failed << " chunks";
     return false;
   }
+  for (const auto& hash_key : task->resp().hash_key()) {
+    OnChunkStored(hash_key);
+  }
   return true;
 }
 
@@ -262,64 +271,87 @@ bool FileServiceClient::CreateFileChunks(
       *task->mutable_req()->mutable_requester_info() = *requester_info_;
     }
     std::unique_ptr<AsyncTask<StoreFileReq, StoreFileResp> > in_flight_task;
-    for (off_t offset = 0; offset < size; offset += kFileChunkSize) {
-      FileBlob* chunk = task->mutable_req()->add_blob();
-      int chunk_size = std::min(kFileChunkSize, size - offset);
-      if (!ReadFileContent(fr, offset, chunk_size, chunk)) {
-        LOG(WARNING) << "ReadFile failed."
-                     << " offset=" << offset << " chunk_size=" << chunk_size;
-        return false;
-      }
-      chunk->set_blob_type(FileBlob::FILE_CHUNK);
-      chunk->set_offset(offset);
-      chunk->set_file_size(chunk_size);
-      std::string hash_key = ComputeFileBlobHashKey(*chunk);
-      LOG(INFO) << "chunk hash_key:" << hash_key;
-      blob->add_hash_key(hash_key);
-      if (task->req().blob_size() >= kNumChunksInStreamRequest) {
-        if (!FinishStoreFileTask(std::move(in_flight_task)))
+    for (off_t offset = 0; offset < size;) {
+      std::vector<const FileBlob*> chunks;
+      for (; offset < size &&
+             static_cast<int>(chunks.size()) < kNumChunksInStreamRequest;
+           offset += kFileChunkSize) {
+        FileBlob* chunk = task->mutable_req()->add_blob();
+        if (!ReadFileChunk(fr, offset, size, chunk)) {
           return false;
-        task->Run();
-        in_flight_task = std::move(task);
-        task = NewAsyncStoreFileTask();
-        if (requester_info_ != nullptr) {
-          *task->mutable_req()->mutable_requester_info() = *requester_info_;
         }
+        chunks.push_back(chunk);
+      }
+      const int first_chunk = blob->hash_key_size();
+      AddChunkHashKeys(chunks, blob);
+      // Drop chunks known to be stored from the request.
+      auto* req_blobs = task->mutable_req()->mutable_blob();
+      int num_blobs = 0;
+      for (size_t i = 0; i < chunks.size(); ++i) {
+        if (ShouldStoreChunk(blob->hash_key(first_chunk + i))) {
+          req_blobs->SwapElements(num_blobs++, i);
+        }
+      }
+      req_blobs->DeleteSubrange(num_blobs, req_blobs->size() - num_blobs);
+      if (num_blobs == 0) {
+        continue;
+      }
+
+      const absl::Time store_start = absl::Now();
+      bool ok = FinishStoreFileTask(std::move(in_flight_task));
+      create_file_blob_stats_.store_time += absl::Now() - store_start;
+      if (!ok) {
+        return false;
       }
-    }
-    VLOG(1) << "ReadFile done";
-    if (task->req().blob_size() > 0)
       task->Run();
-    else
-      task.reset(nullptr);
-    if (!FinishStoreFileTask(std::move(in_flight_task))) {
-      FinishStoreFileTask(std::move(task));
-      return false;
+      in_flight_task = std::move(task);
+      task = NewAsyncStoreFileTask();
+      if (requester_info_ != nullptr) {
+        *task->mutable_req()->mutable_requester_info() = *requester_info_;
+      }
     }
-    return FinishStoreFileTask(std::move(task));
-  }
-
-  for (off_t offset = 0; offset < size; offset += kFileChunkSize) {
-    StoreFileReq req;
-    StoreFileResp resp;
-    if (requester_info_ != nullptr) {
-      *req.mutable_requester_info() = *requester_info_;
+    VLOG(1) << "ReadFile done";
+    const absl::Time store_start = absl::Now();
+    bool ok = FinishStoreFileTask(std::move(in_flight_task));
+    create_file_blob_stats_.store_time += absl::Now() - store_start;
+    return ok;
+  }
+
+  for (off_t offset = 0; offset < size;) {
+    // Read several chunks at once, so that their hash keys can be
+    // computed concurrently.
+    std::vector<StoreFileReq> reqs;
+    std::vector<const FileBlob*> chunks;
+    reqs.reserve(kNumChunksInHashBatch);
+    for (; offset < size && reqs.size() < kNumChunksInHashBatch;
+         offset += kFileChunkSize) {
+      reqs.emplace_back();
+      FileBlob* chunk = reqs.back().add_blob();
+      if (!ReadFileChunk(fr, offset, size, chunk)) {
+        return false;
+      }
+      chunks.push_back(chunk);
     }
-    FileBlob* chunk = req.add_blob();
-    int chunk_size = std::min(kFileChunkSize, size - offset);
-    if (!ReadFileContent(fr, offset, chunk_size, chunk)) {
-      LOG(WARNING) << "ReadFile failed."
-                   << " offset=" << offset << " chunk_size=" << chunk_size;
-      return false;
+    const int first_chunk = blob->hash_key_size();
+    AddChunkHashKeys(chunks, blob);
+    if (!store) {
+      continue;
     }
-    chunk->set_blob_type(FileBlob::FILE_CHUNK);
-    chunk->set_offset(offset);
-    chunk->set_file_size(chunk_size);
-    std::string hash_key = ComputeFileBlobHashKey(*chunk);
-    VLOG(1) << "chunk hash_key:" << hash_key;
-    blob->add_hash_key(hash_key);
-    if (store) {
-      if (!StoreFile(&req, &resp)) {
+
+    for (size_t i = 0; i < reqs.size(); ++i) {
+      StoreFileReq* req = &reqs[i];
+      StoreFileResp resp;
+      if (requester_info_ != nullptr) {
+        *req->mutable_requester_info() = *requester_info_;
+      }
+      const std::string& hash_key = blob->hash_key(first_chunk + i);
+      if (!ShouldStoreChunk(hash_key)) {
+        continue;
+      }
+      const absl::Time store_start = absl::Now();
+      bool ok = StoreFile(req, &resp);
+      create_file_blob_stats_.store_time += absl::Now() - store_start;
+      if (!ok) {
         LOG(WARNING) << "StoreFile failed";
         return false;
       }
@@ -328,11 +360,64 @@ bool FileServiceClient::CreateFileChunks(
                      << "!=" << hash_key;
         return false;
       }
+      OnChunkStored(hash_key);
     }
   }
   return true;
 }
 
+bool FileServiceClient::ShouldStoreChunk(const std::string& hash_key) {
+  ++create_file_blob_stats_.num_chunks;
+  if (skip_stored_chunks_ && IsChunkStored(hash_key)) {
+    VLOG(1) << "chunk already stored:" << hash_key;
+    ++create_file_blob_stats_.num_skipped_chunks;
+    return false;
+  }
+  return true;
+}
+
+bool FileServiceClient::ReadFileChunk(FileReader* fr,
+                                      off_t offset,
+                                      off_t size,
+                                      FileBlob* chunk) {
+  const absl::Time read_start = absl::Now();
+  int chunk_size = std::min(kFileChunkSize, size - offset);
+  bool ok = ReadFileContent(fr, offset, chunk_size, chunk);
+  create_file_blob_stats_.read_time += absl::Now() - read_start;
+  if (!ok) {
+    LOG(WARNING) << "ReadFile failed."
+                 << " offset=" << offset << " chunk_size=" << chunk_size;
+    return false;
+  }
+  chunk->set_blob_type(FileBlob::FILE_CHUNK);
+  chunk->set_offset(offset);
+  chunk->set_file_size(chunk_size);
+  return true;
+}
+
+void FileServiceClient::AddChunkHashKeys(
+    const std::vector<const FileBlob*>& chunks,
+    FileBlob* blob) {
+  const absl::Time hash_start = absl::Now();
+  std::vector<std::string> hash_keys = ComputeChunkHashKeys(chunks);
+  create_file_blob_stats_.hash_time += absl::Now() - hash_start;
+  DCHECK_EQ(chunks.size(), hash_keys.size());
+  for (auto& hash_key : hash_keys) {
+    VLOG(1) << "chunk hash_key:" << hash_key;
+    blob->add_hash_key(std::move(hash_key));
+  }
+}
+
+std::vector<std::string> FileServiceClient::ComputeChunkHashKeys(
+    const std::vector<const FileBlob*>& chunks) {
+  std::vector<std::string> hash_keys;
+  hash_keys.reserve(chunks.size());
+  for (const auto* chunk : chunks) {
+    hash_keys.push_back(ComputeFileBlobHashKey(*chunk));
+  }
+  return hash_keys;
+}
+
 bool FileServiceClient::ReadFileContent(FileReader* fr,
                                         off_t offset, off_t chunk_size,
                                         FileBlob* blob) {
@@ -10,6 +10,7 @@
 #include <string>
 #include <vector>
 
+#include "absl/time/time.h"
 #include "lib/file_reader.h"
 #include "lib/goma_data.pb.h"
 
@@ -56,6 +57,17 @@ class FileServiceClient {
     Resp resp_;
   };
 
+  // Time spent in each stage of CreateFileBlob.
+  struct CreateFileBlobStats {
+    absl::Duration read_time;
+    absl::Duration hash_time;
+    absl::Duration store_time;
+    // The number of file chunks to be stored, and the number of them
+    // skipped because they were known to be stored already.
+    int num_chunks = 0;
+    int num_skipped_chunks = 0;
+  };
+
   FileServiceClient()
       : reader_factory_(FileReaderFactory::GetInstance()) {}
   virtual ~FileServiceClient() {}
@@ -109,7 +121,28 @@ class FileServiceClient {
   virtual bool StoreFile(const StoreFileReq* req, StoreFileResp* resp) = 0;
   virtual bool LookupFile(const LookupFileReq* req, LookupFileResp* resp) = 0;
 
+  // If |skip| is false, CreateFileBlob stores all file chunks even if
+  // IsChunkStored() returns true for them, e.g. when the server reported
+  // that the file is missing. true by default.
+  void set_skip_stored_chunks(bool skip) { skip_stored_chunks_ = skip; }
+
+  // Accumulated stats of CreateFileBlob calls on this instance.
+  const CreateFileBlobStats& create_file_blob_stats() const {
+    return create_file_blob_stats_;
+  }
+
  protected:
+  // Returns hash keys of |chunks|, in the same order.
+  // Subclass may compute them concurrently.
+  virtual std::vector<std::string> ComputeChunkHashKeys(
+      const std::vector<const FileBlob*>& chunks);
+
+  // Returns true if a file chunk of |hash_key| is known to be stored in
+  // file service, so it doesn't need to be stored again.
+  virtual bool IsChunkStored(const std::string& hash_key) { return false; }
+  // Called when a file chunk of |hash_key| has been stored.
+  virtual void OnChunkStored(const std::string& hash_key) {}
+
   FileReaderFactory* reader_factory_;
   std::unique_ptr<RequesterInfo> requester_info_;
   std::string trace_id_;
@@ -124,6 +157,14 @@ class FileServiceClient {
                         off_t size, bool store, FileBlob* blob);
   bool ReadFileContent(FileReader* fr,
                        off_t offset, off_t size, FileBlob* blob);
+  // Reads FILE_CHUNK at |offset| of the file of |size| to |chunk|.
+  bool ReadFileChunk(FileReader* fr, off_t offset, off_t size,
+                     FileBlob* chunk);
+  // Computes hash keys of |chunks| and adds them to |blob|.
+  void AddChunkHashKeys(const std::vector<const FileBlob*>& chunks,
+                        FileBlob* blob);
+  // Returns true if a file chunk of |hash_key| needs to be stored.
+  bool ShouldStoreChunk(const std::string& hash_key);
 
   bool OutputLookupFileResp(const LookupFileReq& req,
                             const LookupFileResp& resp,
@@ -132,6 +173,9 @@ class FileServiceClient {
       std::unique_ptr<AsyncTask<LookupFileReq, LookupFileResp>> task,
       FileDataOutput* output);
   bool OutputFileChunks(const FileBlob& blob, FileDataOutput* output);
+
+  CreateFileBlobStats create_file_blob_stats_;
+  bool skip_stored_chunks_ = true;
 };
 
 }  // namespace devtools_goma
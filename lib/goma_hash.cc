@@ -8,8 +8,9 @@
 #include <stdio.h>
 
 #include <cstdint>
+#include <memory>
 
-#include "lib/file_helper.h"
+#include "lib/scoped_fd.h"
 #include "openssl/sha.h"  // BoringSSL
 
 #ifndef OPENSSL_IS_BORINGSSL
@@ -18,6 +19,8 @@
 
 namespace {
 
+constexpr size_t kReadBufferSize = 1024 * 1024;
+
 static const std::uint8_t kAsciiToInt[256] = {
     16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16,
     16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16,
@@ -92,9 +95,23 @@ void ComputeDataHashKey(absl::string_view data, std::string* md_str) {
 }
 
 bool GomaSha256FromFile(const std::string& filename, std::string* md_str) {
-  std::string s;
-  if (!ReadFileToString(filename, &s)) return false;
-  ComputeDataHashKey(s, md_str);
+  // Hash the file while reading it, instead of holding the whole content
+  // of large files (e.g. PCH or cache files) in memory.
+  ScopedFd fd(ScopedFd::OpenForRead(filename));
+  if (!fd.valid()) return false;
+
+  SHA256_CTX sha256;
+  SHA256_Init(&sha256);
+  std::unique_ptr<char[]> buf(new char[kReadBufferSize]);
+  for (;;) {
+    ssize_t n = fd.Read(buf.get(), kReadBufferSize);
+    if (n < 0) return false;
+    if (n == 0) break;
+    SHA256_Update(&sha256, buf.get(), n);
+  }
+  SHA256HashValue value;
+  SHA256_Final(value.mutable_data(), &sha256);
+  *md_str = value.ToHexString();
   return true;
 }
 
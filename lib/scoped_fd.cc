@@ -5,6 +5,7 @@
 
 #include "lib/scoped_fd.h"
 
+#include "absl/container/inlined_vector.h"
 #include "absl/strings/string_view.h"
 #include "base/compiler_specific.h"
 #include "glog/logging.h"
@@ -22,6 +23,7 @@
 # include <sys/socket.h>
 # include <sys/stat.h>
 # include <sys/types.h>
+# include <sys/uio.h>
 # include <unistd.h>
 #endif
 
@@ -227,6 +229,27 @@ ssize_t ScopedFd::Write(const void* ptr, size_t len) const {
 #endif
 }
 
+ssize_t ScopedFd::WriteAt(const void* ptr, size_t len, off_t offset) const {
+#ifndef _WIN32
+  ssize_t r = 0;
+  while ((r = pwrite(fd_, ptr, len, offset)) < 0) {
+    if (errno != EINTR) break;
+  }
+  return r;
+#else
+  OVERLAPPED overlapped = {};
+  overlapped.Offset = static_cast<DWORD>(offset);
+  overlapped.OffsetHigh =
+      static_cast<DWORD>(static_cast<uint64_t>(offset) >> 32);
+  DWORD bytes_written = 0;
+  if (!WriteFile(fd_, ptr, len, &bytes_written, &overlapped)) {
+    LOG_SYSRESULT(GetLastError());
+    return -1;
+  }
+  return bytes_written;
+#endif
+}
+
 off_t ScopedFd::Seek(off_t offset, Whence whence) const {
 #ifndef _WIN32
   return lseek(fd_, offset, whence);
@@ -264,6 +287,22 @@ bool ScopedFd::GetFileSize(size_t* file_size) const {
 #endif
 }
 
+bool ScopedFd::Sync() const {
+#ifndef _WIN32
+  int r = 0;
+  while ((r = fsync(fd_)) < 0) {
+    if (errno != EINTR) break;
+  }
+  return r == 0;
+#else
+  if (!FlushFileBuffers(fd_)) {
+    LOG_SYSRESULT(GetLastError());
+    return false;
+  }
+  return true;
+#endif
+}
+
 void ScopedFd::reset(ScopedFd::FileDescriptor fd) {
   Close();
   fd_ = fd;
@@ -343,6 +382,29 @@ ssize_t ScopedSocket::Write(const void* ptr, size_t len) const {
 #endif
 }
 
+ssize_t ScopedSocket::Writev(absl::Span<const absl::string_view> bufs) const {
+#ifndef _WIN32
+  absl::InlinedVector<struct iovec, 16> iov(bufs.size());
+  for (size_t i = 0; i < bufs.size(); ++i) {
+    iov[i].iov_base = const_cast<char*>(bufs[i].data());
+    iov[i].iov_len = bufs[i].size();
+  }
+  return writev(fd_, iov.data(), iov.size());
+#else
+  absl::InlinedVector<WSABUF, 16> wsabufs(bufs.size());
+  for (size_t i = 0; i < bufs.size(); ++i) {
+    wsabufs[i].buf = const_cast<char*>(bufs[i].data());
+    wsabufs[i].len = bufs[i].size();
+  }
+  DWORD bytes_sent = 0;
+  if (WSASend(fd_, wsabufs.data(), wsabufs.size(), &bytes_sent, 0, nullptr,
+              nullptr) != 0) {
+    return -1;
+  }
+  return bytes_sent;
+#endif
+}
+
 bool ScopedSocket::Close() {
   if (valid()) {
 #ifndef _WIN32
@@ -21,6 +21,7 @@
 
 #include "absl/strings/string_view.h"
 #include "absl/time/time.h"
+#include "absl/types/span.h"
 
 namespace devtools_goma {
 
@@ -69,8 +70,13 @@ class ScopedFd {
 
   ssize_t Read(void* ptr, size_t len) const;
   ssize_t Write(const void* ptr, size_t len) const;
+  // Writes at |offset| by one system call (pwrite or WriteFile with
+  // OVERLAPPED).  The file offset may not be updated.
+  ssize_t WriteAt(const void* ptr, size_t len, off_t offset) const;
   off_t Seek(off_t offset, Whence whence) const;
   bool GetFileSize(size_t* file_size) const;
+  // Flushes written data to the storage device (fsync or FlushFileBuffers).
+  bool Sync() const;
 
   // Returns a pointer to the internal representation.
   FileDescriptor* ptr() { return &fd_; }
@@ -158,6 +164,8 @@ class ScopedSocket : public IOChannel {
 
   ssize_t Read(void* ptr, size_t len) const override;
   ssize_t Write(const void* ptr, size_t len) const override;
+  // Writes |bufs| by one system call (writev or WSASend).
+  ssize_t Writev(absl::Span<const absl::string_view> bufs) const;
   ssize_t ReadWithTimeout(char* buf,
                           size_t bufsize,
                           absl::Duration timeout) const override;